@@ -0,0 +1,316 @@
+/* KallistiOS ##version##
+
+   httpd/httpd.h
+   Copyright (C) 2026 The KOS Team and contributors.
+*/
+
+#ifndef __HTTPD_HTTPD_H
+#define __HTTPD_HTTPD_H
+
+#include <sys/cdefs.h>
+__BEGIN_DECLS
+
+#include <kos/cdefs.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/** \file   httpd/httpd.h
+    \brief  Embedded HTTP/1.1 server.
+
+    This file defines the API provided by libhttpd, a small HTTP/1.1 server
+    meant to be built into a program to serve things like status pages and
+    diagnostics, along with whatever static files go with them.
+
+    The server runs all of its connections from one thread, with poll(). That
+    can be a thread of its own (see httpd_start()), or the program can call
+    httpd_poll() from a loop of its own. Connections are kept open between
+    requests, and pipelined requests are answered in the order they came in.
+
+    Requests are passed to handlers, which are picked by the method and the
+    start of the path (see httpd_route()). A handler answers the request with
+    one of httpd_respond(), httpd_respond_chunked() (followed by any number of
+    calls to httpd_chunk()), or httpd_send_file(), before it returns. Since
+    everything runs on one thread, handlers should not block.
+
+    Files are sent a piece at a time as the connection can take them, not read
+    in all at once. If the filesystem can map the file into memory (as the
+    romdisk can), it's sent straight from there. Otherwise (on the CD, for
+    instance), it's read a block at a time into a small buffer. Range requests
+    and HEAD are taken care of for files.
+*/
+
+/** \brief  A HTTP server.
+
+    This is an opaque structure, created with httpd_create().
+
+    \headerfile httpd/httpd.h
+*/
+typedef struct httpd httpd_t;
+
+/** \brief  A request being handled.
+
+    Handlers are given one of these for each request. The strings in it are
+    only good until the handler returns.
+
+    \headerfile httpd/httpd.h
+*/
+typedef struct httpd_req {
+    const char *method;             /**< \brief Method ("GET", "POST", etc) */
+    const char *path;               /**< \brief Path, not including the query
+                                                string (not decoded) */
+    const char *query;              /**< \brief Query string (without the '?'),
+                                                or NULL */
+    int version;                    /**< \brief Minor HTTP version (0 or 1) */
+    const uint8_t *body;            /**< \brief Request body, or NULL */
+    size_t body_len;                /**< \brief Length of the body */
+
+    /** \brief  Private data. Don't touch. */
+    struct httpd_conn *conn;
+} httpd_req_t;
+
+/** \brief  Request handler.
+
+    \param  req             The request to handle.
+    \param  data            The data given to httpd_route().
+    \return                 0 if the request was answered, or <0 on error. If a
+                            handler returns an error without having answered,
+                            the server sends a 500 error for it.
+*/
+typedef int (*httpd_handler_t)(httpd_req_t *req, void *data);
+
+/** \brief  Server parameters.
+
+    A zero in any of these means to use the default for it.
+
+    \headerfile httpd/httpd.h
+*/
+typedef struct httpd_params {
+    uint16_t port;                  /**< \brief Port to listen on (default 80) */
+    uint16_t max_conns;             /**< \brief Connections open at once
+                                                (default 8) */
+    uint32_t idle_timeout;          /**< \brief Time before an idle connection
+                                                is closed, in milliseconds
+                                                (default 15 seconds) */
+    uint32_t max_requests;          /**< \brief Requests answered on one
+                                                connection before it is closed
+                                                (default 1000) */
+    uint32_t max_request_size;      /**< \brief Largest request, including its
+                                                headers and body (default
+                                                8192) */
+} httpd_params_t;
+
+/** \brief  Server statistics.
+    \headerfile httpd/httpd.h
+*/
+typedef struct httpd_stats {
+    uint32_t conns_accepted;        /**< \brief Connections accepted */
+    uint32_t conns_open;            /**< \brief Connections open right now */
+    uint32_t conns_timed_out;       /**< \brief Connections closed for being
+                                                idle */
+    uint32_t requests;              /**< \brief Requests answered */
+    uint32_t requests_bad;          /**< \brief Requests that couldn't be
+                                                parsed, or were too big */
+    uint64_t bytes_sent;            /**< \brief Bytes sent, in total */
+    uint64_t file_bytes_mapped;     /**< \brief Bytes sent straight from mapped
+                                                files */
+    uint64_t file_bytes_read;       /**< \brief Bytes of files read in to send
+                                                them */
+} httpd_stats_t;
+
+/** \brief  Create a HTTP server.
+
+    This sets up the listening socket, but doesn't handle anything until the
+    server is started with httpd_start() or polled with httpd_poll().
+
+    \param  params          Server parameters, or NULL for the defaults.
+    \return                 The new server, or NULL on error (errno is set).
+
+    \par    Error Conditions:
+    \em     ENOMEM - out of memory \n
+    \em     Anything that socket(), bind(), or listen() can set.
+*/
+httpd_t *httpd_create(const httpd_params_t *params);
+
+/** \brief  Destroy a HTTP server.
+
+    This stops the server if it is running, closes all of its connections, and
+    frees everything it uses.
+
+    \param  srv             The server to destroy.
+*/
+void httpd_destroy(httpd_t *srv);
+
+/** \brief  Add a request handler.
+
+    Requests go to the handler with the longest prefix that matches the start
+    of the path. If that handler was added for a different method, the request
+    gets a 405 error. If nothing matches, it gets a 404. A handler for GET also
+    gets HEAD requests, and the server leaves off the body it sends for them.
+    Handlers should all be added before the server is started.
+
+    \param  srv             The server.
+    \param  method          Method to handle ("GET", "POST", etc), or NULL for
+                            all of them.
+    \param  prefix          What the path must start with ("/" for everything).
+    \param  handler         The handler.
+    \param  data            Passed to the handler.
+    \retval 0               On success.
+    \retval -1              On error (errno is set).
+
+    \par    Error Conditions:
+    \em     EINVAL - the prefix doesn't start with '/' \n
+    \em     ENOMEM - out of memory
+*/
+int httpd_route(httpd_t *srv, const char *method, const char *prefix,
+                httpd_handler_t handler, void *data);
+
+/** \brief  Serve files from a directory.
+
+    This adds a GET handler for the prefix, which serves the rest of the path
+    from the directory (for instance, with a prefix of "/static" and a
+    directory of "/rd", "/static/x.png" is "/rd/x.png"). A path ending in '/'
+    gets "index.html" from that directory. Paths with ".." in them are refused.
+    HEAD works as well.
+
+    \param  srv             The server.
+    \param  prefix          Start of the paths to serve.
+    \param  dir             Directory to serve them from.
+    \retval 0               On success.
+    \retval -1              On error (errno is set).
+*/
+int httpd_serve_files(httpd_t *srv, const char *prefix, const char *dir);
+
+/** \brief  Start a HTTP server on a thread of its own.
+    \param  srv             The server.
+    \retval 0               On success.
+    \retval -1              If the thread couldn't be created, or the server
+                            is already running.
+*/
+int httpd_start(httpd_t *srv);
+
+/** \brief  Stop a server started with httpd_start().
+
+    This waits for the server's thread to finish. Connections stay open, and
+    pick up where they left off if the server is started again.
+
+    \param  srv             The server.
+*/
+void httpd_stop(httpd_t *srv);
+
+/** \brief  Handle whatever is ready on a server's connections.
+
+    This is for running the server from a loop of the program's own, instead
+    of with httpd_start(). It waits up to the timeout for something to happen,
+    then handles everything that has.
+
+    \param  srv             The server.
+    \param  timeout         How long to wait, in milliseconds (-1 for as long
+                            as it takes, 0 to not wait at all).
+    \retval 0               On success.
+    \retval -1              If poll() failed (errno is set).
+*/
+int httpd_poll(httpd_t *srv, int timeout);
+
+/** \brief  Retrieve a server's statistics.
+    \param  srv             The server.
+    \return                 A copy of the statistics.
+*/
+httpd_stats_t httpd_get_stats(httpd_t *srv);
+
+/** \brief  Look up a request header.
+    \param  req             The request.
+    \param  name            Name of the header (not case sensitive).
+    \return                 The value of the header, or NULL if the request
+                            doesn't have it.
+*/
+const char *httpd_header(httpd_req_t *req, const char *name);
+
+/** \brief  Add a header to the response.
+
+    This has to be done before the response is started. The Content-Type,
+    Content-Length, Transfer-Encoding, and Connection headers are taken care
+    of by the server.
+
+    \param  req             The request being answered.
+    \param  name            Name of the header.
+    \param  value           Value of the header.
+    \retval 0               On success.
+    \retval -1              If the response has already started, or there's
+                            no more room for headers.
+*/
+int httpd_add_header(httpd_req_t *req, const char *name, const char *value);
+
+/** \brief  Answer a request with a response that's all in memory.
+
+    The body is copied, so it doesn't need to stick around after this returns.
+
+    \param  req             The request being answered.
+    \param  status          HTTP status code.
+    \param  type            Content type, or NULL for none.
+    \param  body            The body of the response.
+    \param  len             Length of the body.
+    \retval 0               On success.
+    \retval -1              On error.
+*/
+int httpd_respond(httpd_req_t *req, int status, const char *type,
+                  const void *body, size_t len);
+
+/** \brief  Answer a request with an error page.
+    \param  req             The request being answered.
+    \param  status          HTTP status code.
+    \retval 0               On success.
+    \retval -1              On error.
+*/
+int httpd_respond_error(httpd_req_t *req, int status);
+
+/** \brief  Start a response that's sent a piece at a time.
+
+    The body is sent with chunked encoding, so its length doesn't need to be
+    known up front. HTTP/1.0 clients get the body without any encoding, and the
+    connection is closed after it. Add to the body with httpd_chunk(). It ends
+    when the handler returns.
+
+    \param  req             The request being answered.
+    \param  status          HTTP status code.
+    \param  type            Content type, or NULL for none.
+    \retval 0               On success.
+    \retval -1              On error.
+*/
+int httpd_respond_chunked(httpd_req_t *req, int status, const char *type);
+
+/** \brief  Add to the body of a chunked response.
+    \param  req             The request being answered.
+    \param  data            The data to add.
+    \param  len             Length of the data.
+    \retval 0               On success.
+    \retval -1              If a chunked response hasn't been started, or
+                            on error.
+*/
+int httpd_chunk(httpd_req_t *req, const void *data, size_t len);
+
+/** \brief  Add formatted text to the body of a chunked response.
+    \param  req             The request being answered.
+    \param  fmt             Format string, as for printf().
+    \retval 0               On success.
+    \retval -1              If a chunked response hasn't been started, or
+                            on error.
+*/
+int httpd_chunk_printf(httpd_req_t *req, const char *fmt, ...)
+    __printflike(2, 3);
+
+/** \brief  Answer a request with a file.
+
+    The content type comes from the extension on the file name. A Range header
+    asking for one range of the file gets a 206 response with just that part of
+    it. If the file can't be opened, the request gets a 404 error.
+
+    \param  req             The request being answered.
+    \param  path            The file to send.
+    \retval 0               On success (including sending a 404 error).
+    \retval -1              On error.
+*/
+int httpd_send_file(httpd_req_t *req, const char *path);
+
+__END_DECLS
+
+#endif /* !__HTTPD_HTTPD_H */
@@ -84,7 +84,9 @@ typedef struct ppp_device {
 
         This function will be called periodically to transmit data on the
         underlying device. The data passed in may not necessarily be a whole
-        packet (check the flags to see what's being passed in).
+        packet (check the flags to see what's being passed in). Currently,
+        libppp always passes in a whole HDLC-framed packet at once, with
+        PPP_TX_END_OF_PKT set.
 
         \param  self        The network device in question.
         \param  data        The data to transmit.
@@ -302,6 +304,8 @@ int ppp_lcp_send_proto_reject(uint16_t proto, const uint8_t *pkt, size_t len);
 #define PPP_FLAG_MAGIC_NUMBER   0x00000010  /**< \brief Use magic numbers */
 #define PPP_FLAG_WANT_MRU       0x00000020  /**< \brief Specify MRU */
 #define PPP_FLAG_NO_ACCM        0x00000040  /**< \brief No ctl character map */
+#define PPP_FLAG_NO_VJ          0x00000080  /**< \brief No VJ compression */
+#define PPP_FLAG_NO_CCP         0x00000100  /**< \brief No data compression */
 /** @} */
 
 /** \brief  Get the flags set for our side of the link.
@@ -335,6 +339,38 @@ uint32_t ppp_get_peer_flags(void);
 */
 void ppp_set_flags(uint32_t flags);
 
+/** \brief  PPP data compression statistics.
+
+    This structure holds the counters kept by the Compression Control Protocol
+    (CCP) for the current link. Byte counts include the PPP protocol field of
+    each packet, but none of the framing.
+*/
+typedef struct ppp_ccp_stats {
+    int tx_on;                  /**< \brief Compressing what we send */
+    int rx_on;                  /**< \brief Decompressing what we receive */
+    uint32_t tx_packets;        /**< \brief Packets sent compressed */
+    uint32_t tx_incompressible; /**< \brief Packets sent as they were */
+    uint64_t tx_bytes;          /**< \brief Bytes before compression */
+    uint64_t tx_comp_bytes;     /**< \brief Bytes after compression */
+    uint32_t rx_packets;        /**< \brief Packets decompressed */
+    uint32_t rx_errors;         /**< \brief Corrupt or out of order packets */
+    uint32_t rx_dropped;        /**< \brief Dropped while waiting for a reset */
+    uint64_t rx_bytes;          /**< \brief Bytes after decompression */
+    uint64_t rx_comp_bytes;     /**< \brief Bytes before decompression */
+    uint32_t resets_sent;       /**< \brief Reset-Requests we've sent */
+    uint32_t resets_received;   /**< \brief Reset-Requests from the peer */
+} ppp_ccp_stats_t;
+
+/** \brief  Get the data compression statistics for the link.
+
+    This function retrieves the counters kept by CCP, and whether compression
+    is in use in each direction. Compression is negotiated after IPCP, unless
+    PPP_FLAG_NO_CCP is set.
+
+    \return             A copy of the statistics.
+*/
+ppp_ccp_stats_t ppp_ccp_get_stats(void);
+
 /** \brief  Establish a point-to-point link across a previously set-up device.
 
     This function establishes a point-to-point link to the peer across a device
@@ -0,0 +1,719 @@
+/* KallistiOS ##version##
+
+   libhttpd/httpd.c
+   Copyright (C) 2026 The KOS Team and contributors.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <arch/timer.h>
+
+#include "httpd_internal.h"
+
+/* This file has the server itself: the connections, reading and parsing the
+   requests on them, and passing them off to the handlers. Everything happens
+   on whatever thread calls httpd_poll(), so none of this needs any locking.
+
+   Each connection has a buffer that requests are read into, which is as big
+   as the largest request we'll take. Requests are parsed right in there (the
+   strings in the httpd_req_t point into it), and once one has been answered,
+   whatever came in after it (the next request, if the client is pipelining)
+   is moved up to the start of the buffer. */
+
+/* Largest path (including the directory it's in) httpd_serve_files() will
+   look up. */
+#define FILE_PATH_MAX   256
+
+typedef struct serve_files {
+    size_t prefix_len;
+    char dir[];
+} serve_files_t;
+
+httpd_t *httpd_create(const httpd_params_t *params) {
+    struct sockaddr_in addr;
+    httpd_t *srv;
+    int err;
+
+    if(!(srv = (httpd_t *)calloc(1, sizeof(httpd_t)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if(params)
+        srv->params = *params;
+
+    if(!srv->params.port)
+        srv->params.port = HTTPD_PORT;
+
+    if(!srv->params.max_conns)
+        srv->params.max_conns = HTTPD_MAX_CONNS;
+
+    if(!srv->params.idle_timeout)
+        srv->params.idle_timeout = HTTPD_IDLE_TIMEOUT;
+
+    if(!srv->params.max_requests)
+        srv->params.max_requests = HTTPD_MAX_REQUESTS;
+
+    if(!srv->params.max_request_size)
+        srv->params.max_request_size = HTTPD_MAX_REQUEST_SIZE;
+
+    TAILQ_INIT(&srv->routes);
+    TAILQ_INIT(&srv->conns);
+
+    /* One for each connection, and one for the listening socket. */
+    srv->pfds = (struct pollfd *)malloc(sizeof(struct pollfd) *
+                                        (srv->params.max_conns + 1));
+    srv->pconns = (httpd_conn_t **)malloc(sizeof(httpd_conn_t *) *
+                                          (srv->params.max_conns + 1));
+
+    if(!srv->pfds || !srv->pconns) {
+        errno = ENOMEM;
+        goto out_free;
+    }
+
+    if((srv->sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+        goto out_free;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(srv->params.port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+
+    if(bind(srv->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+       listen(srv->sock, srv->params.max_conns) < 0 ||
+       fcntl(srv->sock, F_SETFL, O_NONBLOCK) < 0)
+        goto out_close;
+
+    return srv;
+
+out_close:
+    err = errno;
+    close(srv->sock);
+    errno = err;
+out_free:
+    free(srv->pconns);
+    free(srv->pfds);
+    free(srv);
+    return NULL;
+}
+
+static void conn_close(httpd_conn_t *c) {
+    httpd_t *srv = c->srv;
+
+    _httpd_file_close(c);
+    close(c->sock);
+
+    TAILQ_REMOVE(&srv->conns, c, entry);
+    --srv->nconns;
+    --srv->stats.conns_open;
+
+    free(c->fbuf);
+    free(c->out);
+    free(c->in);
+    free(c);
+}
+
+void httpd_destroy(httpd_t *srv) {
+    httpd_route_t *r;
+
+    if(!srv)
+        return;
+
+    httpd_stop(srv);
+
+    while(!TAILQ_EMPTY(&srv->conns))
+        conn_close(TAILQ_FIRST(&srv->conns));
+
+    while((r = TAILQ_FIRST(&srv->routes))) {
+        TAILQ_REMOVE(&srv->routes, r, entry);
+
+        if(r->free_data)
+            free(r->data);
+
+        free(r->method);
+        free(r->prefix);
+        free(r);
+    }
+
+    close(srv->sock);
+    free(srv->pconns);
+    free(srv->pfds);
+    free(srv);
+}
+
+static httpd_route_t *route_add(httpd_t *srv, const char *method,
+                                const char *prefix, httpd_handler_t handler,
+                                void *data) {
+    httpd_route_t *r;
+
+    if(!prefix || *prefix != '/' || !handler) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if(!(r = (httpd_route_t *)calloc(1, sizeof(httpd_route_t))))
+        goto out_nomem;
+
+    if(method && !(r->method = strdup(method)))
+        goto out_nomem;
+
+    if(!(r->prefix = strdup(prefix)))
+        goto out_nomem;
+
+    r->prefix_len = strlen(prefix);
+    r->handler = handler;
+    r->data = data;
+    TAILQ_INSERT_TAIL(&srv->routes, r, entry);
+
+    return r;
+
+out_nomem:
+    if(r) {
+        free(r->method);
+        free(r);
+    }
+
+    errno = ENOMEM;
+    return NULL;
+}
+
+int httpd_route(httpd_t *srv, const char *method, const char *prefix,
+                httpd_handler_t handler, void *data) {
+    return route_add(srv, method, prefix, handler, data) ? 0 : -1;
+}
+
+static int hexval(int c) {
+    if(c >= '0' && c <= '9')
+        return c - '0';
+    else if(c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    else if(c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+
+    return -1;
+}
+
+static int serve_files(httpd_req_t *req, void *data) {
+    serve_files_t *sf = (serve_files_t *)data;
+    const char *p = req->path + sf->prefix_len;
+    char path[FILE_PATH_MAX];
+    size_t len;
+    int hi, lo;
+
+    /* Decode the rest of the path onto the end of the directory. */
+    len = strlen(sf->dir);
+    memcpy(path, sf->dir, len);
+
+    if(*p != '/')
+        path[len++] = '/';
+
+    while(*p && len < sizeof(path) - 1) {
+        if(*p == '%') {
+            if((hi = hexval(p[1])) < 0 || (lo = hexval(p[2])) < 0 ||
+               !(hi | lo))
+                return httpd_respond_error(req, 400);
+
+            path[len++] = (char)((hi << 4) | lo);
+            p += 3;
+        }
+        else {
+            path[len++] = *p++;
+        }
+    }
+
+    if(*p)
+        return httpd_respond_error(req, 414);
+
+    path[len] = 0;
+
+    if(strstr(path, ".."))
+        return httpd_respond_error(req, 403);
+
+    if(path[len - 1] == '/') {
+        if(len + 10 >= sizeof(path))
+            return httpd_respond_error(req, 414);
+
+        strcpy(path + len, "index.html");
+    }
+
+    return httpd_send_file(req, path);
+}
+
+int httpd_serve_files(httpd_t *srv, const char *prefix, const char *dir) {
+    serve_files_t *sf;
+    httpd_route_t *r;
+    size_t len = strlen(dir);
+
+    /* Leave off any trailing slashes, the path has one of its own. */
+    while(len > 1 && dir[len - 1] == '/')
+        --len;
+
+    if(len >= FILE_PATH_MAX / 2) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    if(!(sf = (serve_files_t *)malloc(sizeof(serve_files_t) + len + 1))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    sf->prefix_len = strlen(prefix);
+    memcpy(sf->dir, dir, len);
+    sf->dir[len] = 0;
+
+    /* The prefix "/" shouldn't eat the slash at the start of the path. */
+    if(sf->prefix_len && prefix[sf->prefix_len - 1] == '/')
+        --sf->prefix_len;
+
+    if(!(r = route_add(srv, "GET", prefix, serve_files, sf))) {
+        free(sf);
+        return -1;
+    }
+
+    r->free_data = 1;
+    return 0;
+}
+
+static void *httpd_thd(void *data) {
+    httpd_t *srv = (httpd_t *)data;
+
+    while(!srv->stop) {
+        if(httpd_poll(srv, HTTPD_STOP_CHECK) < 0 && errno != EINTR)
+            break;
+    }
+
+    return NULL;
+}
+
+int httpd_start(httpd_t *srv) {
+    if(srv->thd) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    srv->stop = 0;
+
+    if(!(srv->thd = thd_create(0, httpd_thd, srv)))
+        return -1;
+
+    thd_set_label(srv->thd, "[httpd]");
+    return 0;
+}
+
+void httpd_stop(httpd_t *srv) {
+    if(!srv->thd)
+        return;
+
+    srv->stop = 1;
+    thd_join(srv->thd, NULL);
+    srv->thd = NULL;
+}
+
+httpd_stats_t httpd_get_stats(httpd_t *srv) {
+    return srv->stats;
+}
+
+const char *httpd_header(httpd_req_t *req, const char *name) {
+    httpd_conn_t *c = req->conn;
+    int i;
+
+    for(i = 0; i < c->nhdrs; ++i) {
+        if(!strcasecmp(c->hdrs[i * 2], name))
+            return c->hdrs[i * 2 + 1];
+    }
+
+    return NULL;
+}
+
+/* Does a comma separated header value have the given token in it? */
+static int has_token(const char *val, const char *tok) {
+    size_t len = strlen(tok);
+
+    while(val && *val) {
+        while(*val == ' ' || *val == '\t' || *val == ',')
+            ++val;
+
+        if(!strncasecmp(val, tok, len) &&
+           (!val[len] || val[len] == ',' || val[len] == ' ' ||
+            val[len] == '\t'))
+            return 1;
+
+        val = strchr(val, ',');
+    }
+
+    return 0;
+}
+
+/* Parse the request at the start of the input buffer. Returns 1 once the
+   headers are all in and parsed, 0 if they aren't all in yet, or a negated
+   status code if there's something wrong with them. */
+static int parse_request(httpd_conn_t *c) {
+    httpd_req_t *req = &c->req;
+    char *end, *line, *next, *p, *val, *tail;
+    const char *hdr;
+    unsigned long len;
+
+    /* Start from scratch, so that there's something sensible to answer with
+       if this goes wrong. */
+    memset(req, 0, sizeof(httpd_req_t));
+    req->conn = c;
+    req->version = 1;
+    c->nhdrs = 0;
+    c->body_len = 0;
+    c->flags &= ~(CONN_KEEP | CONN_HEAD);
+    c->in[c->in_len] = 0;
+
+    if(!(end = strstr(c->in, "\r\n\r\n")))
+        return 0;
+
+    c->hdr_len = end - c->in + 4;
+
+    /* Request line first: method, target, and version. */
+    line = c->in;
+    p = strstr(line, "\r\n");
+    *p = 0;
+    next = p + 2;
+
+    req->method = line;
+
+    if(!(p = strchr(line, ' ')))
+        return -400;
+
+    *p++ = 0;
+    req->path = p;
+
+    if(!(p = strchr(p, ' ')))
+        return -400;
+
+    *p++ = 0;
+
+    if(strncmp(p, "HTTP/", 5))
+        return -400;
+
+    if(strncmp(p + 5, "1.", 2) || (p[7] != '0' && p[7] != '1') || p[8])
+        return -505;
+
+    req->version = p[7] - '0';
+
+    if(*req->path != '/')
+        return -400;
+
+    if((p = strchr(req->path, '?'))) {
+        *p++ = 0;
+        req->query = p;
+    }
+
+    /* Then the headers. Each one is split at the colon, with the whitespace
+       around the value trimmed off. */
+    line = next;
+
+    while(line < end + 2) {
+        p = strstr(line, "\r\n");
+        *p = 0;
+
+        if(!(val = strchr(line, ':')) || val == line)
+            return -400;
+
+        *val++ = 0;
+
+        while(*val == ' ' || *val == '\t')
+            ++val;
+
+        for(tail = p; tail > val && (tail[-1] == ' ' || tail[-1] == '\t');)
+            *--tail = 0;
+
+        if(c->nhdrs < HTTPD_MAX_HEADERS) {
+            c->hdrs[c->nhdrs * 2] = line;
+            c->hdrs[c->nhdrs * 2 + 1] = val;
+            ++c->nhdrs;
+        }
+
+        line = p + 2;
+    }
+
+    /* Bodies sent with chunked encoding aren't something we take. */
+    if(httpd_header(req, "Transfer-Encoding"))
+        return -501;
+
+    if((hdr = httpd_header(req, "Content-Length"))) {
+        len = strtoul(hdr, &p, 10);
+
+        if(*hdr < '0' || *hdr > '9' || *p)
+            return -400;
+
+        if(len > c->srv->params.max_request_size - c->hdr_len)
+            return -413;
+
+        c->body_len = len;
+    }
+
+    hdr = httpd_header(req, "Connection");
+
+    if(req->version ? !has_token(hdr, "close") : has_token(hdr, "keep-alive"))
+        c->flags |= CONN_KEEP;
+
+    if(c->nreqs + 1 >= c->srv->params.max_requests)
+        c->flags &= ~CONN_KEEP;
+
+    if(!strcmp(req->method, "HEAD"))
+        c->flags |= CONN_HEAD;
+
+    /* If the client is waiting to be told to send the body, tell it. */
+    if(c->body_len && c->in_len < c->hdr_len + c->body_len && req->version &&
+       (hdr = httpd_header(req, "Expect")) && !strcasecmp(hdr, "100-continue"))
+        _httpd_out_append(c, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+
+    c->flags |= CONN_PARSED;
+    return 1;
+}
+
+static void dispatch(httpd_conn_t *c) {
+    httpd_req_t *req = &c->req;
+    httpd_route_t *r, *best = NULL, *any = NULL;
+    int head = c->flags & CONN_HEAD;
+
+    _httpd_resp_reset(c);
+    req->body = c->body_len ? (const uint8_t *)c->in + c->hdr_len : NULL;
+    req->body_len = c->body_len;
+
+    /* Longest prefix wins, but a route for another method only matters if
+       nothing else matches at all. */
+    TAILQ_FOREACH(r, &c->srv->routes, entry) {
+        if(strncmp(req->path, r->prefix, r->prefix_len))
+            continue;
+
+        if(!any || r->prefix_len > any->prefix_len)
+            any = r;
+
+        if(r->method && strcmp(r->method, req->method) &&
+           !(head && !strcmp(r->method, "GET")))
+            continue;
+
+        if(!best || r->prefix_len > best->prefix_len)
+            best = r;
+    }
+
+    if(!best) {
+        _httpd_error(c, any ? 405 : 404);
+        return;
+    }
+
+    best->handler(req, best->data);
+    _httpd_resp_finish(c);
+}
+
+/* Answer whatever complete requests are in the input buffer, as long as
+   there's room for the responses to go. */
+static void process(httpd_conn_t *c) {
+    httpd_t *srv = c->srv;
+    size_t used;
+    int rv;
+
+    while(!(c->flags & CONN_CLOSE) && !c->file_left &&
+          c->out_len - c->out_pos < HTTPD_OUT_HIGH) {
+        if(!(c->flags & CONN_PARSED)) {
+            rv = parse_request(c);
+
+            if(!rv) {
+                if(c->in_len < srv->params.max_request_size)
+                    break;
+
+                rv = -431;
+            }
+
+            if(rv < 0) {
+                ++srv->stats.requests_bad;
+                _httpd_resp_reset(c);
+                c->flags &= ~CONN_KEEP;
+                _httpd_error(c, -rv);
+                c->flags |= CONN_CLOSE;
+                return;
+            }
+        }
+
+        used = c->hdr_len + c->body_len;
+
+        if(c->in_len < used)
+            break;
+
+        dispatch(c);
+        ++srv->stats.requests;
+        ++c->nreqs;
+
+        c->flags &= ~CONN_PARSED;
+        c->in_len -= used;
+        memmove(c->in, c->in + used, c->in_len);
+
+        if(!(c->flags & CONN_KEEP))
+            c->flags |= CONN_CLOSE;
+    }
+
+    /* If the client has stopped sending, whatever's left isn't going to turn
+       into a request. */
+    if((c->flags & CONN_EOF) && !c->file_left &&
+       c->out_len - c->out_pos < HTTPD_OUT_HIGH)
+        c->flags |= CONN_CLOSE;
+}
+
+static int conn_read(httpd_conn_t *c) {
+    ssize_t r;
+
+    r = recv(c->sock, c->in + c->in_len,
+             c->srv->params.max_request_size - c->in_len, MSG_DONTWAIT);
+
+    if(r < 0)
+        return (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR) ?
+               0 : -1;
+    else if(!r)
+        c->flags |= CONN_EOF;
+
+    c->in_len += r;
+    process(c);
+
+    return 0;
+}
+
+static void conn_accept(httpd_t *srv, uint64_t now) {
+    httpd_conn_t *c;
+    int sock, one = 1;
+
+    while(srv->nconns < srv->params.max_conns) {
+        if((sock = accept(srv->sock, NULL, NULL)) < 0)
+            return;
+
+        if(!(c = (httpd_conn_t *)calloc(1, sizeof(httpd_conn_t))) ||
+           !(c->in = (char *)malloc(srv->params.max_request_size + 1))) {
+            free(c);
+            close(sock);
+            return;
+        }
+
+        /* Responses go out in one piece when they can, so there's no point
+           in waiting around to add to them. */
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(sock, F_SETFL, O_NONBLOCK);
+
+        c->srv = srv;
+        c->sock = sock;
+        c->file = FILEHND_INVALID;
+        c->last_active = now;
+        TAILQ_INSERT_TAIL(&srv->conns, c, entry);
+
+        ++srv->nconns;
+        ++srv->stats.conns_accepted;
+        ++srv->stats.conns_open;
+    }
+}
+
+int httpd_poll(httpd_t *srv, int timeout) {
+    httpd_conn_t *c, *tmp;
+    struct pollfd *pfd;
+    uint64_t now;
+    int64_t left;
+    int n = 1, i, rv;
+    short ev;
+
+    srv->pfds[0].fd = srv->sock;
+    srv->pfds[0].events = srv->nconns < srv->params.max_conns ? POLLIN : 0;
+    srv->pfds[0].revents = 0;
+    now = timer_ms_gettime64();
+
+    TAILQ_FOREACH(c, &srv->conns, entry) {
+        ev = 0;
+
+        /* Only read more once there's somewhere to put it. */
+        if(!(c->flags & (CONN_CLOSE | CONN_EOF)) && !c->file_left &&
+           c->out_len - c->out_pos < HTTPD_OUT_HIGH &&
+           c->in_len < srv->params.max_request_size)
+            ev |= POLLIN;
+
+        if(c->out_pos < c->out_len || c->file_left)
+            ev |= POLLOUT;
+
+        pfd = &srv->pfds[n];
+        pfd->fd = c->sock;
+        pfd->events = ev;
+        pfd->revents = 0;
+        srv->pconns[n++] = c;
+
+        /* Don't sleep past when the connection will have been idle for too
+           long. */
+        left = (int64_t)(c->last_active + srv->params.idle_timeout - now);
+
+        if(left < 0)
+            left = 0;
+
+        if(timeout < 0 || left < timeout)
+            timeout = (int)left;
+    }
+
+    if((rv = poll(srv->pfds, n, timeout)) < 0)
+        return -1;
+
+    now = timer_ms_gettime64();
+
+    for(i = 1; i < n && rv; ++i) {
+        c = srv->pconns[i];
+        ev = srv->pfds[i].revents;
+
+        if(!ev)
+            continue;
+
+        --rv;
+        c->last_active = now;
+
+        if(ev & (POLLERR | POLLNVAL)) {
+            conn_close(c);
+            continue;
+        }
+
+        if((ev & POLLOUT) && _httpd_flush(c) < 0) {
+            conn_close(c);
+            continue;
+        }
+
+        if((ev & (POLLIN | POLLHUP)) && !(c->flags & CONN_EOF) &&
+           conn_read(c) < 0) {
+            conn_close(c);
+            continue;
+        }
+
+        /* Anything that was waiting on the output to drain can go now. */
+        if(c->in_len && !(ev & POLLIN))
+            process(c);
+
+        if(_httpd_flush(c) < 0 || ((c->flags & CONN_CLOSE) &&
+                                   c->out_pos == c->out_len && !c->file_left))
+            conn_close(c);
+    }
+
+    if(srv->pfds[0].revents & POLLIN)
+        conn_accept(srv, now);
+
+    /* Close anything that has been sitting around too long. */
+    c = TAILQ_FIRST(&srv->conns);
+
+    while(c) {
+        tmp = TAILQ_NEXT(c, entry);
+
+        if(now - c->last_active >= srv->params.idle_timeout) {
+            ++srv->stats.conns_timed_out;
+            conn_close(c);
+        }
+
+        c = tmp;
+    }
+
+    return 0;
+}
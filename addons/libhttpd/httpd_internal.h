@@ -0,0 +1,135 @@
+/* KallistiOS ##version##
+
+   libhttpd/httpd_internal.h
+   Copyright (C) 2026 The KOS Team and contributors.
+*/
+
+#ifndef __LOCAL_HTTPD_INTERNAL_H
+#define __LOCAL_HTTPD_INTERNAL_H
+
+#include <stdint.h>
+#include <poll.h>
+#include <sys/queue.h>
+
+#include <kos/fs.h>
+#include <kos/thread.h>
+
+#include <httpd/httpd.h>
+
+/* Defaults for the parameters. */
+#define HTTPD_PORT              80
+#define HTTPD_MAX_CONNS         8
+#define HTTPD_IDLE_TIMEOUT      15000
+#define HTTPD_MAX_REQUESTS      1000
+#define HTTPD_MAX_REQUEST_SIZE  8192
+
+/* Most headers we'll look at in a request. Anything past this is ignored. */
+#define HTTPD_MAX_HEADERS       32
+
+/* Room for the headers a handler adds to its response. */
+#define HTTPD_XHDR_SIZE         512
+
+/* Size of the buffer files are read into, when they can't be mapped. */
+#define HTTPD_FILE_BUF          8192
+
+/* Once this much of a response is waiting to go out, pipelined requests wait
+   until some of it has. */
+#define HTTPD_OUT_HIGH          16384
+
+/* How often httpd_start()'s thread checks if it has been asked to stop. */
+#define HTTPD_STOP_CHECK        250
+
+/* Where the current response is at. */
+#define RESP_NONE               0   /* Nothing sent yet */
+#define RESP_DONE               1   /* All of it is queued (or being sent) */
+#define RESP_CHUNKED            2   /* Handler is still adding to it */
+#define RESP_STREAM             3   /* Body with no length, for HTTP/1.0 */
+
+/* Connection flags. */
+#define CONN_CLOSE              0x00000001  /* Close once output is done */
+#define CONN_PARSED             0x00000002  /* Have the request's headers */
+#define CONN_CORKED             0x00000004  /* TCP_CORK is on */
+#define CONN_KEEP               0x00000008  /* Keep open after this request */
+#define CONN_HEAD               0x00000010  /* HEAD request, no body */
+#define CONN_EOF                0x00000020  /* Client is done sending */
+
+typedef struct httpd_route {
+    TAILQ_ENTRY(httpd_route) entry;
+    char *method;
+    char *prefix;
+    size_t prefix_len;
+    httpd_handler_t handler;
+    void *data;
+    int free_data;
+} httpd_route_t;
+
+TAILQ_HEAD(httpd_route_list, httpd_route);
+
+typedef struct httpd_conn {
+    TAILQ_ENTRY(httpd_conn) entry;
+    struct httpd *srv;
+    int sock;
+    uint32_t flags;
+    uint32_t nreqs;
+    uint64_t last_active;
+
+    /* What's come in, and how much of it the current request takes up. */
+    char *in;
+    size_t in_len;
+    size_t hdr_len;
+    size_t body_len;
+
+    /* The current request. */
+    httpd_req_t req;
+    const char *hdrs[HTTPD_MAX_HEADERS * 2];
+    int nhdrs;
+
+    /* The response to it. */
+    int resp;
+    char xhdrs[HTTPD_XHDR_SIZE];
+    size_t xhdrs_len;
+
+    /* What's waiting to go out. */
+    uint8_t *out;
+    size_t out_len;
+    size_t out_pos;
+    size_t out_cap;
+
+    /* A file being sent after it. If it's mapped, map points at the next byte
+       to go out, otherwise it's read through fbuf. */
+    file_t file;
+    const uint8_t *map;
+    uint32_t file_left;
+    uint8_t *fbuf;
+    size_t fbuf_len;
+    size_t fbuf_pos;
+} httpd_conn_t;
+
+TAILQ_HEAD(httpd_conn_list, httpd_conn);
+
+struct httpd {
+    httpd_params_t params;
+    int sock;
+    struct httpd_route_list routes;
+    struct httpd_conn_list conns;
+    int nconns;
+
+    /* Scratch space for poll(). */
+    struct pollfd *pfds;
+    httpd_conn_t **pconns;
+
+    kthread_t *thd;
+    volatile int stop;
+
+    httpd_stats_t stats;
+};
+
+/* In response.c */
+int _httpd_out_append(httpd_conn_t *c, const void *data, size_t len);
+void _httpd_resp_reset(httpd_conn_t *c);
+int _httpd_resp_finish(httpd_conn_t *c);
+int _httpd_error(httpd_conn_t *c, int status);
+int _httpd_flush(httpd_conn_t *c);
+void _httpd_file_close(httpd_conn_t *c);
+
+#endif /* !__LOCAL_HTTPD_INTERNAL_H */
@@ -0,0 +1,559 @@
+/* KallistiOS ##version##
+
+   libhttpd/response.c
+   Copyright (C) 2026 The KOS Team and contributors.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <strings.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "httpd_internal.h"
+
+/* This file builds responses, and sends them (and any file after them) out as
+   the connection can take them. Everything but the body of a file goes into
+   the connection's output buffer first, so most responses go out with one
+   send(). */
+
+static const struct {
+    int code;
+    const char *text;
+} statuses[] = {
+    { 100, "Continue" },
+    { 200, "OK" },
+    { 201, "Created" },
+    { 204, "No Content" },
+    { 206, "Partial Content" },
+    { 301, "Moved Permanently" },
+    { 302, "Found" },
+    { 304, "Not Modified" },
+    { 400, "Bad Request" },
+    { 403, "Forbidden" },
+    { 404, "Not Found" },
+    { 405, "Method Not Allowed" },
+    { 408, "Request Timeout" },
+    { 411, "Length Required" },
+    { 413, "Content Too Large" },
+    { 414, "URI Too Long" },
+    { 416, "Range Not Satisfiable" },
+    { 431, "Request Header Fields Too Large" },
+    { 500, "Internal Server Error" },
+    { 501, "Not Implemented" },
+    { 503, "Service Unavailable" },
+    { 505, "HTTP Version Not Supported" }
+};
+
+static const struct {
+    const char *ext;
+    const char *type;
+} types[] = {
+    { "html", "text/html" },
+    { "htm", "text/html" },
+    { "txt", "text/plain" },
+    { "css", "text/css" },
+    { "js", "text/javascript" },
+    { "json", "application/json" },
+    { "xml", "application/xml" },
+    { "png", "image/png" },
+    { "jpg", "image/jpeg" },
+    { "jpeg", "image/jpeg" },
+    { "gif", "image/gif" },
+    { "ico", "image/x-icon" },
+    { "svg", "image/svg+xml" },
+    { "wav", "audio/wav" },
+    { "bin", "application/octet-stream" }
+};
+
+#define NSTATUSES   (sizeof(statuses) / sizeof(statuses[0]))
+#define NTYPES      (sizeof(types) / sizeof(types[0]))
+
+static const char *status_text(int code) {
+    size_t i;
+
+    for(i = 0; i < NSTATUSES; ++i) {
+        if(statuses[i].code == code)
+            return statuses[i].text;
+    }
+
+    return "Unknown";
+}
+
+static const char *file_type(const char *path) {
+    const char *ext = strrchr(path, '.');
+    size_t i;
+
+    if(ext && !strchr(ext, '/')) {
+        for(i = 0; i < NTYPES; ++i) {
+            if(!strcasecmp(ext + 1, types[i].ext))
+                return types[i].type;
+        }
+    }
+
+    return "application/octet-stream";
+}
+
+int _httpd_out_append(httpd_conn_t *c, const void *data, size_t len) {
+    size_t need, cap;
+    uint8_t *tmp;
+
+    /* Start over at the beginning once everything has gone out. */
+    if(c->out_pos == c->out_len)
+        c->out_pos = c->out_len = 0;
+
+    need = c->out_len + len;
+
+    if(need > c->out_cap && c->out_pos) {
+        memmove(c->out, c->out + c->out_pos, c->out_len - c->out_pos);
+        c->out_len -= c->out_pos;
+        c->out_pos = 0;
+        need = c->out_len + len;
+    }
+
+    if(need > c->out_cap) {
+        cap = c->out_cap ? c->out_cap : 1024;
+
+        while(cap < need)
+            cap <<= 1;
+
+        if(!(tmp = (uint8_t *)realloc(c->out, cap))) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        c->out = tmp;
+        c->out_cap = cap;
+    }
+
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+
+    return 0;
+}
+
+void _httpd_resp_reset(httpd_conn_t *c) {
+    c->resp = RESP_NONE;
+    c->xhdrs_len = 0;
+}
+
+static void set_cork(httpd_conn_t *c, int on) {
+    if(on == !!(c->flags & CONN_CORKED))
+        return;
+
+    setsockopt(c->sock, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+
+    if(on)
+        c->flags |= CONN_CORKED;
+    else
+        c->flags &= ~CONN_CORKED;
+}
+
+/* Queue up the status line and headers. A length of -1 means we don't know
+   how long the body is going to be. */
+static int resp_start(httpd_conn_t *c, int status, const char *type,
+                      int64_t len, const char *extra) {
+    char buf[512];
+    int n, keep;
+
+    if(c->resp != RESP_NONE) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    /* Without a length, a HTTP/1.0 client can only tell where the body ends by
+       the connection closing. */
+    keep = (c->flags & CONN_KEEP) && (len >= 0 || c->req.version);
+
+    if(!keep)
+        c->flags &= ~CONN_KEEP;
+
+    n = snprintf(buf, sizeof(buf), "HTTP/1.1 %d %s\r\nServer: KOS libhttpd\r\n",
+                 status, status_text(status));
+
+    if(type)
+        n += snprintf(buf + n, sizeof(buf) - n, "Content-Type: %.128s\r\n", type);
+
+    if(len >= 0)
+        n += snprintf(buf + n, sizeof(buf) - n, "Content-Length: %llu\r\n",
+                      (unsigned long long)len);
+    else if(c->req.version)
+        n += snprintf(buf + n, sizeof(buf) - n,
+                      "Transfer-Encoding: chunked\r\n");
+
+    /* Keeping the connection is the default for HTTP/1.1, and closing it is
+       for HTTP/1.0, so only say so when it isn't. */
+    if(!keep && c->req.version)
+        n += snprintf(buf + n, sizeof(buf) - n, "Connection: close\r\n");
+    else if(keep && !c->req.version)
+        n += snprintf(buf + n, sizeof(buf) - n, "Connection: keep-alive\r\n");
+
+    if(extra)
+        n += snprintf(buf + n, sizeof(buf) - n, "%s", extra);
+
+    if(n >= (int)sizeof(buf)) {
+        errno = EOVERFLOW;
+        return -1;
+    }
+
+    if(_httpd_out_append(c, buf, n) < 0 ||
+       _httpd_out_append(c, c->xhdrs, c->xhdrs_len) < 0 ||
+       _httpd_out_append(c, "\r\n", 2) < 0)
+        return -1;
+
+    c->resp = RESP_DONE;
+    return 0;
+}
+
+int _httpd_resp_finish(httpd_conn_t *c) {
+    int rv = 0;
+
+    switch(c->resp) {
+        case RESP_NONE:
+            return _httpd_error(c, 500);
+
+        case RESP_CHUNKED:
+            if(!(c->flags & CONN_HEAD))
+                rv = _httpd_out_append(c, "0\r\n\r\n", 5);
+
+            break;
+    }
+
+    c->resp = RESP_DONE;
+    return rv;
+}
+
+int _httpd_error(httpd_conn_t *c, int status) {
+    char body[256];
+    int n;
+
+    n = snprintf(body, sizeof(body), "<html><head><title>%d %s</title></head>"
+                 "<body><h1>%d %s</h1></body></html>\n", status,
+                 status_text(status), status, status_text(status));
+
+    return httpd_respond(&c->req, status, "text/html", body, n);
+}
+
+int httpd_add_header(httpd_req_t *req, const char *name, const char *value) {
+    httpd_conn_t *c = req->conn;
+    size_t nl = strlen(name), vl = strlen(value);
+
+    if(c->resp != RESP_NONE ||
+       c->xhdrs_len + nl + vl + 4 > sizeof(c->xhdrs)) {
+        errno = c->resp != RESP_NONE ? EBUSY : ENOSPC;
+        return -1;
+    }
+
+    memcpy(c->xhdrs + c->xhdrs_len, name, nl);
+    c->xhdrs_len += nl;
+    c->xhdrs[c->xhdrs_len++] = ':';
+    c->xhdrs[c->xhdrs_len++] = ' ';
+    memcpy(c->xhdrs + c->xhdrs_len, value, vl);
+    c->xhdrs_len += vl;
+    c->xhdrs[c->xhdrs_len++] = '\r';
+    c->xhdrs[c->xhdrs_len++] = '\n';
+
+    return 0;
+}
+
+int httpd_respond(httpd_req_t *req, int status, const char *type,
+                  const void *body, size_t len) {
+    httpd_conn_t *c = req->conn;
+
+    if(resp_start(c, status, type, (int64_t)len, NULL) < 0)
+        return -1;
+
+    if(len && !(c->flags & CONN_HEAD))
+        return _httpd_out_append(c, body, len);
+
+    return 0;
+}
+
+int httpd_respond_error(httpd_req_t *req, int status) {
+    return _httpd_error(req->conn, status);
+}
+
+int httpd_respond_chunked(httpd_req_t *req, int status, const char *type) {
+    httpd_conn_t *c = req->conn;
+
+    if(resp_start(c, status, type, -1, NULL) < 0)
+        return -1;
+
+    c->resp = req->version ? RESP_CHUNKED : RESP_STREAM;
+    return 0;
+}
+
+int httpd_chunk(httpd_req_t *req, const void *data, size_t len) {
+    httpd_conn_t *c = req->conn;
+    char hdr[16];
+    int n;
+
+    if(c->resp != RESP_CHUNKED && c->resp != RESP_STREAM) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* A zero length chunk would end the body early. */
+    if(!len || (c->flags & CONN_HEAD))
+        return 0;
+
+    if(c->resp == RESP_STREAM)
+        return _httpd_out_append(c, data, len);
+
+    n = snprintf(hdr, sizeof(hdr), "%x\r\n", (unsigned int)len);
+
+    if(_httpd_out_append(c, hdr, n) < 0 || _httpd_out_append(c, data, len) < 0)
+        return -1;
+
+    return _httpd_out_append(c, "\r\n", 2);
+}
+
+int httpd_chunk_printf(httpd_req_t *req, const char *fmt, ...) {
+    char buf[256], *tmp;
+    va_list ap;
+    int n, rv;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    if(n < 0)
+        return -1;
+
+    if(n < (int)sizeof(buf))
+        return httpd_chunk(req, buf, n);
+
+    /* Didn't fit, so do it again with enough room. */
+    if(!(tmp = (char *)malloc(n + 1))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    va_start(ap, fmt);
+    vsnprintf(tmp, n + 1, fmt, ap);
+    va_end(ap);
+
+    rv = httpd_chunk(req, tmp, n);
+    free(tmp);
+
+    return rv;
+}
+
+/* Parse a Range header. Only a single range is handled, anything else gets the
+   whole file. Returns 1 for a range (in start and end, inclusive), 0 to send
+   the whole file, or -1 if the range is past the end of the file. */
+static int parse_range(const char *hdr, uint32_t size, uint32_t *start,
+                       uint32_t *end) {
+    unsigned long a, b;
+    char *p;
+
+    if(strncasecmp(hdr, "bytes=", 6) || strchr(hdr, ','))
+        return 0;
+
+    hdr += 6;
+
+    if(*hdr == '-') {
+        /* The last however many bytes. */
+        b = strtoul(hdr + 1, &p, 10);
+
+        if(p == hdr + 1 || *p)
+            return 0;
+
+        if(!b || !size)
+            return -1;
+
+        *start = b >= size ? 0 : size - (uint32_t)b;
+        *end = size - 1;
+        return 1;
+    }
+
+    if(*hdr < '0' || *hdr > '9')
+        return 0;
+
+    a = strtoul(hdr, &p, 10);
+
+    if(*p++ != '-')
+        return 0;
+
+    if(!*p) {
+        b = size ? size - 1 : 0;
+    }
+    else {
+        hdr = p;
+        b = strtoul(hdr, &p, 10);
+
+        if(*p || b < a)
+            return 0;
+    }
+
+    if(a >= size)
+        return -1;
+
+    *start = (uint32_t)a;
+    *end = b >= size ? size - 1 : (uint32_t)b;
+    return 1;
+}
+
+int httpd_send_file(httpd_req_t *req, const char *path) {
+    httpd_conn_t *c = req->conn;
+    char extra[96];
+    const char *range;
+    uint32_t size, start = 0, end = 0, len;
+    size_t total;
+    file_t f;
+    int status = 200, r = 0;
+    void *map;
+
+    if((f = fs_open(path, O_RDONLY)) == FILEHND_INVALID)
+        return _httpd_error(c, 404);
+
+    if((total = fs_total(f)) == (size_t)-1 || total > 0xFFFFFFFF) {
+        fs_close(f);
+        return _httpd_error(c, 500);
+    }
+
+    size = (uint32_t)total;
+
+    if((range = httpd_header(req, "Range")))
+        r = parse_range(range, size, &start, &end);
+
+    if(r < 0) {
+        fs_close(f);
+        snprintf(extra, sizeof(extra), "bytes */%lu", (unsigned long)size);
+
+        if(httpd_add_header(req, "Content-Range", extra) < 0)
+            return -1;
+
+        return _httpd_error(c, 416);
+    }
+
+    if(r) {
+        status = 206;
+        len = end - start + 1;
+        snprintf(extra, sizeof(extra), "Accept-Ranges: bytes\r\n"
+                 "Content-Range: bytes %lu-%lu/%lu\r\n", (unsigned long)start,
+                 (unsigned long)end, (unsigned long)size);
+    }
+    else {
+        len = size;
+        strcpy(extra, "Accept-Ranges: bytes\r\n");
+    }
+
+    /* Send it straight out of memory if we can, otherwise get to the right
+       spot to start reading from. */
+    map = len && !(c->flags & CONN_HEAD) ? fs_mmap(f) : NULL;
+
+    if(!map && start && fs_seek(f, start, SEEK_SET) != (off_t)start) {
+        fs_close(f);
+        return _httpd_error(c, 500);
+    }
+
+    if(resp_start(c, status, file_type(path), len, extra) < 0) {
+        fs_close(f);
+        return -1;
+    }
+
+    if(!len || (c->flags & CONN_HEAD)) {
+        fs_close(f);
+        return 0;
+    }
+
+    if(!map && !c->fbuf && !(c->fbuf = (uint8_t *)malloc(HTTPD_FILE_BUF))) {
+        fs_close(f);
+        c->flags |= CONN_CLOSE;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    c->file = f;
+    c->map = map ? (const uint8_t *)map + start : NULL;
+    c->file_left = len;
+    c->fbuf_len = c->fbuf_pos = 0;
+
+    /* Keep the headers and the start of the file together. */
+    set_cork(c, 1);
+
+    return 0;
+}
+
+void _httpd_file_close(httpd_conn_t *c) {
+    if(c->file != FILEHND_INVALID) {
+        fs_close(c->file);
+        c->file = FILEHND_INVALID;
+    }
+
+    c->map = NULL;
+    c->file_left = 0;
+    c->fbuf_len = c->fbuf_pos = 0;
+    set_cork(c, 0);
+}
+
+static int send_some(httpd_conn_t *c, const void *data, size_t len) {
+    ssize_t r = send(c->sock, data, len, MSG_DONTWAIT);
+
+    if(r < 0)
+        return (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR) ?
+               0 : -1;
+
+    c->srv->stats.bytes_sent += r;
+    return (int)r;
+}
+
+int _httpd_flush(httpd_conn_t *c) {
+    httpd_stats_t *st = &c->srv->stats;
+    uint32_t n;
+    int r;
+
+    while(c->out_pos < c->out_len) {
+        if((r = send_some(c, c->out + c->out_pos, c->out_len - c->out_pos)) <= 0)
+            return r;
+
+        c->out_pos += r;
+    }
+
+    c->out_pos = c->out_len = 0;
+
+    /* Then the file, if there is one. */
+    while(c->file_left) {
+        if(c->map) {
+            if((r = send_some(c, c->map, c->file_left)) <= 0)
+                return r;
+
+            c->map += r;
+            st->file_bytes_mapped += r;
+        }
+        else {
+            if(c->fbuf_pos == c->fbuf_len) {
+                n = c->file_left < HTTPD_FILE_BUF ? c->file_left :
+                    HTTPD_FILE_BUF;
+
+                /* If the file comes up short, there's no way to tell the
+                   client, other than to hang up on them. */
+                if((r = fs_read(c->file, c->fbuf, n)) <= 0)
+                    return -1;
+
+                c->fbuf_len = r;
+                c->fbuf_pos = 0;
+                st->file_bytes_read += r;
+            }
+
+            if((r = send_some(c, c->fbuf + c->fbuf_pos,
+                              c->fbuf_len - c->fbuf_pos)) <= 0)
+                return r;
+
+            c->fbuf_pos += r;
+        }
+
+        c->file_left -= r;
+    }
+
+    if(c->file != FILEHND_INVALID)
+        _httpd_file_close(c);
+
+    return 0;
+}
@@ -0,0 +1,725 @@
+/* KallistiOS ##version##
+
+   libppp/ccp.c
+   Copyright (C) 2026 The KOS Team and contributors.
+*/
+
+/* PPP Compression Control Protocol (RFC 1962), with Stac LZS (RFC 1974) as
+   the only compression method.
+
+   Each direction is negotiated on its own: our Configure-Request says what we
+   are willing to receive, and what we ACK from the peer's says what we send.
+   We ask for LZS with one history and sequence number checking. If the peer
+   doesn't do CCP at all, it rejects the protocol and the link carries on
+   without compression. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <ppp/ppp.h>
+
+#include <arpa/inet.h>
+#include <arch/timer.h>
+
+#include "ppp_internal.h"
+#include "lzs.h"
+
+/* CCP packet codes, beyond the ones shared with LCP. */
+#define CCP_RESET_REQUEST       14
+#define CCP_RESET_ACK           15
+
+/* CCP configuration options. */
+#define CCP_CONFIGURE_LZS       17
+
+/* LZS check modes. */
+#define LZS_CHECK_NONE          0
+#define LZS_CHECK_SEQ           3
+
+struct ccp_state_s {
+    int state;
+    uint8_t last_conf;
+    uint8_t last_term;
+    uint8_t last_coderej;
+    uint8_t last_reset;
+
+    ppp_state_t *ppp_state;
+
+    uint64_t next_resend;
+    uint16_t resend_cnt;
+    int (*resend_pkt)(ppp_protocol_t *, int);
+    void (*resend_timeout)(ppp_protocol_t *);
+
+    /* What we're asking the peer to send us. */
+    int rx_want;
+    uint16_t rx_hist;
+    uint8_t rx_check;
+
+    /* What the peer asked us to send (in the last request we ACKed). */
+    int tx_want;
+    uint16_t tx_hist;
+    uint8_t tx_check;
+
+    /* What's actually in use, once we're open. */
+    int rx_on;
+    int tx_on;
+    uint8_t rx_seq;
+    uint8_t tx_seq;
+
+    /* While we're waiting for a Reset-Ack, compressed packets are dropped. */
+    int rx_resetting;
+    uint64_t next_reset;
+
+    lzs_comp_t tx_lzs;
+    lzs_decomp_t rx_lzs;
+    uint8_t tx_buf[LZS_MAX_OUT(LZS_MAX_PKT) + 1];
+
+    ppp_ccp_stats_t stats;
+} ccp_state;
+
+static void ccp_cfg_timeout(ppp_protocol_t *self) {
+    (void)self;
+
+    /* Unlike LCP and IPCP, giving up on CCP doesn't take the link down. We
+       just don't get compression. */
+    ccp_state.resend_pkt = NULL;
+    ccp_state.resend_timeout = NULL;
+    ccp_state.state = PPP_STATE_STOPPED;
+
+    DBG("ccp: no response from peer, going on without compression\n");
+}
+
+static int ccp_send_client_cfg(ppp_protocol_t *self, int resend) {
+    uint8_t rawpkt[16];
+    lcp_pkt_t *pkt = (lcp_pkt_t *)rawpkt;
+    int len = 0;
+
+    (void)self;
+
+    pkt->code = LCP_CONFIGURE_REQUEST;
+
+    if(resend)
+        pkt->id = ccp_state.last_conf;
+    else
+        pkt->id = ++ccp_state.last_conf;
+
+    if(ccp_state.rx_want) {
+        pkt->data[len++] = CCP_CONFIGURE_LZS;
+        pkt->data[len++] = 5;
+        pkt->data[len++] = (uint8_t)(ccp_state.rx_hist >> 8);
+        pkt->data[len++] = (uint8_t)ccp_state.rx_hist;
+        pkt->data[len++] = ccp_state.rx_check;
+    }
+
+    len += 4;
+    pkt->len = htons(len);
+
+    /* Set the resend timer for 3 seconds. */
+    ccp_state.next_resend = timer_ms_gettime64() + 3000;
+    ccp_state.resend_pkt = &ccp_send_client_cfg;
+    ccp_state.resend_timeout = &ccp_cfg_timeout;
+
+    if(!resend)
+        ccp_state.resend_cnt = 10;
+
+    return ppp_send(rawpkt, len, PPP_PROTOCOL_CCP);
+}
+
+static int ccp_send_simple(uint8_t code, uint8_t id) {
+    lcp_pkt_t pkt;
+
+    pkt.code = code;
+    pkt.id = id;
+    pkt.len = htons(4);
+
+    return ppp_send((const uint8_t *)&pkt, 4, PPP_PROTOCOL_CCP);
+}
+
+static int ccp_send_code_reject(ppp_protocol_t *self, const uint8_t *pkt,
+                                size_t len) {
+    uint8_t buf[len + 4];
+    lcp_pkt_t *out = (lcp_pkt_t *)buf;
+    uint16_t out_len = len + 4;
+
+    (void)self;
+
+    if(out_len > ccp_state.ppp_state->peer_mru)
+        out_len = ccp_state.ppp_state->peer_mru;
+
+    out->code = LCP_CODE_REJECT;
+    out->id = ++ccp_state.last_coderej;
+    out->len = htons(out_len);
+
+    memcpy(buf + 4, pkt, out_len - 4);
+
+    return ppp_send(buf, out_len, PPP_PROTOCOL_CCP);
+}
+
+/* Ask the peer to reset its compressor, and drop what it sends until it says
+   that it has. */
+static int ccp_send_reset_req(void) {
+    ccp_state.rx_resetting = 1;
+    ccp_state.next_reset = timer_ms_gettime64() + 1000;
+    ++ccp_state.stats.resets_sent;
+
+    return ccp_send_simple(CCP_RESET_REQUEST, ++ccp_state.last_reset);
+}
+
+/* Start up compression with whatever was agreed on, as CCP goes to the opened
+   state. */
+static void ccp_layer_up(void) {
+    ccp_state.resend_pkt = NULL;
+    ccp_state.resend_timeout = NULL;
+    ccp_state.state = PPP_STATE_OPENED;
+
+    ccp_state.tx_on = ccp_state.tx_want;
+    ccp_state.rx_on = ccp_state.rx_want;
+    ccp_state.tx_seq = ccp_state.rx_seq = 1;
+    ccp_state.rx_resetting = 0;
+    _ppp_lzs_comp_reset(&ccp_state.tx_lzs);
+    _ppp_lzs_decomp_reset(&ccp_state.rx_lzs);
+
+    DBG("ccp: opened, compressing %s, decompressing %s\n",
+        ccp_state.tx_on ? "on" : "off", ccp_state.rx_on ? "on" : "off");
+}
+
+static void ccp_layer_down(void) {
+    ccp_state.tx_on = ccp_state.rx_on = 0;
+}
+
+/* Check over an LZS option, and work out what we'd rather have if it isn't
+   something we can do. Returns 0 if it's fine. */
+static int ccp_check_lzs(const uint8_t *opt, uint8_t opt_len, uint16_t *hist,
+                         uint8_t *check) {
+    if(opt_len != 5)
+        return -1;
+
+    *hist = (opt[2] << 8) | opt[3];
+    *check = opt[4];
+
+    return (*hist > 1 ||
+            (*check != LZS_CHECK_NONE && *check != LZS_CHECK_SEQ)) ? -1 : 0;
+}
+
+static int ccp_handle_configure_req(ppp_protocol_t *self,
+                                    const lcp_pkt_t *pkt, size_t len) {
+    size_t ptr = 0;
+    uint8_t opt_len;
+    uint8_t response[1500], nak[16];
+    uint8_t response_code = LCP_CONFIGURE_ACK;
+    uint16_t response_len = 4, nak_len = 4;
+    int lzs = 0;
+    uint16_t hist = 0;
+    uint8_t check = 0;
+
+    switch(ccp_state.state) {
+        case PPP_STATE_CLOSING:
+        case PPP_STATE_STOPPING:
+            return 0;
+
+        case PPP_STATE_CLOSED:
+            return ccp_send_simple(LCP_TERMINATE_ACK, pkt->id);
+
+        case PPP_STATE_OPENED:
+            /* Starting over, so everything's off until we're open again. */
+            ccp_layer_down();
+            __fallthrough;
+
+        case PPP_STATE_STOPPED:
+            ccp_send_client_cfg(self, 0);
+            ccp_state.state = PPP_STATE_REQUEST_SENT;
+            break;
+    }
+
+    DBG("ccp: Peer configure request received with opts:\n");
+
+    len -= 4;
+
+    while(ptr < len) {
+        if(len - ptr < 2) {
+            DBG("ccp: bad configure length, ignoring.\n");
+            return -1;
+        }
+
+        opt_len = pkt->data[ptr + 1];
+
+        if(opt_len < 2 || ptr + opt_len > len) {
+            DBG("ccp: bad option length, ignoring packet\n");
+            return -1;
+        }
+
+        switch(pkt->data[ptr]) {
+            case CCP_CONFIGURE_LZS:
+                if(!ccp_check_lzs(pkt->data + ptr, opt_len, &hist, &check)) {
+                    DBG("    LZS: %d histories, check mode %d\n", (int)hist,
+                        (int)check);
+                    lzs = 1;
+                    break;
+                }
+
+                /* Tell the peer what we'd like instead. */
+                DBG("    LZS (unsupported settings)\n");
+
+                if(response_code != LCP_CONFIGURE_REJECT) {
+                    response_code = LCP_CONFIGURE_NAK;
+                    nak[nak_len++] = CCP_CONFIGURE_LZS;
+                    nak[nak_len++] = 5;
+                    nak[nak_len++] = 0;
+                    nak[nak_len++] = 1;
+                    nak[nak_len++] = LZS_CHECK_SEQ;
+                }
+                break;
+
+            /* Anything else (Deflate, Predictor, MPPC, ...), we don't do. */
+            default:
+                DBG("    unknown option: %d (len %d)\n", pkt->data[ptr],
+                    opt_len);
+
+                if(response_len + opt_len < 1500) {
+                    response_code = LCP_CONFIGURE_REJECT;
+                    memcpy(response + response_len, &pkt->data[ptr], opt_len);
+                    response_len += opt_len;
+                }
+        }
+
+        ptr += opt_len;
+    }
+
+    if(response_code == LCP_CONFIGURE_ACK) {
+        int rv;
+
+        memcpy(response, pkt, len + 4);
+        response[0] = LCP_CONFIGURE_ACK;
+        rv = ppp_send(response, len + 4, PPP_PROTOCOL_CCP);
+
+        ccp_state.tx_want = lzs;
+        ccp_state.tx_hist = hist;
+        ccp_state.tx_check = check;
+
+        if(ccp_state.state == PPP_STATE_ACK_RECEIVED)
+            ccp_layer_up();
+        else
+            ccp_state.state = PPP_STATE_ACK_SENT;
+
+        return rv;
+    }
+    else if(response_code == LCP_CONFIGURE_REJECT) {
+        lcp_pkt_t *out = (lcp_pkt_t *)response;
+
+        out->code = LCP_CONFIGURE_REJECT;
+        out->id = pkt->id;
+        out->len = htons(response_len);
+
+        if(ccp_state.state != PPP_STATE_ACK_RECEIVED)
+            ccp_state.state = PPP_STATE_REQUEST_SENT;
+
+        return ppp_send(response, response_len, PPP_PROTOCOL_CCP);
+    }
+    else {
+        lcp_pkt_t *out = (lcp_pkt_t *)nak;
+
+        out->code = LCP_CONFIGURE_NAK;
+        out->id = pkt->id;
+        out->len = htons(nak_len);
+
+        if(ccp_state.state != PPP_STATE_ACK_RECEIVED)
+            ccp_state.state = PPP_STATE_REQUEST_SENT;
+
+        return ppp_send(nak, nak_len, PPP_PROTOCOL_CCP);
+    }
+}
+
+static int ccp_handle_configure_ack(ppp_protocol_t *self,
+                                    const lcp_pkt_t *pkt, size_t len) {
+    (void)len;
+
+    if(pkt->id != ccp_state.last_conf) {
+        DBG("ccp: received configure ack with an invalid identifier\n");
+        return -1;
+    }
+
+    switch(ccp_state.state) {
+        case PPP_STATE_CLOSING:
+        case PPP_STATE_STOPPING:
+            return 0;
+
+        case PPP_STATE_CLOSED:
+        case PPP_STATE_STOPPED:
+            return ccp_send_simple(LCP_TERMINATE_ACK, pkt->id);
+
+        case PPP_STATE_REQUEST_SENT:
+            ccp_state.resend_cnt = 10;
+            ccp_state.state = PPP_STATE_ACK_RECEIVED;
+            return 0;
+
+        case PPP_STATE_OPENED:
+            ccp_layer_down();
+            __fallthrough;
+
+        case PPP_STATE_ACK_RECEIVED:
+            ccp_state.state = PPP_STATE_REQUEST_SENT;
+            return ccp_send_client_cfg(self, 0);
+
+        case PPP_STATE_ACK_SENT:
+            ccp_layer_up();
+            return 0;
+    }
+
+    return 0;
+}
+
+/* Configure-Nak and Configure-Reject are handled the same way, other than
+   what happens to the LZS option if it's in there. */
+static int ccp_handle_configure_nak_rej(ppp_protocol_t *self,
+                                        const lcp_pkt_t *pkt, size_t len) {
+    size_t ptr = 0;
+    uint8_t opt_len, check;
+    uint16_t hist;
+
+    if(pkt->id != ccp_state.last_conf) {
+        DBG("ccp: received configure nak/rej with an invalid identifier\n");
+        return -1;
+    }
+
+    switch(ccp_state.state) {
+        case PPP_STATE_CLOSING:
+        case PPP_STATE_STOPPING:
+            return 0;
+
+        case PPP_STATE_CLOSED:
+        case PPP_STATE_STOPPED:
+            return ccp_send_simple(LCP_TERMINATE_ACK, pkt->id);
+
+        case PPP_STATE_OPENED:
+            ccp_layer_down();
+            __fallthrough;
+
+        case PPP_STATE_REQUEST_SENT:
+        case PPP_STATE_ACK_RECEIVED:
+            ccp_state.state = PPP_STATE_REQUEST_SENT;
+            break;
+    }
+
+    len -= 4;
+
+    while(ptr < len) {
+        if(len - ptr < 2) {
+            DBG("ccp: bad configure length, ignoring.\n");
+            return -1;
+        }
+
+        opt_len = pkt->data[ptr + 1];
+
+        if(opt_len < 2 || ptr + opt_len > len) {
+            DBG("ccp: bad option length, ignoring packet\n");
+            return -1;
+        }
+
+        if(pkt->data[ptr] == CCP_CONFIGURE_LZS) {
+            /* Go with what the peer suggests if we can, otherwise stop asking
+               for compression. */
+            if(pkt->code == LCP_CONFIGURE_NAK &&
+               !ccp_check_lzs(pkt->data + ptr, opt_len, &hist, &check)) {
+                ccp_state.rx_hist = hist;
+                ccp_state.rx_check = check;
+            }
+            else {
+                ccp_state.rx_want = 0;
+            }
+        }
+
+        ptr += opt_len;
+    }
+
+    return ccp_send_client_cfg(self, 0);
+}
+
+static int ccp_handle_terminate_req(ppp_protocol_t *self,
+                                    const lcp_pkt_t *pkt, size_t len) {
+    (void)self;
+    (void)len;
+
+    switch(ccp_state.state) {
+        case PPP_STATE_ACK_RECEIVED:
+        case PPP_STATE_ACK_SENT:
+            ccp_state.state = PPP_STATE_REQUEST_SENT;
+            break;
+
+        case PPP_STATE_OPENED:
+            ccp_layer_down();
+            ccp_state.resend_pkt = NULL;
+            ccp_state.resend_timeout = NULL;
+            ccp_state.state = PPP_STATE_STOPPED;
+            break;
+
+        default:
+            break;
+    }
+
+    return ccp_send_simple(LCP_TERMINATE_ACK, pkt->id);
+}
+
+static int ccp_handle_reset_req(const lcp_pkt_t *pkt) {
+    if(ccp_state.state != PPP_STATE_OPENED || !ccp_state.tx_on)
+        return 0;
+
+    /* Start over with an empty history. The ack has to go out before anything
+       compressed with the new history. */
+    _ppp_lzs_comp_reset(&ccp_state.tx_lzs);
+    ccp_state.tx_seq = 1;
+    ++ccp_state.stats.resets_received;
+
+    return ccp_send_simple(CCP_RESET_ACK, pkt->id);
+}
+
+static int ccp_handle_reset_ack(const lcp_pkt_t *pkt) {
+    if(!ccp_state.rx_resetting || pkt->id != ccp_state.last_reset)
+        return 0;
+
+    _ppp_lzs_decomp_reset(&ccp_state.rx_lzs);
+    ccp_state.rx_seq = 1;
+    ccp_state.rx_resetting = 0;
+
+    return 0;
+}
+
+static int ccp_shutdown(ppp_protocol_t *self) {
+    return ppp_del_protocol(self);
+}
+
+static int ccp_input(ppp_protocol_t *self, const uint8_t *buf, size_t len) {
+    const lcp_pkt_t *pkt = (const lcp_pkt_t *)buf;
+
+    /* If we've been told not to do CCP, act like we don't know about it. */
+    if(ccp_state.ppp_state->our_flags & PPP_FLAG_NO_CCP)
+        return ppp_lcp_send_proto_reject(PPP_PROTOCOL_CCP, buf, len);
+
+    if(len < sizeof(lcp_pkt_t) || len != ntohs(pkt->len))
+        return -1;
+
+    switch(pkt->code) {
+        case LCP_CONFIGURE_REQUEST:
+            return ccp_handle_configure_req(self, pkt, len);
+
+        case LCP_CONFIGURE_ACK:
+            return ccp_handle_configure_ack(self, pkt, len);
+
+        case LCP_CONFIGURE_NAK:
+        case LCP_CONFIGURE_REJECT:
+            return ccp_handle_configure_nak_rej(self, pkt, len);
+
+        case LCP_TERMINATE_REQUEST:
+            return ccp_handle_terminate_req(self, pkt, len);
+
+        case LCP_TERMINATE_ACK:
+            if(ccp_state.state == PPP_STATE_OPENED) {
+                ccp_layer_down();
+                ccp_state.state = PPP_STATE_REQUEST_SENT;
+                return ccp_send_client_cfg(self, 0);
+            }
+            break;
+
+        case LCP_CODE_REJECT:
+            if(ccp_state.state == PPP_STATE_ACK_RECEIVED)
+                ccp_state.state = PPP_STATE_REQUEST_SENT;
+            break;
+
+        case CCP_RESET_REQUEST:
+            return ccp_handle_reset_req(pkt);
+
+        case CCP_RESET_ACK:
+            return ccp_handle_reset_ack(pkt);
+
+        default:
+            return ccp_send_code_reject(self, buf, len);
+    }
+
+    return 0;
+}
+
+static void ccp_enter_phase(ppp_protocol_t *self, int oldp, int newp) {
+    (void)oldp;
+
+    if(newp == PPP_PHASE_NETWORK) {
+        ccp_layer_down();
+        ccp_state.state = PPP_STATE_STOPPED;
+
+        if(ccp_state.ppp_state->our_flags & PPP_FLAG_NO_CCP)
+            return;
+
+        ccp_state.rx_want = 1;
+        ccp_state.rx_hist = 1;
+        ccp_state.rx_check = LZS_CHECK_SEQ;
+        ccp_state.tx_want = 0;
+
+        ccp_send_client_cfg(self, 0);
+        ccp_state.state = PPP_STATE_REQUEST_SENT;
+    }
+    else if(newp == PPP_PHASE_DEAD || newp == PPP_PHASE_TERMINATE) {
+        ccp_layer_down();
+        ccp_state.resend_pkt = NULL;
+        ccp_state.resend_timeout = NULL;
+        ccp_state.state = PPP_STATE_INITIAL;
+    }
+}
+
+static void ccp_check_timeouts(ppp_protocol_t *self, uint64_t tm) {
+    if(ccp_state.resend_pkt && tm >= ccp_state.next_resend) {
+        if(!ccp_state.resend_cnt) {
+            ccp_state.resend_timeout(self);
+        }
+        else {
+            ccp_state.resend_pkt(self, 1);
+            --ccp_state.resend_cnt;
+        }
+    }
+
+    /* Keep asking for a reset until we get one. */
+    if(ccp_state.rx_resetting && tm >= ccp_state.next_reset) {
+        ccp_state.next_reset = tm + 1000;
+        ccp_send_simple(CCP_RESET_REQUEST, ccp_state.last_reset);
+    }
+}
+
+/* Compressed datagrams. */
+static int comp_input(ppp_protocol_t *self, const uint8_t *buf, size_t len) {
+    const uint8_t *data;
+    ssize_t rv;
+
+    (void)self;
+
+    /* Drop anything we didn't agree to, or that comes in before the peer has
+       reset its history. */
+    if(!ccp_state.rx_on || ccp_state.rx_resetting) {
+        ++ccp_state.stats.rx_dropped;
+        return 0;
+    }
+
+    if(ccp_state.rx_check == LZS_CHECK_SEQ) {
+        if(!len || buf[0] != ccp_state.rx_seq) {
+            DBG("ccp: sequence number mismatch, resetting\n");
+            ++ccp_state.stats.rx_errors;
+            return ccp_send_reset_req();
+        }
+
+        ++ccp_state.rx_seq;
+        ++buf;
+        --len;
+    }
+
+    rv = _ppp_lzs_decompress(&ccp_state.rx_lzs, buf, len, &data,
+                             ccp_state.rx_hist);
+
+    if(rv < 0) {
+        DBG("ccp: bad compressed packet, resetting\n");
+        ++ccp_state.stats.rx_errors;
+        return ccp_send_reset_req();
+    }
+
+    ++ccp_state.stats.rx_packets;
+    ccp_state.stats.rx_comp_bytes += len;
+    ccp_state.stats.rx_bytes += rv;
+
+    return _ppp_input(data, (size_t)rv);
+}
+
+const uint8_t *_ppp_ccp_compress(uint16_t proto, const uint8_t *hdr,
+                                 size_t hlen, const uint8_t *data, size_t len,
+                                 size_t *out_len) {
+    uint8_t pf[2];
+    uint8_t *out = ccp_state.tx_buf;
+    size_t max = hlen + len;
+    ssize_t rv;
+
+    /* Only network layer protocols get compressed. */
+    if(!ccp_state.tx_on || proto >= 0x4000)
+        return NULL;
+
+    pf[0] = (uint8_t)(proto >> 8);
+    pf[1] = (uint8_t)proto;
+
+    if(ccp_state.tx_check == LZS_CHECK_SEQ) {
+        *out++ = ccp_state.tx_seq;
+        --max;
+    }
+
+    /* If it doesn't save at least the size of the protocol field, it goes out
+       as it is. The history doesn't change in that case, so the peer stays in
+       sync. */
+    rv = _ppp_lzs_compress(&ccp_state.tx_lzs, pf, 2, hdr, hlen, data, len, out,
+                           max, ccp_state.tx_hist);
+
+    ccp_state.stats.tx_bytes += hlen + len + 2;
+
+    if(rv < 0) {
+        ++ccp_state.stats.tx_incompressible;
+        ccp_state.stats.tx_comp_bytes += hlen + len + 2;
+        return NULL;
+    }
+
+    if(ccp_state.tx_check == LZS_CHECK_SEQ)
+        ++ccp_state.tx_seq;
+
+    ++ccp_state.stats.tx_packets;
+    ccp_state.stats.tx_comp_bytes += (out - ccp_state.tx_buf) + rv;
+    *out_len = (out - ccp_state.tx_buf) + rv;
+
+    return ccp_state.tx_buf;
+}
+
+void _ppp_ccp_input_error(void) {
+    /* Without sequence numbers, this is the only way we'd find out that a
+       compressed packet went missing. */
+    if(ccp_state.rx_on && !ccp_state.rx_resetting)
+        ccp_send_reset_req();
+}
+
+void _ppp_ccp_proto_rejected(void) {
+    DBG("ccp: peer rejected CCP, going on without compression\n");
+
+    ccp_layer_down();
+    ccp_state.resend_pkt = NULL;
+    ccp_state.resend_timeout = NULL;
+    ccp_state.state = PPP_STATE_STOPPED;
+}
+
+ppp_ccp_stats_t ppp_ccp_get_stats(void) {
+    ppp_ccp_stats_t rv = ccp_state.stats;
+
+    rv.tx_on = ccp_state.tx_on;
+    rv.rx_on = ccp_state.rx_on;
+
+    return rv;
+}
+
+static ppp_protocol_t ccp_proto = {
+    PPP_PROTO_ENTRY_INIT,
+    "ccp",
+    PPP_PROTOCOL_CCP,
+    NULL,                   /* privdata */
+    NULL,                   /* init */
+    &ccp_shutdown,
+    &ccp_input,
+    &ccp_enter_phase,
+    &ccp_check_timeouts
+};
+
+static ppp_protocol_t comp_proto = {
+    PPP_PROTO_ENTRY_INIT,
+    "comp",
+    PPP_PROTOCOL_COMP,
+    NULL,                   /* privdata */
+    NULL,                   /* init */
+    &ccp_shutdown,
+    &comp_input,
+    NULL,                   /* enter_phase */
+    NULL                    /* check_timeouts */
+};
+
+int _ppp_ccp_init(ppp_state_t *st) {
+    memset(&ccp_state, 0, sizeof(ccp_state));
+    ccp_state.ppp_state = st;
+    ccp_state.state = PPP_STATE_INITIAL;
+
+    return ppp_add_protocol(&comp_proto) | ppp_add_protocol(&ccp_proto);
+}
@@ -15,6 +15,7 @@
 #include <arch/timer.h>
 
 #include "ppp_internal.h"
+#include "vjcomp.h"
 #include "net_ipv4.h"
 
 struct ipcp_state_s {
@@ -30,8 +31,21 @@ struct ipcp_state_s {
     uint16_t resend_cnt;
     int (*resend_pkt)(ppp_protocol_t *, int);
     void (*resend_timeout)(ppp_protocol_t *);
+
+    /* VJ header compression. The first few are what we ask the peer for, the
+       next two are what the peer asked us for (vj_tx_slots is 0 if it didn't).
+       The compression state itself only gets set up once IPCP is open. */
+    int vj_want;
+    uint8_t vj_max_slot;
+    uint8_t vj_comp_cid;
+    int vj_tx_slots;
+    int vj_tx_comp_cid;
+    vj_state_t vj;
 } ipcp_state;
 
+/* Where we rebuild packets with compressed headers. */
+static uint8_t vj_buf[1504 + VJ_MAX_HDR];
+
 /* IPCP configuration options. */
 #define IPCP_CONFIGURE_IP_ADDRESSES   1
 #define IPCP_CONFIGURE_IP_COMPRESSION 2
@@ -41,6 +55,14 @@ struct ipcp_state_s {
 #define IPCP_CONFIGURE_SECONDARY_DNS  131
 #define IPCP_CONFIGURE_SECONDARY_NBNS 132
 
+/* Set up header compression with whatever we agreed on with the peer. This is
+   called as IPCP goes to the opened state. */
+static void ipcp_vj_up(void) {
+    _ppp_vj_init(&ipcp_state.vj, ipcp_state.vj_tx_slots,
+                 ipcp_state.vj_want ? ipcp_state.vj_max_slot + 1 : 0,
+                 ipcp_state.vj_tx_comp_cid);
+}
+
 static void ipcp_cfg_timeout(ppp_protocol_t *self) {
     (void)self;
 
@@ -94,6 +116,15 @@ static int ipcp_send_client_cfg(ppp_protocol_t *self, int resend) {
     pkt->data[len++] = dns[2];
     pkt->data[len++] = dns[3];
 
+    if(ipcp_state.vj_want) {
+        pkt->data[len++] = IPCP_CONFIGURE_IP_COMPRESSION;
+        pkt->data[len++] = 6;
+        pkt->data[len++] = (uint8_t)(PPP_PROTOCOL_VJ_COMP >> 8);
+        pkt->data[len++] = (uint8_t)PPP_PROTOCOL_VJ_COMP;
+        pkt->data[len++] = ipcp_state.vj_max_slot;
+        pkt->data[len++] = ipcp_state.vj_comp_cid;
+    }
+
     len += 4;
     pkt->len = htons(len);
 
@@ -162,6 +193,7 @@ static int ipcp_handle_configure_req(ppp_protocol_t *self,
 
     /* Parameters and their default values. */
     uint32_t addr = 0;
+    int vj_slots = 0, vj_cid = 0;
 
     (void)pkt;
 
@@ -227,6 +259,22 @@ static int ipcp_handle_configure_req(ppp_protocol_t *self,
                 }
                 break;
 
+            case IPCP_CONFIGURE_IP_COMPRESSION:
+                /* The only kind of compression we do is Van Jacobson's, and
+                   only the RFC 1332 version of it. */
+                if(opt_len == 6 && pkt->data[ptr + 2] == 0x00 &&
+                   pkt->data[ptr + 3] == PPP_PROTOCOL_VJ_COMP) {
+                    vj_slots = pkt->data[ptr + 4] + 1;
+                    vj_cid = pkt->data[ptr + 5];
+                    DBG("    VJ compression: %d slots%s\n", vj_slots,
+                        vj_cid ? ", compressed slot ids" : "");
+                }
+                else {
+                    DBG("    IP compression (unsupported)\n");
+                    goto reject_opt;
+                }
+                break;
+
             case IPCP_CONFIGURE_PRIMARY_DNS:
                 if(opt_len == 6) {
                     DBG("    primary DNS: %d.%d.%d.%d\n",
@@ -309,6 +357,9 @@ reject_opt:
             nif->gateway[3] = (uint8)addr;
         }
 
+        ipcp_state.vj_tx_slots = vj_slots;
+        ipcp_state.vj_tx_comp_cid = vj_cid;
+
         if(ipcp_state.state == PPP_STATE_ACK_RECEIVED) {
             ipcp_state.state = PPP_STATE_OPENED;
 
@@ -318,6 +369,7 @@ reject_opt:
             ipcp_state.resend_timeout = NULL;
 
             /* XXXX: This layer up. */
+            ipcp_vj_up();
             _ppp_enter_phase(PPP_PHASE_NETWORK);
         }
         else {
@@ -403,6 +455,7 @@ static int ipcp_handle_configure_ack(ppp_protocol_t *self,
             ipcp_state.resend_timeout = NULL;
             ipcp_state.state = PPP_STATE_OPENED;
             /* XXXX: This layer up. */
+            ipcp_vj_up();
             _ppp_enter_phase(PPP_PHASE_NETWORK);
 
             return 0;
@@ -504,6 +557,25 @@ static int ipcp_handle_configure_nak(ppp_protocol_t *self,
                 }
                 break;
 
+            case IPCP_CONFIGURE_IP_COMPRESSION:
+                /* If the peer wants some other kind of compression, just give
+                   up on it. Otherwise, go with the number of slots it would
+                   rather use, as long as we can handle that many. */
+                if(opt_len == 6 && pkt->data[ptr + 2] == 0x00 &&
+                   pkt->data[ptr + 3] == PPP_PROTOCOL_VJ_COMP) {
+                    if(pkt->data[ptr + 4] < VJ_MAX_SLOTS)
+                        ipcp_state.vj_max_slot = pkt->data[ptr + 4];
+
+                    ipcp_state.vj_comp_cid = pkt->data[ptr + 5] ? 1 : 0;
+                    DBG("    VJ compression: %d slots\n",
+                        ipcp_state.vj_max_slot + 1);
+                }
+                else {
+                    DBG("    IP compression (not VJ)\n");
+                    ipcp_state.vj_want = 0;
+                }
+                break;
+
             /* If we don't know about the option, ignore it. */
             default:
                 DBG("    unknown option: %d (len %d)\n", pkt->data[ptr],
@@ -532,6 +604,73 @@ static int ipcp_handle_configure_nak(ppp_protocol_t *self,
     return ipcp_send_client_cfg(self, 0);
 }
 
+static int ipcp_handle_configure_rej(ppp_protocol_t *self,
+                                     const ipcp_pkt_t *pkt, size_t len) {
+    size_t ptr = 0;
+    uint8_t opt_len;
+
+    if(pkt->id != ipcp_state.last_conf) {
+        DBG("ipcp: received configure reject with an invalid identifier\n");
+        return -1;
+    }
+
+    switch(ipcp_state.state) {
+        case PPP_STATE_CLOSING:
+        case PPP_STATE_STOPPING:
+            /* Silently discard and don't move states. */
+            return 0;
+
+        case PPP_STATE_CLOSED:
+        case PPP_STATE_STOPPED:
+            /* Send a terminate ack and discard the request. */
+            return ipcp_send_terminate_ack(self, pkt->id, NULL, 0);
+
+        case PPP_STATE_OPENED:
+            /* XXXX: This layer down. */
+            __fallthrough;
+
+        case PPP_STATE_REQUEST_SENT:
+        case PPP_STATE_ACK_RECEIVED:
+            ipcp_state.state = PPP_STATE_REQUEST_SENT;
+            break;
+    }
+
+    DBG("ipcp: peer sent configure reject with opts:\n");
+
+    len -= 4;
+
+    while(ptr < len) {
+        if(len - ptr < 2) {
+            DBG("ipcp: bad configure length, ignoring.\n");
+            return -1;
+        }
+
+        opt_len = pkt->data[ptr + 1];
+
+        if(opt_len < 2 || ptr + opt_len > len) {
+            DBG("ipcp: bad option length, ignoring packet\n");
+            return -1;
+        }
+
+        /* The only thing we ask for that we can do without is header
+           compression. If the peer doesn't like anything else, the link
+           probably isn't going to work anyway. */
+        switch(pkt->data[ptr]) {
+            case IPCP_CONFIGURE_IP_COMPRESSION:
+                DBG("    IP compression\n");
+                ipcp_state.vj_want = 0;
+                break;
+
+            default:
+                DBG("    option: %d (len %d)\n", pkt->data[ptr], opt_len);
+        }
+
+        ptr += opt_len;
+    }
+
+    return ipcp_send_client_cfg(self, 0);
+}
+
 static int ipcp_handle_terminate_req(ppp_protocol_t *self,
                                      const ipcp_pkt_t *pkt, size_t len) {
     (void)len;
@@ -641,8 +780,7 @@ static int ipcp_input(ppp_protocol_t *self, const uint8_t *buf, size_t len) {
             return ipcp_handle_configure_nak(self, pkt, len);
 
         case LCP_CONFIGURE_REJECT:
-            //return ipcp_handle_configure_rej(self, pkt, len);
-            return 0;
+            return ipcp_handle_configure_rej(self, pkt, len);
 
         case LCP_TERMINATE_REQUEST:
             return ipcp_handle_terminate_req(self, pkt, len);
@@ -671,6 +809,15 @@ static void ipcp_enter_phase(ppp_protocol_t *self, int oldp, int newp) {
 
     /* We only care about when we're entering the network phase. */
     if(newp == PPP_PHASE_NETWORK) {
+        /* Start over on header compression, and ask for it unless we've been
+           told not to. */
+        ipcp_state.vj_want =
+            !(ipcp_state.ppp_state->our_flags & PPP_FLAG_NO_VJ);
+        ipcp_state.vj_max_slot = VJ_MAX_SLOTS - 1;
+        ipcp_state.vj_comp_cid = 1;
+        ipcp_state.vj_tx_slots = 0;
+        _ppp_vj_init(&ipcp_state.vj, 0, 0, 0);
+
         ipcp_send_client_cfg(self, 0);
         ipcp_state.state = PPP_STATE_REQUEST_SENT;
     }
@@ -695,12 +842,52 @@ static int ip_input(ppp_protocol_t *self, const uint8_t *buf, size_t len) {
     (void)self;
 
     if(ipcp_state.state == PPP_STATE_OPENED)
-        return net_ipv4_input(ipcp_state.ppp_state->netif, buf, len, NULL);
+        return net_ipv4_input(ipcp_state.ppp_state->netif, buf, len, NULL,
+                              NULL);
 
     /* If we're not open, silently discard the packet. */
     return 0;
 }
 
+static int vj_input(ppp_protocol_t *self, const uint8_t *buf, size_t len) {
+    ssize_t rv;
+
+    /* If we're not open, silently discard the packet. */
+    if(ipcp_state.state != PPP_STATE_OPENED)
+        return 0;
+
+    if(len > sizeof(vj_buf) - VJ_MAX_HDR)
+        return -1;
+
+    rv = _ppp_vj_uncompress(&ipcp_state.vj, self->code, buf, len, vj_buf);
+
+    if(rv < 0)
+        return -1;
+
+    return net_ipv4_input(ipcp_state.ppp_state->netif, vj_buf, (size_t)rv,
+                          NULL, NULL);
+}
+
+int _ppp_ipcp_send(const uint8_t *data, size_t len) {
+    uint8_t hdr[VJ_MAX_HDR];
+    size_t hlen, skip;
+    uint16_t proto;
+
+    if(ipcp_state.state != PPP_STATE_OPENED || !ipcp_state.vj.tx_slots)
+        return ppp_send(data, len, PPP_PROTOCOL_IPv4);
+
+    proto = _ppp_vj_compress(&ipcp_state.vj, data, len, hdr, &hlen, &skip);
+
+    if(proto == PPP_PROTOCOL_IPv4)
+        return ppp_send(data, len, proto);
+
+    return _ppp_send_hdr(hdr, hlen, data + skip, len - skip, proto);
+}
+
+void _ppp_ipcp_input_error(void) {
+    _ppp_vj_input_error(&ipcp_state.vj);
+}
+
 static ppp_protocol_t ipcp_proto = {
     PPP_PROTO_ENTRY_INIT,
     "ipcp",
@@ -725,10 +912,35 @@ static ppp_protocol_t ip_proto = {
     NULL                    /* check_timeouts */
 };
 
+static ppp_protocol_t vjc_proto = {
+    PPP_PROTO_ENTRY_INIT,
+    "vjc",
+    PPP_PROTOCOL_VJ_COMP,
+    NULL,                   /* privdata */
+    NULL,                   /* init */
+    &ipcp_shutdown,
+    &vj_input,
+    NULL,                   /* enter_phase */
+    NULL                    /* check_timeouts */
+};
+
+static ppp_protocol_t vju_proto = {
+    PPP_PROTO_ENTRY_INIT,
+    "vju",
+    PPP_PROTOCOL_VJ_UNCOMP,
+    NULL,                   /* privdata */
+    NULL,                   /* init */
+    &ipcp_shutdown,
+    &vj_input,
+    NULL,                   /* enter_phase */
+    NULL                    /* check_timeouts */
+};
+
 int _ppp_ipcp_init(ppp_state_t *st) {
     (void)st;
 
     ipcp_state.ppp_state = st;
 
-    return ppp_add_protocol(&ip_proto) | ppp_add_protocol(&ipcp_proto);
+    return ppp_add_protocol(&ip_proto) | ppp_add_protocol(&vjc_proto) |
+        ppp_add_protocol(&vju_proto) | ppp_add_protocol(&ipcp_proto);
 }
@@ -396,6 +396,7 @@ reject_opt:
         st->peer_flags = flags;
         st->peer_magic = magic;
         st->out_accm[0] = accm;
+        _ppp_update_accm();
         st->auth_proto = auth_proto;
         st->peer_mru = mru;
 
@@ -667,6 +668,7 @@ static int lcp_handle_configure_nak(ppp_protocol_t *self, const lcp_pkt_t *pkt,
     lcp_state.ppp_state->our_flags = flags;
     lcp_state.ppp_state->our_magic = magic;
     lcp_state.ppp_state->in_accm[0] = accm;
+    _ppp_update_accm();
 
     return lcp_send_client_cfg(self, 0);
 }
@@ -948,7 +950,11 @@ static int lcp_input(ppp_protocol_t *self, const uint8_t *buf, size_t len) {
             break;
 
         case LCP_PROTOCOL_REJECT:
-            /* XXXX: Need to inform the protocol that got rejected. */
+            /* XXXX: Need to inform the protocol that got rejected. CCP is the
+               only one that can actually do anything about it for now. */
+            if(len >= 6 && ((pkt->data[0] << 8) | pkt->data[1]) ==
+               PPP_PROTOCOL_CCP)
+                _ppp_ccp_proto_rejected();
             break;
 
         case LCP_ECHO_REQUEST:
@@ -0,0 +1,301 @@
+/* KallistiOS ##version##
+
+   libppp/lzs.c
+   Copyright (C) 2026 The KOS Team and contributors.
+*/
+
+/* Stac LZS compression. This is a plain LZ77 scheme with a 2048 byte window,
+   and a fixed bit-level encoding of the output:
+
+       Literal byte:        0 bbbbbbbb
+       Match, offset < 128: 1 1 ooooooo <length>
+       Match, offset < 2048: 1 0 ooooooooooo <length>
+       End of packet:       1 1 0000000, then zeros up to the next byte
+
+   with lengths encoded as:
+
+       2: 00        5: 1100
+       3: 01        6: 1101
+       4: 10        7: 1110
+       8 and up: 1111, then (length - 8) in four bit chunks, with each 1111
+       chunk adding 15 and the first chunk that isn't 1111 ending it.
+
+   The compressor only looks at one earlier position for each match (the last
+   one with the same first three bytes), which keeps it quick at the cost of a
+   little bit of compression. */
+
+#include <string.h>
+
+#include "lzs.h"
+
+typedef struct bitw {
+    uint8_t *out, *end;
+    uint32_t acc;
+    int bits;
+} bitw_t;
+
+typedef struct bitr {
+    const uint8_t *in, *end;
+    uint32_t acc;
+    int bits;
+} bitr_t;
+
+static inline int put_bits(bitw_t *w, uint32_t val, int n) {
+    w->acc = (w->acc << n) | val;
+    w->bits += n;
+
+    while(w->bits >= 8) {
+        if(w->out == w->end)
+            return -1;
+
+        w->bits -= 8;
+        *w->out++ = (uint8_t)(w->acc >> w->bits);
+    }
+
+    return 0;
+}
+
+static inline int put_len(bitw_t *w, size_t len) {
+    if(len < 5)
+        return put_bits(w, len - 2, 2);
+
+    if(len < 8)
+        return put_bits(w, 0x0c | (len - 5), 4);
+
+    len -= 8;
+
+    if(put_bits(w, 0x0f, 4))
+        return -1;
+
+    while(len >= 15) {
+        if(put_bits(w, 0x0f, 4))
+            return -1;
+
+        len -= 15;
+    }
+
+    return put_bits(w, len, 4);
+}
+
+static inline int get_bits(bitr_t *r, int n, uint32_t *val) {
+    while(r->bits < n) {
+        if(r->in == r->end)
+            return -1;
+
+        r->acc = (r->acc << 8) | *r->in++;
+        r->bits += 8;
+    }
+
+    r->bits -= n;
+    *val = (r->acc >> r->bits) & ((1 << n) - 1);
+    return 0;
+}
+
+static inline uint32_t lzs_hash(const uint8_t *p) {
+    uint32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+
+    return (v * 0x9E3779B1) >> 21;
+}
+
+void _ppp_lzs_comp_reset(lzs_comp_t *c) {
+    memset(c->hash, 0, sizeof(c->hash));
+    c->base = 0;
+    c->hist_len = 0;
+}
+
+void _ppp_lzs_decomp_reset(lzs_decomp_t *d) {
+    d->hist_len = 0;
+}
+
+ssize_t _ppp_lzs_compress(lzs_comp_t *c, const uint8_t *p1, size_t l1,
+                          const uint8_t *p2, size_t l2, const uint8_t *p3,
+                          size_t l3, uint8_t *out, size_t max,
+                          int keep_history) {
+    uint8_t *buf = c->buf;
+    size_t cur, end, cand = 0, mlen, i, shift;
+    uint32_t h, pos;
+    bitw_t w;
+
+    if(l1 + l2 + l3 > LZS_MAX_PKT)
+        return -1;
+
+    /* Without history, everything that came before is out of reach. Anything
+       in the hash table from before now points before the buffer. */
+    if(!keep_history) {
+        c->base += c->hist_len;
+        c->hist_len = 0;
+    }
+
+    /* Put the packet together right after the history. */
+    cur = c->hist_len;
+    memcpy(buf + cur, p1, l1);
+    memcpy(buf + cur + l1, p2, l2);
+    memcpy(buf + cur + l1 + l2, p3, l3);
+    end = cur + l1 + l2 + l3;
+
+    w.out = out;
+    w.end = out + max;
+    w.acc = 0;
+    w.bits = 0;
+
+    while(cur < end) {
+        mlen = 0;
+
+        /* See if the last place these three bytes showed up is still within
+           reach. The hash table isn't cleaned up when a packet gets sent
+           uncompressed, so always check that the bytes actually match. */
+        if(end - cur >= 3) {
+            h = lzs_hash(buf + cur);
+            pos = c->hash[h];
+            c->hash[h] = c->base + cur + 1;
+
+            if(pos && pos - 1 >= c->base) {
+                cand = pos - 1 - c->base;
+
+                if(cand < cur && cur - cand < LZS_HISTORY) {
+                    while(cur + mlen < end && buf[cand + mlen] == buf[cur + mlen])
+                        ++mlen;
+                }
+            }
+        }
+
+        if(mlen >= 2) {
+            if(cur - cand < 128) {
+                if(put_bits(&w, 0x180 | (cur - cand), 9))
+                    return -1;
+            }
+            else if(put_bits(&w, 0x1000 | (cur - cand), 13)) {
+                return -1;
+            }
+
+            if(put_len(&w, mlen))
+                return -1;
+
+            /* Keep the hash table up to date with what we skipped over. */
+            for(i = 1; i < mlen && cur + i + 3 <= end; ++i)
+                c->hash[lzs_hash(buf + cur + i)] = c->base + cur + i + 1;
+
+            cur += mlen;
+        }
+        else {
+            if(put_bits(&w, buf[cur], 9))
+                return -1;
+
+            ++cur;
+        }
+    }
+
+    /* End marker, and pad out to a whole byte. */
+    if(put_bits(&w, 0x180, 9))
+        return -1;
+
+    if(w.bits && put_bits(&w, 0, 8 - w.bits))
+        return -1;
+
+    /* It fit, so this packet is part of the history now. Slide the window up
+       if we've got more than we need. */
+    if(end > LZS_HISTORY) {
+        shift = end - LZS_HISTORY;
+        memmove(buf, buf + shift, LZS_HISTORY);
+        c->base += shift;
+        c->hist_len = LZS_HISTORY;
+    }
+    else {
+        c->hist_len = end;
+    }
+
+    return (ssize_t)(w.out - out);
+}
+
+ssize_t _ppp_lzs_decompress(lzs_decomp_t *d, const uint8_t *in, size_t len,
+                            const uint8_t **out, int keep_history) {
+    uint8_t *buf = d->buf;
+    size_t start, cur, lim, mlen;
+    uint32_t v, off;
+    bitr_t r;
+
+    /* The last packet is left where it was until now, since the caller may
+       have been using it. */
+    if(!keep_history) {
+        d->hist_len = 0;
+    }
+    else if(d->hist_len > LZS_HISTORY) {
+        memmove(buf, buf + d->hist_len - LZS_HISTORY, LZS_HISTORY);
+        d->hist_len = LZS_HISTORY;
+    }
+
+    start = cur = d->hist_len;
+    lim = start + LZS_MAX_PKT;
+
+    r.in = in;
+    r.end = in + len;
+    r.acc = 0;
+    r.bits = 0;
+
+    for(;;) {
+        if(get_bits(&r, 1, &v))
+            return -1;
+
+        if(!v) {
+            if(get_bits(&r, 8, &v) || cur >= lim)
+                return -1;
+
+            buf[cur++] = (uint8_t)v;
+            continue;
+        }
+
+        if(get_bits(&r, 1, &v))
+            return -1;
+
+        if(v) {
+            if(get_bits(&r, 7, &off))
+                return -1;
+
+            /* A zero short offset marks the end of the packet. */
+            if(!off)
+                break;
+        }
+        else if(get_bits(&r, 11, &off) || !off) {
+            return -1;
+        }
+
+        if(get_bits(&r, 2, &v))
+            return -1;
+
+        if(v < 3) {
+            mlen = v + 2;
+        }
+        else {
+            if(get_bits(&r, 2, &v))
+                return -1;
+
+            if(v < 3) {
+                mlen = v + 5;
+            }
+            else {
+                mlen = 8;
+
+                do {
+                    if(get_bits(&r, 4, &v))
+                        return -1;
+
+                    mlen += v;
+                } while(v == 15 && mlen <= LZS_MAX_PKT);
+            }
+        }
+
+        if(off > cur || cur + mlen > lim)
+            return -1;
+
+        /* The match can overlap what it's making, so go a byte at a time. */
+        while(mlen--) {
+            buf[cur] = buf[cur - off];
+            ++cur;
+        }
+    }
+
+    d->hist_len = cur;
+    *out = buf + start;
+
+    return (ssize_t)(cur - start);
+}
@@ -0,0 +1,68 @@
+/* KallistiOS ##version##
+
+   libppp/lzs.h
+   Copyright (C) 2026 The KOS Team and contributors.
+*/
+
+#ifndef __LOCAL_PPP_LZS_H
+#define __LOCAL_PPP_LZS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Stac LZS compression (ANSI X3.241-1994), as used by PPP (RFC 1974). */
+
+/* How far back a match can reach. */
+#define LZS_HISTORY     2048
+
+/* Biggest packet we'll compress or decompress: the MRU plus the protocol
+   field, with a bit of slop. */
+#define LZS_MAX_PKT     1504
+
+/* Worst case size of a compressed packet: nine bits per byte, plus the end
+   marker and padding. */
+#define LZS_MAX_OUT(n)  ((n) + ((n) + 7) / 8 + 4)
+
+/* Size of the compressor's hash table (must be a power of two). */
+#define LZS_HASH_SIZE   2048
+
+/* The compressor keeps the history and the packet being compressed one after
+   the other in buf, so matches never have to wrap around. Positions in the
+   hash table are counted from the start of the stream, and base is the
+   position of buf[0]. */
+typedef struct lzs_comp {
+    uint32_t base;
+    size_t hist_len;
+    uint32_t hash[LZS_HASH_SIZE];
+    uint8_t buf[LZS_HISTORY + LZS_MAX_PKT];
+} lzs_comp_t;
+
+/* The decompressor works the same way, writing each packet right after the
+   history. */
+typedef struct lzs_decomp {
+    size_t hist_len;
+    uint8_t buf[LZS_HISTORY + LZS_MAX_PKT];
+} lzs_decomp_t;
+
+/* Throw away the history. */
+void _ppp_lzs_comp_reset(lzs_comp_t *c);
+void _ppp_lzs_decomp_reset(lzs_decomp_t *d);
+
+/* Compress a packet, given in up to three pieces (any of which can be empty).
+   The result is written to out, and is never more than max bytes. Returns the
+   compressed length, or -1 if it didn't fit in max bytes. In that case, the
+   history is left alone, so the packet can be sent uncompressed without the
+   other side needing to know. With keep_history set to 0, each packet is
+   compressed on its own. */
+ssize_t _ppp_lzs_compress(lzs_comp_t *c, const uint8_t *p1, size_t l1,
+                          const uint8_t *p2, size_t l2, const uint8_t *p3,
+                          size_t l3, uint8_t *out, size_t max,
+                          int keep_history);
+
+/* Decompress a packet. On success, *out points to the data (which stays valid
+   until the next call) and its length is returned. Returns -1 if the packet
+   is corrupt, which means the history can't be trusted any more either. */
+ssize_t _ppp_lzs_decompress(lzs_decomp_t *d, const uint8_t *in, size_t len,
+                            const uint8_t **out, int keep_history);
+
+#endif /* !__LOCAL_PPP_LZS_H */
@@ -32,6 +32,12 @@
 #define EXPECT_CONTROL 3
 #define EXPECT_DATA    4
 
+/* What each received byte means, from the rx_class table. */
+#define RX_DATA        0
+#define RX_FLAG        1
+#define RX_ESCAPE      2
+#define RX_DROP        3
+
 static ppp_state_t ppp_state;
 static mutex_t mutex = RECURSIVE_MUTEX_INITIALIZER;
 static semaphore_t established_sem = SEM_INITIALIZER(0);
@@ -44,6 +50,17 @@ static int conn_rv = 0;
 static uint8_t ppp_recvbuf[PPP_MRU + 4];
 static size_t ppp_recvbuf_len;
 
+/* Send buffer. Each frame is built up in here and handed off to the device in
+   one go. In the worst case, every byte but the flag sequences gets escaped. */
+#define PPP_TX_MAX (PPP_MRU + 8)
+static uint8_t ppp_sendbuf[2 * (PPP_TX_MAX + 6) + 2];
+
+/* Lookup tables built from the ACCMs by _ppp_update_accm(). tx_esc is nonzero
+   for each byte that has to be escaped on the way out, and rx_class says what
+   to do with each byte that comes in. */
+static uint8_t tx_esc[256];
+static uint8_t rx_class[256];
+
 TAILQ_HEAD(ppp_proto_list, ppp_proto);
 static struct ppp_proto_list protocols = TAILQ_HEAD_INITIALIZER(protocols);
 
@@ -70,14 +87,63 @@ static inline int check_accm_bit(uint32_t *accm, uint8_t bit) {
     return accm[pos1] & (1 << pos2);
 }
 
-int ppp_send(const uint8_t *data, size_t len, uint16_t proto) {
-    uint8_t tmp[5];
-    uint16_t fcs = INITIAL_FCS;
-    size_t i, j, run_len = 0;
-    const uint8_t *run_start = data;
+void _ppp_update_accm(void) {
+    int i;
+
+    for(i = 0; i < 256; ++i) {
+        tx_esc[i] = check_accm_bit(ppp_state.out_accm, (uint8_t)i) ? 1 : 0;
+        rx_class[i] = check_accm_bit(ppp_state.in_accm, (uint8_t)i) ?
+            RX_DROP : RX_DATA;
+    }
+
+    /* The flag and escape characters always go out escaped, and always mean
+       the same thing coming in, whatever the ACCMs say. */
+    tx_esc[FLAG_SEQUENCE] = tx_esc[ESCAPE_CHAR] = 1;
+    rx_class[FLAG_SEQUENCE] = RX_FLAG;
+    rx_class[ESCAPE_CHAR] = RX_ESCAPE;
+}
 
-    /* We can't use mutex_lock() inside an IRQ, so we have this song and dance
-       with mutex_trylock() instead in that case. */
+/* Add one byte to an outgoing frame, escaping it if need be. */
+static inline uint8_t *put_byte(uint8_t *out, uint8_t b) {
+    if(tx_esc[b]) {
+        *out++ = ESCAPE_CHAR;
+        *out++ = b ^ 0x20;
+    }
+    else {
+        *out++ = b;
+    }
+
+    return out;
+}
+
+/* Escape a block of data into an outgoing frame, working out the FCS along the
+   way. */
+static inline uint8_t *put_block(uint8_t *out, const uint8_t *data, size_t len,
+                                 uint16_t *fcsp) {
+    const uint8_t *end = data + len;
+    uint16_t fcs = *fcsp;
+    uint8_t b;
+
+    while(data < end) {
+        b = *data++;
+        fcs = (fcs >> 8) ^ fcstab[(fcs ^ b) & 0xFF];
+
+        if(tx_esc[b]) {
+            *out++ = ESCAPE_CHAR;
+            *out++ = b ^ 0x20;
+        }
+        else {
+            *out++ = b;
+        }
+    }
+
+    *fcsp = fcs;
+    return out;
+}
+
+/* We can't use mutex_lock() inside an IRQ, so we have this song and dance
+   with mutex_trylock() instead in that case. */
+static int ppp_lock(void) {
     if(irq_inside_int()) {
         if(mutex_trylock(&mutex)) {
             errno = EAGAIN;
@@ -88,6 +154,25 @@ int ppp_send(const uint8_t *data, size_t len, uint16_t proto) {
         mutex_lock(&mutex);
     }
 
+    return 0;
+}
+
+int _ppp_send_hdr(const uint8_t *hdr, size_t hlen, const uint8_t *data,
+                  size_t len, uint16_t proto) {
+    uint8_t *out = ppp_sendbuf;
+    uint16_t fcs = INITIAL_FCS;
+    const uint8_t *comp;
+    size_t comp_len;
+    int rv;
+
+    if(hlen + len > PPP_TX_MAX) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    if(ppp_lock())
+        return -1;
+
     if(!ppp_state.device) {
         mutex_unlock(&mutex);
         errno = ENETDOWN;
@@ -100,129 +185,81 @@ int ppp_send(const uint8_t *data, size_t len, uint16_t proto) {
         return -1;
     }
 
-    /* Send the start of the framing out first. */
-    i = 0;
-    tmp[i++] = FLAG_SEQUENCE;
-
-    if(check_accm_bit(ppp_state.out_accm, ADDRESS_FIELD)) {
-        tmp[i++] = ESCAPE_CHAR;
-        tmp[i++] = ADDRESS_FIELD ^ 0x20;
-    }
-    else {
-        tmp[i++] = ADDRESS_FIELD;
+    /* If CCP is up, the protocol field and the data get compressed together,
+       and go out as one compressed datagram. */
+    if((comp = _ppp_ccp_compress(proto, hdr, hlen, data, len, &comp_len))) {
+        proto = PPP_PROTOCOL_COMP;
+        hlen = 0;
+        data = comp;
+        len = comp_len;
     }
 
-    if(check_accm_bit(ppp_state.out_accm, CONTROL_FIELD)) {
-        tmp[i++] = ESCAPE_CHAR;
-        tmp[i++] = CONTROL_FIELD ^ 0x20;
-    }
-    else {
-        tmp[i++] = CONTROL_FIELD;
-    }
+    /* Start with the framing and the PPP protocol field. */
+    *out++ = FLAG_SEQUENCE;
+    out = put_byte(out, ADDRESS_FIELD);
+    out = put_byte(out, CONTROL_FIELD);
+    out = put_byte(out, (uint8_t)(proto >> 8));
+    out = put_byte(out, (uint8_t)proto);
 
     fcs = (fcs >> 8) ^ fcstab[(fcs ^ ADDRESS_FIELD) & 0xFF];
     fcs = (fcs >> 8) ^ fcstab[(fcs ^ CONTROL_FIELD) & 0xFF];
-
-    ppp_state.device->tx(ppp_state.device, tmp, i, 0);
-
-    /* Next deal with the PPP protocol field. */
-    i = 0;
-
-    if(check_accm_bit(ppp_state.out_accm, (uint8_t)(proto >> 8))) {
-        tmp[i++] = ESCAPE_CHAR;
-        tmp[i++] = ((uint8_t)(proto >> 8)) ^ 0x20;
-    }
-    else {
-        tmp[i++] = (uint8_t)(proto >> 8);
-    }
-
-    if(check_accm_bit(ppp_state.out_accm, (uint8_t)proto)) {
-        tmp[i++] = ESCAPE_CHAR;
-        tmp[i++] = ((uint8_t)proto) ^ 0x20;
-    }
-    else {
-        tmp[i++] = (uint8_t)proto;
-    }
-
     fcs = (fcs >> 8) ^ fcstab[(fcs ^ ((uint8_t)(proto >> 8))) & 0xFF];
     fcs = (fcs >> 8) ^ fcstab[(fcs ^ ((uint8_t)proto)) & 0xFF];
 
-    ppp_state.device->tx(ppp_state.device, tmp, i, 0);
-
-    /* Deal with the data now. */
-    for(j = 0; j < len; ++j) {
-        if(check_accm_bit(ppp_state.out_accm, data[j])) {
-            /* Send everything up to this point. */
-            if(run_len)
-                ppp_state.device->tx(ppp_state.device, run_start, run_len, 0);
-
-            /* Escape the current byte and send it. */
-            tmp[0] = ESCAPE_CHAR;
-            tmp[1] = data[j] ^ 0x20;
-            ppp_state.device->tx(ppp_state.device, tmp, 2, 0);
-
-            /* Restart the run counter. */
-            run_start = data + j + 1;
-            run_len = 0;
-        }
-        else {
-            ++run_len;
-        }
-
-        fcs = (fcs >> 8) ^ fcstab[(fcs ^ data[j]) & 0xFF];
-    }
+    /* Escape the data and work out the FCS in one pass over it. */
+    if(hlen)
+        out = put_block(out, hdr, hlen, &fcs);
 
-    /* Send anything left over. */
-    if(run_len)
-        ppp_state.device->tx(ppp_state.device, run_start, run_len, 0);
+    out = put_block(out, data, len, &fcs);
 
     /* Finish up with the FCS and tack it onto the end along with an extra flag
        sequence to mark the end of the packet. */
     fcs = fcs ^ 0xFFFF;
-    i = 0;
+    out = put_byte(out, (uint8_t)(fcs & 0xFF));
+    out = put_byte(out, (uint8_t)((fcs >> 8) & 0xFF));
+    *out++ = FLAG_SEQUENCE;
 
-    if(check_accm_bit(ppp_state.out_accm, (uint8_t)(fcs & 0xFF))) {
-        tmp[i++] = ESCAPE_CHAR;
-        tmp[i++] = ((uint8_t)(fcs & 0xFF)) ^ 0x20;
-    }
-    else {
-        tmp[i++] = (uint8_t)(fcs & 0xFF);
-    }
-
-    if(check_accm_bit(ppp_state.out_accm, (uint8_t)((fcs >> 8) & 0xFF))) {
-        tmp[i++] = ESCAPE_CHAR;
-        tmp[i++] = ((uint8_t)((fcs >> 8) & 0xFF)) ^ 0x20;
-    }
-    else {
-        tmp[i++] = (uint8_t)((fcs >> 8) & 0xFF);
-    }
-
-    tmp[i++] = FLAG_SEQUENCE;
-
-    ppp_state.device->tx(ppp_state.device, tmp, i, PPP_TX_END_OF_PKT);
+    rv = ppp_state.device->tx(ppp_state.device, ppp_sendbuf,
+                              (size_t)(out - ppp_sendbuf), PPP_TX_END_OF_PKT);
 
     /* Clean up, we're done. */
     mutex_unlock(&mutex);
 
+    if(rv < 0) {
+        errno = EIO;
+        return -1;
+    }
+
     return 0;
 }
 
-static int ppp_input(void) {
+int ppp_send(const uint8_t *data, size_t len, uint16_t proto) {
+    return _ppp_send_hdr(NULL, 0, data, len, proto);
+}
+
+/* Hand off a packet (starting at the protocol field, without the FCS) to the
+   protocol it's for. Decompressed packets come back through here too. */
+int _ppp_input(const uint8_t *buf, size_t len) {
     uint16_t proto;
-    uint8_t *ptr;
-    size_t len;
+    const uint8_t *ptr;
     ppp_protocol_t *i;
 
+    if(!len)
+        return -1;
+
     /* Do we have a compressed protocol value? */
-    if(ppp_recvbuf[0] & 0x01) {
-        proto = ppp_recvbuf[0];
-        ptr = ppp_recvbuf + 1;
-        len = ppp_recvbuf_len - 3;
+    if(buf[0] & 0x01) {
+        proto = buf[0];
+        ptr = buf + 1;
+        len -= 1;
     }
     else {
-        proto = (ppp_recvbuf[0] << 8) | ppp_recvbuf[1];
-        ptr = ppp_recvbuf + 2;
-        len = ppp_recvbuf_len - 4;
+        if(len < 2)
+            return -1;
+
+        proto = (buf[0] << 8) | buf[1];
+        ptr = buf + 2;
+        len -= 2;
     }
 
     /* Look for the specified protocol in the list of registered protocols. */
@@ -232,14 +269,20 @@ static int ppp_input(void) {
     }
 
     /* We didn't find it in the protocols list, so send a protocol reject. */
-    return ppp_lcp_send_proto_reject(proto, ppp_recvbuf + 2,
-                                     ppp_recvbuf_len - 4);
+    return ppp_lcp_send_proto_reject(proto, ptr, len);
+}
+
+/* A frame got mangled on the way in. Anything that keeps state across packets
+   needs to know. */
+static void ppp_input_error(void) {
+    _ppp_ipcp_input_error();
+    _ppp_ccp_input_error();
 }
 
 /* PPP thread function. */
 void *ppp_main(void *arg) {
-    const uint8_t *data, *cur;
-    uint8_t ch;
+    const uint8_t *data, *cur, *end;
+    uint8_t ch, *dst, *dst_end;
     ssize_t data_len;
     int esc = 0, expect = EXPECT_FLAGSEQ;
     uint16_t fcs = INITIAL_FCS;
@@ -260,11 +303,32 @@ void *ppp_main(void *arg) {
             goto check_timeouts;
         }
 
-        while(data_len--) {
+        end = data + data_len;
+
+        while(cur < end) {
+            /* Most of what comes in is plain data in the middle of a packet.
+               Copy as much of that as we can in one go before falling back to
+               looking at each byte on its own. */
+            if(expect == EXPECT_DATA && !esc) {
+                dst = ppp_recvbuf + ppp_recvbuf_len;
+                dst_end = ppp_recvbuf + PPP_MRU + 4;
+
+                while(cur < end && dst < dst_end && rx_class[*cur] == RX_DATA) {
+                    ch = *cur++;
+                    fcs = (fcs >> 8) ^ fcstab[(fcs ^ ch) & 0xFF];
+                    *dst++ = ch;
+                }
+
+                ppp_recvbuf_len = (size_t)(dst - ppp_recvbuf);
+
+                if(cur == end)
+                    break;
+            }
+
             ch = *cur++;
 
             /* Go through some special edge cases... */
-            if(ch == FLAG_SEQUENCE) {
+            if(rx_class[ch] == RX_FLAG) {
                 /* A flag sequence marks the beginning of a packet. Check what
                    we should do with whatever we have already. */
                 switch(expect) {
@@ -280,6 +344,7 @@ void *ppp_main(void *arg) {
                     case EXPECT_CONTROL:
                         DBG("ppp: aborting packet, unexpected flag sequence\n");
 
+                        ppp_input_error();
                         expect = EXPECT_ADDRESS;
                         ppp_recvbuf_len = 0;
                         fcs = INITIAL_FCS;
@@ -291,9 +356,10 @@ void *ppp_main(void *arg) {
                            protocol handler. */
                         if(fcs == FINAL_FCS) {
                             /* This is a good packet, pass it along. */
-                            ppp_input();
+                            _ppp_input(ppp_recvbuf, ppp_recvbuf_len - 2);
                         }
                         else    {
+                            ppp_input_error();
                             DBG("ppp: dropping packet with bad final fcs, got: "
                                 "%04x\n", fcs);
                             DBG("ppp: was for proto %02x%02x\n", ppp_recvbuf[0],
@@ -308,10 +374,10 @@ void *ppp_main(void *arg) {
                         break;
                 }
             }
-            else if(ch == ESCAPE_CHAR) {
+            else if(rx_class[ch] == RX_ESCAPE) {
                 esc = 1;
             }
-            else if(check_accm_bit(ppp_state.in_accm, ch)) {
+            else if(rx_class[ch] == RX_DROP) {
                 DBG("ppp: dropping character that should be escaped: %02x\n",
                     ch);
             }
@@ -341,6 +407,7 @@ void *ppp_main(void *arg) {
                         else {
                             /* Something is probably wrong, so go ahead and drop
                                the packet now. */
+                            ppp_input_error();
                             expect = EXPECT_FLAGSEQ;
                             ppp_recvbuf_len = 0;
                             fcs = INITIAL_FCS;
@@ -371,6 +438,7 @@ void *ppp_main(void *arg) {
                         }
                         else {
                             /* We've gone beyond the MRU, so bail. */
+                            ppp_input_error();
                             expect = EXPECT_FLAGSEQ;
                             ppp_recvbuf_len = 0;
                             fcs = INITIAL_FCS;
@@ -586,11 +654,21 @@ static int ppp_if_shutdown(netif_t *self) {
 }
 
 static int ppp_if_tx(netif_t *self, const uint8 *data, int len, int blocking) {
+    int rv;
+
     (void)self;
     (void)blocking;
 
+    /* Hold the lock across the whole thing, so that header compression sees
+       packets in the same order they go out. */
+    if(ppp_lock())
+        return -1;
+
     /* XXXX: Support protocols other than IPv4 here... */
-    return ppp_send(data, len, PPP_PROTOCOL_IPv4);
+    rv = _ppp_ipcp_send(data, (size_t)len);
+    mutex_unlock(&mutex);
+
+    return rv;
 }
 
 static int ppp_if_set_flags(netif_t *self, uint32 flags_and, uint32 flags_or) {
@@ -638,7 +716,9 @@ static netif_t ppp_if = {
     &ppp_if_dummy,              /* tx_commit */
     &ppp_if_dummy,              /* rx_poll */
     &ppp_if_set_flags,          /* set_flags */
-    &ppp_if_set_mc              /* set_mc */
+    &ppp_if_set_mc,             /* set_mc */
+    NULL,                       /* tx_v */
+    { 0 }                       /* stats */
 };
 
 int ppp_init(void) {
@@ -661,6 +741,7 @@ int ppp_init(void) {
     set_accm_bit(ppp_state.in_accm, ESCAPE_CHAR);
     set_accm_bit(ppp_state.in_accm, FLAG_SEQUENCE);
     ppp_state.out_accm[0] = 0xffffffff;
+    _ppp_update_accm();
     ppp_state.peer_mru = 1500;
     ppp_state.netif = &ppp_if;
 
@@ -673,6 +754,7 @@ int ppp_init(void) {
     _ppp_lcp_init(&ppp_state);
     _ppp_pap_init(&ppp_state);
     _ppp_ipcp_init(&ppp_state);
+    _ppp_ccp_init(&ppp_state);
 
     /* Add us to netcore. */
     net_reg_device(&ppp_if);
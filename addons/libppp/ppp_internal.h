@@ -61,9 +61,13 @@ typedef struct ppp_state {
 /* PPP Protocols we might care about. */
 #define PPP_PROTOCOL_IPv4       0x0021
 #define PPP_PROTOCOL_IPv6       0x0057
+#define PPP_PROTOCOL_VJ_COMP    0x002d    /* RFC 1144 */
+#define PPP_PROTOCOL_VJ_UNCOMP  0x002f    /* RFC 1144 */
+#define PPP_PROTOCOL_COMP       0x00fd    /* RFC 1962 */
 
 #define PPP_PROTOCOL_IPCP       0x8021    /* RFC 1332 */
 #define PPP_PROTOCOL_IPV6CP     0x8057    /* RFC 2472 */
+#define PPP_PROTOCOL_CCP        0x80fd    /* RFC 1962 */
 
 #define PPP_PROTOCOL_LCP        0xc021
 #define PPP_PROTOCOL_PAP        0xc023    /* RFC 1334 */
@@ -103,6 +107,10 @@ typedef struct lcp_packet ipcp_pkt_t;
 
 /* From ppp.c */
 int _ppp_enter_phase(int phase);
+void _ppp_update_accm(void);
+int _ppp_send_hdr(const uint8_t *hdr, size_t hlen, const uint8_t *data,
+                  size_t len, uint16_t proto);
+int _ppp_input(const uint8_t *buf, size_t len);
 
 /* From lcp.c */
 int _ppp_lcp_init(ppp_state_t *state);
@@ -112,5 +120,15 @@ int _ppp_pap_init(ppp_state_t *state);
 
 /* From ipcp.c */
 int _ppp_ipcp_init(ppp_state_t *state);
+int _ppp_ipcp_send(const uint8_t *data, size_t len);
+void _ppp_ipcp_input_error(void);
+
+/* From ccp.c */
+int _ppp_ccp_init(ppp_state_t *state);
+const uint8_t *_ppp_ccp_compress(uint16_t proto, const uint8_t *hdr,
+                                 size_t hlen, const uint8_t *data, size_t len,
+                                 size_t *out_len);
+void _ppp_ccp_input_error(void);
+void _ppp_ccp_proto_rejected(void);
 
 #endif /* !__LOCAL_PPP_PPP_INTERNAL_H */
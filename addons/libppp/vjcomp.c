@@ -0,0 +1,488 @@
+/* KallistiOS ##version##
+
+   libppp/vjcomp.c
+   Copyright (C) 2026 The KOS Team and contributors.
+*/
+
+/* Van Jacobson TCP/IP header compression, as described in RFC 1144.
+
+   Each end keeps a copy of the last header it saw for each TCP connection (a
+   "slot"). The first packet on a slot goes out whole, as an uncompressed TCP
+   packet, with the slot number stored in the IP protocol field. After that,
+   only the fields that changed get sent, as differences from the saved header,
+   which takes the usual 40 bytes of header down to 3 or 4 in the common
+   cases.
+
+   The TCP checksum is always sent, so if a frame gets lost and the two ends
+   end up with different ideas of what's in a slot, the packets that come out
+   of the decompressor fail the checksum and get dropped by TCP. The
+   retransmission that follows has a sequence number that can't be sent as a
+   difference, so it goes out uncompressed and puts the slot back in sync. */
+
+#include <string.h>
+
+#include <netinet/in.h>
+
+#include "ppp_internal.h"
+#include "vjcomp.h"
+#include "net_ipv4.h"
+
+/* Bits in the change mask at the front of a compressed packet. */
+#define NEW_U           0x01    /* Urgent pointer */
+#define NEW_W           0x02    /* Window */
+#define NEW_A           0x04    /* Ack */
+#define NEW_S           0x08    /* Sequence number */
+#define NEW_P           0x10    /* TCP push flag */
+#define NEW_I           0x20    /* IP ID */
+#define NEW_C           0x40    /* Connection number */
+
+/* Combinations of the low four bits that can't happen normally, which are used
+   for the two most common cases: echoed interactive traffic, where the
+   sequence number and ack both move forward by the length of the last packet,
+   and one-way data transfer, where just the sequence number does. */
+#define SPECIAL_I       (NEW_S | NEW_W | NEW_U)
+#define SPECIAL_D       (NEW_S | NEW_A | NEW_W | NEW_U)
+#define SPECIALS_MASK   (NEW_S | NEW_A | NEW_W | NEW_U)
+
+#define TCP_FLAG_FIN    0x01
+#define TCP_FLAG_SYN    0x02
+#define TCP_FLAG_RST    0x04
+#define TCP_FLAG_PSH    0x08
+#define TCP_FLAG_ACK    0x10
+#define TCP_FLAG_URG    0x20
+
+/* Headers are handled a byte at a time, since nothing about the buffers they
+   come in guarantees any particular alignment. */
+static inline uint32_t get16(const uint8_t *p) {
+    return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t get32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline void put16(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static inline void put32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+/* Differences go out as one byte if they fit (and aren't zero), otherwise as a
+   zero byte followed by the 16-bit value. */
+static inline uint8_t *vj_encode(uint8_t *cp, uint32_t val) {
+    if(val >= 256 || !val) {
+        *cp++ = 0;
+        *cp++ = (uint8_t)(val >> 8);
+        *cp++ = (uint8_t)val;
+    }
+    else {
+        *cp++ = (uint8_t)val;
+    }
+
+    return cp;
+}
+
+static int vj_decode(const uint8_t **cp, const uint8_t *end, uint32_t *val) {
+    const uint8_t *p = *cp;
+
+    if(p >= end)
+        return -1;
+
+    if(*p) {
+        *val = *p;
+        *cp = p + 1;
+        return 0;
+    }
+
+    if(end - p < 3)
+        return -1;
+
+    *val = (p[1] << 8) | p[2];
+    *cp = p + 3;
+    return 0;
+}
+
+/* Work out the length of the IP + TCP headers on a packet, or return 0 if it
+   isn't something we can deal with. */
+static size_t vj_hdr_len(const uint8_t *pkt, size_t len) {
+    size_t ihl, thl;
+
+    if(len < 40 || (pkt[0] >> 4) != 4)
+        return 0;
+
+    ihl = (pkt[0] & 0x0f) << 2;
+
+    if(ihl < 20 || ihl + 20 > len)
+        return 0;
+
+    thl = (pkt[ihl + 12] >> 4) << 2;
+
+    if(thl < 20 || ihl + thl > len || ihl + thl > VJ_MAX_HDR)
+        return 0;
+
+    return ihl + thl;
+}
+
+void _ppp_vj_init(vj_state_t *vj, int tx_slots, int rx_slots, int comp_cid) {
+    memset(vj, 0, sizeof(vj_state_t));
+
+    if(tx_slots > VJ_MAX_SLOTS)
+        tx_slots = VJ_MAX_SLOTS;
+
+    if(rx_slots > VJ_MAX_SLOTS)
+        rx_slots = VJ_MAX_SLOTS;
+
+    vj->tx_slots = tx_slots;
+    vj->tx_comp_cid = comp_cid;
+    vj->rx_slots = rx_slots;
+
+    /* Make sure the first packet we send on any slot has the connection number
+       in it, and that we don't accept compressed packets until we've seen an
+       uncompressed one. */
+    vj->last_xmit = 0xff;
+    vj->toss = 1;
+}
+
+uint16_t _ppp_vj_compress(vj_state_t *vj, const uint8_t *pkt, size_t len,
+                          uint8_t *hdr, size_t *hlen, size_t *skip) {
+    vj_slot_t *slot = NULL, *oldest = NULL, *s;
+    const uint8_t *th;
+    uint8_t *oip, *oth, *cp;
+    uint8_t deltas[16], changes = 0, flags, id;
+    uint32_t delta, delta_s = 0, delta_a = 0, olen;
+    size_t hl, ihl;
+    int i;
+
+    if(!vj->tx_slots || len < 40 || pkt[9] != IPPROTO_TCP)
+        return PPP_PROTOCOL_IPv4;
+
+    /* Don't bother with fragments, or anything we can't parse. */
+    if((get16(pkt + 6) & 0x3fff) || !(hl = vj_hdr_len(pkt, len)))
+        return PPP_PROTOCOL_IPv4;
+
+    ihl = (pkt[0] & 0x0f) << 2;
+    th = pkt + ihl;
+    flags = th[13];
+
+    /* Connection setup and teardown go out as they are. So does anything
+       without an ack, which is pretty much nothing else. */
+    if((flags & (TCP_FLAG_SYN | TCP_FLAG_FIN | TCP_FLAG_RST | TCP_FLAG_ACK)) !=
+       TCP_FLAG_ACK)
+        return PPP_PROTOCOL_IPv4;
+
+    ++vj->stats.out_pkts;
+
+    /* Look for the slot for this connection, keeping track of the least
+       recently used one in case we don't find it. */
+    for(i = 0; i < vj->tx_slots; ++i) {
+        s = &vj->tx[i];
+
+        if(s->valid && !memcmp(s->hdr + 12, pkt + 12, 8) &&
+           !memcmp(s->hdr + ((s->hdr[0] & 0x0f) << 2), th, 4)) {
+            slot = s;
+            break;
+        }
+
+        if(!oldest || (oldest->valid &&
+                       (!s->valid || (int32_t)(s->used - oldest->used) < 0)))
+            oldest = s;
+    }
+
+    if(!slot) {
+        ++vj->stats.out_misses;
+        slot = oldest;
+        goto uncompressed;
+    }
+
+    oip = slot->hdr;
+    oth = oip + ihl;
+    cp = deltas;
+
+    /* Anything that isn't expected to change between packets has to be the
+       same as last time, or we can't compress this one. */
+    if(oip[0] != pkt[0] || oip[1] != pkt[1] || memcmp(oip + 6, pkt + 6, 4) ||
+       slot->hlen != hl || memcmp(oip + 20, pkt + 20, ihl - 20) ||
+       memcmp(oth + 20, th + 20, hl - ihl - 20))
+        goto uncompressed;
+
+    if(flags & TCP_FLAG_URG) {
+        cp = vj_encode(cp, get16(th + 18));
+        changes |= NEW_U;
+    }
+    else if(get16(th + 18) != get16(oth + 18)) {
+        goto uncompressed;
+    }
+
+    if((delta = (get16(th + 14) - get16(oth + 14)) & 0xffff)) {
+        cp = vj_encode(cp, delta);
+        changes |= NEW_W;
+    }
+
+    if((delta_a = get32(th + 8) - get32(oth + 8))) {
+        if(delta_a > 0xffff)
+            goto uncompressed;
+
+        cp = vj_encode(cp, delta_a);
+        changes |= NEW_A;
+    }
+
+    if((delta_s = get32(th + 4) - get32(oth + 4))) {
+        if(delta_s > 0xffff)
+            goto uncompressed;
+
+        cp = vj_encode(cp, delta_s);
+        changes |= NEW_S;
+    }
+
+    olen = get16(oip + 2);
+
+    switch(changes) {
+        case 0:
+            /* Nothing changed. That's fine for the first bit of data after a
+               bare ack, but otherwise it's probably a retransmission, which is
+               a good time to make sure the other side is in sync. */
+            if(get16(pkt + 2) != olen && olen == hl)
+                break;
+
+            goto uncompressed;
+
+        case SPECIAL_I:
+        case SPECIAL_D:
+            /* These would be mistaken for the special cases below. */
+            goto uncompressed;
+
+        case NEW_S | NEW_A:
+            if(delta_s == delta_a && delta_s == olen - hl) {
+                changes = SPECIAL_I;
+                cp = deltas;
+            }
+
+            break;
+
+        case NEW_S:
+            if(delta_s == olen - hl) {
+                changes = SPECIAL_D;
+                cp = deltas;
+            }
+
+            break;
+    }
+
+    if((delta = (get16(pkt + 4) - get16(oip + 4)) & 0xffff) != 1) {
+        cp = vj_encode(cp, delta);
+        changes |= NEW_I;
+    }
+
+    if(flags & TCP_FLAG_PSH)
+        changes |= NEW_P;
+
+    /* This is what the other side will have once it gets this packet. */
+    memcpy(slot->hdr, pkt, hl);
+    slot->used = ++vj->clock;
+    id = (uint8_t)(slot - vj->tx);
+
+    /* Put the compressed header together. The connection number can be left
+       out if it's the same as last time, and the peer is fine with that. */
+    hdr[0] = changes;
+    i = 1;
+
+    if(!vj->tx_comp_cid || vj->last_xmit != id) {
+        vj->last_xmit = id;
+        hdr[0] |= NEW_C;
+        hdr[i++] = id;
+    }
+
+    hdr[i++] = th[16];
+    hdr[i++] = th[17];
+    memcpy(hdr + i, deltas, cp - deltas);
+
+    *hlen = i + (cp - deltas);
+    *skip = hl;
+
+    ++vj->stats.out_compressed;
+    vj->stats.out_hdr_bytes += hl;
+    vj->stats.out_comp_bytes += *hlen;
+
+    return PPP_PROTOCOL_VJ_COMP;
+
+uncompressed:
+    /* Send the whole header, with the slot number in place of the protocol, so
+       the other side can save it. */
+    id = (uint8_t)(slot - vj->tx);
+    memcpy(slot->hdr, pkt, hl);
+    slot->hlen = (uint16_t)hl;
+    slot->valid = 1;
+    slot->used = ++vj->clock;
+    vj->last_xmit = id;
+
+    memcpy(hdr, pkt, hl);
+    hdr[9] = id;
+    *hlen = hl;
+    *skip = hl;
+
+    ++vj->stats.out_uncompressed;
+
+    return PPP_PROTOCOL_VJ_UNCOMP;
+}
+
+ssize_t _ppp_vj_uncompress(vj_state_t *vj, uint16_t proto, const uint8_t *buf,
+                           size_t len, uint8_t *out) {
+    const uint8_t *cp = buf, *end = buf + len;
+    uint8_t changes, *th;
+    vj_slot_t *s;
+    uint32_t val;
+    uint16_t sum;
+    size_t hl, ihl, plen;
+
+    if(!vj->rx_slots)
+        goto bad;
+
+    if(proto == PPP_PROTOCOL_VJ_UNCOMP) {
+        /* Save the header, and put the real protocol back. */
+        if(!(hl = vj_hdr_len(buf, len)) || buf[9] >= vj->rx_slots)
+            goto bad;
+
+        s = &vj->rx[buf[9]];
+        vj->last_recv = buf[9];
+        vj->toss = 0;
+
+        memcpy(s->hdr, buf, hl);
+        s->hdr[9] = IPPROTO_TCP;
+        s->hlen = (uint16_t)hl;
+        s->valid = 1;
+
+        memcpy(out, buf, len);
+        out[9] = IPPROTO_TCP;
+
+        ++vj->stats.in_uncompressed;
+        return (ssize_t)len;
+    }
+
+    if(len < 3)
+        goto bad;
+
+    changes = *cp++;
+
+    if(changes & NEW_C) {
+        if(*cp >= vj->rx_slots)
+            goto bad;
+
+        vj->last_recv = *cp++;
+        vj->toss = 0;
+    }
+    else if(vj->toss) {
+        /* We've lost track of where things are, so we have to wait for the
+           connection number to be sent explicitly. */
+        ++vj->stats.in_tossed;
+        return -1;
+    }
+
+    s = &vj->rx[vj->last_recv];
+
+    if(!s->valid || end - cp < 2)
+        goto bad;
+
+    /* Work on a copy of the saved header, so it's left alone if this packet
+       turns out to be bad. */
+    hl = s->hlen;
+    ihl = (s->hdr[0] & 0x0f) << 2;
+    memcpy(out, s->hdr, hl);
+    th = out + ihl;
+
+    th[16] = *cp++;
+    th[17] = *cp++;
+
+    if(changes & NEW_P)
+        th[13] |= TCP_FLAG_PSH;
+    else
+        th[13] &= ~TCP_FLAG_PSH;
+
+    switch(changes & SPECIALS_MASK) {
+        case SPECIAL_I:
+            val = get16(out + 2) - hl;
+            put32(th + 8, get32(th + 8) + val);
+            put32(th + 4, get32(th + 4) + val);
+            break;
+
+        case SPECIAL_D:
+            put32(th + 4, get32(th + 4) + get16(out + 2) - hl);
+            break;
+
+        default:
+            if(changes & NEW_U) {
+                if(vj_decode(&cp, end, &val))
+                    goto bad;
+
+                th[13] |= TCP_FLAG_URG;
+                put16(th + 18, val);
+            }
+            else {
+                th[13] &= ~TCP_FLAG_URG;
+            }
+
+            if(changes & NEW_W) {
+                if(vj_decode(&cp, end, &val))
+                    goto bad;
+
+                put16(th + 14, get16(th + 14) + val);
+            }
+
+            if(changes & NEW_A) {
+                if(vj_decode(&cp, end, &val))
+                    goto bad;
+
+                put32(th + 8, get32(th + 8) + val);
+            }
+
+            if(changes & NEW_S) {
+                if(vj_decode(&cp, end, &val))
+                    goto bad;
+
+                put32(th + 4, get32(th + 4) + val);
+            }
+
+            break;
+    }
+
+    if(changes & NEW_I) {
+        if(vj_decode(&cp, end, &val))
+            goto bad;
+    }
+    else {
+        val = 1;
+    }
+
+    put16(out + 4, get16(out + 4) + val);
+
+    /* Fix up the IP length and checksum to go with what's left. */
+    plen = end - cp;
+
+    if(hl + plen > 0xffff)
+        goto bad;
+
+    put16(out + 2, hl + plen);
+    out[10] = out[11] = 0;
+    sum = net_ipv4_checksum(out, ihl, 0);
+    memcpy(out + 10, &sum, 2);
+
+    memcpy(s->hdr, out, hl);
+    memcpy(out + hl, cp, plen);
+
+    ++vj->stats.in_compressed;
+    return (ssize_t)(hl + plen);
+
+bad:
+    vj->toss = 1;
+    ++vj->stats.in_errors;
+    return -1;
+}
+
+void _ppp_vj_input_error(vj_state_t *vj) {
+    vj->toss = 1;
+}
@@ -0,0 +1,91 @@
+/* KallistiOS ##version##
+
+   libppp/vjcomp.h
+   Copyright (C) 2026 The KOS Team and contributors.
+*/
+
+#ifndef __LOCAL_PPP_VJCOMP_H
+#define __LOCAL_PPP_VJCOMP_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Van Jacobson TCP/IP header compression - RFC 1144. This is negotiated by
+   IPCP (RFC 1332), and only handles IPv4. */
+
+/* Most connection slots we'll keep in each direction. RFC 1332 allows up to
+   256, but 16 is what everyone uses in practice. */
+#define VJ_MAX_SLOTS    16
+
+/* Biggest IP + TCP header we'll compress. Anything with more options than this
+   just goes out as a regular IP packet. */
+#define VJ_MAX_HDR      128
+
+/* Longest a compressed header can be: the change mask, connection number and
+   TCP checksum, plus five deltas of up to three bytes each. */
+#define VJ_MAX_COMP_HDR 19
+
+typedef struct vj_slot {
+    uint32_t used;                  /* When this slot was last used (tx only) */
+    uint16_t hlen;                  /* Length of the saved headers */
+    uint8_t valid;                  /* Nonzero once hdr is filled in */
+    uint8_t hdr[VJ_MAX_HDR];        /* Last IP + TCP header for the slot */
+} vj_slot_t;
+
+typedef struct vj_stats {
+    uint32_t out_pkts;              /* TCP/IP packets handed to the compressor */
+    uint32_t out_compressed;        /* ... sent as compressed TCP */
+    uint32_t out_uncompressed;      /* ... sent as uncompressed TCP */
+    uint32_t out_misses;            /* Packets that needed a new slot */
+    uint32_t out_hdr_bytes;         /* IP + TCP header bytes compressed */
+    uint32_t out_comp_bytes;        /* ... and what they compressed to */
+    uint32_t in_compressed;         /* Compressed TCP packets received */
+    uint32_t in_uncompressed;       /* Uncompressed TCP packets received */
+    uint32_t in_errors;             /* Received packets we couldn't use */
+    uint32_t in_tossed;             /* Packets dropped after an error */
+} vj_stats_t;
+
+typedef struct vj_state {
+    /* Compressor (what we send). tx_slots is 0 if the peer didn't ask us to
+       compress. */
+    int tx_slots;
+    int tx_comp_cid;
+    uint8_t last_xmit;
+    uint32_t clock;
+
+    /* Decompressor (what we receive). rx_slots is 0 if the peer didn't agree
+       to send compressed headers. */
+    int rx_slots;
+    uint8_t last_recv;
+    int toss;
+
+    vj_stats_t stats;
+
+    vj_slot_t tx[VJ_MAX_SLOTS];
+    vj_slot_t rx[VJ_MAX_SLOTS];
+} vj_state_t;
+
+/* Set up (or reset) the state for a link. comp_cid is whether the peer will
+   accept packets with the connection number left out. */
+void _ppp_vj_init(vj_state_t *vj, int tx_slots, int rx_slots, int comp_cid);
+
+/* Compress an IPv4 packet. Returns the PPP protocol number to send it with. For
+   PPP_PROTOCOL_IPv4, the packet goes out as it is. Otherwise, what goes out is
+   the hlen bytes written to hdr (which must have room for VJ_MAX_HDR bytes),
+   followed by the packet from offset *skip on. */
+uint16_t _ppp_vj_compress(vj_state_t *vj, const uint8_t *pkt, size_t len,
+                          uint8_t *hdr, size_t *hlen, size_t *skip);
+
+/* Rebuild the IPv4 packet from a received compressed or uncompressed TCP
+   packet. The packet is written to out, which must have room for len +
+   VJ_MAX_HDR bytes. Returns the length of the rebuilt packet, or -1 if it
+   should be dropped. */
+ssize_t _ppp_vj_uncompress(vj_state_t *vj, uint16_t proto, const uint8_t *buf,
+                           size_t len, uint8_t *out);
+
+/* Tell the decompressor that a frame was lost (bad FCS, too long, etc). It
+   drops compressed packets until it sees one that sets the connection number
+   explicitly. */
+void _ppp_vj_input_error(vj_state_t *vj);
+
+#endif /* !__LOCAL_PPP_VJCOMP_H */
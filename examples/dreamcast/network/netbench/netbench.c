@@ -0,0 +1,550 @@
+/* KallistiOS ##version##
+
+   netbench.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+   This example is a small iperf-style benchmark of the network stack. It runs
+   both ends of each test over the loopback device, so it doesn't need any
+   network hardware at all, and what it measures is purely the cost of the
+   stack itself (TCP, UDP, IP, and the socket layer).
+
+   Five tests are run:
+       - TCP throughput: one thread streams data to another for a while.
+       - TCP latency: a small message is bounced back and forth.
+       - UDP throughput: datagrams are blasted across, and we count how many
+         make it (the loopback device will drop some if we outrun it).
+       - UDP packet rate: lots of tiny datagrams are sent, first one at a time
+         with sendto() and recv(), then in batches with sendmmsg() and
+         recvmmsg(), to show what batching saves.
+       - UDP latency: a small datagram is bounced back and forth.
+
+   The TCP throughput test is then run again with some delay and loss added on
+   the loopback device, to show how TCP copes with a less friendly network.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <arch/arch.h>
+#include <arch/timer.h>
+#include <kos/net.h>
+#include <kos/thread.h>
+
+KOS_INIT_FLAGS(INIT_DEFAULT | INIT_NET);
+
+#define BENCH_PORT      5201
+#define TCP_BUF_SIZE    8192
+#define UDP_PKT_SIZE    1024
+#define TEST_TIME       5000        /* In milliseconds */
+#define LAT_ROUNDS      1000
+#define IDLE_TIME       500         /* In milliseconds */
+#define UDP_SMALL_SIZE  32
+#define UDP_BATCH       32
+
+static uint8 buf[TCP_BUF_SIZE];
+
+/* Wait for a socket to have something to read, giving up if it's been quiet
+   for a while. */
+static int wait_readable(int sock) {
+    struct pollfd pfd;
+
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    return poll(&pfd, 1, IDLE_TIME) > 0;
+}
+
+static void loop_addr(struct sockaddr_in *addr, int port) {
+    memset(addr, 0, sizeof(struct sockaddr_in));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+}
+
+static void print_rate(const char *name, uint64 bytes, uint64 us) {
+    printf("%s: %llu bytes in %llu ms, %llu KiB/s\n", name,
+           (unsigned long long)bytes, (unsigned long long)(us / 1000),
+           (unsigned long long)(us ? bytes * 1000000 / 1024 / us : 0));
+}
+
+/* TCP throughput. The listening socket is set up before the sink thread is
+   started, so that the client can't try to connect before it's there. */
+static void *tcp_sink(void *data) {
+    int lsock = (int)data, sock;
+    ssize_t sz;
+    uint64 total = 0;
+    static uint8 rbuf[TCP_BUF_SIZE];
+
+    if((sock = accept(lsock, NULL, NULL)) < 0) {
+        perror("accept");
+        return NULL;
+    }
+
+    while((sz = read(sock, rbuf, TCP_BUF_SIZE)) > 0) {
+        total += sz;
+    }
+
+    close(sock);
+    return (void *)(uint32)total;
+}
+
+static int tcp_listen(int port) {
+    struct sockaddr_in addr;
+    int sock;
+
+    if((sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    loop_addr(&addr, port);
+
+    if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+       listen(sock, 1) < 0) {
+        perror("bind/listen");
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+static int tcp_connect(int port) {
+    struct sockaddr_in addr;
+    int sock;
+
+    if((sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    loop_addr(&addr, port);
+
+    if(connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+static void tcp_throughput(const char *name) {
+    kthread_t *thd;
+    int lsock, sock;
+    uint64 start, now;
+    void *rv;
+
+    if((lsock = tcp_listen(BENCH_PORT)) < 0)
+        return;
+
+    thd = thd_create(0, tcp_sink, (void *)lsock);
+
+    if((sock = tcp_connect(BENCH_PORT)) < 0) {
+        close(lsock);
+        thd_join(thd, NULL);
+        return;
+    }
+
+    start = timer_us_gettime64();
+
+    do {
+        if(write(sock, buf, TCP_BUF_SIZE) < 0) {
+            perror("write");
+            break;
+        }
+
+        now = timer_us_gettime64();
+    } while(now - start < TEST_TIME * 1000);
+
+    close(sock);
+    thd_join(thd, &rv);
+    now = timer_us_gettime64();
+    close(lsock);
+
+    print_rate(name, (uint64)(uint32)rv, now - start);
+}
+
+/* TCP latency: send a small message, and wait for it to come back. */
+static void *tcp_echo(void *data) {
+    int lsock = (int)data, sock;
+    uint8 msg[64];
+    ssize_t sz;
+
+    if((sock = accept(lsock, NULL, NULL)) < 0) {
+        perror("accept");
+        return NULL;
+    }
+
+    while((sz = read(sock, msg, sizeof(msg))) > 0) {
+        if(write(sock, msg, sz) != sz)
+            break;
+    }
+
+    close(sock);
+    return NULL;
+}
+
+static void tcp_latency(void) {
+    kthread_t *thd;
+    int lsock, sock, i, one = 1;
+    uint8 msg[64];
+    uint64 start, end;
+    ssize_t sz, got;
+
+    if((lsock = tcp_listen(BENCH_PORT + 1)) < 0)
+        return;
+
+    thd = thd_create(0, tcp_echo, (void *)lsock);
+
+    if((sock = tcp_connect(BENCH_PORT + 1)) < 0) {
+        close(lsock);
+        thd_join(thd, NULL);
+        return;
+    }
+
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    memset(msg, 0x5A, sizeof(msg));
+    start = timer_us_gettime64();
+
+    for(i = 0; i < LAT_ROUNDS; ++i) {
+        if(write(sock, msg, sizeof(msg)) != sizeof(msg)) {
+            perror("write");
+            break;
+        }
+
+        for(got = 0; got < (ssize_t)sizeof(msg); got += sz) {
+            if((sz = read(sock, msg + got, sizeof(msg) - got)) <= 0)
+                break;
+        }
+
+        if(got != sizeof(msg))
+            break;
+    }
+
+    end = timer_us_gettime64();
+    close(sock);
+    thd_join(thd, NULL);
+    close(lsock);
+
+    if(i)
+        printf("TCP latency: %d round trips, %llu us average\n", i,
+               (unsigned long long)((end - start) / i));
+}
+
+/* UDP throughput. The sink counts what it gets until it goes quiet. */
+static volatile uint32 udp_rcvd;
+
+static void *udp_sink(void *data) {
+    int sock = (int)data;
+    static uint8 rbuf[UDP_PKT_SIZE];
+
+    while(wait_readable(sock)) {
+        if(recv(sock, rbuf, UDP_PKT_SIZE, 0) <= 0)
+            break;
+
+        ++udp_rcvd;
+    }
+
+    return NULL;
+}
+
+static int udp_socket(int port) {
+    struct sockaddr_in addr;
+    int sock;
+
+    if((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    if(port) {
+        loop_addr(&addr, port);
+
+        if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            perror("bind");
+            close(sock);
+            return -1;
+        }
+    }
+
+    return sock;
+}
+
+static void udp_throughput(void) {
+    struct sockaddr_in addr;
+    kthread_t *thd;
+    int rsock, ssock;
+    uint32 sent = 0;
+    uint64 start, end;
+
+    if((rsock = udp_socket(BENCH_PORT)) < 0)
+        return;
+
+    if((ssock = udp_socket(0)) < 0) {
+        close(rsock);
+        return;
+    }
+
+    udp_rcvd = 0;
+    thd = thd_create(0, udp_sink, (void *)rsock);
+    loop_addr(&addr, BENCH_PORT);
+    start = timer_us_gettime64();
+
+    do {
+        if(sendto(ssock, buf, UDP_PKT_SIZE, 0, (struct sockaddr *)&addr,
+                  sizeof(addr)) == UDP_PKT_SIZE)
+            ++sent;
+
+        /* Give the receiver a chance to keep up. */
+        if(!(sent & 15))
+            thd_pass();
+
+        end = timer_us_gettime64();
+    } while(end - start < TEST_TIME * 1000);
+
+    thd_join(thd, NULL);
+    close(ssock);
+    close(rsock);
+
+    print_rate("UDP throughput", (uint64)udp_rcvd * UDP_PKT_SIZE, end - start);
+    printf("UDP throughput: %lu sent, %lu received (%lu%% lost)\n",
+           (unsigned long)sent, (unsigned long)udp_rcvd,
+           (unsigned long)(sent ? (sent - udp_rcvd) * 100 / sent : 0));
+}
+
+/* UDP packet rate. Both ends do the same amount of work between yielding to
+   each other either way, so the only difference is in the calls made. */
+static volatile int udp_batch;
+
+static void setup_msgs(struct mmsghdr *msgs, struct iovec *iovs, uint8 *bufs,
+                       struct sockaddr_in *addr) {
+    int i;
+
+    memset(msgs, 0, sizeof(struct mmsghdr) * UDP_BATCH);
+
+    for(i = 0; i < UDP_BATCH; ++i) {
+        iovs[i].iov_base = bufs + i * UDP_SMALL_SIZE;
+        iovs[i].iov_len = UDP_SMALL_SIZE;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+
+        if(addr) {
+            msgs[i].msg_hdr.msg_name = addr;
+            msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        }
+    }
+}
+
+static void *udp_small_sink(void *data) {
+    int sock = (int)data, n;
+    static uint8 rbufs[UDP_BATCH * UDP_SMALL_SIZE];
+    static struct mmsghdr msgs[UDP_BATCH];
+    static struct iovec iovs[UDP_BATCH];
+
+    setup_msgs(msgs, iovs, rbufs, NULL);
+
+    while(wait_readable(sock)) {
+        if(udp_batch) {
+            if((n = recvmmsg(sock, msgs, UDP_BATCH, MSG_DONTWAIT, NULL)) <= 0)
+                break;
+
+            udp_rcvd += n;
+        }
+        else {
+            while(recv(sock, rbufs, UDP_SMALL_SIZE, MSG_DONTWAIT) > 0) {
+                ++udp_rcvd;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void udp_rate(int batch) {
+    static struct mmsghdr msgs[UDP_BATCH];
+    static struct iovec iovs[UDP_BATCH];
+    struct sockaddr_in addr;
+    net_udp_stats_t before, after;
+    kthread_t *thd;
+    int rsock, ssock, i, n;
+    uint32 sent = 0;
+    uint64 start, end;
+
+    if((rsock = udp_socket(BENCH_PORT + 2)) < 0)
+        return;
+
+    if((ssock = udp_socket(0)) < 0) {
+        close(rsock);
+        return;
+    }
+
+    loop_addr(&addr, BENCH_PORT + 2);
+    setup_msgs(msgs, iovs, buf, &addr);
+
+    udp_rcvd = 0;
+    udp_batch = batch;
+    before = net_udp_get_stats();
+    thd = thd_create(0, udp_small_sink, (void *)rsock);
+    start = timer_us_gettime64();
+
+    do {
+        if(batch) {
+            if((n = sendmmsg(ssock, msgs, UDP_BATCH, 0)) > 0)
+                sent += n;
+        }
+        else {
+            for(i = 0; i < UDP_BATCH; ++i) {
+                if(sendto(ssock, buf, UDP_SMALL_SIZE, 0,
+                          (struct sockaddr *)&addr,
+                          sizeof(addr)) == UDP_SMALL_SIZE)
+                    ++sent;
+            }
+        }
+
+        /* Don't get more than a couple of batches ahead of the receiver, or
+           the loopback device starts dropping things and this ends up
+           measuring that instead. Something might have been lost though, so
+           don't wait forever. */
+        end = timer_us_gettime64();
+
+        do {
+            thd_pass();
+        } while(sent - udp_rcvd > 2 * UDP_BATCH &&
+                timer_us_gettime64() - end < 10000);
+
+        end = timer_us_gettime64();
+    } while(end - start < TEST_TIME * 1000);
+
+    thd_join(thd, NULL);
+    after = net_udp_get_stats();
+    close(ssock);
+    close(rsock);
+
+    printf("UDP rate (%s): %llu datagrams/s sent, %llu/s received, "
+           "%lu dropped on a full queue\n",
+           batch ? "sendmmsg/recvmmsg" : "sendto/recv",
+           (unsigned long long)sent * 1000000 / (end - start),
+           (unsigned long long)udp_rcvd * 1000000 / (end - start),
+           (unsigned long)(after.pkt_recv_no_space -
+                           before.pkt_recv_no_space));
+}
+
+/* UDP latency. */
+static void *udp_echo(void *data) {
+    int sock = (int)data;
+    struct sockaddr_in from;
+    socklen_t flen;
+    uint8 msg[64];
+    ssize_t sz;
+
+    while(wait_readable(sock)) {
+        flen = sizeof(from);
+
+        if((sz = recvfrom(sock, msg, sizeof(msg), 0, (struct sockaddr *)&from,
+                          &flen)) <= 0)
+            break;
+
+        sendto(sock, msg, sz, 0, (struct sockaddr *)&from, flen);
+    }
+
+    return NULL;
+}
+
+static void udp_latency(void) {
+    struct sockaddr_in addr;
+    kthread_t *thd;
+    int esock, sock, i;
+    uint8 msg[64];
+    uint64 start, end;
+
+    if((esock = udp_socket(BENCH_PORT + 1)) < 0)
+        return;
+
+    if((sock = udp_socket(0)) < 0) {
+        close(esock);
+        return;
+    }
+
+    thd = thd_create(0, udp_echo, (void *)esock);
+    loop_addr(&addr, BENCH_PORT + 1);
+    memset(msg, 0xA5, sizeof(msg));
+    start = timer_us_gettime64();
+
+    for(i = 0; i < LAT_ROUNDS; ++i) {
+        if(sendto(sock, msg, sizeof(msg), 0, (struct sockaddr *)&addr,
+                  sizeof(addr)) != sizeof(msg))
+            break;
+
+        /* If the reply got lost, we'd wait forever without the timeout. */
+        if(!wait_readable(sock) ||
+           recv(sock, msg, sizeof(msg), 0) != sizeof(msg))
+            break;
+    }
+
+    end = timer_us_gettime64();
+    thd_join(thd, NULL);
+    close(sock);
+    close(esock);
+
+    if(i)
+        printf("UDP latency: %d round trips, %llu us average\n", i,
+               (unsigned long long)((end - start) / i));
+}
+
+int main(int argc, char *argv[]) {
+    net_loop_params_t params;
+    net_loop_stats_t stats;
+
+    (void)argc;
+    (void)argv;
+
+    if(!net_loop_dev) {
+        printf("No loopback device, is networking initialized?\n");
+        return EXIT_FAILURE;
+    }
+
+    memset(buf, 0xAA, sizeof(buf));
+
+    printf("Benchmarking the network stack over the loopback device...\n");
+
+    tcp_throughput("TCP throughput");
+    tcp_latency();
+    udp_throughput();
+    udp_rate(0);
+    udp_rate(1);
+    udp_latency();
+
+    /* Now make things a bit harder on TCP. */
+    memset(&params, 0, sizeof(params));
+    params.delay = 2000;
+    params.loss = 10;
+    params.reorder = 10;
+    net_loop_set_params(&params);
+
+    printf("With 2 ms delay, 1%% loss, and 1%% reordering:\n");
+    tcp_throughput("TCP throughput");
+
+    memset(&params, 0, sizeof(params));
+    net_loop_set_params(&params);
+
+    stats = net_loop_get_stats();
+    printf("Loopback: %lu sent, %lu delivered, %lu lost, %lu reordered, "
+           "%lu dropped\n", (unsigned long)stats.pkt_sent,
+           (unsigned long)stats.pkt_delivered, (unsigned long)stats.pkt_lost,
+           (unsigned long)stats.pkt_reordered,
+           (unsigned long)stats.pkt_dropped);
+
+    return 0;
+}
@@ -263,11 +263,15 @@ typedef struct fs_socket_proto {
                             but not any from lower-level protocols
         \param  size        The size of the packet, not including any lower-
                             level protocol headers
+        \param  pbuf        The packet buffer holding the packet, if it came
+                            in through one, otherwise NULL. The protocol may
+                            take its own reference to it with
+                            net_pbuf_addref() rather than copying the data.
         \retval -1          On error (the packet is discarded)
         \retval 0           On success
     */
     int (*input)(netif_t *src, int domain, const void *hdr, const uint8 *data,
-                 size_t size);
+                 size_t size, net_pbuf_t *pbuf);
 
     /** \brief  Get socket options.
 
@@ -353,6 +357,43 @@ typedef struct fs_socket_proto {
                             currently true in the socket. 0 if none are true.
     */
     short (*poll)(net_socket_t *s, short events);
+
+    /** \brief  Receive several messages on a socket created with the protocol.
+
+        This function should implement the ::recvmmsg() system call for the
+        protocol (and is also used for ::recvmsg(), with one message). This
+        may be NULL, in which case fs_socket calls recvfrom() for each buffer
+        of each message instead, and only blocks for the first one.
+
+        \param  s           The socket to receive data on
+        \param  msgvec      The messages to fill in
+        \param  vlen        The number of messages
+        \param  flags       Flags to the function
+        \param  timeout     How long to wait for all of the messages (NULL to
+                            wait forever)
+        \retval -1          On error (set errno appropriately)
+        \retval n           The number of messages received
+    */
+    int (*recvmmsg)(net_socket_t *s, struct mmsghdr *msgvec, unsigned int vlen,
+                    int flags, struct timespec *timeout);
+
+    /** \brief  Send several messages on a socket created with the protocol.
+
+        This function should implement the ::sendmmsg() system call for the
+        protocol (and is also used for ::sendmsg(), with one message). This
+        may be NULL, in which case fs_socket calls sendto() for each buffer of
+        each message instead.
+
+        \param  s           The socket to send data on
+        \param  msgvec      The messages to send
+        \param  vlen        The number of messages
+        \param  flags       Flags to the function
+        \retval -1          On error, if no messages were sent (set errno
+                            appropriately)
+        \retval n           The number of messages sent
+    */
+    int (*sendmmsg)(net_socket_t *s, struct mmsghdr *msgvec, unsigned int vlen,
+                    int flags);
 } fs_socket_proto_t;
 
 /** \brief  Initializer for the entry field in the fs_socket_proto_t struct. */
@@ -410,12 +451,13 @@ net_socket_t *fs_socket_open_sock(fs_socket_proto_t *proto);
     \param  data        The upper-level packet, without any lower-level protocol
                         headers, but with the upper-level ones intact
     \param  size        The size of the packet (the data parameter)
+    \param  pbuf        The packet buffer holding the packet, or NULL
     \retval -2          The protocol is not known
     \retval -1          Protocol-level error processing packet
     \retval 0           On success
 */
 int fs_socket_input(netif_t *src, int domain, int protocol, const void *hdr,
-                    const uint8 *data, size_t size);
+                    const uint8 *data, size_t size, net_pbuf_t *pbuf);
 
 /** \brief  Add a new protocol for use with fs_socket.
 
@@ -0,0 +1,207 @@
+/* KallistiOS ##version##
+
+   include/kos/ktimer.h
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/** \file   kos/ktimer.h
+    \brief  Kernel software timers.
+
+    This file contains a facility for scheduling a function to be called at
+    some point in the future, either once or periodically. Timers are kept on
+    a timer wheel that is checked by the scheduler's timer interrupt, and the
+    hardware timer is programmed to fire when the next timer is due (rather
+    than just on the next scheduler tick), so timers fire close to when they
+    were asked to.
+
+    Deadlines are specified in microseconds, but timers are kept with a
+    resolution of one millisecond, and a timer will never fire early.
+    Timers are serviced from the scheduler's timer interrupt. In cooperative
+    threading mode that interrupt is only programmed when there is a timer
+    pending, and it never forces a context switch, so threaded callbacks (see
+    below) will not run until the current thread blocks or yields.
+
+    A timer's callback can either be run directly from the timer interrupt
+    (the default), or from a dedicated kernel thread (KTIMER_THREAD). Callbacks
+    run from the interrupt must follow all the usual rules for interrupt
+    handlers, most importantly that they must not block. Callbacks run from
+    the thread can do anything a normal thread can, but should not sleep for
+    long, since all threaded timers share the one thread.
+
+    The ktimer_t structure is owned by the caller, and must remain valid until
+    the timer has been cancelled (or has fired, for a one-shot timer).
+*/
+
+#ifndef __KOS_KTIMER_H
+#define __KOS_KTIMER_H
+
+#include <sys/cdefs.h>
+__BEGIN_DECLS
+
+#include <sys/queue.h>
+#include <arch/types.h>
+
+struct ktimer;
+
+/** \brief  Kernel timer callback type.
+
+    \param  t               The timer that fired.
+    \param  data            The data pointer given to ktimer_setup().
+*/
+typedef void (*ktimer_cb_t)(struct ktimer *t, void *data);
+
+/** \brief  Kernel timer structure.
+
+    All of the fields in here are private, use the functions below to work with
+    timers.
+
+    \headerfile kos/ktimer.h
+*/
+typedef struct ktimer {
+    /** \cond */
+    LIST_ENTRY(ktimer) entry;
+    TAILQ_ENTRY(ktimer) runq;
+    uint64 expire;
+    uint64 period;
+    uint64 tick;
+    ktimer_cb_t cb;
+    void *data;
+    int flags;
+    int state;
+    /** \endcond */
+} ktimer_t;
+
+/** \defgroup ktimer_flags          Kernel timer flags
+    @{
+*/
+/** \brief  Run the callback from the timer thread, not the interrupt. */
+#define KTIMER_THREAD       0x00000001
+/** @} */
+
+/** \brief  Initializer for a statically allocated timer.
+
+    \param  cb              The callback function.
+    \param  data            Data to pass to the callback.
+    \param  flags           \ref ktimer_flags for the timer.
+*/
+#define KTIMER_INITIALIZER(cb, data, flags) \
+    { { NULL, NULL }, { NULL, NULL }, 0, 0, 0, (cb), (data), (flags), 0 }
+
+/** \brief  Set up a timer.
+
+    This function initializes a timer, but does not start it. This must not be
+    called on a timer that is pending.
+
+    \param  t               The timer to set up.
+    \param  cb              The callback function.
+    \param  data            Data to pass to the callback.
+    \param  flags           \ref ktimer_flags for the timer.
+*/
+void ktimer_setup(ktimer_t *t, ktimer_cb_t cb, void *data, int flags);
+
+/** \brief  Start a timer.
+
+    This function starts a timer to fire after the given delay. If the timer is
+    already pending, it is rescheduled. This function may be called from inside
+    an interrupt, including from a timer's own callback.
+
+    \param  t               The timer to start.
+    \param  delay           How long until the timer fires, in microseconds.
+    \param  period          If nonzero, the timer will fire again every period
+                            microseconds until cancelled.
+    \return                 0 on success, -1 on error.
+
+    \par    Error Conditions:
+    \em     EINVAL - the timer has not been set up
+*/
+int ktimer_start(ktimer_t *t, uint64 delay, uint64 period);
+
+/** \brief  Start a timer at an absolute time.
+
+    This function works like ktimer_start(), but takes the time at which the
+    timer should fire, rather than a delay.
+
+    \param  t               The timer to start.
+    \param  when            When the timer should fire, in microseconds since
+                            boot (as from timer_us_gettime64()).
+    \param  period          If nonzero, the timer will fire again every period
+                            microseconds until cancelled.
+    \return                 0 on success, -1 on error.
+
+    \par    Error Conditions:
+    \em     EINVAL - the timer has not been set up
+*/
+int ktimer_start_at(ktimer_t *t, uint64 when, uint64 period);
+
+/** \brief  Cancel a timer.
+
+    This function stops a timer from firing. If called from a thread other than
+    the timer thread while the timer's callback is running in the timer thread,
+    this will wait for the callback to finish. This means it is safe to free
+    the timer after this function returns, so long as it is not called from an
+    interrupt while the callback is running in the timer thread.
+
+    \param  t               The timer to cancel.
+    \retval 1               If the timer was pending.
+    \retval 0               If the timer was not pending.
+*/
+int ktimer_cancel(ktimer_t *t);
+
+/** \brief  Check if a timer is pending.
+
+    \param  t               The timer to check.
+    \return                 Nonzero if the timer is waiting to fire (or waiting
+                            for its callback to be run in the timer thread).
+*/
+int ktimer_pending(const ktimer_t *t);
+
+/** \brief  Check if the current thread is the timer thread.
+
+    \return                 Nonzero if called from the timer thread.
+*/
+int ktimer_thread_current(void);
+
+/** \brief  Run any expired timers.
+
+    There should be no reason you need to call this function, it is called
+    internally by the scheduler for you.
+
+    \param  now             The current system time, in microseconds.
+*/
+void ktimer_check(uint64 now);
+
+/** \brief  Figure out when the scheduler needs to wake up next.
+
+    This function is for the internal use of the scheduler, and should not be
+    called from user code.
+
+    \param  now             The current system time, in milliseconds.
+    \param  max             The latest the scheduler wants to be woken, in
+                            milliseconds from now, or 0 if the scheduler does
+                            not need to be woken up for itself.
+    \return                 How long to wait for the next wakeup, in
+                            milliseconds (at least 1, at most max). If max is
+                            0, this is 0 when there are no timers pending, in
+                            which case the timer should not be programmed.
+*/
+uint32 ktimer_next_wakeup(uint64 now, uint32 max);
+
+/** \brief  Initialize the kernel timer system.
+
+    This is called by the threading system when it is initialized.
+
+    \retval 0               On success.
+    \retval -1              If the timer thread could not be created.
+*/
+int ktimer_init(void);
+
+/** \brief  Shut down the kernel timer system.
+
+    This is called by the threading system when it is shut down.
+*/
+void ktimer_shutdown(void);
+
+__END_DECLS
+
+#endif /* __KOS_KTIMER_H */
@@ -27,12 +27,36 @@ __BEGIN_DECLS
 
 #include <arch/types.h>
 #include <sys/queue.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 
 /* All functions in this header return < 0 on failure, and 0 on success. */
 
 
 
+/** \brief  Per-device statistics.
+
+    The network stack keeps one of these in each device it sends and receives
+    packets on. Received frames are counted as they are passed to net_input(),
+    and sent frames as they are handed to the device's transmit function. The
+    byte counts include the link-level headers.
+
+    \headerfile kos/net.h
+*/
+typedef struct net_if_stats {
+    uint32  rx_packets;             /**< \brief Frames received */
+    uint64  rx_bytes;               /**< \brief Bytes received */
+    uint32  rx_dropped;             /**< \brief Frames thrown out for being
+                                                of an unknown type */
+    uint32  rx_errors;              /**< \brief Frames too short to be valid */
+    uint32  tx_packets;             /**< \brief Frames sent */
+    uint64  tx_bytes;               /**< \brief Bytes sent */
+    uint32  tx_dropped;             /**< \brief Frames not sent because the
+                                                device was busy */
+    uint32  tx_errors;              /**< \brief Frames the device failed to
+                                                send */
+} net_if_stats_t;
+
 /** \brief Structure describing one usable network device.
 
     Each usable network device should have one of these describing it. These
@@ -171,6 +195,32 @@ typedef struct knetif {
         \param  count       The number of addresses in list.
     */
     int (*if_set_mc)(struct knetif *self, const uint8 *list, int count);
+
+    /** \brief  Queue a packet for transmission from a list of pieces.
+
+        This works just like if_tx, except that the packet is passed in as a
+        list of pieces to be sent back to back, so that the network stack does
+        not have to put the whole packet together in one buffer first. Drivers
+        that can't do anything smarter than that themselves should leave this
+        as NULL, and the pieces will be gathered up and passed to if_tx.
+
+        \param  self        The network device in question.
+        \param  iov         The pieces of the packet.
+        \param  iovcnt      The number of pieces.
+        \param  blocking    1 if we should block if needed, 0 otherwise.
+        \retval NETIF_TX_OK     On success.
+        \retval NETIF_TX_ERROR  On general failure.
+        \retval NETIF_TX_AGAIN  If non-blocking and we must block to send.
+    */
+    int (*if_tx_v)(struct knetif *self, const struct iovec *iov, int iovcnt,
+                   int blocking);
+
+    /** \brief  Statistics for the device.
+
+        These are kept by the network stack. Drivers should leave them alone,
+        other than starting them out zeroed. See net_if_get_stats().
+    */
+    net_if_stats_t      stats;
 } netif_t;
 
 /** \defgroup net_flags Flags for netif_t
@@ -241,6 +291,150 @@ typedef struct ipv6_hdr_s {
 #undef PACKED
 
 
+/***** net_pbuf.c *********************************************************/
+
+/** \brief  Network packet buffer.
+
+    Packet buffers are used to move packet data through the network stack
+    without copying it at each layer. Each buffer holds a contiguous block of
+    packet data with some amount of free space (headroom) in front of it, so
+    that lower layers can prepend their headers in place with
+    net_pbuf_push(). Buffers may also be chained together to form a single
+    packet from several discontiguous pieces, and may reference external
+    memory that the buffer does not own.
+
+    Packet buffers are reference counted. Each call to net_pbuf_addref() must
+    be matched with a call to net_pbuf_free(). Buffers for typical packet sizes
+    come from a preallocated pool, so allocating one is safe inside an
+    interrupt.
+
+    \headerfile kos/net.h
+*/
+typedef struct net_pbuf {
+    struct net_pbuf *next;      /**< \brief Next buffer in the chain */
+    uint8           *data;      /**< \brief Start of data in this buffer */
+    size_t          len;        /**< \brief Length of data in this buffer */
+    size_t          tot_len;    /**< \brief Length of data in the chain,
+                                             starting at this buffer */
+    uint8           *buf;       /**< \brief Start of the backing storage */
+    size_t          size;       /**< \brief Size of the backing storage */
+    int             ref;        /**< \brief Reference count */
+    uint32          flags;      /**< \brief Allocation flags (internal) */
+} net_pbuf_t;
+
+/** \brief  Headroom to reserve for link and network layer headers.
+
+    Packet buffers that will be passed down through the IPv4 or IPv6 layers
+    should be allocated with at least this much headroom so that the headers
+    can be prepended without a copy.
+*/
+#define NET_PBUF_HEADROOM   128
+
+/** \brief  Allocate a packet buffer.
+    \param  headroom        The amount of space to reserve in front of the
+                            data for headers.
+    \param  len             The length of the data area.
+    \return                 The new buffer (with a reference count of 1), or
+                            NULL if out of memory.
+*/
+net_pbuf_t *net_pbuf_alloc(size_t headroom, size_t len);
+
+/** \brief  Create a packet buffer referencing external data.
+
+    The data is not copied, so it must remain valid for as long as the buffer
+    is in use. The returned buffer has no headroom.
+
+    \param  data            The data to reference.
+    \param  len             The length of the data, in bytes.
+    \return                 The new buffer (with a reference count of 1), or
+                            NULL if out of memory.
+*/
+net_pbuf_t *net_pbuf_ref(const void *data, size_t len);
+
+/** \brief  Add a reference to a packet buffer chain.
+    \param  p               The buffer chain to reference.
+*/
+void net_pbuf_addref(net_pbuf_t *p);
+
+/** \brief  Drop a reference to a packet buffer chain.
+
+    Each buffer in the chain whose reference count drops to zero is released.
+
+    \param  p               The buffer chain to release.
+*/
+void net_pbuf_free(net_pbuf_t *p);
+
+/** \brief  Prepend space to the front of a packet buffer.
+    \param  p               The buffer to modify.
+    \param  len             The number of bytes to prepend.
+    \return                 A pointer to the new start of the data, or NULL if
+                            there is not enough headroom.
+*/
+void *net_pbuf_push(net_pbuf_t *p, size_t len);
+
+/** \brief  Remove space from the front of a packet buffer.
+    \param  p               The buffer to modify.
+    \param  len             The number of bytes to remove.
+    \return                 A pointer to the new start of the data, or NULL if
+                            the buffer is not that long.
+*/
+void *net_pbuf_pull(net_pbuf_t *p, size_t len);
+
+/** \brief  Append a packet buffer chain to the end of another.
+
+    The head chain takes over the caller's reference to the tail chain.
+
+    \param  head            The chain to append to.
+    \param  tail            The chain to append.
+*/
+void net_pbuf_cat(net_pbuf_t *head, net_pbuf_t *tail);
+
+/** \brief  Copy data out of a packet buffer chain.
+    \param  p               The chain to copy from.
+    \param  off             The offset within the chain to start at.
+    \param  dst             The buffer to copy into.
+    \param  len             The maximum number of bytes to copy.
+    \return                 The number of bytes copied.
+*/
+size_t net_pbuf_copy(const net_pbuf_t *p, size_t off, void *dst, size_t len);
+
+/** \brief  Transmit a packet buffer chain on a network device.
+
+    This hands the completed link-layer frame in the chain to the device. A
+    single buffer is passed to the device's if_tx function directly, and a
+    chain is passed as a list of pieces with net_if_tx_v().
+
+    \param  net             The device to transmit on.
+    \param  p               The frame to transmit.
+    \param  blocking        One of NETIF_BLOCK or NETIF_NOBLOCK.
+    \return                 The return value from the device's if_tx function.
+*/
+int net_pbuf_tx(netif_t *net, const net_pbuf_t *p, int blocking);
+
+/** \brief  Check whether a packet buffer's storage came from the pool.
+
+    Anything that holds on to a pool buffer for a long time (like a socket's
+    receive queue) keeps the drivers from using it for incoming packets, so it
+    should make sure that it doesn't hold on to too many of them.
+
+    \param  p               The buffer to check.
+    \return                 Nonzero if the storage is a pool buffer.
+*/
+int net_pbuf_pooled(const net_pbuf_t *p);
+
+/** \brief  Get the number of free buffers in the pool.
+    \return                 The number of pool buffers not in use.
+*/
+int net_pbuf_pool_avail(void);
+
+/** \brief  Init packet buffers.
+    \retval 0               On success (no error conditions defined).
+*/
+int net_pbuf_init(void);
+
+/** \brief  Shutdown packet buffers. */
+void net_pbuf_shutdown(void);
+
 /***** net_arp.c **********************************************************/
 
 /** \brief  Init ARP.
@@ -267,8 +461,9 @@ int net_arp_insert(netif_t *nif, const uint8 mac[6], const uint8 ip[4],
 /** \brief  Look up an entry from the ARP cache.
 
     If no entry is found, then an ARP query will be sent and an error will be
-    returned. If you specify a packet with the call, it will be sent when the
-    reply comes in.
+    returned. If you specify a packet with the call, a copy of it will be sent
+    when the reply comes in. A few packets can be held for each address while
+    the query is outstanding.
 
     \param  nif             The network device in use.
     \param  ip_in           The IP address to lookup.
@@ -278,12 +473,35 @@ int net_arp_insert(netif_t *nif, const uint8 mac[6], const uint8 ip[4],
     \param  data            Packet data to go with the header.
     \param  data_size       The size of data.
     \retval 0               On success.
-    \retval -1              A query is outstanding for that address.
-    \retval -2              Address not found, query generated.
+    \retval -1              A query is outstanding for that address (and no
+                            packet was given), or the lookup failed.
+    \retval -2              Address not found, query generated (or already
+                            outstanding), and the packet was queued.
 */
 int net_arp_lookup(netif_t *nif, const uint8 ip_in[4], uint8 mac_out[6],
                    const ip_hdr_t *pkt, const uint8 *data, int data_size);
 
+/** \brief  Look up an entry from the ARP cache, with a packet buffer.
+
+    This works just like net_arp_lookup(), except that the packet to send when
+    the reply comes in is given as a packet buffer chain. The chain is copied if
+    it needs to be held onto, so the caller still owns it afterwards.
+
+    \param  nif             The network device in use.
+    \param  ip_in           The IP address to lookup.
+    \param  mac_out         Storage for the MAC address, if found.
+    \param  pkt             A simple IPv4 header, if you want to send one when a
+                            response comes in (if not found immediately).
+    \param  p               Packet data to go with the header.
+    \retval 0               On success.
+    \retval -1              A query is outstanding for that address (and no
+                            packet was given), or the lookup failed.
+    \retval -2              Address not found, query generated (or already
+                            outstanding), and the packet was queued.
+*/
+int net_arp_lookup_pbuf(netif_t *nif, const uint8 ip_in[4], uint8 mac_out[6],
+                        const ip_hdr_t *pkt, const net_pbuf_t *p);
+
 /** \brief  Do a reverse ARP lookup.
 
     This function looks for an IP for a given mac address; note that if this
@@ -339,6 +557,21 @@ extern net_input_func net_input_target;
 */
 int net_input(netif_t *device, const uint8 *data, int len);
 
+/** \brief  Submit a received packet held in a packet buffer.
+
+    This works like net_input(), but allows protocols that queue received data
+    to keep a reference to the buffer rather than copying out of it. The buffer
+    is passed down to the protocols along with the packet, so this is safe to
+    call from more than one thread at once. The driver should drop its own
+    reference with net_pbuf_free() after this returns. The frame must be
+    contained in a single buffer.
+
+    \param  device          The network device submitting packets.
+    \param  p               The buffer holding the packet.
+    \return                 0 on success, <0 on failure.
+*/
+int net_input_pbuf(netif_t *device, net_pbuf_t *p);
+
 /** \brief  Setup a network input target.
     \param  t               The new target callback.
     \return                 The old target.
@@ -561,6 +794,70 @@ typedef struct net_ipv6_stats {
 */
 net_ipv6_stats_t net_ipv6_get_stats(void);
 
+/***** net_ipv4_frag.c ****************************************************/
+
+/** \brief  Fragment reassembly parameters.
+
+    These control how much memory goes to putting IPv4 and IPv6 fragments
+    back together. Every datagram being reassembled counts against max_mem,
+    and when a new one won't fit, the oldest ones are thrown out to make room.
+    A zero in any field means to use the default for it.
+
+    \headerfile kos/net.h
+*/
+typedef struct net_frag_params {
+    uint32  max_mem;                /**< \brief Memory for all datagrams being
+                                                reassembled, in bytes (default
+                                                256KB) */
+    uint32  max_size;               /**< \brief Largest datagram to reassemble,
+                                                in bytes of payload (default
+                                                65535) */
+    uint32  timeout;                /**< \brief Time to wait for the rest of a
+                                                datagram, in milliseconds
+                                                (default 30 seconds) */
+} net_frag_params_t;
+
+/** \brief  Fragment reassembly statistics.
+    \headerfile kos/net.h
+*/
+typedef struct net_frag_stats {
+    uint32  frag_recv;              /**< \brief Fragments received */
+    uint32  frag_dropped;           /**< \brief Fragments dropped (bad, too
+                                                big, or out of memory) */
+    uint32  pkt_reassembled;        /**< \brief Datagrams put back together */
+    uint32  pkt_timeout;            /**< \brief Datagrams that timed out */
+    uint32  pkt_evicted;            /**< \brief Datagrams thrown out to make
+                                                room for newer ones */
+    uint32  pkt_bad;                /**< \brief Datagrams with fragments that
+                                                didn't agree on the length */
+    uint32  mem_used;               /**< \brief Memory in use right now */
+    uint32  mem_peak;               /**< \brief Most memory ever in use */
+} net_frag_stats_t;
+
+/** \brief  Set the fragment reassembly parameters.
+
+    If the new memory limit is smaller than what's in use, the oldest
+    datagrams are thrown out right away to get back under it.
+
+    \param  params          The new parameters.
+    \retval 0               On success.
+    \retval -1              On error (sets errno as appropriate).
+
+    \par    Error Conditions:
+    \em     EINVAL - max_size is over 65535
+*/
+int net_frag_set_params(const net_frag_params_t *params);
+
+/** \brief  Retrieve the fragment reassembly parameters.
+    \param  params          Storage for the current parameters.
+*/
+void net_frag_get_params(net_frag_params_t *params);
+
+/** \brief  Retrieve fragment reassembly statistics.
+    \return                 The fragment reassembly stats structure.
+*/
+net_frag_stats_t net_frag_get_stats(void);
+
 /***** net_ndp.c **********************************************************/
 
 /** \brief  Init NDP.
@@ -572,7 +869,7 @@ int net_ndp_init(void);
 void net_ndp_shutdown(void);
 
 /** \brief  Garbage collect timed out NDP entries.
-    This will be called periodically as NDP queries come in.
+    This will be called periodically by the network thread.
 */
 void net_ndp_gc(void);
 
@@ -589,8 +886,8 @@ int net_ndp_insert(netif_t *nif, const uint8 mac[6], const struct in6_addr *ip,
 /** \brief  Look up an entry from the NDP cache.
 
     If no entry is found, then an NDP query will be sent and an error will be
-    returned. If you specify a packet with the call, it will be sent when the
-    reply comes in.
+    returned. If you specify a packet with the call, a copy of it will be sent
+    when the reply comes in.
 
     \param  net             The network device to use.
     \param  ip              The IPv6 address to query.
@@ -604,6 +901,24 @@ int net_ndp_insert(netif_t *nif, const uint8 mac[6], const struct in6_addr *ip,
 int net_ndp_lookup(netif_t *net, const struct in6_addr *ip, uint8 mac_out[6],
                    const ipv6_hdr_t *pkt, const uint8 *data, int data_size);
 
+/** \brief  Look up an entry from the NDP cache, with a packet buffer.
+
+    This works just like net_ndp_lookup(), except that the packet to send when
+    the reply comes in is given as a packet buffer chain. The chain is copied if
+    it needs to be held onto, so the caller still owns it afterwards.
+
+    \param  net             The network device to use.
+    \param  ip              The IPv6 address to query.
+    \param  mac_out         Storage for the MAC address on success.
+    \param  pkt             A simple IPv6 header, if you want to send a packet
+                            when a reply comes in.
+    \param  p               Anything that comes after the header.
+    \return                 0 on success, <0 on failure.
+*/
+int net_ndp_lookup_pbuf(netif_t *net, const struct in6_addr *ip,
+                        uint8 mac_out[6], const ipv6_hdr_t *pkt,
+                        const net_pbuf_t *p);
+
 /***** net_udp.c **********************************************************/
 
 /** \brief  UDP statistics structure.
@@ -620,6 +935,8 @@ typedef struct net_udp_stats {
     uint32  pkt_recv_bad_size;      /**< \brief Packets of a bad size */
     uint32  pkt_recv_bad_chksum;    /**< \brief Packets with a bad checksum */
     uint32  pkt_recv_no_sock;       /**< \brief Packets with to a closed port */
+    uint32  pkt_recv_no_space;      /**< \brief Packets dropped because the
+                                                socket's queue was full */
 } net_udp_stats_t;
 
 /** \brief  Retrieve statistics from the UDP layer.
@@ -637,6 +954,42 @@ void net_udp_shutdown(void);
 
 /***** net_tcp.c **********************************************************/
 
+/** \brief  TCP statistics structure.
+
+    This structure holds some basic statistics about the TCP layer of the
+    stack, and can be retrieved with the net_tcp_get_stats() function. The
+    state of a single connection can be had with the TCP_INFO socket option.
+
+    \headerfile kos/net.h
+*/
+typedef struct net_tcp_stats {
+    uint32  seg_sent;               /**< \brief Segments sent */
+    uint32  seg_recv;               /**< \brief Segments received */
+    uint32  seg_recv_bad_size;      /**< \brief Segments of a bad size */
+    uint32  seg_recv_bad_chksum;    /**< \brief Segments with a bad checksum */
+    uint32  seg_recv_no_sock;       /**< \brief Segments for a connection we
+                                                don't have */
+    uint32  seg_retransmitted;      /**< \brief Segments sent again */
+    uint32  rst_sent;               /**< \brief Resets sent */
+    uint32  conn_active;            /**< \brief Connections opened with
+                                                connect() */
+    uint32  conn_passive;           /**< \brief Connections opened with
+                                                accept() */
+    uint32  conn_reset;             /**< \brief Connections reset (or refused)
+                                                by the other side */
+    uint32  listen_overflows;       /**< \brief Connections refused because
+                                                the listen backlog was full */
+    uint32  timeouts;               /**< \brief Retransmission timeouts */
+    uint32  fast_retransmits;       /**< \brief Fast retransmits (after three
+                                                duplicate ACKs) */
+    uint32  dup_acks;               /**< \brief Duplicate ACKs received */
+} net_tcp_stats_t;
+
+/** \brief  Retrieve statistics from the TCP layer.
+    \return                 The global TCP stats struct.
+*/
+net_tcp_stats_t net_tcp_get_stats(void);
+
 /** \brief  Init TCP.
     \retval 0               On success (no error conditions defined).
 */
@@ -654,6 +1007,19 @@ void net_tcp_shutdown(void);
 */
 uint32 net_crc32le(const uint8 *data, int size);
 
+/** \brief  Continue a "little-endian" CRC-32 calculation.
+
+    This allows the CRC of a block of data to be calculated in pieces. Calling
+    this with a crc of 0 is the same as calling net_crc32le().
+
+    \param  crc             The CRC so far, as returned by a previous call to
+                            this function (or 0 to start a new calculation).
+    \param  data            The data to calculate over.
+    \param  size            The size of the data, in bytes.
+    \return                 The updated CRC-32.
+*/
+uint32 net_crc32le_update(uint32 crc, const uint8 *data, int size);
+
 /** \brief  Calculate a "big-endian" CRC-32 over a block of data.
     \param  data            The data to calculate over.
     \param  size            The size of the data, in bytes.
@@ -661,6 +1027,20 @@ uint32 net_crc32le(const uint8 *data, int size);
 */
 uint32 net_crc32be(const uint8 *data, int size);
 
+/** \brief  Continue a "big-endian" CRC-32 calculation.
+
+    This allows the CRC of a block of data to be calculated in pieces. Calling
+    this with a crc of 0xFFFFFFFF is the same as calling net_crc32be().
+
+    \param  crc             The CRC so far, as returned by a previous call to
+                            this function (or 0xFFFFFFFF to start a new
+                            calculation).
+    \param  data            The data to calculate over.
+    \param  size            The size of the data, in bytes.
+    \return                 The updated CRC-32.
+*/
+uint32 net_crc32be_update(uint32 crc, const uint8 *data, int size);
+
 /** \brief  Calculate a CRC16-CCITT over a block of data.
     \param  data            The data to calculate over.
     \param  size            The size of the data, in bytes.
@@ -712,6 +1092,379 @@ int net_multicast_init(void);
 /** \brief  Shutdown multicast support. */
 void net_multicast_shutdown(void);
 
+/***** net_loop.c *********************************************************/
+
+/** \brief  The loopback network device (read-only).
+
+    This is set up by net_init(), and is NULL while networking is not
+    initialized. Anything sent to 127.0.0.0/8 or ::1 goes out on this device,
+    regardless of which device was asked for.
+*/
+extern netif_t *net_loop_dev;
+
+/** \brief  Loopback device parameters.
+
+    These allow the loopback device to behave a bit more like a real network,
+    for testing protocols against delay, loss, and reordering. By default, all
+    of these are zero, and packets come back in order as soon as the loopback
+    thread gets to run.
+
+    \headerfile kos/net.h
+*/
+typedef struct net_loop_params {
+    uint32  delay;                  /**< \brief Delay on each packet, in
+                                                microseconds */
+    uint32  loss;                   /**< \brief Chance a packet is dropped, in
+                                                tenths of a percent */
+    uint32  reorder;                /**< \brief Chance a packet is delivered
+                                                ahead of the one sent before
+                                                it, in tenths of a percent */
+    uint32  flags;                  /**< \brief Flags (see below) */
+} net_loop_params_t;
+
+/** \brief  Deliver loopback packets directly from the transmit path.
+
+    With this set, packets are passed back to net_input() from within the
+    device's transmit function, rather than being queued for the loopback
+    thread. This is faster, but a protocol that sends in response to input
+    will then be re-entered while it is still sending, which TCP does not
+    handle. The delay, loss, and reorder parameters are ignored in this
+    mode.
+*/
+#define NET_LOOP_DIRECT     0x00000001
+
+/** \brief  Loopback device statistics.
+    \headerfile kos/net.h
+*/
+typedef struct net_loop_stats {
+    uint32  pkt_sent;               /**< \brief Packets sent */
+    uint32  pkt_delivered;          /**< \brief Packets passed to net_input() */
+    uint32  pkt_lost;               /**< \brief Packets dropped on purpose */
+    uint32  pkt_reordered;          /**< \brief Packets moved out of order */
+    uint32  pkt_dropped;            /**< \brief Packets dropped for lack of
+                                                queue or buffer space */
+} net_loop_stats_t;
+
+/** \brief  Set the loopback device parameters.
+    \param  params          The new parameters.
+    \retval 0               On success.
+    \retval -1              On error (sets errno as appropriate).
+
+    \par    Error Conditions:
+    \em     EINVAL - a loss or reorder chance is over 1000
+*/
+int net_loop_set_params(const net_loop_params_t *params);
+
+/** \brief  Retrieve the loopback device parameters.
+    \param  params          Storage for the current parameters.
+*/
+void net_loop_get_params(net_loop_params_t *params);
+
+/** \brief  Retrieve statistics from the loopback device.
+    \return                 The loopback stats structure.
+*/
+net_loop_stats_t net_loop_get_stats(void);
+
+/** \brief  Check if an address belongs to the loopback network.
+    \param  addr            The address to check (IPv4 addresses should be
+                            given as IPv4-mapped IPv6 addresses).
+    \return                 Nonzero if the address is in 127.0.0.0/8 or is
+                            ::1.
+*/
+int net_loop_addr(const struct in6_addr *addr);
+
+/** \brief  Init the loopback device.
+    \retval 0               On success.
+    \retval -1              If the loopback thread could not be created.
+*/
+int net_loop_init(void);
+
+/** \brief  Shutdown the loopback device. */
+void net_loop_shutdown(void);
+
+/***** net_capture.c ******************************************************/
+
+/** \brief  Packet capture parameters.
+
+    These pick what gets captured by net_capture_start(), and how much room
+    the capture has to work with. A zero in any of these fields means to use
+    the default for it, so a zeroed structure captures everything.
+
+    \headerfile kos/net.h
+*/
+typedef struct net_capture_params {
+    netif_t *nif;                   /**< \brief Device to capture on (NULL for
+                                                all devices) */
+    uint32  dirs;                   /**< \brief Directions to capture (see
+                                                below, default both) */
+    uint32  protos;                 /**< \brief Link layer protocols to
+                                                capture (see below, default
+                                                all) */
+    uint32  ip_proto;               /**< \brief IP protocol number to capture
+                                                (i.e, IPPROTO_TCP, default
+                                                all) */
+    uint32  snaplen;                /**< \brief Most bytes to keep of each
+                                                frame (default 65535) */
+    uint32  bufsize;                /**< \brief Size of the buffer holding
+                                                frames that haven't been
+                                                written out yet, in bytes
+                                                (default 64KiB) */
+} net_capture_params_t;
+
+/** \defgroup net_capture_dirs Packet capture directions
+    @{
+*/
+#define NET_CAPTURE_IN      0x00000001  /**< \brief Frames received */
+#define NET_CAPTURE_OUT     0x00000002  /**< \brief Frames sent */
+/** @} */
+
+/** \defgroup net_capture_protos Packet capture protocols
+    @{
+*/
+#define NET_CAPTURE_ARP     0x00000001  /**< \brief ARP */
+#define NET_CAPTURE_IPV4    0x00000002  /**< \brief IPv4 */
+#define NET_CAPTURE_IPV6    0x00000004  /**< \brief IPv6 */
+#define NET_CAPTURE_OTHER   0x00000008  /**< \brief Anything else */
+/** @} */
+
+/** \brief  Packet capture statistics.
+    \headerfile kos/net.h
+*/
+typedef struct net_capture_stats {
+    uint32  pkt_captured;           /**< \brief Frames put in the capture */
+    uint32  pkt_dropped;            /**< \brief Frames that didn't fit in the
+                                                buffer */
+    uint32  bytes_written;          /**< \brief Bytes written to the file */
+    uint32  write_errors;           /**< \brief Failed writes to the file */
+} net_capture_stats_t;
+
+/** \brief  Start capturing packets to a file.
+
+    This writes frames sent and received by the network stack to the given
+    file, in the libpcap format (so that the capture can be opened in
+    Wireshark or tcpdump). Frames are copied into a buffer as they go by, and
+    a thread writes them out from there, so the file can be on anything in
+    the VFS (/pc, /ram, /sd, etc). If the file can't keep up, frames that don't
+    fit in the buffer are dropped from the capture (but not from the
+    network).
+
+    Frames from devices that don't use ethernet (such as the loopback) are
+    given an ethernet header with all-zero addresses, so that everything can
+    go in the same file.
+
+    \param  fn              The file to write the capture to.
+    \param  params          What to capture, or NULL to capture everything.
+    \retval 0               On success.
+    \retval -1              On error (sets errno as appropriate).
+
+    \par    Error Conditions:
+    \em     EBUSY - a capture is already running \n
+    \em     EINVAL - a parameter is out of range \n
+    \em     ENOMEM - out of memory for the buffer \n
+    Anything fs_open() can set, if the file can't be opened.
+*/
+int net_capture_start(const char *fn, const net_capture_params_t *params);
+
+/** \brief  Stop capturing packets.
+
+    This writes out anything left in the buffer and closes the file. It is
+    safe to call if no capture is running.
+*/
+void net_capture_stop(void);
+
+/** \brief  Check if a capture is running.
+    \return                 Nonzero if a capture is running.
+*/
+int net_capture_running(void);
+
+/** \brief  Retrieve statistics from the packet capture.
+
+    These are reset each time a capture is started.
+
+    \return                 The capture stats structure.
+*/
+net_capture_stats_t net_capture_get_stats(void);
+
+/***** net_dhcp.c *********************************************************/
+
+/** \brief  A DHCP lease, as kept between boots.
+
+    When the DHCP client gets an address, it hands one of these to the lease
+    store (if one is set). On the next boot, if the store gives it back and it
+    hasn't expired yet, the client asks the server for the same address again
+    instead of starting from scratch, which only takes one round trip.
+
+    Addresses are in network byte order, like the ones in netif_t.
+
+    \headerfile kos/net.h
+*/
+typedef struct net_dhcp_lease {
+    uint8   mac[6];                 /**< \brief MAC address of the device the
+                                                lease is for */
+    uint8   ip[4];                  /**< \brief Our address */
+    uint8   server[4];              /**< \brief The DHCP server's address */
+    uint8   netmask[4];             /**< \brief Netmask */
+    uint8   gateway[4];             /**< \brief Default router */
+    uint8   dns[4];                 /**< \brief DNS server */
+    uint8   broadcast[4];           /**< \brief Broadcast address */
+    uint32  mtu;                    /**< \brief Interface MTU */
+    uint32  lease_time;             /**< \brief Length of the lease, in
+                                                seconds (0xFFFFFFFF for
+                                                forever) */
+    int64   obtained;               /**< \brief When the lease was granted,
+                                                as returned by time() */
+} net_dhcp_lease_t;
+
+/** \brief  Somewhere to keep a DHCP lease between boots.
+
+    Set one of these with net_dhcp_set_store() to keep the lease somewhere
+    other than a file (net_dhcp_set_store_file() covers files, including ones
+    on a VMU). The functions are called from the network thread, so they can
+    block, but they hold up the network while they do.
+
+    \headerfile kos/net.h
+*/
+typedef struct net_dhcp_store {
+    /** \brief  Read the lease back.
+        \param  self        The store.
+        \param  lease       Where to put the lease.
+        \retval 0           On success.
+        \retval -1          If there is no lease to be had.
+    */
+    int (*load)(struct net_dhcp_store *self, net_dhcp_lease_t *lease);
+
+    /** \brief  Save a lease, replacing any that was saved before.
+        \param  self        The store.
+        \param  lease       The lease to save.
+        \retval 0           On success.
+        \retval -1          On error.
+    */
+    int (*save)(struct net_dhcp_store *self, const net_dhcp_lease_t *lease);
+
+    /** \brief  Forget the saved lease (may be NULL).
+
+        This is called when the server refuses to give us the saved lease
+        again.
+
+        \param  self        The store.
+        \retval 0           On success.
+        \retval -1          On error.
+    */
+    int (*clear)(struct net_dhcp_store *self);
+
+    /** \brief  Anything the store needs to keep track of. */
+    void *data;
+} net_dhcp_store_t;
+
+/** \brief  DHCP client parameters.
+
+    A zero in any of these fields means to use the default for it.
+
+    \headerfile kos/net.h
+*/
+typedef struct net_dhcp_params {
+    uint32  retrans_min;            /**< \brief Time before a request is first
+                                                sent again, in milliseconds
+                                                (default 2000). This doubles
+                                                each time it's resent. */
+    uint32  retrans_max;            /**< \brief Most time between resends, in
+                                                milliseconds (default
+                                                64000) */
+    uint32  reboot_timeout;         /**< \brief How long to wait for an answer
+                                                about a saved lease before
+                                                starting over, in milliseconds
+                                                (default 4000) */
+    uint32  timeout;                /**< \brief How long net_init() waits for
+                                                an address, in milliseconds
+                                                (default 60000) */
+} net_dhcp_params_t;
+
+/** \brief  Set where the DHCP lease is kept between boots.
+
+    This has to be done before net_init() for it to do any good on the first
+    request. The store is used until it is changed, so it must stay around
+    until then.
+
+    \param  store           The store to use, or NULL for none.
+    \retval 0               On success.
+    \retval -1              On error (sets errno as appropriate).
+
+    \par    Error Conditions:
+    \em     EINVAL - the store is missing its load or save function
+*/
+int net_dhcp_set_store(net_dhcp_store_t *store);
+
+/** \brief  Keep the DHCP lease in a file between boots.
+
+    This sets a lease store that keeps the lease in a file, which can be
+    anywhere in the VFS that can be written to (such as /vmu/a1/DHCP). Like
+    net_dhcp_set_store(), this should be called before net_init().
+
+    \param  fn              The file to keep the lease in, or NULL for no
+                            store.
+    \retval 0               On success.
+    \retval -1              On error (sets errno as appropriate).
+
+    \par    Error Conditions:
+    \em     ENOMEM - out of memory
+*/
+int net_dhcp_set_store_file(const char *fn);
+
+/** \brief  Set the DHCP client parameters.
+    \param  params          The new parameters.
+    \retval 0               On success.
+    \retval -1              On error (sets errno as appropriate).
+
+    \par    Error Conditions:
+    \em     EINVAL - retrans_min is more than retrans_max, or a time is too
+                     long
+*/
+int net_dhcp_set_params(const net_dhcp_params_t *params);
+
+/** \brief  Retrieve the DHCP client parameters.
+    \param  params          Storage for the current parameters.
+*/
+void net_dhcp_get_params(net_dhcp_params_t *params);
+
+/***** net_stats.c ********************************************************/
+
+/** \brief  All of the network stack's statistics, in one place.
+
+    This gathers up the statistics from each of the protocols, and can be
+    retrieved with the net_get_stats() function. Statistics for each device
+    are in the device itself (see net_if_get_stats()).
+
+    The same counters can be read as text from the files in /net, which is
+    handy for a status page or anything else that would rather not link
+    against the stack directly. /net/dev has a line for each device,
+    /net/snmp a line for each protocol (a line of names followed by a line of
+    values), and /net/tcp a line for each TCP socket, with the fields of its
+    TCP_INFO.
+
+    \headerfile kos/net.h
+*/
+typedef struct net_stats {
+    net_ipv4_stats_t    ipv4;       /**< \brief IPv4 stats */
+    net_ipv6_stats_t    ipv6;       /**< \brief IPv6 stats */
+    net_frag_stats_t    frag;       /**< \brief Fragment reassembly stats */
+    net_udp_stats_t     udp;        /**< \brief UDP stats */
+    net_tcp_stats_t     tcp;        /**< \brief TCP stats */
+} net_stats_t;
+
+/** \brief  Retrieve statistics from every protocol in the stack.
+    \return                 A copy of all of the stats.
+*/
+net_stats_t net_get_stats(void);
+
+/** \brief  Init the /net filesystem.
+    \retval 0               On success.
+    \retval -1              If the filesystem couldn't be registered.
+*/
+int net_stats_init(void);
+
+/** \brief  Shutdown the /net filesystem. */
+void net_stats_shutdown(void);
+
 /***** net_core.c *********************************************************/
 
 /** \brief  Interface list; note: do not manipulate directly! */
@@ -734,6 +1487,42 @@ extern netif_t *net_default_dev;
 */
 netif_t *net_set_default(netif_t *n);
 
+/** \brief  Transmit a packet made up of several pieces on a device.
+
+    This uses the device's if_tx_v function if it has one. Otherwise the pieces
+    are copied into one buffer and passed to if_tx.
+
+    \param  net             The device to transmit on.
+    \param  iov             The pieces of the packet.
+    \param  iovcnt          The number of pieces.
+    \param  blocking        One of NETIF_BLOCK or NETIF_NOBLOCK.
+    \return                 The return value from the device's transmit
+                            function.
+*/
+int net_if_tx_v(netif_t *net, const struct iovec *iov, int iovcnt,
+                int blocking);
+
+/** \brief  Transmit a packet on a device.
+
+    This calls the device's if_tx function, and counts the packet in the
+    device's statistics. The network stack sends everything this way (or with
+    net_if_tx_v()), rather than calling if_tx itself.
+
+    \param  net             The device to transmit on.
+    \param  data            The packet to send.
+    \param  len             The length of the packet, in bytes.
+    \param  blocking        One of NETIF_BLOCK or NETIF_NOBLOCK.
+    \return                 The return value from the device's transmit
+                            function.
+*/
+int net_if_tx(netif_t *net, const uint8 *data, int len, int blocking);
+
+/** \brief  Retrieve the statistics for a device.
+    \param  net             The device to look at.
+    \return                 A copy of the device's stats struct.
+*/
+net_if_stats_t net_if_get_stats(netif_t *net);
+
 /** \brief  Register a network device.
     \param  device          The device to register.
     \return                 0 on success, <0 on failure.
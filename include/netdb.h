@@ -95,6 +95,7 @@ extern int h_errno;
 #define EAI_SOCKTYPE        8       /**< \brief Invalid socket type. */
 #define EAI_SYSTEM          9       /**< \brief System error, check errno. */
 #define EAI_OVERFLOW        10      /**< \brief Argument buffer overflow. */
+#define EAI_INPROGRESS      11      /**< \brief Lookup not yet finished. */
 /** @} */
 
 /** \defgroup addrinfo_flags            Flags for ai_flags in struct addrinfo
@@ -102,8 +103,8 @@ extern int h_errno;
     These are the flags that can be set in the ai_flags field of struct
     addrinfo. These values can be bitwise ORed together.
 
-    Currently only AI_PASSIVE is actually supported by the getaddrinfo()
-    function.
+    Currently only AI_PASSIVE and AI_NUMERICHOST are actually supported by the
+    getaddrinfo() function.
 
     @{
 */
@@ -183,6 +184,92 @@ struct hostent *gethostbyname(const char *name);
 */
 struct hostent *gethostbyname2(const char *name, int af);
 
+/** \brief  Asynchronous address lookup handle.
+
+    This is an opaque handle for a lookup started with getaddrinfo_async().
+*/
+typedef struct gai_async gai_async_t;
+
+/** \brief  Asynchronous address lookup completion callback.
+
+    This is called from the thread doing the lookup once it has finished. The
+    callback takes ownership of the results, and must free them with
+    freeaddrinfo() when done with them.
+
+    \param  req             The lookup that finished.
+    \param  err             0 on success, or an error code on failure.
+    \param  res             The results of the lookup (if any).
+    \param  data            The data pointer passed to getaddrinfo_async().
+*/
+typedef void (*gai_async_cb_t)(gai_async_t *req, int err,
+                               struct addrinfo *res, void *data);
+
+/** \brief  Start looking up an address, without waiting for the result.
+
+    This function does the same thing as getaddrinfo(), but does it in a thread
+    of its own, and returns right away. The caller can either provide a
+    callback to be called when the lookup finishes, or check on it later with
+    gai_async_wait() and gai_async_result(). Either way, the handle must be
+    released with gai_async_free() when it is no longer needed.
+
+    This function is a KOS extension and has not been specified by any POSIX
+    specification.
+
+    \param  nodename        The host to look up.
+    \param  servname        The service to look up.
+    \param  hints           Hints used in aiding lookup.
+    \param  cb              Function to call when done, or NULL for none.
+    \param  data            Data to pass to the callback.
+    \return                 A handle for the lookup, or NULL on failure (with
+                            errno set appropriately).
+*/
+gai_async_t *getaddrinfo_async(const char *nodename, const char *servname,
+                               const struct addrinfo *hints,
+                               gai_async_cb_t cb, void *data);
+
+/** \brief  Wait for an asynchronous address lookup to finish.
+
+    \param  req             The lookup to wait on.
+    \param  timeout         The maximum number of milliseconds to wait. 0 means
+                            not to wait at all, and a negative value means to
+                            wait for as long as it takes.
+    \return                 EAI_INPROGRESS if the lookup has not finished yet,
+                            otherwise the same thing getaddrinfo() would have
+                            returned.
+*/
+int gai_async_wait(gai_async_t *req, int timeout);
+
+/** \brief  Get the results of an asynchronous address lookup.
+
+    This hands the results of the lookup over to the caller, who must free them
+    with freeaddrinfo(). If a callback was given when the lookup was started,
+    the results have already been given to it, and this returns NULL in res.
+
+    \param  req             The lookup to get the results from.
+    \param  res             The resulting address information.
+    \return                 EAI_INPROGRESS if the lookup has not finished yet,
+                            otherwise the same thing getaddrinfo() would have
+                            returned.
+*/
+int gai_async_result(gai_async_t *req, struct addrinfo **res);
+
+/** \brief  Release an asynchronous address lookup handle.
+
+    If the lookup is still in progress, it will be cleaned up when it finishes
+    (and its callback, if any, will still be called).
+
+    \param  req             The lookup to release.
+*/
+void gai_async_free(gai_async_t *req);
+
+/** \brief  Throw away all cached address lookup results.
+
+    The results of DNS lookups are cached for as long as the DNS server allows.
+    This function empties the cache, so that the next lookup of each name goes
+    back to the server (for instance, after switching to a different server).
+*/
+void gai_cache_flush(void);
+
 __END_DECLS
 
 #endif /* !__NETDB_H */
@@ -133,6 +133,13 @@ struct sockaddr_in6 {
 */
 #define INADDR_NONE      0xFFFFFFFF
 
+/** \brief  IPv4 loopback address.
+
+    This address is the normal IPv4 loopback address (127.0.0.1), in host byte
+    order.
+*/
+#define INADDR_LOOPBACK  0x7F000001
+
 /** \brief  Initialize an IPv6 local host address.
 
     This macro can be used to initialize a struct in6_addr to any local address.
@@ -0,0 +1,118 @@
+/* KallistiOS ##version##
+
+   netinet/tcp.h
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/** \file   netinet/tcp.h
+    \brief  Definitions for the Transmission Control Protocol.
+
+    This file contains the standard definitions (as directed by the POSIX 2008
+    standard) for TCP-related functionality. The only thing POSIX requires in
+    here is the TCP_NODELAY option, but a few other common options are also
+    defined, along with the TCP_INFO option for looking at the state of a
+    connection.
+*/
+
+#ifndef __NETINET_TCP_H
+#define __NETINET_TCP_H
+
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+#include <stdint.h>
+
+/** \defgroup tcp_opts                  TCP protocol level options
+
+    These are the various socket-level options that can be accessed with the
+    setsockopt() and getsockopt() functions for the IPPROTO_TCP level value.
+
+    \see                so_opts
+    \see                ipv4_opts
+    \see                ipv6_opts
+    \see                udp_opts
+
+    @{
+*/
+#define TCP_NODELAY     28  /**< \brief Don't delay small segments (get/set) */
+#define TCP_CORK        29  /**< \brief Only send full segments (get/set) */
+#define TCP_INFO        30  /**< \brief Connection state (get) */
+/** @} */
+
+/** \defgroup tcp_states                TCP connection states
+
+    These are the values of the tcpi_state field of struct tcp_info. They're
+    numbered the same as they are on Linux.
+
+    @{
+*/
+#define TCP_ESTABLISHED 1   /**< \brief Connection is open */
+#define TCP_SYN_SENT    2   /**< \brief Waiting for a reply to our SYN */
+#define TCP_SYN_RECV    3   /**< \brief Waiting for the handshake to finish */
+#define TCP_FIN_WAIT1   4   /**< \brief We've closed, waiting for an ACK */
+#define TCP_FIN_WAIT2   5   /**< \brief We've closed, waiting for the other
+                                         side to */
+#define TCP_TIME_WAIT   6   /**< \brief Both closed, waiting for strays */
+#define TCP_CLOSE       7   /**< \brief Not connected */
+#define TCP_CLOSE_WAIT  8   /**< \brief Other side closed, we haven't */
+#define TCP_LAST_ACK    9   /**< \brief Both closed, waiting for an ACK */
+#define TCP_LISTEN      10  /**< \brief Listening for connections */
+#define TCP_CLOSING     11  /**< \brief Both closed at once, waiting for an
+                                         ACK */
+/** @} */
+
+/** \defgroup tcpi_opts                 TCP options in use on a connection
+
+    These are the bits of the tcpi_options field of struct tcp_info.
+
+    @{
+*/
+#define TCPI_OPT_TIMESTAMPS 0x01    /**< \brief Timestamps */
+#define TCPI_OPT_SACK       0x02    /**< \brief Selective acknowledgements */
+#define TCPI_OPT_WSCALE     0x04    /**< \brief Window scaling */
+/** @} */
+
+/** \brief  State of a TCP connection.
+
+    This is what getsockopt() returns for the TCP_INFO option. The names of the
+    fields are the same as on Linux, but there are fewer of them, and windows
+    and the like are counted in bytes rather than segments. If the buffer
+    passed in is smaller than this, only that much of it is filled in.
+
+    \headerfile netinet/tcp.h
+*/
+struct tcp_info {
+    uint8_t     tcpi_state;         /**< \brief State (see \ref tcp_states) */
+    uint8_t     tcpi_retransmits;   /**< \brief Timeouts in a row without
+                                                anything being acked */
+    uint8_t     tcpi_options;       /**< \brief Options in use (see
+                                                \ref tcpi_opts) */
+    uint8_t     tcpi_snd_wscale : 4; /**< \brief Other side's window scale */
+    uint8_t     tcpi_rcv_wscale : 4; /**< \brief Our window scale */
+    uint32_t    tcpi_rto;           /**< \brief Retransmission timeout, in
+                                                microseconds */
+    uint32_t    tcpi_snd_mss;       /**< \brief Largest segment we send */
+    uint32_t    tcpi_rtt;           /**< \brief Smoothed round-trip time, in
+                                                microseconds */
+    uint32_t    tcpi_rttvar;        /**< \brief Round-trip time variation, in
+                                                microseconds */
+    uint32_t    tcpi_snd_cwnd;      /**< \brief Congestion window, in bytes */
+    uint32_t    tcpi_snd_ssthresh;  /**< \brief Slow start threshold, in
+                                                bytes */
+    uint32_t    tcpi_snd_wnd;       /**< \brief Other side's window, in bytes */
+    uint32_t    tcpi_rcv_wnd;       /**< \brief Our window, in bytes */
+    uint32_t    tcpi_unacked;       /**< \brief Bytes sent but not acked */
+    uint32_t    tcpi_notsent_bytes; /**< \brief Bytes waiting to be sent */
+    uint32_t    tcpi_total_retrans; /**< \brief Segments sent again */
+    uint32_t    tcpi_segs_out;      /**< \brief Segments sent */
+    uint32_t    tcpi_segs_in;       /**< \brief Segments received */
+    uint64_t    tcpi_bytes_acked;   /**< \brief Bytes of data acked by the
+                                                other side */
+    uint64_t    tcpi_bytes_received; /**< \brief Bytes of data received */
+};
+
+__END_DECLS
+
+#endif /* __NETINET_TCP_H */
@@ -9,8 +9,9 @@
 
     This file contains the definitions needed for using the poll() function, as
     directed by the POSIX 2008 standard (aka The Open Group Base Specifications
-    Issue 7). Currently the functionality defined herein only works for sockets,
-    and that is likely how it will stay for some time.
+    Issue 7). Currently the functionality defined herein only works for sockets
+    and ptys. Other files are always considered to be ready for reading and
+    writing.
 
     The poll() function works quite similarly to the select() function that it
     is quite likely that you'd be more familiar with.
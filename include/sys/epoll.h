@@ -0,0 +1,153 @@
+/* KallistiOS ##version##
+
+   sys/epoll.h
+   Copyright (C) 2026 The KOS Team and contributors.
+*/
+
+/** \file   sys/epoll.h
+    \brief  Scalable I/O event notification.
+
+    This file contains the definitions for an event notification interface
+    modeled on the Linux epoll API. Unlike poll(), which hands the kernel the
+    full list of file descriptors of interest on every call, an epoll instance
+    keeps a persistent interest list. Files that become ready are placed on the
+    instance's ready list as the event happens, so the cost of waiting for
+    events depends only on the number of files that are actually ready, not on
+    the number of files being watched.
+
+    Both level-triggered (the default) and edge-triggered (EPOLLET) operation
+    are supported. Events are currently generated by sockets and by the pty
+    filesystem. Other files are treated as always being ready for reading and
+    writing, as with poll().
+
+    Closing a file descriptor removes it from the interest list of every epoll
+    instance that was watching it, so the descriptor number can be added again
+    once it has been reused. Unlike Linux, this happens when that particular
+    descriptor is closed, even if other duplicates of it remain open.
+*/
+
+#ifndef __SYS_EPOLL_H
+#define __SYS_EPOLL_H
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+#include <stdint.h>
+#include <poll.h>
+
+__BEGIN_DECLS
+
+/** \defgroup epoll_events              Events for epoll
+
+    These are the events that can be set in the events field of the struct
+    epoll_event. The low bits share their values with the events used by the
+    poll() function.
+
+    @{
+*/
+#define EPOLLIN         POLLIN      /**< \brief Data may be read */
+#define EPOLLPRI        POLLPRI     /**< \brief High-priority data may be read */
+#define EPOLLOUT        POLLOUT     /**< \brief Data may be written */
+#define EPOLLRDNORM     POLLRDNORM  /**< \brief Normal data may be read */
+#define EPOLLRDBAND     POLLRDBAND  /**< \brief Priority data may be read */
+#define EPOLLWRNORM     POLLWRNORM  /**< \brief Normal data may be written */
+#define EPOLLWRBAND     POLLWRBAND  /**< \brief Priority data may be written */
+#define EPOLLERR        POLLERR     /**< \brief Error (always reported) */
+#define EPOLLHUP        POLLHUP     /**< \brief Hang up (always reported) */
+#define EPOLLONESHOT    (1U << 30)  /**< \brief Disable after one event */
+#define EPOLLET         (1U << 31)  /**< \brief Edge-triggered notification */
+/** @} */
+
+/** \defgroup epoll_ops                 Operations for epoll_ctl()
+    @{
+*/
+#define EPOLL_CTL_ADD   1           /**< \brief Add a file to the instance */
+#define EPOLL_CTL_DEL   2           /**< \brief Remove a file */
+#define EPOLL_CTL_MOD   3           /**< \brief Change a file's events */
+/** @} */
+
+/** \brief  Flag for epoll_create1() to set close-on-exec.
+
+    This is accepted for compatibility, but has no effect on KOS.
+*/
+#define EPOLL_CLOEXEC   0x0001
+
+/** \brief  User data associated with a file in an epoll instance. */
+typedef union epoll_data {
+    void *ptr;                      /**< \brief Pointer value */
+    int fd;                         /**< \brief File descriptor */
+    uint32_t u32;                   /**< \brief 32-bit value */
+    uint64_t u64;                   /**< \brief 64-bit value */
+} epoll_data_t;
+
+/** \brief  Structure describing an event on an epoll instance.
+    \headerfile sys/epoll.h
+*/
+struct epoll_event {
+    uint32_t events;                /**< \brief Events (see \ref epoll_events) */
+    epoll_data_t data;              /**< \brief User data */
+};
+
+/** \brief  Create an epoll instance.
+
+    \param  size        Ignored, but must be greater than zero.
+    \return             A file descriptor for the new instance, or -1 on error
+                        (sets errno as appropriate).
+*/
+int epoll_create(int size);
+
+/** \brief  Create an epoll instance.
+
+    \param  flags       0 or EPOLL_CLOEXEC.
+    \return             A file descriptor for the new instance, or -1 on error
+                        (sets errno as appropriate).
+
+    \par    Error Conditions:
+    \em     EINVAL - flags is invalid \n
+    \em     ENOMEM - out of memory \n
+    \em     EMFILE - no more file descriptors available
+*/
+int epoll_create1(int flags);
+
+/** \brief  Modify the interest list of an epoll instance.
+
+    \param  epfd        The epoll instance.
+    \param  op          The operation to perform (see \ref epoll_ops).
+    \param  fd          The file descriptor to add, modify, or remove.
+    \param  event       The events of interest and user data for the file. This
+                        is ignored for EPOLL_CTL_DEL.
+    \return             0 on success, -1 on error (sets errno as appropriate).
+
+    \par    Error Conditions:
+    \em     EBADF - epfd or fd is not a valid file descriptor \n
+    \em     EINVAL - epfd is not an epoll instance, fd is epfd, or op is
+                     invalid \n
+    \em     EEXIST - fd is already in the interest list (EPOLL_CTL_ADD) \n
+    \em     ENOENT - fd is not in the interest list \n
+    \em     ENOMEM - out of memory
+*/
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+
+/** \brief  Wait for events on an epoll instance.
+
+    This function blocks until at least one file in the interest list of the
+    instance is ready, or until the timeout expires.
+
+    \param  epfd        The epoll instance.
+    \param  events      Buffer for returned events.
+    \param  maxevents   Number of elements in events, must be greater than 0.
+    \param  timeout     Maximum time to block, in milliseconds. Pass 0 to not
+                        block at all and -1 to block until an event occurs.
+    \return             The number of events stored in events (0 if the timeout
+                        expired), or -1 on error (sets errno as appropriate).
+
+    \par    Error Conditions:
+    \em     EBADF - epfd is not a valid file descriptor \n
+    \em     EINVAL - epfd is not an epoll instance or maxevents is invalid \n
+    \em     EPERM - called inside an interrupt
+*/
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+               int timeout);
+
+__END_DECLS
+
+#endif /* !__SYS_EPOLL_H */
@@ -143,8 +143,8 @@ struct sockaddr_storage {
 
     Note that not all of these are currently supported, but they are listed for
     completeness. Those that are unsupported have (U) at the end of their
-    description. Also, for the time being, the supported flags are only
-    supported for TCP.
+    description. MSG_PEEK, MSG_TRUNC, MSG_DONTWAIT, and MSG_WAITFORONE work with
+    UDP, and MSG_PEEK, MSG_WAITALL, and MSG_DONTWAIT work with TCP.
 
     @{
 */
@@ -153,11 +153,45 @@ struct sockaddr_storage {
 #define MSG_EOR         0x04    /**< \brief Terminate a record (U) */
 #define MSG_OOB         0x08    /**< \brief Out-of-band data (U) */
 #define MSG_PEEK        0x10    /**< \brief Leave received data in queue */
-#define MSG_TRUNC       0x20    /**< \brief Normal data truncated (U) */
+#define MSG_TRUNC       0x20    /**< \brief Normal data truncated */
 #define MSG_WAITALL     0x40    /**< \brief Attempt to fill read buffer */
 #define MSG_DONTWAIT    0x80    /**< \brief Make this call non-blocking (non-standard) */
+#define MSG_WAITFORONE  0x100   /**< \brief Only block for the first message
+                                             in recvmmsg() (non-standard) */
 /** @} */
 
+/** \brief  Message header for sendmsg() and recvmsg().
+
+    This describes a message made up of several pieces of memory, along with
+    the address it is to be sent to or came from. Ancillary data is not
+    supported, so msg_control is ignored, and msg_controllen is set to 0 by
+    recvmsg().
+
+    \headerfile sys/socket.h
+*/
+struct msghdr {
+    void         *msg_name;         /**< \brief Address (optional) */
+    socklen_t     msg_namelen;      /**< \brief Size of the address */
+    struct iovec *msg_iov;          /**< \brief Pieces of the message */
+    int           msg_iovlen;       /**< \brief Number of pieces */
+    void         *msg_control;      /**< \brief Ancillary data (unused) */
+    socklen_t     msg_controllen;   /**< \brief Ancillary data length */
+    int           msg_flags;        /**< \brief Flags on the received
+                                                 message */
+};
+
+/** \brief  One message for sendmmsg() and recvmmsg() (non-standard).
+    \headerfile sys/socket.h
+*/
+struct mmsghdr {
+    struct msghdr msg_hdr;          /**< \brief The message */
+    unsigned int  msg_len;          /**< \brief Bytes sent or received */
+};
+
+/** \cond */
+struct timespec;
+/** \endcond */
+
 /** \brief  Unspecified address family. */
 #define AF_UNSPEC   0
 
@@ -281,6 +315,46 @@ ssize_t recv(int socket, void *buffer, size_t length, int flags);
 ssize_t recvfrom(int socket, void *buffer, size_t length, int flags,
                  struct sockaddr *address, socklen_t *address_len);
 
+/** \brief  Receive a message on a socket, scattering it into several buffers.
+
+    This function works like recvfrom(), except that the message is spread
+    across the buffers in message->msg_iov. If a datagram doesn't fit, the
+    rest of it is thrown away and MSG_TRUNC is set in message->msg_flags.
+
+    \param  socket      The socket to receive on.
+    \param  message     The message header to fill in.
+    \param  flags       The type of message reception.
+    \return             On success, the length of the message in bytes (or
+                        the full length of the datagram, if MSG_TRUNC is
+                        passed in flags). If no messages are available, and
+                        the socket has been shut down, 0. On error, -1, and
+                        sets errno as appropriate.
+*/
+ssize_t recvmsg(int socket, struct msghdr *message, int flags);
+
+/** \brief  Receive several messages on a socket at once (non-standard).
+
+    This function receives up to vlen messages in one call, which saves a lot
+    of overhead over calling recvfrom() for each one when there are a lot of
+    small datagrams coming in. The length of each message is stored in its
+    msg_len field.
+
+    Unless the socket is non-blocking, or MSG_DONTWAIT is passed, this blocks
+    until vlen messages have been received or the timeout runs out. With
+    MSG_WAITFORONE, it only blocks until the first message comes in.
+
+    \param  socket      The socket to receive on.
+    \param  msgvec      The messages to fill in.
+    \param  vlen        The number of messages in msgvec.
+    \param  flags       The type of message reception.
+    \param  timeout     How long to wait for all of the messages (NULL to
+                        wait forever).
+    \return             On success, the number of messages received. On
+                        error, -1, and sets errno as appropriate.
+*/
+int recvmmsg(int socket, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+             struct timespec *timeout);
+
 /** \brief  Send a message on a connected socket.
 
     This function sends messages to the peer on a connected socket.
@@ -312,6 +386,36 @@ ssize_t send(int socket, const void *message, size_t length, int flags);
 ssize_t sendto(int socket, const void *message, size_t length, int flags,
                const struct sockaddr *dest_addr, socklen_t dest_len);
 
+/** \brief  Send a message on a socket, gathering it from several buffers.
+
+    This function works like sendto(), except that the message is made up of
+    the buffers in message->msg_iov, and the address (if any) is in
+    message->msg_name.
+
+    \param  socket      The socket to send on.
+    \param  message     The message to send.
+    \param  flags       The type of message transmission.
+    \return             On success, the number of bytes sent. On error, -1,
+                        and sets errno as appropriate.
+*/
+ssize_t sendmsg(int socket, const struct msghdr *message, int flags);
+
+/** \brief  Send several messages on a socket at once (non-standard).
+
+    This function sends up to vlen messages in one call. The number of bytes
+    sent for each message is stored in its msg_len field.
+
+    \param  socket      The socket to send on.
+    \param  msgvec      The messages to send.
+    \param  vlen        The number of messages in msgvec.
+    \param  flags       The type of message transmission.
+    \return             On success, the number of messages sent, which may be
+                        less than vlen if there was an error partway through.
+                        If the first message could not be sent, -1, and sets
+                        errno as appropriate.
+*/
+int sendmmsg(int socket, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+
 /** \brief  Shutdown socket send and receive operations.
 
     This function closes a specific socket for the set of specified operations.
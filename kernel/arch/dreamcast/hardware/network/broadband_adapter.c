@@ -65,10 +65,15 @@
    own dcload syscalls emulation.*/
 #define TX_SEMA
 
-/* If this is defined, the dma buffer will be located in P2 area, and no call to
-   dcache_inval_range need to be done before receiving data.
-   TODO : make some benchmark to see which method is faster */
-//#define USE_P2_AREA
+/* Interrupts we handle, and the subset of those that the RX thread masks off
+   while it is busy emptying the ring. */
+#define BBA_INTR_MASK   (RT_INT_PCIERR | RT_INT_TIMEOUT | \
+                         RT_INT_RXFIFO_OVERFLOW | \
+                         RT_INT_RXFIFO_UNDERRUN | /* +link change */ \
+                         RT_INT_RXBUF_OVERFLOW | RT_INT_TX_ERR | \
+                         RT_INT_TX_OK | RT_INT_RX_ERR | RT_INT_RX_OK)
+#define BBA_INTR_RX     (RT_INT_RXFIFO_OVERFLOW | RT_INT_RXBUF_OVERFLOW | \
+                         RT_INT_RX_ERR | RT_INT_RX_OK)
 
 /*
 
@@ -308,15 +313,7 @@ static int bba_hw_init() {
     /* Enable receive interrupts */
     /* XXX need to handle more! */
     g2_write_16(NIC(RT_INTRSTATUS), 0xffff);
-    g2_write_16(NIC(RT_INTRMASK), RT_INT_PCIERR |
-                RT_INT_TIMEOUT |
-                RT_INT_RXFIFO_OVERFLOW |
-                RT_INT_RXFIFO_UNDERRUN |    // +link change
-                RT_INT_RXBUF_OVERFLOW |
-                RT_INT_TX_ERR |
-                RT_INT_TX_OK |
-                RT_INT_RX_ERR |
-                RT_INT_RX_OK);
+    g2_write_16(NIC(RT_INTRMASK), BBA_INTR_MASK);
 
     /* Enable RX/TX once more */
     g2_write_8(NIC(RT_CHIPCMD), RT_CMD_RX_ENABLE | RT_CMD_TX_ENABLE);
@@ -461,185 +458,232 @@ static void g2_read_block_8(uint8 *dst, uint8 *src, int len) {
 #endif
 
 
-#define RXBSZ    (64*1024) /* must be a power of two */
-#define MAX_PKTS (RXBSZ / 32)
-static struct pkt {
-    int pkt_size;
-    uint8 * rxbuff;
-} rx_pkt[MAX_PKTS];
+/* Receive processing is done NAPI-style: the interrupt handler doesn't touch
+   the ring at all, it just masks off the RX interrupts and wakes up the RX
+   thread. The thread then pulls up to BBA_RX_BUDGET packets out of the ring per
+   pass, hands them to the network stack as a batch, and keeps going until the
+   ring is empty, at which point the RX interrupts get turned back on. Under a
+   flood of packets, this means we take one interrupt per burst rather than one
+   per packet, and anything we can't keep up with gets dropped by the chip
+   rather than eating all of our CPU time in interrupt context. */
+#define BBA_RX_BUDGET       16
 
-#define BEFORE 0 // 32*1024
-#define AFTER  0 // (BEFORE + 32*1024)
-
-static uint8 rxbuff[RXBSZ + 2 * 1600 + AFTER] __attribute__((aligned(32)));
-static uint32 rxbuff_pos;
-static int rxin;
-static int rxout;
-static int dma_used;
-
-static uint32 rx_size;
+/* If we go this many passes in a row without emptying the ring, sleep for a
+   moment so that lower priority threads get a chance to run. */
+#define BBA_RX_MAX_PASSES   8
 
 static kthread_t * bba_rx_thread;
 static semaphore_t bba_rx_sema;
 static int bba_rx_exit_thread;
-static semaphore_t bba_rx_sema2;
 
-static void bba_rx();
+/* Set by the interrupt handler if the chip reports a ring overflow. The RX
+   thread takes care of the reset, so it doesn't happen in the middle of a
+   copy out of the ring. */
+static volatile int rx_overflow;
+
+/* Set while the RX thread (or a poll from another thread) is pulling packets
+   out of the ring. A poll from an interrupt ignores this, since whoever set it
+   can't run again until the interrupt is over. */
+static int rx_busy;
+
+static bba_rx_stats_t rx_stats;
 
 #ifdef TX_SEMA
 static semaphore_t tx_sema;
 #endif
 
-static uint8 * next_dst;
-static uint8 * next_src;
-static int next_len;
+/* Copy a packet out of the ring buffer into a new packet buffer. The buffer is
+   allocated so that its data has the same alignment within a 32-byte block as
+   the packet does in the ring, and with enough slack at the end for the copy to
+   be done in whole words or DMA blocks. */
+static net_pbuf_t *bba_rx_copy(uint32 ring_offset, size_t len) {
+    uint32 src = rtl_mem + ring_offset;
+    size_t align = src & 31;
+    net_pbuf_t *p;
+
+    if(!(p = net_pbuf_alloc(align, ((len + align + 31) & ~31) - align)))
+        return NULL;
+
+    p->len = p->tot_len = len;
+
+    /* Use DMA for anything big enough to be worth it, as long as the buffer
+       lines up the way the DMA controller needs. Waiting for the DMA to finish
+       needs a semaphore, so it can't be done from an interrupt. */
+    if(len > DMA_THRESHOLD && !irq_inside_int() &&
+       !(((uint32)p->data ^ src) & 31)) {
+        dcache_flush_range((uint32)(p->data - align), len + align);
+
+        if(g2_dma_transfer(p->data - align, (void *)(src - align), len + align,
+                           1, NULL, 0,
+                           1,   /* dir = 1, we're *reading* from the g2 bus */
+                           BBA_DMA_MODE, BBA_DMA_G2CHN, BBA_DMA_SHCHN) >= 0)
+            return p;
+    }
 
-static void rx_finish_enq(int room) {
-    /* Tell the chip where we are for overflow checking */
-    rtl.cur_rx = (rtl.cur_rx + rx_size + 4 + 3) & ~3;
-    g2_write_16(NIC(RT_RXBUFTAIL), (rtl.cur_rx - 16) & (RX_BUFFER_LEN - 1));
+    g2_read_block_8(p->data, (uint8 *)src, len);
 
-    if(room > 0 && (((rxin + 1) % MAX_PKTS) != rxout)) {
-        rxin = (rxin + 1) % MAX_PKTS;
-        sem_signal(&bba_rx_sema);
-        thd_schedule(1, 0);
-    }
+    return p;
 }
+#undef g2_read_block_8
 
-static void bba_dma_cb(ptr_t p) {
-    (void)p;
+/* Forward declarations for passing packets up to the network stack */
+static void bba_if_netinput(uint8 *pkt, int pktsize);
+static void bba_if_netinput_pbuf(net_pbuf_t *p);
+
+/* Pull up to budget packets out of the ring and pass them along. Returns the
+   number of packets processed.
+
+   This can be called from an interrupt (by dcload, while it waits for a
+   reply), which may well have interrupted the RX thread in the middle of this
+   same function. The interrupt has to be able to empty the ring anyway, or
+   dcload would wait forever, so it doesn't check rx_busy. Instead, the thread
+   only moves the ring pointer along with interrupts disabled, and only if
+   nobody else has moved it since it started on that packet. */
+static int bba_rx_poll(int budget) {
+    net_pbuf_t *batch[BBA_RX_BUDGET];
+    uint32 rx_status, rx_size;
+    uint16 start;
+    size_t pkt_size, ring_offset;
+    int cnt = 0, done = 0, i, old, inside = irq_inside_int();
 
-    if(next_len) {
-        g2_dma_transfer(next_dst, next_src, next_len, 0,
-                        bba_dma_cb, 0,  /* callback */
-                        1,  /* dir = 1, we're *reading* from the g2 bus */
-                        BBA_DMA_MODE, BBA_DMA_G2CHN, BBA_DMA_SHCHN);
-        next_len = 0;
-    }
-    else {
-        rx_finish_enq(1);
+    if(budget > BBA_RX_BUDGET)
+        budget = BBA_RX_BUDGET;
+
+    /* Make sure no other thread is already doing this. */
+    if(!inside) {
+        old = irq_disable();
 
-        dma_used = 0;
+        if(rx_busy) {
+            irq_restore(old);
+            return 0;
+        }
 
-        bba_rx();
+        rx_busy = 1;
+        irq_restore(old);
     }
-}
 
-static int bba_copy_dma(uint8 * dst, uint32 s, int len) {
-    uint8 *src = (uint8 *) s;
+    if(rx_overflow) {
+        rx_overflow = 0;
+        rx_reset();
+    }
 
-    if(len <= 0)
-        return 1;
-
-    if(len > DMA_THRESHOLD && !irq_inside_int()) {
-        uint32 add;
-
-        /*
-           This way all will be nicely 32 bytes aligned (assuming that dst and src have
-           same alignement initially and that we don't care about the beginning of dst
-           buffer)
-        */
-        add = ((uint32) src) & 31;
-        len += add;
-        src -= add;
-        dst -= add;
-
-#ifndef USE_P2_AREA
-        /*
-           used to be a call to dcache_inval_range, but for some strange reasons, I need to
-           make a full flush now ...
-        */
-        dcache_flush_range((uint32) dst, len);
-#endif
+    /* Copy everything out of the ring first, so that the chip gets the space
+       back as soon as possible. */
+    while(done < budget && !(g2_read_8(NIC(RT_CHIPCMD)) & RT_CMD_RX_BUF_EMPTY)) {
+        /* Get frame size and status */
+        start = rtl.cur_rx;
+        ring_offset = start % RX_BUFFER_LEN;
+        rx_status = g2_read_32(rtl_mem + ring_offset);
+        rx_size = (rx_status >> 16) & 0xffff;
+        pkt_size = rx_size - 4;
 
-        if(!dma_used) {
-            dma_used = 1;
-            g2_dma_transfer(dst, src, len, 0,
-                            bba_dma_cb, 0,  /* callback */
-                            1,  /* dir = 1, we're *reading* from the g2 bus */
-                            BBA_DMA_MODE, BBA_DMA_G2CHN, BBA_DMA_SHCHN);
+        if(rx_size == 0xfff0) {
+            /* Early receive, the packet isn't all there yet. */
+            break;
         }
-        else {
-            next_dst = dst;
-            next_src = src;
-            next_len = len;
+
+        if(!(rx_status & RT_RX_STATUS_OK) || pkt_size > 1514) {
+            /* Don't reset the ring over a header that an interrupt pulled
+               out from under us. */
+            if(rtl.cur_rx != start)
+                continue;
+
+            if(!(rx_status & RT_RX_STATUS_OK)) {
+                dbglog(DBG_KDEBUG, "bba: frame receive error, status is %08lx; skipping\n", rx_status);
+            }
+
+            dbglog(DBG_KDEBUG, "bba: bogus packet receive detected; skipping packet\n");
+            ++rx_stats.rx_errors;
+            rx_reset();
+            break;
         }
 
-        return 0;
-    }
-    else {
-        g2_read_block_8(dst, src, len);
-        return !dma_used;
-    }
-}
-#undef g2_read_block_8
+        batch[cnt] = eth_rx_callback ? bba_rx_copy(ring_offset + 4,
+                                                   pkt_size) : NULL;
 
-/* Utility function to copy out a some data from the ring buffer into an SH-4
-   buffer. This is done to make sure the buffers don't overflow. */
-/* XXX Could probably use a memcpy8 here, even */
-static int  bba_copy_packet(uint8 * dst, uint32 src, int len) {
+        old = irq_disable();
 
-#if !RX_NOWRAP
+        if(rtl.cur_rx != start) {
+            /* An interrupt got to this packet first (or reset the ring). */
+            irq_restore(old);
 
-    if((src + len) < RX_BUFFER_LEN) {
-#endif
-        /* Straight copy is ok */
-        return bba_copy_dma(dst, rtl_mem + src, len);
-#if !RX_NOWRAP
+            if(batch[cnt])
+                net_pbuf_free(batch[cnt]);
+
+            continue;
+        }
+
+        if(batch[cnt])
+            ++cnt;
+        else
+            ++rx_stats.rx_dropped;
+
+        ++done;
+
+        /* Tell the chip where we are for overflow checking */
+        rtl.cur_rx = (rtl.cur_rx + rx_size + 4 + 3) & ~3;
+        g2_write_16(NIC(RT_RXBUFTAIL), (rtl.cur_rx - 16) & (RX_BUFFER_LEN - 1));
+        irq_restore(old);
     }
-    else {
-        /* Have to copy around the ring end */
-        bba_copy_dma(dst, rtl_mem + src, RX_BUFFER_LEN - src);
 
-        return bba_copy_dma(dst + (RX_BUFFER_LEN - src),
-                            rtl_mem, len - (RX_BUFFER_LEN - src));
+    /* Now hand the whole batch to the stack. */
+    for(i = 0; i < cnt; ++i) {
+        if(eth_rx_callback == bba_if_netinput)
+            bba_if_netinput_pbuf(batch[i]);
+        else if(eth_rx_callback)
+            eth_rx_callback(batch[i]->data, batch[i]->len);
+
+        net_pbuf_free(batch[i]);
     }
 
-#endif
-}
+    rx_stats.rx_pkts += cnt;
 
-static int rx_enq(int ring_offset, size_t pkt_size) {
-    /* If there's no one to receive it, don't bother. */
-    if(eth_rx_callback) {
-        if(rxin != rxout &&
-                (((rx_pkt[rxout].rxbuff - (rxbuff + 32 + BEFORE)) - rxbuff_pos) & (RXBSZ - 1)) < pkt_size + 2048) {
-            /*       printf("diff %d, %d\n", (( (rx_pkt[rxout].rxbuff - rxbuff) - rxbuff_pos ) & (RXBSZ-1)), */
-            /*       pkt_size); */
-            //dbglog(DBG_KDEBUG, "rx_enq: lagging\n");
-            return -1;
-        }
+    if((uint32)done > rx_stats.rx_max_batch)
+        rx_stats.rx_max_batch = done;
 
-        /* Receive buffer: temporary space to copy out received data */
+    if(!inside)
+        rx_busy = 0;
 
-#ifdef USE_P2_AREA
-        rx_pkt[rxin].rxbuff = rxbuff + 32 + BEFORE + (rxbuff_pos | 0xa0000000) + (ring_offset & 31);
-#else
-        rx_pkt[rxin].rxbuff = rxbuff + 32 + BEFORE + rxbuff_pos + (ring_offset & 31);
-#endif
+    return done;
+}
 
+void bba_get_rx_stats(bba_rx_stats_t *stats) {
+    *stats = rx_stats;
+}
 
-        rxbuff_pos = (rxbuff_pos + pkt_size + 63) & (RXBSZ - 32);
+/* Copy one piece of a packet out to RTL memory. Check the alignment of both
+   ends, if they're both 32-bit aligned, use g2_write_block_32, if they're both
+   16-bit aligned, use g2_write_block_16, otherwise, use g2_write_block_8. */
+static void bba_tx_copy(uint32 dst, const uint8 *src, int len) {
+    uint32 align = dst | (uint32)src;
 
-        rx_pkt[rxin].pkt_size = pkt_size;
-        return bba_copy_packet(rx_pkt[rxin].rxbuff, ring_offset, pkt_size);
+    /* XXX could use store queues or memcpy8 here */
+    if(!(align & 0x03)) {
+        g2_write_block_32((uint32 *) src, dst, (len + 3) >> 2);
+    }
+    else if(!(align & 0x01)) {
+        g2_write_block_16((uint16 *) src, dst, (len + 1) >> 1);
+    }
+    else {
+        g2_write_block_8(src, dst, len);
     }
-    else
-        return 1;
 }
 
-/* Transmit a single packet */
+/* Transmit a single packet, gathered from the pieces given */
 #ifdef TX_SEMA
-static int bba_rtx(const uint8 * pkt, int len, int wait)
+static int bba_rtx_v(const struct iovec *iov, int iovcnt, int wait)
 #else
-static int bba_tx(const uint8 * pkt, int len, int wait)
+int bba_tx_v(const struct iovec *iov, int iovcnt, int wait)
 #endif
 {
-    /*
-       int i;
+    int i, len = 0;
 
-    printf("Transmitting packet:\r\n"); for (i=0; i<len; i++) { printf("%02x ", pkt[i]); if (i
-       && !(i % 16)) printf("\r\n"); } printf("\r\n");
-    */
+    for(i = 0; i < iovcnt; ++i) {
+        len += iov[i].iov_len;
+    }
+
+    if(len > TX_BUFFER_LEN)
+        return BBA_TX_ERROR;
 
     //wait = BBA_TX_WAIT;
     if(!link_stable) {
@@ -665,22 +709,13 @@ static int bba_tx(const uint8 * pkt, int len, int wait)
         }
     }
 
-    /* Copy the packet out to RTL memory */
-    /* XXX could use store queues or memcpy8 here */
-
-    //g2_write_block_8(pkt, txdesc[rtl.cur_tx], len);
-
-    /* Check alignment of the packet, if its 32-bit aligned, use
-       g2_write_block_32, if its 16-bit aligned, use g2_write_block_16,
-       otherwise, use g2_write_block_8. */
-    if(!((uint32)pkt & 0x03)) {
-        g2_write_block_32((uint32 *) pkt, txdesc[rtl.cur_tx], (len + 3) >> 2);
-    }
-    else if(!((uint32)pkt & 0x01)) {
-        g2_write_block_16((uint16 *) pkt, txdesc[rtl.cur_tx], (len + 1) >> 1);
-    }
-    else {
-        g2_write_block_8(pkt, txdesc[rtl.cur_tx], len);
+    /* Copy the packet out to RTL memory, one piece after another. Any extra
+       bytes written at the end of a piece by the wider copies just get written
+       over by the next one. */
+    for(i = 0, len = 0; i < iovcnt; ++i) {
+        bba_tx_copy(txdesc[rtl.cur_tx] + len, (const uint8 *)iov[i].iov_base,
+                    iov[i].iov_len);
+        len += iov[i].iov_len;
     }
 
     /* All packets must be at least 60 bytes, pad them with null bytes if
@@ -700,13 +735,13 @@ static int bba_tx(const uint8 * pkt, int len, int wait)
 }
 
 #ifdef TX_SEMA
-int bba_tx(const uint8 * pkt, int len, int wait) {
+int bba_tx_v(const struct iovec *iov, int iovcnt, int wait) {
     int res;
 
     if(irq_inside_int()) {
         /*     printf("bba_tx called from an irq !\n"); */
         /*     return 0; */
-        //return bba_rtx(pkt, len, wait);
+        //return bba_rtx_v(iov, iovcnt, wait);
         if(sem_trywait(&tx_sema)) {
             //printf("bba_tx called from an irq while a thread was running it !\n");
             return BBA_TX_OK;   /* sorry guys ... */
@@ -715,13 +750,23 @@ int bba_tx(const uint8 * pkt, int len, int wait) {
     else
         sem_wait(&tx_sema);
 
-    res = bba_rtx(pkt, len, wait);
+    res = bba_rtx_v(iov, iovcnt, wait);
     sem_signal(&tx_sema);
 
     return res;
 }
 #endif
 
+/* Transmit a single packet */
+int bba_tx(const uint8 * pkt, int len, int wait) {
+    struct iovec iov;
+
+    iov.iov_base = (void *)pkt;
+    iov.iov_len = len;
+
+    return bba_tx_v(&iov, 1, wait);
+}
+
 void bba_lock() {
     //sem_wait(&bba_rx_sema2);
     //asic_evt_disable(ASIC_EVT_EXP_PCI, BBA_ASIC_IRQ);
@@ -732,32 +777,39 @@ void bba_unlock() {
     //sem_signal(&bba_rx_sema2);
 }
 
-static int bcolor;
 static void *bba_rx_threadfunc(void *dummy) {
+    int passes;
+
     (void)dummy;
 
     while(!bba_rx_exit_thread) {
-        //sem_wait_timed(&bba_rx_sema, 500);
         sem_wait(&bba_rx_sema);
 
         if(bba_rx_exit_thread)
             break;
 
-        bcolor = 255;
-        //vid_border_color(255, 255, 0);
-        bba_lock();
+        passes = 0;
 
-        if(rxout != rxin) {
+        for(;;) {
+            ++rx_stats.rx_polls;
 
-            /* Call the callback to process it */
-            eth_rx_callback(rx_pkt[rxout].rxbuff, rx_pkt[rxout].pkt_size);
+            if(bba_rx_poll(BBA_RX_BUDGET) < BBA_RX_BUDGET) {
+                /* The ring is empty, so turn the RX interrupts back on. If
+                   something came in while we were doing that, keep going. */
+                g2_write_16(NIC(RT_INTRSTATUS), RT_INT_RX_ACK);
+                g2_write_16(NIC(RT_INTRMASK), BBA_INTR_MASK);
 
-            rxout = (rxout + 1) % MAX_PKTS;
+                if(g2_read_8(NIC(RT_CHIPCMD)) & RT_CMD_RX_BUF_EMPTY)
+                    break;
+            }
+            else if(++passes >= BBA_RX_MAX_PASSES) {
+                passes = 0;
+                thd_sleep(1);
+            }
+            else {
+                thd_pass();
+            }
         }
-
-        bcolor = 0;
-        //vid_border_color(0, 0, 0);
-        bba_unlock();
     }
 
     bba_rx_exit_thread = 0;
@@ -766,52 +818,6 @@ static void *bba_rx_threadfunc(void *dummy) {
     return NULL;
 }
 
-static void bba_rx() {
-    uint32 rx_status;
-    size_t pkt_size, ring_offset;
-
-    //vid_border_color(255, 0, 255);
-    while(!(g2_read_8(NIC(RT_CHIPCMD)) & 1)) {
-        /* Get frame size and status */
-        ring_offset = rtl.cur_rx % RX_BUFFER_LEN;
-        rx_status = g2_read_32(rtl_mem + ring_offset);
-        rx_size = (rx_status >> 16) & 0xffff;
-        pkt_size = rx_size - 4;
-
-        if(rx_size == 0xfff0) {
-            //dbglog(DBG_KDEBUG, "bba: early receive triggered\n");
-            break;
-        }
-
-        /*     if ( ( ( g2_read_16(NIC(RT_RXBUFHEAD)) - ring_offset ) & (RX_BUFFER_LEN-1)) < */
-        /*   ( (rx_size+4+3) & (RX_BUFFER_LEN-3-1) )) { */
-        /*       //dbglog(DBG_KDEBUG, "bba: oops\n"); */
-        /*       break; */
-        /*     } */
-
-        if((rx_status & 1) && (pkt_size <= 1514)) {
-            /* Add it to the rx queue */
-            int res = rx_enq(ring_offset + 4, pkt_size);
-
-            if(!res)
-                break;  /* will be finished in the dma callback */
-            else
-                rx_finish_enq(res);
-        }
-        else {
-            if(!(rx_status & 1)) {
-                dbglog(DBG_KDEBUG, "bba: frame receive error, status is %08lx; skipping\n", rx_status);
-            }
-
-            dbglog(DBG_KDEBUG, "bba: bogus packet receive detected; skipping packet\n");
-            rx_reset();
-            break;
-        }
-    }
-
-    //vid_border_color(bcolor, bcolor, 0);
-}
-
 /* Ethernet IRQ handler */
 static void bba_irq_hnd(uint32 code) {
     int intr, hnd;
@@ -827,14 +833,24 @@ static void bba_irq_hnd(uint32 code) {
     /* Do processing */
     hnd = 0;
 
-    if(intr & RT_INT_RX_ACK) {
+    if(intr & (RT_INT_RX_ACK | RT_INT_RX_ERR)) {
+        /* Leave the ring alone and let the RX thread deal with it. Mask off
+           the RX interrupts until it has emptied the ring. */
+        g2_write_16(NIC(RT_INTRMASK), BBA_INTR_MASK & ~BBA_INTR_RX);
+        g2_write_16(NIC(RT_INTRSTATUS), RT_INT_RX_ACK);
 
-        if(!dma_used) {
-            bba_rx();
+        if(intr & RT_INT_RXBUF_OVERFLOW) {
+            dbglog(DBG_KDEBUG, "bba: RX overrun\n");
+            ++rx_stats.rx_errors;
+            rx_overflow = 1;
         }
 
-        /* so that the irq is not called again and again */
-        g2_write_16(NIC(RT_INTRSTATUS), RT_INT_RX_ACK);
+        ++rx_stats.rx_irqs;
+
+        if(bba_rx_thread) {
+            sem_signal(&bba_rx_sema);
+            thd_schedule(1, 0);
+        }
 
         hnd = 1;
     }
@@ -884,12 +900,6 @@ static void bba_irq_hnd(uint32 code) {
         hnd = 1;
     }
 
-    if(intr & RT_INT_RXBUF_OVERFLOW) {
-        dbglog(DBG_KDEBUG, "bba: RX overrun\n");
-        rx_reset();
-        hnd = 1;
-    }
-
     // DMA complete ? doesn't look like, then what ? anyway, ignore it for now ...
     if(intr == 0) {
         hnd = 1;
@@ -977,7 +987,6 @@ static int bba_if_start(netif_t *self) {
     // Start the BBA RX thread.
     assert(bba_rx_thread == NULL);
     sem_init(&bba_rx_sema, 0);
-    sem_init(&bba_rx_sema2, 1);
     bba_rx_thread = thd_create(0, bba_rx_threadfunc, 0);
     bba_rx_thread->prio = 1;
     thd_set_label(bba_rx_thread, "BBA-rx-thd");
@@ -1012,10 +1021,8 @@ static int bba_if_stop(netif_t *self) {
     assert(bba_rx_thread != NULL);
     bba_rx_exit_thread = 1;
     sem_signal(&bba_rx_sema);
-    sem_signal(&bba_rx_sema2);
     thd_join(bba_rx_thread, NULL);
     sem_destroy(&bba_rx_sema);
-    sem_destroy(&bba_rx_sema2);
 
     bba_rx_thread = NULL;
 
@@ -1035,6 +1042,19 @@ static int bba_if_tx(netif_t *self, const uint8 *data, int len, int blocking) {
     return 0;
 }
 
+static int bba_if_tx_v(netif_t *self, const struct iovec *iov, int iovcnt,
+                       int blocking) {
+    (void)self;
+
+    if(!(bba_if.flags & NETIF_RUNNING))
+        return -1;
+
+    if(bba_tx_v(iov, iovcnt, blocking) != BBA_TX_OK)
+        return -1;
+
+    return 0;
+}
+
 /* We'll auto-commit for now */
 static int bba_if_tx_commit(netif_t *self) {
     (void)self;
@@ -1042,25 +1062,11 @@ static int bba_if_tx_commit(netif_t *self) {
 }
 
 static int bba_if_rx_poll(netif_t *self) {
-    int intr;
-
     (void)self;
 
-    intr = g2_read_16(NIC(RT_INTRSTATUS));
-
-    if(intr & RT_INT_RX_ACK) {
-        bba_rx();
-
-        /* so that the irq is not called */
-        g2_write_16(NIC(RT_INTRSTATUS), RT_INT_RX_ACK);
-    }
-
-    if(rxout != rxin) {
-        /* Call the callback to process it */
-        eth_rx_callback(rx_pkt[rxout].rxbuff, rx_pkt[rxout].pkt_size);
-
-        rxout = (rxout + 1) % MAX_PKTS;
-    }
+    /* Process one batch directly. From a thread, this does nothing if the RX
+       thread is busy with the ring. From an interrupt, it always empties it. */
+    bba_rx_poll(BBA_RX_BUDGET);
 
     return 0;
 }
@@ -1109,11 +1115,15 @@ static int bba_if_set_mc(netif_t *self, const uint8 *list, int count) {
     return 0;
 }
 
-/* We'll take packets from the interrupt handler and push them into netcore */
+/* We'll take packets from the RX thread and push them into netcore */
 static void bba_if_netinput(uint8 *pkt, int pktsize) {
     net_input(&bba_if, pkt, pktsize);
 }
 
+static void bba_if_netinput_pbuf(net_pbuf_t *p) {
+    net_input_pbuf(&bba_if, p);
+}
+
 /* Set ISP configuration from the flashrom, as long as we're configured staticly */
 static void bba_set_ispcfg() {
     flashrom_ispcfg_t isp;
@@ -1179,6 +1189,7 @@ int bba_init() {
     bba_if.if_rx_poll = bba_if_rx_poll;
     bba_if.if_set_flags = bba_if_set_flags;
     bba_if.if_set_mc = bba_if_set_mc;
+    bba_if.if_tx_v = bba_if_tx_v;
 
     /* Attempt to set up our IP address et al from the flashrom */
     bba_set_ispcfg();
@@ -756,6 +756,7 @@ int la_init() {
     la_if.if_rx_poll = la_if_rx_poll;
     la_if.if_set_flags = la_if_set_flags;
     la_if.if_set_mc = la_if_set_mc;
+    la_if.if_tx_v = NULL;
 
     /* Attempt to set up our IP address et al from the flashrom */
     la_set_ispcfg();
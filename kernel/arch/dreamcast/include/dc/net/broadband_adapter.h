@@ -21,6 +21,8 @@
 #include <sys/cdefs.h>
 __BEGIN_DECLS
 
+#include <sys/uio.h>
+
 /** \defgroup bba_regs  RTL8139C Register Definitions
     @{
 */
@@ -161,6 +163,28 @@ typedef void (*eth_rx_callback_t)(uint8 *pkt, int len);
 */
 void bba_set_rx_callback(eth_rx_callback_t cb);
 
+/** \brief  BBA receive statistics.
+
+    These counters describe how the receive path is coping with the incoming
+    packet rate. The average number of packets handled per receive interrupt is
+    rx_pkts / rx_irqs.
+
+    \headerfile dc/net/broadband_adapter.h
+*/
+typedef struct bba_rx_stats {
+    uint32  rx_irqs;        /**< \brief Receive interrupts taken */
+    uint32  rx_polls;       /**< \brief Passes made over the receive ring */
+    uint32  rx_pkts;        /**< \brief Packets passed up to the callback */
+    uint32  rx_max_batch;   /**< \brief Most packets handled in one pass */
+    uint32  rx_dropped;     /**< \brief Packets dropped (no buffer space) */
+    uint32  rx_errors;      /**< \brief Bad frames and ring overflows */
+} bba_rx_stats_t;
+
+/** \brief  Retrieve the receive statistics for the BBA.
+    \param  stats           Where to store the statistics.
+*/
+void bba_get_rx_stats(bba_rx_stats_t *stats);
+
 /** \defgroup bba_txrv  Return values from bba_tx().
     @{
 */
@@ -189,6 +213,24 @@ void bba_set_rx_callback(eth_rx_callback_t cb);
 */
 int bba_tx(const uint8 *pkt, int len, int wait);
 
+/** \brief  Transmit a single packet made up of several pieces.
+
+    This function works just like bba_tx(), except that the packet is given as
+    a list of pieces which are copied into the adapter's transmit buffer back
+    to back.
+
+    \param  iov             The pieces of the packet.
+    \param  iovcnt          The number of pieces.
+    \param  wait            BBA_TX_WAIT if you don't mind blocking for the
+                            all clear to transmit, BBA_TX_NOWAIT otherwise.
+
+    \retval BBA_TX_OK       On success.
+    \retval BBA_TX_ERROR    If there was an error transmitting the packet.
+    \retval BBA_TX_AGAIN    If BBA_TX_NOWAIT was specified and it is not ok to
+                            transmit right now.
+*/
+int bba_tx_v(const struct iovec *iov, int iovcnt, int wait);
+
 /* \cond */
 /* Initialize */
 int bba_init();
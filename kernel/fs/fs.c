@@ -54,6 +54,9 @@ fs_hnd_t * fd_table[FD_SETSIZE] = { NULL };
 /* For some reason, Newlib doesn't seem to define this function in stdlib.h. */
 extern char *realpath(const char *, const char *);
 
+/* Lets poll()/epoll drop anything tied to a descriptor that's being closed. */
+extern void __poll_fd_closed(int fd, void *hnd);
+
 
 /* Internal file commands for root dir reading */
 static fs_hnd_t * fs_root_opendir() {
@@ -345,9 +348,13 @@ int fs_close(file_t fd) {
       return -1;
     }
 
-    /* Deref it and remove it from our table */
-    retval = fs_hnd_unref(hnd);
+    /* Remove it from our table, then let any epoll instances that are watching
+       the descriptor forget about it before the handle can go away. */
     fd_table[fd] = NULL;
+    __poll_fd_closed(fd, hnd->hnd);
+
+    /* Deref it */
+    retval = fs_hnd_unref(hnd);
     return retval ? -1 : 0;
 }
 
@@ -21,6 +21,9 @@ space or data is available (respectively). Like Unix sockets, the returned
 data may be less than the requested data if there is not enough data
 or space present.
 
+Each end also supports poll(), and delivers events to poll() and epoll as data
+arrives, as space frees up, and when the other end goes away.
+
 */
 
 #include <kos/dbgio.h>
@@ -35,12 +38,14 @@ or space present.
 #include <stdio.h>
 #include <assert.h>
 #include <errno.h>
+#include <poll.h>
 
 /* pty buffer size */
 #define PTY_BUFFER_SIZE 1024
 
 /* Forward-declare some stuff */
 struct ptyhalf;
+struct pipefd;
 typedef LIST_HEAD(ptylist, ptyhalf) ptylist_t;
 
 /* This struct represents one half of a pty. Each end is openable as a
@@ -56,6 +61,7 @@ typedef struct ptyhalf {
     size_t cnt;             /* Byte count in the queue */
 
     int refcnt;             /* When this reaches zero, we close */
+    LIST_HEAD(pipefdlist, pipefd) fds;  /* Open handles on this end */
 
     int id;
 
@@ -85,6 +91,8 @@ typedef struct dirlist {
 
 /* We'll have one of these for each opened pipe */
 typedef struct pipefd {
+    LIST_ENTRY(pipefd) list;
+
     /* Our directory or pty */
     union {
         ptyhalf_t   * p;
@@ -100,6 +108,18 @@ typedef struct pipefd {
 #define PF_PTY  0
 #define PF_DIR  1
 
+extern void __poll_event_trigger_hnd(void *hnd, short event);
+
+/* Let anything watching the open handles on a pty half know that something
+   happened. The ptyhalf's mutex must be held. */
+static void pty_notify(ptyhalf_t *ph, short event) {
+    pipefd_t *fd;
+
+    LIST_FOREACH(fd, &ph->fds, list) {
+        __poll_event_trigger_hnd(fd, event);
+    }
+}
+
 /* Creates a pty pair */
 int fs_pty_create(char * buffer, int maxbuflen, file_t * master_out, file_t * slave_out) {
     ptyhalf_t *master, *slave;
@@ -354,16 +374,24 @@ static void * pty_open_file(const char * fn, int mode) {
             ph = ph->other;
     }
 
-    /* Now add a refcnt and return it */
-    mutex_lock(&ph->mutex);
-    ph->refcnt++;
-    mutex_unlock(&ph->mutex);
-
     fdobj = malloc(sizeof(pipefd_t));
+
+    if(!fdobj) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
     memset(fdobj, 0, sizeof(pipefd_t));
     fdobj->d.p = ph;
     fdobj->type = PF_PTY;
     fdobj->mode = mode;
+
+    /* Now add a refcnt and return it */
+    mutex_lock(&ph->mutex);
+    ph->refcnt++;
+    LIST_INSERT_HEAD(&ph->fds, fdobj, list);
+    mutex_unlock(&ph->mutex);
+
     return (void *)fdobj;
 }
 
@@ -403,11 +431,16 @@ static int pty_close(void * h) {
         /* De-ref this end of it */
         mutex_lock(&fdobj->d.p->mutex);
         fdobj->d.p->refcnt--;
+        LIST_REMOVE(fdobj, list);
 
         if(fdobj->d.p->refcnt <= 0) {
             /* Unblock anyone who might be waiting on the other end */
             cond_broadcast(&fdobj->d.p->other->ready_read);
             cond_broadcast(&fdobj->d.p->ready_write);
+
+            mutex_lock(&fdobj->d.p->other->mutex);
+            pty_notify(fdobj->d.p->other, POLLHUP);
+            mutex_unlock(&fdobj->d.p->other->mutex);
         }
 
         mutex_unlock(&fdobj->d.p->mutex);
@@ -523,6 +556,14 @@ static ssize_t pty_read(void * h, void * buf, size_t bytes) {
 
     /* Wake anyone waiting for write space */
     cond_broadcast(&ph->ready_write);
+    mutex_unlock(&ph->mutex);
+
+    /* ... and anyone polling on the other end for it. */
+    mutex_lock(&ph->other->mutex);
+    pty_notify(ph->other, POLLWRNORM);
+    mutex_unlock(&ph->other->mutex);
+
+    return bytes;
 
 done:
     mutex_unlock(&ph->mutex);
@@ -590,6 +631,7 @@ static ssize_t pty_write(void * h, const void * buf, size_t bytes) {
 
     /* Wake anyone waiting on read */
     cond_broadcast(&ph->ready_read);
+    pty_notify(ph, POLLRDNORM);
 
 done:
     mutex_unlock(&ph->mutex);
@@ -612,6 +654,40 @@ static size_t pty_total(void * h) {
     return ph->cnt;
 }
 
+/* Check for pending events on a pty endpoint */
+static short pty_poll(void * h, short events) {
+    pipefd_t *fdobj = (pipefd_t *)h;
+    ptyhalf_t *ph = fdobj->d.p;
+    short rv = 0;
+
+    if(fdobj->type != PF_PTY)
+        return POLLNVAL;
+
+    /* The unattached console can always be written to, but there's no way to
+       tell if there's anything to read without actually reading it. */
+    if(ph->id == 0 && !ph->master && ph->other->refcnt == 0)
+        return events & POLLWRNORM;
+
+    mutex_lock(&ph->mutex);
+
+    if(ph->cnt)
+        rv |= POLLRDNORM;
+
+    if(ph->other->refcnt <= 0)
+        rv |= POLLHUP;
+
+    mutex_unlock(&ph->mutex);
+
+    mutex_lock(&ph->other->mutex);
+
+    if(ph->other->cnt < PTY_BUFFER_SIZE)
+        rv |= POLLWRNORM;
+
+    mutex_unlock(&ph->other->mutex);
+
+    return rv & (events | POLLHUP);
+}
+
 /* Read a directory entry */
 static dirent_t * pty_readdir(void * h) {
     pipefd_t * fdobj = (pipefd_t *)h;
@@ -748,7 +824,7 @@ static vfs_handler_t vh = {
     NULL,
     NULL,
     pty_fcntl,
-    NULL,
+    pty_poll,
     NULL,
     NULL,
     NULL,
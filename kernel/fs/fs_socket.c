@@ -192,7 +192,7 @@ int fs_socket_shutdown(void) {
 }
 
 int fs_socket_input(netif_t *src, int domain, int protocol, const void *hdr,
-                    const uint8 *data, size_t size) {
+                    const uint8 *data, size_t size, net_pbuf_t *pbuf) {
     fs_socket_proto_t *i;
     int rv = -2;
 
@@ -211,7 +211,7 @@ int fs_socket_input(netif_t *src, int domain, int protocol, const void *hdr,
 
     TAILQ_FOREACH(i, &protocols, entry) {
         if(i->protocol == protocol) {
-            rv = i->input(src, domain, hdr, data, size);
+            rv = i->input(src, domain, hdr, data, size, pbuf);
             break;
         }
     }
@@ -508,6 +508,140 @@ ssize_t recvfrom(int sock, void *buffer, size_t length, int flags,
                                    address_len);
 }
 
+/* Receive one message with recvfrom(), for protocols that can't do it
+   themselves. This is really only sensible for stream sockets, so it keeps on
+   filling buffers for as long as there is data there to fill them with. */
+static ssize_t sock_recvmsg_emul(net_socket_t *hnd, struct msghdr *msg,
+                                 int flags) {
+    socklen_t *alen = msg->msg_name ? &msg->msg_namelen : NULL;
+    ssize_t rv, total = 0;
+    int i;
+
+    msg->msg_controllen = 0;
+    msg->msg_flags = 0;
+
+    for(i = 0; i < msg->msg_iovlen; ++i) {
+        if(!msg->msg_iov[i].iov_len)
+            continue;
+
+        rv = hnd->protocol->recvfrom(hnd, msg->msg_iov[i].iov_base,
+                                     msg->msg_iov[i].iov_len, flags,
+                                     total ? NULL : msg->msg_name,
+                                     total ? NULL : alen);
+
+        if(rv < 0)
+            return total ? total : -1;
+
+        total += rv;
+
+        if((size_t)rv < msg->msg_iov[i].iov_len || (flags & MSG_PEEK))
+            break;
+
+        /* Don't wait around for anything to fill the rest in. */
+        flags |= MSG_DONTWAIT;
+    }
+
+    return total;
+}
+
+/* Send one message with sendto(), for protocols that can't do it
+   themselves. */
+static ssize_t sock_sendmsg_emul(net_socket_t *hnd, const struct msghdr *msg,
+                                 int flags) {
+    ssize_t rv, total = 0;
+    int i;
+
+    for(i = 0; i < msg->msg_iovlen; ++i) {
+        if(!msg->msg_iov[i].iov_len)
+            continue;
+
+        rv = hnd->protocol->sendto(hnd, msg->msg_iov[i].iov_base,
+                                   msg->msg_iov[i].iov_len, flags,
+                                   (const struct sockaddr *)msg->msg_name,
+                                   msg->msg_namelen);
+
+        if(rv < 0)
+            return total ? total : -1;
+
+        total += rv;
+
+        if((size_t)rv < msg->msg_iov[i].iov_len)
+            break;
+    }
+
+    return total;
+}
+
+ssize_t recvmsg(int sock, struct msghdr *message, int flags) {
+    net_socket_t *hnd;
+    struct mmsghdr mm;
+
+    hnd = (net_socket_t *)fs_get_handle(sock);
+
+    if(hnd == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+
+    /* Make sure this is actually a socket. */
+    if(fs_get_handler(sock) != &vh) {
+        errno = ENOTSOCK;
+        return -1;
+    }
+
+    if(!hnd->protocol->recvmmsg)
+        return sock_recvmsg_emul(hnd, message, flags);
+
+    mm.msg_hdr = *message;
+    mm.msg_len = 0;
+
+    if(hnd->protocol->recvmmsg(hnd, &mm, 1, flags, NULL) < 0)
+        return -1;
+
+    *message = mm.msg_hdr;
+    return mm.msg_len;
+}
+
+int recvmmsg(int sock, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+             struct timespec *timeout) {
+    net_socket_t *hnd;
+    unsigned int i;
+    ssize_t rv;
+
+    hnd = (net_socket_t *)fs_get_handle(sock);
+
+    if(hnd == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+
+    /* Make sure this is actually a socket. */
+    if(fs_get_handler(sock) != &vh) {
+        errno = ENOTSOCK;
+        return -1;
+    }
+
+    if(hnd->protocol->recvmmsg)
+        return hnd->protocol->recvmmsg(hnd, msgvec, vlen, flags, timeout);
+
+    /* Only the first message gets waited on here, regardless of the flags or
+       the timeout. */
+    for(i = 0; i < vlen; ++i) {
+        if((rv = sock_recvmsg_emul(hnd, &msgvec[i].msg_hdr, flags)) < 0)
+            return i ? (int)i : -1;
+
+        msgvec[i].msg_len = rv;
+
+        /* The peer hung up, so there won't be anything more. */
+        if(!rv)
+            return i + 1;
+
+        flags |= MSG_DONTWAIT;
+    }
+
+    return vlen;
+}
+
 ssize_t send(int sock, const void *message, size_t length, int flags) {
     net_socket_t *hnd;
 
@@ -548,6 +682,66 @@ ssize_t sendto(int sock, const void *message, size_t length, int flags,
                                  dest_len);
 }
 
+ssize_t sendmsg(int sock, const struct msghdr *message, int flags) {
+    net_socket_t *hnd;
+    struct mmsghdr mm;
+
+    hnd = (net_socket_t *)fs_get_handle(sock);
+
+    if(hnd == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+
+    /* Make sure this is actually a socket. */
+    if(fs_get_handler(sock) != &vh) {
+        errno = ENOTSOCK;
+        return -1;
+    }
+
+    if(!hnd->protocol->sendmmsg)
+        return sock_sendmsg_emul(hnd, message, flags);
+
+    mm.msg_hdr = *message;
+    mm.msg_len = 0;
+
+    if(hnd->protocol->sendmmsg(hnd, &mm, 1, flags) < 0)
+        return -1;
+
+    return mm.msg_len;
+}
+
+int sendmmsg(int sock, struct mmsghdr *msgvec, unsigned int vlen, int flags) {
+    net_socket_t *hnd;
+    unsigned int i;
+    ssize_t rv;
+
+    hnd = (net_socket_t *)fs_get_handle(sock);
+
+    if(hnd == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+
+    /* Make sure this is actually a socket. */
+    if(fs_get_handler(sock) != &vh) {
+        errno = ENOTSOCK;
+        return -1;
+    }
+
+    if(hnd->protocol->sendmmsg)
+        return hnd->protocol->sendmmsg(hnd, msgvec, vlen, flags);
+
+    for(i = 0; i < vlen; ++i) {
+        if((rv = sock_sendmsg_emul(hnd, &msgvec[i].msg_hdr, flags)) < 0)
+            return i ? (int)i : -1;
+
+        msgvec[i].msg_len = rv;
+    }
+
+    return vlen;
+}
+
 int shutdown(int sock, int how) {
     net_socket_t *hnd;
 
@@ -0,0 +1,572 @@
+/* KallistiOS ##version##
+
+   epoll.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* This file implements a Linux-style epoll interface on top of the watch table
+   used by poll(). Each file in an instance's interest list gets a watch hung
+   off of its VFS handle, and when an event is delivered to that watch the file
+   gets put on the instance's ready list (if it isn't already there). Waiting
+   for events then only has to look at the files on the ready list.
+
+   Each instance has a mutex that protects its interest list, and is held while
+   collecting events so that items can't disappear out from under us. The ready
+   list is protected by __poll_mutex, since that is what is held when events
+   are delivered. The handlers' poll methods are never called with
+   __poll_mutex held, since the sockets (and ptys) deliver events while holding
+   their own locks.
+
+   When a file descriptor is closed, fs_close() lets us know through the
+   watch's closed callback. The item can't be taken off of the interest list
+   there (that would need the instance's mutex, which nests outside of
+   __poll_mutex), so its watch is dropped and it gets marked as dead and put on
+   the ready list. Dead items are freed the next time someone holding the
+   instance's mutex runs across them. */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/queue.h>
+
+#include <arch/irq.h>
+#include <arch/timer.h>
+#include <kos/fs.h>
+#include <kos/mutex.h>
+#include <kos/cond.h>
+
+#include "poll_watch.h"
+
+/* Number of buckets in each instance's interest list. This needs to be a power
+   of two. */
+#define EP_BUCKETS      64
+
+/* Poll events that are always reported. */
+#define EP_ALWAYS       (POLLERR | POLLHUP)
+
+struct epoll_inst;
+
+struct epitem {
+    poll_watch_t watch;
+    LIST_ENTRY(epitem) ilist;
+    TAILQ_ENTRY(epitem) rlist;
+    struct epoll_inst *ep;
+    int fd;
+    uint32_t events;
+    epoll_data_t data;
+
+    /* These are protected by __poll_mutex. */
+    int ready;                  /* On the ready list (or being collected) */
+    int disabled;               /* Fired with EPOLLONESHOT */
+    int dead;                   /* The fd has been closed */
+    short revents;              /* Events delivered since last collected */
+};
+
+TAILQ_HEAD(epready, epitem);
+
+struct epoll_inst {
+    mutex_t mutex;
+    LIST_HEAD(epitems, epitem) items[EP_BUCKETS];
+    struct epready ready;
+    condvar_t cv;
+};
+
+static int ep_close(void *hnd);
+static short ep_poll(void *hnd, short events);
+
+/* VFS handler. This is never registered with the name manager, it's only here
+   so that epoll instances can have file descriptors. */
+static vfs_handler_t ep_vh = {
+    /* Name handler */
+    {
+        "/epoll",       /* Name */
+        0,              /* tbfi */
+        0x00010000,     /* Version 1.0 */
+        0,              /* Flags */
+        NMMGR_TYPE_VFS,
+        NMMGR_LIST_INIT,
+    },
+
+    0, NULL,        /* No cache, privdata */
+
+    NULL,            /* open */
+    ep_close,        /* close */
+    NULL,            /* read */
+    NULL,            /* write */
+    NULL,            /* seek */
+    NULL,            /* tell */
+    NULL,            /* total */
+    NULL,            /* readdir */
+    NULL,            /* ioctl */
+    NULL,            /* rename */
+    NULL,            /* unlink */
+    NULL,            /* mmap */
+    NULL,            /* complete */
+    NULL,            /* stat */
+    NULL,            /* mkdir */
+    NULL,            /* rmdir */
+    NULL,            /* fcntl */
+    ep_poll,         /* poll */
+    NULL,            /* link */
+    NULL,            /* symlink */
+    NULL,            /* seek64 */
+    NULL,            /* tell64 */
+    NULL,            /* total64 */
+    NULL,            /* readlink */
+    NULL,            /* rewinddir */
+    NULL             /* fstat */
+};
+
+static struct epoll_inst *ep_get(int epfd) {
+    if(epfd < 0 || epfd >= FD_SETSIZE || !fs_get_handle(epfd)) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    if(fs_get_handler(epfd) != &ep_vh) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return (struct epoll_inst *)fs_get_handle(epfd);
+}
+
+/* Free an item that's been taken off of the interest list. The instance's
+   mutex and __poll_mutex must be held, and the item can't be in the middle of
+   being collected. */
+static void ep_free(struct epitem *i) {
+    if(!i->dead)
+        __poll_watch_del(&i->watch);
+
+    if(i->ready)
+        TAILQ_REMOVE(&i->ep->ready, i, rlist);
+
+    free(i);
+}
+
+/* Clean out any dead items in the bucket for fd. The instance's mutex and
+   __poll_mutex must be held. */
+static void ep_reap(struct epoll_inst *ep, int fd) {
+    struct epitem *i, *tmp;
+
+    i = LIST_FIRST(&ep->items[fd & (EP_BUCKETS - 1)]);
+
+    while(i) {
+        tmp = LIST_NEXT(i, ilist);
+
+        if(i->dead) {
+            LIST_REMOVE(i, ilist);
+            ep_free(i);
+        }
+
+        i = tmp;
+    }
+}
+
+static struct epitem *ep_find(struct epoll_inst *ep, int fd) {
+    struct epitem *i;
+
+    LIST_FOREACH(i, &ep->items[fd & (EP_BUCKETS - 1)], ilist) {
+        if(i->fd == fd)
+            return i;
+    }
+
+    return NULL;
+}
+
+/* Put an item on the ready list. __poll_mutex must be held. */
+static void ep_queue(struct epitem *i) {
+    struct epoll_inst *ep = i->ep;
+    int wasempty = TAILQ_EMPTY(&ep->ready);
+
+    i->ready = 1;
+    TAILQ_INSERT_TAIL(&ep->ready, i, rlist);
+    cond_broadcast(&ep->cv);
+
+    /* Let anyone polling on the instance itself know. Loops between instances
+       are cut off by the ready flag, so this can't recurse forever. */
+    if(wasempty)
+        __poll_event_deliver(ep, POLLRDNORM);
+}
+
+/* Called by poll.c when an event is delivered on a watched file. */
+static void ep_cb(poll_watch_t *w, short event) {
+    struct epitem *i = (struct epitem *)w->data;
+
+    if(i->disabled)
+        return;
+
+    i->revents |= event;
+
+    if(!i->ready)
+        ep_queue(i);
+}
+
+/* Called by poll.c when a file descriptor referring to a watched file is
+   closed. */
+static void ep_closed(poll_watch_t *w, int fd) {
+    struct epitem *i = (struct epitem *)w->data;
+
+    if(i->fd != fd || i->dead)
+        return;
+
+    __poll_watch_del(w);
+    i->dead = 1;
+
+    /* Make sure it gets cleaned up even if nobody touches this fd again. */
+    if(!i->ready)
+        ep_queue(i);
+}
+
+static short ep_check(struct epitem *i) {
+    vfs_handler_t *hndl;
+    short mask = (short)(i->events & 0xffff) | EP_ALWAYS;
+    int old = errno;
+
+    /* Make sure the fd hasn't been closed (or reused) behind our back. */
+    if(fs_get_handle(i->fd) != i->watch.hnd) {
+        errno = old;
+        return 0;
+    }
+
+    if(!(hndl = fs_get_handler(i->fd)) || !hndl->poll)
+        return (POLLRDNORM | POLLWRNORM) & mask;
+
+    return hndl->poll(i->watch.hnd, mask) & mask;
+}
+
+/* Collect up to max events from the ready list. */
+static int ep_collect(struct epoll_inst *ep, struct epoll_event *events,
+                      int max) {
+    struct epready tx, requeue;
+    struct epitem *i;
+    short ev;
+    int n = 0;
+
+    TAILQ_INIT(&tx);
+    TAILQ_INIT(&requeue);
+
+    mutex_lock(&ep->mutex);
+    mutex_lock(&__poll_mutex);
+
+    /* Pull everything off of the ready list. The items stay marked as ready
+       while we work on them, so any events delivered in the meantime will just
+       be recorded in revents. */
+    while((i = TAILQ_FIRST(&ep->ready))) {
+        TAILQ_REMOVE(&ep->ready, i, rlist);
+        TAILQ_INSERT_TAIL(&tx, i, rlist);
+        i->revents = 0;
+    }
+
+    mutex_unlock(&__poll_mutex);
+
+    while(n < max && (i = TAILQ_FIRST(&tx))) {
+        TAILQ_REMOVE(&tx, i, rlist);
+        ev = ep_check(i);
+
+        mutex_lock(&__poll_mutex);
+
+        if(i->dead) {
+            /* The fd was closed, so whatever we found belongs to something
+               else now. */
+            i->ready = 0;
+            LIST_REMOVE(i, ilist);
+            free(i);
+        }
+        else if(ev) {
+            events[n].events = (uint32_t)(uint16_t)ev;
+            events[n++].data = i->data;
+
+            if(i->events & EPOLLONESHOT) {
+                i->disabled = 1;
+                i->ready = 0;
+            }
+            else if(!(i->events & EPOLLET) || i->revents) {
+                /* Level-triggered items stay on the ready list until a check
+                   comes up empty. */
+                TAILQ_INSERT_TAIL(&requeue, i, rlist);
+            }
+            else {
+                i->ready = 0;
+            }
+        }
+        else if(i->revents) {
+            /* Something came in while we were looking, look again later. */
+            TAILQ_INSERT_TAIL(&requeue, i, rlist);
+        }
+        else {
+            i->ready = 0;
+        }
+
+        mutex_unlock(&__poll_mutex);
+    }
+
+    mutex_lock(&__poll_mutex);
+
+    /* Anything we didn't get to goes back at the front of the list, and the
+       stuff we reported goes to the back so everyone gets a turn. */
+    while((i = TAILQ_LAST(&tx, epready))) {
+        TAILQ_REMOVE(&tx, i, rlist);
+        TAILQ_INSERT_HEAD(&ep->ready, i, rlist);
+    }
+
+    while((i = TAILQ_FIRST(&requeue))) {
+        TAILQ_REMOVE(&requeue, i, rlist);
+        TAILQ_INSERT_TAIL(&ep->ready, i, rlist);
+    }
+
+    mutex_unlock(&__poll_mutex);
+    mutex_unlock(&ep->mutex);
+
+    return n;
+}
+
+static int ep_close(void *hnd) {
+    struct epoll_inst *ep = (struct epoll_inst *)hnd;
+    struct epitem *i;
+    int j;
+
+    mutex_lock(&ep->mutex);
+
+    for(j = 0; j < EP_BUCKETS; ++j) {
+        while((i = LIST_FIRST(&ep->items[j]))) {
+            LIST_REMOVE(i, ilist);
+
+            mutex_lock(&__poll_mutex);
+            ep_free(i);
+            mutex_unlock(&__poll_mutex);
+        }
+    }
+
+    mutex_unlock(&ep->mutex);
+
+    cond_destroy(&ep->cv);
+    mutex_destroy(&ep->mutex);
+    free(ep);
+
+    return 0;
+}
+
+static short ep_poll(void *hnd, short events) {
+    struct epoll_inst *ep = (struct epoll_inst *)hnd;
+    short rv = 0;
+
+    if(__poll_lock())
+        return 0;
+
+    if(!TAILQ_EMPTY(&ep->ready))
+        rv = POLLRDNORM & events;
+
+    mutex_unlock(&__poll_mutex);
+
+    return rv;
+}
+
+int epoll_create1(int flags) {
+    struct epoll_inst *ep;
+    int j, fd;
+
+    if(flags & ~EPOLL_CLOEXEC) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!(ep = (struct epoll_inst *)malloc(sizeof(struct epoll_inst)))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    mutex_init(&ep->mutex, MUTEX_TYPE_NORMAL);
+    cond_init(&ep->cv);
+    TAILQ_INIT(&ep->ready);
+
+    for(j = 0; j < EP_BUCKETS; ++j) {
+        LIST_INIT(&ep->items[j]);
+    }
+
+    if((fd = fs_open_handle(&ep_vh, ep)) < 0) {
+        cond_destroy(&ep->cv);
+        mutex_destroy(&ep->mutex);
+        free(ep);
+        return -1;
+    }
+
+    return fd;
+}
+
+int epoll_create(int size) {
+    if(size <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return epoll_create1(0);
+}
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+    struct epoll_inst *ep;
+    struct epitem *i, *n = NULL;
+    void *hnd;
+
+    if(!(ep = ep_get(epfd)))
+        return -1;
+
+    if(fd < 0 || fd >= FD_SETSIZE || !(hnd = fs_get_handle(fd))) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if(fd == epfd || (op != EPOLL_CTL_DEL && !event)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Allocate this up front, so we're not doing it with the locks held. */
+    if(op == EPOLL_CTL_ADD &&
+       !(n = (struct epitem *)calloc(1, sizeof(struct epitem)))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    mutex_lock(&ep->mutex);
+    mutex_lock(&__poll_mutex);
+
+    /* If the fd got closed after we looked it up, we either already heard
+       about it or never will, so don't hang a watch off of it. */
+    if(fs_get_handle(fd) != hnd) {
+        errno = EBADF;
+        goto err;
+    }
+
+    /* Get rid of anything left over from an earlier fd with this number. An
+       item that doesn't match the handle was closed somewhere we couldn't be
+       told about it (like in an interrupt). */
+    ep_reap(ep, fd);
+
+    if((i = ep_find(ep, fd)) && i->watch.hnd != hnd) {
+        LIST_REMOVE(i, ilist);
+        ep_free(i);
+        i = NULL;
+    }
+
+    switch(op) {
+        case EPOLL_CTL_ADD:
+            if(i) {
+                errno = EEXIST;
+                goto err;
+            }
+
+            i = n;
+            n = NULL;
+            i->watch.hnd = hnd;
+            i->watch.events = (short)(event->events & 0xffff);
+            i->watch.cb = ep_cb;
+            i->watch.closed = ep_closed;
+            i->watch.data = i;
+            i->ep = ep;
+            i->fd = fd;
+            i->events = event->events;
+            i->data = event->data;
+            LIST_INSERT_HEAD(&ep->items[fd & (EP_BUCKETS - 1)], i, ilist);
+
+            /* Start it out on the ready list, so that we find out if it's
+               already ready on the next wait. */
+            __poll_watch_add(&i->watch);
+            ep_queue(i);
+            break;
+
+        case EPOLL_CTL_MOD:
+            if(!i) {
+                errno = ENOENT;
+                goto err;
+            }
+
+            i->watch.events = (short)(event->events & 0xffff);
+            i->events = event->events;
+            i->data = event->data;
+            i->disabled = 0;
+
+            if(!i->ready)
+                ep_queue(i);
+
+            break;
+
+        case EPOLL_CTL_DEL:
+            if(!i) {
+                errno = ENOENT;
+                goto err;
+            }
+
+            LIST_REMOVE(i, ilist);
+            ep_free(i);
+            break;
+
+        default:
+            errno = EINVAL;
+            goto err;
+    }
+
+    mutex_unlock(&__poll_mutex);
+    mutex_unlock(&ep->mutex);
+    return 0;
+
+err:
+    mutex_unlock(&__poll_mutex);
+    mutex_unlock(&ep->mutex);
+    free(n);
+    return -1;
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+               int timeout) {
+    struct epoll_inst *ep;
+    uint64 deadline = 0, now;
+    int n, old;
+
+    if(!(ep = ep_get(epfd)))
+        return -1;
+
+    if(!events || maxevents <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(irq_inside_int()) {
+        errno = EPERM;
+        return -1;
+    }
+
+    if(timeout > 0)
+        deadline = timer_ms_gettime64() + timeout;
+
+    for(;;) {
+        if((n = ep_collect(ep, events, maxevents)) || !timeout)
+            return n;
+
+        mutex_lock(&__poll_mutex);
+
+        if(TAILQ_EMPTY(&ep->ready)) {
+            if(timeout < 0) {
+                cond_wait(&ep->cv, &__poll_mutex);
+            }
+            else {
+                now = timer_ms_gettime64();
+
+                if(now >= deadline) {
+                    mutex_unlock(&__poll_mutex);
+                    return 0;
+                }
+
+                old = errno;
+
+                if(cond_wait_timed(&ep->cv, &__poll_mutex,
+                                   (int)(deadline - now)))
+                    errno = old;
+            }
+        }
+
+        mutex_unlock(&__poll_mutex);
+    }
+}
@@ -18,10 +18,16 @@
    The implementations of getaddrinfo() and freeaddrinfo() are new to this
    version of the code though.
 
-   Eventually, I'd like to add some sort of cacheing of results to this file so
-   that if you look something up more than once, it doesn't have to go back out
-   to the server to do so. But, for now, there is no local database of cached
-   addresses...
+   Answers from the DNS server are kept in a small cache, for as long as their
+   TTLs say they're good for. Names that don't exist (or don't have any
+   addresses of the type asked for) are cached too, for as long as the server
+   says is ok for negative answers (RFC 2308). When both IPv4 and IPv6
+   addresses are wanted, the A and AAAA queries are sent out together, rather
+   than waiting for one to finish before starting the other.
+
+   There's also a simple asynchronous interface, getaddrinfo_async(), which
+   does the lookup in its own thread and either calls back when it is done or
+   lets the caller check in on it later.
 */
 
 #include <stdio.h>
@@ -35,8 +41,21 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 
+#include <ctype.h>
+#include <sys/queue.h>
+
 #include <kos/net.h>
 #include <kos/dbglog.h>
+#include <kos/mutex.h>
+#include <kos/cond.h>
+#include <kos/thread.h>
+#include <arch/timer.h>
+
+#ifdef __STRICT_ANSI__
+/* Newlib doesn't prototype this function in strict standards compliant mode, so
+   we'll do it here. */
+char *strdup(const char *);
+#endif
 
 /* How many attempts to make at contacting the DNS server before giving up. */
 #define DNS_ATTEMPTS    4
@@ -44,6 +63,24 @@
 /* How long to wait between attempts. */
 #define DNS_TIMEOUT     500
 
+/* Port the DNS server listens on. */
+#define DNS_PORT        53
+
+/* Longest name we'll look up (RFC 1035, section 2.3.4). */
+#define DNS_NAME_MAX    253
+
+/* Maximum number of addresses kept from one answer. */
+#define DNS_MAX_ADDRS   8
+
+/* Maximum number of answers kept in the cache. */
+#define DNS_CACHE_SIZE  32
+
+/* Limits on how long answers are cached, in seconds. Negative answers are kept
+   for DNS_NEG_TTL if the server doesn't tell us how long to keep them. */
+#define DNS_MAX_TTL     86400
+#define DNS_NEG_TTL     60
+#define DNS_MAX_NEG_TTL 900
+
 /*
    This performs a simple DNS A-record query. It hasn't been tested extensively
    but so far it seems to work fine.
@@ -73,8 +110,51 @@ typedef struct dnsmsg {
 static uint16_t qnum = 0;
 
 #define QTYPE_A         1
+#define QTYPE_CNAME     5
+#define QTYPE_SOA       6
 #define QTYPE_AAAA      28
 
+/* The result of one query, as kept in the cache. */
+struct dns_answer {
+    int err;                        /* 0 or an EAI_* error */
+    int qtype;
+    int naddrs;
+    uint32_t ttl;
+    union {
+        struct in_addr v4;
+        struct in6_addr v6;
+    } addrs[DNS_MAX_ADDRS];
+};
+
+struct dns_cache_ent {
+    TAILQ_ENTRY(dns_cache_ent) lru;
+    char name[DNS_NAME_MAX + 1];
+    uint64 expire;
+    struct dns_answer ans;
+};
+
+TAILQ_HEAD(dns_cache_list, dns_cache_ent);
+
+static struct dns_cache_list dns_cache = TAILQ_HEAD_INITIALIZER(dns_cache);
+static int dns_cache_cnt = 0;
+static mutex_t dns_cache_lock = MUTEX_INITIALIZER;
+
+/* An asynchronous lookup. */
+struct gai_async {
+    mutex_t lock;
+    condvar_t cv;
+    char *node;
+    char *serv;
+    struct addrinfo hints;
+    int have_hints;
+    gai_async_cb_t cb;
+    void *data;
+    int status;
+    int err;
+    int abandoned;
+    struct addrinfo *res;
+};
+
 /* Flags:
    Query/Response (1 bit) -- 0 = Query, 1 = Response
    Opcode (4 bits) -- 0 = Standard, 1 = Inverse, 2 = Status
@@ -114,71 +194,43 @@ static uint16_t qnum = 0;
      AAAA   28
  */
 
-// Construct a DNS query for an A record by host name. "buf" should
-// be at least 1500 bytes, to make sure there's room.
-static size_t dns_make_query(const char *host, dnsmsg_t *buf, int ip4,
-                             int ip6) {
-    int i, o = 0, ls, t;
+// Construct a DNS query for one record type by host name. "buf" should
+// be at least 512 bytes, to make sure there's room. The name must already
+// have been checked to make sure it isn't too long.
+static size_t dns_make_query(const char *host, dnsmsg_t *buf, int qtype) {
+    int i, o, ls, t;
 
     // Build up the header.
     buf->id = htons(qnum++);
     buf->flags = htons(0x0100);
-    buf->qdcount = htons(ip4 + ip6);
+    buf->qdcount = htons(1);
     buf->ancount = htons(0);
     buf->nscount = htons(0);
     buf->arcount = htons(0);
 
-    /* Fill in the question section(s). */
+    /* Fill in the question section. */
     ls = 0;
-
-    if(ip4) {
-        o = ls + 1;
-        t = strlen(host);
-
-        for(i = 0; i <= t; i++) {
-            if(host[i] == '.' || i == t) {
-                buf->data[ls] = (o - ls) - 1;
-                ls = o;
-                o++;
-            }
-            else {
-                buf->data[o++] = host[i];
-            }
+    o = ls + 1;
+    t = strlen(host);
+
+    for(i = 0; i <= t; i++) {
+        if(host[i] == '.' || i == t) {
+            buf->data[ls] = (o - ls) - 1;
+            ls = o;
+            o++;
         }
-
-        buf->data[ls] = 0;
-
-        // Might be unaligned now... so just build it by hand.
-        buf->data[o++] = (uint8_t)(QTYPE_A >> 8);
-        buf->data[o++] = (uint8_t)QTYPE_A;
-        buf->data[o++] = 0x00;
-        buf->data[o++] = 0x01;
-        ls = o;
-    }
-
-    if(ip6) {
-        o = ls + 1;
-        t = strlen(host);
-
-        for(i = 0; i <= t; i++) {
-            if(host[i] == '.' || i == t) {
-                buf->data[ls] = (o - ls) - 1;
-                ls = o;
-                o++;
-            }
-            else {
-                buf->data[o++] = host[i];
-            }
+        else {
+            buf->data[o++] = host[i];
         }
+    }
 
-        buf->data[ls] = 0;
+    buf->data[ls] = 0;
 
-        // Might be unaligned now... so just build it by hand.
-        buf->data[o++] = (uint8_t)(QTYPE_AAAA >> 8);
-        buf->data[o++] = (uint8_t)QTYPE_AAAA;
-        buf->data[o++] = 0x00;
-        buf->data[o++] = 0x01;
-    }
+    // Might be unaligned now... so just build it by hand.
+    buf->data[o++] = (uint8_t)(qtype >> 8);
+    buf->data[o++] = (uint8_t)qtype;
+    buf->data[o++] = 0x00;
+    buf->data[o++] = 0x01;
 
     // Return the full message size.
     return (size_t)(o + sizeof(dnsmsg_t));
@@ -213,213 +265,264 @@ static size_t dns_make_query(const char *host, dnsmsg_t *buf, int ip4,
 
 // Scans through and skips a label in the data payload, starting
 // at the given offset. The new offset (after the label) will be
-// returned.
-static int dns_skip_label(dnsmsg_t *resp, int o) {
+// returned, or -1 if the label runs off the end of the message.
+static int dns_skip_label(const dnsmsg_t *resp, int size, int o) {
     int cnt;
 
     // End of the label?
-    while(resp->data[o] != 0) {
+    while(o < size && resp->data[o] != 0) {
         // Is it a pointer?
         if((resp->data[o] & 0xc0) == 0xc0)
-            return o + 2;
+            return o + 2 <= size ? o + 2 : -1;
 
         // Skip this part.
         cnt = resp->data[o++];
         o += cnt;
     }
 
+    if(o >= size)
+        return -1;
+
     // Skip the terminator
     o++;
 
     return o;
 }
 
-// Scans through and copies out a label in the data payload,
-// starting at the given offset. The new offset (after the label)
-// will be returned as well as the label string.
-static int dns_copy_label(dnsmsg_t *resp, int o, char *outbuf) {
-    int cnt;
-    int rv = -1;
-
-    // Do each part.
-    outbuf[0] = 0;
-
-    for(;;) {
-        // Is it a pointer?
-        if((resp->data[o] & 0xc0) == 0xc0) {
-            int offs = ((resp->data[o] & ~0xc0) << 8) | resp->data[o + 1];
-
-            if(rv < 0)
-                rv = o + 2;
-
-            o = offs - sizeof(dnsmsg_t);
-        }
-        else {
-            cnt = resp->data[o++];
-
-            if(cnt) {
-                if(outbuf[0] != 0)
-                    strcat(outbuf, ".");
-
-                strncat(outbuf, (char *)(resp->data + o), cnt);
-                o += cnt;
-            }
-            else {
-                break;
-            }
-        }
-    }
-
-    if(rv < 0)
-        return o;
-    else
-        return rv;
+static inline uint16_t dns_get16(const uint8_t *p) {
+    return (p[0] << 8) | p[1];
 }
 
-/* Forward declaration... */
-static struct addrinfo *add_ipv4_ai(uint32_t ip, uint16_t port,
-                                    struct addrinfo *h, struct addrinfo *tail);
-static struct addrinfo *add_ipv6_ai(const struct in6_addr *ip, uint16_t port,
-                                    struct addrinfo *h, struct addrinfo *tail);
+static inline uint32_t dns_get32(const uint8_t *p) {
+    return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
 
-// Parse a response packet from the DNS server. The IP address
-// will be filled in upon a successful return, otherwise the
-// return value will be <0.
-static int dns_parse_response(dnsmsg_t *resp, struct addrinfo *hints,
-                              uint16_t port, struct addrinfo **res) {
-    int i, o, arecs;
-    uint16_t flags;
-    char tmp[64];
-    uint16_t ancnt, len;
-    struct addrinfo *ptr = NULL;
+// Parse a response packet from the DNS server for a query of the given type.
+// The answer is filled in with the addresses found, or an error code, along
+// with how long the answer is good for. Returns <0 if the message isn't a
+// response at all.
+static int dns_parse_response(const dnsmsg_t *resp, int size, int qtype,
+                              struct dns_answer *ans) {
+    int i, o, type, cnt;
+    uint16_t flags, len;
+    uint32_t ttl, negttl = DNS_NEG_TTL;
+
+    memset(ans, 0, sizeof(struct dns_answer));
+    ans->qtype = qtype;
+    ans->ttl = DNS_MAX_TTL;
+    size -= sizeof(dnsmsg_t);
 
     /* Check the flags first to see if it was successful. */
     flags = ntohs(resp->flags);
 
     if(!(flags & 0x8000)) {
         /* Not our response! */
-        return EAI_AGAIN;
+        return -1;
     }
 
     /* Did the server report an error? */
     switch(flags & 0x000f) {
         case 0:   /* No error */
+        case 3:   /* Name error */
             break;
 
         case 1:   /* Format error */
         case 4:   /* Not implemented */
         case 5:   /* Refused */
         default:
-            return EAI_FAIL;
-
-        case 3:   /* Name error */
-            return EAI_NONAME;
+            ans->err = EAI_FAIL;
+            return 0;
 
         case 2:   /* Server failure */
-            return EAI_AGAIN;
+            ans->err = EAI_AGAIN;
+            return 0;
     }
 
-    /* Getting zero answers is also a failure. */
-    ancnt = ntohs(resp->ancount);
-
-    if(ancnt < 1)
-        return EAI_NONAME;
-
     /* If we have any query sections (should have at least one), skip 'em. */
     o = 0;
     len = ntohs(resp->qdcount);
 
-    for(i = 0; i < len; i++) {
+    for(i = 0; i < len && o >= 0; i++) {
         /* Skip the label. */
-        o = dns_skip_label(resp, o);
-
-        /* And the two type fields. */
-        o += 4;
+        if((o = dns_skip_label(resp, size, o)) >= 0)
+            /* And the two type fields. */
+            o += 4;
     }
 
-    /* Ok, now the answer section (what we're interested in). */
-    arecs = 0;
+    /* Ok, now the answer section (what we're interested in), then the
+       authority section, which might tell us how long we can remember that a
+       name doesn't exist. Anything that isn't the type we asked for (like a
+       CNAME record on the way to the answer) just gets skipped. */
+    cnt = ntohs(resp->ancount) + ntohs(resp->nscount);
 
-    for(i = 0; i < ancnt; i++) {
-        /* Copy out the label, in case we need it. */
-        o = dns_copy_label(resp, o, tmp);
+    for(i = 0; i < cnt && o >= 0; i++) {
+        if((o = dns_skip_label(resp, size, o)) < 0 || o + 10 > size)
+            break;
 
-        /* Get the type code. If it's not A or AAAA, skip it. */
-        if(resp->data[o] == 0 && resp->data[o + 1] == 1 &&
-           (hints->ai_family == AF_INET || hints->ai_family == AF_UNSPEC)) {
-            uint32_t addr;
+        type = dns_get16(&resp->data[o]);
+        ttl = dns_get32(&resp->data[o + 4]);
+        len = dns_get16(&resp->data[o + 8]);
+        o += 10;
 
-            o += 8;
-            len = (resp->data[o] << 8) | resp->data[o + 1];
-            o += 2;
+        if(o + len > size)
+            break;
 
-            /* Grab the address from the response. */
-            addr = htonl((resp->data[o] << 24) | (resp->data[o + 1] << 16) |
-                         (resp->data[o + 2] << 8) | resp->data[o + 3]);
+        if(i < ntohs(resp->ancount)) {
+            if(type == qtype && ans->naddrs < DNS_MAX_ADDRS &&
+               ((type == QTYPE_A && len == 4) ||
+                (type == QTYPE_AAAA && len == 16))) {
+                memcpy(&ans->addrs[ans->naddrs++], &resp->data[o], len);
+            }
 
-            /* Add this address to the chain. */
-            if(!(ptr = add_ipv4_ai(addr, port, hints, ptr)))
-                /* If something goes wrong in here, it's in calling malloc, so
-                   it is definitely a system error. */
-                return EAI_SYSTEM;
+            if(ttl < ans->ttl)
+                ans->ttl = ttl;
+        }
+        else if(type == QTYPE_SOA) {
+            int so = dns_skip_label(resp, size, o);
 
-            if(!*res)
-                *res = ptr;
+            /* The SOA MINIMUM field comes after two names and four other
+               32-bit fields (RFC 2308, section 5). */
+            if(so >= 0)
+                so = dns_skip_label(resp, size, so);
+
+            if(so >= 0 && so + 20 <= o + len) {
+                negttl = dns_get32(&resp->data[so + 16]);
 
-            o += len;
-            arecs++;
+                if(ttl < negttl)
+                    negttl = ttl;
+            }
         }
-        else if(resp->data[o] == 0 && resp->data[o + 1] == 28 &&
-                (hints->ai_family == AF_INET6 || hints->ai_family == AF_UNSPEC)) {
-            struct in6_addr addr;
 
-            o += 8;
-            len = (resp->data[o] << 8) | resp->data[o + 1];
-            o += 2;
+        o += len;
+    }
 
-            /* Grab the address from the response. */
-            memcpy(addr.s6_addr, &resp->data[o], 16);
+    /* Did we find something? If not, the answer is good for as long as the
+       server said negative answers were. */
+    if(!ans->naddrs) {
+        ans->err = EAI_NONAME;
+        ans->ttl = negttl < DNS_MAX_NEG_TTL ? negttl : DNS_MAX_NEG_TTL;
+    }
 
-            /* Add this address to the chain. */
-            if(!(ptr = add_ipv6_ai(&addr, port, hints, ptr)))
-                /* If something goes wrong in here, it's in calling malloc, so
-                   it is definitely a system error. */
-                return EAI_SYSTEM;
+    return 0;
+}
 
-            if(!*res)
-                *res = ptr;
+/* Lower case a name, so that it can be compared against the cache. */
+static void dns_name_lower(const char *name, char *out) {
+    int i;
 
-            o += len;
-            arecs++;
-        }
-        else if(resp->data[o] == 0 && resp->data[o + 1] == 5) {
-            char tmp2[64];
+    for(i = 0; name[i] && i < DNS_NAME_MAX; ++i) {
+        out[i] = tolower((unsigned char)name[i]);
+    }
+
+    /* Ignore a trailing dot on a fully qualified name. */
+    if(i && out[i - 1] == '.')
+        --i;
+
+    out[i] = 0;
+}
+
+static void dns_cache_remove(struct dns_cache_ent *e) {
+    TAILQ_REMOVE(&dns_cache, e, lru);
+    --dns_cache_cnt;
+    free(e);
+}
+
+/* Look for an answer in the cache. Returns 0 and fills in the answer if there
+   is one that is still good. */
+static int dns_cache_lookup(const char *name, int qtype,
+                            struct dns_answer *ans) {
+    struct dns_cache_ent *e;
+    uint64 now = timer_ms_gettime64();
+    int rv = -1;
+
+    mutex_lock(&dns_cache_lock);
+
+    TAILQ_FOREACH(e, &dns_cache, lru) {
+        if(e->ans.qtype == qtype && !strcmp(e->name, name)) {
+            if(e->expire <= now) {
+                dns_cache_remove(e);
+                break;
+            }
+
+            /* Move it up to the front, so it'll be the last to go. */
+            TAILQ_REMOVE(&dns_cache, e, lru);
+            TAILQ_INSERT_HEAD(&dns_cache, e, lru);
 
-            o += 8;
-            len = (resp->data[o] << 8) | resp->data[o + 1];
-            o += 2;
-            o = dns_copy_label(resp, o, tmp2);
+            memcpy(ans, &e->ans, sizeof(struct dns_answer));
+            rv = 0;
+            break;
         }
-        else {
-            o += 8;
-            len = (resp->data[o] << 8) | resp->data[o + 1];
-            o += 2 + len;
+    }
+
+    mutex_unlock(&dns_cache_lock);
+
+    return rv;
+}
+
+/* Remember an answer from the server, if it is one that's worth keeping. */
+static void dns_cache_insert(const char *name, const struct dns_answer *ans) {
+    struct dns_cache_ent *e;
+    uint32_t ttl = ans->ttl;
+
+    /* Don't cache transient errors, or anything the server says not to. */
+    if((ans->err && ans->err != EAI_NONAME) || !ttl)
+        return;
+
+    if(ttl > DNS_MAX_TTL)
+        ttl = DNS_MAX_TTL;
+
+    mutex_lock(&dns_cache_lock);
+
+    /* Replace any old answer for the same question. */
+    TAILQ_FOREACH(e, &dns_cache, lru) {
+        if(e->ans.qtype == ans->qtype && !strcmp(e->name, name)) {
+            dns_cache_remove(e);
+            break;
         }
     }
 
-    /* Did we find something? */
-    return arecs > 0 ? 0 : EAI_NONAME;
+    /* Make room by throwing out whatever was used least recently, if need
+       be. */
+    if(dns_cache_cnt >= DNS_CACHE_SIZE)
+        dns_cache_remove(TAILQ_LAST(&dns_cache, dns_cache_list));
+
+    if((e = (struct dns_cache_ent *)malloc(sizeof(struct dns_cache_ent)))) {
+        strcpy(e->name, name);
+        e->expire = timer_ms_gettime64() + ttl * 1000ULL;
+        memcpy(&e->ans, ans, sizeof(struct dns_answer));
+        TAILQ_INSERT_HEAD(&dns_cache, e, lru);
+        ++dns_cache_cnt;
+    }
+
+    mutex_unlock(&dns_cache_lock);
 }
 
-static int getaddrinfo_dns(const char *name, struct addrinfo *hints,
-                           uint16_t port, struct addrinfo **res) {
+void gai_cache_flush(void) {
+    mutex_lock(&dns_cache_lock);
+
+    while(!TAILQ_EMPTY(&dns_cache)) {
+        dns_cache_remove(TAILQ_FIRST(&dns_cache));
+    }
+
+    mutex_unlock(&dns_cache_lock);
+}
+
+/* Ask the DNS server the given questions, all at once. Each question gets its
+   own query message (since some resolvers can't handle more than one question
+   in a message), but they are all sent out before waiting on any answers.
+   Anything that never gets an answer is marked as timed out. */
+static int dns_query(const char *name, const int *qtypes, int cnt,
+                     struct dns_answer *ans) {
     struct sockaddr_in toaddr;
-    uint8_t qb[512];
-    size_t size;
-    int sock, rv, tries;
+    uint8_t qb[2][512];
+    uint8_t rb[512];
+    size_t size[2];
+    uint16_t ids[2];
+    int sock, tries, i, pending = 0, timeout;
     in_addr_t raddr;
-    ssize_t rsize = 0;
+    ssize_t rsize;
     struct pollfd pfd;
+    uint64 end, now;
 
     /* Make sure we have a network device to communicate on. */
     if(!net_default_dev) {
@@ -433,21 +536,14 @@ static int getaddrinfo_dns(const char *name, struct addrinfo *hints,
         return EAI_FAIL;
     }
 
-    /* Setup a query */
-    if(hints->ai_family == AF_UNSPEC)
-        /* Note: This should (in theory) work, but it seems that some resolvers
-           cannot handle multiple questions in one query. So... while the code
-           here supports multiple questions in one query, this branch will never
-           actually be taken -- getaddrinfo() will always make two separate
-           calls if we need to do both IPv4 and IPv6. */
-        size = dns_make_query(name, (dnsmsg_t *)qb, 1, 1);
-    else if(hints->ai_family == AF_INET)
-        size = dns_make_query(name, (dnsmsg_t *)qb, 1, 0);
-    else if(hints->ai_family == AF_INET6)
-        size = dns_make_query(name, (dnsmsg_t *)qb, 0, 1);
-    else {
-        errno = EAFNOSUPPORT;
-        return EAI_SYSTEM;
+    /* Setup the queries */
+    for(i = 0; i < cnt; ++i) {
+        size[i] = dns_make_query(name, (dnsmsg_t *)qb[i], qtypes[i]);
+        ids[i] = ((dnsmsg_t *)qb[i])->id;
+        memset(&ans[i], 0, sizeof(struct dns_answer));
+        ans[i].qtype = qtypes[i];
+        ans[i].err = EAI_SYSTEM;
+        pending |= 1 << i;
     }
 
     /* Make a socket to talk to the DNS server. */
@@ -460,7 +556,7 @@ static int getaddrinfo_dns(const char *name, struct addrinfo *hints,
 
     memset(&toaddr, 0, sizeof(toaddr));
     toaddr.sin_family = AF_INET;
-    toaddr.sin_port = htons(53);
+    toaddr.sin_port = htons(DNS_PORT);
     toaddr.sin_addr.s_addr = htonl(raddr);
 
     if(connect(sock, (struct sockaddr *)&toaddr, sizeof(toaddr))) {
@@ -473,20 +569,42 @@ static int getaddrinfo_dns(const char *name, struct addrinfo *hints,
     pfd.events = POLLIN;
     pfd.revents = 0;
 
-    for(tries = 0; tries < DNS_ATTEMPTS; ++tries) {
-        /* Send the query to the server. */
-        if(send(sock, qb, size, 0) < 0) {
-            return EAI_SYSTEM;
+    for(tries = 0; tries < DNS_ATTEMPTS && pending; ++tries) {
+        /* Send the queries that haven't been answered yet to the server. */
+        for(i = 0; i < cnt; ++i) {
+            if((pending & (1 << i)) && send(sock, qb[i], size[i], 0) < 0) {
+                close(sock);
+                return EAI_SYSTEM;
+            }
         }
 
-        /* Wait for the timeout to expire or for us to get the response. */
-        if(poll(&pfd, 1, DNS_TIMEOUT) == 1) {
+        /* Wait for the timeout to expire or for us to get the responses. */
+        end = timer_ms_gettime64() + DNS_TIMEOUT;
+
+        while(pending && (now = timer_ms_gettime64()) < end) {
+            timeout = (int)(end - now);
+
+            if(poll(&pfd, 1, timeout) != 1)
+                break;
+
             /* Get the response. */
-            if((rsize = recv(sock, qb, 512, 0)) < 0) {
+            if((rsize = recv(sock, rb, 512, 0)) < 0) {
+                close(sock);
                 return EAI_SYSTEM;
             }
 
-            break;
+            if(rsize < (ssize_t)sizeof(dnsmsg_t))
+                continue;
+
+            /* Figure out which question it is the answer to, if any. */
+            for(i = 0; i < cnt; ++i) {
+                if((pending & (1 << i)) && ((dnsmsg_t *)rb)->id == ids[i] &&
+                   !dns_parse_response((dnsmsg_t *)rb, rsize, qtypes[i],
+                                       &ans[i])) {
+                    pending &= ~(1 << i);
+                    break;
+                }
+            }
         }
     }
 
@@ -497,22 +615,92 @@ static int getaddrinfo_dns(const char *name, struct addrinfo *hints,
        the server on the other end. I'm not entirely sure what to return in that
        case, to be perfectly honest. I suppose that EAI_SYSTEM + ETIMEDOUT would
        make the most sense, since that's really what happened... */
-    if(!rsize) {
+    if(pending)
         errno = ETIMEDOUT;
+
+    return 0;
+}
+
+/* Forward declaration... */
+static struct addrinfo *add_ipv4_ai(uint32_t ip, uint16_t port,
+                                    struct addrinfo *h, struct addrinfo *tail);
+static struct addrinfo *add_ipv6_ai(const struct in6_addr *ip, uint16_t port,
+                                    struct addrinfo *h, struct addrinfo *tail);
+
+/* Look up a name for the address family in the hints, from the cache if we
+   can and from the DNS server if we can't, and build up the list of results
+   from the answers. */
+static int getaddrinfo_dns(const char *nodename, struct addrinfo *hints,
+                           uint16_t port, struct addrinfo **res) {
+    char name[DNS_NAME_MAX + 1];
+    struct dns_answer ans[2], qans[2];
+    int qtypes[2], which[2];
+    int i, j, cnt = 0, qcnt = 0, rv;
+    struct addrinfo *ptr = NULL;
+
+    /* Make sure the name will actually fit in a query. */
+    if(strlen(nodename) > DNS_NAME_MAX)
+        return EAI_NONAME;
+
+    dns_name_lower(nodename, name);
+
+    /* Figure out what we need to ask about, and see if we already know the
+       answer to any of it. */
+    if(hints->ai_family == AF_INET || hints->ai_family == AF_UNSPEC)
+        ans[cnt++].qtype = QTYPE_A;
+
+    if(hints->ai_family == AF_INET6 || hints->ai_family == AF_UNSPEC)
+        ans[cnt++].qtype = QTYPE_AAAA;
+
+    if(!cnt) {
+        errno = EAFNOSUPPORT;
         return EAI_SYSTEM;
     }
 
-    /* Parse the response. */
-    rv = dns_parse_response((dnsmsg_t *)qb, hints, port, res);
+    for(i = 0; i < cnt; ++i) {
+        if(dns_cache_lookup(name, ans[i].qtype, &ans[i])) {
+            which[qcnt] = i;
+            qtypes[qcnt++] = ans[i].qtype;
+        }
+    }
 
-    /* If we got something in the result, but got an error value in the return,
-       free whatever we got. */
-    if(rv != 0 && *res) {
-        freeaddrinfo(*res);
-        *res = NULL;
+    /* Ask the server about anything we didn't already know. */
+    if(qcnt) {
+        if((rv = dns_query(name, qtypes, qcnt, qans)))
+            return rv;
+
+        for(j = 0; j < qcnt; ++j) {
+            ans[which[j]] = qans[j];
+            dns_cache_insert(name, &qans[j]);
+        }
     }
 
-    return rv;
+    /* If the IPv4 lookup failed for any reason other than the name not having
+       any addresses, that's what we report. */
+    if(ans[0].err && ans[0].err != EAI_NONAME)
+        return ans[0].err;
+
+    for(i = 0; i < cnt; ++i) {
+        for(j = 0; j < ans[i].naddrs; ++j) {
+            if(ans[i].qtype == QTYPE_A)
+                ptr = add_ipv4_ai(ans[i].addrs[j].v4.s_addr, port, hints, ptr);
+            else
+                ptr = add_ipv6_ai(&ans[i].addrs[j].v6, port, hints, ptr);
+
+            /* If something goes wrong in here, it's in calling malloc, so
+               it is definitely a system error. */
+            if(!ptr) {
+                freeaddrinfo(*res);
+                *res = NULL;
+                return EAI_SYSTEM;
+            }
+
+            if(!*res)
+                *res = ptr;
+        }
+    }
+
+    return *res ? 0 : EAI_NONAME;
 }
 
 /* New stuff below here... */
@@ -706,46 +894,179 @@ int getaddrinfo(const char *nodename, const char *servname,
         return 0;
     }
 
-    /* If we've gotten this far, do the lookup. */
-    if(ihints.ai_family == AF_UNSPEC) {
-        /* It seems that some resolvers really don't like multi-part questions.
-           So, make sure we only ever send one part at a time... */
-        struct addrinfo *res1 = NULL, *res2 = NULL;
-        int rv;
+    /* If the name is just a numeric address, there's nothing to look up. */
+    if(ihints.ai_family == AF_INET || ihints.ai_family == AF_UNSPEC) {
+        struct in_addr addr;
 
-        ihints.ai_family = AF_INET;
-        rv = getaddrinfo_dns(nodename, &ihints, port, &res1);
-
-        if(rv && rv != EAI_NONAME)
-            return rv;
+        if(inet_pton(AF_INET, nodename, &addr) == 1) {
+            if(!(*res = add_ipv4_ai(addr.s_addr, port, &ihints, NULL)))
+                return EAI_SYSTEM;
 
-        ihints.ai_family = AF_INET6;
-        getaddrinfo_dns(nodename, &ihints, port, &res2);
+            return 0;
+        }
+    }
 
-        /* Figure out what to do with the result(s). */
-        if(res1 && res2) {
-            *res = res1;
+    if(ihints.ai_family == AF_INET6 || ihints.ai_family == AF_UNSPEC) {
+        struct in6_addr addr;
 
-            /* Go to the end of the chain. */
-            while(res1->ai_next) {
-                res1 = res1->ai_next;
-            }
+        if(inet_pton(AF_INET6, nodename, &addr) == 1) {
+            if(!(*res = add_ipv6_ai(&addr, port, &ihints, NULL)))
+                return EAI_SYSTEM;
 
-            res1->ai_next = res2;
-            return 0;
-        }
-        else if(res1) {
-            *res = res1;
             return 0;
         }
-        else if(res2) {
-            *res = res2;
-            return 0;
-        }
-        else {
-            return EAI_NONAME;
-        }
     }
 
+    if(ihints.ai_flags & AI_NUMERICHOST)
+        return EAI_NONAME;
+
+    /* If we've gotten this far, do the lookup. */
     return getaddrinfo_dns(nodename, &ihints, port, res);
 }
+
+static void *gai_async_thd(void *param) {
+    gai_async_t *req = (gai_async_t *)param;
+    struct addrinfo *res = NULL;
+    int rv, abandoned;
+
+    rv = getaddrinfo(req->node, req->serv,
+                     req->have_hints ? &req->hints : NULL, &res);
+
+    /* If there's a callback, the results are all its to deal with. */
+    if(req->cb) {
+        req->cb(req, rv, res, req->data);
+        res = NULL;
+    }
+
+    mutex_lock(&req->lock);
+    req->res = res;
+    req->err = errno;
+    req->status = rv;
+    abandoned = req->abandoned;
+    cond_broadcast(&req->cv);
+    mutex_unlock(&req->lock);
+
+    /* If nobody cares about the result anymore, clean up after ourselves. */
+    if(abandoned) {
+        req->abandoned = 0;
+        gai_async_free(req);
+    }
+
+    return NULL;
+}
+
+gai_async_t *getaddrinfo_async(const char *nodename, const char *servname,
+                               const struct addrinfo *hints,
+                               gai_async_cb_t cb, void *data) {
+    gai_async_t *req;
+
+    if(!nodename && !servname) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if(!(req = (gai_async_t *)calloc(1, sizeof(gai_async_t)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if((nodename && !(req->node = strdup(nodename))) ||
+       (servname && !(req->serv = strdup(servname)))) {
+        free(req->node);
+        free(req);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if(hints) {
+        memcpy(&req->hints, hints, sizeof(struct addrinfo));
+        req->have_hints = 1;
+    }
+
+    req->cb = cb;
+    req->data = data;
+    req->status = EAI_INPROGRESS;
+    mutex_init(&req->lock, MUTEX_TYPE_NORMAL);
+    cond_init(&req->cv);
+
+    if(!thd_create(1, &gai_async_thd, req)) {
+        mutex_destroy(&req->lock);
+        cond_destroy(&req->cv);
+        free(req->node);
+        free(req->serv);
+        free(req);
+        return NULL;
+    }
+
+    return req;
+}
+
+int gai_async_wait(gai_async_t *req, int timeout) {
+    int rv;
+
+    uint64 end, now;
+
+    mutex_lock(&req->lock);
+
+    /* Wait for the lookup to finish, or for the timeout to run out. */
+    if(timeout < 0) {
+        while(req->status == EAI_INPROGRESS)
+            cond_wait(&req->cv, &req->lock);
+    }
+    else if(timeout > 0) {
+        end = timer_ms_gettime64() + timeout;
+
+        while(req->status == EAI_INPROGRESS &&
+              (now = timer_ms_gettime64()) < end) {
+            cond_wait_timed(&req->cv, &req->lock, (int)(end - now));
+        }
+    }
+
+    if((rv = req->status) == EAI_SYSTEM)
+        errno = req->err;
+
+    mutex_unlock(&req->lock);
+
+    return rv;
+}
+
+int gai_async_result(gai_async_t *req, struct addrinfo **res) {
+    int rv;
+
+    mutex_lock(&req->lock);
+
+    if((rv = req->status) != EAI_INPROGRESS) {
+        *res = req->res;
+        req->res = NULL;
+
+        if(rv == EAI_SYSTEM)
+            errno = req->err;
+    }
+    else {
+        *res = NULL;
+    }
+
+    mutex_unlock(&req->lock);
+
+    return rv;
+}
+
+void gai_async_free(gai_async_t *req) {
+    mutex_lock(&req->lock);
+
+    /* If the lookup is still going, let the thread clean up when it's done. */
+    if(req->status == EAI_INPROGRESS) {
+        req->abandoned = 1;
+        mutex_unlock(&req->lock);
+        return;
+    }
+
+    mutex_unlock(&req->lock);
+
+    freeaddrinfo(req->res);
+    mutex_destroy(&req->lock);
+    cond_destroy(&req->cv);
+    free(req->node);
+    free(req->serv);
+    free(req);
+}
@@ -7,6 +7,7 @@
 
 #include <poll.h>
 #include <errno.h>
+#include <stdint.h>
 #include <sys/queue.h>
 
 #include <arch/irq.h>
@@ -14,125 +15,227 @@
 #include <kos/mutex.h>
 #include <kos/cond.h>
 
+#include "poll_watch.h"
+
+/* Number of buckets in the watch table. This needs to be a power of two. */
+#define WATCH_BUCKETS   64
+
 struct poll_int {
-    LIST_ENTRY(poll_int) entry;
     struct pollfd *fds;
-    nfds_t nfds;
+    poll_watch_t *watches;
     int nmatched;
     condvar_t cv;
 };
 
-LIST_HEAD(polllist, poll_int) poll_list;
+LIST_HEAD(watchlist, poll_watch);
 
-static mutex_t mutex = MUTEX_INITIALIZER;
+static struct watchlist watches[WATCH_BUCKETS];
 
-void __poll_event_trigger(int fd, short event) {
-    struct poll_int *i;
-    nfds_t j;
-    int gotone = 0;
+mutex_t __poll_mutex = MUTEX_INITIALIZER;
+
+static inline struct watchlist *watch_bucket(void *hnd) {
+    uint32_t h = (uint32_t)(uintptr_t)hnd >> 4;
+
+    return &watches[(h * 2654435761U) >> 26];
+}
+
+/* Lock the watch table, failing if we're in an interrupt and can't get it. */
+int __poll_lock(void) {
+    if(irq_inside_int())
+        return mutex_trylock(&__poll_mutex);
+
+    mutex_lock(&__poll_mutex);
+    return 0;
+}
+
+void __poll_watch_add(poll_watch_t *w) {
+    LIST_INSERT_HEAD(watch_bucket(w->hnd), w, entry);
+}
+
+void __poll_watch_del(poll_watch_t *w) {
+    LIST_REMOVE(w, entry);
+}
+
+void __poll_event_deliver(void *hnd, short event) {
+    poll_watch_t *w, *tmp;
     short mask;
 
-    if(irq_inside_int()) {
-        if(mutex_trylock(&mutex))
-            /* XXXX: Uhh... this is bad... */
-            return;
+    /* Only the watches on this handle's bucket need to be looked at. A callback
+       is allowed to remove its own watch, so be careful walking the list. */
+    w = LIST_FIRST(watch_bucket(hnd));
+
+    while(w) {
+        tmp = LIST_NEXT(w, entry);
+        mask = w->events | POLLERR | POLLHUP | POLLNVAL;
+
+        if(w->hnd == hnd && (event & mask))
+            w->cb(w, event & mask);
+
+        w = tmp;
     }
-    else {
-        mutex_lock(&mutex);
+}
+
+void __poll_event_trigger_hnd(void *hnd, short event) {
+    if(__poll_lock())
+        /* XXXX: Uhh... this is bad... */
+        return;
+
+    __poll_event_deliver(hnd, event);
+    mutex_unlock(&__poll_mutex);
+}
+
+void __poll_event_trigger(int fd, short event) {
+    void *hnd;
+    int old = errno;
+
+    if(fd < 0 || fd >= FD_SETSIZE)
+        return;
+
+    /* Don't let a stale fd clobber errno for whatever thread we're in. */
+    if(!(hnd = fs_get_handle(fd))) {
+        errno = old;
+        return;
     }
 
-    /* Look through the list of poll fds for any that match */
-    LIST_FOREACH(i, &poll_list, entry) {
-        for(j = 0; j < i->nfds; ++j) {
-            if(i->fds[j].fd == fd) {
-                mask = i->fds[j].events | POLLERR | POLLHUP | POLLNVAL;
-                if(event & mask) {
-                    i->fds[j].revents |= event & mask;
-                    ++i->nmatched;
-                    gotone = 1;
-                }
-            }
-        }
+    __poll_event_trigger_hnd(hnd, event);
+}
 
-        /* If we got any events, signal the waiting thread to wake it up. */
-        if(gotone) {
-            cond_signal(&i->cv);
-            gotone = 0;
-        }
+void __poll_fd_closed(int fd, void *hnd) {
+    poll_watch_t *w, *tmp;
+
+    /* A callback is allowed to remove its own watch here too. If we can't get
+       the lock in an interrupt, the watchers will notice the stale handle the
+       next time they look at it. */
+    if(__poll_lock())
+        return;
+
+    w = LIST_FIRST(watch_bucket(hnd));
+
+    while(w) {
+        tmp = LIST_NEXT(w, entry);
+
+        if(w->hnd == hnd && w->closed)
+            w->closed(w, fd);
+
+        w = tmp;
     }
 
-    mutex_unlock(&mutex);
+    mutex_unlock(&__poll_mutex);
+}
+
+static void poll_cb(poll_watch_t *w, short event) {
+    struct poll_int *p = (struct poll_int *)w->data;
+    struct pollfd *fd = &p->fds[w - p->watches];
+
+    if(!fd->revents)
+        ++p->nmatched;
+
+    fd->revents |= event;
+    cond_signal(&p->cv);
 }
 
 int poll(struct pollfd fds[], nfds_t nfds, int timeout) {
-    struct poll_int p = { { 0 }, fds, nfds, 0, COND_INITIALIZER };
-    int tmp;
+    poll_watch_t w[nfds ? nfds : 1];
+    struct poll_int p = { fds, w, 0, COND_INITIALIZER };
+    int tmp, inint = irq_inside_int();
     nfds_t i;
     vfs_handler_t *hndl;
     void *hnd;
+    short rv;
 
-    if(irq_inside_int()) {
-        if(mutex_trylock(&mutex)) {
-            errno = EAGAIN;
-            return -1;
-        }
-    }
-    else {
-        mutex_lock(&mutex);
+    if(__poll_lock()) {
+        errno = EAGAIN;
+        return -1;
     }
 
-    /* Check if any of the fds already match */
+    /* Hang a watch off of each file first, so that nothing that happens while
+       we're checking the files below can slip past us. We can't wait inside an
+       interrupt, so there's no sense in doing this there. */
     for(i = 0; i < nfds; ++i) {
-        hndl = fs_get_handler(fds[i].fd);
-        hnd = fs_get_handle(fds[i].fd);
         fds[i].revents = 0;
+        w[i].hnd = NULL;
+        w[i].events = fds[i].events;
+        w[i].cb = poll_cb;
+        w[i].closed = NULL;
+        w[i].data = &p;
+
+        if(fds[i].fd >= 0 && fds[i].fd < FD_SETSIZE &&
+           (hnd = fs_get_handle(fds[i].fd)) && !inint) {
+            w[i].hnd = hnd;
+            __poll_watch_add(&w[i]);
+        }
+    }
+
+    /* Check if any of the fds already match. This is done without the watch
+       table locked, since the handlers will take their own locks, and those
+       may well be held by someone trying to deliver an event to us. */
+    if(!inint)
+        mutex_unlock(&__poll_mutex);
+
+    for(i = 0; i < nfds; ++i) {
+        hndl = NULL;
+        hnd = NULL;
+
+        if(fds[i].fd >= 0 && fds[i].fd < FD_SETSIZE) {
+            hndl = fs_get_handler(fds[i].fd);
+            hnd = fs_get_handle(fds[i].fd);
+        }
 
         /* If we didn't get one of these, then assume its a bad fd. */
         if(!hndl || !hnd) {
-            fds[i].revents = POLLNVAL;
-            ++p.nmatched;
-            continue;
+            rv = POLLNVAL;
         }
-
-        if(!hndl->poll) {
+        else if(!hndl->poll) {
             /* Assume its a regular file if there's no poll method in the
                handler. */
-            if(fds[i].events & (POLLRDNORM | POLLWRNORM)) {
-                fds[i].revents |= (POLLRDNORM | POLLWRNORM) & fds[i].events;
-                ++p.nmatched;
-            }
+            rv = (POLLRDNORM | POLLWRNORM) & fds[i].events;
         }
         else {
-            if((fds[i].revents = hndl->poll(hnd, fds[i].events))) {
+            rv = hndl->poll(hnd, fds[i].events);
+        }
+
+        if(!inint)
+            mutex_lock(&__poll_mutex);
+
+        if(rv) {
+            if(!fds[i].revents)
                 ++p.nmatched;
-            }
+
+            fds[i].revents |= rv;
         }
+
+        if(!inint)
+            mutex_unlock(&__poll_mutex);
     }
 
-    /* If the user specified a 0 timeout, or we've already matched something,
-       bail out now. */
-    if(p.nmatched || !timeout) {
-        mutex_unlock(&mutex);
+    if(inint) {
+        mutex_unlock(&__poll_mutex);
+
+        /* We can't actually wait while we're in an interrupt, so if we'd have
+           to, it is an error. */
+        if(!p.nmatched && timeout) {
+            errno = EPERM;
+            return -1;
+        }
+
         return p.nmatched;
     }
 
-    /* We can't actually wait while we're in an interrupt, so if we got this far
-       it is an error. */
-    if(irq_inside_int()) {
-        mutex_unlock(&mutex);
-        errno = EPERM;
-        return -1;
+    mutex_lock(&__poll_mutex);
+
+    /* If the user specified a 0 timeout, or we've already matched something,
+       bail out now. */
+    if(p.nmatched || !timeout) {
+        tmp = p.nmatched;
+        goto out;
     }
 
     /* Map to the value used by cond_wait_timed() */
     if(timeout == -1)
         timeout = 0;
 
-    /* Add this instance to the list */
-    LIST_INSERT_HEAD(&poll_list, &p, entry);
-
     tmp = errno;
-    if(cond_wait_timed(&p.cv, &mutex, timeout)) {
+    if(cond_wait_timed(&p.cv, &__poll_mutex, timeout)) {
         errno = tmp;
         tmp = 0;
         goto out;
@@ -141,9 +244,12 @@ int poll(struct pollfd fds[], nfds_t nfds, int timeout) {
     tmp = p.nmatched;
 
 out:
-    /* Remove this instance from the list */
-    LIST_REMOVE(&p, entry);
+    /* Unhook our watches */
+    for(i = 0; i < nfds; ++i) {
+        if(w[i].hnd)
+            __poll_watch_del(&w[i]);
+    }
 
-    mutex_unlock(&mutex);
+    mutex_unlock(&__poll_mutex);
     return tmp;
 }
@@ -0,0 +1,52 @@
+/* KallistiOS ##version##
+
+   kernel/libc/koslib/poll_watch.h
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+#ifndef __LOCAL_POLL_WATCH_H
+#define __LOCAL_POLL_WATCH_H
+
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+#include <sys/queue.h>
+#include <kos/mutex.h>
+
+/* A watch is hung off of a VFS handle by anything that wants to hear about
+   events on it (poll() or an epoll instance). Watches are kept in a hash
+   table keyed on the handle, so delivering an event only touches the watches
+   for the file in question. All of this is protected by __poll_mutex.
+
+   If closed is set, it gets called when a file descriptor that refers to the
+   handle is closed, so that watches tied to that descriptor can be dropped. */
+typedef struct poll_watch {
+    LIST_ENTRY(poll_watch) entry;
+    void *hnd;
+    short events;
+    void (*cb)(struct poll_watch *w, short event);
+    void (*closed)(struct poll_watch *w, int fd);
+    void *data;
+} poll_watch_t;
+
+extern mutex_t __poll_mutex;
+
+int __poll_lock(void);
+
+void __poll_watch_add(poll_watch_t *w);
+void __poll_watch_del(poll_watch_t *w);
+
+/* Deliver an event to the watches on a handle. __poll_mutex must be held. */
+void __poll_event_deliver(void *hnd, short event);
+
+void __poll_event_trigger(int fd, short event);
+void __poll_event_trigger_hnd(void *hnd, short event);
+
+/* Called by the VFS when fd (which referred to hnd) is closed. */
+void __poll_fd_closed(int fd, void *hnd);
+
+__END_DECLS
+
+#endif /* !__LOCAL_POLL_WATCH_H */
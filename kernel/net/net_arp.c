@@ -11,9 +11,14 @@
 #include <stdio.h>
 #include <kos/net.h>
 #include <kos/thread.h>
+#include <kos/mutex.h>
 #include <arch/timer.h>
+#include <arch/irq.h>
 
 #include "net_ipv4.h"
+#include "net_capture.h"
+#include "net_thd.h"
+#include "net_wheel.h"
 
 /*
 
@@ -36,12 +41,49 @@ typedef struct {
 } packed arp_pkt_t;
 #undef packed
 
-/* Structure describing an ARP entry; each entry contains a MAC address,
-   an IP address, and a timestamp from 'jiffies'. The timestamp allows
-   aging and eventual removal. */
+/* Sizes of things in the ARP cache. The cache holds a fixed number of entries,
+   which are found by hashing the IPv4 address. When the cache fills up, the
+   entry that was used least recently gets thrown out to make room. */
+#define ARP_CACHE_SIZE      64
+#define ARP_HASH_BITS       6
+#define ARP_HASH_SIZE       (1 << ARP_HASH_BITS)
+
+/* Maximum number of packets that will be held for an entry while it is being
+   resolved. If more than this show up, the oldest ones get dropped. */
+#define ARP_QUEUE_LEN       3
+
+/* Timeouts, in milliseconds. Entries are aged on a timer wheel that ticks
+   every ARP_TICK milliseconds. */
+#define ARP_TICK            1000
+#define ARP_RETRANS_TIME    1000    /* Between queries for an address */
+#define ARP_MAX_QUERIES     3       /* Before giving up on an address */
+#define ARP_REACHABLE_TIME  120000  /* How long a reply is good for */
+#define ARP_PROBE_TIME      5000    /* How long to wait to reconfirm */
+
+/* States for an ARP entry. An entry starts off INCOMPLETE when we're looking
+   for an address, or REACHABLE if we learned it from someone else. Once a
+   REACHABLE entry has been around for ARP_REACHABLE_TIME, it is thrown out if
+   nobody has used it, or goes STALE (but is still usable) while we ask for the
+   address again. If nobody answers that, the entry is thrown out. PERMANENT
+   entries never age out and are never evicted. */
+#define ARP_STATE_FREE          0
+#define ARP_STATE_INCOMPLETE    1
+#define ARP_STATE_REACHABLE     2
+#define ARP_STATE_STALE         3
+#define ARP_STATE_PERMANENT     4
+
+/* Structure describing an ARP entry; each entry contains a MAC address, an IP
+   address, its state, and a timer used to age it. */
 typedef struct netarp {
-    /* ARP cache list handle */
-    LIST_ENTRY(netarp)  ac_list;
+    /* Aging timer (must be first) */
+    net_wheel_ent_t     timer;
+
+    /* Hash chain and LRU list handles */
+    LIST_ENTRY(netarp)  ac_hash;
+    TAILQ_ENTRY(netarp) ac_lru;
+
+    /* Device the entry was made on */
+    netif_t             *nif;
 
     /* Mac address */
     uint8               mac[6];
@@ -49,174 +91,317 @@ typedef struct netarp {
     /* Associated IP address */
     uint8               ip[4];
 
-    /* Cache entry time; if zero, this entry won't expire */
-    uint64              timestamp;
+    /* Current state, and number of queries sent while resolving */
+    int                 state;
+    int                 queries;
 
-    /* Optional packet to send when the entry is filled in */
-    ip_hdr_t            *pkt;
+    /* Set when the entry has been used since it was last confirmed */
+    int                 used;
 
-    /* Additional data for that packet, if any */
-    uint8               *data;
-
-    /* Size of the additional data for the packet */
-    int                 data_size;
+    /* Packets to send when the entry is filled in. Each one has a copy of its
+       IP header at the front of the data. */
+    net_pbuf_t          *queue[ARP_QUEUE_LEN];
+    int                 queue_cnt;
 } netarp_t;
 
-/* Define the list type */
+/* Define the list types */
 LIST_HEAD(netarp_list, netarp);
+TAILQ_HEAD(netarp_lru, netarp);
 
 /**************************************************************************/
 /* Variables */
 
-/* ARP cache */
-struct netarp_list net_arp_cache = LIST_HEAD_INITIALIZER(0);
+/* ARP cache, hash table, and least recently used list */
+static netarp_t arp_ents[ARP_CACHE_SIZE];
+static struct netarp_list arp_hash[ARP_HASH_SIZE];
+static struct netarp_lru arp_lru = TAILQ_HEAD_INITIALIZER(arp_lru);
+static int arp_used = 0;
+
+/* Timer wheel used for aging entries */
+static net_wheel_t arp_wheel = NET_WHEEL_INITIALIZER(ARP_TICK);
+static int arp_cbid = -1;
+
+/* This can be called from inside an interrupt, so lock carefully. */
+static mutex_t arp_mutex = MUTEX_INITIALIZER;
 
 /**************************************************************************/
 /* Cache management */
 
-/* Garbage collect timed out entries */
-static int net_arp_gc(netif_t *nif) {
-    netarp_t *a1, *a2;
-    uint64 now = timer_ms_gettime64();
+static int arp_lock(void) {
+    if(irq_inside_int())
+        return mutex_trylock(&arp_mutex);
 
-    a1 = LIST_FIRST(&net_arp_cache);
+    return mutex_lock(&arp_mutex);
+}
 
-    while(a1 != NULL) {
-        a2 = LIST_NEXT(a1, ac_list);
+static inline int arp_hash_ip(const uint8 ip[4]) {
+    uint32 a = (ip[0] << 24) | (ip[1] << 16) | (ip[2] << 8) | ip[3];
 
-        if(a1->timestamp) {
-            if(now >= (a1->timestamp + 120 * 1000)) {
-                LIST_REMOVE(a1, ac_list);
+    return (a * 2654435761U) >> (32 - ARP_HASH_BITS);
+}
+
+static netarp_t *arp_find(const uint8 ip[4]) {
+    netarp_t *cur;
 
-                if(a1->pkt) {
-                    free(a1->pkt);
-                    free(a1->data);
-                }
+    LIST_FOREACH(cur, &arp_hash[arp_hash_ip(ip)], ac_hash) {
+        if(!memcmp(ip, cur->ip, 4))
+            return cur;
+    }
+
+    return NULL;
+}
 
-                free(a1);
-                a1 = a2;
-                continue;
+/* Drop any packets waiting on an entry. */
+static void arp_queue_drop(netarp_t *e) {
+    int i;
+
+    for(i = 0; i < e->queue_cnt; ++i) {
+        net_pbuf_free(e->queue[i]);
+    }
+
+    e->queue_cnt = 0;
+}
+
+static void arp_free(netarp_t *e) {
+    net_wheel_del(&arp_wheel, &e->timer);
+    LIST_REMOVE(e, ac_hash);
+    TAILQ_REMOVE(&arp_lru, e, ac_lru);
+    arp_queue_drop(e);
+    e->state = ARP_STATE_FREE;
+    --arp_used;
+}
+
+/* Grab an unused entry for the given address, throwing out the least recently
+   used entry if the cache is full. */
+static netarp_t *arp_alloc(netif_t *nif, const uint8 ip[4]) {
+    netarp_t *e;
+    int i;
+
+    if(arp_used == ARP_CACHE_SIZE) {
+        TAILQ_FOREACH(e, &arp_lru, ac_lru) {
+            if(e->state != ARP_STATE_PERMANENT)
+                break;
+        }
+
+        if(!e)
+            return NULL;
+
+        arp_free(e);
+    }
+
+    for(i = 0; i < ARP_CACHE_SIZE; ++i) {
+        if(arp_ents[i].state == ARP_STATE_FREE)
+            break;
+    }
+
+    e = &arp_ents[i];
+    memset(e, 0, sizeof(netarp_t));
+    e->nif = nif;
+    memcpy(e->ip, ip, 4);
+
+    LIST_INSERT_HEAD(&arp_hash[arp_hash_ip(ip)], e, ac_hash);
+    TAILQ_INSERT_TAIL(&arp_lru, e, ac_lru);
+    ++arp_used;
+
+    return e;
+}
+
+/* Mark an entry as just used. */
+static inline void arp_touch(netarp_t *e) {
+    TAILQ_REMOVE(&arp_lru, e, ac_lru);
+    TAILQ_INSERT_TAIL(&arp_lru, e, ac_lru);
+    e->used = 1;
+}
+
+/* Age an entry whose timer has gone off. */
+static void arp_timeout(net_wheel_ent_t *t, void *data) {
+    netarp_t *e = (netarp_t *)t;
+    uint64 now = *(uint64 *)data;
+
+    switch(e->state) {
+        case ARP_STATE_INCOMPLETE:
+            /* If nobody has answered us after a few tries, give up and drop
+               anything waiting on the address. */
+            if(e->queries >= ARP_MAX_QUERIES) {
+                arp_free(e);
+                break;
             }
 
-            /* If the entry is incomplete and it's been more than 5 seconds
-               since we queried it, try again. */
-            if(a1->mac[0] == 0 && a1->mac[1] == 0 && a1->mac[2] == 0 &&
-               a1->mac[3] == 0 && a1->mac[4] == 0 && a1->mac[5] == 0 &&
-               now > (a1->timestamp + 5 * 1000)) {
-                net_arp_query(nif, a1->ip);
+            ++e->queries;
+            net_arp_query(e->nif, e->ip);
+            net_wheel_add(&arp_wheel, &e->timer, now + ARP_RETRANS_TIME);
+            break;
+
+        case ARP_STATE_REACHABLE:
+            /* If nobody has used the entry, just get rid of it. Otherwise, keep
+               using it while we make sure it's still right. */
+            if(!e->used) {
+                arp_free(e);
+                break;
             }
-        }
 
-        a1 = a2;
+            e->state = ARP_STATE_STALE;
+            net_arp_query(e->nif, e->ip);
+            net_wheel_add(&arp_wheel, &e->timer, now + ARP_PROBE_TIME);
+            break;
+
+        case ARP_STATE_STALE:
+            arp_free(e);
+            break;
     }
+}
 
-    return 0;
+/* Age the ARP cache (called by the network thread) */
+static void arp_thd_cb(void *data) {
+    uint64 now = timer_ms_gettime64();
+
+    (void)data;
+
+    mutex_lock(&arp_mutex);
+    net_wheel_run(&arp_wheel, now, &arp_timeout, &now);
+    mutex_unlock(&arp_mutex);
 }
 
 /* Add an entry to the ARP cache manually */
 int net_arp_insert(netif_t *nif, const uint8 mac[6], const uint8 ip[4],
                    uint64 timestamp) {
+    net_pbuf_t *queue[ARP_QUEUE_LEN];
     netarp_t *cur;
+    ip_hdr_t hdr;
+    int i, cnt = 0;
 
-    /* First make sure the entry isn't already there */
-    LIST_FOREACH(cur, &net_arp_cache, ac_list) {
-        if(!memcmp(ip, cur->ip, 4)) {
-            memcpy(cur->mac, mac, 6);
-            cur->timestamp = timestamp;
-
-            /* Send our queued packet, if we have one */
-            if(cur->pkt) {
-                net_ipv4_send_packet(nif, cur->pkt, cur->data, cur->data_size);
-                free(cur->pkt);
-                free(cur->data);
-
-                cur->pkt = NULL;
-                cur->data = NULL;
-                cur->data_size = 0;
-            }
+    if(arp_lock() < 0)
+        return 0;
 
+    /* Find the entry if it's already there, otherwise add an entry */
+    if(!(cur = arp_find(ip))) {
+        if(!(cur = arp_alloc(nif, ip))) {
+            mutex_unlock(&arp_mutex);
             return 0;
         }
     }
+    /* Don't let anything learned from the network replace a permanent entry */
+    else if(cur->state == ARP_STATE_PERMANENT && timestamp) {
+        mutex_unlock(&arp_mutex);
+        return 0;
+    }
 
-    /* It's not there, add an entry */
-    cur = (netarp_t *)malloc(sizeof(netarp_t));
     memcpy(cur->mac, mac, 6);
-    memcpy(cur->ip, ip, 4);
-    cur->timestamp = timestamp;
-    cur->pkt = NULL;
-    cur->data = NULL;
-    cur->data_size = 0;
-    LIST_INSERT_HEAD(&net_arp_cache, cur, ac_list);
+    cur->nif = nif;
+    cur->used = 0;
 
-    /* Garbage collect expired entries */
-    net_arp_gc(nif);
+    if(timestamp) {
+        cur->state = ARP_STATE_REACHABLE;
+        net_wheel_add(&arp_wheel, &cur->timer, timestamp + ARP_REACHABLE_TIME);
+    }
+    else {
+        cur->state = ARP_STATE_PERMANENT;
+        net_wheel_del(&arp_wheel, &cur->timer);
+    }
+
+    /* Grab any queued packets to send once we're done with the cache. */
+    if((cnt = cur->queue_cnt)) {
+        memcpy(queue, cur->queue, cnt * sizeof(net_pbuf_t *));
+        cur->queue_cnt = 0;
+    }
+
+    mutex_unlock(&arp_mutex);
+
+    /* Send our queued packets, if we have any */
+    for(i = 0; i < cnt; ++i) {
+        memcpy(&hdr, queue[i]->data, sizeof(ip_hdr_t));
+        net_pbuf_pull(queue[i], sizeof(ip_hdr_t));
+        net_ipv4_send_packet_pbuf(nif, &hdr, queue[i]);
+        net_pbuf_free(queue[i]);
+    }
 
     return 0;
 }
 
+/* Hold onto a copy of a packet to send when the address is resolved. */
+static void arp_enqueue(netarp_t *e, const ip_hdr_t *pkt, const net_pbuf_t *p) {
+    net_pbuf_t *q;
+
+    if(!(q = net_pbuf_alloc(NET_PBUF_HEADROOM, sizeof(ip_hdr_t) + p->tot_len)))
+        return;
+
+    memcpy(q->data, pkt, sizeof(ip_hdr_t));
+    net_pbuf_copy(p, 0, q->data + sizeof(ip_hdr_t), p->tot_len);
+
+    /* If the queue is full, drop the oldest packet to make room */
+    if(e->queue_cnt == ARP_QUEUE_LEN) {
+        net_pbuf_free(e->queue[0]);
+        memmove(e->queue, e->queue + 1,
+                (ARP_QUEUE_LEN - 1) * sizeof(net_pbuf_t *));
+        --e->queue_cnt;
+    }
+
+    e->queue[e->queue_cnt++] = q;
+}
+
 /* Look up an entry from the ARP cache; if no entry is found, then an ARP
-   query will be sent and an error will be returned. Thus your packet send
-   should also fail. Later when the transmit retries, hopefully the answer
-   will have arrived. */
-int net_arp_lookup(netif_t *nif, const uint8 ip_in[4], uint8 mac_out[6],
-                   const ip_hdr_t *pkt, const uint8 *data, int data_size) {
+   query will be sent and an error will be returned. If a packet is given, a
+   copy of it is held onto and sent when the reply comes in. */
+int net_arp_lookup_pbuf(netif_t *nif, const uint8 ip_in[4], uint8 mac_out[6],
+                        const ip_hdr_t *pkt, const net_pbuf_t *p) {
     netarp_t *cur;
+    int rv = -2;
 
-    /* Garbage collect expired entries */
-    net_arp_gc(nif);
+    if(arp_lock() < 0)
+        return -1;
 
     /* Look for the entry */
-    LIST_FOREACH(cur, &net_arp_cache, ac_list) {
-        if(!memcmp(ip_in, cur->ip, 4)) {
-            if(cur->mac[0] == 0 && cur->mac[1] == 0 &&
-               cur->mac[2] == 0 && cur->mac[3] == 0 &&
-               cur->mac[4] == 0 && cur->mac[5] == 0) {
-                return -1;
-            }
-
+    if((cur = arp_find(ip_in))) {
+        if(cur->state != ARP_STATE_INCOMPLETE) {
             memcpy(mac_out, cur->mac, 6);
-
-            if(cur->timestamp != 0)
-                cur->timestamp = timer_ms_gettime64();
-
+            arp_touch(cur);
+            mutex_unlock(&arp_mutex);
             return 0;
         }
-    }
 
-    /* It's not there... Add an incomplete ARP entry */
-    cur = (netarp_t *)malloc(sizeof(netarp_t));
-    memset(cur, 0, sizeof(netarp_t));
-    memcpy(cur->ip, ip_in, 4);
-    cur->timestamp = timer_ms_gettime64();
+        /* We're still waiting on a reply, so queue the packet up with any
+           others waiting on it. */
+        if(!pkt || !p)
+            rv = -1;
+    }
+    /* It's not there... Add an incomplete ARP entry and generate an ARP who-has
+       packet */
+    else if((cur = arp_alloc(nif, ip_in))) {
+        cur->state = ARP_STATE_INCOMPLETE;
+        cur->queries = 1;
+        net_wheel_add(&arp_wheel, &cur->timer,
+                      timer_ms_gettime64() + ARP_RETRANS_TIME);
+        net_arp_query(nif, ip_in);
+    }
+    else {
+        rv = -1;
+    }
 
     /* Copy our packet if we have one to copy. */
-    if(pkt && data && data_size) {
-        cur->data = (uint8 *)malloc(data_size);
+    if(cur && pkt && p)
+        arp_enqueue(cur, pkt, p);
 
-        if(cur->data) {
-            cur->pkt = (ip_hdr_t *)malloc(sizeof(ip_hdr_t));
+    mutex_unlock(&arp_mutex);
 
-            if(!cur->pkt) {
-                free(cur->data);
-                cur->data = NULL;
-            }
-            else {
-                memcpy(cur->pkt, pkt, sizeof(ip_hdr_t));
-                memcpy(cur->data, data, data_size);
-                cur->data_size = data_size;
-            }
-        }
-    }
+    /* Return failure */
+    memset(mac_out, 0, 6);
+    return rv;
+}
 
-    LIST_INSERT_HEAD(&net_arp_cache, cur, ac_list);
+int net_arp_lookup(netif_t *nif, const uint8 ip_in[4], uint8 mac_out[6],
+                   const ip_hdr_t *pkt, const uint8 *data, int data_size) {
+    net_pbuf_t *p = NULL;
+    int rv;
 
-    /* Generate an ARP who-has packet */
-    net_arp_query(nif, ip_in);
+    if(pkt && data && data_size)
+        p = net_pbuf_ref(data, data_size);
 
-    /* Return failure */
-    memset(mac_out, 0, 6);
-    return -2;
+    rv = net_arp_lookup_pbuf(nif, ip_in, mac_out, p ? pkt : NULL, p);
+
+    if(p)
+        net_pbuf_free(p);
+
+    return rv;
 }
 
 /* Do a reverse ARP lookup: look for an IP for a given mac address; note
@@ -226,18 +411,20 @@ int net_arp_revlookup(netif_t *nif, uint8 ip_out[4], const uint8 mac_in[6]) {
 
     (void)nif;
 
+    if(arp_lock() < 0)
+        return -1;
+
     /* Look for the entry */
-    LIST_FOREACH(cur, &net_arp_cache, ac_list) {
-        if(!memcmp(mac_in, cur->mac, 6)) {
+    TAILQ_FOREACH(cur, &arp_lru, ac_lru) {
+        if(cur->state != ARP_STATE_INCOMPLETE && !memcmp(mac_in, cur->mac, 6)) {
             memcpy(ip_out, cur->ip, 4);
-
-            if(cur->timestamp != 0)
-                cur->timestamp = timer_ms_gettime64();
-
+            arp_touch(cur);
+            mutex_unlock(&arp_mutex);
             return 0;
         }
     }
 
+    mutex_unlock(&arp_mutex);
     return -1;
 }
 
@@ -271,7 +458,11 @@ static int net_arp_send(netif_t *nif, arp_pkt_t *pkt)   {
     memcpy(buf + sizeof(eth_hdr_t), &pkt_out, sizeof(arp_pkt_t));
 
     /* Send it away */
-    nif->if_tx(nif, buf, sizeof(eth_hdr_t) + sizeof(arp_pkt_t), NETIF_BLOCK);
+    if(net_capture_on)
+        net_capture_frame(nif, buf, sizeof(eth_hdr_t) + sizeof(arp_pkt_t),
+                          NET_CAPTURE_OUT);
+
+    net_if_tx(nif, buf, sizeof(eth_hdr_t) + sizeof(arp_pkt_t), NETIF_BLOCK);
 
     return 0;
 }
@@ -343,7 +534,11 @@ int net_arp_query(netif_t *nif, const uint8 ip[4]) {
     memcpy(buf + sizeof(eth_hdr_t), &pkt_out, sizeof(arp_pkt_t));
 
     /* Send it away */
-    nif->if_tx(nif, buf, sizeof(eth_hdr_t) + sizeof(arp_pkt_t), NETIF_BLOCK);
+    if(net_capture_on)
+        net_capture_frame(nif, buf, sizeof(eth_hdr_t) + sizeof(arp_pkt_t),
+                          NET_CAPTURE_OUT);
+
+    net_if_tx(nif, buf, sizeof(eth_hdr_t) + sizeof(arp_pkt_t), NETIF_BLOCK);
 
     return 0;
 }
@@ -354,29 +549,33 @@ int net_arp_query(netif_t *nif, const uint8 ip[4]) {
 /* Init */
 int net_arp_init(void) {
     /* Initialize the ARP cache */
-    LIST_INIT(&net_arp_cache);
+    net_arp_shutdown();
+
+    mutex_lock(&arp_mutex);
+    net_wheel_init(&arp_wheel, timer_ms_gettime64());
+    mutex_unlock(&arp_mutex);
+
+    arp_cbid = net_thd_add_callback(&arp_thd_cb, NULL, ARP_TICK);
 
     return 0;
 }
 
 /* Shutdown */
 void net_arp_shutdown(void) {
-    /* Free all ARP entries */
-    netarp_t *a1, *a2;
-
-    a1 = LIST_FIRST(&net_arp_cache);
+    int i;
 
-    while(a1 != NULL) {
-        a2 = LIST_NEXT(a1, ac_list);
+    if(arp_cbid != -1) {
+        net_thd_del_callback(arp_cbid);
+        arp_cbid = -1;
+    }
 
-        if(a1->pkt) {
-            free(a1->pkt);
-            free(a1->data);
-        }
+    /* Free all ARP entries */
+    mutex_lock(&arp_mutex);
 
-        free(a1);
-        a1 = a2;
+    for(i = 0; i < ARP_CACHE_SIZE; ++i) {
+        if(arp_ents[i].state != ARP_STATE_FREE)
+            arp_free(&arp_ents[i]);
     }
 
-    LIST_INIT(&net_arp_cache);
+    mutex_unlock(&arp_mutex);
 }
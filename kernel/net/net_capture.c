@@ -0,0 +1,460 @@
+/* KallistiOS ##version##
+
+   kernel/net/net_capture.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* This file implements packet capture to a libpcap format file. Frames are
+   copied into a ring buffer as they go in and out of the stack, and a thread
+   writes them from there to the file. That way, the capture can be done from
+   anywhere a frame shows up (including inside of interrupts), and the file can
+   be somewhere slow, like /pc, without holding up the network.
+
+   The ring holds the frames already in the format they go into the file in
+   (a record header followed by the frame), so the thread doesn't have to look
+   at them at all, it just writes out whatever is there. Like the loopback
+   queue, the ring is protected by disabling interrupts. */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <kos/net.h>
+#include <kos/fs.h>
+#include <kos/thread.h>
+#include <kos/mutex.h>
+#include <kos/sem.h>
+#include <arch/irq.h>
+#include <arch/rtc.h>
+#include <arch/timer.h>
+
+#include "net_capture.h"
+
+/* Defaults for the things not given in the parameters. */
+#define CAP_SNAPLEN_DEFAULT     65535
+#define CAP_BUFSIZE_DEFAULT     65536
+
+/* The buffer has to be able to hold at least one full ethernet frame. */
+#define CAP_BUFSIZE_MIN         4096
+
+/* How long the thread waits before writing out what it has, if the buffer
+   never fills up enough to wake it. Writing a frame at a time would be awfully
+   slow on something like /pc. */
+#define CAP_FLUSH_MS            100
+
+/* libpcap file format. These are written in the host's byte order, and the
+   magic number tells the reader which that is. */
+#define PCAP_MAGIC              0xA1B2C3D4
+#define PCAP_LINKTYPE_ETHERNET  1
+
+typedef struct pcap_file_hdr {
+    uint32 magic;
+    uint16 version_major;
+    uint16 version_minor;
+    int32 thiszone;
+    uint32 sigfigs;
+    uint32 snaplen;
+    uint32 network;
+} pcap_file_hdr_t;
+
+typedef struct pcap_rec_hdr {
+    uint32 ts_sec;
+    uint32 ts_usec;
+    uint32 incl_len;
+    uint32 orig_len;
+} pcap_rec_hdr_t;
+
+volatile int net_capture_on = 0;
+
+static net_capture_params_t cap_params;
+static net_capture_stats_t cap_stats;
+
+static uint8 *cap_buf;
+static uint32 cap_head, cap_count;
+
+static file_t cap_fd = FILEHND_INVALID;
+static time_t cap_boot;
+
+static semaphore_t cap_sem;
+static kthread_t *cap_thd;
+static volatile int cap_done;
+
+/* Serializes starting and stopping. */
+static mutex_t cap_mutex = MUTEX_INITIALIZER;
+
+static void *cap_thread(void *data) {
+    uint32 head, cnt;
+    ssize_t rv;
+    int old;
+
+    (void)data;
+
+    for(;;) {
+        old = irq_disable();
+        head = cap_head;
+        cnt = cap_count;
+        irq_restore(old);
+
+        if(!cnt) {
+            if(cap_done)
+                break;
+
+            sem_wait_timed(&cap_sem, CAP_FLUSH_MS);
+            continue;
+        }
+
+        /* Only write up to the end of the ring, the rest will get picked up on
+           the next time around. */
+        if(head + cnt > cap_params.bufsize)
+            cnt = cap_params.bufsize - head;
+
+        if((rv = fs_write(cap_fd, cap_buf + head, cnt)) == (ssize_t)cnt)
+            cap_stats.bytes_written += cnt;
+        else
+            ++cap_stats.write_errors;
+
+        /* Even if the write failed, there's nothing better to do with the data
+           than get it out of the way of what's coming in. */
+        old = irq_disable();
+        cap_head = (cap_head + cnt) % cap_params.bufsize;
+        cap_count -= cnt;
+        irq_restore(old);
+
+        /* Wait for more to show up, unless there's a lot there already. */
+        if(!cap_done && cap_count < cap_params.bufsize / 4)
+            sem_wait_timed(&cap_sem, CAP_FLUSH_MS);
+    }
+
+    return NULL;
+}
+
+/* Copy some data into the ring, at the given offset from the head. This must
+   be called with interrupts disabled, and with room in the ring. */
+static uint32 cap_put(uint32 off, const void *data, uint32 len) {
+    uint32 pos = (cap_head + off) % cap_params.bufsize;
+    uint32 cnt = cap_params.bufsize - pos;
+
+    if(cnt >= len) {
+        memcpy(cap_buf + pos, data, len);
+    }
+    else {
+        memcpy(cap_buf + pos, data, cnt);
+        memcpy(cap_buf, (const uint8 *)data + cnt, len - cnt);
+    }
+
+    return off + len;
+}
+
+/* Copy up to len bytes from the front of a frame. */
+static uint32 cap_gather(const struct iovec *iov, int iovcnt, uint8 *dst,
+                         uint32 len) {
+    uint32 cnt, done = 0;
+    int i;
+
+    for(i = 0; i < iovcnt && done < len; ++i) {
+        cnt = iov[i].iov_len;
+
+        if(cnt > len - done)
+            cnt = len - done;
+
+        memcpy(dst + done, iov[i].iov_base, cnt);
+        done += cnt;
+    }
+
+    return done;
+}
+
+/* Figure out if a frame is one we want. The header is the ethernet header (a
+   made up one, if the device doesn't use ethernet) and as much of what comes
+   after it as there was. */
+static int cap_match(const uint8 *hdr, uint32 len) {
+    uint16 type = (uint16)((hdr[12] << 8) | hdr[13]);
+    uint32 proto;
+    int ip_proto = -1;
+
+    switch(type) {
+        case 0x0806:
+            proto = NET_CAPTURE_ARP;
+            break;
+
+        case 0x0800:
+            proto = NET_CAPTURE_IPV4;
+
+            if(len >= 14 + 10)
+                ip_proto = hdr[14 + 9];
+
+            break;
+
+        case 0x86DD:
+            /* This doesn't dig through extension headers, so filtering on
+               the protocol only sees what's in the fixed header. */
+            proto = NET_CAPTURE_IPV6;
+
+            if(len >= 14 + 7)
+                ip_proto = hdr[14 + 6];
+
+            break;
+
+        default:
+            proto = NET_CAPTURE_OTHER;
+            break;
+    }
+
+    if(!(cap_params.protos & proto))
+        return 0;
+
+    if(cap_params.ip_proto && (int)cap_params.ip_proto != ip_proto)
+        return 0;
+
+    return 1;
+}
+
+void net_capture_iov(netif_t *nif, const struct iovec *iov, int iovcnt,
+                     int dir) {
+    uint8 hdr[14 + 40];
+    pcap_rec_hdr_t rec;
+    uint64 now;
+    uint32 len = 0, hlen, caplen, off, cnt;
+    int i, old;
+
+    if(!net_capture_on || !(cap_params.dirs & dir) ||
+       (cap_params.nif && cap_params.nif != nif))
+        return;
+
+    for(i = 0; i < iovcnt; ++i) {
+        len += iov[i].iov_len;
+    }
+
+    /* Put together the start of the frame for the filter. Devices that don't
+       do ethernet get an ethernet header made up for them, so that their
+       frames can go in the same file as everyone else's. */
+    if(nif && (nif->flags & NETIF_NOETH)) {
+        if(!len)
+            return;
+
+        memset(hdr, 0, 14);
+        hlen = 14 + cap_gather(iov, iovcnt, hdr + 14, sizeof(hdr) - 14);
+
+        if((hdr[14] >> 4) == 6) {
+            hdr[12] = 0x86;
+            hdr[13] = 0xDD;
+        }
+        else {
+            hdr[12] = 0x08;
+        }
+
+        len += 14;
+    }
+    else {
+        if(len < 14)
+            return;
+
+        hlen = cap_gather(iov, iovcnt, hdr, sizeof(hdr));
+    }
+
+    if(!cap_match(hdr, hlen))
+        return;
+
+    caplen = len < cap_params.snaplen ? len : cap_params.snaplen;
+    now = timer_us_gettime64();
+
+    rec.ts_sec = (uint32)(cap_boot + now / 1000000);
+    rec.ts_usec = (uint32)(now % 1000000);
+    rec.incl_len = caplen;
+    rec.orig_len = len;
+
+    old = irq_disable();
+
+    /* Make sure we didn't get stopped while getting this far. */
+    if(!net_capture_on) {
+        irq_restore(old);
+        return;
+    }
+
+    if(cap_count + sizeof(rec) + caplen > cap_params.bufsize) {
+        ++cap_stats.pkt_dropped;
+        irq_restore(old);
+        return;
+    }
+
+    off = cap_put(cap_count, &rec, sizeof(rec));
+
+    /* The made up header isn't in the iovec, so it goes in separately. */
+    if(nif && (nif->flags & NETIF_NOETH)) {
+        off = cap_put(off, hdr, caplen < 14 ? caplen : 14);
+        caplen = caplen < 14 ? 0 : caplen - 14;
+    }
+
+    for(i = 0; i < iovcnt && caplen; ++i) {
+        cnt = iov[i].iov_len < caplen ? iov[i].iov_len : caplen;
+        off = cap_put(off, iov[i].iov_base, cnt);
+        caplen -= cnt;
+    }
+
+    /* Give the thread a kick once there's enough to be worth writing. */
+    if(cap_count < cap_params.bufsize / 4 &&
+       off >= cap_params.bufsize / 4)
+        sem_signal(&cap_sem);
+
+    cap_count = off;
+    ++cap_stats.pkt_captured;
+
+    irq_restore(old);
+}
+
+void net_capture_frame(netif_t *nif, const uint8 *data, int len, int dir) {
+    struct iovec iov;
+
+    iov.iov_base = (void *)data;
+    iov.iov_len = len;
+
+    net_capture_iov(nif, &iov, 1, dir);
+}
+
+void net_capture_pbuf(netif_t *nif, const net_pbuf_t *p, int dir) {
+    const net_pbuf_t *q;
+    int cnt = 0;
+
+    for(q = p; q; q = q->next) {
+        ++cnt;
+    }
+
+    {
+        struct iovec iov[cnt];
+
+        for(q = p, cnt = 0; q; q = q->next, ++cnt) {
+            iov[cnt].iov_base = q->data;
+            iov[cnt].iov_len = q->len;
+        }
+
+        net_capture_iov(nif, iov, cnt, dir);
+    }
+}
+
+int net_capture_start(const char *fn, const net_capture_params_t *params) {
+    pcap_file_hdr_t fhdr;
+    net_capture_params_t p;
+
+    if(params)
+        p = *params;
+    else
+        memset(&p, 0, sizeof(p));
+
+    if(!p.dirs)
+        p.dirs = NET_CAPTURE_IN | NET_CAPTURE_OUT;
+
+    if(!p.protos)
+        p.protos = NET_CAPTURE_ARP | NET_CAPTURE_IPV4 | NET_CAPTURE_IPV6 |
+            NET_CAPTURE_OTHER;
+
+    if(!p.snaplen)
+        p.snaplen = CAP_SNAPLEN_DEFAULT;
+
+    if(!p.bufsize)
+        p.bufsize = CAP_BUFSIZE_DEFAULT;
+
+    if(p.bufsize < CAP_BUFSIZE_MIN || p.ip_proto > 255 ||
+       p.snaplen > CAP_SNAPLEN_DEFAULT) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    mutex_lock(&cap_mutex);
+
+    if(cap_thd) {
+        mutex_unlock(&cap_mutex);
+        errno = EBUSY;
+        return -1;
+    }
+
+    if(!(cap_buf = (uint8 *)malloc(p.bufsize))) {
+        mutex_unlock(&cap_mutex);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if((cap_fd = fs_open(fn, O_WRONLY | O_TRUNC | O_CREAT)) == FILEHND_INVALID)
+        goto out_buf;
+
+    fhdr.magic = PCAP_MAGIC;
+    fhdr.version_major = 2;
+    fhdr.version_minor = 4;
+    fhdr.thiszone = 0;
+    fhdr.sigfigs = 0;
+    fhdr.snaplen = p.snaplen;
+    fhdr.network = PCAP_LINKTYPE_ETHERNET;
+
+    if(fs_write(cap_fd, &fhdr, sizeof(fhdr)) != (ssize_t)sizeof(fhdr)) {
+        errno = EIO;
+        goto out_file;
+    }
+
+    cap_params = p;
+    memset(&cap_stats, 0, sizeof(cap_stats));
+    cap_stats.bytes_written = sizeof(fhdr);
+    cap_head = cap_count = 0;
+    cap_boot = rtc_boot_time();
+    cap_done = 0;
+    sem_init(&cap_sem, 0);
+
+    if(!(cap_thd = thd_create(0, cap_thread, NULL))) {
+        sem_destroy(&cap_sem);
+        goto out_file;
+    }
+
+    thd_set_label(cap_thd, "[net capture]");
+
+    net_capture_on = 1;
+    mutex_unlock(&cap_mutex);
+
+    return 0;
+
+out_file:
+    fs_close(cap_fd);
+    cap_fd = FILEHND_INVALID;
+out_buf:
+    free(cap_buf);
+    cap_buf = NULL;
+    mutex_unlock(&cap_mutex);
+    return -1;
+}
+
+void net_capture_stop(void) {
+    int old;
+
+    mutex_lock(&cap_mutex);
+
+    if(!cap_thd) {
+        mutex_unlock(&cap_mutex);
+        return;
+    }
+
+    /* Once this is clear, nothing else goes in the ring. The thread writes
+       out whatever is already there before it exits. */
+    old = irq_disable();
+    net_capture_on = 0;
+    irq_restore(old);
+
+    cap_done = 1;
+    sem_signal(&cap_sem);
+    thd_join(cap_thd, NULL);
+    cap_thd = NULL;
+    sem_destroy(&cap_sem);
+
+    fs_close(cap_fd);
+    cap_fd = FILEHND_INVALID;
+
+    free(cap_buf);
+    cap_buf = NULL;
+
+    mutex_unlock(&cap_mutex);
+}
+
+int net_capture_running(void) {
+    return net_capture_on;
+}
+
+net_capture_stats_t net_capture_get_stats(void) {
+    return cap_stats;
+}
@@ -0,0 +1,30 @@
+/* KallistiOS ##version##
+
+   kernel/net/net_capture.h
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+#ifndef __LOCAL_NET_CAPTURE_H
+#define __LOCAL_NET_CAPTURE_H
+
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+#include <kos/net.h>
+
+/* Is a capture running? Check this before calling any of the functions below,
+   so that there's next to no cost when there isn't one. */
+extern volatile int net_capture_on;
+
+/* Hand a frame to the capture. The direction is NET_CAPTURE_IN or
+   NET_CAPTURE_OUT. These are safe to call from inside an interrupt. */
+void net_capture_frame(netif_t *nif, const uint8 *data, int len, int dir);
+void net_capture_iov(netif_t *nif, const struct iovec *iov, int iovcnt,
+                     int dir);
+void net_capture_pbuf(netif_t *nif, const net_pbuf_t *p, int dir);
+
+__END_DECLS
+
+#endif /* !__LOCAL_NET_CAPTURE_H */
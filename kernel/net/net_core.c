@@ -107,6 +107,62 @@ netif_t *net_set_default(netif_t *n)    {
     return olddev;
 }
 
+/* Count a packet handed to a device, based on what the device made of it. */
+static int net_if_tx_count(netif_t *net, int len, int rv) {
+    switch(rv) {
+        case NETIF_TX_OK:
+            ++net->stats.tx_packets;
+            net->stats.tx_bytes += len;
+            break;
+
+        case NETIF_TX_AGAIN:
+            ++net->stats.tx_dropped;
+            break;
+
+        default:
+            ++net->stats.tx_errors;
+            break;
+    }
+
+    return rv;
+}
+
+/* Transmit a packet */
+int net_if_tx(netif_t *net, const uint8 *data, int len, int blocking) {
+    return net_if_tx_count(net, len, net->if_tx(net, data, len, blocking));
+}
+
+/* Transmit a packet made up of several pieces */
+int net_if_tx_v(netif_t *net, const struct iovec *iov, int iovcnt,
+                int blocking) {
+    size_t len = 0;
+    int i;
+
+    for(i = 0; i < iovcnt; ++i) {
+        len += iov[i].iov_len;
+    }
+
+    if(net->if_tx_v)
+        return net_if_tx_count(net, len,
+                               net->if_tx_v(net, iov, iovcnt, blocking));
+
+    /* The device can't take the pieces itself, so gather them up. */
+    {
+        uint8 pkt[len];
+
+        for(i = 0, len = 0; i < iovcnt; ++i) {
+            memcpy(pkt + len, iov[i].iov_base, iov[i].iov_len);
+            len += iov[i].iov_len;
+        }
+
+        return net_if_tx(net, pkt, len, blocking);
+    }
+}
+
+net_if_stats_t net_if_get_stats(netif_t *net) {
+    return net->stats;
+}
+
 /* Device detect / init */
 int net_dev_init(void) {
     int detected = 0;
@@ -147,10 +203,17 @@ int net_init(uint32 ip) {
     if(net_initted)
         return 0;
 
+    /* Set up the packet buffer pool before any devices can use it */
+    net_pbuf_init();
+
     /* Detect and potentially initialize devices */
     if(net_dev_init() < 0)
         return -1;
 
+    /* Bring up the loopback device. This comes after the other devices, so
+       that it never ends up as the default. */
+    net_loop_init();
+
     /* Initialize the network thread. */
     net_thd_init();
 
@@ -160,7 +223,7 @@ int net_init(uint32 ip) {
     /* Initialize the NDP cache */
     net_ndp_init();
 
-    /* Initialize IPv4 fragmentation support */
+    /* Initialize fragment reassembly (for both IPv4 and IPv6) */
     net_ipv4_frag_init();
 
     /* Initialize multicast support */
@@ -179,6 +242,9 @@ int net_init(uint32 ip) {
     /* Initialize the DHCP system */
     net_dhcp_init();
 
+    /* Set up /net, for looking at the stats */
+    net_stats_init();
+
     if(net_default_dev) {
         /* Did we get a requested IP address? If so, set it. */
         if(ip)
@@ -208,6 +274,12 @@ void net_shutdown(void) {
        down in here. */
     net_thd_kill();
 
+    /* Stop any packet capture that's still going */
+    net_capture_stop();
+
+    /* Take down /net */
+    net_stats_shutdown();
+
     /* Shut down DHCP */
     net_dhcp_shutdown();
 
@@ -224,7 +296,7 @@ void net_shutdown(void) {
     /* Shut down multicast support */
     net_multicast_shutdown();
 
-    /* Shut down IPv4 fragmentation support */
+    /* Shut down fragment reassembly */
     net_ipv4_frag_shutdown();
 
     /* Shut down the NDP cache */
@@ -236,6 +308,9 @@ void net_shutdown(void) {
     /* Shut down the network thread */
     net_thd_shutdown();
 
+    /* Shut down the loopback device */
+    net_loop_shutdown();
+
     /* Shut down all activated network devices */
     LIST_FOREACH(cur, &net_if_list, if_list) {
         if(cur->flags & NETIF_RUNNING && cur->if_stop)
@@ -250,5 +325,8 @@ void net_shutdown(void) {
     /* Blank out the list */
     LIST_INIT(&net_if_list);
 
+    /* Shut down the packet buffer pool */
+    net_pbuf_shutdown();
+
     net_initted = 0;
 }
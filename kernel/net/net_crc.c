@@ -7,56 +7,70 @@
 
 #include <kos/net.h>
 
-/* Calculate a CRC-32 checksum over a given block of data. Somewhat inspired by
-   the CRC32 function in Figure 14-6 of http://www.hackersdelight.org/crc.pdf */
-uint32 net_crc32le(const uint8 *data, int size) {
-    int i;
-    uint32 rv = 0xFFFFFFFF;
-
-    for(i = 0; i < size; ++i) {
-        rv ^= data[i];
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
+#include "net_crc_tab.h"
+
+/* Run the reflected CRC-32 over a block of data, without doing any of the
+   inversions at the start or end. This uses the slicing-by-8 method: each
+   table lookup gives the contribution of one byte of the block to the CRC eight
+   bytes later, so the eight lookups for a group of bytes don't depend on each
+   other, and only the first four have to be mixed with the current CRC. */
+static uint32 crc32_update(uint32 crc, const uint8 *data, int size) {
+    while(size >= 8) {
+        crc = crc32_tab[7][(crc ^ data[0]) & 0xFF] ^
+              crc32_tab[6][((crc >> 8) ^ data[1]) & 0xFF] ^
+              crc32_tab[5][((crc >> 16) ^ data[2]) & 0xFF] ^
+              crc32_tab[4][(crc >> 24) ^ data[3]] ^
+              crc32_tab[3][data[4]] ^ crc32_tab[2][data[5]] ^
+              crc32_tab[1][data[6]] ^ crc32_tab[0][data[7]];
+        data += 8;
+        size -= 8;
+    }
+
+    while(size-- > 0) {
+        crc = crc32_tab[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
     }
 
-    return ~rv;
+    return crc;
 }
 
-/* This one isn't quite as nice as the one above for little-endian... */
-uint32 net_crc32be(const uint8 *data, int size) {
-    int i, j;
-    uint32 rv = 0xFFFFFFFF, b, c;
+/* Reverse the order of the bits in a 32-bit value. */
+static inline uint32 bitrev32(uint32 x) {
+    x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+    x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+    x = ((x >> 4) & 0x0F0F0F0F) | ((x & 0x0F0F0F0F) << 4);
+    x = ((x >> 8) & 0x00FF00FF) | ((x & 0x00FF00FF) << 8);
 
-    for(i = 0; i < size; ++i) {
-        b = data[i];
+    return (x >> 16) | (x << 16);
+}
 
-        for(j = 0; j < 8; ++j) {
-            c = ((rv & 0x80000000) ? 1 : 0) ^(b & 1);
-            b >>= 1;
+/* Calculate a CRC-32 checksum over a given block of data. */
+uint32 net_crc32le(const uint8 *data, int size) {
+    return ~crc32_update(0xFFFFFFFF, data, size);
+}
 
-            if(c)   rv = ((rv << 1) ^ 0x04C11DB6) | c;
-            else    rv <<= 1;
-        }
-    }
+uint32 net_crc32le_update(uint32 crc, const uint8 *data, int size) {
+    return ~crc32_update(~crc, data, size);
+}
 
-    return rv;
+/* The "big-endian" CRC feeds in the bits of each byte least significant bit
+   first, but shifts the CRC itself the other way, and doesn't invert the
+   result at the end. Flip the whole register around, and that's exactly the
+   same as the reflected CRC above, so we can use the same tables. */
+uint32 net_crc32be(const uint8 *data, int size) {
+    return bitrev32(crc32_update(0xFFFFFFFF, data, size));
 }
 
-/* Based on code found at: http://www.ccsinfo.com/forum/viewtopic.php?t=24977 */
+uint32 net_crc32be_update(uint32 crc, const uint8 *data, int size) {
+    return bitrev32(crc32_update(bitrev32(crc), data, size));
+}
+
+/* Table-driven version of the code found at:
+   http://www.ccsinfo.com/forum/viewtopic.php?t=24977 */
 uint16 net_crc16ccitt(const uint8 *data, int size, uint16 start) {
-    uint16 rv = start, tmp;
+    uint16 rv = start;
 
     while(size--) {
-        tmp = (rv >> 8) ^ *data++;
-        tmp ^= tmp >> 4;
-
-        rv = (rv << 8) ^ (tmp << 12) ^ (tmp << 5) ^ tmp;
+        rv = (rv << 8) ^ crc16_tab[(rv >> 8) ^ *data++];
     }
 
     return rv;
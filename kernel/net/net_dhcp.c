@@ -14,9 +14,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <time.h>
 
 #include <kos/net.h>
+#include <kos/fs.h>
 #include <kos/genwait.h>
 #include <kos/mutex.h>
 #include <kos/fs_socket.h>
@@ -51,6 +53,87 @@ static uint64 rebind_time = 0xFFFFFFFFFFFFFFFFULL;
 static uint64 lease_expires = 0xFFFFFFFFFFFFFFFFULL;
 static int state = DHCP_STATE_INIT;
 
+/* Defaults for the retransmission timers and such. */
+#define DHCP_RETRANS_MIN        2000
+#define DHCP_RETRANS_MAX        64000
+#define DHCP_REBOOT_TIMEOUT     4000
+#define DHCP_TIMEOUT            60000
+
+static net_dhcp_params_t params = {
+    DHCP_RETRANS_MIN, DHCP_RETRANS_MAX, DHCP_REBOOT_TIMEOUT, DHCP_TIMEOUT
+};
+
+/* Where the lease is kept between boots, if anywhere. */
+static net_dhcp_store_t *store = NULL;
+static net_dhcp_lease_t lease;
+static int lease_dirty = 0;
+static uint64 reboot_deadline = 0;
+
+/* The store that net_dhcp_set_store_file() sets up. The lease is written out
+   with a little header, so that anything else that happens to be in the file
+   doesn't get mistaken for a lease. */
+#define DHCP_LEASE_MAGIC        0x4C484344  /* "DHCL" */
+#define DHCP_LEASE_VERSION      1
+
+typedef struct dhcp_lease_file {
+    uint32 magic;
+    uint32 version;
+    net_dhcp_lease_t lease;
+} dhcp_lease_file_t;
+
+static int file_store_load(net_dhcp_store_t *self, net_dhcp_lease_t *out) {
+    dhcp_lease_file_t rec;
+    file_t fd;
+    ssize_t rv;
+
+    if((fd = fs_open((const char *)self->data, O_RDONLY)) == FILEHND_INVALID)
+        return -1;
+
+    rv = fs_read(fd, &rec, sizeof(rec));
+    fs_close(fd);
+
+    if(rv != sizeof(rec) || rec.magic != DHCP_LEASE_MAGIC ||
+       rec.version != DHCP_LEASE_VERSION) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memcpy(out, &rec.lease, sizeof(net_dhcp_lease_t));
+    return 0;
+}
+
+static int file_store_save(net_dhcp_store_t *self,
+                           const net_dhcp_lease_t *l) {
+    dhcp_lease_file_t rec;
+    file_t fd;
+    ssize_t rv;
+
+    rec.magic = DHCP_LEASE_MAGIC;
+    rec.version = DHCP_LEASE_VERSION;
+    memcpy(&rec.lease, l, sizeof(net_dhcp_lease_t));
+
+    fd = fs_open((const char *)self->data, O_WRONLY | O_CREAT | O_TRUNC);
+
+    if(fd == FILEHND_INVALID)
+        return -1;
+
+    rv = fs_write(fd, &rec, sizeof(rec));
+    fs_close(fd);
+
+    return rv == sizeof(rec) ? 0 : -1;
+}
+
+static int file_store_clear(net_dhcp_store_t *self) {
+    return fs_unlink((const char *)self->data);
+}
+
+static net_dhcp_store_t file_store = {
+    file_store_load,
+    file_store_save,
+    file_store_clear,
+    NULL
+};
+
 static int net_dhcp_fill_options(netif_t *net, dhcp_pkt_t *req, uint8 msgtype,
                                  uint32 serverid, uint32 reqip) {
     int pos = 0;
@@ -194,35 +277,16 @@ static uint16 net_dhcp_get_16bit(dhcp_pkt_t *pkt, uint8 opt, int len) {
     return 0;
 }
 
-int net_dhcp_request(void) {
-    uint8 pkt[1500];
-    dhcp_pkt_t *req = (dhcp_pkt_t *)pkt;
-    int optlen;
-    struct dhcp_pkt_out *qpkt;
-    int rv = 0;
-
-    if(dhcp_sock == -1) {
-        return -1;
-    }
-
-    if(!irq_inside_int()) {
-        mutex_lock(&dhcp_lock);
-    }
-    else {
-        if(mutex_trylock(&dhcp_lock)) {
-            return -1;
-        }
-    }
-
-    /* Fill in the initial DHCPDISCOVER packet */
+/* Fill in the fixed part of a request. */
+static void net_dhcp_fill_header(dhcp_pkt_t *req, uint32 xid, uint32 ciaddr) {
     req->op = DHCP_OP_BOOTREQUEST;
     req->htype = DHCP_HTYPE_10MB_ETHERNET;
     req->hlen = DHCP_HLEN_ETHERNET;
     req->hops = 0;
-    req->xid = htonl(time(NULL) ^ 0xDEADBEEF);
+    req->xid = xid;
     req->secs = 0;
     req->flags = 0;
-    req->ciaddr = 0;
+    req->ciaddr = ciaddr;
     req->yiaddr = 0;
     req->siaddr = 0;
     req->giaddr = 0;
@@ -231,42 +295,146 @@ int net_dhcp_request(void) {
            DHCP_HLEN_ETHERNET);
     memset(req->sname, 0, sizeof(req->sname));
     memset(req->file, 0, sizeof(req->file));
+}
 
-    /* Fill in options */
-    optlen = net_dhcp_fill_options(net_default_dev, req, DHCP_MSG_DHCPDISCOVER,
-                                   0, 0);
+/* Add a packet to the queue of ones that get sent (and resent) until they're
+   answered. */
+static int net_dhcp_queue(const uint8 *buf, int size, int pkt_type,
+                          int delay) {
+    struct dhcp_pkt_out *qpkt;
 
-    /* Add to our packet queue */
     qpkt = (struct dhcp_pkt_out *)malloc(sizeof(struct dhcp_pkt_out));
 
     if(!qpkt) {
-        mutex_unlock(&dhcp_lock);
         return -1;
     }
 
-    qpkt->buf = (uint8 *)malloc(sizeof(dhcp_pkt_t) + optlen);
+    qpkt->buf = (uint8 *)malloc(size);
 
     if(!qpkt->buf) {
         free(qpkt);
-        mutex_unlock(&dhcp_lock);
         return -1;
     }
 
-    qpkt->size = sizeof(dhcp_pkt_t) + optlen;
-    memcpy(qpkt->buf, pkt, sizeof(dhcp_pkt_t) + optlen);
-    qpkt->pkt_type = DHCP_MSG_DHCPDISCOVER;
+    qpkt->size = size;
+    memcpy(qpkt->buf, buf, size);
+    qpkt->pkt_type = pkt_type;
     qpkt->next_send = 0;
-    qpkt->next_delay = 2000;
+    qpkt->next_delay = delay;
 
     STAILQ_INSERT_TAIL(&dhcp_pkts, qpkt, pkt_queue);
 
+    return 0;
+}
+
+/* Throw away everything that's waiting on an answer. */
+static void net_dhcp_flush(void) {
+    struct dhcp_pkt_out *qpkt;
+
+    while((qpkt = STAILQ_FIRST(&dhcp_pkts))) {
+        STAILQ_REMOVE_HEAD(&dhcp_pkts, pkt_queue);
+        free(qpkt->buf);
+        free(qpkt);
+    }
+}
+
+static int net_dhcp_discover(void) {
+    uint8 pkt[1500];
+    dhcp_pkt_t *req = (dhcp_pkt_t *)pkt;
+    int optlen;
+
+    /* Fill in the initial DHCPDISCOVER packet */
+    net_dhcp_fill_header(req, htonl(time(NULL) ^ 0xDEADBEEF), 0);
+
+    /* Fill in options */
+    optlen = net_dhcp_fill_options(net_default_dev, req, DHCP_MSG_DHCPDISCOVER,
+                                   0, 0);
+
+    /* Add to our packet queue */
+    if(net_dhcp_queue(pkt, sizeof(dhcp_pkt_t) + optlen, DHCP_MSG_DHCPDISCOVER,
+                      params.retrans_min) < 0)
+        return -1;
+
     state = DHCP_STATE_SELECTING;
+    return 0;
+}
+
+/* See if the lease we had last time is still any good, and if so, ask for it
+   again (the INIT-REBOOT state in RFC 2131). The server answers right away
+   with an ACK or a NAK, so this saves a round trip over discovering, and the
+   time the server takes to check that the address it offers is free. */
+static int net_dhcp_reboot(void) {
+    uint8 pkt[1500];
+    dhcp_pkt_t *req = (dhcp_pkt_t *)pkt;
+    int optlen;
+    uint32 ip;
+    time_t now;
+
+    if(!store || store->load(store, &lease) < 0)
+        return -1;
+
+    /* Make sure it's for this device, and that it hasn't run out. */
+    if(memcmp(lease.mac, net_default_dev->mac_addr, 6))
+        return -1;
+
+    now = time(NULL);
+
+    if(lease.lease_time != 0xFFFFFFFF &&
+       (now < lease.obtained || now >= lease.obtained + lease.lease_time))
+        return -1;
+
+    ip = (lease.ip[0] << 24) | (lease.ip[1] << 16) | (lease.ip[2] << 8) |
+         lease.ip[3];
+
+    if(!ip)
+        return -1;
+
+    /* The server identifier is left out, and the address goes in the
+       requested IP address option, not ciaddr. */
+    net_dhcp_fill_header(req, htonl(time(NULL) ^ 0xDEADBEEF), 0);
+    optlen = net_dhcp_fill_options(net_default_dev, req, DHCP_MSG_DHCPREQUEST,
+                                   0, ip);
+
+    if(net_dhcp_queue(pkt, sizeof(dhcp_pkt_t) + optlen, DHCP_MSG_DHCPREQUEST,
+                      params.retrans_min) < 0)
+        return -1;
+
+    state = DHCP_STATE_REBOOTING;
+    reboot_deadline = timer_ms_gettime64() + params.reboot_timeout;
+    return 0;
+}
+
+int net_dhcp_request(void) {
+    int rv = 0;
+
+    if(dhcp_sock == -1) {
+        return -1;
+    }
+
+    if(!irq_inside_int()) {
+        mutex_lock(&dhcp_lock);
+    }
+    else {
+        if(mutex_trylock(&dhcp_lock)) {
+            return -1;
+        }
+    }
+
+    /* Try to get back the lease we had, and if there isn't one, start from
+       scratch. The store can't be touched from an interrupt, though. */
+    if((irq_inside_int() || net_dhcp_reboot() < 0) &&
+       net_dhcp_discover() < 0) {
+        mutex_unlock(&dhcp_lock);
+        return -1;
+    }
+
     mutex_unlock(&dhcp_lock);
 
     /* We need to wait til we're either bound to an IP address, or until we give
-       up all hope of doing so (give us 60 seconds). */
+       up all hope of doing so. */
     if(!net_thd_is_current()) {
-        rv = genwait_wait(&dhcp_sock, "net_dhcp_request", 60 * 1000, NULL);
+        rv = genwait_wait(&dhcp_sock, "net_dhcp_request", params.timeout,
+                          NULL);
     }
 
     return rv;
@@ -277,7 +445,6 @@ static void net_dhcp_send_request(dhcp_pkt_t *pkt, int pktlen, dhcp_pkt_t *pkt2,
     uint8 buf[1500];
     dhcp_pkt_t *req = (dhcp_pkt_t *)buf;
     int optlen;
-    struct dhcp_pkt_out *qpkt;
     uint32 serverid = net_dhcp_get_32bit(pkt, DHCP_OPTION_SERVER_ID, pktlen);
 
     (void)pkt2;
@@ -287,48 +454,16 @@ static void net_dhcp_send_request(dhcp_pkt_t *pkt, int pktlen, dhcp_pkt_t *pkt2,
         return;
 
     /* Fill in the DHCP request */
-    req->op = DHCP_OP_BOOTREQUEST;
-    req->htype = DHCP_HTYPE_10MB_ETHERNET;
-    req->hlen = DHCP_HLEN_ETHERNET;
-    req->hops = 0;
-    req->xid = pkt->xid;
-    req->secs = 0;
-    req->flags = 0;
-    req->ciaddr = 0;
-    req->yiaddr = 0;
-    req->siaddr = 0;
-    req->giaddr = 0;
-    memcpy(req->chaddr, net_default_dev->mac_addr, DHCP_HLEN_ETHERNET);
-    memset(req->chaddr + DHCP_HLEN_ETHERNET, 0, sizeof(req->chaddr) -
-           DHCP_HLEN_ETHERNET);
-    memset(req->sname, 0, sizeof(req->sname));
-    memset(req->file, 0, sizeof(req->file));
+    net_dhcp_fill_header(req, pkt->xid, 0);
 
     /* Fill in options */
     optlen = net_dhcp_fill_options(net_default_dev, req, DHCP_MSG_DHCPREQUEST,
                                    serverid, ntohl(pkt->yiaddr));
 
     /* Add to our packet queue */
-    qpkt = (struct dhcp_pkt_out *)malloc(sizeof(struct dhcp_pkt_out));
-
-    if(!qpkt) {
+    if(net_dhcp_queue(buf, sizeof(dhcp_pkt_t) + optlen, DHCP_MSG_DHCPREQUEST,
+                      params.retrans_min) < 0)
         return;
-    }
-
-    qpkt->buf = (uint8 *)malloc(sizeof(dhcp_pkt_t) + optlen);
-
-    if(!qpkt->buf) {
-        free(qpkt);
-        return;
-    }
-
-    qpkt->size = sizeof(dhcp_pkt_t) + optlen;
-    memcpy(qpkt->buf, buf, sizeof(dhcp_pkt_t) + optlen);
-    qpkt->pkt_type = DHCP_MSG_DHCPREQUEST;
-    qpkt->next_send = 0;
-    qpkt->next_delay = 2000;
-
-    STAILQ_INSERT_TAIL(&dhcp_pkts, qpkt, pkt_queue);
 
     state = DHCP_STATE_REQUESTING;
 }
@@ -337,55 +472,23 @@ static void net_dhcp_renew(void) {
     uint8 buf[1500];
     dhcp_pkt_t *req = (dhcp_pkt_t *)buf;
     int optlen;
-    struct dhcp_pkt_out *qpkt;
 
     /* Fill in the DHCP request */
-    req->op = DHCP_OP_BOOTREQUEST;
-    req->htype = DHCP_HTYPE_10MB_ETHERNET;
-    req->hlen = DHCP_HLEN_ETHERNET;
-    req->hops = 0;
-    req->xid = time(NULL) ^ 0xDEADBEEF;
-    req->secs = 0;
-    req->flags = 0;
-    req->ciaddr = htonl(net_ipv4_address(net_default_dev->ip_addr));
-    req->yiaddr = 0;
-    req->siaddr = 0;
-    req->giaddr = 0;
-    memcpy(req->chaddr, net_default_dev->mac_addr, DHCP_HLEN_ETHERNET);
-    memset(req->chaddr + DHCP_HLEN_ETHERNET, 0, sizeof(req->chaddr) -
-           DHCP_HLEN_ETHERNET);
-    memset(req->sname, 0, sizeof(req->sname));
-    memset(req->file, 0, sizeof(req->file));
+    net_dhcp_fill_header(req, time(NULL) ^ 0xDEADBEEF,
+                         htonl(net_ipv4_address(net_default_dev->ip_addr)));
 
     /* Fill in options */
     optlen = net_dhcp_fill_options(net_default_dev, req, DHCP_MSG_DHCPREQUEST,
                                    0, ntohl(req->ciaddr));
 
     /* Add to our packet queue */
-    qpkt = (struct dhcp_pkt_out *)malloc(sizeof(struct dhcp_pkt_out));
-
-    if(!qpkt) {
-        return;
-    }
-
-    qpkt->buf = (uint8 *)malloc(sizeof(dhcp_pkt_t) + optlen);
-
-    if(!qpkt->buf) {
-        free(qpkt);
-        return;
-    }
-
-    qpkt->size = sizeof(dhcp_pkt_t) + optlen;
-    memcpy(qpkt->buf, buf, sizeof(dhcp_pkt_t) + optlen);
-    qpkt->pkt_type = DHCP_MSG_DHCPREQUEST;
-    qpkt->next_send = 0;
-    qpkt->next_delay = 60000;
-
-    STAILQ_INSERT_TAIL(&dhcp_pkts, qpkt, pkt_queue);
+    net_dhcp_queue(buf, sizeof(dhcp_pkt_t) + optlen, DHCP_MSG_DHCPREQUEST,
+                   60000);
 }
 
-static void net_dhcp_bind(dhcp_pkt_t *pkt, int len) {
+static void net_dhcp_bind(dhcp_pkt_t *pkt, int len, uint32 server) {
     uint32 tmp = ntohl(pkt->yiaddr);
+    uint32 lease_time;
     uint32 old = irq_disable();
 
     /* Bind the IP address first */
@@ -445,20 +548,21 @@ static void net_dhcp_bind(dhcp_pkt_t *pkt, int len) {
             net_default_dev->ip_addr[3] | (~net_default_dev->netmask[3]);
     }
 
-    /* Grab the Lease expiry time */
-    tmp = net_dhcp_get_32bit(pkt, DHCP_OPTION_IP_LEASE_TIME, len);
+    /* Grab the Lease expiry time. This comes back from net_dhcp_get_32bit()
+       in host byte order already. */
+    lease_time = net_dhcp_get_32bit(pkt, DHCP_OPTION_IP_LEASE_TIME, len);
 
-    if(tmp != 0 && tmp != 0xFFFFFFFF) {
+    if(lease_time != 0 && lease_time != 0xFFFFFFFF) {
         /* Set our renewal timer to half the lease time and the rebinding timer
            to .875 * lease time. */
         uint64 now = timer_ms_gettime64();
-        int expiry = ntohl(tmp) * 1000;
+        uint64 expiry = (uint64)lease_time * 1000;
 
         renew_time = now + (expiry >> 1);
-        rebind_time = now + (uint64)(expiry * 0.875);
+        rebind_time = now + expiry * 7 / 8;
         lease_expires = now + expiry;
     }
-    else if(tmp == 0xFFFFFFFF) {
+    else if(lease_time == 0xFFFFFFFF) {
         renew_time = rebind_time = lease_expires = 0xFFFFFFFFFFFFFFFFULL;
     }
 
@@ -471,6 +575,25 @@ static void net_dhcp_bind(dhcp_pkt_t *pkt, int len) {
 
     state = DHCP_STATE_BOUND;
 
+    /* Remember all of this for next time. It gets written out once we're done
+       with everything else, since the store might be slow. */
+    if(store) {
+        memcpy(lease.mac, net_default_dev->mac_addr, 6);
+        memcpy(lease.ip, net_default_dev->ip_addr, 4);
+        lease.server[0] = (server >> 24) & 0xFF;
+        lease.server[1] = (server >> 16) & 0xFF;
+        lease.server[2] = (server >>  8) & 0xFF;
+        lease.server[3] = (server >>  0) & 0xFF;
+        memcpy(lease.netmask, net_default_dev->netmask, 4);
+        memcpy(lease.gateway, net_default_dev->gateway, 4);
+        memcpy(lease.dns, net_default_dev->dns, 4);
+        memcpy(lease.broadcast, net_default_dev->broadcast, 4);
+        lease.mtu = net_default_dev->mtu;
+        lease.lease_time = lease_time ? lease_time : 0xFFFFFFFF;
+        lease.obtained = time(NULL);
+        lease_dirty = 1;
+    }
+
     irq_restore(old);
 }
 
@@ -482,7 +605,9 @@ static void net_dhcp_thd(void *obj __attribute__((unused))) {
     ssize_t len = 0;
     socklen_t addr_len = sizeof(struct sockaddr_in);
     dhcp_pkt_t *pkt = (dhcp_pkt_t *)buf, *pkt2;
-    int found;
+    net_dhcp_lease_t tosave;
+    int found, save = 0, forget = 0;
+    uint32 server;
 
     now = timer_ms_gettime64();
     len = 0;
@@ -492,25 +617,17 @@ static void net_dhcp_thd(void *obj __attribute__((unused))) {
     /* Make sure we don't need to renew our lease */
     if(lease_expires <= now && (state == DHCP_STATE_BOUND ||
                                 state == DHCP_STATE_RENEWING || state == DHCP_STATE_REBINDING)) {
-        STAILQ_FOREACH(qpkt, &dhcp_pkts, pkt_queue) {
-            STAILQ_REMOVE(&dhcp_pkts, qpkt, dhcp_pkt_out, pkt_queue);
-            free(qpkt->buf);
-            free(qpkt);
-        }
+        net_dhcp_flush();
 
         state = DHCP_STATE_INIT;
         srv_addr.sin_addr.s_addr = INADDR_BROADCAST;
         memset(net_default_dev->ip_addr, 0, 4);
-        net_dhcp_request();
+        net_dhcp_discover();
     }
     else if(rebind_time <= now &&
             (state == DHCP_STATE_BOUND || state == DHCP_STATE_RENEWING)) {
         /* Clear out any existing packets. */
-        STAILQ_FOREACH(qpkt, &dhcp_pkts, pkt_queue) {
-            STAILQ_REMOVE(&dhcp_pkts, qpkt, dhcp_pkt_out, pkt_queue);
-            free(qpkt->buf);
-            free(qpkt);
-        }
+        net_dhcp_flush();
 
         state = DHCP_STATE_REBINDING;
         srv_addr.sin_addr.s_addr = INADDR_BROADCAST;
@@ -520,6 +637,12 @@ static void net_dhcp_thd(void *obj __attribute__((unused))) {
         state = DHCP_STATE_RENEWING;
         net_dhcp_renew();
     }
+    else if(reboot_deadline <= now && state == DHCP_STATE_REBOOTING) {
+        /* No answer about the old lease, so it's time to give up on it and go
+           looking for a new one. */
+        net_dhcp_flush();
+        net_dhcp_discover();
+    }
 
     /* Check if we have any packets waiting to come in. */
     while((len = recvfrom(dhcp_sock, buf, 1024, 0,
@@ -573,24 +696,43 @@ static void net_dhcp_thd(void *obj __attribute__((unused))) {
                 case DHCP_MSG_DHCPREQUEST:
                     found = net_dhcp_get_message_type(pkt, len);
 
+                    /* A request shares its xid with the DISCOVER before it,
+                       so this could be another OFFER from answering that
+                       more than once. Only an ACK or NAK answers it. */
+                    if(found != DHCP_MSG_DHCPACK && found != DHCP_MSG_DHCPNAK)
+                        break;
+
+                    /* Remove the old packet from our queue */
+                    STAILQ_REMOVE(&dhcp_pkts, qpkt, dhcp_pkt_out,
+                                  pkt_queue);
+                    free(qpkt->buf);
+                    free(qpkt);
+
                     if(found == DHCP_MSG_DHCPACK) {
                         srv_addr.sin_addr.s_addr = addr.sin_addr.s_addr;
+                        server = net_dhcp_get_32bit(pkt, DHCP_OPTION_SERVER_ID,
+                                                    len);
+
+                        if(!server)
+                            server = ntohl(addr.sin_addr.s_addr);
 
                         /* Bind to the specified IP address */
-                        net_dhcp_bind(pkt, len);
+                        net_dhcp_bind(pkt, len, server);
                         genwait_wake_all(&dhcp_sock);
                     }
                     else if(found == DHCP_MSG_DHCPNAK) {
+                        /* If that was the lease from last time, it's no good
+                           any more. */
+                        if(state == DHCP_STATE_REBOOTING)
+                            forget = 1;
+
                         /* We got a NAK, try to discover again. */
                         state = DHCP_STATE_INIT;
-                        net_dhcp_request();
+                        srv_addr.sin_addr.s_addr = INADDR_BROADCAST;
+                        net_dhcp_flush();
+                        net_dhcp_discover();
                     }
 
-                    /* Remove the old packet from our queue */
-                    STAILQ_REMOVE(&dhcp_pkts, qpkt, dhcp_pkt_out,
-                                  pkt_queue);
-                    free(qpkt->buf);
-                    free(qpkt);
                     break;
 
                     /* Currently, these are the only two DHCP packets the code
@@ -600,16 +742,99 @@ static void net_dhcp_thd(void *obj __attribute__((unused))) {
         }
     }
 
-    /* Send any packets that need to be sent. */
+    /* Send any packets that need to be sent. Each one waits twice as long as
+       the last before it goes out again, up to a point. */
     STAILQ_FOREACH(qpkt, &dhcp_pkts, pkt_queue) {
         if(qpkt->next_send <= now) {
             sendto(dhcp_sock, qpkt->buf, qpkt->size, 0,
                    (struct sockaddr *)&srv_addr, sizeof(srv_addr));
             qpkt->next_send = now + qpkt->next_delay;
             qpkt->next_delay <<= 1;
+
+            if(qpkt->next_delay > (int)params.retrans_max)
+                qpkt->next_delay = params.retrans_max;
         }
     }
 
+    if(lease_dirty) {
+        memcpy(&tosave, &lease, sizeof(tosave));
+        lease_dirty = 0;
+        save = 1;
+    }
+
+    mutex_unlock(&dhcp_lock);
+
+    /* Now that nobody's waiting on us, update the store. */
+    if(forget && store && store->clear)
+        store->clear(store);
+
+    if(save && store)
+        store->save(store, &tosave);
+}
+
+int net_dhcp_set_store(net_dhcp_store_t *st) {
+    if(st && (!st->load || !st->save)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    mutex_lock(&dhcp_lock);
+    store = st;
+    mutex_unlock(&dhcp_lock);
+
+    return 0;
+}
+
+int net_dhcp_set_store_file(const char *fn) {
+    char *tmp = NULL;
+
+    if(fn && !(tmp = strdup(fn))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    mutex_lock(&dhcp_lock);
+
+    if(store == &file_store)
+        store = NULL;
+
+    free(file_store.data);
+    file_store.data = tmp;
+
+    if(tmp)
+        store = &file_store;
+
+    mutex_unlock(&dhcp_lock);
+
+    return 0;
+}
+
+int net_dhcp_set_params(const net_dhcp_params_t *p) {
+    net_dhcp_params_t tmp;
+
+    tmp.retrans_min = p->retrans_min ? p->retrans_min : DHCP_RETRANS_MIN;
+    tmp.retrans_max = p->retrans_max ? p->retrans_max : DHCP_RETRANS_MAX;
+    tmp.reboot_timeout = p->reboot_timeout ? p->reboot_timeout :
+        DHCP_REBOOT_TIMEOUT;
+    tmp.timeout = p->timeout ? p->timeout : DHCP_TIMEOUT;
+
+    /* Keep the delays where doubling them won't overflow. */
+    if(tmp.retrans_min > tmp.retrans_max || tmp.retrans_max > 0x3FFFFFFF ||
+       tmp.timeout > 0x7FFFFFFF) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    mutex_lock(&dhcp_lock);
+    params = tmp;
+    mutex_unlock(&dhcp_lock);
+
+    return 0;
+}
+
+void net_dhcp_get_params(net_dhcp_params_t *p) {
+    mutex_lock(&dhcp_lock);
+    *p = params;
     mutex_unlock(&dhcp_lock);
 }
 
@@ -639,6 +864,10 @@ int net_dhcp_init(void) {
     srv_addr.sin_port = htons(DHCP_SERVER_PORT);
     srv_addr.sin_addr.s_addr = INADDR_BROADCAST;
 
+    /* Start out with nothing, in case we were up before. */
+    state = DHCP_STATE_INIT;
+    renew_time = rebind_time = lease_expires = 0xFFFFFFFFFFFFFFFFULL;
+
     /* Make the socket non-blocking */
     fs_fcntl(dhcp_sock, F_SETFL, O_NONBLOCK);
 
@@ -658,4 +887,8 @@ void net_dhcp_shutdown(void) {
         close(dhcp_sock);
         dhcp_sock = -1;
     }
+
+    mutex_lock(&dhcp_lock);
+    net_dhcp_flush();
+    mutex_unlock(&dhcp_lock);
 }
@@ -9,6 +9,7 @@
 #include <kos/net.h>
 #include "net_ipv4.h"
 #include "net_ipv6.h"
+#include "net_capture.h"
 
 /*
 
@@ -16,8 +17,42 @@
 
 */
 
-static int net_default_input(netif_t *nif, const uint8 *data, int len) {
-    uint16 proto = (uint16)((data[12] << 8) | (data[13]));
+/* Sort out what to do with a frame. If it came in through a packet buffer, p
+   is that buffer, so that the protocols can hang on to it rather than copying
+   the data out. */
+static int net_input_frame(netif_t *nif, const uint8 *data, int len,
+                           net_pbuf_t *p) {
+    uint16 proto;
+
+    /* Devices that don't use ethernet hand us bare IP packets, so look at the
+       version to figure out what to do with them. */
+    if(nif && (nif->flags & NETIF_NOETH)) {
+        if(len < 1) {
+            ++nif->stats.rx_errors;
+            return 0;
+        }
+
+        switch(data[0] >> 4) {
+            case 4:
+                return net_ipv4_input(nif, data, len, NULL, p);
+
+            case 6:
+                return net_ipv6_input(nif, data, len, NULL, p);
+
+            default:
+                ++nif->stats.rx_dropped;
+                return 0;
+        }
+    }
+
+    if(len < (int)sizeof(eth_hdr_t)) {
+        if(nif)
+            ++nif->stats.rx_errors;
+
+        return 0;
+    }
+
+    proto = (uint16)((data[12] << 8) | (data[13]));
 
     /* If this is bound for a multicast address, make sure we actually care
        about the one that it gets sent to. */
@@ -32,7 +67,7 @@ static int net_default_input(netif_t *nif, const uint8 *data, int len) {
         case 0x0800:
             return net_ipv4_input(nif, data + sizeof(eth_hdr_t),
                                   len - sizeof(eth_hdr_t),
-                                  (const eth_hdr_t *)data);
+                                  (const eth_hdr_t *)data, p);
 
         case 0x0806:
             return net_arp_input(nif, data, len);
@@ -40,24 +75,58 @@ static int net_default_input(netif_t *nif, const uint8 *data, int len) {
         case 0x86DD:
             return net_ipv6_input(nif, data + sizeof(eth_hdr_t),
                                   len - sizeof(eth_hdr_t),
-                                  (const eth_hdr_t *)data);
+                                  (const eth_hdr_t *)data, p);
 
         default:
+            if(nif)
+                ++nif->stats.rx_dropped;
+
             return 0;
     }
 }
 
+static int net_default_input(netif_t *nif, const uint8 *data, int len) {
+    return net_input_frame(nif, data, len, NULL);
+}
+
 /* Where will input packets be routed? */
 net_input_func net_input_target = net_default_input;
 
+static void net_input_count(netif_t *device, const uint8 *data, int len) {
+    if(device) {
+        ++device->stats.rx_packets;
+        device->stats.rx_bytes += len;
+    }
+
+    if(net_capture_on)
+        net_capture_frame(device, data, len, NET_CAPTURE_IN);
+}
+
 /* Process an incoming packet */
 int net_input(netif_t *device, const uint8 *data, int len) {
+    net_input_count(device, data, len);
+
     if(net_input_target != NULL)
         return net_input_target(device, data, len);
     else
         return 0;
 }
 
+/* Process an incoming packet held in a packet buffer. The buffer goes down
+   the stack along with the packet, since the devices can be feeding packets
+   in from more than one thread at once. A replacement input target only gets
+   the bare frame. */
+int net_input_pbuf(netif_t *device, net_pbuf_t *p) {
+    net_input_count(device, p->data, (int)p->len);
+
+    if(net_input_target == net_default_input)
+        return net_input_frame(device, p->data, (int)p->len, p);
+    else if(net_input_target != NULL)
+        return net_input_target(device, p->data, (int)p->len);
+    else
+        return 0;
+}
+
 /* Setup an input target; returns the old target */
 net_input_func net_input_set_target(net_input_func t) {
     net_input_func old = net_input_target;
@@ -12,6 +12,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
 #include <arpa/inet.h>
@@ -24,43 +25,220 @@
 
 static net_ipv4_stats_t ipv4_stats = { 0 };
 
+/* Fold a 64-bit one's complement sum down to 16 bits. */
+static inline uint32 cksum_fold(uint64 sum) {
+    uint32 s;
+
+    sum = (sum >> 32) + (sum & 0xFFFFFFFF);
+    sum = (sum >> 32) + (sum & 0xFFFFFFFF);
+    s = (uint32)sum;
+    s = (s >> 16) + (s & 0xFFFF);
+    s = (s >> 16) + (s & 0xFFFF);
+
+    return s;
+}
+
+/* Add up a block of data as native-order 16-bit words, starting at a 16-bit
+   aligned address. The bulk of the work is done 32 bits at a time into a 64-bit
+   accumulator, so that carries only have to be folded in once at the end. The
+   one's complement sum of 32-bit words folds down to the same thing as the sum
+   of the 16-bit words would have. */
+static uint32 cksum_partial(const uint8 *data, size_t bytes) {
+    const uint32 *ptr;
+    uint64 sum = 0;
+    uint16 w;
+
+    /* Get up to 32-bit alignment */
+    if(bytes >= 2 && ((uintptr_t)data & 0x02)) {
+        sum += *(const uint16 *)data;
+        data += 2;
+        bytes -= 2;
+    }
+
+    ptr = (const uint32 *)data;
+
+    while(bytes >= 32) {
+        sum += ptr[0];
+        sum += ptr[1];
+        sum += ptr[2];
+        sum += ptr[3];
+        sum += ptr[4];
+        sum += ptr[5];
+        sum += ptr[6];
+        sum += ptr[7];
+        ptr += 8;
+        bytes -= 32;
+    }
+
+    while(bytes >= 4) {
+        sum += *ptr++;
+        bytes -= 4;
+    }
+
+    data = (const uint8 *)ptr;
+
+    if(bytes >= 2) {
+        sum += *(const uint16 *)data;
+        data += 2;
+        bytes -= 2;
+    }
+
+    /* Handle the last byte, if we have an odd byte count. It goes in the first
+       byte of a word, whatever that means for our endianness. */
+    if(bytes) {
+        w = 0;
+        *(uint8 *)&w = *data;
+        sum += w;
+    }
+
+    return cksum_fold(sum);
+}
+
 /* Perform an IP-style checksum on a block of data */
 uint16 net_ipv4_checksum(const uint8 *data, size_t bytes, uint16 start) {
-    uint32 sum = start;
-    size_t i = bytes;
+    uint32 sum;
+    uint16 w = 0;
+
+    /* If the data is on an odd address, sum everything but the first byte,
+       which puts each byte in the wrong half of its word. Swapping the bytes of
+       the result fixes that up (RFC 1071, section 2). */
+    if(((uintptr_t)data & 0x01) && bytes) {
+        *(uint8 *)&w = *data;
+        sum = cksum_partial(data + 1, bytes - 1);
+        sum = ((sum & 0xFF) << 8) | (sum >> 8);
+        sum += w;
+    }
+    else {
+        sum = cksum_partial(data, bytes);
+    }
 
-    /* Make sure we don't do any unaligned memory accesses */
-    if(((uint32)data) & 0x01) {
-        const uint8 *ptr = data;
+    sum += start;
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    sum = (sum >> 16) + (sum & 0xFFFF);
 
-        while(i > 1) {
-            sum += *ptr | ((*ptr + 1) << 8);
-            ptr += 2;
-            i -= 2;
+    return sum ^ 0xFFFF;
+}
 
-            while(sum >> 16)
-                sum = (sum >> 16) + (sum & 0xFFFF);
-        }
+/* Copy a block of data, adding it up along the way. The return value is the
+   running (uncomplemented) sum, which can be passed as the start value to
+   net_ipv4_checksum() for the rest of the packet. Unlike that function, the
+   bytes are placed in words based on the address of the destination, not on
+   their offset from the start of the block. That way a packet can be filled in
+   piece by piece in any order, as long as the packet starts on an even
+   address. */
+uint16 net_ipv4_checksum_copy(uint8 *dst, const uint8 *src, size_t bytes,
+                              uint16 start) {
+    uint64 sum = start;
+    uint32 *d;
+    const uint32 *s;
+    uint32 t0, t1, t2, t3;
+    uint16 w;
+
+    /* Odd destination address: this byte is the second half of a word. */
+    if(((uintptr_t)dst & 0x01) && bytes) {
+        w = 0;
+        ((uint8 *)&w)[1] = *dst++ = *src++;
+        sum += w;
+        --bytes;
     }
-    else {
-        const uint16 *ptr = (const uint16 *)data;
 
-        while(i > 1) {
-            sum += *ptr++;
-            i -= 2;
+    /* If the source and destination don't line up with each other, we can't do
+       the copy a word at a time. Let memcpy deal with the misalignment, and then
+       add up the data while it is still in the cache. */
+    if(((uintptr_t)dst ^ (uintptr_t)src) & 0x03) {
+        memcpy(dst, src, bytes);
+        return cksum_fold(sum + cksum_partial(dst, bytes));
+    }
 
-            while(sum >> 16)
-                sum = (sum >> 16) + (sum & 0xFFFF);
-        }
+    if(bytes >= 2 && ((uintptr_t)dst & 0x02)) {
+        w = *(const uint16 *)src;
+        *(uint16 *)dst = w;
+        sum += w;
+        dst += 2;
+        src += 2;
+        bytes -= 2;
     }
 
-    /* Handle the last byte, if we have an odd byte count */
-    if(i)
-        sum += data[bytes - 1];
+    d = (uint32 *)dst;
+    s = (const uint32 *)src;
+
+    while(bytes >= 16) {
+        t0 = s[0];
+        t1 = s[1];
+        t2 = s[2];
+        t3 = s[3];
+        d[0] = t0;
+        d[1] = t1;
+        d[2] = t2;
+        d[3] = t3;
+        sum += t0;
+        sum += t1;
+        sum += t2;
+        sum += t3;
+        d += 4;
+        s += 4;
+        bytes -= 16;
+    }
 
-    /* Take care of any carry bits */
-    while(sum >> 16)
-        sum = (sum >> 16) + (sum & 0xFFFF);
+    while(bytes >= 4) {
+        t0 = *s++;
+        *d++ = t0;
+        sum += t0;
+        bytes -= 4;
+    }
+
+    dst = (uint8 *)d;
+    src = (const uint8 *)s;
+
+    if(bytes >= 2) {
+        w = *(const uint16 *)src;
+        *(uint16 *)dst = w;
+        sum += w;
+        dst += 2;
+        src += 2;
+        bytes -= 2;
+    }
+
+    if(bytes) {
+        w = 0;
+        *(uint8 *)&w = *dst = *src;
+        sum += w;
+    }
+
+    return cksum_fold(sum);
+}
+
+/* Incrementally update a checksum for a change in one 16-bit word of the data
+   that it covers (RFC 1624, equation 3). */
+uint16 net_ipv4_checksum_update(uint16 cksum, uint16 from, uint16 to) {
+    uint32 sum;
+
+    sum = (uint16)~cksum + (uint16)~from + to;
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    sum = (sum >> 16) + (sum & 0xFFFF);
+
+    return ~sum;
+}
+
+/* Perform an IP-style checksum on the data in a chain of packet buffers. Each
+   buffer is added up on its own, and those that start at an odd offset into
+   the packet get their sums byte swapped before being added in. */
+uint16 net_ipv4_checksum_pbuf(const net_pbuf_t *p, uint16 start) {
+    uint32 sum = start, s;
+    size_t off = 0;
+
+    for(; p; p = p->next) {
+        s = (uint16)~net_ipv4_checksum(p->data, p->len, 0);
+
+        if(off & 0x01)
+            s = ((s & 0xFF) << 8) | (s >> 8);
+
+        sum += s;
+        off += p->len;
+    }
+
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    sum = (sum >> 16) + (sum & 0xFFFF);
 
     return sum ^ 0xFFFF;
 }
@@ -90,15 +268,25 @@ static int is_broadcast(const uint8 dest[4], const uint8 bc[4]) {
     return 1;
 }
 
-/* Send a packet on the specified network adapter */
-int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
-                         size_t size) {
+/* Send a packet on the specified network adapter. The IP and ethernet headers
+   are prepended into the headroom of the buffer, and removed again before we
+   return, so the caller still owns the buffer as it passed it in. */
+int net_ipv4_send_packet_pbuf(netif_t *net, ip_hdr_t *hdr, net_pbuf_t *p) {
     uint8 dest_ip[4];
     uint8 dest_mac[6];
-    uint8 pkt[size + sizeof(ip_hdr_t) + sizeof(eth_hdr_t)];
+    int ihl = 4 * (hdr->version_ihl & 0x0f);
+    size_t pushed = 0;
     eth_hdr_t *ehdr;
+    uint8 *iph;
     int err;
 
+    net_ipv4_parse_address(ntohl(hdr->dest), dest_ip);
+
+    /* Anything for the loopback network (127/8) goes to the loopback device,
+       no matter where we were asked to send it. */
+    if(dest_ip[0] == 0x7F && net_loop_dev)
+        net = net_loop_dev;
+
     if(net == NULL) {
         net = net_default_dev;
 
@@ -108,86 +296,93 @@ int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
         }
     }
 
-    net_ipv4_parse_address(ntohl(hdr->dest), dest_ip);
-
-    /* Is this a loopback address (127/8)? */
-    if(dest_ip[0] == 0x7F) {
-        /* Put the IP header / data into our packet */
-        memcpy(pkt, hdr, 4 * (hdr->version_ihl & 0x0f));
-        memcpy(pkt + 4 * (hdr->version_ihl & 0x0f), data, size);
-
-        ++ipv4_stats.pkt_sent;
-
-        /* Send it "away" */
-        net_ipv4_input(NULL, pkt, 4 * (hdr->version_ihl & 0x0f) + size, NULL);
-
-        return 0;
-    }
-    else if(net->flags & NETIF_NOETH) {
-        /* Put the IP header / data into our packet */
-        memcpy(pkt, hdr, 4 * (hdr->version_ihl & 0x0f));
-        memcpy(pkt + 4 * (hdr->version_ihl & 0x0f), data, size);
+    if(!(net->flags & NETIF_NOETH)) {
+        /* Are we sending a broadcast packet? */
+        if(hdr->dest == 0xFFFFFFFF || is_broadcast(dest_ip, net->broadcast)) {
+            /* Set the destination to the datalink layer broadcast address. */
+            memset(dest_mac, 0xFF, 6);
+        }
+        else {
+            /* Is it in our network? */
+            if(!is_in_network(net->ip_addr, dest_ip, net->netmask)) {
+                memcpy(dest_ip, net->gateway, 4);
+            }
 
-        ++ipv4_stats.pkt_sent;
+            /* Get our destination's MAC address. If we do not have the MAC
+               address cached, return a distinguished error to the upper-level
+               protocol so that it can decide what to do. */
+            err = net_arp_lookup_pbuf(net, dest_ip, dest_mac, hdr, p);
 
-        /* Send it away */
-        return net->if_tx(net, pkt, 4 * (hdr->version_ihl & 0x0f) + size,
-                          NETIF_BLOCK);
+            if(err == -1) {
+                errno = ENETUNREACH;
+                ++ipv4_stats.pkt_send_failed;
+                return -1;
+            }
+            else if(err == -2) {
+                /* It'll send when the ARP reply comes in (assuming one does),
+                   so return success. */
+                return 0;
+            }
+        }
     }
 
-    /* Are we sending a broadcast packet? */
-    if(hdr->dest == 0xFFFFFFFF || is_broadcast(dest_ip, net->broadcast)) {
-        /* Set the destination to the datalink layer broadcast address. */
-        memset(dest_mac, 0xFF, 6);
+    /* Put the IP header in front of the data */
+    if(!(iph = (uint8 *)net_pbuf_push(p, ihl))) {
+        errno = ENOBUFS;
+        ++ipv4_stats.pkt_send_failed;
+        return -1;
     }
-    else {
-        /* Is it in our network? */
-        if(!is_in_network(net->ip_addr, dest_ip, net->netmask)) {
-            memcpy(dest_ip, net->gateway, 4);
-        }
 
-        /* Get our destination's MAC address. If we do not have the MAC address
-           cached, return a distinguished error to the upper-level protocol so
-           that it can decide what to do. */
-        err = net_arp_lookup(net, dest_ip, dest_mac, hdr, data, size);
+    memcpy(iph, hdr, ihl);
+    pushed = ihl;
 
-        if(err == -1) {
-            errno = ENETUNREACH;
+    /* Fill in the ethernet header, if this device needs one */
+    if(!(net->flags & NETIF_NOETH)) {
+        if(!(ehdr = (eth_hdr_t *)net_pbuf_push(p, sizeof(eth_hdr_t)))) {
+            net_pbuf_pull(p, pushed);
+            errno = ENOBUFS;
             ++ipv4_stats.pkt_send_failed;
             return -1;
         }
-        else if(err == -2) {
-            /* It'll send when the ARP reply comes in (assuming one does), so
-               return success. */
-            return 0;
-        }
-    }
 
-    /* Fill in the ethernet header */
-    ehdr = (eth_hdr_t *)pkt;
-    memcpy(ehdr->dest, dest_mac, 6);
-    memcpy(ehdr->src, net->mac_addr, 6);
-    ehdr->type[0] = 0x08;
-    ehdr->type[1] = 0x00;
-
-    /* Put the IP header / data into our ethernet packet */
-    memcpy(pkt + sizeof(eth_hdr_t), hdr, 4 * (hdr->version_ihl & 0x0f));
-    memcpy(pkt + sizeof(eth_hdr_t) + 4 * (hdr->version_ihl & 0x0f), data,
-           size);
+        memcpy(ehdr->dest, dest_mac, 6);
+        memcpy(ehdr->src, net->mac_addr, 6);
+        ehdr->type[0] = 0x08;
+        ehdr->type[1] = 0x00;
+        pushed += sizeof(eth_hdr_t);
+    }
 
     ++ipv4_stats.pkt_sent;
 
     /* Send it away */
-    net->if_tx(net, pkt, sizeof(ip_hdr_t) + size + sizeof(eth_hdr_t),
-               NETIF_BLOCK);
+    err = net_pbuf_tx(net, p, NETIF_BLOCK);
+    net_pbuf_pull(p, pushed);
 
-    return 0;
+    return (net->flags & NETIF_NOETH) ? err : 0;
 }
 
-int net_ipv4_send(netif_t *net, const uint8 *data, size_t size, int id, int ttl,
-                  int proto, uint32 src, uint32 dst) {
-    ip_hdr_t hdr;
+int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
+                         size_t size) {
+    net_pbuf_t *p;
+    int rv;
+
+    /* Copy the data into a buffer with room in front for the headers, which is
+       the one copy we'd have to make anyway. */
+    if(!(p = net_pbuf_alloc(NET_PBUF_HEADROOM, size))) {
+        errno = ENOBUFS;
+        ++ipv4_stats.pkt_send_failed;
+        return -1;
+    }
+
+    memcpy(p->data, data, size);
+    rv = net_ipv4_send_packet_pbuf(net, hdr, p);
+    net_pbuf_free(p);
 
+    return rv;
+}
+
+static void ipv4_fill_hdr(ip_hdr_t *hdr, size_t size, int id, int ttl,
+                          int proto, uint32 src, uint32 dst) {
     /* If the ID is -1, generate a random ID value that can be used in case the
        packet gets fragmented. */
     if(id == -1) {
@@ -195,24 +390,65 @@ int net_ipv4_send(netif_t *net, const uint8 *data, size_t size, int id, int ttl,
     }
 
     /* Fill in the IPv4 Header */
-    hdr.version_ihl = 0x45;
-    hdr.tos = 0;
-    hdr.length = htons(size + 20);
-    hdr.packet_id = id;
-    hdr.flags_frag_offs = 0;
-    hdr.ttl = ttl;
-    hdr.protocol = proto;
-    hdr.checksum = 0;
-    hdr.src = src;
-    hdr.dest = dst;
-
-    hdr.checksum = net_ipv4_checksum((uint8 *)&hdr, sizeof(ip_hdr_t), 0);
+    hdr->version_ihl = 0x45;
+    hdr->tos = 0;
+    hdr->length = htons(size + 20);
+    hdr->packet_id = id;
+    hdr->flags_frag_offs = 0;
+    hdr->ttl = ttl;
+    hdr->protocol = proto;
+    hdr->checksum = 0;
+    hdr->src = src;
+    hdr->dest = dst;
+
+    hdr->checksum = net_ipv4_checksum((uint8 *)hdr, sizeof(ip_hdr_t), 0);
+}
+
+int net_ipv4_send(netif_t *net, const uint8 *data, size_t size, int id, int ttl,
+                  int proto, uint32 src, uint32 dst) {
+    ip_hdr_t hdr;
+
+    ipv4_fill_hdr(&hdr, size, id, ttl, proto, src, dst);
 
     return net_ipv4_frag_send(net, &hdr, data, size);
 }
 
+int net_ipv4_send_pbuf(netif_t *net, net_pbuf_t *p, int id, int ttl, int proto,
+                       uint32 src, uint32 dst) {
+    ip_hdr_t hdr;
+
+    if((ntohl(dst) >> 24) == 0x7F && net_loop_dev)
+        net = net_loop_dev;
+
+    if(net == NULL) {
+        net = net_default_dev;
+
+        if(!net) {
+            errno = ENETDOWN;
+            return -1;
+        }
+    }
+
+    ipv4_fill_hdr(&hdr, p->tot_len, id, ttl, proto, src, dst);
+
+    /* If the packet fits in one frame, it can go straight down. Otherwise,
+       let the fragmentation code deal with it. */
+    if((int)(p->tot_len + sizeof(ip_hdr_t)) < net->mtu)
+        return net_ipv4_send_packet_pbuf(net, &hdr, p);
+
+    if(!p->next)
+        return net_ipv4_frag_send(net, &hdr, p->data, p->len);
+
+    {
+        uint8 data[p->tot_len];
+
+        net_pbuf_copy(p, 0, data, p->tot_len);
+        return net_ipv4_frag_send(net, &hdr, data, p->tot_len);
+    }
+}
+
 int net_ipv4_input(netif_t *src, const uint8 *pkt, size_t pktsize,
-                   const eth_hdr_t *eth) {
+                   const eth_hdr_t *eth, net_pbuf_t *pbuf) {
     const ip_hdr_t *ip;
     const uint8 *data;
     size_t hdrlen;
@@ -227,8 +463,10 @@ int net_ipv4_input(netif_t *src, const uint8 *pkt, size_t pktsize,
     ip = (const ip_hdr_t *)pkt;
     hdrlen = (ip->version_ihl & 0x0F) << 2;
 
-    if(pktsize < hdrlen) {
-        /* The packet is smaller than the listed header length, bail */
+    if(pktsize < hdrlen || hdrlen < sizeof(ip_hdr_t) ||
+       ntohs(ip->length) < hdrlen || ntohs(ip->length) > pktsize) {
+        /* The packet is smaller than the listed header length (or the length
+           it says it is), bail */
         ++ipv4_stats.pkt_recv_bad_size;
         return -1;
     }
@@ -249,10 +487,12 @@ int net_ipv4_input(netif_t *src, const uint8 *pkt, size_t pktsize,
     }
 
     /* Submit the packet for possible reassembly. */
-    return net_ipv4_reassemble(src, ip, data, ntohs(ip->length) - hdrlen);
+    return net_ipv4_reassemble(src, ip, data, ntohs(ip->length) - hdrlen,
+                               pbuf);
 }
 
-int net_ipv4_input_proto(netif_t *src, const ip_hdr_t *ip, const uint8 *data) {
+int net_ipv4_input_proto(netif_t *src, const ip_hdr_t *ip, const uint8 *data,
+                         net_pbuf_t *pbuf) {
     size_t hdrlen = (ip->version_ihl & 0x0F) << 2;
     size_t datalen = ntohs(ip->length) - hdrlen;
     int rv;
@@ -264,7 +504,8 @@ int net_ipv4_input_proto(netif_t *src, const ip_hdr_t *ip, const uint8 *data) {
             return net_icmp_input(src, ip, data, datalen);
 
         default:
-            rv = fs_socket_input(src, AF_INET, ip->protocol, ip, data, datalen);
+            rv = fs_socket_input(src, AF_INET, ip->protocol, ip, data, datalen,
+                                 pbuf);
 
             if(rv > -2) {
                 ++ipv4_stats.pkt_recv;
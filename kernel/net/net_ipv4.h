@@ -28,13 +28,21 @@ typedef struct {
 #undef packed
 
 uint16 net_ipv4_checksum(const uint8 *data, size_t bytes, uint16 start);
+uint16 net_ipv4_checksum_copy(uint8 *dst, const uint8 *src, size_t bytes,
+                              uint16 start);
+uint16 net_ipv4_checksum_update(uint16 cksum, uint16 from, uint16 to);
+uint16 net_ipv4_checksum_pbuf(const net_pbuf_t *p, uint16 start);
 int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
                          size_t size);
 int net_ipv4_send(netif_t *net, const uint8 *data, size_t size, int id, int ttl,
                   int proto, uint32 src, uint32 dst);
+int net_ipv4_send_packet_pbuf(netif_t *net, ip_hdr_t *hdr, net_pbuf_t *p);
+int net_ipv4_send_pbuf(netif_t *net, net_pbuf_t *p, int id, int ttl, int proto,
+                       uint32 src, uint32 dst);
 int net_ipv4_input(netif_t *src, const uint8 *pkt, size_t pktsize,
-                   const eth_hdr_t *eth);
-int net_ipv4_input_proto(netif_t *net, const ip_hdr_t *ip, const uint8 *data);
+                   const eth_hdr_t *eth, net_pbuf_t *pbuf);
+int net_ipv4_input_proto(netif_t *net, const ip_hdr_t *ip, const uint8 *data,
+                         net_pbuf_t *pbuf);
 
 uint16 net_ipv4_checksum_pseudo(in_addr_t src, in_addr_t dst, uint8 proto,
                                 uint16 len);
@@ -43,7 +51,7 @@ uint16 net_ipv4_checksum_pseudo(in_addr_t src, in_addr_t dst, uint8 proto,
 int net_ipv4_frag_send(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
                        size_t size);
 int net_ipv4_reassemble(netif_t *net, const ip_hdr_t *hdr, const uint8 *data,
-                        size_t size);
+                        size_t size, net_pbuf_t *pbuf);
 int net_ipv4_frag_init(void);
 void net_ipv4_frag_shutdown(void);
 
@@ -7,9 +7,9 @@
 
 #include <string.h>
 #include <stdlib.h>
-#include <string.h>
 #include <errno.h>
 #include <arpa/inet.h>
+#include <sys/queue.h>
 
 #include <kos/net.h>
 #include <kos/mutex.h>
@@ -17,33 +17,223 @@
 #include <arch/irq.h>
 
 #include "net_ipv4.h"
+#include "net_ipv6.h"
 #include "net_thd.h"
 
-#define MAX(a, b) a > b ? a : b;
+/* This file handles reassembly for both IPv4 and IPv6, since the only real
+   differences between the two are where the fragment information comes from
+   and what the header looks like once everything is put back together.
+
+   Each datagram being put back together gets one allocation, holding its
+   bookkeeping, room for the header, and the data. The size of the data buffer
+   comes from the first fragment that arrives: if it's the last one, we know
+   exactly how big the datagram is. Otherwise, we guess at room for a few more
+   fragments of the same size. If that turns out to be too small, it's doubled,
+   or set to exactly the right size once the last fragment shows up, so it
+   rarely has to grow more than once. All of the buffers come out of one
+   budget, and when a new one won't fit, the oldest datagrams get thrown out
+   to make room. */
+
+/* Defaults for the parameters. */
+#define FRAG_MAX_MEM        (256 * 1024)
+#define FRAG_MAX_SIZE       65535
+#define FRAG_TIMEOUT        30000
+
+/* How many fragments worth of room to start out with, when we don't know how
+   big the datagram will be. */
+#define FRAG_GUESS          4
+
+/* Room in front of the data for the header, enough for the biggest IPv4
+   header (with options). The IPv6 header is smaller than that. */
+#define FRAG_HDR_MAX        60
+
+/* The most data an IP datagram can carry, and so the bits it takes to keep
+   track of which 8 byte blocks of it have arrived. */
+#define FRAG_DATA_MAX       65535
+#define FRAG_BITFIELD_LEN   ((FRAG_DATA_MAX + 63) >> 6)
+
+#define FRAG_HASH_BITS      5
+#define FRAG_HASH_SIZE      (1 << FRAG_HASH_BITS)
 
 struct ip_frag {
-    TAILQ_ENTRY(ip_frag) listhnd;
-
-    uint32 src;
-    uint32 dst;
-    uint16 ident;
+    TAILQ_ENTRY(ip_frag) listhnd;   /* All datagrams, oldest first */
+    LIST_ENTRY(ip_frag) hashhnd;
+
+    /* What identifies the datagram. IPv4 addresses are kept as IPv4-mapped
+       IPv6 addresses. */
+    int domain;
+    struct in6_addr src;
+    struct in6_addr dst;
+    uint32 ident;
     uint8 proto;
 
-    ip_hdr_t hdr;
-    uint8 *data;
-    uint8 bitfield[8192];
-    int cur_length;
-    int total_length;
+    int hdrlen;                     /* Length of the header, once we have it */
+    int size;                       /* Room for data in the buffer */
+    int high;                       /* Furthest a fragment has reached */
+    int total_length;               /* Length of the data, once we know it */
+    uint32 mem;                     /* What this counts against the budget */
     uint64 death_time;
+    uint8 bitfield[FRAG_BITFIELD_LEN];
+
+    /* The header goes at the end of the first FRAG_HDR_MAX bytes, right in
+       front of the data, so the whole thing can be passed along as one
+       packet. */
+    uint8 buf[];
 };
 
+#define FRAG_DATA(f)        ((f)->buf + FRAG_HDR_MAX)
+
 TAILQ_HEAD(ip_frag_list, ip_frag);
+LIST_HEAD(ip_frag_hash, ip_frag);
 
 static struct ip_frag_list frags;
+static struct ip_frag_hash frag_hash[FRAG_HASH_SIZE];
 static mutex_t frag_mutex = MUTEX_INITIALIZER;
 static int cbid = -1;
 static int initted = 0;
 
+static net_frag_params_t params = {
+    FRAG_MAX_MEM, FRAG_MAX_SIZE, FRAG_TIMEOUT
+};
+
+static net_frag_stats_t frag_stats;
+
+static inline int frag_hashval(const struct in6_addr *src,
+                               const struct in6_addr *dst, uint32 ident,
+                               uint8 proto) {
+    uint32 h = ident ^ proto;
+    int i;
+
+    for(i = 0; i < 4; ++i) {
+        h ^= src->__s6_addr.__s6_addr32[i] ^ dst->__s6_addr.__s6_addr32[i];
+    }
+
+    return (int)((h * 0x9E3779B1) >> (32 - FRAG_HASH_BITS));
+}
+
+/* Take a datagram out of the lists, and give back what it was using from the
+   budget. The caller is responsible for freeing it. */
+static void frag_remove(struct ip_frag *f) {
+    TAILQ_REMOVE(&frags, f, listhnd);
+    LIST_REMOVE(f, hashhnd);
+    frag_stats.mem_used -= f->mem;
+}
+
+/* Make room in the budget for mem more bytes, throwing out the oldest
+   datagrams (other than keep) if need be. */
+static int frag_reserve(uint32 mem, struct ip_frag *keep) {
+    struct ip_frag *f, *n;
+
+    if(mem > params.max_mem)
+        return -1;
+
+    f = TAILQ_FIRST(&frags);
+
+    while(f && frag_stats.mem_used + mem > params.max_mem) {
+        n = TAILQ_NEXT(f, listhnd);
+
+        if(f != keep) {
+            frag_remove(f);
+            free(f);
+            ++frag_stats.pkt_evicted;
+        }
+
+        f = n;
+    }
+
+    return frag_stats.mem_used + mem > params.max_mem ? -1 : 0;
+}
+
+static struct ip_frag *frag_find(int domain, const struct in6_addr *src,
+                                 const struct in6_addr *dst, uint32 ident,
+                                 uint8 proto) {
+    struct ip_frag *f;
+
+    LIST_FOREACH(f, &frag_hash[frag_hashval(src, dst, ident, proto)],
+                 hashhnd) {
+        if(f->ident == ident && f->proto == proto && f->domain == domain &&
+           !memcmp(&f->src, src, sizeof(struct in6_addr)) &&
+           !memcmp(&f->dst, dst, sizeof(struct in6_addr)))
+            return f;
+    }
+
+    return NULL;
+}
+
+static struct ip_frag *frag_new(int domain, const struct in6_addr *src,
+                                const struct in6_addr *dst, uint32 ident,
+                                uint8 proto, int size) {
+    struct ip_frag *f;
+    uint32 mem = sizeof(struct ip_frag) + FRAG_HDR_MAX + size;
+
+    if(frag_reserve(mem, NULL) < 0)
+        return NULL;
+
+    if(!(f = (struct ip_frag *)malloc(mem)))
+        return NULL;
+
+    f->domain = domain;
+    f->src = *src;
+    f->dst = *dst;
+    f->ident = ident;
+    f->proto = proto;
+    f->hdrlen = 0;
+    f->size = size;
+    f->high = 0;
+    f->total_length = 0;
+    f->mem = mem;
+    f->death_time = timer_ms_gettime64() + params.timeout;
+    memset(f->bitfield, 0, sizeof(f->bitfield));
+
+    TAILQ_INSERT_TAIL(&frags, f, listhnd);
+    LIST_INSERT_HEAD(&frag_hash[frag_hashval(src, dst, ident, proto)], f,
+                     hashhnd);
+    frag_stats.mem_used += mem;
+
+    if(frag_stats.mem_used > frag_stats.mem_peak)
+        frag_stats.mem_peak = frag_stats.mem_used;
+
+    return f;
+}
+
+/* Give a datagram more room, when our guess at its size was too small. This
+   keeps its place in line for eviction. Returns the (possibly moved) datagram,
+   or NULL if it couldn't be grown (in which case it's been thrown out). */
+static struct ip_frag *frag_grow(struct ip_frag *f, int size) {
+    struct ip_frag *n, *next;
+    uint32 mem = sizeof(struct ip_frag) + FRAG_HDR_MAX + size;
+
+    if(frag_reserve(mem - f->mem, f) < 0) {
+        frag_remove(f);
+        free(f);
+        return NULL;
+    }
+
+    next = TAILQ_NEXT(f, listhnd);
+    frag_remove(f);
+
+    if(!(n = (struct ip_frag *)realloc(f, mem))) {
+        free(f);
+        return NULL;
+    }
+
+    if(next)
+        TAILQ_INSERT_BEFORE(next, n, listhnd);
+    else
+        TAILQ_INSERT_TAIL(&frags, n, listhnd);
+
+    LIST_INSERT_HEAD(&frag_hash[frag_hashval(&n->src, &n->dst, n->ident,
+                                             n->proto)], n, hashhnd);
+    n->size = size;
+    n->mem = mem;
+    frag_stats.mem_used += mem;
+
+    if(frag_stats.mem_used > frag_stats.mem_peak)
+        frag_stats.mem_peak = frag_stats.mem_used;
+
+    return n;
+}
+
 /* IP fragment "thread" -- this thread is set up to delete fragments for which
    the "death_time" has passed. This is run approximately once every two
    seconds (since death_time is always on the order of seconds). */
@@ -54,16 +244,16 @@ static void frag_thd_cb(void *data __attribute__((unused))) {
     mutex_lock(&frag_mutex);
 
     /* Look at each fragment item, and see if the timer has expired. If so,
-       remvoe it. */
+       remove it. */
     f = TAILQ_FIRST(&frags);
 
     while(f) {
         n = TAILQ_NEXT(f, listhnd);
 
         if(f->death_time < now) {
-            TAILQ_REMOVE(&frags, f, listhnd);
-            free(f->data);
+            frag_remove(f);
             free(f);
+            ++frag_stats.pkt_timeout;
         }
 
         f = n;
@@ -74,33 +264,22 @@ static void frag_thd_cb(void *data __attribute__((unused))) {
 
 /* Set the bits in the bitfield for the given set of fragment blocks. */
 static inline void set_bits(uint8 *bitfield, int start, int end) {
-    /* Use a slightly more efficient method when dealing with an end that is not
-       in the same byte as the start. */
-    if((end >> 3) > (start >> 3)) {
-        int bits = start & 0x07;
-
-        /* Finish off anything in the start byte... */
-        while(bits && bits < 8) {
-            bitfield[start >> 3] |= (1 << bits);
-            ++bits;
-        }
-
-        /* ...and the start of the end byte. */
-        bits = end & 0x07;
-        bitfield[end >> 3] |= (1 << bits) - 1;
+    /* Finish off anything before the first whole byte... */
+    while(start < end && (start & 0x07)) {
+        bitfield[start >> 3] |= (1 << (start & 0x07));
+        ++start;
+    }
 
-        /* Now, fill anything in in the middle. */
-        bits = (end >> 3) - ((start + 1) >> 3);
-        memset(bitfield + ((start + 1) >> 3), 0xFF, bits);
+    /* ...fill in the whole bytes in the middle... */
+    if(end - start >= 8) {
+        memset(bitfield + (start >> 3), 0xFF, (end - start) >> 3);
+        start += (end - start) & ~0x07;
     }
-    /* Fall back to brute-forcing it for when the two are in the same byte. */
-    else {
-        --end;
 
-        while(end >= start) {
-            bitfield[end >> 3] |= (1 << (end & 0x07));
-            --end;
-        }
+    /* ...and then anything left in the last byte. */
+    while(start < end) {
+        bitfield[start >> 3] |= (1 << (start & 0x07));
+        ++start;
     }
 }
 
@@ -116,81 +295,171 @@ static inline int all_bits_set(const uint8 *bitfield, int end) {
     }
 
     /* Check the last byte to make sure it has the right number of bits set. */
-    if(bitfield[(end >> 3)] != ((1 << (end & 0x07)) - 1)) {
+    if((end & 0x07) &&
+       bitfield[(end >> 3)] != ((1 << (end & 0x07)) - 1)) {
         return 0;
     }
 
     return 1;
 }
 
-/* Import the data for a fragment, potentially passing it onward in processing,
-   if the whole datagram has arrived. */
-static int frag_import(netif_t *src, const ip_hdr_t *hdr, const uint8 *data,
-                       size_t size, uint16 flags, struct ip_frag *frag) {
-    void *tmp;
-    int fo = flags & 0x1FFF;
-    int tl = ntohs(hdr->length);
-    int start = (fo << 3);
-    int ihl = (hdr->version_ihl & 0x0F) << 2;
-    int end = start + tl - ihl;
-    int rv = 0;
-    uint64 now = timer_ms_gettime64();
+/* Put the header back together and send the datagram on its way. The data
+   lives in our own buffer now, so there's no packet buffer to pass along. */
+static int frag_deliver(netif_t *src, struct ip_frag *f) {
+    uint8 *data = FRAG_DATA(f);
+    ip_hdr_t *ip;
+    ipv6_hdr_t *ip6;
 
-    (void)size;
+    if(f->domain == AF_INET) {
+        /* Set the right length. Don't worry about updating the checksum, since
+           net_ipv4_input_proto doesn't check it anyway. */
+        ip = (ip_hdr_t *)(data - f->hdrlen);
+        ip->length = htons(f->total_length + f->hdrlen);
+        ip->flags_frag_offs = 0;
+
+        return net_ipv4_input_proto(src, ip, data, NULL);
+    }
+    else {
+        ip6 = (ipv6_hdr_t *)(data - f->hdrlen);
+        ip6->length = htons(f->total_length);
+        ip6->next_header = f->proto;
+
+        return net_ipv6_input_proto(src, ip6, data, NULL);
+    }
+}
+
+/* Add a fragment to the datagram it belongs to, starting a new one if need be,
+   and pass the datagram along if it's all here. The offset and length of the
+   fragment are in bytes. The mutex must be locked, and is unlocked when this
+   returns. */
+static int frag_import(netif_t *src, int domain, const struct in6_addr *saddr,
+                       const struct in6_addr *daddr, uint32 ident, uint8 proto,
+                       const void *hdr, int hdrlen, const uint8 *data,
+                       int start, int len, int more) {
+    struct ip_frag *f;
+    int end = start + len, size, rv;
+
+    ++frag_stats.frag_recv;
 
-    /* Reallocate space for the data buffer, if needed. */
-    if(end > frag->cur_length) {
-        tmp = realloc(frag->data, end);
+    /* Every fragment but the last has to be a multiple of 8 bytes long, and
+       none of them can go past what an IP datagram can hold (or what we're
+       willing to put back together). */
+    if((more && (len & 7)) || (more && !len) || end > (int)params.max_size) {
+        errno = EMSGSIZE;
+        goto drop;
+    }
+
+    if(!(f = frag_find(domain, saddr, daddr, ident, proto))) {
+        /* If this is the last fragment, we know exactly how big it is.
+           Otherwise, make a guess. */
+        if(more) {
+            size = len * FRAG_GUESS;
+
+            if(size < end)
+                size = end;
+
+            if(size > (int)params.max_size)
+                size = (int)params.max_size;
+        }
+        else {
+            size = end;
+        }
 
-        if(!tmp) {
+        if(!(f = frag_new(domain, saddr, daddr, ident, proto, size))) {
             errno = ENOMEM;
-            rv = -1;
-            goto out;
+            goto drop;
         }
+    }
+
+    /* Make sure this agrees with what we already know about the length. */
+    if(f->total_length && (end > f->total_length ||
+                           (!more && end != f->total_length)))
+        goto drop_all;
+    else if(!more && end < f->high)
+        goto drop_all;
+
+    if(end > f->size) {
+        size = end;
 
-        frag->data = tmp;
+        if(more) {
+            size = f->size << 1;
+
+            if(size < end)
+                size = end;
+
+            if(size > (int)params.max_size)
+                size = (int)params.max_size;
+        }
+
+        if(!(f = frag_grow(f, size))) {
+            errno = ENOMEM;
+            goto drop;
+        }
     }
 
-    memcpy(frag->data + start, data, end - start);
-    set_bits(frag->bitfield, fo, fo + (((tl - ihl) + 7) >> 3));
+    memcpy(FRAG_DATA(f) + start, data, len);
+    set_bits(f->bitfield, start >> 3, (end + 7) >> 3);
+
+    if(end > f->high)
+        f->high = end;
 
     /* If the MF flag is not set, set the data length. */
-    if(!(flags & 0x2000)) {
-        frag->total_length = end;
-    }
+    if(!more)
+        f->total_length = end;
 
     /* If the fragment offset is zero, store the header. */
-    if(!fo) {
-        frag->hdr = *hdr;
+    if(!start) {
+        f->hdrlen = hdrlen;
+        memcpy(FRAG_DATA(f) - hdrlen, hdr, hdrlen);
     }
 
     /* If the total length is not zero, and all the bits in the bitfield are
        set, we continue on. */
-    if(frag->total_length &&
-            all_bits_set(frag->bitfield, frag->total_length >> 3)) {
-        /* Set the right length. Don't worry about updating the checksum, since
-           net_ipv4_input_proto doesn't check it anyway. */
-        frag->hdr.length = htons(frag->total_length +
-                                 ((frag->hdr.version_ihl & 0x0F) << 2));
-
-        rv = net_ipv4_input_proto(src, &frag->hdr, frag->data);
+    if(f->total_length &&
+       all_bits_set(f->bitfield, (f->total_length + 7) >> 3)) {
+        frag_remove(f);
+        ++frag_stats.pkt_reassembled;
+        mutex_unlock(&frag_mutex);
 
-        /* Remove the fragment from our buffer. */
-        TAILQ_REMOVE(&frags, frag, listhnd);
-        free(frag->data);
-        free(frag);
+        rv = frag_deliver(src, f);
+        free(f);
 
-        goto out;
+        return rv;
     }
 
-    /* Update the timer. */
-    frag->death_time = MAX(frag->death_time, (now + hdr->ttl * 1000));
+    mutex_unlock(&frag_mutex);
+    return 0;
 
-out:
+drop_all:
+    /* The fragments don't agree with each other, so none of them can be
+       trusted. */
+    frag_remove(f);
+    free(f);
+    ++frag_stats.pkt_bad;
+    errno = EINVAL;
+drop:
+    ++frag_stats.frag_dropped;
     mutex_unlock(&frag_mutex);
-    return rv;
+    return -1;
 }
 
+/* This is usually called inside an interrupt, so try to safely lock the mutex,
+   and bail if we can't. */
+static int frag_lock(void) {
+    if(irq_inside_int()) {
+        if(mutex_trylock(&frag_mutex) == -1) {
+            errno = EWOULDBLOCK;
+            return -1;
+        }
+    }
+    else {
+        mutex_lock(&frag_mutex);
+    }
+
+    return 0;
+}
+
+
 /* IPv4 fragmentation procedure. This is basically a direct implementation of
    the example IP fragmentation procedure on pages 26-27 of RFC 791. */
 int net_ipv4_frag_send(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
@@ -199,11 +468,21 @@ int net_ipv4_frag_send(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
     int total = size + ihl;
     uint16 flags = ntohs(hdr->flags_frag_offs);
     ip_hdr_t newhdr;
+    uint16 len;
     int nfb, ds;
 
-    if(net == NULL)
+    if((ntohl(hdr->dest) >> 24) == 0x7F && net_loop_dev)
+        net = net_loop_dev;
+
+    if(net == NULL) {
         net = net_default_dev;
 
+        if(!net) {
+            errno = ENETDOWN;
+            return -1;
+        }
+    }
+
     /* If the packet doesn't need to be fragmented, send it away as is. */
     if(total < net->mtu) {
         return net_ipv4_send_packet(net, hdr, data, size);
@@ -221,9 +500,12 @@ int net_ipv4_frag_send(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
     newhdr.flags_frag_offs = htons(flags | 0x2000);
     newhdr.length = htons(ihl + ds);
 
-    /* Recompute the checksum. */
-    newhdr.checksum = 0;
-    newhdr.checksum = net_ipv4_checksum((uint8 *)&newhdr, sizeof(ip_hdr_t), 0);
+    /* Update the checksum for the two fields we changed. */
+    newhdr.checksum = net_ipv4_checksum_update(hdr->checksum,
+                                               hdr->flags_frag_offs,
+                                               newhdr.flags_frag_offs);
+    newhdr.checksum = net_ipv4_checksum_update(newhdr.checksum, hdr->length,
+                                               newhdr.length);
 
     if(net_ipv4_send_packet(net, &newhdr, data, ds)) {
         return -1;
@@ -232,76 +514,128 @@ int net_ipv4_frag_send(netif_t *net, ip_hdr_t *hdr, const uint8 *data,
     /* We don't deal with options right now, so dealing with the rest of the
        fragments is pretty easy. Fix the header, and recursively call this
        function to finish things off. */
-    hdr->length = htons(ihl + size - ds);
-    hdr->flags_frag_offs = htons((flags & 0xE000) | ((flags & 0x1FFF) + nfb));
-    hdr->checksum = 0;
-    hdr->checksum = net_ipv4_checksum((uint8 *)hdr, sizeof(ip_hdr_t), 0);
+    len = htons(ihl + size - ds);
+    hdr->checksum = net_ipv4_checksum_update(hdr->checksum, hdr->length, len);
+    hdr->length = len;
+
+    len = htons((flags & 0xE000) | ((flags & 0x1FFF) + nfb));
+    hdr->checksum = net_ipv4_checksum_update(hdr->checksum,
+                                             hdr->flags_frag_offs, len);
+    hdr->flags_frag_offs = len;
 
     return net_ipv4_frag_send(net, hdr, data + ds, size - ds);
 }
 
+
 /* IPv4 fragment reassembly procedure. This (along with the frag_import function
-   above are basically a direct implementation of the example IP reassembly
+   above) started out as a direct implementation of the example IP reassembly
    routine on pages 27-29 of RFC 791. */
 int net_ipv4_reassemble(netif_t *src, const ip_hdr_t *hdr, const uint8 *data,
-                        size_t size) {
+                        size_t size, net_pbuf_t *pbuf) {
     uint16 flags = ntohs(hdr->flags_frag_offs);
-    struct ip_frag *f;
+    struct in6_addr saddr, daddr;
+    int hdrlen = (hdr->version_ihl & 0x0F) << 2;
 
     /* If the fragment offset is zero and the MF flag is 0, this is the whole
        packet. Treat it as such. */
     if(!(flags & 0x2000) && (flags & 0x1FFF) == 0) {
-        return net_ipv4_input_proto(src, hdr, data);
+        return net_ipv4_input_proto(src, hdr, data, pbuf);
     }
 
-    /* This is usually called inside an interrupt, so try to safely lock the
-       mutex, and bail if we can't. */
-    if(irq_inside_int()) {
-        if(mutex_trylock(&frag_mutex) == -1) {
-            errno = EWOULDBLOCK;
-            return -1;
-        }
-    }
-    else {
-        mutex_lock(&frag_mutex);
+    if(hdrlen > FRAG_HDR_MAX) {
+        errno = EMSGSIZE;
+        return -1;
     }
 
-    /* Find the packet if we already have this one in our data buffer. */
-    TAILQ_FOREACH(f, &frags, listhnd) {
-        if(f->src == hdr->src && f->dst == hdr->dest &&
-           f->ident == hdr->packet_id && f->proto == hdr->protocol) {
-            /* We've got it, import the data (this function handles unlocking
-               the mutex when its done). */
-            return frag_import(src, hdr, data, size, flags, f);
-        }
+    /* Key everything on IPv4-mapped addresses, so IPv4 and IPv6 can share. */
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.s6_addr[10] = saddr.s6_addr[11] = 0xFF;
+    daddr = saddr;
+    memcpy(&saddr.s6_addr[12], &hdr->src, 4);
+    memcpy(&daddr.s6_addr[12], &hdr->dest, 4);
+
+    if(frag_lock())
+        return -1;
+
+    return frag_import(src, AF_INET, &saddr, &daddr, hdr->packet_id,
+                       hdr->protocol, hdr, hdrlen, data, (flags & 0x1FFF) << 3,
+                       (int)size, flags & 0x2000);
+}
+
+/* IPv6 fragments. The fragment header is right after the IPv6 header, and
+   size covers it and everything after it. */
+int net_ipv6_reassemble(netif_t *src, const ipv6_hdr_t *hdr, const uint8 *data,
+                        size_t size) {
+    const ipv6_frag_hdr_t *fh = (const ipv6_frag_hdr_t *)data;
+    struct in6_addr saddr, daddr;
+    uint16 offs;
+    uint32 ident;
+
+    if(size < sizeof(ipv6_frag_hdr_t)) {
+        errno = EMSGSIZE;
+        return -1;
     }
 
-    /* We don't have a fragment with that identifier, so make one. */
-    f = (struct ip_frag *)malloc(sizeof(struct ip_frag));
+    /* The addresses in the packet aren't necessarily aligned, so copy them
+       out before doing anything with them. An "atomic" fragment (one with an
+       offset of zero and no more after it) goes through here like any other,
+       and just comes right back out. */
+    offs = ntohs(fh->offs_flags);
+    memcpy(&ident, &fh->ident, 4);
+    memcpy(&saddr, &hdr->src_addr, sizeof(saddr));
+    memcpy(&daddr, &hdr->dst_addr, sizeof(daddr));
+
+    if(frag_lock())
+        return -1;
+
+    return frag_import(src, AF_INET6, &saddr, &daddr, ident,
+                       fh->next_header, hdr, sizeof(ipv6_hdr_t),
+                       data + sizeof(ipv6_frag_hdr_t), offs & 0xFFF8,
+                       (int)(size - sizeof(ipv6_frag_hdr_t)), offs & 0x0001);
+}
+
+int net_frag_set_params(const net_frag_params_t *p) {
+    net_frag_params_t tmp;
+
+    tmp.max_mem = p->max_mem ? p->max_mem : FRAG_MAX_MEM;
+    tmp.max_size = p->max_size ? p->max_size : FRAG_MAX_SIZE;
+    tmp.timeout = p->timeout ? p->timeout : FRAG_TIMEOUT;
 
-    if(!f) {
-        errno = ENOMEM;
+    if(tmp.max_size > FRAG_DATA_MAX) {
+        errno = EINVAL;
         return -1;
     }
 
-    f->src = hdr->src;
-    f->dst = hdr->dest;
-    f->ident = hdr->packet_id;
-    f->proto = hdr->protocol;
-    f->data = NULL;
-    f->cur_length = 0;
-    f->total_length = 0;
-    memset(f->bitfield, 0, sizeof(f->bitfield));
+    mutex_lock(&frag_mutex);
+    params = tmp;
 
-    TAILQ_INSERT_TAIL(&frags, f, listhnd);
+    /* Get back under the new budget, if it's smaller. */
+    frag_reserve(0, NULL);
+    mutex_unlock(&frag_mutex);
+
+    return 0;
+}
+
+void net_frag_get_params(net_frag_params_t *p) {
+    mutex_lock(&frag_mutex);
+    *p = params;
+    mutex_unlock(&frag_mutex);
+}
 
-    return frag_import(src, hdr, data, size, flags, f);
+net_frag_stats_t net_frag_get_stats(void) {
+    return frag_stats;
 }
 
 int net_ipv4_frag_init(void) {
+    int i;
+
     if(!initted) {
         cbid = net_thd_add_callback(&frag_thd_cb, NULL, 2000);
         TAILQ_INIT(&frags);
+
+        for(i = 0; i < FRAG_HASH_SIZE; ++i) {
+            LIST_INIT(&frag_hash[i]);
+        }
     }
 
     initted = 1;
@@ -310,6 +644,7 @@ int net_ipv4_frag_init(void) {
 
 void net_ipv4_frag_shutdown(void) {
     struct ip_frag *c, *n;
+    int i;
 
     if(initted) {
         if(cbid != -1)
@@ -319,8 +654,7 @@ void net_ipv4_frag_shutdown(void) {
 
         while(c) {
             n = TAILQ_NEXT(c, listhnd);
-            free(c->data);
-            free(c->bitfield);
+            free(c);
             c = n;
         }
     }
@@ -328,4 +662,10 @@ void net_ipv4_frag_shutdown(void) {
     cbid = -1;
     initted = 0;
     TAILQ_INIT(&frags);
+
+    for(i = 0; i < FRAG_HASH_SIZE; ++i) {
+        LIST_INIT(&frag_hash[i]);
+    }
+
+    frag_stats.mem_used = 0;
 }
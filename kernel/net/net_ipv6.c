@@ -54,14 +54,20 @@ static int is_in_network(netif_t *net, const struct in6_addr *ip) {
     return 0;
 }
 
-/* Send a packet on the specified network adapter */
-int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
-                         size_t data_size) {
-    uint8 pkt[data_size + sizeof(ipv6_hdr_t) + sizeof(eth_hdr_t)];
+/* Send a packet on the specified network adapter. As with IPv4, the headers
+   are prepended into the headroom of the buffer and removed again before we
+   return. */
+int net_ipv6_send_packet_pbuf(netif_t *net, ipv6_hdr_t *hdr, net_pbuf_t *p) {
     uint8 dst_mac[6];
     int err;
     struct in6_addr dst = hdr->dst_addr;
+    size_t pushed;
     eth_hdr_t *ehdr;
+    ipv6_hdr_t *iph;
+
+    /* Packets to loopback go out on the loopback device. */
+    if(IN6_IS_ADDR_LOOPBACK(&hdr->dst_addr) && net_loop_dev)
+        net = net_loop_dev;
 
     if(!net) {
         net = net_default_dev;
@@ -72,26 +78,8 @@ int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
         }
     }
 
-    /* Are we sending a packet to loopback? */
-    if(IN6_IS_ADDR_LOOPBACK(&hdr->dst_addr)) {
-        memcpy(pkt, hdr, sizeof(ipv6_hdr_t));
-        memcpy(pkt + sizeof(ipv6_hdr_t), data, data_size);
-
-        ++ipv6_stats.pkt_sent;
-
-        /* Send the packet "away" */
-        net_ipv6_input(NULL, pkt, sizeof(ipv6_hdr_t) + data_size, NULL);
-        return 0;
-    }
-    else if(net->flags & NETIF_NOETH) {
-        memcpy(pkt, hdr, sizeof(ipv6_hdr_t));
-        memcpy(pkt + sizeof(ipv6_hdr_t), data, data_size);
-
-        ++ipv6_stats.pkt_sent;
-
-        /* Send the packet away */
-        return net->if_tx(net, pkt, sizeof(ipv6_hdr_t) + data_size,
-                          NETIF_BLOCK);
+    if(net->flags & NETIF_NOETH) {
+        /* Nothing to look up. */
     }
     else if(IN6_IS_ADDR_MULTICAST(&hdr->dst_addr)) {
         dst_mac[0] = dst_mac[1] = 0x33;
@@ -105,7 +93,7 @@ int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
             dst = net->ip6_gateway;
         }
 
-        err = net_ndp_lookup(net, &dst, dst_mac, hdr, data, data_size);
+        err = net_ndp_lookup_pbuf(net, &dst, dst_mac, hdr, p);
 
         if(err == -1) {
             errno = ENETUNREACH;
@@ -117,31 +105,85 @@ int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
         }
     }
 
-    /* Fill in the ethernet header */
-    ehdr = (eth_hdr_t *)pkt;
-    memcpy(ehdr->dest, dst_mac, 6);
-    memcpy(ehdr->src, net->mac_addr, 6);
-    ehdr->type[0] = 0x86;
-    ehdr->type[1] = 0xDD;
+    /* Put the IP header in front of the data */
+    if(!(iph = (ipv6_hdr_t *)net_pbuf_push(p, sizeof(ipv6_hdr_t)))) {
+        errno = ENOBUFS;
+        ++ipv6_stats.pkt_send_failed;
+        return -1;
+    }
+
+    memcpy(iph, hdr, sizeof(ipv6_hdr_t));
+    pushed = sizeof(ipv6_hdr_t);
+
+    /* Fill in the ethernet header, if this device needs one */
+    if(!(net->flags & NETIF_NOETH)) {
+        if(!(ehdr = (eth_hdr_t *)net_pbuf_push(p, sizeof(eth_hdr_t)))) {
+            net_pbuf_pull(p, pushed);
+            errno = ENOBUFS;
+            ++ipv6_stats.pkt_send_failed;
+            return -1;
+        }
 
-    /* Put the IP header / data into our ethernet packet */
-    memcpy(pkt + sizeof(eth_hdr_t), hdr, sizeof(ipv6_hdr_t));
-    memcpy(pkt + sizeof(eth_hdr_t) + sizeof(ipv6_hdr_t), data, data_size);
+        memcpy(ehdr->dest, dst_mac, 6);
+        memcpy(ehdr->src, net->mac_addr, 6);
+        ehdr->type[0] = 0x86;
+        ehdr->type[1] = 0xDD;
+        pushed += sizeof(eth_hdr_t);
+    }
 
     ++ipv6_stats.pkt_sent;
 
     /* Send it away */
-    net->if_tx(net, pkt, sizeof(ipv6_hdr_t) + data_size + sizeof(eth_hdr_t),
-               NETIF_BLOCK);
+    err = net_pbuf_tx(net, p, NETIF_BLOCK);
+    net_pbuf_pull(p, pushed);
 
-    return 0;
+    return (net->flags & NETIF_NOETH) ? err : 0;
+}
+
+int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
+                         size_t data_size) {
+    net_pbuf_t *p;
+    int rv;
+
+    if(!(p = net_pbuf_alloc(NET_PBUF_HEADROOM, data_size))) {
+        errno = ENOBUFS;
+        ++ipv6_stats.pkt_send_failed;
+        return -1;
+    }
+
+    memcpy(p->data, data, data_size);
+    rv = net_ipv6_send_packet_pbuf(net, hdr, p);
+    net_pbuf_free(p);
+
+    return rv;
 }
 
 int net_ipv6_send(netif_t *net, const uint8 *data, size_t data_size,
                   int hop_limit, int proto, const struct in6_addr *src,
                   const struct in6_addr *dst) {
+    net_pbuf_t *p;
+    int rv;
+
+    if(!(p = net_pbuf_alloc(NET_PBUF_HEADROOM, data_size))) {
+        errno = ENOBUFS;
+        ++ipv6_stats.pkt_send_failed;
+        return -1;
+    }
+
+    memcpy(p->data, data, data_size);
+    rv = net_ipv6_send_pbuf(net, p, hop_limit, proto, src, dst);
+    net_pbuf_free(p);
+
+    return rv;
+}
+
+int net_ipv6_send_pbuf(netif_t *net, net_pbuf_t *p, int hop_limit, int proto,
+                       const struct in6_addr *src, const struct in6_addr *dst) {
     ipv6_hdr_t hdr;
 
+    if(net_loop_dev && net_loop_addr(dst))
+        net = net_loop_dev;
+
     if(!net) {
         net = net_default_dev;
 
@@ -165,9 +207,9 @@ int net_ipv6_send(netif_t *net, const uint8 *data, size_t data_size,
        send function to do the rest. Note that only V4-mapped addresses are
        supported here (::ffff:x.y.z.w) */
     if(IN6_IS_ADDR_V4MAPPED(src) && IN6_IS_ADDR_V4MAPPED(dst)) {
-        return net_ipv4_send(net, data, data_size, -1, hop_limit, proto,
-                             src->__s6_addr.__s6_addr32[3],
-                             dst->__s6_addr.__s6_addr32[3]);
+        return net_ipv4_send_pbuf(net, p, -1, hop_limit, proto,
+                                  src->__s6_addr.__s6_addr32[3],
+                                  dst->__s6_addr.__s6_addr32[3]);
     }
     else if(IN6_IS_ADDR_V4MAPPED(src) || IN6_IS_ADDR_V4MAPPED(dst) ||
             IN6_IS_ADDR_V4COMPAT(src) || IN6_IS_ADDR_V4COMPAT(dst)) {
@@ -177,23 +219,20 @@ int net_ipv6_send(netif_t *net, const uint8 *data, size_t data_size,
     hdr.version_lclass = 0x60;
     hdr.hclass_lflow = 0;
     hdr.lclass = 0;
-    hdr.length = ntohs(data_size);
+    hdr.length = ntohs(p->tot_len);
     hdr.next_header = proto;
     hdr.hop_limit = hop_limit;
     hdr.src_addr = *src;
     hdr.dst_addr = *dst;
 
     /* XXXX: Handle fragmentation... */
-    return net_ipv6_send_packet(net, &hdr, data, data_size);
+    return net_ipv6_send_packet_pbuf(net, &hdr, p);
 }
 
 int net_ipv6_input(netif_t *src, const uint8 *pkt, size_t pktsize,
-                   const eth_hdr_t *eth) {
+                   const eth_hdr_t *eth, net_pbuf_t *pbuf) {
     ipv6_hdr_t *ip;
-    uint8 next_hdr;
-    //int pos;
     size_t len;
-    int rv;
 
     if(pktsize < sizeof(ipv6_hdr_t)) {
         /* This is obviously a bad packet, drop it */
@@ -211,21 +250,30 @@ int net_ipv6_input(netif_t *src, const uint8 *pkt, size_t pktsize,
         return -1;
     }
 
-    /* Parse the header to find the payload */
-    //pos = sizeof(ipv6_hdr_t); // Currently unused, but will be needed later.
-    next_hdr = ip->next_header;
-
     if(eth)
         net_ndp_insert(src, eth->src, &ip->src_addr, 1);
 
-    /* XXXX: Parse options and deal with fragmentation */
+    /* Fragments get put back together first, and then come back through
+       net_ipv6_input_proto() once they're all here. */
+    if(ip->next_header == IPV6_HDR_EXT_FRAGMENT)
+        return net_ipv6_reassemble(src, ip, pkt + sizeof(ipv6_hdr_t), len);
+
+    return net_ipv6_input_proto(src, ip, pkt + sizeof(ipv6_hdr_t), pbuf);
+}
+
+int net_ipv6_input_proto(netif_t *src, ipv6_hdr_t *ip, const uint8 *data,
+                         net_pbuf_t *pbuf) {
+    uint8 next_hdr = ip->next_header;
+    size_t len = ntohs(ip->length);
+    int rv;
+
+    /* XXXX: Parse options */
     switch(next_hdr) {
         case IPV6_HDR_ICMP:
-            return net_icmp6_input(src, ip, pkt + sizeof(ipv6_hdr_t), len);
+            return net_icmp6_input(src, ip, data, len);
 
         default:
-            rv = fs_socket_input(src, AF_INET6, next_hdr, pkt,
-                                 pkt + sizeof(ipv6_hdr_t), len);
+            rv = fs_socket_input(src, AF_INET6, next_hdr, ip, data, len, pbuf);
 
             if(rv == -2) {
                 /* We don't know what to do with this packet, so send an ICMPv6
@@ -233,7 +281,8 @@ int net_ipv6_input(netif_t *src, const uint8 *pkt, size_t pktsize,
                 ++ipv6_stats.pkt_recv_bad_proto;
                 return net_icmp6_send_param_prob(src,
                                                  ICMP6_PARAM_PROB_UNK_HEADER, 6,
-                                                 pkt, pktsize);
+                                                 (const uint8 *)ip,
+                                                 len + sizeof(ipv6_hdr_t));
             }
 
             ++ipv6_stats.pkt_recv;
@@ -280,11 +329,13 @@ int net_ipv6_init(void) {
 
     /* Also register for the one for our link-local address' solicited nodes
        group (which will do the same for all our other addresses too). */
-    mac[2] = 0xFF;
-    mac[3] = net_default_dev->ip6_lladdr.s6_addr[13];
-    mac[4] = net_default_dev->ip6_lladdr.s6_addr[14];
-    mac[5] = net_default_dev->ip6_lladdr.s6_addr[15];
-    net_multicast_add(mac);
+    if(net_default_dev) {
+        mac[2] = 0xFF;
+        mac[3] = net_default_dev->ip6_lladdr.s6_addr[13];
+        mac[4] = net_default_dev->ip6_lladdr.s6_addr[14];
+        mac[5] = net_default_dev->ip6_lladdr.s6_addr[15];
+        net_multicast_add(mac);
+    }
 
     return 0;
 }
@@ -296,9 +347,11 @@ void net_ipv6_shutdown(void) {
     net_multicast_del(mac);
 
     /* ... and our solicited nodes multicast group */
-    mac[2] = 0xFF;
-    mac[3] = net_default_dev->ip6_lladdr.s6_addr[13];
-    mac[4] = net_default_dev->ip6_lladdr.s6_addr[14];
-    mac[5] = net_default_dev->ip6_lladdr.s6_addr[15];
-    net_multicast_del(mac);
+    if(net_default_dev) {
+        mac[2] = 0xFF;
+        mac[3] = net_default_dev->ip6_lladdr.s6_addr[13];
+        mac[4] = net_default_dev->ip6_lladdr.s6_addr[14];
+        mac[5] = net_default_dev->ip6_lladdr.s6_addr[15];
+        net_multicast_del(mac);
+    }
 }
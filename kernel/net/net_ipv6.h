@@ -32,6 +32,13 @@ typedef struct ipv6_pseudo_hdr_s {
     uint8           next_header;
 } PACKED ipv6_pseudo_hdr_t;
 
+typedef struct ipv6_frag_hdr_s {
+    uint8       next_header;
+    uint8       reserved;
+    uint16      offs_flags;
+    uint32      ident;
+} PACKED ipv6_frag_hdr_t;
+
 #undef PACKED
 
 #define IPV6_HDR_EXT_HOP_BY_HOP     0
@@ -48,8 +55,13 @@ int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8 *data,
 int net_ipv6_send(netif_t *net, const uint8 *data, size_t data_size,
                   int hop_limit, int proto, const struct in6_addr *src,
                   const struct in6_addr *dst);
+int net_ipv6_send_packet_pbuf(netif_t *net, ipv6_hdr_t *hdr, net_pbuf_t *p);
+int net_ipv6_send_pbuf(netif_t *net, net_pbuf_t *p, int hop_limit, int proto,
+                       const struct in6_addr *src, const struct in6_addr *dst);
 int net_ipv6_input(netif_t *src, const uint8 *pkt, size_t pktsize,
-                   const eth_hdr_t *eth);
+                   const eth_hdr_t *eth, net_pbuf_t *pbuf);
+int net_ipv6_input_proto(netif_t *src, ipv6_hdr_t *ip, const uint8 *data,
+                         net_pbuf_t *pbuf);
 uint16 net_ipv6_checksum_pseudo(const struct in6_addr *src,
                                 const struct in6_addr *dst,
                                 uint32 upper_len, uint8 next_hdr);
@@ -57,6 +69,10 @@ uint16 net_ipv6_checksum_pseudo(const struct in6_addr *src,
 extern const struct in6_addr in6addr_linklocal_allnodes;
 extern const struct in6_addr in6addr_linklocal_allrouters;
 
+/* In net_ipv4_frag.c */
+int net_ipv6_reassemble(netif_t *src, const ipv6_hdr_t *hdr, const uint8 *data,
+                        size_t size);
+
 /* Init and Shutdown */
 int net_ipv6_init(void);
 void net_ipv6_shutdown(void);
@@ -0,0 +1,399 @@
+/* KallistiOS ##version##
+
+   kernel/net/net_loop.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* This file implements the loopback network device. Packets sent on it are
+   copied into packet buffers and put on a small queue, and a thread hands them
+   back to net_input() from there. Going through the queue means that a
+   protocol never gets re-entered from inside its own send path (which TCP
+   would not appreciate, since it holds the socket's lock while sending), and
+   it gives us an easy place to add delay, loss, and reordering for testing.
+
+   The queue is a ring of packets in the order they are to be delivered. Since
+   every packet gets the same delay, the delivery times in the ring never go
+   backwards, so the thread only ever has to look at the front of it. The ring
+   is protected by disabling interrupts, since things like ICMP can send from
+   inside an interrupt. */
+
+#include <errno.h>
+#include <string.h>
+
+#include <kos/net.h>
+#include <kos/thread.h>
+#include <kos/sem.h>
+#include <arch/irq.h>
+#include <arch/timer.h>
+
+/* Number of packets that can be waiting to be delivered. This needs to be a
+   power of two. */
+#define LOOP_QLEN       128
+
+/* MTU of the device. This is kept at the ethernet MTU, so that the stack
+   behaves the same on the loopback as it would on a real device (and so that
+   packets fit in the packet buffer pool). */
+#define LOOP_MTU        1500
+
+typedef struct loop_pkt {
+    net_pbuf_t *pbuf;
+    uint64 due;
+} loop_pkt_t;
+
+static loop_pkt_t loop_q[LOOP_QLEN];
+static int loop_head, loop_count;
+
+static net_loop_params_t loop_params;
+static net_loop_stats_t loop_stats;
+
+static semaphore_t loop_sem;
+static kthread_t *loop_thd;
+static volatile int loop_done;
+
+/* State for the random number generator used for loss and reordering. This
+   doesn't use rand(), since we can be called from inside an interrupt. */
+static uint32 loop_rand_state = 0x2545F491;
+
+static struct in6_addr loop_ip6 = IN6ADDR_LOOPBACK_INIT;
+
+netif_t *net_loop_dev = NULL;
+
+static netif_t loop_if;
+
+static int loop_chance(uint32 chance) {
+    uint32 x = loop_rand_state;
+
+    if(!chance)
+        return 0;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    loop_rand_state = x;
+
+    return (x % 1000) < chance;
+}
+
+static void *loop_thread(void *data) {
+    net_pbuf_t *p;
+    uint64 now;
+    int old, wait;
+
+    (void)data;
+
+    while(!loop_done) {
+        p = NULL;
+        wait = 0;
+
+        old = irq_disable();
+
+        if(loop_count) {
+            now = timer_us_gettime64();
+
+            if(loop_q[loop_head].due <= now) {
+                p = loop_q[loop_head].pbuf;
+                loop_head = (loop_head + 1) & (LOOP_QLEN - 1);
+                --loop_count;
+            }
+            else {
+                wait = (int)((loop_q[loop_head].due - now + 999) / 1000);
+            }
+        }
+
+        irq_restore(old);
+
+        if(p) {
+            ++loop_stats.pkt_delivered;
+            net_input_pbuf(&loop_if, p);
+            net_pbuf_free(p);
+        }
+        else if(wait) {
+            sem_wait_timed(&loop_sem, wait);
+        }
+        else {
+            sem_wait(&loop_sem);
+        }
+    }
+
+    return NULL;
+}
+
+/* Put a packet on the queue. This takes over the caller's reference to the
+   packet buffer. */
+static int loop_queue(net_pbuf_t *p) {
+    uint64 due = timer_us_gettime64() + loop_params.delay;
+    loop_pkt_t tmp;
+    int old, tail, prev;
+
+    ++loop_stats.pkt_sent;
+
+    if(loop_chance(loop_params.loss)) {
+        ++loop_stats.pkt_lost;
+        net_pbuf_free(p);
+        return NETIF_TX_OK;
+    }
+
+    old = irq_disable();
+
+    if(loop_count == LOOP_QLEN || loop_done) {
+        irq_restore(old);
+        ++loop_stats.pkt_dropped;
+        net_pbuf_free(p);
+        return NETIF_TX_OK;
+    }
+
+    tail = (loop_head + loop_count) & (LOOP_QLEN - 1);
+    loop_q[tail].pbuf = p;
+    loop_q[tail].due = due;
+
+    /* To reorder, swap places with the packet in front of us. That one will
+       still be due after we are, so the ring stays in delivery order. */
+    if(loop_count && loop_chance(loop_params.reorder)) {
+        prev = (tail - 1) & (LOOP_QLEN - 1);
+        tmp = loop_q[prev];
+        loop_q[prev].pbuf = p;
+        loop_q[tail] = tmp;
+        loop_q[tail].due = due;
+        ++loop_stats.pkt_reordered;
+    }
+
+    /* If the queue was empty, the thread needs a kick. Otherwise, it's already
+       waiting on something that will be due before this one. */
+    if(!loop_count++)
+        sem_signal(&loop_sem);
+
+    irq_restore(old);
+
+    return NETIF_TX_OK;
+}
+
+static int loop_if_detect(netif_t *self) {
+    self->flags |= NETIF_DETECTED;
+    return 0;
+}
+
+static int loop_if_init(netif_t *self) {
+    self->flags |= NETIF_INITIALIZED;
+    return 0;
+}
+
+static int loop_if_shutdown(netif_t *self) {
+    self->flags &= ~(NETIF_DETECTED | NETIF_INITIALIZED);
+    return 0;
+}
+
+static int loop_if_start(netif_t *self) {
+    if(self->flags & NETIF_RUNNING)
+        return 0;
+
+    loop_head = loop_count = 0;
+    loop_done = 0;
+    sem_init(&loop_sem, 0);
+
+    if(!(loop_thd = thd_create(0, loop_thread, NULL))) {
+        sem_destroy(&loop_sem);
+        return -1;
+    }
+
+    thd_set_label(loop_thd, "[net loop]");
+
+    self->flags |= NETIF_RUNNING;
+    return 0;
+}
+
+static int loop_if_stop(netif_t *self) {
+    int old;
+
+    if(!(self->flags & NETIF_RUNNING))
+        return 0;
+
+    loop_done = 1;
+    sem_signal(&loop_sem);
+    thd_join(loop_thd, NULL);
+    sem_destroy(&loop_sem);
+    loop_thd = NULL;
+
+    /* Throw away anything that didn't make it back in. */
+    old = irq_disable();
+
+    while(loop_count) {
+        net_pbuf_free(loop_q[loop_head].pbuf);
+        loop_head = (loop_head + 1) & (LOOP_QLEN - 1);
+        --loop_count;
+    }
+
+    irq_restore(old);
+
+    self->flags &= ~NETIF_RUNNING;
+    return 0;
+}
+
+static int loop_if_tx(netif_t *self, const uint8 *data, int len,
+                      int blocking) {
+    net_pbuf_t *p;
+
+    (void)blocking;
+
+    if(loop_params.flags & NET_LOOP_DIRECT) {
+        ++loop_stats.pkt_sent;
+        ++loop_stats.pkt_delivered;
+        net_input(self, data, len);
+        return NETIF_TX_OK;
+    }
+
+    if(!(p = net_pbuf_alloc(0, len))) {
+        ++loop_stats.pkt_dropped;
+        return NETIF_TX_ERROR;
+    }
+
+    memcpy(p->data, data, len);
+
+    return loop_queue(p);
+}
+
+static int loop_if_tx_v(netif_t *self, const struct iovec *iov, int iovcnt,
+                        int blocking) {
+    net_pbuf_t *p;
+    size_t len = 0;
+    int i;
+
+    (void)blocking;
+
+    for(i = 0; i < iovcnt; ++i) {
+        len += iov[i].iov_len;
+    }
+
+    if(!(p = net_pbuf_alloc(0, len))) {
+        ++loop_stats.pkt_dropped;
+        return NETIF_TX_ERROR;
+    }
+
+    for(i = 0, len = 0; i < iovcnt; ++i) {
+        memcpy(p->data + len, iov[i].iov_base, iov[i].iov_len);
+        len += iov[i].iov_len;
+    }
+
+    if(loop_params.flags & NET_LOOP_DIRECT) {
+        ++loop_stats.pkt_sent;
+        ++loop_stats.pkt_delivered;
+        net_input_pbuf(self, p);
+        net_pbuf_free(p);
+        return NETIF_TX_OK;
+    }
+
+    return loop_queue(p);
+}
+
+static int loop_if_dummy(netif_t *self) {
+    (void)self;
+    return 0;
+}
+
+static int loop_if_set_flags(netif_t *self, uint32 flags_and,
+                             uint32 flags_or) {
+    self->flags = (self->flags & flags_and) | flags_or;
+    return 0;
+}
+
+static int loop_if_set_mc(netif_t *self, const uint8 *list, int count) {
+    (void)self;
+    (void)list;
+    (void)count;
+
+    /* Multicast doesn't mean anything on the loopback. */
+    return 0;
+}
+
+/* KOS Network interface. */
+static netif_t loop_if = {
+    { 0 },
+    "lo",
+    "Loopback",
+    0,                          /* index */
+    0,                          /* dev_id */
+    NETIF_NOETH,                /* flags */
+    { 0, 0, 0, 0, 0, 0 },       /* MAC address */
+    { 127, 0, 0, 1 },           /* IPv4 address */
+    { 255, 0, 0, 0 },           /* netmask */
+    { 0, 0, 0, 0 },             /* gateway */
+    { 127, 255, 255, 255 },     /* broadcast */
+    { 0, 0, 0, 0 },             /* dns */
+    LOOP_MTU,                   /* mtu */
+    IN6ADDR_LOOPBACK_INIT,      /* ip6_lladdr */
+    &loop_ip6,                  /* ip6_addrs */
+    1,                          /* ip6_addr_count */
+    IN6ADDR_ANY_INIT,           /* ip6_gateway */
+    LOOP_MTU,                   /* mtu6 */
+    255,                        /* hop_limit */
+    &loop_if_detect,            /* detect */
+    &loop_if_init,              /* init */
+    &loop_if_shutdown,          /* shutdown */
+    &loop_if_start,             /* start */
+    &loop_if_stop,              /* stop */
+    &loop_if_tx,                /* tx */
+    &loop_if_dummy,             /* tx_commit */
+    &loop_if_dummy,             /* rx_poll */
+    &loop_if_set_flags,         /* set_flags */
+    &loop_if_set_mc,            /* set_mc */
+    &loop_if_tx_v,              /* tx_v */
+    { 0 }                       /* stats */
+};
+
+int net_loop_set_params(const net_loop_params_t *params) {
+    int old;
+
+    if(params->loss > 1000 || params->reorder > 1000) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    old = irq_disable();
+    loop_params = *params;
+    irq_restore(old);
+
+    return 0;
+}
+
+void net_loop_get_params(net_loop_params_t *params) {
+    *params = loop_params;
+}
+
+net_loop_stats_t net_loop_get_stats(void) {
+    return loop_stats;
+}
+
+int net_loop_addr(const struct in6_addr *addr) {
+    if(IN6_IS_ADDR_LOOPBACK(addr))
+        return 1;
+
+    return IN6_IS_ADDR_V4MAPPED(addr) && addr->s6_addr[12] == 127;
+}
+
+int net_loop_init(void) {
+    memset(&loop_stats, 0, sizeof(loop_stats));
+
+    if(net_reg_device(&loop_if) < 0)
+        return -1;
+
+    if(loop_if.if_detect(&loop_if) < 0 || loop_if.if_init(&loop_if) < 0 ||
+       loop_if.if_start(&loop_if) < 0) {
+        net_unreg_device(&loop_if);
+        return -1;
+    }
+
+    net_loop_dev = &loop_if;
+
+    return 0;
+}
+
+void net_loop_shutdown(void) {
+    if(!net_loop_dev)
+        return;
+
+    net_loop_dev = NULL;
+
+    loop_if.if_stop(&loop_if);
+    loop_if.if_shutdown(&loop_if);
+    net_unreg_device(&loop_if);
+}
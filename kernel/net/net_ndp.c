@@ -11,72 +11,266 @@
 #include <netinet/in.h>
 #include <sys/queue.h>
 #include <kos/net.h>
+#include <kos/mutex.h>
 #include <arch/timer.h>
+#include <arch/irq.h>
 
 #include "net_ipv6.h"
 #include "net_icmp6.h"
+#include "net_thd.h"
+#include "net_wheel.h"
 
 /* This file implements the Neighbor Discovery Protocol for IPv6. Basically, NDP
    acts much like ARP does for IPv4. It is responsible for keeping track of the
    low-level addresses of other hosts on the network. Everything it does is
    through ICMPv6 packets. NDP is specified in RFC 4861. Note however, that, for
-   the time being at least, this isn't fully compliant with that spec. */
+   the time being at least, this isn't fully compliant with that spec.
+
+   The cache is a fixed size hash table of entries, each of which goes through
+   the states described in section 7.3.2 of the RFC. Entries are aged on a timer
+   wheel, so that nothing needs to sweep the whole cache to find the ones that
+   have timed out. */
+
+/* Sizes of things in the NDP cache. Just like the ARP cache, this holds a fixed
+   number of entries, found by hashing the address, and throws out the least
+   recently used entry when it fills up. */
+#define NDP_CACHE_SIZE      64
+#define NDP_HASH_BITS       6
+#define NDP_HASH_SIZE       (1 << NDP_HASH_BITS)
+
+/* Maximum number of packets held for an entry while it is being resolved. */
+#define NDP_QUEUE_LEN       3
+
+/* Maximum number of solicitations that can be sent on one run of the timers.
+   Anything past this gets sent on the next retransmission instead. */
+#define NDP_MAX_SOLS        16
+
+/* Timeouts, in milliseconds (mostly from section 10 of RFC 4861). */
+#define NDP_TICK            1000
+#define NDP_RETRANS_TIME    1000    /* RETRANS_TIMER */
+#define NDP_MAX_SOLICIT     3       /* MAX_MULTICAST/UNICAST_SOLICIT */
+#define NDP_REACHABLE_TIME  30000   /* REACHABLE_TIME */
+#define NDP_DELAY_TIME      5000    /* DELAY_FIRST_PROBE_TIME */
+#define NDP_STALE_TIME      600000  /* How long to keep unused stale entries */
 
 /* Structure describing a NDP entry. Analogous to the netarp_t for ARP. */
 typedef struct ndp_entry {
-    LIST_ENTRY(ndp_entry)   entry;
+    net_wheel_ent_t         timer;
+    LIST_ENTRY(ndp_entry)   hash;
+    TAILQ_ENTRY(ndp_entry)  lru;
+    netif_t                 *net;
     struct in6_addr         ip;
-    uint64                  last_reachable;
     int                     state;
+    int                     probes;
     uint8                   mac[6];
-    ipv6_hdr_t              *pkt;
-    uint8                   *data;
-    int                     data_size;
+    net_pbuf_t              *queue[NDP_QUEUE_LEN];
+    int                     queue_cnt;
 } ndp_entry_t;
 
 LIST_HEAD(ndp_list, ndp_entry);
-static struct ndp_list ndp_cache = LIST_HEAD_INITIALIZER(0);
+TAILQ_HEAD(ndp_lru, ndp_entry);
+
+static ndp_entry_t ndp_ents[NDP_CACHE_SIZE];
+static struct ndp_list ndp_hash[NDP_HASH_SIZE];
+static struct ndp_lru ndp_lru = TAILQ_HEAD_INITIALIZER(ndp_lru);
+static int ndp_used = 0;
+
+static net_wheel_t ndp_wheel = NET_WHEEL_INITIALIZER(NDP_TICK);
+static int ndp_cbid = -1;
+static mutex_t ndp_mutex = MUTEX_INITIALIZER;
+
+/* A solicitation to be sent once we're done with the cache. */
+struct ndp_sol {
+    netif_t *net;
+    struct in6_addr ip;
+    int unicast;
+};
+
+struct ndp_sols {
+    struct ndp_sol sol[NDP_MAX_SOLS];
+    int cnt;
+};
+
+/* List of states for the ndp entry (RFC 4861, section 7.3.2) */
+#define NDP_STATE_FREE          0
+#define NDP_STATE_INCOMPLETE    1
+#define NDP_STATE_REACHABLE     2
+#define NDP_STATE_STALE         3
+#define NDP_STATE_DELAY         4
+#define NDP_STATE_PROBE         5
+
+static int ndp_lock(void) {
+    if(irq_inside_int())
+        return mutex_trylock(&ndp_mutex);
+
+    return mutex_lock(&ndp_mutex);
+}
 
-/* List of states for the ndp entry */
-#define NDP_STATE_INCOMPLETE    0
-#define NDP_STATE_REACHABLE     1
-#define NDP_STATE_STALE         2
-#define NDP_STATE_DELAY         3
-#define NDP_STATE_PROBE         4
+static inline int ndp_hash_ip(const struct in6_addr *ip) {
+    uint32 a = ip->__s6_addr.__s6_addr32[0] ^ ip->__s6_addr.__s6_addr32[1] ^
+               ip->__s6_addr.__s6_addr32[2] ^ ip->__s6_addr.__s6_addr32[3];
 
-void net_ndp_gc(void) {
-    ndp_entry_t *i, *tmp;
-    uint64 now = timer_ms_gettime64();
+    return (a * 2654435761U) >> (32 - NDP_HASH_BITS);
+}
+
+static ndp_entry_t *ndp_find(const struct in6_addr *ip) {
+    ndp_entry_t *i;
+
+    LIST_FOREACH(i, &ndp_hash[ndp_hash_ip(ip)], hash) {
+        if(!memcmp(ip, &i->ip, sizeof(struct in6_addr)))
+            return i;
+    }
+
+    return NULL;
+}
+
+static void ndp_free(ndp_entry_t *i) {
+    int j;
+
+    net_wheel_del(&ndp_wheel, &i->timer);
+    LIST_REMOVE(i, hash);
+    TAILQ_REMOVE(&ndp_lru, i, lru);
+
+    for(j = 0; j < i->queue_cnt; ++j) {
+        net_pbuf_free(i->queue[j]);
+    }
+
+    i->queue_cnt = 0;
+    i->state = NDP_STATE_FREE;
+    --ndp_used;
+}
+
+static ndp_entry_t *ndp_alloc(netif_t *net, const struct in6_addr *ip) {
+    ndp_entry_t *i;
+    int j;
+
+    /* If we're full, throw out whatever was used least recently. */
+    if(ndp_used == NDP_CACHE_SIZE)
+        ndp_free(TAILQ_FIRST(&ndp_lru));
+
+    for(j = 0; j < NDP_CACHE_SIZE; ++j) {
+        if(ndp_ents[j].state == NDP_STATE_FREE)
+            break;
+    }
+
+    i = &ndp_ents[j];
+    memset(i, 0, sizeof(ndp_entry_t));
+    i->net = net;
+    i->ip = *ip;
+
+    LIST_INSERT_HEAD(&ndp_hash[ndp_hash_ip(ip)], i, hash);
+    TAILQ_INSERT_TAIL(&ndp_lru, i, lru);
+    ++ndp_used;
 
-    i = LIST_FIRST(&ndp_cache);
+    return i;
+}
 
-    while(i) {
-        tmp = LIST_NEXT(i, entry);
+/* Set an entry's state, and start the timer to go with it. */
+static void ndp_set_state(ndp_entry_t *i, int state, uint64 timeout) {
+    i->state = state;
+    net_wheel_add(&ndp_wheel, &i->timer, timer_ms_gettime64() + timeout);
+}
 
-        /* If we haven't gotten a reachable confirmation within 10 minutes, its
-           pretty safe to remove it. Also, remove any incomplete entries that
-           are still incomplete after a few seconds have passed. */
-        if(i->last_reachable + 600000 < now ||
-                (i->state == NDP_STATE_INCOMPLETE &&
-                 i->last_reachable + 2000 < now)) {
-            LIST_REMOVE(i, entry);
+static void ndp_add_sol(struct ndp_sols *s, ndp_entry_t *i, int unicast) {
+    if(s->cnt < NDP_MAX_SOLS) {
+        s->sol[s->cnt].net = i->net;
+        s->sol[s->cnt].ip = i->ip;
+        s->sol[s->cnt++].unicast = unicast;
+    }
+
+    ++i->probes;
+}
 
-            if(i->pkt) {
-                free(i->pkt);
-                free(i->data);
+/* Set up and send a neighbor solicitation about the specified address */
+static void net_ndp_send_sol(netif_t *net, const struct in6_addr *ip,
+                             int unicast) {
+    struct in6_addr dst = *ip;
+
+    /* Send to the solicited nodes multicast group for the specified addr,
+       unless we're checking up on an address we already know. */
+    if(!unicast) {
+        dst.s6_addr[0] = 0xFF;
+        dst.s6_addr[1] = 0x02;
+        dst.__s6_addr.__s6_addr16[1] = 0x0000;
+        dst.__s6_addr.__s6_addr16[2] = 0x0000;
+        dst.__s6_addr.__s6_addr16[3] = 0x0000;
+        dst.__s6_addr.__s6_addr16[4] = 0x0000;
+        dst.s6_addr[10] = 0x00;
+        dst.s6_addr[11] = 0x01;
+        dst.s6_addr[12] = 0xFF;
+    }
+
+    net_icmp6_send_nsol(net, &dst, ip, 0);
+}
+
+static void ndp_send_sols(const struct ndp_sols *s) {
+    int i;
+
+    for(i = 0; i < s->cnt; ++i) {
+        net_ndp_send_sol(s->sol[i].net, &s->sol[i].ip, s->sol[i].unicast);
+    }
+}
+
+/* Move an entry along when its timer goes off (RFC 4861, appendix C). */
+static void ndp_timeout(net_wheel_ent_t *t, void *data) {
+    ndp_entry_t *i = (ndp_entry_t *)t;
+    struct ndp_sols *s = (struct ndp_sols *)data;
+
+    switch(i->state) {
+        case NDP_STATE_INCOMPLETE:
+        case NDP_STATE_PROBE:
+            /* Give up on the neighbor if it hasn't answered us. */
+            if(i->probes >= NDP_MAX_SOLICIT) {
+                ndp_free(i);
+                break;
             }
 
-            free(i);
-        }
+            ndp_add_sol(s, i, i->state == NDP_STATE_PROBE);
+            ndp_set_state(i, i->state, NDP_RETRANS_TIME);
+            break;
+
+        case NDP_STATE_REACHABLE:
+            ndp_set_state(i, NDP_STATE_STALE, NDP_STALE_TIME);
+            break;
 
-        i = tmp;
+        case NDP_STATE_STALE:
+            /* Nobody has used this one in a long time, so toss it. */
+            ndp_free(i);
+            break;
+
+        case NDP_STATE_DELAY:
+            i->probes = 0;
+            ndp_add_sol(s, i, 1);
+            ndp_set_state(i, NDP_STATE_PROBE, NDP_RETRANS_TIME);
+            break;
     }
 }
 
+void net_ndp_gc(void) {
+    struct ndp_sols s;
+
+    s.cnt = 0;
+
+    if(ndp_lock() < 0)
+        return;
+
+    net_wheel_run(&ndp_wheel, timer_ms_gettime64(), &ndp_timeout, &s);
+    mutex_unlock(&ndp_mutex);
+
+    ndp_send_sols(&s);
+}
+
+static void ndp_thd_cb(void *data) {
+    (void)data;
+    net_ndp_gc();
+}
+
 int net_ndp_insert(netif_t *net, const uint8 mac[6], const struct in6_addr *ip,
                    int unsol) {
+    net_pbuf_t *queue[NDP_QUEUE_LEN];
     ndp_entry_t *i;
-    uint64 now = timer_ms_gettime64();
+    ipv6_hdr_t hdr;
+    int j, cnt;
 
     /* Don't allow any multicast or unspecified addresses to end up in the NDP
        cache... */
@@ -84,161 +278,171 @@ int net_ndp_insert(netif_t *net, const uint8 mac[6], const struct in6_addr *ip,
         return -1;
     }
 
-    /* Look through the list first to see if its there */
-    LIST_FOREACH(i, &ndp_cache, entry) {
-        if(!memcmp(ip, &i->ip, sizeof(struct in6_addr))) {
-            /* We found it, update everything */
-            if(unsol && memcmp(i->mac, mac, 6)) {
-                i->state = NDP_STATE_STALE;
-            }
-            else {
-                i->state = NDP_STATE_REACHABLE;
-            }
-
-            memcpy(i->mac, mac, 6);
-            i->last_reachable = now;
-
-            /* Send our queued packet, if we have one */
-            if(i->pkt) {
-                net_ipv6_send_packet(net, i->pkt, i->data, i->data_size);
-                free(i->pkt);
-                free(i->data);
-
-                i->pkt = NULL;
-                i->data = NULL;
-                i->data_size = 0;
-            }
+    if(ndp_lock() < 0)
+        return -1;
 
-            return 0;
+    /* Look through the cache first to see if its there */
+    if((i = ndp_find(ip))) {
+        /* We found it, update everything */
+        if(unsol && memcmp(i->mac, mac, 6)) {
+            ndp_set_state(i, NDP_STATE_STALE, NDP_STALE_TIME);
+        }
+        else {
+            ndp_set_state(i, NDP_STATE_REACHABLE, NDP_REACHABLE_TIME);
         }
     }
-
     /* No entry exists yet, so create one */
-    if(!(i = (ndp_entry_t *)malloc(sizeof(ndp_entry_t)))) {
-        return -1;
+    else {
+        i = ndp_alloc(net, ip);
+
+        if(unsol) {
+            ndp_set_state(i, NDP_STATE_STALE, NDP_STALE_TIME);
+        }
+        else {
+            ndp_set_state(i, NDP_STATE_REACHABLE, NDP_REACHABLE_TIME);
+        }
     }
 
-    memset(i, 0, sizeof(ndp_entry_t));
-    memcpy(&i->ip, ip, sizeof(struct in6_addr));
     memcpy(i->mac, mac, 6);
-    i->last_reachable = now;
+    i->net = net;
+    i->probes = 0;
 
-    if(unsol) {
-        i->state = NDP_STATE_STALE;
-    }
-    else {
-        i->state = NDP_STATE_REACHABLE;
+    /* Grab any queued packets to send once we're done with the cache */
+    if((cnt = i->queue_cnt)) {
+        memcpy(queue, i->queue, cnt * sizeof(net_pbuf_t *));
+        i->queue_cnt = 0;
     }
 
-    LIST_INSERT_HEAD(&ndp_cache, i, entry);
+    mutex_unlock(&ndp_mutex);
 
-    /* Garbage collect! */
-    net_ndp_gc();
+    /* Send our queued packets, if we have any */
+    for(j = 0; j < cnt; ++j) {
+        memcpy(&hdr, queue[j]->data, sizeof(ipv6_hdr_t));
+        net_pbuf_pull(queue[j], sizeof(ipv6_hdr_t));
+        net_ipv6_send_packet_pbuf(net, &hdr, queue[j]);
+        net_pbuf_free(queue[j]);
+    }
 
     return 0;
 }
 
-/* Set up and send a neighbor solicitation about the specified address */
-static void net_ndp_send_sol(netif_t *net, const struct in6_addr *ip) {
-    struct in6_addr dst = *ip;
+/* Hold onto a copy of a packet to send when the address is resolved. The
+   oldest packet waiting is dropped if there's no room for it. */
+static void ndp_enqueue(ndp_entry_t *i, const ipv6_hdr_t *pkt,
+                        const net_pbuf_t *p) {
+    net_pbuf_t *q;
 
-    /* Send to the solicited nodes multicast group for the specified addr */
-    dst.s6_addr[0] = 0xFF;
-    dst.s6_addr[1] = 0x02;
-    dst.__s6_addr.__s6_addr16[1] = 0x0000;
-    dst.__s6_addr.__s6_addr16[2] = 0x0000;
-    dst.__s6_addr.__s6_addr16[3] = 0x0000;
-    dst.__s6_addr.__s6_addr16[4] = 0x0000;
-    dst.s6_addr[10] = 0x00;
-    dst.s6_addr[11] = 0x01;
-    dst.s6_addr[12] = 0xFF;
+    if(!(q = net_pbuf_alloc(NET_PBUF_HEADROOM,
+                            sizeof(ipv6_hdr_t) + p->tot_len)))
+        return;
 
-    net_icmp6_send_nsol(net, &dst, ip, 0);
+    memcpy(q->data, pkt, sizeof(ipv6_hdr_t));
+    net_pbuf_copy(p, 0, q->data + sizeof(ipv6_hdr_t), p->tot_len);
+
+    if(i->queue_cnt == NDP_QUEUE_LEN) {
+        net_pbuf_free(i->queue[0]);
+        memmove(i->queue, i->queue + 1,
+                (NDP_QUEUE_LEN - 1) * sizeof(net_pbuf_t *));
+        --i->queue_cnt;
+    }
+
+    i->queue[i->queue_cnt++] = q;
 }
 
-int net_ndp_lookup(netif_t *net, const struct in6_addr *ip, uint8 mac_out[6],
-                   const ipv6_hdr_t *pkt, const uint8 *data, int data_size) {
+int net_ndp_lookup_pbuf(netif_t *net, const struct in6_addr *ip,
+                        uint8 mac_out[6], const ipv6_hdr_t *pkt,
+                        const net_pbuf_t *p) {
     ndp_entry_t *i;
-    uint64 now = timer_ms_gettime64();
+    int rv = -2;
 
-    /* Garbage collect, so we don't end up returning really stale entries */
-    net_ndp_gc();
+    if(ndp_lock() < 0)
+        return -1;
 
     /* Look for the entry */
-    LIST_FOREACH(i, &ndp_cache, entry) {
-        if(!memcmp(ip, &i->ip, sizeof(struct in6_addr))) {
-            if(i->state == NDP_STATE_INCOMPLETE) {
-                memset(mac_out, 0, 6);
-                return -1;
-            }
-            else if(i->state == NDP_STATE_STALE) {
-                net_ndp_send_sol(net, ip);
-            }
+    if((i = ndp_find(ip))) {
+        if(i->state != NDP_STATE_INCOMPLETE) {
+            /* If the entry is stale, keep using it, but check up on it if we
+               don't hear anything from the neighbor in a little while. */
+            if(i->state == NDP_STATE_STALE)
+                ndp_set_state(i, NDP_STATE_DELAY, NDP_DELAY_TIME);
+
+            TAILQ_REMOVE(&ndp_lru, i, lru);
+            TAILQ_INSERT_TAIL(&ndp_lru, i, lru);
 
             memcpy(mac_out, i->mac, 6);
+            mutex_unlock(&ndp_mutex);
             return 0;
         }
-    }
 
-    /* Its not there, add an incomplete entry and solicit the info */
-    if(!(i = (ndp_entry_t *)malloc(sizeof(ndp_entry_t)))) {
-        return -1;
-    }
+        /* Still waiting on an answer, so the packet waits along with any
+           others. */
+        if(!pkt || !p)
+            rv = -1;
+        else
+            ndp_enqueue(i, pkt, p);
 
-    memset(i, 0, sizeof(ndp_entry_t));
-    memcpy(&i->ip, ip, sizeof(struct in6_addr));
-    i->last_reachable = now;
-    i->state = NDP_STATE_INCOMPLETE;
+        mutex_unlock(&ndp_mutex);
+    }
+    else {
+        /* Its not there, add an incomplete entry and solicit the info */
+        i = ndp_alloc(net, ip);
+        i->probes = 1;
+        ndp_set_state(i, NDP_STATE_INCOMPLETE, NDP_RETRANS_TIME);
 
-    /* Copy our packet if we have one to copy. */
-    if(pkt && data && data_size) {
-        i->data = (uint8 *)malloc(data_size);
+        /* Copy our packet if we have one to copy. */
+        if(pkt && p)
+            ndp_enqueue(i, pkt, p);
 
-        if(i->data) {
-            i->pkt = (ipv6_hdr_t *)malloc(sizeof(ipv6_hdr_t));
+        mutex_unlock(&ndp_mutex);
 
-            if(!i->pkt) {
-                free(i->data);
-                i->data = NULL;
-            }
-            else {
-                memcpy(i->pkt, pkt, sizeof(ipv6_hdr_t));
-                memcpy(i->data, data, data_size);
-                i->data_size = data_size;
-            }
-        }
+        net_ndp_send_sol(net, ip, 0);
     }
 
-    LIST_INSERT_HEAD(&ndp_cache, i, entry);
+    memset(mac_out, 0, 6);
+    return rv;
+}
 
-    net_ndp_send_sol(net, ip);
+int net_ndp_lookup(netif_t *net, const struct in6_addr *ip, uint8 mac_out[6],
+                   const ipv6_hdr_t *pkt, const uint8 *data, int data_size) {
+    net_pbuf_t *p = NULL;
+    int rv;
 
-    memset(mac_out, 0, 6);
-    return -2;
+    if(pkt && data && data_size)
+        p = net_pbuf_ref(data, data_size);
+
+    rv = net_ndp_lookup_pbuf(net, ip, mac_out, p ? pkt : NULL, p);
+
+    if(p)
+        net_pbuf_free(p);
+
+    return rv;
 }
 
 int net_ndp_init(void) {
+    mutex_lock(&ndp_mutex);
+    net_wheel_init(&ndp_wheel, timer_ms_gettime64());
+    mutex_unlock(&ndp_mutex);
+
+    ndp_cbid = net_thd_add_callback(&ndp_thd_cb, NULL, NDP_TICK);
+
     return 0;
 }
 
 void net_ndp_shutdown(void) {
-    /* Free all entries */
-    ndp_entry_t *i, *tmp;
-
-    i = LIST_FIRST(&ndp_cache);
+    int i;
 
-    while(i) {
-        tmp = LIST_NEXT(i, entry);
+    if(ndp_cbid != -1) {
+        net_thd_del_callback(ndp_cbid);
+        ndp_cbid = -1;
+    }
 
-        if(i->pkt) {
-            free(i->pkt);
-            free(i->data);
-        }
+    /* Free all entries */
+    mutex_lock(&ndp_mutex);
 
-        free(i);
-        i = tmp;
+    for(i = 0; i < NDP_CACHE_SIZE; ++i) {
+        if(ndp_ents[i].state != NDP_STATE_FREE)
+            ndp_free(&ndp_ents[i]);
     }
 
-    /* Reinit the list to the clean state, in case we call net_ndp_init later */
-    LIST_INIT(&ndp_cache);
+    mutex_unlock(&ndp_mutex);
 }
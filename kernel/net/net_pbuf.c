@@ -0,0 +1,328 @@
+/* KallistiOS ##version##
+
+   kernel/net/net_pbuf.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* This file implements the packet buffers that are used to carry packet data
+   through the network stack. Most buffers come out of a small preallocated
+   pool so that they can be grabbed cheaply (and safely) from inside an
+   interrupt, and we only fall back to malloc() when the pool runs dry or when
+   someone asks for something bigger than a pool buffer can hold.
+
+   The pool is protected by disabling interrupts, rather than a mutex, since
+   both the driver receive paths and the protocol send paths need to be able to
+   get at it from any context. Everything done with interrupts disabled is a
+   few pointer updates, so this shouldn't hurt interrupt latency any. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <kos/net.h>
+#include <arch/irq.h>
+
+#include "net_capture.h"
+
+/* Number of pool buffers and the size of each. A pool buffer is large enough
+   to hold a full ethernet frame with the standard amount of headroom in front
+   of it. */
+#define PBUF_POOL_COUNT     32
+#define PBUF_POOL_BUFSZ     1664
+
+/* Number of pool buffer headers. We keep more of these than buffers, since
+   references to external data don't need any backing storage. */
+#define PBUF_HDR_COUNT      64
+
+/* Flags for the flags field of the net_pbuf_t. */
+#define PBUF_FLAG_POOLHDR   0x00000001  /* Header came from the pool */
+#define PBUF_FLAG_POOLBUF   0x00000002  /* Storage came from the pool */
+#define PBUF_FLAG_EXTERN    0x00000004  /* Storage is not owned by us */
+
+static net_pbuf_t pbuf_hdrs[PBUF_HDR_COUNT];
+static uint8 pbuf_bufs[PBUF_POOL_COUNT][PBUF_POOL_BUFSZ]
+    __attribute__((aligned(32)));
+
+/* Free lists. Free headers are linked through their next pointers, free
+   buffers through a pointer stored at the start of the buffer itself. */
+static net_pbuf_t *free_hdrs = NULL;
+static void *free_bufs = NULL;
+static int free_buf_cnt = 0;
+
+static net_pbuf_t *hdr_get(void) {
+    net_pbuf_t *p;
+    int old;
+
+    old = irq_disable();
+
+    if((p = free_hdrs))
+        free_hdrs = p->next;
+
+    irq_restore(old);
+
+    return p;
+}
+
+static void hdr_put(net_pbuf_t *p) {
+    int old;
+
+    old = irq_disable();
+    p->next = free_hdrs;
+    free_hdrs = p;
+    irq_restore(old);
+}
+
+static uint8 *buf_get(void) {
+    void *b;
+    int old;
+
+    old = irq_disable();
+
+    if((b = free_bufs)) {
+        free_bufs = *(void **)b;
+        --free_buf_cnt;
+    }
+
+    irq_restore(old);
+
+    return (uint8 *)b;
+}
+
+static void buf_put(uint8 *b) {
+    int old;
+
+    old = irq_disable();
+    *(void **)b = free_bufs;
+    free_bufs = b;
+    ++free_buf_cnt;
+    irq_restore(old);
+}
+
+net_pbuf_t *net_pbuf_alloc(size_t headroom, size_t len) {
+    net_pbuf_t *p = NULL;
+    size_t sz = headroom + len;
+    uint8 *b;
+
+    /* Try the pool first, if the request will fit in a pool buffer. */
+    if(sz <= PBUF_POOL_BUFSZ && (b = buf_get())) {
+        if((p = hdr_get())) {
+            p->buf = b;
+            p->size = PBUF_POOL_BUFSZ;
+            p->flags = PBUF_FLAG_POOLHDR | PBUF_FLAG_POOLBUF;
+        }
+        else {
+            buf_put(b);
+        }
+    }
+
+    /* If that didn't work, allocate the header and storage in one block. */
+    if(!p) {
+        if(!(p = (net_pbuf_t *)malloc(sizeof(net_pbuf_t) + sz)))
+            return NULL;
+
+        p->buf = (uint8 *)(p + 1);
+        p->size = sz;
+        p->flags = 0;
+    }
+
+    p->next = NULL;
+    p->data = p->buf + headroom;
+    p->len = p->tot_len = len;
+    p->ref = 1;
+
+    return p;
+}
+
+net_pbuf_t *net_pbuf_ref(const void *data, size_t len) {
+    net_pbuf_t *p;
+
+    if((p = hdr_get())) {
+        p->flags = PBUF_FLAG_POOLHDR | PBUF_FLAG_EXTERN;
+    }
+    else {
+        if(!(p = (net_pbuf_t *)malloc(sizeof(net_pbuf_t))))
+            return NULL;
+
+        p->flags = PBUF_FLAG_EXTERN;
+    }
+
+    p->next = NULL;
+    p->buf = p->data = (uint8 *)data;
+    p->size = p->len = p->tot_len = len;
+    p->ref = 1;
+
+    return p;
+}
+
+void net_pbuf_addref(net_pbuf_t *p) {
+    int old;
+
+    old = irq_disable();
+    ++p->ref;
+    irq_restore(old);
+}
+
+void net_pbuf_free(net_pbuf_t *p) {
+    net_pbuf_t *next;
+    int old, ref;
+
+    /* Release buffers from the front of the chain until we hit one that is
+       still referenced elsewhere. Whoever holds that one holds the rest of the
+       chain too. */
+    while(p) {
+        old = irq_disable();
+        ref = --p->ref;
+        irq_restore(old);
+
+        if(ref)
+            break;
+
+        next = p->next;
+
+        if(p->flags & PBUF_FLAG_POOLBUF)
+            buf_put(p->buf);
+
+        if(p->flags & PBUF_FLAG_POOLHDR)
+            hdr_put(p);
+        else
+            free(p);
+
+        p = next;
+    }
+}
+
+void *net_pbuf_push(net_pbuf_t *p, size_t len) {
+    if((size_t)(p->data - p->buf) < len)
+        return NULL;
+
+    p->data -= len;
+    p->len += len;
+    p->tot_len += len;
+
+    return p->data;
+}
+
+void *net_pbuf_pull(net_pbuf_t *p, size_t len) {
+    if(p->len < len)
+        return NULL;
+
+    p->data += len;
+    p->len -= len;
+    p->tot_len -= len;
+
+    return p->data;
+}
+
+void net_pbuf_cat(net_pbuf_t *head, net_pbuf_t *tail) {
+    net_pbuf_t *p;
+
+    for(p = head; p->next; p = p->next) {
+        p->tot_len += tail->tot_len;
+    }
+
+    p->tot_len += tail->tot_len;
+    p->next = tail;
+}
+
+size_t net_pbuf_copy(const net_pbuf_t *p, size_t off, void *dst, size_t len) {
+    uint8 *d = (uint8 *)dst;
+    size_t cnt, done = 0;
+
+    /* Skip over any buffers entirely before the offset. */
+    while(p && off >= p->len) {
+        off -= p->len;
+        p = p->next;
+    }
+
+    while(p && done < len) {
+        cnt = p->len - off;
+
+        if(cnt > len - done)
+            cnt = len - done;
+
+        memcpy(d + done, p->data + off, cnt);
+        done += cnt;
+        off = 0;
+        p = p->next;
+    }
+
+    return done;
+}
+
+int net_pbuf_tx(netif_t *net, const net_pbuf_t *p, int blocking) {
+    if(net_capture_on)
+        net_capture_pbuf(net, p, NET_CAPTURE_OUT);
+
+    /* The common case: the whole frame is in one buffer. */
+    if(!p->next)
+        return net_if_tx(net, p->data, p->len, blocking);
+
+    {
+        const net_pbuf_t *q;
+        int cnt = 0;
+
+        for(q = p; q; q = q->next) {
+            ++cnt;
+        }
+
+        {
+            struct iovec iov[cnt];
+
+            for(q = p, cnt = 0; q; q = q->next) {
+                /* Skip over empty buffers, there's no sense in passing them
+                   down to the driver. */
+                if(!q->len)
+                    continue;
+
+                iov[cnt].iov_base = q->data;
+                iov[cnt++].iov_len = q->len;
+            }
+
+            return net_if_tx_v(net, iov, cnt, blocking);
+        }
+    }
+}
+
+int net_pbuf_pooled(const net_pbuf_t *p) {
+    return !!(p->flags & PBUF_FLAG_POOLBUF);
+}
+
+int net_pbuf_pool_avail(void) {
+    return free_buf_cnt;
+}
+
+int net_pbuf_init(void) {
+    int i, old;
+
+    old = irq_disable();
+
+    free_hdrs = NULL;
+    free_bufs = NULL;
+
+    for(i = 0; i < PBUF_HDR_COUNT; ++i) {
+        pbuf_hdrs[i].next = free_hdrs;
+        free_hdrs = &pbuf_hdrs[i];
+    }
+
+    for(i = 0; i < PBUF_POOL_COUNT; ++i) {
+        *(void **)pbuf_bufs[i] = free_bufs;
+        free_bufs = pbuf_bufs[i];
+    }
+
+    free_buf_cnt = PBUF_POOL_COUNT;
+
+    irq_restore(old);
+
+    return 0;
+}
+
+void net_pbuf_shutdown(void) {
+    int old;
+
+    /* Anything still outstanding will go back on the lists when it is freed,
+       and the lists get rebuilt from scratch on the next init anyway. */
+    old = irq_disable();
+    free_hdrs = NULL;
+    free_bufs = NULL;
+    free_buf_cnt = 0;
+    irq_restore(old);
+}
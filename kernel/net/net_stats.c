@@ -0,0 +1,518 @@
+/* KallistiOS ##version##
+
+   kernel/net/net_stats.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* This file gathers up the statistics from all over the network stack, and
+   makes them available as text in a small read-only filesystem at /net:
+
+   /net/dev     One line per device: packets, bytes, drops and errors each way.
+   /net/snmp    Two lines per protocol: the names of its counters, then their
+                values (the same layout as /proc/net/snmp on Linux).
+   /net/tcp     One line per TCP socket, with its addresses and its TCP_INFO.
+
+   Each file is a snapshot, taken when it is opened. Read it again (or open it
+   again) for newer numbers. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+
+#include <kos/fs.h>
+#include <kos/net.h>
+#include <kos/nmmgr.h>
+
+#include "net_tcp.h"
+
+/* Size the text buffer for a file starts out at. */
+#define STATS_BUF_SIZE  1024
+
+/* An open file (or the directory). */
+typedef struct stats_file {
+    int dir;
+    char *buf;
+    size_t len;
+    size_t size;
+    size_t pos;
+    int err;
+    dirent_t dirent;
+} stats_file_t;
+
+/* One counter in net_stats_t. */
+typedef struct stats_field {
+    const char *name;
+    size_t off;
+} stats_field_t;
+
+#define FIELD(p, f)     { #f, offsetof(net_stats_t, p.f) }
+
+static const stats_field_t ipv4_fields[] = {
+    FIELD(ipv4, pkt_sent), FIELD(ipv4, pkt_send_failed),
+    FIELD(ipv4, pkt_recv), FIELD(ipv4, pkt_recv_bad_size),
+    FIELD(ipv4, pkt_recv_bad_chksum), FIELD(ipv4, pkt_recv_bad_proto),
+    { NULL, 0 }
+};
+
+static const stats_field_t ipv6_fields[] = {
+    FIELD(ipv6, pkt_sent), FIELD(ipv6, pkt_send_failed),
+    FIELD(ipv6, pkt_recv), FIELD(ipv6, pkt_recv_bad_size),
+    FIELD(ipv6, pkt_recv_bad_proto), FIELD(ipv6, pkt_recv_bad_ext),
+    { NULL, 0 }
+};
+
+static const stats_field_t frag_fields[] = {
+    FIELD(frag, frag_recv), FIELD(frag, frag_dropped),
+    FIELD(frag, pkt_reassembled), FIELD(frag, pkt_timeout),
+    FIELD(frag, pkt_evicted), FIELD(frag, pkt_bad), FIELD(frag, mem_used),
+    FIELD(frag, mem_peak),
+    { NULL, 0 }
+};
+
+static const stats_field_t udp_fields[] = {
+    FIELD(udp, pkt_sent), FIELD(udp, pkt_send_failed), FIELD(udp, pkt_recv),
+    FIELD(udp, pkt_recv_bad_size), FIELD(udp, pkt_recv_bad_chksum),
+    FIELD(udp, pkt_recv_no_sock), FIELD(udp, pkt_recv_no_space),
+    { NULL, 0 }
+};
+
+static const stats_field_t tcp_fields[] = {
+    FIELD(tcp, seg_sent), FIELD(tcp, seg_recv), FIELD(tcp, seg_recv_bad_size),
+    FIELD(tcp, seg_recv_bad_chksum), FIELD(tcp, seg_recv_no_sock),
+    FIELD(tcp, seg_retransmitted), FIELD(tcp, rst_sent),
+    FIELD(tcp, conn_active), FIELD(tcp, conn_passive), FIELD(tcp, conn_reset),
+    FIELD(tcp, listen_overflows), FIELD(tcp, timeouts),
+    FIELD(tcp, fast_retransmits), FIELD(tcp, dup_acks),
+    { NULL, 0 }
+};
+
+#undef FIELD
+
+static const struct {
+    const char *name;
+    const stats_field_t *fields;
+} snmp_protos[] = {
+    { "Ip", ipv4_fields },
+    { "Ip6", ipv6_fields },
+    { "Frag", frag_fields },
+    { "Udp", udp_fields },
+    { "Tcp", tcp_fields }
+};
+
+/* Names of the TCP states, by their TCP_INFO numbers. */
+static const char *const tcp_states[] = {
+    "UNKNOWN", "ESTABLISHED", "SYN_SENT", "SYN_RECV", "FIN_WAIT1", "FIN_WAIT2",
+    "TIME_WAIT", "CLOSE", "CLOSE_WAIT", "LAST_ACK", "LISTEN", "CLOSING"
+};
+
+static const char *const stats_files[] = { "dev", "snmp", "tcp" };
+#define STATS_FILE_CNT  (sizeof(stats_files) / sizeof(stats_files[0]))
+
+net_stats_t net_get_stats(void) {
+    net_stats_t rv;
+
+    rv.ipv4 = net_ipv4_get_stats();
+    rv.ipv6 = net_ipv6_get_stats();
+    rv.frag = net_frag_get_stats();
+    rv.udp = net_udp_get_stats();
+    rv.tcp = net_tcp_get_stats();
+
+    return rv;
+}
+
+/* Add some text to a file, making room for it as needed. */
+static void stats_printf(stats_file_t *f, const char *fmt, ...) {
+    va_list ap;
+    char *tmp;
+    size_t sz;
+    int len;
+
+    if(f->err)
+        return;
+
+    va_start(ap, fmt);
+    len = vsnprintf(f->buf + f->len, f->size - f->len, fmt, ap);
+    va_end(ap);
+
+    if(len < 0) {
+        f->err = EIO;
+        return;
+    }
+
+    if(f->len + len >= f->size) {
+        for(sz = f->size; f->len + len >= sz; sz <<= 1) {
+        }
+
+        if(!(tmp = (char *)realloc(f->buf, sz))) {
+            f->err = ENOMEM;
+            return;
+        }
+
+        f->buf = tmp;
+        f->size = sz;
+
+        va_start(ap, fmt);
+        vsnprintf(f->buf + f->len, f->size - f->len, fmt, ap);
+        va_end(ap);
+    }
+
+    f->len += len;
+}
+
+static void stats_gen_dev(stats_file_t *f) {
+    netif_t *nif;
+
+    stats_printf(f, "dev rx_packets rx_bytes rx_dropped rx_errors "
+                 "tx_packets tx_bytes tx_dropped tx_errors\n");
+
+    LIST_FOREACH(nif, &net_if_list, if_list) {
+        stats_printf(f, "%s%d %lu %llu %lu %lu %lu %llu %lu %lu\n", nif->name,
+                     nif->index, (unsigned long)nif->stats.rx_packets,
+                     (unsigned long long)nif->stats.rx_bytes,
+                     (unsigned long)nif->stats.rx_dropped,
+                     (unsigned long)nif->stats.rx_errors,
+                     (unsigned long)nif->stats.tx_packets,
+                     (unsigned long long)nif->stats.tx_bytes,
+                     (unsigned long)nif->stats.tx_dropped,
+                     (unsigned long)nif->stats.tx_errors);
+    }
+}
+
+static void stats_gen_snmp(stats_file_t *f) {
+    net_stats_t st = net_get_stats();
+    const stats_field_t *i;
+    size_t j;
+
+    for(j = 0; j < sizeof(snmp_protos) / sizeof(snmp_protos[0]); ++j) {
+        stats_printf(f, "%s:", snmp_protos[j].name);
+
+        for(i = snmp_protos[j].fields; i->name; ++i) {
+            stats_printf(f, " %s", i->name);
+        }
+
+        stats_printf(f, "\n%s:", snmp_protos[j].name);
+
+        for(i = snmp_protos[j].fields; i->name; ++i) {
+            stats_printf(f, " %lu",
+                         (unsigned long)*(uint32 *)((uint8 *)&st + i->off));
+        }
+
+        stats_printf(f, "\n");
+    }
+}
+
+/* Write out an address and port, the way they'd go in a URL. */
+static void stats_addr(stats_file_t *f, const struct sockaddr_in6 *addr) {
+    char str[INET6_ADDRSTRLEN];
+
+    if(IN6_IS_ADDR_V4MAPPED(&addr->sin6_addr)) {
+        inet_ntop(AF_INET, &addr->sin6_addr.__s6_addr.__s6_addr32[3], str,
+                  sizeof(str));
+        stats_printf(f, "%s:%u ", str, ntohs(addr->sin6_port));
+    }
+    else {
+        inet_ntop(AF_INET6, &addr->sin6_addr, str, sizeof(str));
+        stats_printf(f, "[%s]:%u ", str, ntohs(addr->sin6_port));
+    }
+}
+
+static void stats_tcp_sock(const struct sockaddr_in6 *local,
+                           const struct sockaddr_in6 *remote,
+                           const struct tcp_info *ti, void *data) {
+    stats_file_t *f = (stats_file_t *)data;
+
+    stats_addr(f, local);
+    stats_addr(f, remote);
+    stats_printf(f, "%s %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu "
+                 "%llu %llu\n",
+                 tcp_states[ti->tcpi_state <= TCP_CLOSING ? ti->tcpi_state : 0],
+                 (unsigned long)ti->tcpi_rto, (unsigned long)ti->tcpi_rtt,
+                 (unsigned long)ti->tcpi_rttvar,
+                 (unsigned long)ti->tcpi_snd_mss,
+                 (unsigned long)ti->tcpi_snd_cwnd,
+                 (unsigned long)ti->tcpi_snd_ssthresh,
+                 (unsigned long)ti->tcpi_snd_wnd,
+                 (unsigned long)ti->tcpi_rcv_wnd,
+                 (unsigned long)ti->tcpi_unacked,
+                 (unsigned long)ti->tcpi_notsent_bytes,
+                 (unsigned long)ti->tcpi_total_retrans,
+                 (unsigned long)ti->tcpi_segs_out,
+                 (unsigned long)ti->tcpi_segs_in,
+                 (unsigned long long)ti->tcpi_bytes_acked,
+                 (unsigned long long)ti->tcpi_bytes_received);
+}
+
+static void stats_gen_tcp(stats_file_t *f) {
+    stats_printf(f, "local remote state rto rtt rttvar snd_mss snd_cwnd "
+                 "snd_ssthresh snd_wnd rcv_wnd unacked notsent_bytes "
+                 "total_retrans segs_out segs_in bytes_acked "
+                 "bytes_received\n");
+    net_tcp_foreach(stats_tcp_sock, f);
+}
+
+static void *stats_open(vfs_handler_t *vfs, const char *fn, int mode) {
+    stats_file_t *f;
+    size_t i;
+
+    (void)vfs;
+
+    if(*fn == '/')
+        ++fn;
+
+    if((mode & O_MODE_MASK) != O_RDONLY) {
+        errno = EROFS;
+        return NULL;
+    }
+
+    for(i = 0; i < STATS_FILE_CNT; ++i) {
+        if(!strcmp(fn, stats_files[i]))
+            break;
+    }
+
+    if(*fn && i == STATS_FILE_CNT) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    if(!*fn && !(mode & O_DIR)) {
+        errno = EISDIR;
+        return NULL;
+    }
+    else if(*fn && (mode & O_DIR)) {
+        errno = ENOTDIR;
+        return NULL;
+    }
+
+    if(!(f = (stats_file_t *)calloc(1, sizeof(stats_file_t)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if(!*fn) {
+        f->dir = 1;
+        return f;
+    }
+
+    if(!(f->buf = (char *)malloc(STATS_BUF_SIZE))) {
+        free(f);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    f->size = STATS_BUF_SIZE;
+
+    switch(i) {
+        case 0:
+            stats_gen_dev(f);
+            break;
+
+        case 1:
+            stats_gen_snmp(f);
+            break;
+
+        case 2:
+            stats_gen_tcp(f);
+            break;
+    }
+
+    if(f->err) {
+        errno = f->err;
+        free(f->buf);
+        free(f);
+        return NULL;
+    }
+
+    return f;
+}
+
+static int stats_close(void *h) {
+    stats_file_t *f = (stats_file_t *)h;
+
+    free(f->buf);
+    free(f);
+
+    return 0;
+}
+
+static ssize_t stats_read(void *h, void *buf, size_t cnt) {
+    stats_file_t *f = (stats_file_t *)h;
+
+    if(f->dir) {
+        errno = EISDIR;
+        return -1;
+    }
+
+    if(f->pos >= f->len)
+        return 0;
+
+    if(cnt > f->len - f->pos)
+        cnt = f->len - f->pos;
+
+    memcpy(buf, f->buf + f->pos, cnt);
+    f->pos += cnt;
+
+    return (ssize_t)cnt;
+}
+
+static off_t stats_seek(void *h, off_t offset, int whence) {
+    stats_file_t *f = (stats_file_t *)h;
+
+    if(f->dir) {
+        errno = EISDIR;
+        return -1;
+    }
+
+    switch(whence) {
+        case SEEK_SET:
+            break;
+
+        case SEEK_CUR:
+            offset += f->pos;
+            break;
+
+        case SEEK_END:
+            offset += f->len;
+            break;
+
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+
+    if(offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    f->pos = offset;
+    return offset;
+}
+
+static off_t stats_tell(void *h) {
+    return ((stats_file_t *)h)->pos;
+}
+
+static size_t stats_total(void *h) {
+    return ((stats_file_t *)h)->len;
+}
+
+static dirent_t *stats_readdir(void *h) {
+    stats_file_t *f = (stats_file_t *)h;
+
+    if(!f->dir) {
+        errno = ENOTDIR;
+        return NULL;
+    }
+
+    if(f->pos >= STATS_FILE_CNT)
+        return NULL;
+
+    /* The files don't have a size until they're opened. */
+    strcpy(f->dirent.name, stats_files[f->pos++]);
+    f->dirent.size = 0;
+    f->dirent.time = 0;
+    f->dirent.attr = STAT_ATTR_R;
+
+    return &f->dirent;
+}
+
+static int stats_rewinddir(void *h) {
+    stats_file_t *f = (stats_file_t *)h;
+
+    if(!f->dir) {
+        errno = ENOTDIR;
+        return -1;
+    }
+
+    f->pos = 0;
+    return 0;
+}
+
+static int stats_fstat(void *h, struct stat *st) {
+    stats_file_t *f = (stats_file_t *)h;
+
+    memset(st, 0, sizeof(struct stat));
+
+    st->st_dev = (dev_t)('n' | ('e' << 8) | ('t' << 16));
+    st->st_nlink = 1;
+
+    if(f->dir) {
+        st->st_mode = S_IFDIR | S_IRUSR | S_IXUSR | S_IRGRP | S_IXGRP |
+            S_IROTH | S_IXOTH;
+    }
+    else {
+        st->st_mode = S_IFREG | S_IRUSR | S_IRGRP | S_IROTH;
+        st->st_size = (off_t)f->len;
+        st->st_blksize = 1;
+    }
+
+    return 0;
+}
+
+static vfs_handler_t vh = {
+    /* Name Handler */
+    {
+        { "/net" },     /* name */
+        0,              /* in-kernel */
+        0x00010000,     /* Version 1.0 */
+        0,              /* flags */
+        NMMGR_TYPE_VFS, /* VFS handler */
+        NMMGR_LIST_INIT /* list */
+    },
+
+    0, NULL,            /* no cacheing, privdata */
+
+    stats_open,
+    stats_close,
+    stats_read,
+    NULL,
+    stats_seek,
+    stats_tell,
+    stats_total,
+    stats_readdir,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    stats_rewinddir,
+    stats_fstat
+};
+
+static int stats_initted = 0;
+
+int net_stats_init(void) {
+    if(stats_initted)
+        return 0;
+
+    if(nmmgr_handler_add(&vh.nmmgr))
+        return -1;
+
+    stats_initted = 1;
+    return 0;
+}
+
+void net_stats_shutdown(void) {
+    if(!stats_initted)
+        return;
+
+    nmmgr_handler_remove(&vh.nmmgr);
+    stats_initted = 0;
+}
@@ -11,6 +11,7 @@
 #include <stdint.h>
 #include <poll.h>
 #include <sys/socket.h>
+#include <netinet/tcp.h>
 
 #include <kos/fs.h>
 #include <kos/net.h>
@@ -18,6 +19,7 @@
 #include <kos/mutex.h>
 #include <kos/rwsem.h>
 #include <kos/fs_socket.h>
+#include <kos/ktimer.h>
 
 #include <arch/timer.h>
 
@@ -26,6 +28,7 @@
 #include "net_ipv4.h"
 #include "net_ipv6.h"
 #include "net_thd.h"
+#include "net_tcp.h"
 
 /* Since some of this is a bit odd in its implementation, here's a few notes on
    what my thinking was while writing all of this...
@@ -50,15 +53,10 @@
    always acquire the read lock. The second level of locking is on the
    individual socket level. This is done with a standard mutex. When looking at
    an individual socket, grab that mutex in addition to the read or write lock,
-   as is appropriate. The only function that is somewhat counter-intuitive in
-   its locking is bind(). The bind() function, even though it does not modify
-   the list itself, does grab the write lock. The reason for this is fairly
-   simple. If bind() were to grab the read lock, then iterate through the list
-   of sockets looking for duplicate binds, there is a possibility that a second
-   call to bind() in another thread could cause a deadlock due to the locking
-   and unlocking of the mutexes on the individual sockets. To prevent this
-   problem, I have it grab the write lock instead. That way, no two bind() calls
-   can be active at a time.
+   as is appropriate. The bind() function grabs the write lock, since it adds
+   the socket to the port hash table (see below). Since the local port of a
+   socket only ever changes with the write lock held, that also means that
+   bind() can check for duplicate binds without locking the other sockets.
 
    On listening:
    When a connection comes in for a socket that is in the listening state, that
@@ -71,22 +69,37 @@
    real socket created for them until they are accept()ed.
 
    On matching sockets:
-   All new sockets (including those created by accept()) are added to the head
-   of the list. Since we cannot bind a socket to an already used port for
-   listening, that means that any fully-created sockets should appear in the
-   list in front of those created for listening to a port (and thus that are
-   only partially-created). This simplifies the procedure for finding matching
-   sockets for incoming packets, since this makes sure that the fully-created
-   socket will be found first if it exists when simply iterating through the
-   list of sockets.
+   All sockets are kept in one big list, but that list is only used for things
+   that need to look at every socket (like the timer callback). Every socket
+   that has a local port is also in a hash table indexed by that port, and every
+   socket that has a remote address is in a second hash table indexed by the
+   remote address and both ports. When a segment comes in, we look for a
+   fully-created socket in the connection table first, and only if that fails
+   do we look for a listening socket on the port. This gives the same result as
+   the old approach of walking the whole list (where fully-created sockets
+   always came first), without having to look at every socket for every single
+   packet. Both tables are protected by the same rwsem as the list itself.
 
    On what's actually here:
-   I didn't bother implementing any TCP extensions beyond RFC 793. That means
-   that I just ignore things like the timestamp option and the selective
-   acknowledgement option. That also means that the window size maxes out at
-   65535. Some extensions may be implemented in the future, if I see fit to do
-   so. That all said, everything in here works just fine over IPv4 or IPv6, and
-   can be used just fine to communicate with "normal" TCP/IP implementations.
+   The base of this is a fairly direct implementation of RFC 793. On top of
+   that, the retransmission timer is computed from measured round-trip times
+   as described in RFC 6298 (using Karn's algorithm and exponential backoff),
+   and congestion control follows RFC 5681 with the NewReno modifications to
+   fast recovery from RFC 6582. The window scale and timestamp options from
+   RFC 7323 are supported (including PAWS), so the window isn't stuck at 65535
+   bytes anymore. The socket buffers can be resized with SO_RCVBUF/SO_SNDBUF
+   at any time, and the receive buffer will grow on its own (up to a limit) if
+   the application keeps up with the data coming in, unless the user has set
+   its size explicitly. Segments that arrive out of order are held on to in the
+   receive buffer until the holes in front of them are filled, and selective
+   acknowledgements (RFC 2018) are used in both directions so that only the
+   data that actually got lost needs to be resent. ACKs are delayed and small
+   segments are coalesced with the Nagle algorithm as described in RFC 1122
+   (which can be turned off with TCP_NODELAY, or made more aggressive with
+   TCP_CORK). Some other extensions may be implemented in the future, if I see
+   fit to do so. That all said, everything in here works just fine over IPv4
+   or IPv6, and can be used just fine to communicate with "normal"
+   TCP/IP implementations.
 */
 
 typedef struct tcp_hdr {
@@ -101,6 +114,19 @@ typedef struct tcp_hdr {
     uint8_t options[];
 } __attribute__((packed)) tcp_hdr_t;
 
+/* Maximum number of discontiguous blocks of out-of-order data we'll hold on to
+   for a connection. Out-of-order data is stored directly in the receive buffer
+   at the spot it'll end up at once the holes are filled in, so it never uses
+   more memory than the window we've advertised. This just bounds how badly
+   fragmented that can get; anything that would need another block is dropped
+   and will be retransmitted by the other side. */
+#define TCP_MAX_OOO_BLOCKS      8
+
+/* Maximum number of SACKed ranges we keep track of for data we've sent. If the
+   other side reports more than this, the extra ones are just forgotten about,
+   which at worst means we retransmit something that didn't need it. */
+#define TCP_MAX_SACK_SCORE      8
+
 /* Listening socket. Each one of these is an incoming connection from a socket
    that is in the listen state */
 struct lsock {
@@ -110,6 +136,10 @@ struct lsock {
     uint32_t isn;
     uint32_t wnd;
     uint16_t mss;
+    int wscale;
+    int has_ts;
+    int sack_ok;
+    uint32_t tsval;
 };
 
 /* Send/receive variables... */
@@ -121,7 +151,9 @@ struct sndrec {
     uint32_t wl1;
     uint32_t wl2;
     uint32_t iss;
+    uint32_t max;
     uint16_t mss;
+    uint8_t wscale;
 };
 
 struct rcvrec {
@@ -129,10 +161,36 @@ struct rcvrec {
     uint32_t wnd;
     uint32_t up;
     uint32_t irs;
+    uint32_t last_ack;
+    uint32_t last_wnd;
+    uint8_t wscale;
+};
+
+/* A range of sequence numbers, [start, end). Used both for the blocks of data
+   that we've received out of order and for the SACK blocks the other side has
+   sent to us. */
+struct tcp_sack_blk {
+    uint32_t start;
+    uint32_t end;
+};
+
+/* Options parsed out of an incoming segment */
+struct tcp_opts {
+    uint16_t mss;
+    int wscale;
+    int has_ts;
+    int sack_ok;
+    int nsack;
+    uint32_t tsval;
+    uint32_t tsecr;
+    struct tcp_sack_blk sack[4];
 };
 
 struct tcp_sock {
     LIST_ENTRY(tcp_sock) sock_list;
+    LIST_ENTRY(tcp_sock) port_list;
+    LIST_ENTRY(tcp_sock) conn_list;
+    int hashed;
     struct sockaddr_in6 local_addr;
     struct sockaddr_in6 remote_addr;
 
@@ -145,6 +203,8 @@ struct tcp_sock {
     int hop_limit;
     uint32_t rcvbuf_sz;
     uint32_t sndbuf_sz;
+    ktimer_t timer;
+    uint64_t timer_when;
 
     union {
         struct {
@@ -169,6 +229,32 @@ struct tcp_sock {
             uint32_t sndbuf_acked;
             uint32_t sndbuf_tail;
             uint64_t timer;
+            uint32_t srtt;
+            uint32_t rttvar;
+            uint32_t rto;
+            uint32_t rtt_seq;
+            uint64_t rtt_start;
+            uint32_t cwnd;
+            uint32_t ssthresh;
+            uint32_t recover;
+            int dupacks;
+            uint32_t ts_recent;
+            uint32_t rcvq_bytes;
+            uint64_t rcvq_time;
+            struct tcp_sack_blk ooo[TCP_MAX_OOO_BLOCKS];
+            int ooo_cnt;
+            uint32_t ooo_recent;
+            struct tcp_sack_blk sacked[TCP_MAX_SACK_SCORE];
+            int sacked_cnt;
+            uint32_t rexmit_nxt;
+            uint64_t ack_time;
+            uint64_t held_time;
+            uint32_t rexmits;
+            uint32_t total_retrans;
+            uint32_t segs_in;
+            uint32_t segs_out;
+            uint64_t bytes_acked;
+            uint64_t bytes_received;
             condvar_t send_cv;
             condvar_t recv_cv;
         } data;
@@ -177,13 +263,44 @@ struct tcp_sock {
 
 LIST_HEAD(tcp_sock_list, tcp_sock);
 
+/* Sizes of the socket lookup hash tables. Both must be powers of two. */
+#define TCP_PORT_HASH_SIZE  64
+#define TCP_CONN_HASH_SIZE  256
+
+/* Bits for the hashed field of struct tcp_sock. */
+#define TCP_HASHED_PORT     0x01
+#define TCP_HASHED_CONN     0x02
+
+/* Range of ports that get handed out to sockets that don't bind() to a specific
+   port (the dynamic port range from RFC 6335). */
+#define TCP_EPHEMERAL_MIN   49152
+#define TCP_EPHEMERAL_MAX   65535
+
 static struct tcp_sock_list tcp_socks = LIST_HEAD_INITIALIZER(0);
+static struct tcp_sock_list tcp_port_hash[TCP_PORT_HASH_SIZE];
+static struct tcp_sock_list tcp_conn_hash[TCP_CONN_HASH_SIZE];
+static uint16_t tcp_next_port = TCP_EPHEMERAL_MIN;
 static rw_semaphore_t tcp_sem = RWSEM_INITIALIZER;
 static int thd_cb_id = 0;
+static int tcp_timers_off = 0;
+static net_tcp_stats_t tcp_stats = { 0 };
 
 /* Default starting window size for connections. This should be big enough as a
-   starting point, in general. If you need to adjust it, you can do so... */
-#define TCP_DEFAULT_WINDOW  8192
+   starting point, in general. If you need to adjust it, you can do so with the
+   SO_RCVBUF and SO_SNDBUF socket options. Unless SO_RCVBUF is set explicitly,
+   the receive buffer will also grow on its own (up to TCP_MAX_AUTO_RCVBUF) if
+   the connection turns out to have a large bandwidth-delay product. */
+#define TCP_DEFAULT_WINDOW  16384
+
+/* Limits on the socket buffer sizes that can be set with setsockopt(). */
+#define TCP_MIN_BUFSZ       1024
+#define TCP_MAX_BUFSZ       (1024 * 1024)
+
+/* Maximum size that receive buffer auto-tuning will grow a buffer to. */
+#define TCP_MAX_AUTO_RCVBUF (128 * 1024)
+
+/* Largest window scale shift allowed by RFC 7323. */
+#define TCP_MAX_WSCALE      14
 
 /* Default MSS */
 #define TCP_DEFAULT_MSS     1460
@@ -192,8 +309,40 @@ static int thd_cb_id = 0;
    to be 15 seconds, since that's what Mac OS X does. */
 #define TCP_DEFAULT_MSL     15000
 
-/* Default retransmission timeout (in milliseconds). */
-#define TCP_DEFAULT_RTTO    2000
+/* Initial retransmission timeout (in milliseconds), used until we have an
+   actual round-trip time measurement for the connection (RFC 6298). */
+#define TCP_DEFAULT_RTTO    1000
+
+/* Bounds on the retransmission timeout (in milliseconds). RFC 6298 says that
+   the minimum SHOULD be one second, but like most other stacks, we go quite a
+   bit lower than that so that a single lost segment on a LAN doesn't stall the
+   connection for a full second. */
+#define TCP_MIN_RTTO        200
+#define TCP_MAX_RTTO        60000
+
+/* Clock granularity for the RTO calculation (in milliseconds). The socket
+   timers themselves are accurate to the millisecond, but the timer thread may
+   not get to run until the next scheduler tick. */
+#define TCP_CLOCK_GRAN      10
+
+/* How often closed sockets are cleaned up (in milliseconds). */
+#define TCP_REAP_TIME       1000
+
+/* Number of duplicate ACKs that trigger a fast retransmit (RFC 5681). */
+#define TCP_DUPACK_THRESH   3
+
+/* Upper bound on the congestion window, just to keep it from overflowing on
+   long-lived connections. */
+#define TCP_MAX_CWND        0x40000000
+
+/* How long we'll hold off on acknowledging data (in milliseconds), in hopes of
+   being able to piggyback the ACK on some data going the other way. RFC 1122
+   says this has to be less than half a second. */
+#define TCP_DELACK_TIME     100
+
+/* How long a partial segment will be held back on a socket with TCP_CORK set
+   before we give up and send it anyway (in milliseconds). */
+#define TCP_CORK_TIME       200
 
 /* Default hop limit (or ttl for IPv4) for new sockets */
 #define TCP_DEFAULT_HOPS    64
@@ -228,10 +377,28 @@ static int thd_cb_id = 0;
 #define TCP_IFLAG_CANBEDEL      0x00000001
 #define TCP_IFLAG_QUEUEDCLOSE   0x00000002
 #define TCP_IFLAG_ACCEPTWAIT    0x00000004
+#define TCP_IFLAG_RTTTIMING     0x00000008
+#define TCP_IFLAG_FASTRECOV     0x00000010
+#define TCP_IFLAG_WSCALE        0x00000020
+#define TCP_IFLAG_TSTAMP        0x00000040
+#define TCP_IFLAG_RCVBUFLOCK    0x00000080
+#define TCP_IFLAG_SACK          0x00000100
+#define TCP_IFLAG_NODELAY       0x00000200
+#define TCP_IFLAG_CORK          0x00000400
+#define TCP_IFLAG_ACKPENDING    0x00000800
+#define TCP_IFLAG_HELD          0x00001000
+#define TCP_IFLAG_PUSH          0x00002000
 
 #define TCP_OPT_EOL             0
 #define TCP_OPT_NOP             1
 #define TCP_OPT_MSS             2
+#define TCP_OPT_WSCALE          3
+#define TCP_OPT_SACK_PERMITTED  4
+#define TCP_OPT_SACK            5
+#define TCP_OPT_TIMESTAMP       8
+
+/* Length of the timestamp option, as we send it (with two NOPs in front). */
+#define TCP_TS_OPT_LEN          12
 
 /* A few macros for comparing sequence numbers */
 #define SEQ_LT(x, y)    (((int32_t)((x) - (y))) < 0)
@@ -240,6 +407,12 @@ static int thd_cb_id = 0;
 #define SEQ_GE(x, y)    (((int32_t)((x) - (y))) >= 0)
 
 #define MAX(x, y)       (x > y ? x : y)
+#define MIN(x, y)       ((x) < (y) ? (x) : (y))
+
+/* Amount of payload we put in each segment we send */
+#define TCP_SEG_SIZE(s) ((s)->data.snd.mss - sizeof(tcp_hdr_t) - \
+                         (((s)->intflags & TCP_IFLAG_TSTAMP) ? \
+                          TCP_TS_OPT_LEN : 0))
 
 /* Forward declarations */
 static fs_socket_proto_t proto;
@@ -251,6 +424,20 @@ static int tcp_send_syn(struct tcp_sock *sock, int ack);
 static void tcp_send_ack(struct tcp_sock *sock);
 static void tcp_send_data(struct tcp_sock *sock, int resend);
 static void tcp_send_fin_ack(struct tcp_sock *sock);
+static uint32_t tcp_send_seg(struct tcp_sock *sock, uint32_t seq, uint32_t head,
+                             uint32_t len);
+static void tcp_cc_init(struct tcp_sock *sock);
+static void tcp_timer_cb(ktimer_t *t, void *data);
+static void tcp_timer_sched(struct tcp_sock *sock);
+static int tcp_resize_rcvbuf(struct tcp_sock *sock, uint32_t sz);
+static int tcp_resize_sndbuf(struct tcp_sock *sock, uint32_t sz);
+static void tcp_rcvbuf_autotune(struct tcp_sock *sock, uint32_t read);
+static uint8_t tcp_wscale(struct tcp_sock *sock);
+static void tcp_hash_port(struct tcp_sock *sock);
+static void tcp_hash_conn(struct tcp_sock *sock);
+static void tcp_unhash(struct tcp_sock *sock);
+static int tcp_port_used(uint16_t port, struct tcp_sock *self);
+static uint16_t tcp_alloc_port(void);
 
 /* Sockets interface... */
 static int net_tcp_socket(net_socket_t *hnd, int domain, int type, int proto) {
@@ -272,6 +459,8 @@ static int net_tcp_socket(net_socket_t *hnd, int domain, int type, int proto) {
         return -1;
     }
 
+    ktimer_setup(&sock->timer, tcp_timer_cb, sock, KTIMER_THREAD);
+
     sock->domain = domain;
     sock->sock = hnd->fd;
     sock->hop_limit = TCP_DEFAULT_HOPS;
@@ -380,21 +569,18 @@ retry:
             cond_destroy(&sock->data.recv_cv);
             goto ret_remove;
 
+        case TCP_STATE_SYN_RECEIVED:
         case TCP_STATE_ESTABLISHED:
 
-            /* See if all sends have finished... */
+            /* See if all sends have finished... accept() can hand the socket
+               back before the handshake is done, so there may be data queued
+               up even in SYN_RECEIVED. */
             if(sock->data.sndbuf_cur_sz) {
                 goto ret_no_remove;
             }
 
-            /* Fall through... */
-            __fallthrough;
-
-        case TCP_STATE_SYN_RECEIVED:
-            /* Don't have to worry about queued packets, since we don't allow
-               any queueing until after the connection is established. */
             tcp_send_fin_ack(sock);
-            ++sock->data.snd.nxt;
+            sock->data.snd.max = ++sock->data.snd.nxt;
             sock->state = TCP_STATE_FIN_WAIT_1;
             goto ret_no_remove;
 
@@ -406,7 +592,7 @@ retry:
             }
 
             tcp_send_fin_ack(sock);
-            ++sock->data.snd.nxt;
+            sock->data.snd.max = ++sock->data.snd.nxt;
             sock->state = TCP_STATE_CLOSING;
             goto ret_no_remove;
 
@@ -426,7 +612,9 @@ retry:
     }
 
 ret_remove:
+    tcp_unhash(sock);
     LIST_REMOVE(sock, sock_list);
+    ktimer_cancel(&sock->timer);
     mutex_unlock(&sock->mutex);
     mutex_destroy(&sock->mutex);
     free(sock);
@@ -436,16 +624,18 @@ ret_remove:
 
 ret_no_remove:
     if(sock->state != TCP_STATE_LISTEN)
-        sock->intflags = TCP_IFLAG_CANBEDEL;
+        sock->intflags |= TCP_IFLAG_CANBEDEL;
 
-    if(sock->state == TCP_STATE_ESTABLISHED ||
+    if(sock->state == TCP_STATE_SYN_RECEIVED ||
+            sock->state == TCP_STATE_ESTABLISHED ||
             sock->state == TCP_STATE_CLOSE_WAIT)
         sock->intflags |= TCP_IFLAG_QUEUEDCLOSE;
 
     sock->sock = -1;
 
     /* Don't free anything here, it will be dealt with later on in the
-       net_thd callback. */
+       net_thd callback. Any queued close gets handled by the socket's timer. */
+    tcp_timer_sched(sock);
     mutex_unlock(&sock->mutex);
     rwsem_write_unlock(&tcp_sem);
     return;
@@ -527,6 +717,7 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
             mutex_lock(&sock->mutex);
             free(sock->listen.queue);
             cond_destroy(&sock->listen.cv);
+            tcp_unhash(sock);
             LIST_REMOVE(sock, sock_list);
             mutex_unlock(&sock->mutex);
             mutex_destroy(&sock->mutex);
@@ -563,6 +754,8 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
         return -1;
     }
 
+    ktimer_setup(&sock2->timer, tcp_timer_cb, sock2, KTIMER_THREAD);
+
     if(!(sock2->data.rcvbuf = (uint8_t *)malloc(sock->rcvbuf_sz))) {
         errno = ENOMEM;
         mutex_unlock(&sock->mutex);
@@ -717,21 +910,52 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
        by the wording of the RFC... */
     sock2->data.snd.iss = (uint32_t)(timer_us_gettime64() >> 2);
     sock2->data.snd.nxt = sock2->data.snd.iss + 1;
+    sock2->data.snd.max = sock2->data.snd.nxt;
     sock2->data.snd.una = sock2->data.snd.iss;
     sock2->data.snd.wnd = lsock.wnd;
     sock2->data.snd.wl1 = sock2->data.snd.iss;
     sock2->data.snd.mss = lsock.mss;
     sock2->data.rcv.nxt = lsock.isn + 1;
     sock2->data.rcv.irs = lsock.isn;
+    sock2->intflags = sock->intflags & (TCP_IFLAG_RCVBUFLOCK |
+                                        TCP_IFLAG_NODELAY | TCP_IFLAG_CORK);
+
+    /* Only use window scaling, timestamps and selective acknowledgements if the
+       other side asked for them in its <SYN> (RFC 7323 and RFC 2018). */
+    if(lsock.wscale >= 0) {
+        sock2->intflags |= TCP_IFLAG_WSCALE;
+        sock2->data.snd.wscale = (uint8_t)lsock.wscale;
+        sock2->data.rcv.wscale = tcp_wscale(sock2);
+    }
+
+    if(lsock.has_ts) {
+        sock2->intflags |= TCP_IFLAG_TSTAMP;
+        sock2->data.ts_recent = lsock.tsval;
+    }
+
+    if(lsock.sack_ok)
+        sock2->intflags |= TCP_IFLAG_SACK;
+
+    sock2->data.rto = TCP_DEFAULT_RTTO;
+    sock2->data.recover = sock2->data.snd.iss;
+    tcp_cc_init(sock2);
 
     /* Since nothing else has a pointer to this socket, this will not fail. */
     mutex_trylock(&sock2->mutex);
 
-    /* Send the <SYN,ACK> packet now, add it to the list, and clean up. */
+    /* Send the <SYN,ACK> packet now, add it to the list, and clean up. The
+       handshake gives us our first round-trip time sample, if the <SYN,ACK>
+       doesn't have to be retransmitted. */
     tcp_send_syn(sock2, 1);
-    sock2->data.timer = timer_ms_gettime64();
+    ++tcp_stats.conn_passive;
+    sock2->data.timer = sock2->data.rtt_start = timer_ms_gettime64();
+    sock2->data.rtt_seq = sock2->data.snd.iss;
+    sock2->intflags |= TCP_IFLAG_RTTTIMING;
+    tcp_timer_sched(sock2);
     fd = sock2->sock;
     LIST_INSERT_HEAD(&tcp_socks, sock2, sock_list);
+    tcp_hash_port(sock2);
+    tcp_hash_conn(sock2);
     mutex_unlock(&sock2->mutex);
 
     sock->state &= ~TCP_STATE_ACCEPTING;
@@ -743,7 +967,7 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
 
 static int net_tcp_bind(net_socket_t *hnd, const struct sockaddr *addr,
                         socklen_t addr_len) {
-    struct tcp_sock *sock, *iter;
+    struct tcp_sock *sock;
     struct sockaddr_in *realaddr4;
     struct sockaddr_in6 realaddr6;
 
@@ -850,75 +1074,27 @@ static int net_tcp_bind(net_socket_t *hnd, const struct sockaddr *addr,
         return -1;
     }
 
-    /* See if we requested a specific port or not */
+    /* See if we requested a specific port or not. If so, make sure we don't
+       already have a socket bound to it. Since ports only ever change with the
+       write lock held, we don't need to lock the other sockets to check. */
     if(realaddr6.sin6_port != 0) {
-        /* Make sure we don't already have a socket bound to the port
-           specified */
-        LIST_FOREACH(iter, &tcp_socks, sock_list) {
-            if(iter == sock)
-                continue;
-
-            if(irq_inside_int()) {
-                if(mutex_trylock(&iter->mutex)) {
-                    mutex_unlock(&sock->mutex);
-                    rwsem_write_unlock(&tcp_sem);
-                    errno = EWOULDBLOCK;
-                    return -1;
-                }
-            }
-            else {
-                mutex_lock(&iter->mutex);
-            }
-
-            if(iter->local_addr.sin6_port == realaddr6.sin6_port) {
-                mutex_unlock(&iter->mutex);
-                mutex_unlock(&sock->mutex);
-                rwsem_write_unlock(&tcp_sem);
-                errno = EADDRINUSE;
-                return -1;
-            }
-
-            mutex_unlock(&iter->mutex);
+        if(tcp_port_used(realaddr6.sin6_port, sock)) {
+            mutex_unlock(&sock->mutex);
+            rwsem_write_unlock(&tcp_sem);
+            errno = EADDRINUSE;
+            return -1;
         }
-
-        sock->local_addr = realaddr6;
     }
-    else {
-        uint16_t port = 1024, tmp = 0;
-
-        /* Grab the first unused port >= 1024. This is, unfortunately, O(n^2) */
-        while(tmp != port) {
-            tmp = port;
-
-            LIST_FOREACH(iter, &tcp_socks, sock_list) {
-                if(iter == sock)
-                    continue;
-
-                if(irq_inside_int()) {
-                    if(mutex_trylock(&iter->mutex)) {
-                        mutex_unlock(&sock->mutex);
-                        rwsem_write_unlock(&tcp_sem);
-                        errno = EWOULDBLOCK;
-                        return -1;
-                    }
-                }
-                else {
-                    mutex_lock(&iter->mutex);
-                }
-
-                if(iter->local_addr.sin6_port == port) {
-                    ++port;
-                    break;
-                }
-
-                mutex_unlock(&iter->mutex);
-            }
-        }
-
-        sock->local_addr = realaddr6;
-        sock->local_addr.sin6_port = htons(port);
+    else if(!(realaddr6.sin6_port = tcp_alloc_port())) {
+        mutex_unlock(&sock->mutex);
+        rwsem_write_unlock(&tcp_sem);
+        errno = EADDRINUSE;
+        return -1;
     }
 
+    sock->local_addr = realaddr6;
+    tcp_hash_port(sock);
+
     /* Release the locks, we're done */
     mutex_unlock(&sock->mutex);
     rwsem_write_unlock(&tcp_sem);
@@ -928,20 +1104,16 @@ static int net_tcp_bind(net_socket_t *hnd, const struct sockaddr *addr,
 
 static int net_tcp_connect(net_socket_t *hnd, const struct sockaddr *addr,
                            socklen_t addr_len) {
-    struct tcp_sock *sock, *iter;
+    struct tcp_sock *sock;
     struct sockaddr_in *realaddr4;
     struct sockaddr_in6 realaddr6;
+    netif_t *net;
 
     if(addr == NULL) {
         errno = EDESTADDRREQ;
         return -1;
     }
 
-    if(!net_default_dev) {
-        errno = ENETDOWN;
-        return -1;
-    }
-
     switch(addr->sa_family) {
         case AF_INET:
 
@@ -981,6 +1153,18 @@ static int net_tcp_connect(net_socket_t *hnd, const struct sockaddr *addr,
             return -1;
     }
 
+    /* Connections to the loopback network stay on the loopback device,
+       everything else goes out the default device. */
+    if(net_loop_dev && net_loop_addr(&realaddr6.sin6_addr))
+        net = net_loop_dev;
+    else
+        net = net_default_dev;
+
+    if(!net) {
+        errno = ENETDOWN;
+        return -1;
+    }
+
     if(irq_inside_int()) {
         if(rwsem_write_trylock(&tcp_sem)) {
             errno = EWOULDBLOCK;
@@ -1045,43 +1229,22 @@ static int net_tcp_connect(net_socket_t *hnd, const struct sockaddr *addr,
 
     /* See if the socket is already bound to a local port */
     if(!sock->local_addr.sin6_port) {
-        uint16_t port = 1024, tmp = 0;
-
-        /* Grab the first unused port >= 1024. This is, unfortunately, O(n^2) */
-        while(tmp != port) {
-            tmp = port;
-
-            LIST_FOREACH(iter, &tcp_socks, sock_list) {
-                if(iter == sock)
-                    continue;
-
-                if(irq_inside_int()) {
-                    if(mutex_trylock(&iter->mutex)) {
-                        mutex_unlock(&sock->mutex);
-                        rwsem_write_unlock(&tcp_sem);
-                        errno = EWOULDBLOCK;
-                        return -1;
-                    }
-                }
-                else {
-                    mutex_lock(&iter->mutex);
-                }
-
-                if(iter->local_addr.sin6_port == port) {
-                    ++port;
-                    break;
-                }
-
-                mutex_unlock(&iter->mutex);
-            }
+        if(!(sock->local_addr.sin6_port = tcp_alloc_port())) {
+            mutex_unlock(&sock->mutex);
+            rwsem_write_unlock(&tcp_sem);
+            errno = EADDRNOTAVAIL;
+            return -1;
         }
 
-        sock->local_addr.sin6_port = htons(port);
+        tcp_hash_port(sock);
 
         if(addr->sa_family == AF_INET) {
             sock->local_addr.sin6_addr.__s6_addr.__s6_addr16[5] = 0xFFFF;
             sock->local_addr.sin6_addr.__s6_addr.__s6_addr32[3] =
-                htonl(net_ipv4_address(net_default_dev->ip_addr));
+                htonl(net_ipv4_address(net->ip_addr));
+        }
+        else if(net == net_loop_dev) {
+            sock->local_addr.sin6_addr = in6addr_loopback;
         }
     }
 
@@ -1124,12 +1287,18 @@ static int net_tcp_connect(net_socket_t *hnd, const struct sockaddr *addr,
     }
 
     sock->data.rcv.wnd = sock->rcvbuf_sz;
+    sock->data.rcv.wscale = tcp_wscale(sock);
     sock->data.rcvbuf_head = sock->data.rcvbuf_tail = 0;
-    sock->data.net = net_default_dev;
+    sock->data.net = net;
+    sock->intflags |= TCP_IFLAG_WSCALE | TCP_IFLAG_TSTAMP | TCP_IFLAG_SACK;
     sock->data.snd.iss = timer_us_gettime64() >> 2;
     sock->data.snd.una = sock->data.snd.iss;
     sock->data.snd.nxt = sock->data.snd.iss + 1;
+    sock->data.snd.max = sock->data.snd.nxt;
+    sock->data.rto = TCP_DEFAULT_RTTO;
+    sock->data.recover = sock->data.snd.iss;
     sock->state = TCP_STATE_SYN_SENT;
+    tcp_hash_conn(sock);
 
     /* Send a <SYN> packet */
     if(tcp_send_syn(sock, 0) == -1) {
@@ -1138,6 +1307,13 @@ static int net_tcp_connect(net_socket_t *hnd, const struct sockaddr *addr,
         return -1;
     }
 
+    ++tcp_stats.conn_active;
+
+    sock->data.timer = sock->data.rtt_start = timer_ms_gettime64();
+    sock->data.rtt_seq = sock->data.snd.iss;
+    sock->intflags |= TCP_IFLAG_RTTTIMING;
+    tcp_timer_sched(sock);
+
     /* Release the write lock... */
     rwsem_write_unlock(&tcp_sem);
 
@@ -1403,11 +1579,30 @@ static ssize_t net_tcp_recvfrom(net_socket_t *hnd, void *buffer, size_t length,
             sock->data.rcvbuf_head = size - tmp;
     }
 
-    /* If we've got nothing left, move the pointers back to the beginning */
-    if(!sock->data.rcvbuf_cur_sz) {
+    /* If we've got nothing left, move the pointers back to the beginning. We
+       can't do that if there's out-of-order data sitting past the end of what
+       we've got, though. */
+    if(!sock->data.rcvbuf_cur_sz && !sock->data.ooo_cnt) {
         sock->data.rcvbuf_head = sock->data.rcvbuf_tail = 0;
     }
 
+    if(!(flags & MSG_PEEK)) {
+        /* See if the receive buffer should grow to keep up. */
+        if(!(sock->intflags & TCP_IFLAG_RCVBUFLOCK))
+            tcp_rcvbuf_autotune(sock, size);
+
+        /* If reading opened up a good chunk of the window since we last told
+           the other side about it, let them know now rather than waiting for
+           them to probe (RFC 1122, section 4.2.3.3). */
+        if((sock->state == TCP_STATE_ESTABLISHED ||
+            sock->state == TCP_STATE_FIN_WAIT_1 ||
+            sock->state == TCP_STATE_FIN_WAIT_2) &&
+           sock->data.rcv.wnd - sock->data.rcv.last_wnd >=
+           MIN(sock->rcvbuf_sz >> 1, 2 * (uint32_t)TCP_SEG_SIZE(sock))) {
+            tcp_send_ack(sock);
+        }
+    }
+
     if(addr != NULL) {
         if(sock->domain == AF_INET) {
             struct sockaddr_in realaddr;
@@ -1643,10 +1838,64 @@ static int net_tcp_shutdownsock(net_socket_t *hnd, int how) {
     return 0;
 }
 
+/* What our states are called in struct tcp_info. */
+static const uint8_t tcp_info_states[] = {
+    TCP_CLOSE, TCP_LISTEN, TCP_SYN_SENT, TCP_SYN_RECV, TCP_ESTABLISHED,
+    TCP_FIN_WAIT1, TCP_FIN_WAIT2, TCP_CLOSE_WAIT, TCP_CLOSING, TCP_LAST_ACK,
+    TCP_TIME_WAIT
+};
+
+/* Fill in the TCP_INFO for a socket. The socket's mutex must be held. */
+static void tcp_get_info(struct tcp_sock *sock, struct tcp_info *ti) {
+    uint32_t unacked;
+    int state = sock->state & 0x0F;
+
+    memset(ti, 0, sizeof(struct tcp_info));
+    ti->tcpi_state = tcp_info_states[state];
+
+    /* Listening sockets don't have any of the rest. Neither do sockets that
+       haven't been connected yet, but all of that is still zeroed for them. */
+    if(state == TCP_STATE_LISTEN)
+        return;
+
+    if(sock->intflags & TCP_IFLAG_TSTAMP)
+        ti->tcpi_options |= TCPI_OPT_TIMESTAMPS;
+
+    if(sock->intflags & TCP_IFLAG_SACK)
+        ti->tcpi_options |= TCPI_OPT_SACK;
+
+    if(sock->intflags & TCP_IFLAG_WSCALE) {
+        ti->tcpi_options |= TCPI_OPT_WSCALE;
+        ti->tcpi_snd_wscale = sock->data.snd.wscale;
+        ti->tcpi_rcv_wscale = sock->data.rcv.wscale;
+    }
+
+    unacked = sock->data.snd.max - sock->data.snd.una;
+
+    ti->tcpi_retransmits = MIN(sock->data.rexmits, 255);
+    ti->tcpi_rto = sock->data.rto * 1000;
+    ti->tcpi_snd_mss = sock->data.snd.mss ? TCP_SEG_SIZE(sock) : 0;
+    ti->tcpi_rtt = (sock->data.srtt >> 3) * 1000;
+    ti->tcpi_rttvar = (sock->data.rttvar >> 2) * 1000;
+    ti->tcpi_snd_cwnd = sock->data.cwnd;
+    ti->tcpi_snd_ssthresh = sock->data.ssthresh;
+    ti->tcpi_snd_wnd = sock->data.snd.wnd;
+    ti->tcpi_rcv_wnd = sock->data.rcv.wnd;
+    ti->tcpi_unacked = unacked;
+    ti->tcpi_notsent_bytes = sock->data.sndbuf_cur_sz > unacked ?
+        sock->data.sndbuf_cur_sz - unacked : 0;
+    ti->tcpi_total_retrans = sock->data.total_retrans;
+    ti->tcpi_segs_out = sock->data.segs_out;
+    ti->tcpi_segs_in = sock->data.segs_in;
+    ti->tcpi_bytes_acked = sock->data.bytes_acked;
+    ti->tcpi_bytes_received = sock->data.bytes_received;
+}
+
 static int net_tcp_getsockopt(net_socket_t *hnd, int level, int option_name,
                               void *option_value, socklen_t *option_len) {
     int tmp;
     struct tcp_sock *sock;
+    struct tcp_info ti;
 
     if(!option_value || !option_len) {
         errno = EFAULT;
@@ -1730,6 +1979,33 @@ static int net_tcp_getsockopt(net_socket_t *hnd, int level, int option_name,
                     tmp = !!(sock->flags & FS_SOCKET_V6ONLY);
                     goto copy_int;
             }
+
+            break;
+
+        case IPPROTO_TCP:
+
+            switch(option_name) {
+                case TCP_NODELAY:
+                    tmp = !!(sock->intflags & TCP_IFLAG_NODELAY);
+                    goto copy_int;
+
+                case TCP_CORK:
+                    tmp = !!(sock->intflags & TCP_IFLAG_CORK);
+                    goto copy_int;
+
+                case TCP_INFO:
+                    tcp_get_info(sock, &ti);
+
+                    if(*option_len > sizeof(struct tcp_info))
+                        *option_len = sizeof(struct tcp_info);
+
+                    memcpy(option_value, &ti, *option_len);
+                    mutex_unlock(&sock->mutex);
+                    rwsem_read_unlock(&tcp_sem);
+                    return 0;
+            }
+
+            break;
     }
 
     /* If it wasn't handled, return that error. */
@@ -1803,6 +2079,65 @@ static int net_tcp_setsockopt(net_socket_t *hnd, int level, int option_name,
                 case SO_ERROR:
                 case SO_TYPE:
                     goto ret_inval;
+
+                case SO_RCVBUF:
+                case SO_SNDBUF:
+
+                    if(option_len != sizeof(int))
+                        goto ret_inval;
+
+                    tmp = *((int *)option_value);
+
+                    if(tmp < TCP_MIN_BUFSZ)
+                        tmp = TCP_MIN_BUFSZ;
+                    else if(tmp > TCP_MAX_BUFSZ)
+                        tmp = TCP_MAX_BUFSZ;
+
+                    /* Explicitly setting the receive buffer size turns off
+                       auto-tuning on it, like on other systems. */
+                    if(option_name == SO_RCVBUF)
+                        sock->intflags |= TCP_IFLAG_RCVBUFLOCK;
+
+                    switch(sock->state) {
+                        case TCP_STATE_CLOSED:
+                        case TCP_STATE_LISTEN:
+                            /* No buffers yet, so just save the size. */
+                            if(option_name == SO_RCVBUF)
+                                sock->rcvbuf_sz = tmp;
+                            else
+                                sock->sndbuf_sz = tmp;
+
+                            goto ret_success;
+
+                        case TCP_STATE_SYN_SENT:
+                        case TCP_STATE_SYN_RECEIVED:
+                        case TCP_STATE_ESTABLISHED:
+                        case TCP_STATE_CLOSE_WAIT:
+
+                            /* Allocating memory in an IRQ is a bad idea... */
+                            if(irq_inside_int()) {
+                                mutex_unlock(&sock->mutex);
+                                rwsem_read_unlock(&tcp_sem);
+                                errno = EWOULDBLOCK;
+                                return -1;
+                            }
+
+                            if(option_name == SO_RCVBUF)
+                                tmp = tcp_resize_rcvbuf(sock, tmp);
+                            else
+                                tmp = tcp_resize_sndbuf(sock, tmp);
+
+                            if(tmp) {
+                                mutex_unlock(&sock->mutex);
+                                rwsem_read_unlock(&tcp_sem);
+                                errno = ENOBUFS;
+                                return -1;
+                            }
+
+                            goto ret_success;
+                    }
+
+                    goto ret_inval;
             }
 
             break;
@@ -1869,6 +2204,37 @@ static int net_tcp_setsockopt(net_socket_t *hnd, int level, int option_name,
                     goto ret_success;
             }
 
+            break;
+
+        case IPPROTO_TCP:
+
+            switch(option_name) {
+                case TCP_NODELAY:
+                case TCP_CORK:
+
+                    if(option_len != sizeof(int))
+                        goto ret_inval;
+
+                    tmp = option_name == TCP_NODELAY ? TCP_IFLAG_NODELAY :
+                          TCP_IFLAG_CORK;
+
+                    if(*((int *)option_value))
+                        sock->intflags |= tmp;
+                    else
+                        sock->intflags &= ~tmp;
+
+                    /* Turning on TCP_NODELAY or turning off TCP_CORK pushes out
+                       anything that was being held back. */
+                    if((sock->state == TCP_STATE_ESTABLISHED ||
+                        sock->state == TCP_STATE_CLOSE_WAIT) &&
+                       (sock->intflags & TCP_IFLAG_HELD) &&
+                       !(sock->intflags & TCP_IFLAG_CORK)) {
+                        tcp_send_data(sock, 0);
+                    }
+
+                    goto ret_success;
+            }
+
             break;
     }
 
@@ -2142,6 +2508,8 @@ static void tcp_rst(netif_t *net, const struct in6_addr *src,
     c = net_ipv6_checksum_pseudo(src, dst, sizeof(tcp_hdr_t), IPPROTO_TCP);
     pkt.checksum = net_ipv4_checksum((const uint8 *)&pkt, sizeof(tcp_hdr_t), c);
 
+    ++tcp_stats.seg_sent;
+    ++tcp_stats.rst_sent;
     net_ipv6_send(net, (const uint8 *)&pkt, sizeof(tcp_hdr_t), 0, IPPROTO_TCP,
                   src, dst);
 }
@@ -2183,14 +2551,138 @@ static void tcp_bpkt_rst(netif_t *net, const struct in6_addr *src,
     pkt.checksum = net_ipv4_checksum((const uint8 *)&pkt, sizeof(tcp_hdr_t),
                                      cs);
 
+    ++tcp_stats.seg_sent;
+    ++tcp_stats.rst_sent;
     net_ipv6_send(net, (const uint8 *)&pkt, sizeof(tcp_hdr_t), 0, IPPROTO_TCP,
                   dst, src);
 }
 
+static inline void tcp_put32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static inline uint32_t tcp_get32(const uint8_t *p) {
+    return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* Our timestamp clock for RFC 7323 ticks once per millisecond. */
+static inline uint32_t tcp_ts_now(void) {
+    return (uint32_t)timer_ms_gettime64();
+}
+
+/* Pick the window scale shift that we'll use on a connection, based on how
+   big the receive buffer is (or could get to, with auto-tuning). */
+static uint8_t tcp_wscale(struct tcp_sock *sock) {
+    uint32_t sz = sock->rcvbuf_sz;
+    uint8_t shift = 0;
+
+    if(!(sock->intflags & TCP_IFLAG_RCVBUFLOCK))
+        sz = MAX(sz, TCP_MAX_AUTO_RCVBUF);
+
+    while(shift < TCP_MAX_WSCALE && (sz >> shift) > 0xFFFF)
+        ++shift;
+
+    return shift;
+}
+
+/* Parse the options out of an incoming segment. The caller should fill in the
+   default MSS before calling, as that differs depending on the state. */
+static int tcp_parse_opts(const tcp_hdr_t *tcp, uint16_t flags,
+                          struct tcp_opts *o) {
+    int j = 0, k;
+    int end_of_opts = TCP_GET_OFFSET(flags) - 20;
+
+    o->wscale = -1;
+    o->has_ts = 0;
+    o->sack_ok = 0;
+    o->nsack = 0;
+
+    while(j < end_of_opts) {
+        switch(tcp->options[j]) {
+            case TCP_OPT_EOL:
+                j = end_of_opts;
+                break;
+
+            case TCP_OPT_NOP:
+                ++j;
+                break;
+
+            case TCP_OPT_MSS:
+                if(j + 4 > end_of_opts || tcp->options[j + 1] != 4)
+                    return -1;
+
+                o->mss = (tcp->options[j + 2] << 8) | tcp->options[j + 3];
+                j += 4;
+                break;
+
+            case TCP_OPT_WSCALE:
+                if(j + 3 > end_of_opts || tcp->options[j + 1] != 3)
+                    return -1;
+
+                o->wscale = tcp->options[j + 2];
+
+                if(o->wscale > TCP_MAX_WSCALE)
+                    o->wscale = TCP_MAX_WSCALE;
+
+                j += 3;
+                break;
+
+            case TCP_OPT_TIMESTAMP:
+                if(j + 10 > end_of_opts || tcp->options[j + 1] != 10)
+                    return -1;
+
+                o->has_ts = 1;
+                o->tsval = tcp_get32(&tcp->options[j + 2]);
+                o->tsecr = tcp_get32(&tcp->options[j + 6]);
+                j += 10;
+                break;
+
+            case TCP_OPT_SACK_PERMITTED:
+                if(j + 2 > end_of_opts || tcp->options[j + 1] != 2)
+                    return -1;
+
+                o->sack_ok = 1;
+                j += 2;
+                break;
+
+            case TCP_OPT_SACK:
+                if(j + 2 > end_of_opts || tcp->options[j + 1] < 10 ||
+                   ((tcp->options[j + 1] - 2) & 7) ||
+                   j + tcp->options[j + 1] > end_of_opts)
+                    return -1;
+
+                for(k = j + 2; k < j + tcp->options[j + 1] && o->nsack < 4;
+                    k += 8) {
+                    o->sack[o->nsack].start = tcp_get32(&tcp->options[k]);
+                    o->sack[o->nsack].end = tcp_get32(&tcp->options[k + 4]);
+                    ++o->nsack;
+                }
+
+                j += tcp->options[j + 1];
+                break;
+
+            default:
+
+                /* Skip unknown options */
+                if(j + 1 >= end_of_opts || tcp->options[j + 1] < 2 ||
+                        j + tcp->options[j + 1] > end_of_opts)
+                    return -1;
+
+                j += tcp->options[j + 1];
+        }
+    }
+
+    return 0;
+}
+
 static int tcp_send_syn(struct tcp_sock *sock, int ack) {
-    uint8_t rawpkt[sizeof(tcp_hdr_t) + 4];
+    uint8_t rawpkt[sizeof(tcp_hdr_t) + 24];
     tcp_hdr_t *hdr = (tcp_hdr_t *)rawpkt;
     uint16_t cs;
+    int len = 4;
 
     /* Fill in the base packet */
     hdr->src_port = sock->local_addr.sin6_port;
@@ -2198,166 +2690,876 @@ static int tcp_send_syn(struct tcp_sock *sock, int ack) {
     hdr->seq = htonl(sock->data.snd.iss);
     hdr->ack = htonl(sock->data.rcv.nxt);
 
-    if(ack) {
-        hdr->off_flags = htons(TCP_FLAG_SYN | TCP_FLAG_ACK | TCP_OFFSET(6));
-    }
-    else {
-        hdr->off_flags = htons(TCP_FLAG_SYN | TCP_OFFSET(6));
-    }
-
-    hdr->wnd = htons(sock->data.rcv.wnd);
+    /* The window in a <SYN> is never scaled. */
+    hdr->wnd = htons(MIN(sock->data.rcv.wnd, 0xFFFF));
     hdr->checksum = 0;
     hdr->urg = 0;
 
-    /* Fill in our SYN options. The only one we worry about right now is MSS. */
+    /* Fill in our SYN options. We always send the MSS, and send the window
+       scale, timestamp and SACK-permitted options if we're offering them (or if
+       the other side did, in the case of a <SYN,ACK>). */
     hdr->options[0] = TCP_OPT_MSS;
     hdr->options[1] = 4;
     hdr->options[2] = (TCP_DEFAULT_MSS >> 8) & 0xFF;
     hdr->options[3] = TCP_DEFAULT_MSS & 0xFF;
 
+    if(sock->intflags & TCP_IFLAG_WSCALE) {
+        hdr->options[len++] = TCP_OPT_NOP;
+        hdr->options[len++] = TCP_OPT_WSCALE;
+        hdr->options[len++] = 3;
+        hdr->options[len++] = sock->data.rcv.wscale;
+    }
+
+    if(sock->intflags & TCP_IFLAG_TSTAMP) {
+        hdr->options[len++] = TCP_OPT_NOP;
+        hdr->options[len++] = TCP_OPT_NOP;
+        hdr->options[len++] = TCP_OPT_TIMESTAMP;
+        hdr->options[len++] = 10;
+        tcp_put32(&hdr->options[len], tcp_ts_now());
+        tcp_put32(&hdr->options[len + 4], ack ? sock->data.ts_recent : 0);
+        len += 8;
+    }
+
+    if(sock->intflags & TCP_IFLAG_SACK) {
+        hdr->options[len++] = TCP_OPT_NOP;
+        hdr->options[len++] = TCP_OPT_NOP;
+        hdr->options[len++] = TCP_OPT_SACK_PERMITTED;
+        hdr->options[len++] = 2;
+    }
+
+    len += sizeof(tcp_hdr_t);
+
+    if(ack) {
+        hdr->off_flags = htons(TCP_FLAG_SYN | TCP_FLAG_ACK |
+                               TCP_OFFSET(len >> 2));
+
+        /* This counts as the first ACK we've sent, for deciding when to save
+           the other side's timestamp and when to send a window update. */
+        sock->data.rcv.last_ack = sock->data.rcv.nxt;
+        sock->data.rcv.last_wnd = MIN(sock->data.rcv.wnd, 0xFFFF);
+    }
+    else {
+        hdr->off_flags = htons(TCP_FLAG_SYN | TCP_OFFSET(len >> 2));
+    }
+
     /* Calculate the real checksum */
     cs = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
                                   &sock->remote_addr.sin6_addr,
-                                  sizeof(tcp_hdr_t) + 4, IPPROTO_TCP);
-    hdr->checksum = net_ipv4_checksum(rawpkt, sizeof(tcp_hdr_t) + 4, cs);
+                                  len, IPPROTO_TCP);
+    hdr->checksum = net_ipv4_checksum(rawpkt, len, cs);
 
-    return net_ipv6_send(sock->data.net, rawpkt, sizeof(tcp_hdr_t) + 4,
-                         sock->hop_limit, IPPROTO_TCP,
-                         &sock->local_addr.sin6_addr,
+    ++tcp_stats.seg_sent;
+    ++sock->data.segs_out;
+
+    return net_ipv6_send(sock->data.net, rawpkt, len, sock->hop_limit,
+                         IPPROTO_TCP, &sock->local_addr.sin6_addr,
                          &sock->remote_addr.sin6_addr);
 }
 
-static void tcp_send_fin_ack(struct tcp_sock *sock) {
-    uint8_t rawpkt[sizeof(tcp_hdr_t)];
-    tcp_hdr_t *hdr = (tcp_hdr_t *)rawpkt;
-    uint16_t cs;
+/* Fill in the parts of the header that are common to all segments we send on a
+   synchronized connection, including the timestamp option if it is in use on
+   the connection. Returns the length of the header, including options. */
+static int tcp_fill_hdr(struct tcp_sock *sock, tcp_hdr_t *hdr, uint32_t seq,
+                        uint16_t flags) {
+    uint32_t wnd = sock->data.rcv.wnd >> sock->data.rcv.wscale;
+    int len = sizeof(tcp_hdr_t);
+
+    if(wnd > 0xFFFF)
+        wnd = 0xFFFF;
 
-    /* Fill in the base packet */
     hdr->src_port = sock->local_addr.sin6_port;
     hdr->dst_port = sock->remote_addr.sin6_port;
-    hdr->seq = htonl(sock->data.snd.nxt);
+    hdr->seq = htonl(seq);
     hdr->ack = htonl(sock->data.rcv.nxt);
-    hdr->off_flags = htons(TCP_FLAG_FIN | TCP_FLAG_ACK | TCP_OFFSET(5));
-    hdr->wnd = htons(sock->data.rcv.wnd);
+    hdr->wnd = htons(wnd);
     hdr->checksum = 0;
     hdr->urg = 0;
 
-    /* Calculate the real checksum */
-    cs = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
-                                  &sock->remote_addr.sin6_addr,
-                                  sizeof(tcp_hdr_t), IPPROTO_TCP);
-    hdr->checksum = net_ipv4_checksum(rawpkt, sizeof(tcp_hdr_t), cs);
+    if(sock->intflags & TCP_IFLAG_TSTAMP) {
+        hdr->options[0] = TCP_OPT_NOP;
+        hdr->options[1] = TCP_OPT_NOP;
+        hdr->options[2] = TCP_OPT_TIMESTAMP;
+        hdr->options[3] = 10;
+        tcp_put32(&hdr->options[4], tcp_ts_now());
+        tcp_put32(&hdr->options[8], sock->data.ts_recent);
+        len += TCP_TS_OPT_LEN;
+    }
 
-    net_ipv6_send(sock->data.net, rawpkt, sizeof(tcp_hdr_t), sock->hop_limit,
-                  IPPROTO_TCP, &sock->local_addr.sin6_addr,
-                  &sock->remote_addr.sin6_addr);
+    hdr->off_flags = htons(flags | TCP_OFFSET(len >> 2));
+
+    /* Remember what we've told the other side, for window updates and for
+       deciding when to update ts_recent (RFC 7323, section 4.3). Since this
+       segment carries an ACK, any delayed ACK is taken care of now too. */
+    sock->data.rcv.last_ack = sock->data.rcv.nxt;
+    sock->data.rcv.last_wnd = wnd << sock->data.rcv.wscale;
+    sock->intflags &= ~TCP_IFLAG_ACKPENDING;
+
+    return len;
 }
 
-static void tcp_send_ack(struct tcp_sock *sock) {
-    tcp_hdr_t hdr;
-    uint16_t c;
+static void tcp_send_fin_ack(struct tcp_sock *sock) {
+    uint8_t rawpkt[sizeof(tcp_hdr_t) + TCP_TS_OPT_LEN];
+    tcp_hdr_t *hdr = (tcp_hdr_t *)rawpkt;
+    uint16_t cs;
+    int len;
 
     /* Fill in the base packet */
-    hdr.src_port = sock->local_addr.sin6_port;
-    hdr.dst_port = sock->remote_addr.sin6_port;
-    hdr.seq = htonl(sock->data.snd.nxt);
-    hdr.ack = htonl(sock->data.rcv.nxt);
-    hdr.off_flags = htons(TCP_FLAG_ACK | TCP_OFFSET(5));
-    hdr.wnd = htons(sock->data.rcv.wnd);
-    hdr.checksum = 0;
-    hdr.urg = 0;
+    len = tcp_fill_hdr(sock, hdr, sock->data.snd.nxt,
+                       TCP_FLAG_FIN | TCP_FLAG_ACK);
 
     /* Calculate the real checksum */
-    c = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
-                                 &sock->remote_addr.sin6_addr,
-                                 sizeof(tcp_hdr_t), IPPROTO_TCP);
-    hdr.checksum = net_ipv4_checksum((const uint8 *)&hdr, sizeof(tcp_hdr_t), c);
+    cs = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
+                                  &sock->remote_addr.sin6_addr,
+                                  len, IPPROTO_TCP);
+    hdr->checksum = net_ipv4_checksum(rawpkt, len, cs);
 
-    net_ipv6_send(sock->data.net, (const uint8 *)&hdr, sizeof(tcp_hdr_t),
-                  sock->hop_limit, IPPROTO_TCP, &sock->local_addr.sin6_addr,
+    ++tcp_stats.seg_sent;
+    ++sock->data.segs_out;
+    net_ipv6_send(sock->data.net, rawpkt, len, sock->hop_limit,
+                  IPPROTO_TCP, &sock->local_addr.sin6_addr,
                   &sock->remote_addr.sin6_addr);
 }
 
-static void tcp_send_data(struct tcp_sock *sock, int resend) {
-    uint32_t wnd = sock->data.snd.wnd, snd;
-    int sz = sizeof(tcp_hdr_t);
-    uint8_t rawpkt[1500];
-    tcp_hdr_t *hdr = (tcp_hdr_t *)rawpkt;
+/* Tack SACK blocks describing our out-of-order queue onto the end of a header
+   that's already been filled in by tcp_fill_hdr(). The first block is always
+   the one holding the segment we got most recently (RFC 2018, section 4). We
+   only ever send these on pure ACKs, so they don't eat into the space for data
+   in our segments. Returns the new length of the header. */
+static int tcp_fill_sack(struct tcp_sock *sock, tcp_hdr_t *hdr, int len) {
+    int i, first = 0, cnt = 0, max, olen;
+    uint8_t *opt = ((uint8_t *)hdr) + len;
+    const struct tcp_sack_blk *b;
+
+    if(!(sock->intflags & TCP_IFLAG_SACK) || !sock->data.ooo_cnt)
+        return len;
+
+    /* We get 40 bytes of options in total, which means four blocks or three if
+       we're sending timestamps too. */
+    max = (40 - (len - (int)sizeof(tcp_hdr_t)) - 4) >> 3;
+
+    for(i = 0; i < sock->data.ooo_cnt; ++i) {
+        b = &sock->data.ooo[i];
+
+        if(SEQ_LE(b->start, sock->data.ooo_recent) &&
+           SEQ_LT(sock->data.ooo_recent, b->end)) {
+            first = i;
+            break;
+        }
+    }
+
+    opt[0] = TCP_OPT_NOP;
+    opt[1] = TCP_OPT_NOP;
+    opt[2] = TCP_OPT_SACK;
+    olen = 4;
+
+    for(i = -1; i < sock->data.ooo_cnt && cnt < max; ++i) {
+        if(i == first)
+            continue;
+
+        b = &sock->data.ooo[i < 0 ? first : i];
+        tcp_put32(&opt[olen], b->start);
+        tcp_put32(&opt[olen + 4], b->end);
+        olen += 8;
+        ++cnt;
+    }
+
+    opt[3] = olen - 2;
+    len += olen;
+    hdr->off_flags = htons(TCP_FLAG_ACK | TCP_OFFSET(len >> 2));
+
+    return len;
+}
+
+static void tcp_send_ack(struct tcp_sock *sock) {
+    uint8_t rawpkt[sizeof(tcp_hdr_t) + 40];
+    tcp_hdr_t *hdr = (tcp_hdr_t *)rawpkt;
+    net_pbuf_t *p;
+    uint16_t c;
+    int len;
+
+    /* Fill in the base packet */
+    len = tcp_fill_hdr(sock, hdr, sock->data.snd.nxt, TCP_FLAG_ACK);
+    len = tcp_fill_sack(sock, hdr, len);
+
+    /* Calculate the real checksum */
+    c = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
+                                 &sock->remote_addr.sin6_addr,
+                                 len, IPPROTO_TCP);
+    hdr->checksum = net_ipv4_checksum(rawpkt, len, c);
+
+    /* Put it in a buffer with room for the lower layers' headers. If we can't
+       get one, the peer will just have to retransmit. */
+    if(!(p = net_pbuf_alloc(NET_PBUF_HEADROOM, len)))
+        return;
+
+    memcpy(p->data, rawpkt, len);
+    ++tcp_stats.seg_sent;
+    ++sock->data.segs_out;
+    net_ipv6_send_pbuf(sock->data.net, p, sock->hop_limit, IPPROTO_TCP,
+                       &sock->local_addr.sin6_addr,
+                       &sock->remote_addr.sin6_addr);
+    net_pbuf_free(p);
+}
+
+/* Build a chain of packet buffers for a segment for a device that can take
+   packets in pieces. Only the header is copied into a buffer of its own, the
+   data is referenced right where it sits in the send buffer (in one or two
+   pieces, depending on whether it wraps around the end). The device has
+   copied it all out by the time the send returns, so nothing needs to be kept
+   around after that. */
+static net_pbuf_t *tcp_seg_chain(struct tcp_sock *sock, const uint8_t *hdr,
+                                 int hlen, uint32_t head, uint32_t len) {
+    net_pbuf_t *p, *d;
+    uint32_t sz = len;
+
+    if(!(p = net_pbuf_alloc(NET_PBUF_HEADROOM, hlen)))
+        return NULL;
+
+    memcpy(p->data, hdr, hlen);
+
+    if(head + len > sock->sndbuf_sz)
+        sz = sock->sndbuf_sz - head;
+
+    if(!(d = net_pbuf_ref(sock->data.sndbuf + head, sz)))
+        goto out_free;
+
+    net_pbuf_cat(p, d);
+
+    if(sz < len) {
+        if(!(d = net_pbuf_ref(sock->data.sndbuf, len - sz)))
+            goto out_free;
+
+        net_pbuf_cat(p, d);
+    }
+
+    return p;
+
+out_free:
+    net_pbuf_free(p);
+    return NULL;
+}
+
+/* Build and send one segment of data out of the send buffer, starting at the
+   given offset into the buffer. Returns the offset into the send buffer just
+   past the end of what was sent. Unless the device can take the segment in
+   pieces, the data is copied out of the send buffer exactly once, into a
+   packet buffer with enough headroom that none of the lower layers need to
+   copy it again, and is checksummed during that copy. */
+static uint32_t tcp_send_seg(struct tcp_sock *sock, uint32_t seq, uint32_t head,
+                             uint32_t len) {
+    uint8_t rawhdr[sizeof(tcp_hdr_t) + TCP_TS_OPT_LEN];
+    tcp_hdr_t *hdr = (tcp_hdr_t *)rawhdr;
+    uint8_t *buf;
+    uint8_t *sb = sock->data.sndbuf + head;
+    netif_t *net = sock->data.net ? sock->data.net : net_default_dev;
+    net_pbuf_t *p;
     uint16_t cs;
-    uint8_t *sb, *buf;
+    int sz, hlen;
+
+    /* Fill in the base packet */
+    hlen = tcp_fill_hdr(sock, hdr, seq, TCP_FLAG_ACK);
+    sz = len + hlen;
+
+    cs = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
+                                  &sock->remote_addr.sin6_addr, sz,
+                                  IPPROTO_TCP);
+
+    if(net && net->if_tx_v && len) {
+        /* If we can't get a buffer, act like the segment was sent and let the
+           retransmission timer deal with it. */
+        if(!(p = tcp_seg_chain(sock, rawhdr, hlen, head, len)))
+            return (head + len) % sock->sndbuf_sz;
+
+        head = (head + len) % sock->sndbuf_sz;
+
+        hdr = (tcp_hdr_t *)p->data;
+        hdr->checksum = net_ipv4_checksum_pbuf(p, cs);
+    }
+    else {
+        if(!(p = net_pbuf_alloc(NET_PBUF_HEADROOM, sz)))
+            return (head + len) % sock->sndbuf_sz;
+
+        memcpy(p->data, rawhdr, hlen);
+        buf = p->data + hlen;
+
+        /* Copy in the data, adding it into the checksum as we go */
+        if(head + len <= sock->sndbuf_sz) {
+            cs = net_ipv4_checksum_copy(buf, sb, len, cs);
+            head += len;
+
+            if(head == sock->sndbuf_sz)
+                head = 0;
+        }
+        else {
+            sz = sock->sndbuf_sz - head;
+            cs = net_ipv4_checksum_copy(buf, sb, sz, cs);
+            cs = net_ipv4_checksum_copy(buf + sz, sock->data.sndbuf, len - sz,
+                                        cs);
+            head = len - sz;
+        }
+
+        /* Finish off the checksum with the header */
+        hdr = (tcp_hdr_t *)p->data;
+        hdr->checksum = net_ipv4_checksum(p->data, hlen, cs);
+    }
+
+    /* Anything that starts below the highest sequence number we've sent has
+       been sent before. */
+    if(SEQ_LT(seq, sock->data.snd.max)) {
+        ++tcp_stats.seg_retransmitted;
+        ++sock->data.total_retrans;
+    }
+
+    ++tcp_stats.seg_sent;
+    ++sock->data.segs_out;
+    net_ipv6_send_pbuf(sock->data.net, p, sock->hop_limit, IPPROTO_TCP,
+                       &sock->local_addr.sin6_addr,
+                       &sock->remote_addr.sin6_addr);
+    net_pbuf_free(p);
+
+    return head;
+}
+
+/* Add the range [start, end) to a sorted list of blocks, merging it with any
+   blocks that it overlaps or touches. Returns the index of the block that the
+   range ended up in, or -1 if it needed a new block and the list was full. */
+static int tcp_blk_add(struct tcp_sack_blk *blks, int *cnt, int max,
+                       uint32_t start, uint32_t end) {
+    int i, j;
+
+    /* Find the first block that doesn't end before this one starts. */
+    for(i = 0; i < *cnt && SEQ_LT(blks[i].end, start); ++i) ;
+
+    if(i < *cnt && SEQ_LE(blks[i].start, end)) {
+        /* Merge into this block, then swallow up anything after it that now
+           overlaps it too. */
+        if(SEQ_LT(start, blks[i].start))
+            blks[i].start = start;
+
+        if(SEQ_GT(end, blks[i].end))
+            blks[i].end = end;
+
+        for(j = i + 1; j < *cnt && SEQ_LE(blks[j].start, blks[i].end); ++j) {
+            if(SEQ_GT(blks[j].end, blks[i].end))
+                blks[i].end = blks[j].end;
+        }
+
+        if(j > i + 1) {
+            memmove(&blks[i + 1], &blks[j],
+                    (*cnt - j) * sizeof(struct tcp_sack_blk));
+            *cnt -= j - i - 1;
+        }
+
+        return i;
+    }
+
+    if(*cnt == max)
+        return -1;
+
+    memmove(&blks[i + 1], &blks[i], (*cnt - i) * sizeof(struct tcp_sack_blk));
+    blks[i].start = start;
+    blks[i].end = end;
+    ++*cnt;
+
+    return i;
+}
+
+/* Throw out everything below seq from a sorted list of blocks. */
+static void tcp_blk_trim(struct tcp_sack_blk *blks, int *cnt, uint32_t seq) {
+    int i;
+
+    for(i = 0; i < *cnt && SEQ_LE(blks[i].end, seq); ++i) ;
+
+    if(i) {
+        memmove(&blks[0], &blks[i], (*cnt - i) * sizeof(struct tcp_sack_blk));
+        *cnt -= i;
+    }
+
+    if(*cnt && SEQ_LT(blks[0].start, seq))
+        blks[0].start = seq;
+}
+
+/* Copy some data into the receive buffer, off bytes past the end of the data
+   that's currently in there. */
+static void tcp_rcvbuf_write(struct tcp_sock *sock, uint32_t off,
+                             const uint8_t *buf, uint32_t len) {
+    uint32_t pos = sock->data.rcvbuf_tail + off, tmp;
+
+    if(pos >= sock->rcvbuf_sz)
+        pos -= sock->rcvbuf_sz;
+
+    if(pos + len <= sock->rcvbuf_sz) {
+        memcpy(sock->data.rcvbuf + pos, buf, len);
+    }
+    else {
+        tmp = sock->rcvbuf_sz - pos;
+        memcpy(sock->data.rcvbuf + pos, buf, tmp);
+        memcpy(sock->data.rcvbuf, buf + tmp, len - tmp);
+    }
+}
+
+/* Mark len bytes past the end of the data in the receive buffer as being in
+   sequence, so that the application can read them. */
+static void tcp_rcvbuf_advance(struct tcp_sock *sock, uint32_t len) {
+    sock->data.bytes_received += len;
+    sock->data.rcv.nxt += len;
+    sock->data.rcv.wnd -= len;
+    sock->data.rcvbuf_cur_sz += len;
+    sock->data.rcvbuf_tail += len;
+
+    if(sock->data.rcvbuf_tail >= sock->rcvbuf_sz)
+        sock->data.rcvbuf_tail -= sock->rcvbuf_sz;
+}
+
+/* Take any SACK blocks from an incoming segment and add them to our record of
+   what the other side has received (the "scoreboard" from RFC 6675). Blocks
+   that don't make sense for what we've sent are ignored. */
+static void tcp_sack_update(struct tcp_sock *sock, const struct tcp_opts *o) {
+    int i;
+    const struct tcp_sack_blk *b;
+
+    for(i = 0; i < o->nsack; ++i) {
+        b = &o->sack[i];
+
+        if(!SEQ_LT(b->start, b->end) || SEQ_LE(b->end, sock->data.snd.una) ||
+           SEQ_GT(b->end, sock->data.snd.max))
+            continue;
+
+        tcp_blk_add(sock->data.sacked, &sock->data.sacked_cnt,
+                    TCP_MAX_SACK_SCORE, b->start, b->end);
+    }
+
+    tcp_blk_trim(sock->data.sacked, &sock->data.sacked_cnt,
+                 sock->data.snd.una);
+}
+
+/* Retransmit one segment out of the first hole in the data that the other side
+   has told us about with SACK blocks, skipping over anything we've already
+   retransmitted in this recovery episode. Returns nonzero if we sent
+   something, or zero if there weren't any holes left to fill. */
+static int tcp_sack_rexmit(struct tcp_sock *sock) {
+    uint32_t seq = sock->data.snd.una, len = 0, off;
+    int i;
+
+    if(!(sock->intflags & TCP_IFLAG_SACK))
+        return 0;
+
+    if(SEQ_GT(sock->data.rexmit_nxt, seq))
+        seq = sock->data.rexmit_nxt;
+
+    /* Holes only exist below the highest SACKed block. */
+    for(i = 0; i < sock->data.sacked_cnt; ++i) {
+        if(SEQ_LE(sock->data.sacked[i].end, seq))
+            continue;
+
+        if(SEQ_LT(seq, sock->data.sacked[i].start)) {
+            len = sock->data.sacked[i].start - seq;
+            break;
+        }
+
+        seq = sock->data.sacked[i].end;
+    }
+
+    if(!len)
+        return 0;
+
+    len = MIN(len, TCP_SEG_SIZE(sock));
+    off = sock->data.sndbuf_acked + (seq - sock->data.snd.una);
+
+    if(off >= sock->sndbuf_sz)
+        off -= sock->sndbuf_sz;
+
+    tcp_send_seg(sock, seq, off, len);
+    sock->data.rexmit_nxt = seq + len;
+
+    return 1;
+}
+
+static void tcp_send_data(struct tcp_sock *sock, int resend) {
+    uint32_t wnd = MIN(sock->data.snd.wnd, sock->data.cwnd), snd;
     uint32_t seq, unacked, head;
+    uint64_t now = timer_ms_gettime64();
 
     if(!resend) {
         seq = sock->data.snd.nxt;
         unacked = sock->data.snd.nxt - sock->data.snd.una;
-        wnd -= unacked;
         head = sock->data.sndbuf_head;
     }
     else {
         seq = sock->data.snd.una;
         unacked = 0;
         head = sock->data.sndbuf_acked;
+
+        /* Karn's algorithm: never take a round-trip time sample from a
+           segment that has been retransmitted. */
+        sock->intflags &= ~TCP_IFLAG_RTTTIMING;
     }
 
-    if(!wnd)
+    if(unacked >= wnd)
+        wnd = 0;
+    else
+        wnd -= unacked;
+
+    /* If the other side has closed its window and we have nothing in flight,
+       send a one byte probe so we find out when it opens again. */
+    if(!wnd && !unacked)
         wnd = 1;
 
-    /* Fill in the base packet */
-    hdr->src_port = sock->local_addr.sin6_port;
-    hdr->dst_port = sock->remote_addr.sin6_port;
-    hdr->ack = htonl(sock->data.rcv.nxt);
-    hdr->off_flags = htons(TCP_FLAG_ACK | TCP_OFFSET(5));
-    hdr->wnd = htons(sock->data.rcv.wnd);
-    hdr->urg = 0;
+    /* The retransmission timer gets (re)started when we retransmit or when we
+       send new data while it isn't already running (RFC 6298, section 5.1). */
+    if(resend || (!unacked && sock->data.sndbuf_cur_sz))
+        sock->data.timer = now;
 
     /* Put on some data if we should do so */
     while(sock->data.sndbuf_cur_sz - unacked && wnd) {
-        hdr->seq = htonl(seq);
-        hdr->checksum = 0;
-        buf = rawpkt + sizeof(tcp_hdr_t);
-        sb = sock->data.sndbuf + head;
         snd = wnd;
 
-        if(snd > sock->data.snd.mss - sizeof(tcp_hdr_t))
-            snd = sock->data.snd.mss - sizeof(tcp_hdr_t);
+        if(snd > TCP_SEG_SIZE(sock))
+            snd = TCP_SEG_SIZE(sock);
 
         if(snd > sock->data.sndbuf_cur_sz - unacked)
             snd = sock->data.sndbuf_cur_sz - unacked;
 
-        /* Copy in the data */
-        if(head + snd <= sock->sndbuf_sz) {
-            memcpy(buf, sb, snd);
-            head += snd;
+        /* If all we have left is less than a full segment, we might want to
+           hang on to it for a bit in hopes of more data coming along. With
+           TCP_CORK set, we wait until we have a full segment. Otherwise, the
+           Nagle algorithm says to wait until everything we've sent has been
+           acknowledged (RFC 1122, section 4.2.3.4). */
+        if(!resend && snd < TCP_SEG_SIZE(sock) &&
+           snd == sock->data.sndbuf_cur_sz - unacked &&
+           !(sock->intflags & (TCP_IFLAG_PUSH | TCP_IFLAG_QUEUEDCLOSE)) &&
+           !(sock->flags & (SHUT_WR << 24)) &&
+           ((sock->intflags & TCP_IFLAG_CORK) ||
+            (unacked && !(sock->intflags & TCP_IFLAG_NODELAY)))) {
+            if(!(sock->intflags & TCP_IFLAG_HELD)) {
+                sock->intflags |= TCP_IFLAG_HELD;
+                sock->data.held_time = now;
+            }
 
-            if(head == sock->sndbuf_sz)
-                head = 0;
+            break;
         }
-        else {
-            sz = sock->sndbuf_sz - head;
-            memcpy(buf, sb, sz);
-            memcpy(buf + sz, sock->data.sndbuf, snd - sz);
-            head = snd - sz;
+
+        /* Time this segment if we aren't timing one already, and it isn't
+           something we've sent before. */
+        if(!resend && !(sock->intflags & TCP_IFLAG_RTTTIMING) &&
+           SEQ_GE(seq, sock->data.snd.max)) {
+            sock->intflags |= TCP_IFLAG_RTTTIMING;
+            sock->data.rtt_seq = seq;
+            sock->data.rtt_start = now;
         }
 
-        sz = snd + sizeof(tcp_hdr_t);
+        head = tcp_send_seg(sock, seq, head, snd);
         wnd -= snd;
         seq += snd;
         unacked += snd;
+    }
+
+    sock->data.sndbuf_head = head;
+
+    if(sock->data.sndbuf_cur_sz == unacked)
+        sock->intflags &= ~(TCP_IFLAG_HELD | TCP_IFLAG_PUSH);
+
+    /* Never pull snd.nxt backwards unless this is a timeout retransmission
+       (go-back-N), or we could end up resending data needlessly. */
+    if(resend || SEQ_GT(seq, sock->data.snd.nxt))
+        sock->data.snd.nxt = seq;
+
+    if(SEQ_GT(seq, sock->data.snd.max))
+        sock->data.snd.max = seq;
+
+    tcp_timer_sched(sock);
+}
+
+/* Set up the initial congestion control state for a connection, once we know
+   the MSS for it (RFC 5681, using the initial window from RFC 3390). */
+static void tcp_cc_init(struct tcp_sock *sock) {
+    uint32_t seg = sock->data.snd.mss ? TCP_SEG_SIZE(sock) : TCP_DEFAULT_MSS;
+
+    sock->data.cwnd = MIN(4 * seg, MAX(2 * seg, 4380));
+    sock->data.ssthresh = TCP_MAX_CWND;
+    sock->data.dupacks = 0;
+    sock->intflags &= ~TCP_IFLAG_FASTRECOV;
+}
+
+/* Update the smoothed round-trip time and retransmission timeout with a new
+   sample, as described in RFC 6298. The srtt is kept scaled by 8 and the
+   rttvar by 4, to avoid losing precision in the fractional updates. */
+static void tcp_rtt_update(struct tcp_sock *sock, uint32_t rtt) {
+    int32_t delta;
+    uint32_t rto;
+
+    if(!rtt)
+        rtt = 1;
+
+    if(!sock->data.srtt) {
+        sock->data.srtt = rtt << 3;
+        sock->data.rttvar = rtt << 1;
+    }
+    else {
+        delta = (int32_t)rtt - (int32_t)(sock->data.srtt >> 3);
+        sock->data.srtt += delta;
+
+        if(delta < 0)
+            delta = -delta;
+
+        delta -= (int32_t)(sock->data.rttvar >> 2);
+        sock->data.rttvar += delta;
+    }
+
+    rto = (sock->data.srtt >> 3) + MAX(TCP_CLOCK_GRAN, sock->data.rttvar);
+
+    if(rto < TCP_MIN_RTTO)
+        rto = TCP_MIN_RTTO;
+    else if(rto > TCP_MAX_RTTO)
+        rto = TCP_MAX_RTTO;
+
+    sock->data.rto = rto;
+}
+
+/* Handle an ACK of new data for congestion control purposes (RFC 5681 and the
+   NewReno modification from RFC 6582). The acked value is how many bytes of
+   data this ACK covered, and snd.una has already been updated. */
+static void tcp_cc_newack(struct tcp_sock *sock, uint32_t ack, uint32_t acked) {
+    uint32_t seg = TCP_SEG_SIZE(sock), incr;
+    uint32_t flight = sock->data.snd.max - ack;
+
+    if(sock->intflags & TCP_IFLAG_FASTRECOV) {
+        if(SEQ_GE(ack, sock->data.recover)) {
+            /* Full acknowledgement: deflate the window and leave recovery. */
+            sock->data.cwnd = MIN(sock->data.ssthresh, MAX(flight, seg) + seg);
+            sock->intflags &= ~TCP_IFLAG_FASTRECOV;
+            sock->data.dupacks = 0;
+        }
+        else {
+            /* Partial acknowledgement: the next hole is lost too, so resend it
+               right away and partially deflate the window. If we have SACK
+               information, resend the next hole we haven't already resent
+               instead. */
+            if(SEQ_LT(sock->data.rexmit_nxt, ack))
+                sock->data.rexmit_nxt = ack;
+
+            if(!tcp_sack_rexmit(sock)) {
+                tcp_send_seg(sock, ack, sock->data.sndbuf_acked,
+                             MIN(seg, flight));
+            }
+
+            sock->data.timer = timer_ms_gettime64();
+
+            /* Deflate the window by the amount of new data acked, and add
+               back one segment if at least that much was (RFC 6582, section
+               3.2, step 3). Never go below one segment though, so that the
+               retransmission we just sent isn't the last thing we send. */
+            if(sock->data.cwnd > acked)
+                sock->data.cwnd -= acked;
+            else
+                sock->data.cwnd = 0;
+
+            if(acked >= seg)
+                sock->data.cwnd += seg;
+
+            if(sock->data.cwnd < seg)
+                sock->data.cwnd = seg;
+        }
+
+        return;
+    }
+
+    sock->data.dupacks = 0;
+
+    if(!acked)
+        return;
+
+    if(sock->data.cwnd < sock->data.ssthresh) {
+        /* Slow start */
+        incr = MIN(acked, seg);
+    }
+    else {
+        /* Congestion avoidance: roughly one segment per round-trip. */
+        incr = (seg * seg) / sock->data.cwnd;
+
+        if(!incr)
+            incr = 1;
+    }
+
+    sock->data.cwnd += incr;
+
+    if(sock->data.cwnd > TCP_MAX_CWND)
+        sock->data.cwnd = TCP_MAX_CWND;
+}
+
+/* Handle a duplicate ACK. On the third one, do a fast retransmit and go into
+   fast recovery. Any further ones inflate the window while in recovery. */
+static void tcp_cc_dupack(struct tcp_sock *sock, uint32_t ack) {
+    uint32_t seg = TCP_SEG_SIZE(sock);
+    uint32_t flight = sock->data.snd.max - sock->data.snd.una;
+
+    ++tcp_stats.dup_acks;
+
+    if(sock->intflags & TCP_IFLAG_FASTRECOV) {
+        /* Each duplicate ACK means a segment has left the network, so we can
+           send another one. Fill in any holes the other side has told us about
+           before sending new data. */
+        sock->data.cwnd += seg;
+
+        if(!tcp_sack_rexmit(sock))
+            tcp_send_data(sock, 0);
 
-        /* Calculate the checksum */
-        cs = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
-                                      &sock->remote_addr.sin6_addr, sz,
-                                      IPPROTO_TCP);
-        hdr->checksum = net_ipv4_checksum(rawpkt, sz, cs);
+        return;
+    }
+
+    if(++sock->data.dupacks != TCP_DUPACK_THRESH)
+        return;
 
-        net_ipv6_send(sock->data.net, rawpkt, sz, sock->hop_limit, IPPROTO_TCP,
-                      &sock->local_addr.sin6_addr,
-                      &sock->remote_addr.sin6_addr);
+    /* Don't go into recovery again for losses from the same window of data
+       that we've already recovered from (RFC 6582, section 3.2). */
+    if(!SEQ_GT(ack, sock->data.recover))
+        return;
+
+    ++tcp_stats.fast_retransmits;
+    sock->data.ssthresh = MAX(flight / 2, 2 * seg);
+    sock->data.recover = sock->data.snd.max;
+    sock->intflags |= TCP_IFLAG_FASTRECOV;
+    sock->intflags &= ~TCP_IFLAG_RTTTIMING;
+    sock->data.rexmit_nxt = sock->data.snd.una;
+
+    if(!tcp_sack_rexmit(sock)) {
+        tcp_send_seg(sock, sock->data.snd.una, sock->data.sndbuf_acked,
+                     MIN(seg, flight));
+        sock->data.rexmit_nxt = sock->data.snd.una + MIN(seg, flight);
     }
 
     sock->data.timer = timer_ms_gettime64();
-    sock->data.sndbuf_head = head;
-    sock->data.snd.nxt = seq;
+    sock->data.cwnd = sock->data.ssthresh + TCP_DUPACK_THRESH * seg;
+}
+
+/* The retransmission timer has expired. Collapse the congestion window, back
+   off the timer, and resend starting at the oldest unacknowledged byte. */
+static void tcp_rto_expired(struct tcp_sock *sock) {
+    uint32_t seg = TCP_SEG_SIZE(sock);
+    uint32_t flight = sock->data.snd.max - sock->data.snd.una;
+
+    ++tcp_stats.timeouts;
+    ++sock->data.rexmits;
+    sock->data.ssthresh = MAX(flight / 2, 2 * seg);
+    sock->data.cwnd = seg;
+    sock->data.recover = sock->data.snd.max;
+    sock->data.dupacks = 0;
+    sock->intflags &= ~TCP_IFLAG_FASTRECOV;
+    sock->data.rto = MIN(sock->data.rto << 1, TCP_MAX_RTTO);
+
+    /* The other side is allowed to throw away data that it has SACKed, so we
+       can't trust the scoreboard after a timeout (RFC 2018, section 8). */
+    sock->data.sacked_cnt = 0;
+    sock->data.rexmit_nxt = sock->data.snd.una;
+
+    tcp_send_data(sock, 1);
+}
+
+/* Resize the receive buffer of a connected socket. We never shrink the window
+   that we've already advertised, so the buffer can't get any smaller than the
+   data that's in it plus the current window. */
+static int tcp_resize_rcvbuf(struct tcp_sock *sock, uint32_t sz) {
+    uint8_t *buf;
+    uint32_t cur = sock->data.rcvbuf_cur_sz, tmp, len = cur;
+
+    if(sz < cur + sock->data.rcv.wnd)
+        sz = cur + sock->data.rcv.wnd;
+
+    if(sz == sock->rcvbuf_sz)
+        return 0;
+
+    if(!(buf = (uint8_t *)malloc(sz)))
+        return -1;
+
+    /* Any out-of-order data has to come along too. */
+    if(sock->data.ooo_cnt)
+        len += sock->data.ooo[sock->data.ooo_cnt - 1].end - sock->data.rcv.nxt;
+
+    /* Copy the data over, straightening out the ring buffer as we go. */
+    if(sock->data.rcvbuf_head + len <= sock->rcvbuf_sz) {
+        memcpy(buf, sock->data.rcvbuf + sock->data.rcvbuf_head, len);
+    }
+    else {
+        tmp = sock->rcvbuf_sz - sock->data.rcvbuf_head;
+        memcpy(buf, sock->data.rcvbuf + sock->data.rcvbuf_head, tmp);
+        memcpy(buf + tmp, sock->data.rcvbuf, len - tmp);
+    }
+
+    free(sock->data.rcvbuf);
+    sock->data.rcvbuf = buf;
+    sock->data.rcvbuf_head = 0;
+    sock->data.rcvbuf_tail = cur;
+    sock->data.rcv.wnd += sz - sock->rcvbuf_sz;
+    sock->rcvbuf_sz = sz;
+
+    return 0;
+}
+
+/* Resize the send buffer of a connected socket. Anything that is in the buffer
+   (sent or not) has to stay there, so it can't shrink below that. */
+static int tcp_resize_sndbuf(struct tcp_sock *sock, uint32_t sz) {
+    uint8_t *buf;
+    uint32_t cur = sock->data.sndbuf_cur_sz, tmp, sent;
+
+    if(sz < cur)
+        sz = cur;
+
+    if(sz == sock->sndbuf_sz)
+        return 0;
+
+    if(!(buf = (uint8_t *)malloc(sz)))
+        return -1;
+
+    if(sock->data.sndbuf_acked + cur <= sock->sndbuf_sz) {
+        memcpy(buf, sock->data.sndbuf + sock->data.sndbuf_acked, cur);
+    }
+    else {
+        tmp = sock->sndbuf_sz - sock->data.sndbuf_acked;
+        memcpy(buf, sock->data.sndbuf + sock->data.sndbuf_acked, tmp);
+        memcpy(buf + tmp, sock->data.sndbuf, cur - tmp);
+    }
+
+    sent = MIN(sock->data.snd.nxt - sock->data.snd.una, cur);
+
+    free(sock->data.sndbuf);
+    sock->data.sndbuf = buf;
+    sock->data.sndbuf_acked = 0;
+    sock->data.sndbuf_head = sent == sz ? 0 : sent;
+    sock->data.sndbuf_tail = cur == sz ? 0 : cur;
+    sock->sndbuf_sz = sz;
+
+    return 0;
+}
+
+/* Receive buffer auto-tuning. Once per round-trip time, look at how much data
+   the application has pulled out of the buffer. If the buffer isn't at least
+   twice that, the window is what's limiting throughput, so grow the buffer (and
+   thus the window) to keep up with the bandwidth-delay product. */
+static void tcp_rcvbuf_autotune(struct tcp_sock *sock, uint32_t read) {
+    uint64_t now = timer_ms_gettime64();
+    uint32_t rtt = sock->data.srtt >> 3, want;
+
+    if(irq_inside_int() || sock->rcvbuf_sz >= TCP_MAX_AUTO_RCVBUF)
+        return;
+
+    if(!rtt)
+        rtt = TCP_CLOCK_GRAN;
+
+    sock->data.rcvq_bytes += read;
+
+    if(now - sock->data.rcvq_time < rtt)
+        return;
+
+    want = sock->data.rcvq_bytes << 1;
+
+    if(want > sock->rcvbuf_sz) {
+        /* Grow by at least half again, so we don't reallocate all the time. */
+        want = MAX(want, sock->rcvbuf_sz + (sock->rcvbuf_sz >> 1));
+        tcp_resize_rcvbuf(sock, MIN(want, TCP_MAX_AUTO_RCVBUF));
+    }
+
+    sock->data.rcvq_bytes = 0;
+    sock->data.rcvq_time = now;
 }
 
 #define ADDR_EQUAL(a1, a2) \
@@ -2366,53 +3568,163 @@ static void tcp_send_data(struct tcp_sock *sock, int resend) {
      ((a1).__s6_addr.__s6_addr32[2] == (a2).__s6_addr.__s6_addr32[2]) && \
      ((a1).__s6_addr.__s6_addr32[3] == (a2).__s6_addr.__s6_addr32[3]))
 
+static inline int tcp_port_bucket(uint16_t port) {
+    return ntohs(port) & (TCP_PORT_HASH_SIZE - 1);
+}
+
+static inline int tcp_conn_bucket(const struct in6_addr *raddr, uint16_t rport,
+                                  uint16_t lport) {
+    uint32_t h = raddr->__s6_addr.__s6_addr32[0] ^
+                 raddr->__s6_addr.__s6_addr32[1] ^
+                 raddr->__s6_addr.__s6_addr32[2] ^
+                 raddr->__s6_addr.__s6_addr32[3];
+
+    h ^= ((uint32_t)rport << 16) | lport;
+    h *= 0x9E3779B1;
+
+    return (int)(h >> 24) & (TCP_CONN_HASH_SIZE - 1);
+}
+
+/* Add a socket to the port hash table. The caller must hold the write lock on
+   tcp_sem and the socket must have its local port set. */
+static void tcp_hash_port(struct tcp_sock *sock) {
+    if(sock->hashed & TCP_HASHED_PORT)
+        return;
+
+    LIST_INSERT_HEAD(&tcp_port_hash[tcp_port_bucket(sock->local_addr.sin6_port)],
+                     sock, port_list);
+    sock->hashed |= TCP_HASHED_PORT;
+}
+
+/* Add a socket to the connection hash table. The caller must hold the write
+   lock on tcp_sem and the socket must have both ends of the connection set. */
+static void tcp_hash_conn(struct tcp_sock *sock) {
+    int b;
+
+    if(sock->hashed & TCP_HASHED_CONN)
+        return;
+
+    b = tcp_conn_bucket(&sock->remote_addr.sin6_addr,
+                        sock->remote_addr.sin6_port,
+                        sock->local_addr.sin6_port);
+    LIST_INSERT_HEAD(&tcp_conn_hash[b], sock, conn_list);
+    sock->hashed |= TCP_HASHED_CONN;
+}
+
+/* Remove a socket from any hash tables it is in. The caller must hold the write
+   lock on tcp_sem. */
+static void tcp_unhash(struct tcp_sock *sock) {
+    if(sock->hashed & TCP_HASHED_PORT)
+        LIST_REMOVE(sock, port_list);
+
+    if(sock->hashed & TCP_HASHED_CONN)
+        LIST_REMOVE(sock, conn_list);
+
+    sock->hashed = 0;
+}
+
+/* Check if any socket other than self is using the given local port. The
+   caller must hold tcp_sem. */
+static int tcp_port_used(uint16_t port, struct tcp_sock *self) {
+    struct tcp_sock *i;
+
+    LIST_FOREACH(i, &tcp_port_hash[tcp_port_bucket(port)], port_list) {
+        if(i != self && i->local_addr.sin6_port == port)
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Pick an unused ephemeral port. Rather than searching from the bottom of the
+   range each time, we just keep going from where we left off last time, so in
+   general the first port we try will be free. The caller must hold the write
+   lock on tcp_sem. Returns the port in network byte order, or 0 if every port
+   in the range is in use. */
+static uint16_t tcp_alloc_port(void) {
+    int i;
+    uint16_t port;
+
+    for(i = 0; i <= TCP_EPHEMERAL_MAX - TCP_EPHEMERAL_MIN; ++i) {
+        port = htons(tcp_next_port);
+
+        if(tcp_next_port++ == TCP_EPHEMERAL_MAX)
+            tcp_next_port = TCP_EPHEMERAL_MIN;
+
+        if(!tcp_port_used(port, NULL))
+            return port;
+    }
+
+    return 0;
+}
+
+/* Check whether a socket is allowed to see a packet from the given domain.
+   IPv6-only sockets don't get IPv4 packets, and IPv4 sockets don't get IPv6
+   packets. */
+static inline int tcp_domain_ok(const struct tcp_sock *i, int domain) {
+    return !((domain == AF_INET && (i->flags & FS_SOCKET_V6ONLY)) ||
+             (domain == AF_INET6 && i->domain == AF_INET));
+}
+
 /* Match a socket to an incoming packet. If an actual socket is returned, it is
    the caller's responsibility  to release the socket's mutex when they're done
    with it. */
 static struct tcp_sock *find_sock(const struct in6_addr *src,
                                   const struct in6_addr *dst,
                                   uint16_t sport, uint16_t dport, int domain) {
-    struct tcp_sock *i;
+    struct tcp_sock *i, *rv = NULL;
 
-    LIST_FOREACH(i, &tcp_socks, sock_list) {
+    /* Look for a fully-created socket first. */
+    LIST_FOREACH(i, &tcp_conn_hash[tcp_conn_bucket(src, sport, dport)],
+                 conn_list) {
         /* Ignore any closed sockets */
-        if(i->state == TCP_STATE_CLOSED)
+        if(i->state == TCP_STATE_CLOSED || !tcp_domain_ok(i, domain))
             continue;
 
-        /* Ignore any sockets that are IPv6 only when we have an incoming IPv4
-           packet, or any that are IPv4 only when we have an incoming IPv6
-           packet. */
-        if((domain == AF_INET && (i->flags & FS_SOCKET_V6ONLY)) ||
-                (domain == AF_INET6 && i->domain == AF_INET))
+        if(i->remote_addr.sin6_port != sport ||
+           i->local_addr.sin6_port != dport ||
+           !ADDR_EQUAL(i->remote_addr.sin6_addr, *src))
             continue;
 
-        /* See if the remote end matches what's in the socket */
-        if(!IN6_IS_ADDR_UNSPECIFIED(&i->remote_addr.sin6_addr) &&
-                (!ADDR_EQUAL(i->remote_addr.sin6_addr, *src) ||
-                 i->remote_addr.sin6_port != sport))
+        if(!IN6_IS_ADDR_UNSPECIFIED(&i->local_addr.sin6_addr) &&
+           !ADDR_EQUAL(i->local_addr.sin6_addr, *dst))
             continue;
 
-        /* See if it matches the local end */
-        if((!IN6_IS_ADDR_UNSPECIFIED(&i->local_addr.sin6_addr) &&
-                !ADDR_EQUAL(i->local_addr.sin6_addr, *dst)) ||
-                i->local_addr.sin6_port != dport)
-            continue;
+        rv = i;
+        break;
+    }
 
-        if(irq_inside_int()) {
-            if(mutex_trylock(&i->mutex))
-                return (struct tcp_sock *) - 1;
-        }
-        else {
-            mutex_lock(&i->mutex);
+    /* If we didn't find one of those, look for a listening socket. */
+    if(!rv) {
+        LIST_FOREACH(i, &tcp_port_hash[tcp_port_bucket(dport)], port_list) {
+            if(i->state == TCP_STATE_CLOSED || !tcp_domain_ok(i, domain))
+                continue;
+
+            if(i->local_addr.sin6_port != dport ||
+               !IN6_IS_ADDR_UNSPECIFIED(&i->remote_addr.sin6_addr))
+                continue;
+
+            if(!IN6_IS_ADDR_UNSPECIFIED(&i->local_addr.sin6_addr) &&
+               !ADDR_EQUAL(i->local_addr.sin6_addr, *dst))
+                continue;
+
+            rv = i;
+            break;
         }
+    }
 
-        /* Because we always add new sockets to the head of the list, this
-           should be sufficient to match the socket. See the comment at the top
-           of the file for more discussion of this, if you're interested. */
-        return i;
+    if(!rv)
+        return NULL;
+
+    if(irq_inside_int()) {
+        if(mutex_trylock(&rv->mutex))
+            return (struct tcp_sock *) - 1;
+    }
+    else {
+        mutex_lock(&rv->mutex);
     }
 
-    return NULL;
+    return rv;
 }
 
 extern void __poll_event_trigger(int fd, short event);
@@ -2424,9 +3736,8 @@ extern void __poll_event_trigger(int fd, short event);
 static int listen_pkt(netif_t *src, const struct in6_addr *srca,
                       const struct in6_addr *dsta, const tcp_hdr_t *tcp,
                       struct tcp_sock *s, uint16_t flags, int size) {
-    int j = 0;
-    int end_of_opts;
-    uint16_t mss = 576;
+    int j;
+    struct tcp_opts opts;
 
     (void)size;
 
@@ -2438,40 +3749,16 @@ static int listen_pkt(netif_t *src, const struct in6_addr *srca,
     if(flags & TCP_FLAG_ACK)
         return -1;
 
-    /* Parse options now, in case we need to update the max segment size. */
-    end_of_opts = TCP_GET_OFFSET(flags) - 20;
-
-    while(j < end_of_opts) {
-        switch(tcp->options[j]) {
-            case TCP_OPT_EOL:
-                j = end_of_opts;
-                break;
-
-            case TCP_OPT_NOP:
-                ++j;
-                break;
-
-            case TCP_OPT_MSS:
-                if(j + 4 > end_of_opts || tcp->options[j + 1] != 4)
-                    return -1;
-
-                mss = (tcp->options[j + 2] << 8) | tcp->options[j + 3];
-                j += 4;
-                break;
-
-            default:
+    /* Parse options now, in case we need to update the max segment size or
+       the other side wants window scaling or timestamps. */
+    opts.mss = 576;
 
-                /* Skip unknown options */
-                if(j + 1 > end_of_opts || j + tcp->options[j + 1] > end_of_opts)
-                    return -1;
-
-                j += tcp->options[j + 1];
-        }
-    }
+    if(tcp_parse_opts(tcp, flags, &opts))
+        return -1;
 
     /* Silently cap the MSS... */
-    if(mss > 1460)
-        mss = 1460;
+    if(opts.mss > 1460)
+        opts.mss = 1460;
 
     /* If the SYN bit is set, we should check the security/compartment. We just
        silently ignore them for now. We also ignore the precidence... Thus, the
@@ -2482,14 +3769,20 @@ static int listen_pkt(netif_t *src, const struct in6_addr *srca,
                 ADDR_EQUAL(s->listen.queue[j].local_addr.sin6_addr, *dsta) &&
                 s->listen.queue[j].remote_addr.sin6_port == tcp->src_port) {
             s->listen.queue[j].isn = ntohl(tcp->seq);
-            s->listen.queue[j].mss = mss;
+            s->listen.queue[j].mss = opts.mss;
+            s->listen.queue[j].wscale = opts.wscale;
+            s->listen.queue[j].has_ts = opts.has_ts;
+            s->listen.queue[j].sack_ok = opts.sack_ok;
+            s->listen.queue[j].tsval = opts.tsval;
             return 0;
         }
     }
 
     /* Next, see if we have space for this one in the queue... */
-    if(s->listen.count == s->listen.backlog)
+    if(s->listen.count == s->listen.backlog) {
+        ++tcp_stats.listen_overflows;
         return -1;
+    }
 
     /* The rest of the processing is put off until the program does an accept().
        Save the connection in the list of incoming sockets. */
@@ -2499,8 +3792,12 @@ static int listen_pkt(netif_t *src, const struct in6_addr *srca,
     s->listen.queue[s->listen.tail].local_addr.sin6_addr = *dsta;
     s->listen.queue[s->listen.tail].local_addr.sin6_port = tcp->dst_port;
     s->listen.queue[s->listen.tail].isn = ntohl(tcp->seq);
-    s->listen.queue[s->listen.tail].mss = mss;
+    s->listen.queue[s->listen.tail].mss = opts.mss;
     s->listen.queue[s->listen.tail].wnd = ntohs(tcp->wnd);
+    s->listen.queue[s->listen.tail].wscale = opts.wscale;
+    s->listen.queue[s->listen.tail].has_ts = opts.has_ts;
+    s->listen.queue[s->listen.tail].sack_ok = opts.sack_ok;
+    s->listen.queue[s->listen.tail].tsval = opts.tsval;
     ++s->listen.count;
     ++s->listen.tail;
 
@@ -2522,10 +3819,12 @@ static int synsent_pkt(netif_t *src, const struct in6_addr *srca,
                        struct tcp_sock *s, uint16_t flags, int size) {
     uint32_t ack, seq;
     int sz = size - TCP_GET_OFFSET(flags), gotack = 0;
-    int j = 0, end_of_opts, mss = 536;
+    struct tcp_opts opts;
 
     (void)src;
 
+    ++s->data.segs_in;
+
     /* Grab the ack and seq numbers from the packet */
     ack = ntohl(tcp->ack);
     seq = ntohl(tcp->seq);
@@ -2543,6 +3842,7 @@ static int synsent_pkt(netif_t *src, const struct in6_addr *srca,
     /* Next, we check the RST bit */
     if(flags & TCP_FLAG_RST) {
         if(gotack) {
+            ++tcp_stats.conn_reset;
             s->state = TCP_STATE_CLOSED | TCP_STATE_RESET;
             __poll_event_trigger(s->sock, POLLHUP);
             cond_signal(&s->data.recv_cv);
@@ -2558,44 +3858,46 @@ static int synsent_pkt(netif_t *src, const struct in6_addr *srca,
         s->data.rcv.nxt = seq + 1;
         s->data.rcv.irs = seq;
 
-        end_of_opts = TCP_GET_OFFSET(flags) - 20;
+        opts.mss = 536;
 
-        while(j < end_of_opts) {
-            switch(tcp->options[j]) {
-                case TCP_OPT_EOL:
-                    j = end_of_opts;
-                    break;
-
-                case TCP_OPT_NOP:
-                    ++j;
-                    break;
-
-                case TCP_OPT_MSS:
-
-                    if(j + 4 > end_of_opts || tcp->options[j + 1] != 4)
-                        return -1;
+        if(tcp_parse_opts(tcp, flags, &opts))
+            return -1;
 
-                    mss = (tcp->options[j + 2] << 8) | tcp->options[j + 3];
-                    j += 4;
-                    break;
+        s->data.snd.mss = opts.mss > 1460 ? 1460 : opts.mss;
+        s->data.snd.wnd = ntohs(tcp->wnd);
 
-                default:
+        /* Window scaling only gets used if both sides agreed to it. If the
+           other side didn't send the option back, we can't scale either. */
+        if(opts.wscale >= 0) {
+            s->data.snd.wscale = (uint8_t)opts.wscale;
+        }
+        else {
+            s->intflags &= ~TCP_IFLAG_WSCALE;
+            s->data.snd.wscale = s->data.rcv.wscale = 0;
+        }
 
-                    /* Skip unknown options */
-                    if(j + 1 > end_of_opts ||
-                            j + tcp->options[j + 1] > end_of_opts)
-                        return -1;
+        if(opts.has_ts)
+            s->data.ts_recent = opts.tsval;
+        else
+            s->intflags &= ~TCP_IFLAG_TSTAMP;
 
-                    j += tcp->options[j + 1];
-            }
-        }
+        if(!opts.sack_ok)
+            s->intflags &= ~TCP_IFLAG_SACK;
 
-        s->data.snd.mss = mss > 1460 ? 1460 : mss;
-        s->data.snd.wnd = htons(tcp->wnd);
+        tcp_cc_init(s);
 
         if(gotack) {
             s->data.snd.una = ack;
 
+            /* Take our first round-trip time sample from the handshake, as
+               long as we didn't have to retransmit the <SYN>. */
+            if((s->intflags & TCP_IFLAG_RTTTIMING) &&
+               SEQ_GT(ack, s->data.rtt_seq)) {
+                tcp_rtt_update(s, (uint32_t)(timer_ms_gettime64() -
+                                             s->data.rtt_start));
+                s->intflags &= ~TCP_IFLAG_RTTTIMING;
+            }
+
             /* If the ack covers our iss, then we've established the connection.
                Update the state and ack it. */
             if(SEQ_GT(ack, s->data.snd.iss)) {
@@ -2621,22 +3923,40 @@ static int synsent_pkt(netif_t *src, const struct in6_addr *srca,
 static int process_pkt(netif_t *src, const struct in6_addr *srca,
                        const struct in6_addr *dsta, const tcp_hdr_t *tcp,
                        struct tcp_sock *s, uint16_t flags, size_t size) {
-    uint32_t seq, ack, up;
+    uint32_t seq, ack, up, acked, wnd, off;
     size_t sz;
-    int bad_pkt = 0, tmp, acksyn = 0;
+    int bad_pkt = 0, acksyn = 0, sendmore = 0;
     const uint8_t *buf = (const uint8_t *)tcp;
-    uint8_t *rb;
+    struct tcp_opts opts;
 
     (void)src;
 
-    /* Grab the seq and ack values from the header. */
+    ++s->data.segs_in;
+
+    /* Grab the seq and ack values from the header. The window is scaled by
+       whatever the other side asked for in its <SYN>. */
     seq = ntohl(tcp->seq);
     ack = ntohl(tcp->ack);
+    wnd = (uint32_t)ntohs(tcp->wnd) << s->data.snd.wscale;
 
     /* Check the validity of the incoming segment's sequence number */
     sz = size - TCP_GET_OFFSET(flags);
     buf += TCP_GET_OFFSET(flags);
 
+    opts.mss = s->data.snd.mss;
+
+    if(tcp_parse_opts(tcp, flags, &opts))
+        return 0;
+
+    /* Protection Against Wrapped Sequences: throw out anything with a
+       timestamp older than the most recent one we've seen (RFC 7323, section
+       5.3). */
+    if((s->intflags & TCP_IFLAG_TSTAMP) && opts.has_ts &&
+       !(flags & TCP_FLAG_RST) && SEQ_LT(opts.tsval, s->data.ts_recent)) {
+        tcp_send_ack(s);
+        return 0;
+    }
+
     if(s->data.rcv.wnd == 0) {
         if(sz || seq != s->data.rcv.nxt)
             bad_pkt = 1;
@@ -2648,8 +3968,12 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
                 bad_pkt = 1;
         }
         else {
+            /* Segments that start before what we're expecting are fine, so
+               long as some of the data in them is new. */
             if(!(SEQ_GE(seq, s->data.rcv.nxt) &&
-                    SEQ_LT(seq, s->data.rcv.nxt + s->data.rcv.wnd)))
+                    SEQ_LT(seq, s->data.rcv.nxt + s->data.rcv.wnd)) &&
+               !(SEQ_GE(seq + sz - 1, s->data.rcv.nxt) &&
+                    SEQ_LT(seq + sz - 1, s->data.rcv.nxt + s->data.rcv.wnd)))
                 bad_pkt = 1;
         }
     }
@@ -2666,6 +3990,14 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
         return 0;
     }
 
+    /* Save the timestamp to echo back, if this segment is the one we're
+       expecting next (RFC 7323, section 4.3). */
+    if((s->intflags & TCP_IFLAG_TSTAMP) && opts.has_ts &&
+       SEQ_GE(opts.tsval, s->data.ts_recent) &&
+       SEQ_LE(seq, s->data.rcv.last_ack)) {
+        s->data.ts_recent = opts.tsval;
+    }
+
     /* See if we have a reset, and process it */
     if(flags & TCP_FLAG_RST) {
         if(s->state == TCP_STATE_SYN_SENT) {
@@ -2680,6 +4012,7 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
             return 0;
         }
         else {
+            ++tcp_stats.conn_reset;
             s->state = TCP_STATE_RESET | TCP_STATE_CLOSED;
             __poll_event_trigger(s->sock, POLLHUP);
             cond_signal(&s->data.recv_cv);
@@ -2715,10 +4048,20 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
         }
     }
 
-    /* Check the ack number for validity */
-    if(SEQ_LT(s->data.snd.una, ack) && SEQ_LE(ack, s->data.snd.nxt)) {
-        s->data.sndbuf_acked += (int32_t)(ack - s->data.snd.una - acksyn);
-        s->data.sndbuf_cur_sz -= (int32_t)(ack - s->data.snd.una - acksyn);
+    /* Check the ack number for validity. Note that we compare against the
+       highest sequence number we've sent, since a retransmission timeout can
+       pull snd.nxt back behind data that is still in flight. */
+    if((s->intflags & TCP_IFLAG_SACK) && opts.nsack &&
+       SEQ_GE(ack, s->data.snd.una) && SEQ_LE(ack, s->data.snd.max)) {
+        tcp_sack_update(s, &opts);
+    }
+
+    if(SEQ_LT(s->data.snd.una, ack) && SEQ_LE(ack, s->data.snd.max)) {
+        acked = (uint32_t)(ack - s->data.snd.una - acksyn);
+        s->data.bytes_acked += acked;
+        s->data.rexmits = 0;
+        s->data.sndbuf_acked += acked;
+        s->data.sndbuf_cur_sz -= acked;
         s->data.snd.una = ack;
         __poll_event_trigger(s->sock, POLLWRNORM | POLLWRBAND);
         cond_signal(&s->data.send_cv);
@@ -2726,14 +4069,69 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
         if(s->data.sndbuf_acked >= s->sndbuf_sz)
             s->data.sndbuf_acked -= s->sndbuf_sz;
 
+        if(SEQ_LT(s->data.snd.nxt, ack)) {
+            s->data.snd.nxt = ack;
+            s->data.sndbuf_head = s->data.sndbuf_acked;
+        }
+
+        tcp_blk_trim(s->data.sacked, &s->data.sacked_cnt, ack);
+
+        /* Update the round-trip time estimate if this ACK covers the segment
+           we were timing. Getting a valid sample also clears any backoff. With
+           timestamps, the echoed value gives us a sample that is safe to use
+           even for retransmitted data, so we take one of those each window. */
+        if((s->intflags & TCP_IFLAG_TSTAMP) && opts.has_ts && opts.tsecr) {
+            if(SEQ_GT(ack, s->data.rtt_seq)) {
+                tcp_rtt_update(s, tcp_ts_now() - opts.tsecr);
+                s->data.rtt_seq = s->data.snd.max;
+            }
+        }
+        else if((s->intflags & TCP_IFLAG_RTTTIMING) &&
+                SEQ_GT(ack, s->data.rtt_seq)) {
+            tcp_rtt_update(s, (uint32_t)(timer_ms_gettime64() -
+                                         s->data.rtt_start));
+            s->intflags &= ~TCP_IFLAG_RTTTIMING;
+        }
+
+        tcp_cc_newack(s, ack, acked);
+
+        /* Restart the retransmission timer if there's still data in flight
+           (RFC 6298, section 5.3). */
+        if(s->data.snd.una != s->data.snd.max)
+            s->data.timer = timer_ms_gettime64();
+
         if(SEQ_LT(s->data.snd.wl1, seq) ||
                 (s->data.snd.wl1 == seq && SEQ_LE(s->data.snd.wl2, ack))) {
-            s->data.snd.wnd = ntohs(tcp->wnd);
+            s->data.snd.wnd = wnd;
+            s->data.snd.wl1 = seq;
+            s->data.snd.wl2 = ack;
+        }
+
+        sendmore = 1;
+    }
+    else if(ack == s->data.snd.una) {
+        /* A duplicate ACK is one that doesn't advance snd.una, carries no
+           data, has no SYN or FIN and doesn't change the window, while we
+           have data outstanding (RFC 5681, section 2). */
+        if(!sz && !(flags & (TCP_FLAG_SYN | TCP_FLAG_FIN)) &&
+           s->data.snd.una != s->data.snd.max &&
+           wnd == s->data.snd.wnd &&
+           (s->state == TCP_STATE_ESTABLISHED ||
+            s->state == TCP_STATE_CLOSE_WAIT)) {
+            tcp_cc_dupack(s, ack);
+        }
+        else if(SEQ_LT(s->data.snd.wl1, seq) ||
+                (s->data.snd.wl1 == seq && SEQ_LE(s->data.snd.wl2, ack))) {
+            /* Window update */
+            if(wnd > s->data.snd.wnd)
+                sendmore = 1;
+
+            s->data.snd.wnd = wnd;
             s->data.snd.wl1 = seq;
             s->data.snd.wl2 = ack;
         }
     }
-    else if(SEQ_GT(ack, s->data.snd.nxt)) {
+    else if(SEQ_GT(ack, s->data.snd.max)) {
         /* This ACKs something we haven't sent, so try to correct the other side
            and return */
         tcp_send_ack(s);
@@ -2780,6 +4178,14 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
             break;
     }
 
+    /* If the ACK opened up some room in the window, push out any more data
+       that we have queued up to send. */
+    if(sendmore && (s->state == TCP_STATE_ESTABLISHED ||
+                    s->state == TCP_STATE_CLOSE_WAIT) &&
+       s->data.sndbuf_cur_sz > s->data.snd.nxt - s->data.snd.una) {
+        tcp_send_data(s, 0);
+    }
+
     /* Next, we handle the URG bit */
     if(flags & TCP_FLAG_URG) {
         if(s->state == TCP_STATE_ESTABLISHED ||
@@ -2792,36 +4198,70 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
 
     if(s->state == TCP_STATE_ESTABLISHED || s->state == TCP_STATE_FIN_WAIT_1 ||
             s->state == TCP_STATE_FIN_WAIT_2) {
+        /* Trim off anything at the front of the segment that we've already
+           got. The sequence check above makes sure something is left. */
+        if(sz && SEQ_LT(seq, s->data.rcv.nxt)) {
+            off = s->data.rcv.nxt - seq;
+            buf += off;
+            sz -= off;
+            seq = s->data.rcv.nxt;
+        }
+
         /* Next, check the data size versus our window. If its more than the
            window, truncate the data and copy out what we can. */
-        if(sz > s->data.rcv.wnd) {
-            sz = s->data.rcv.wnd;
+        off = seq - s->data.rcv.nxt;
+
+        if(sz > s->data.rcv.wnd - off) {
+            sz = s->data.rcv.wnd - off;
             bad_pkt = 1;
         }
 
-        /* Copy the data out */
-        if(sz) {
-            rb = s->data.rcvbuf + s->data.rcvbuf_tail;
-            s->data.rcv.nxt += sz;
-            s->data.rcv.wnd -= sz;
-            s->data.rcvbuf_cur_sz += sz;
+        if(sz && !off) {
+            /* Copy the data out, along with anything in the out-of-order queue
+               that this segment has made contiguous. */
+            tcp_rcvbuf_write(s, 0, buf, sz);
+            tcp_rcvbuf_advance(s, sz);
 
-            if(s->data.rcvbuf_tail + sz <= s->rcvbuf_sz) {
-                memcpy(rb, buf, sz);
-                s->data.rcvbuf_tail += sz;
-            }
-            else {
-                tmp = s->rcvbuf_sz - s->data.rcvbuf_tail;
-                memcpy(rb, buf, tmp);
-                sz -= tmp;
-                buf += tmp;
-                memcpy(s->data.rcvbuf, buf, sz);
-                s->data.rcvbuf_tail = sz;
+            while(s->data.ooo_cnt &&
+                  SEQ_LE(s->data.ooo[0].start, s->data.rcv.nxt)) {
+                if(SEQ_GT(s->data.ooo[0].end, s->data.rcv.nxt))
+                    tcp_rcvbuf_advance(s, s->data.ooo[0].end - s->data.rcv.nxt);
+
+                tcp_blk_trim(s->data.ooo, &s->data.ooo_cnt, s->data.rcv.nxt);
             }
 
-            /* Signal any waiting thread and send an ack for what we read */
+            /* Signal any waiting thread and acknowledge what we read. We
+               acknowledge every second segment right away, along with any
+               segment that fills in a hole in the sequence space. Otherwise,
+               hold off in hopes of piggybacking the ACK on some data going the
+               other way (RFC 1122, section 4.2.3.2 and RFC 5681, section
+               4.2). */
             __poll_event_trigger(s->sock, POLLRDNORM);
             cond_signal(&s->data.recv_cv);
+
+            if((s->intflags & TCP_IFLAG_ACKPENDING) ||
+               SEQ_GT(s->data.rcv.nxt, seq + sz)) {
+                tcp_send_ack(s);
+            }
+            else {
+                s->intflags |= TCP_IFLAG_ACKPENDING;
+                s->data.ack_time = timer_ms_gettime64();
+            }
+        }
+        else if(sz) {
+            /* This segment is out of order. Stash it in the receive buffer
+               where it belongs (if we have room to keep track of it), and send
+               a duplicate ACK right away so the other side can figure out what
+               it needs to resend (RFC 5681, section 4.2). */
+            if(tcp_blk_add(s->data.ooo, &s->data.ooo_cnt, TCP_MAX_OOO_BLOCKS,
+                           seq, seq + sz) >= 0) {
+                tcp_rcvbuf_write(s, off, buf, sz);
+                s->data.ooo_recent = seq;
+            }
+
+            /* We can't do anything with a FIN until everything before it has
+               shown up. */
+            bad_pkt = 1;
             tcp_send_ack(s);
         }
     }
@@ -2832,8 +4272,9 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
     }
 
     /* Finally, check the FIN bit. We don't try to ack it if the packet had too
-       much data. */
-    if(!bad_pkt && (flags & TCP_FLAG_FIN)) {
+       much data, or if it isn't the next thing we're expecting. */
+    if(!bad_pkt && (flags & TCP_FLAG_FIN) &&
+       seq + sz == s->data.rcv.nxt) {
         /* ACK the FIN */
         ++s->data.rcv.nxt;
         tcp_send_ack(s);
@@ -2871,7 +4312,7 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
 }
 
 static int net_tcp_input(netif_t *src, int domain, const void *hdr,
-                         const uint8 *data, size_t size) {
+                         const uint8 *data, size_t size, net_pbuf_t *pbuf) {
     struct in6_addr srca, dsta;
     const ip_hdr_t *ip4;
     const ipv6_hdr_t *ip6;
@@ -2907,6 +4348,14 @@ static int net_tcp_input(netif_t *src, int domain, const void *hdr,
 
     tcp = (const tcp_hdr_t *)data;
 
+    /* Make sure the header (and its options) actually fit in the packet. */
+    if(size < sizeof(tcp_hdr_t) ||
+       TCP_GET_OFFSET(ntohs(tcp->off_flags)) < sizeof(tcp_hdr_t) ||
+       TCP_GET_OFFSET(ntohs(tcp->off_flags)) > size) {
+        ++tcp_stats.seg_recv_bad_size;
+        return 0;
+    }
+
     /* Check the TCP checksum */
     c = net_ipv6_checksum_pseudo(&srca, &dsta, size, IPPROTO_TCP);
     c = net_ipv4_checksum(data, size, c);
@@ -2914,9 +4363,11 @@ static int net_tcp_input(netif_t *src, int domain, const void *hdr,
     if(c) {
         /* The checksum should be 0 on success, so discard the packet if it does
            not match that expectation. */
+        ++tcp_stats.seg_recv_bad_chksum;
         return 0;
     }
 
+    ++tcp_stats.seg_recv;
     flags = ntohs(tcp->off_flags);
 
     if(irq_inside_int()) {
@@ -2964,8 +4415,15 @@ static int net_tcp_input(netif_t *src, int domain, const void *hdr,
                 break;
         }
 
+        /* Processing the segment may have changed when the socket's timer
+           needs to fire (an ACK being delayed, the retransmission timer being
+           restarted, a move to TIME-WAIT, and so on). */
+        tcp_timer_sched(s);
         mutex_unlock(&s->mutex);
     }
+    else {
+        ++tcp_stats.seg_recv_no_sock;
+    }
 
     rwsem_read_unlock(&tcp_sem);
 
@@ -2977,83 +4435,186 @@ static int net_tcp_input(netif_t *src, int domain, const void *hdr,
     return 0;
 }
 
-static void tcp_thd_cb(void *arg) {
-    struct tcp_sock *i, *tmp;
-    uint64_t timer;
+/* Deal with anything that has come due on a socket. The socket's mutex must be
+   held. */
+static void tcp_sock_timers(struct tcp_sock *i, uint64_t timer) {
+    /* Send any delayed ACK that's been waiting long enough. */
+    if((i->state == TCP_STATE_ESTABLISHED ||
+        i->state == TCP_STATE_FIN_WAIT_1 ||
+        i->state == TCP_STATE_FIN_WAIT_2) &&
+       (i->intflags & TCP_IFLAG_ACKPENDING) &&
+       i->data.ack_time + TCP_DELACK_TIME <= timer) {
+        tcp_send_ack(i);
+    }
 
-    (void)arg;
+    switch(i->state) {
+        case TCP_STATE_LISTEN:
+            break;
 
-    rwsem_read_lock(&tcp_sem);
+        case TCP_STATE_SYN_SENT:
 
-    LIST_FOREACH(i, &tcp_socks, sock_list) {
-        mutex_lock(&i->mutex);
-        timer = timer_ms_gettime64();
+            /* If our last <SYN> was sent more than one  retransmission
+               timeout period ago and we are still in the SYN-SENT state,
+               send another one and back off the timer. */
+            if(i->data.timer + i->data.rto <= timer) {
+                ++tcp_stats.timeouts;
+                ++tcp_stats.seg_retransmitted;
+                ++i->data.rexmits;
+                ++i->data.total_retrans;
+                tcp_send_syn(i, 0);
+                i->data.timer = timer;
+                i->data.rto = MIN(i->data.rto << 1, TCP_MAX_RTTO);
+                i->intflags &= ~TCP_IFLAG_RTTTIMING;
+            }
 
-        switch(i->state) {
-            case TCP_STATE_LISTEN:
-                break;
+            break;
 
-            case TCP_STATE_SYN_SENT:
+        case TCP_STATE_SYN_RECEIVED:
 
-                /* If our last <SYN> was sent more than one  retransmission
-                   timeout period ago and we are still in the SYN-SENT state,
-                   send another one. */
-                if(i->data.timer + TCP_DEFAULT_RTTO <= timer) {
-                    tcp_send_syn(i, 0);
-                    i->data.timer = timer;
-                }
+            /* If our last <SYN,ACK> was sent more than one  retransmission
+               timeout period ago and we are still in the SYN-RECEIVED
+               state, send another one and back off the timer. */
+            if(i->data.timer + i->data.rto <= timer) {
+                ++tcp_stats.timeouts;
+                ++tcp_stats.seg_retransmitted;
+                ++i->data.rexmits;
+                ++i->data.total_retrans;
+                tcp_send_syn(i, 1);
+                i->data.timer = timer;
+                i->data.rto = MIN(i->data.rto << 1, TCP_MAX_RTTO);
+                i->intflags &= ~TCP_IFLAG_RTTTIMING;
+            }
 
-                break;
+            break;
 
-            case TCP_STATE_SYN_RECEIVED:
+        case TCP_STATE_TIME_WAIT:
+
+            /* If the TIME-WAIT timer has expired, then clean up the rest of
+               the connection (the fd was already taken care of by a close()
+               call earlier that ended up putting us in this state). */
+            if(i->data.timer + 2 * TCP_DEFAULT_MSL <= timer)
+                i->state = TCP_STATE_CLOSED;
+
+            break;
 
-                /* If our last <SYN,ACK> was sent more than one  retransmission
-                   timeout period ago and we are still in the SYN-RECEIVED
-                   state, send another one. */
-                if(i->data.timer + TCP_DEFAULT_RTTO <= timer) {
-                    tcp_send_syn(i, 1);
-                    i->data.timer = timer;
+        case TCP_STATE_ESTABLISHED:
+        case TCP_STATE_CLOSE_WAIT:
+
+            /* Data that we're deliberately holding back can't time out,
+               but anything else in the buffer can (including data that is
+               stuck behind a closed window). Data being held back by
+               TCP_CORK gets sent once it's been sitting there long
+               enough. */
+            if((i->data.snd.una != i->data.snd.max ||
+                (i->data.sndbuf_cur_sz &&
+                 !(i->intflags & TCP_IFLAG_HELD))) &&
+                    i->data.timer + i->data.rto <= timer) {
+                tcp_rto_expired(i);
+            }
+            else if((i->intflags & TCP_IFLAG_HELD) &&
+                    i->data.held_time + TCP_CORK_TIME <= timer) {
+                i->intflags |= TCP_IFLAG_PUSH;
+                tcp_send_data(i, 0);
+            }
+            else if(!i->data.sndbuf_cur_sz &&
+                    (i->intflags & TCP_IFLAG_QUEUEDCLOSE)) {
+                if(i->state == TCP_STATE_ESTABLISHED) {
+                    i->state = TCP_STATE_FIN_WAIT_1;
+                }
+                else {
+                    i->state = TCP_STATE_CLOSING;
                 }
 
-                break;
+                tcp_send_fin_ack(i);
+                i->data.snd.max = ++i->data.snd.nxt;
+            }
 
-            case TCP_STATE_TIME_WAIT:
+            break;
+    }
+}
 
-                /* If the TIME-WAIT timer has expired, then clean up the rest of
-                   the connection (the fd was already taken care of by a close()
-                   call earlier that ended up putting us in this state). */
-                if(i->data.timer + 2 * TCP_DEFAULT_MSL <= timer)
-                    i->state = TCP_STATE_CLOSED;
+static inline uint64_t tcp_earliest(uint64_t a, uint64_t b) {
+    return (!a || b < a) ? b : a;
+}
 
-                break;
+/* Figure out when the next thing is due on a socket, and make sure its timer
+   is going to fire by then. The socket's mutex must be held. This just looks at
+   the state of the socket, so it is safe to call any time something that might
+   affect the timers has changed. */
+static void tcp_timer_sched(struct tcp_sock *sock) {
+    uint64_t when = 0;
 
-            case TCP_STATE_ESTABLISHED:
-            case TCP_STATE_CLOSE_WAIT:
+    if(tcp_timers_off)
+        return;
 
-                if(i->data.sndbuf_cur_sz &&
-                        i->data.timer + TCP_DEFAULT_RTTO <= timer) {
-                    tcp_send_data(i, 1);
-                }
-                else if(!i->data.sndbuf_cur_sz &&
-                        (i->intflags & TCP_IFLAG_QUEUEDCLOSE)) {
-                    if(i->state == TCP_STATE_ESTABLISHED) {
-                        i->state = TCP_STATE_FIN_WAIT_1;
-                    }
-                    else {
-                        i->state = TCP_STATE_CLOSING;
-                    }
+    if((sock->state == TCP_STATE_ESTABLISHED ||
+        sock->state == TCP_STATE_FIN_WAIT_1 ||
+        sock->state == TCP_STATE_FIN_WAIT_2) &&
+       (sock->intflags & TCP_IFLAG_ACKPENDING))
+        when = sock->data.ack_time + TCP_DELACK_TIME;
 
-                    tcp_send_fin_ack(i);
-                    ++i->data.snd.nxt;
-                }
+    switch(sock->state) {
+        case TCP_STATE_SYN_SENT:
+        case TCP_STATE_SYN_RECEIVED:
+            when = tcp_earliest(when, sock->data.timer + sock->data.rto);
+            break;
 
-                break;
-        }
+        case TCP_STATE_TIME_WAIT:
+            when = tcp_earliest(when, sock->data.timer + 2 * TCP_DEFAULT_MSL);
+            break;
 
-        mutex_unlock(&i->mutex);
+        case TCP_STATE_ESTABLISHED:
+        case TCP_STATE_CLOSE_WAIT:
+            if(sock->data.snd.una != sock->data.snd.max ||
+               (sock->data.sndbuf_cur_sz &&
+                !(sock->intflags & TCP_IFLAG_HELD)))
+                when = tcp_earliest(when, sock->data.timer + sock->data.rto);
+            else if(sock->intflags & TCP_IFLAG_HELD)
+                when = tcp_earliest(when,
+                                    sock->data.held_time + TCP_CORK_TIME);
+            else if(!sock->data.sndbuf_cur_sz &&
+                    (sock->intflags & TCP_IFLAG_QUEUEDCLOSE))
+                when = tcp_earliest(when, timer_ms_gettime64());
+
+            break;
+    }
+
+    if(!when)
+        return;
+
+    /* Only move the timer if it has to fire sooner than it already will. If it
+       ends up firing before anything is due, the callback just puts it back. */
+    if(ktimer_pending(&sock->timer) && sock->timer_when <= when)
+        return;
+
+    sock->timer_when = when;
+    ktimer_start_at(&sock->timer, when * 1000, 0);
+}
+
+/* Per-socket timer callback. This runs in the kernel timer thread. */
+static void tcp_timer_cb(ktimer_t *t, void *data) {
+    struct tcp_sock *sock = (struct tcp_sock *)data;
+
+    /* If someone is adding or removing sockets, try again in a moment. Waiting
+       for the lock here could deadlock with a close() that is waiting for this
+       callback to finish. */
+    if(rwsem_read_trylock(&tcp_sem)) {
+        ktimer_start(t, 1000, 0);
+        return;
     }
 
+    mutex_lock(&sock->mutex);
+    tcp_sock_timers(sock, timer_ms_gettime64());
+    tcp_timer_sched(sock);
+    mutex_unlock(&sock->mutex);
+
     rwsem_read_unlock(&tcp_sem);
+}
+
+static void tcp_thd_cb(void *arg) {
+    struct tcp_sock *i, *tmp;
+
+    (void)arg;
 
     /* Go through and clean up any sockets that need to be destroyed. */
     rwsem_write_lock(&tcp_sem);
@@ -3065,7 +4626,9 @@ static void tcp_thd_cb(void *arg) {
 
         if((i->intflags & TCP_IFLAG_CANBEDEL) &&
                 (i->state & 0x0F) == TCP_STATE_CLOSED) {
+            tcp_unhash(i);
             LIST_REMOVE(i, sock_list);
+            ktimer_cancel(&i->timer);
             cond_destroy(&i->data.send_cv);
             cond_destroy(&i->data.recv_cv);
             mutex_destroy(&i->mutex);
@@ -3103,8 +4666,35 @@ static fs_socket_proto_t proto = {
     net_tcp_poll                        /* poll */
 };
 
+net_tcp_stats_t net_tcp_get_stats(void) {
+    return tcp_stats;
+}
+
+int net_tcp_foreach(net_tcp_sock_cb cb, void *data) {
+    struct tcp_sock *i;
+    struct tcp_info ti;
+    int cnt = 0;
+
+    rwsem_read_lock(&tcp_sem);
+
+    LIST_FOREACH(i, &tcp_socks, sock_list) {
+        mutex_lock(&i->mutex);
+        tcp_get_info(i, &ti);
+        cb(&i->local_addr, &i->remote_addr, &ti, data);
+        mutex_unlock(&i->mutex);
+        ++cnt;
+    }
+
+    rwsem_read_unlock(&tcp_sem);
+
+    return cnt;
+}
+
 int net_tcp_init(void) {
-    if((thd_cb_id = net_thd_add_callback(tcp_thd_cb, NULL, 50)) < 0)
+    tcp_timers_off = 0;
+
+    if((thd_cb_id = net_thd_add_callback(tcp_thd_cb, NULL,
+                                         TCP_REAP_TIME)) < 0)
         return -1;
 
     return fs_socket_proto_add(&proto);
@@ -3118,6 +4708,14 @@ void net_tcp_shutdown(void) {
     if(thd_cb_id >= 0)
         net_thd_del_callback(thd_cb_id);
 
+    /* Stop all the socket timers, and make sure nothing starts them back up
+       again. */
+    tcp_timers_off = 1;
+
+    LIST_FOREACH(i, &tcp_socks, sock_list) {
+        ktimer_cancel(&i->timer);
+    }
+
     /* Disable IRQs so we can kill the sockets in peace... */
     old = irq_disable();
 
@@ -3131,6 +4729,7 @@ void net_tcp_shutdown(void) {
             close(i->sock);
         }
         else {
+            tcp_unhash(i);
             LIST_REMOVE(i, sock_list);
             cond_destroy(&i->data.send_cv);
             cond_destroy(&i->data.recv_cv);
@@ -3144,6 +4743,8 @@ void net_tcp_shutdown(void) {
     }
 
     LIST_INIT(&tcp_socks);
+    memset(tcp_port_hash, 0, sizeof(tcp_port_hash));
+    memset(tcp_conn_hash, 0, sizeof(tcp_conn_hash));
 
     /* Remove us from fs_socket and clean up the semaphore */
     fs_socket_proto_remove(&proto);
@@ -0,0 +1,30 @@
+/* KallistiOS ##version##
+
+   kernel/net/net_tcp.h
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+#ifndef __LOCAL_NET_TCP_H
+#define __LOCAL_NET_TCP_H
+
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/* Called by net_tcp_foreach() for each socket. The socket is locked while
+   this runs, so it must not do anything with sockets itself. */
+typedef void (*net_tcp_sock_cb)(const struct sockaddr_in6 *local,
+                                const struct sockaddr_in6 *remote,
+                                const struct tcp_info *info, void *data);
+
+/* Go through all of the TCP sockets. Returns how many there were. This can't
+   be used in an interrupt. */
+int net_tcp_foreach(net_tcp_sock_cb cb, void *data);
+
+__END_DECLS
+
+#endif /* !__LOCAL_NET_TCP_H */
@@ -5,12 +5,18 @@
 
 */
 
+/* This used to be a thread of its own that woke up every 50ms and ran any
+   callbacks that were due. Now each callback is just a periodic kernel timer
+   that runs in the kernel timer thread, so callbacks run when they're due and
+   nothing wakes up when there's nothing to do. */
+
 #include <sys/queue.h>
 #include <errno.h>
 #include <stdlib.h>
 
 #include <kos/thread.h>
-#include <arch/timer.h>
+#include <kos/ktimer.h>
+#include <arch/irq.h>
 #include "net_thd.h"
 
 struct thd_cb {
@@ -19,37 +25,22 @@ struct thd_cb {
     int cbid;
     void (*cb)(void *);
     void *data;
-    uint64 timeout;
-    uint64 nextrun;
+    ktimer_t timer;
 };
 
 TAILQ_HEAD(thd_cb_queue, thd_cb);
 
 static struct thd_cb_queue cbs;
-static kthread_t *thd;
 static int done = 0;
 static int cbid_top;
 
-static void *net_thd_thd(void *data __attribute__((unused))) {
-    struct thd_cb *cb;
-    uint64 now;
-
-    while(!done) {
-        now = timer_ms_gettime64();
-
-        /* Run any callbacks that need to be run now. */
-        TAILQ_FOREACH(cb, &cbs, thds) {
-            if(now >= cb->nextrun) {
-                cb->cb(cb->data);
-                cb->nextrun = now + cb->timeout;
-            }
-        }
+static void net_thd_timer(ktimer_t *t, void *data) {
+    struct thd_cb *cb = (struct thd_cb *)data;
 
-        /* Go to sleep til we need to be run again. */
-        thd_sleep(50);
-    }
+    (void)t;
 
-    return NULL;
+    if(!done)
+        cb->cb(cb->data);
 }
 
 int net_thd_add_callback(void (*cb)(void *), void *data, uint64 timeout) {
@@ -64,17 +55,18 @@ int net_thd_add_callback(void (*cb)(void *), void *data, uint64 timeout) {
         return -1;
     }
 
-    newcb->cbid = cbid_top++;
     newcb->cb = cb;
     newcb->data = data;
-    newcb->timeout = timeout;
-    newcb->nextrun = timer_ms_gettime64() + timeout;
+    ktimer_setup(&newcb->timer, net_thd_timer, newcb, KTIMER_THREAD);
 
     /* Disable interrupts, insert, and reenable interrupts */
     old = irq_disable();
+    newcb->cbid = cbid_top++;
     TAILQ_INSERT_TAIL(&cbs, newcb, thds);
     irq_restore(old);
 
+    ktimer_start(&newcb->timer, timeout * 1000, timeout * 1000);
+
     return newcb->cbid;
 }
 
@@ -90,8 +82,12 @@ int net_thd_del_callback(int cbid) {
     TAILQ_FOREACH(cb, &cbs, thds) {
         if(cb->cbid == cbid) {
             TAILQ_REMOVE(&cbs, cb, thds);
-            free(cb);
             irq_restore(old);
+
+            /* This will wait for the callback to finish, if it happens to be
+               running right now. */
+            ktimer_cancel(&cb->timer);
+            free(cb);
             return 0;
         }
     }
@@ -102,21 +98,20 @@ int net_thd_del_callback(int cbid) {
 }
 
 int net_thd_is_current(void) {
-    return thd_current == thd;
+    return ktimer_thread_current();
 }
 
 void net_thd_kill(void) {
-    /* Do things gracefully, if we can... Otherwise, punt. */
+    struct thd_cb *cb;
+
+    /* Stop all the callbacks. They stay on the list so that whoever added them
+       can still remove them. Nobody should be adding any more at this point,
+       so there's no need to lock the list. */
     done = 1;
 
-    if(!irq_inside_int()) {
-        thd_join(thd, NULL);
-    }
-    else {
-        thd_destroy(thd);
+    TAILQ_FOREACH(cb, &cbs, thds) {
+        ktimer_cancel(&cb->timer);
     }
-
-    thd = NULL;
 }
 
 int net_thd_init(void) {
@@ -124,24 +119,21 @@ int net_thd_init(void) {
     done = 0;
     cbid_top = 1;
 
-    thd = thd_create(0, &net_thd_thd, NULL);
-
     return 0;
 }
 
 void net_thd_shutdown(void) {
     struct thd_cb *c, *n;
 
-    /* Kill the thread. */
-    if(thd) {
-        net_thd_kill();
-    }
+    /* Stop anything that's still running. */
+    net_thd_kill();
 
     /* Free any handlers that we have laying around */
     c = TAILQ_FIRST(&cbs);
 
     while(c) {
         n = TAILQ_NEXT(c, thds);
+        ktimer_cancel(&c->timer);
         free(c);
         c = n;
     }
@@ -18,7 +18,9 @@
 #include <sys/queue.h>
 #include <kos/fs_socket.h>
 #include <arch/irq.h>
+#include <arch/timer.h>
 #include <sys/socket.h>
+#include <time.h>
 
 #include "net_ipv4.h"
 #include "net_ipv6.h"
@@ -26,6 +28,23 @@
 /* Default hop limit (or ttl for IPv4) for new sockets */
 #define UDP_DEFAULT_HOPS    64
 
+/* Size of the hash table used to look up sockets by their local port. This
+   must be a power of two. */
+#define UDP_PORT_HASH_SIZE  64
+
+/* Range of ports that get handed out to sockets that don't bind() to a specific
+   port (the dynamic port range from RFC 6335). */
+#define UDP_EPHEMERAL_MIN   49152
+#define UDP_EPHEMERAL_MAX   65535
+
+/* Limits on how much can be waiting in a socket's receive queue, which can be
+   changed with SO_RCVBUF. Each datagram counts as its size plus the size of
+   the structure that holds onto it, so that a flood of tiny datagrams can't
+   eat up the heap either. */
+#define UDP_DEFAULT_RCVBUF  (64 * 1024)
+#define UDP_MIN_RCVBUF      1024
+#define UDP_MAX_RCVBUF      (1024 * 1024)
+
 #define packed __attribute__((packed))
 typedef struct {
     uint16 src_port    packed;
@@ -40,6 +59,8 @@ struct udp_pkt {
     struct sockaddr_in6 from;
     uint8 *data;
     uint16 datasize;
+    net_pbuf_t *pbuf;
+    size_t cost;
 };
 
 TAILQ_HEAD(udp_pkt_queue, udp_pkt);
@@ -47,8 +68,25 @@ TAILQ_HEAD(udp_pkt_queue, udp_pkt);
 #define UDPSOCK_NO_CHECKSUM 0x00000001
 #define UDPSOCK_LITE_RCVCOV 0x00000002
 
+/* What a queued datagram counts for against SO_RCVBUF. One that hangs on to
+   the packet buffer it came in on keeps the whole buffer around, so that's
+   what gets charged. */
+#define UDP_PKT_COST(sz)    ((sz) + sizeof(struct udp_pkt))
+
+/* Datagrams smaller than this get copied out of their packet buffer, rather
+   than keeping a buffer many times their size pinned while they're queued. */
+#define UDP_PBUF_MIN        256
+
+/* A socket can only keep this many pool buffers pinned in its receive queue,
+   and none at all once the pool is down to its last few buffers. Anything past
+   that gets copied, so that a socket nobody is reading from can't leave the
+   drivers without buffers to receive into. */
+#define UDP_POOL_PINS       4
+#define UDP_POOL_RESERVE    8
+
 struct udp_sock {
     LIST_ENTRY(udp_sock) sock_list;
+    LIST_ENTRY(udp_sock) port_list;
     struct sockaddr_in6 local_addr;
     struct sockaddr_in6 remote_addr;
 
@@ -65,19 +103,129 @@ struct udp_sock {
     } udp_lite;
 
     struct udp_pkt_queue packets;
+    size_t rcvbuf;
+    size_t rcvq_len;
+    int pool_pins;
 };
 
 LIST_HEAD(udp_sock_list, udp_sock);
 
 static struct udp_sock_list net_udp_sockets = LIST_HEAD_INITIALIZER(0);
+static struct udp_sock_list udp_port_hash[UDP_PORT_HASH_SIZE];
+static uint16_t udp_next_port = UDP_EPHEMERAL_MIN;
 static mutex_t udp_mutex = MUTEX_INITIALIZER;
 static net_udp_stats_t udp_stats = { 0 };
 
+static inline int udp_port_bucket(uint16_t port) {
+    return ntohs(port) & (UDP_PORT_HASH_SIZE - 1);
+}
+
+/* Check if any socket other than self is bound to the given port. The caller
+   must hold udp_mutex. */
+static int udp_port_used(uint16_t port, struct udp_sock *self) {
+    struct udp_sock *i;
+
+    LIST_FOREACH(i, &udp_port_hash[udp_port_bucket(port)], port_list) {
+        if(i != self && i->local_addr.sin6_port == port)
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Pick an unused ephemeral port, starting from where we left off last time.
+   The caller must hold udp_mutex. Returns the port in network byte order, or 0
+   if every port in the range is in use. */
+static uint16_t udp_alloc_port(void) {
+    int i;
+    uint16_t port;
+
+    for(i = 0; i <= UDP_EPHEMERAL_MAX - UDP_EPHEMERAL_MIN; ++i) {
+        port = htons(udp_next_port);
+
+        if(udp_next_port++ == UDP_EPHEMERAL_MAX)
+            udp_next_port = UDP_EPHEMERAL_MIN;
+
+        if(!udp_port_used(port, NULL))
+            return port;
+    }
+
+    return 0;
+}
+
+/* Set the local address of a socket and put it in the right spot in the port
+   hash table. The caller must hold udp_mutex. */
+static void udp_set_local(struct udp_sock *sock,
+                          const struct sockaddr_in6 *addr) {
+    if(sock->local_addr.sin6_port)
+        LIST_REMOVE(sock, port_list);
+
+    sock->local_addr = *addr;
+    LIST_INSERT_HEAD(&udp_port_hash[udp_port_bucket(addr->sin6_port)], sock,
+                     port_list);
+}
+
 static int net_udp_send_raw(netif_t *net, const struct sockaddr_in6 *src,
                             const struct sockaddr_in6 *dst, const uint8 *data,
                             size_t size, uint32_t flags, int hops,
                             uint32_t iflags, int proto, uint16_t cscov);
 
+/* Figure out whether a received datagram should keep the packet buffer it
+   came in on, and what it costs to queue it. Returns the buffer to keep, if
+   any. */
+static net_pbuf_t *udp_pkt_pbuf(const struct udp_sock *sock,
+                                const uint8 *data, size_t len,
+                                net_pbuf_t *pbuf, size_t *cost) {
+    if(pbuf && len >= UDP_PBUF_MIN && data >= pbuf->data &&
+       data + len <= pbuf->data + pbuf->len &&
+       (!net_pbuf_pooled(pbuf) || (sock->pool_pins < UDP_POOL_PINS &&
+                                   net_pbuf_pool_avail() > UDP_POOL_RESERVE))) {
+        *cost = UDP_PKT_COST(pbuf->size);
+        return pbuf;
+    }
+
+    *cost = UDP_PKT_COST(len);
+    return NULL;
+}
+
+/* Set up the data for a received packet. If udp_pkt_pbuf() said to keep the
+   packet buffer, we just hang on to a reference to that, otherwise the data
+   gets copied. */
+static int udp_pkt_data(struct udp_sock *sock, struct udp_pkt *pkt,
+                        const uint8 *data, net_pbuf_t *pbuf) {
+    if(pbuf) {
+        pkt->pbuf = pbuf;
+        net_pbuf_addref(pbuf);
+        pkt->data = (uint8 *)data;
+
+        if(net_pbuf_pooled(pbuf))
+            ++sock->pool_pins;
+
+        return 0;
+    }
+
+    pkt->pbuf = NULL;
+
+    if(!(pkt->data = (uint8 *)malloc(pkt->datasize)))
+        return -1;
+
+    memcpy(pkt->data, data, pkt->datasize);
+    return 0;
+}
+
+static void udp_pkt_free(struct udp_sock *sock, struct udp_pkt *pkt) {
+    if(pkt->pbuf) {
+        if(net_pbuf_pooled(pkt->pbuf))
+            --sock->pool_pins;
+
+        net_pbuf_free(pkt->pbuf);
+    }
+    else
+        free(pkt->data);
+
+    free(pkt);
+}
+
 static int net_udp_accept(net_socket_t *hnd, struct sockaddr *addr,
                           socklen_t *addr_len) {
     (void)hnd;
@@ -89,7 +237,7 @@ static int net_udp_accept(net_socket_t *hnd, struct sockaddr *addr,
 
 static int net_udp_bind(net_socket_t *hnd, const struct sockaddr *addr,
                         socklen_t addr_len) {
-    struct udp_sock *udpsock, *iter;
+    struct udp_sock *udpsock;
     struct sockaddr_in *realaddr4;
     struct sockaddr_in6 realaddr6;
 
@@ -165,42 +313,22 @@ static int net_udp_bind(net_socket_t *hnd, const struct sockaddr *addr,
         return -1;
     }
 
-    /* See if we requested a specific port or not */
+    /* See if we requested a specific port or not. If so, make sure we don't
+       already have a socket bound to the port specified. */
     if(realaddr6.sin6_port != 0) {
-        /* Make sure we don't already have a socket bound to the port
-           specified */
-        LIST_FOREACH(iter, &net_udp_sockets, sock_list) {
-            if(iter == udpsock)
-                continue;
-
-            if(iter->local_addr.sin6_port == realaddr6.sin6_port) {
-                mutex_unlock(&udp_mutex);
-                errno = EADDRINUSE;
-                return -1;
-            }
+        if(udp_port_used(realaddr6.sin6_port, udpsock)) {
+            mutex_unlock(&udp_mutex);
+            errno = EADDRINUSE;
+            return -1;
         }
-
-        udpsock->local_addr = realaddr6;
     }
-    else {
-        uint16 port = 1024, tmp = 0;
-
-        /* Grab the first unused port >= 1024. This is, unfortunately, O(n^2) */
-        while(tmp != port) {
-            tmp = port;
-
-            LIST_FOREACH(iter, &net_udp_sockets, sock_list) {
-                if(iter->local_addr.sin6_port == port) {
-                    ++port;
-                    break;
-                }
-            }
-        }
-
-        udpsock->local_addr = realaddr6;
-        udpsock->local_addr.sin6_port = htons(port);
+    else if(!(realaddr6.sin6_port = udp_alloc_port())) {
+        mutex_unlock(&udp_mutex);
+        errno = EADDRINUSE;
+        return -1;
     }
 
+    udp_set_local(udpsock, &realaddr6);
     udpsock->sock = hnd->fd;
 
     mutex_unlock(&udp_mutex);
@@ -314,11 +442,101 @@ static int net_udp_listen(net_socket_t *hnd, int backlog) {
     return -1;
 }
 
-static ssize_t net_udp_recvfrom(net_socket_t *hnd, void *buffer, size_t length,
-                                int flags, struct sockaddr *addr,
-                                socklen_t *addr_len) {
+/* Copy the address a packet came from out to the user, in the socket's address
+   family. */
+static void udp_copy_addr(const struct udp_sock *udpsock,
+                          const struct sockaddr_in6 *from,
+                          struct sockaddr *addr, socklen_t *addr_len) {
+    if(udpsock->domain == AF_INET) {
+        struct sockaddr_in realaddr;
+
+        memset(&realaddr, 0, sizeof(struct sockaddr_in));
+        realaddr.sin_family = AF_INET;
+        realaddr.sin_addr.s_addr = from->sin6_addr.__s6_addr.__s6_addr32[3];
+        realaddr.sin_port = from->sin6_port;
+
+        if(*addr_len < sizeof(struct sockaddr_in)) {
+            memcpy(addr, &realaddr, *addr_len);
+        }
+        else {
+            memcpy(addr, &realaddr, sizeof(struct sockaddr_in));
+            *addr_len = sizeof(struct sockaddr_in);
+        }
+    }
+    else if(udpsock->domain == AF_INET6) {
+        struct sockaddr_in6 realaddr6;
+
+        memset(&realaddr6, 0, sizeof(struct sockaddr_in6));
+        realaddr6.sin6_family = AF_INET6;
+        realaddr6.sin6_addr = from->sin6_addr;
+        realaddr6.sin6_port = from->sin6_port;
+
+        if(*addr_len < sizeof(struct sockaddr_in6)) {
+            memcpy(addr, &realaddr6, *addr_len);
+        }
+        else {
+            memcpy(addr, &realaddr6, sizeof(struct sockaddr_in6));
+            *addr_len = sizeof(struct sockaddr_in6);
+        }
+    }
+}
+
+/* Copy a packet out to a message, scattering it across the message's buffers.
+   Returns the number of bytes to report back for it. */
+static unsigned int udp_pkt_copyout(const struct udp_sock *udpsock,
+                                    const struct udp_pkt *pkt,
+                                    struct msghdr *msg, int flags) {
+    size_t cnt, done = 0;
+    int i;
+
+    for(i = 0; i < msg->msg_iovlen && done < pkt->datasize; ++i) {
+        cnt = pkt->datasize - done;
+
+        if(cnt > msg->msg_iov[i].iov_len)
+            cnt = msg->msg_iov[i].iov_len;
+
+        memcpy(msg->msg_iov[i].iov_base, pkt->data + done, cnt);
+        done += cnt;
+    }
+
+    if(msg->msg_name)
+        udp_copy_addr(udpsock, &pkt->from, (struct sockaddr *)msg->msg_name,
+                      &msg->msg_namelen);
+
+    msg->msg_controllen = 0;
+    msg->msg_flags = done < pkt->datasize ? MSG_TRUNC : 0;
+
+    /* With MSG_TRUNC, the caller wants to know how big the datagram really
+       was, even if it didn't all fit. */
+    return (flags & MSG_TRUNC) ? pkt->datasize : done;
+}
+
+static int udp_msg_valid(const struct msghdr *msg) {
+    int i;
+
+    if(msg->msg_iovlen < 0 || (msg->msg_iovlen && !msg->msg_iov))
+        return 0;
+
+    for(i = 0; i < msg->msg_iovlen; ++i) {
+        if(!msg->msg_iov[i].iov_base && msg->msg_iov[i].iov_len)
+            return 0;
+    }
+
+    return 1;
+}
+
+/* Receive as many datagrams as will fit in msgvec. This only takes the lock
+   once for the whole batch (unless it has to wait for more to come in), which
+   is the whole point of it over calling recvfrom() over and over. */
+static int net_udp_recvmmsg(net_socket_t *hnd, struct mmsghdr *msgvec,
+                            unsigned int vlen, int flags,
+                            struct timespec *timeout) {
     struct udp_sock *udpsock;
     struct udp_pkt *pkt;
+    struct msghdr *msg;
+    uint64 deadline = 0, now;
+    unsigned int cnt = 0;
+    int wait;
 
     if(irq_inside_int()) {
         if(mutex_trylock(&udp_mutex) == -1) {
@@ -338,94 +556,181 @@ static ssize_t net_udp_recvfrom(net_socket_t *hnd, void *buffer, size_t length,
         return -1;
     }
 
-    if(udpsock->flags & (SHUT_RD << 24)) {
-        mutex_unlock(&udp_mutex);
-        return 0;
-    }
-
-    if(buffer == NULL || (addr != NULL && addr_len == NULL)) {
+    if(msgvec == NULL && vlen) {
         mutex_unlock(&udp_mutex);
         errno = EFAULT;
         return -1;
     }
 
-    if(TAILQ_EMPTY(&udpsock->packets) &&
-       ((udpsock->flags & FS_SOCKET_NONBLOCK) || (flags & MSG_DONTWAIT) ||
-        irq_inside_int())) {
-        mutex_unlock(&udp_mutex);
-        errno = EWOULDBLOCK;
-        return -1;
-    }
+    if(timeout) {
+        if(timeout->tv_sec < 0 || timeout->tv_nsec < 0 ||
+           timeout->tv_nsec >= 1000000000) {
+            mutex_unlock(&udp_mutex);
+            errno = EINVAL;
+            return -1;
+        }
 
-    while(TAILQ_EMPTY(&udpsock->packets)) {
-        mutex_unlock(&udp_mutex);
-        genwait_wait(udpsock, "net_udp_recvfrom", 0, NULL);
-        mutex_lock(&udp_mutex);
+        deadline = timer_us_gettime64() + timeout->tv_sec * 1000000ULL +
+            timeout->tv_nsec / 1000;
     }
 
-    pkt = TAILQ_FIRST(&udpsock->packets);
+    while(cnt < vlen) {
+        msg = &msgvec[cnt].msg_hdr;
 
-    if(pkt->datasize > length) {
-        memcpy(buffer, pkt->data, length);
-    }
-    else {
-        memcpy(buffer, pkt->data, pkt->datasize);
-        length = pkt->datasize;
-    }
+        if(!udp_msg_valid(msg)) {
+            if(cnt)
+                break;
+
+            mutex_unlock(&udp_mutex);
+            errno = EFAULT;
+            return -1;
+        }
 
-    if(addr != NULL) {
-        if(udpsock->domain == AF_INET) {
-            struct sockaddr_in realaddr;
+        if(udpsock->flags & (SHUT_RD << 24))
+            break;
 
-            memset(&realaddr, 0, sizeof(struct sockaddr_in));
-            realaddr.sin_family = AF_INET;
-            realaddr.sin_addr.s_addr =
-                pkt->from.sin6_addr.__s6_addr.__s6_addr32[3];
-            realaddr.sin_port = pkt->from.sin6_port;
+        if(TAILQ_EMPTY(&udpsock->packets)) {
+            if((udpsock->flags & FS_SOCKET_NONBLOCK) ||
+               (flags & MSG_DONTWAIT) || irq_inside_int()) {
+                if(cnt)
+                    break;
 
-            if(*addr_len < sizeof(struct sockaddr_in)) {
-                memcpy(addr, &realaddr, *addr_len);
-            }
-            else {
-                memcpy(addr, &realaddr, sizeof(struct sockaddr_in));
-                *addr_len = sizeof(struct sockaddr_in);
+                mutex_unlock(&udp_mutex);
+                errno = EWOULDBLOCK;
+                return -1;
             }
-        }
-        else if(udpsock->domain == AF_INET6) {
-            struct sockaddr_in6 realaddr6;
 
-            memset(&realaddr6, 0, sizeof(struct sockaddr_in6));
-            realaddr6.sin6_family = AF_INET6;
-            realaddr6.sin6_addr = pkt->from.sin6_addr;
-            realaddr6.sin6_port = pkt->from.sin6_port;
+            wait = 0;
 
-            if(*addr_len < sizeof(struct sockaddr_in6)) {
-                memcpy(addr, &realaddr6, *addr_len);
-            }
-            else {
-                memcpy(addr, &realaddr6, sizeof(struct sockaddr_in6));
-                *addr_len = sizeof(struct sockaddr_in6);
+            if(timeout) {
+                now = timer_us_gettime64();
+
+                if(now >= deadline) {
+                    if(cnt)
+                        break;
+
+                    mutex_unlock(&udp_mutex);
+                    errno = EAGAIN;
+                    return -1;
+                }
+
+                wait = (int)((deadline - now + 999) / 1000);
             }
+
+            mutex_unlock(&udp_mutex);
+            genwait_wait(udpsock, "net_udp_recvmmsg", wait, NULL);
+            mutex_lock(&udp_mutex);
+            continue;
         }
-    }
 
-    /* Remove the packet if we're pulling data out of the queue. */
-    if(!(flags & MSG_PEEK)) {
+        pkt = TAILQ_FIRST(&udpsock->packets);
+        msgvec[cnt++].msg_len = udp_pkt_copyout(udpsock, pkt, msg, flags);
+
+        /* Peeking at the same packet over and over isn't very useful, so stop
+           after the first one. */
+        if(flags & MSG_PEEK)
+            break;
+
         TAILQ_REMOVE(&udpsock->packets, pkt, pkt_queue);
-        free(pkt->data);
-        free(pkt);
+        udpsock->rcvq_len -= pkt->cost;
+        udp_pkt_free(udpsock, pkt);
+
+        if(flags & MSG_WAITFORONE)
+            flags |= MSG_DONTWAIT;
     }
 
     mutex_unlock(&udp_mutex);
 
-    return length;
+    return (int)cnt;
+}
+
+static ssize_t net_udp_recvfrom(net_socket_t *hnd, void *buffer, size_t length,
+                                int flags, struct sockaddr *addr,
+                                socklen_t *addr_len) {
+    struct mmsghdr mm;
+    struct iovec iov;
+    int rv;
+
+    if(buffer == NULL || (addr != NULL && addr_len == NULL)) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    iov.iov_base = buffer;
+    iov.iov_len = length;
+
+    memset(&mm, 0, sizeof(mm));
+    mm.msg_hdr.msg_name = addr;
+    mm.msg_hdr.msg_namelen = addr ? *addr_len : 0;
+    mm.msg_hdr.msg_iov = &iov;
+    mm.msg_hdr.msg_iovlen = 1;
+
+    if((rv = net_udp_recvmmsg(hnd, &mm, 1, flags, NULL)) <= 0)
+        return rv;
+
+    if(addr)
+        *addr_len = mm.msg_hdr.msg_namelen;
+
+    return mm.msg_len;
+}
+
+/* Figure out where a datagram is going. If the socket is connected, that's
+   where it goes, otherwise it goes to the address given. */
+static int udp_dest_addr(int domain, const struct sockaddr_in6 *remote,
+                         const struct sockaddr *addr, socklen_t addr_len,
+                         struct sockaddr_in6 *dst) {
+    const struct sockaddr_in *realaddr;
+
+    if(!IN6_IS_ADDR_UNSPECIFIED(&remote->sin6_addr) && remote->sin6_port != 0) {
+        if(addr) {
+            errno = EISCONN;
+            return -1;
+        }
+
+        *dst = *remote;
+    }
+    else if(addr == NULL) {
+        errno = EDESTADDRREQ;
+        return -1;
+    }
+    else if(addr->sa_family != domain) {
+        errno = EAFNOSUPPORT;
+        return -1;
+    }
+    else if(domain == AF_INET6) {
+        if(addr_len != sizeof(struct sockaddr_in6)) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        *dst = *((const struct sockaddr_in6 *)addr);
+    }
+    else if(domain == AF_INET) {
+        if(addr_len != sizeof(struct sockaddr_in)) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        realaddr = (const struct sockaddr_in *)addr;
+        memset(dst, 0, sizeof(struct sockaddr_in6));
+        dst->sin6_family = AF_INET6;
+        dst->sin6_addr.__s6_addr.__s6_addr16[5] = 0xFFFF;
+        dst->sin6_addr.__s6_addr.__s6_addr32[3] = realaddr->sin_addr.s_addr;
+        dst->sin6_port = realaddr->sin_port;
+    }
+    else {
+        /* Shouldn't be able to get here... */
+        errno = EBADF;
+        return -1;
+    }
+
+    return 0;
 }
 
 static ssize_t net_udp_sendto(net_socket_t *hnd, const void *message,
                               size_t length, int flags,
                               const struct sockaddr *addr, socklen_t addr_len) {
     struct udp_sock *udpsock;
-    struct sockaddr_in *realaddr;
     struct sockaddr_in6 realaddr6;
     uint32_t sflags, iflags;
     int hops, proto;
@@ -456,76 +761,101 @@ static ssize_t net_udp_sendto(net_socket_t *hnd, const void *message,
         goto err;
     }
 
-    if(!IN6_IS_ADDR_UNSPECIFIED(&udpsock->remote_addr.sin6_addr) &&
-       udpsock->remote_addr.sin6_port != 0) {
-        if(addr) {
-            errno = EISCONN;
-            goto err;
-        }
-
-        realaddr6 = udpsock->remote_addr;
-    }
-    else if(addr == NULL) {
-        errno = EDESTADDRREQ;
+    if(udp_dest_addr(udpsock->domain, &udpsock->remote_addr, addr, addr_len,
+                     &realaddr6))
         goto err;
-    }
-    else if(addr->sa_family != udpsock->domain) {
-        errno = EAFNOSUPPORT;
+
+    if(message == NULL) {
+        errno = EFAULT;
         goto err;
     }
-    else if(udpsock->domain == AF_INET6) {
-        if(addr_len != sizeof(struct sockaddr_in6)) {
-            errno = EINVAL;
+
+    if(udpsock->local_addr.sin6_port == 0) {
+        local_addr = udpsock->local_addr;
+
+        if(!(local_addr.sin6_port = udp_alloc_port())) {
+            errno = EADDRNOTAVAIL;
             goto err;
         }
 
-        realaddr6 = *((struct sockaddr_in6 *)addr);
+        udp_set_local(udpsock, &local_addr);
     }
-    else if(udpsock->domain == AF_INET) {
-        if(addr_len != sizeof(struct sockaddr_in)) {
-            errno = EINVAL;
-            goto err;
-        }
 
-        realaddr = (struct sockaddr_in *)addr;
-        memset(&realaddr6, 0, sizeof(struct sockaddr_in6));
-        realaddr6.sin6_family = AF_INET6;
-        realaddr6.sin6_addr.__s6_addr.__s6_addr16[5] = 0xFFFF;
-        realaddr6.sin6_addr.__s6_addr.__s6_addr32[3] =
-            realaddr->sin_addr.s_addr;
-        realaddr6.sin6_port = realaddr->sin_port;
+    local_addr = udpsock->local_addr;
+    sflags = udpsock->flags;
+    iflags = udpsock->int_flags;
+    hops = udpsock->hop_limit;
+    proto = udpsock->proto;
+    cscov = udpsock->udp_lite.send_cscov;
+    mutex_unlock(&udp_mutex);
+
+    return net_udp_send_raw(NULL, &local_addr, &realaddr6,
+                            (const uint8 *)message, length, sflags, hops,
+                            iflags, proto, cscov);
+err:
+    mutex_unlock(&udp_mutex);
+    return -1;
+}
+
+/* Send a batch of datagrams. Everything needed from the socket is grabbed
+   under the lock once up front, and the datagrams all go out without it. */
+static int net_udp_sendmmsg(net_socket_t *hnd, struct mmsghdr *msgvec,
+                            unsigned int vlen, int flags) {
+    struct udp_sock *udpsock;
+    struct sockaddr_in6 local_addr, remote_addr, dst;
+    struct msghdr *msg;
+    uint32_t sflags, iflags;
+    int hops, proto, domain, i;
+    uint16_t cscov;
+    unsigned int cnt;
+    const uint8 *data;
+    uint8 *tmp;
+    size_t len;
+    int rv;
+
+    (void)flags;
+
+    if(irq_inside_int()) {
+        if(mutex_trylock(&udp_mutex) == -1) {
+            errno = EWOULDBLOCK;
+            return -1;
+        }
     }
     else {
-        /* Shouldn't be able to get here... */
+        mutex_lock(&udp_mutex);
+    }
+
+    udpsock = (struct udp_sock *)hnd->data;
+
+    if(udpsock == NULL) {
         errno = EBADF;
         goto err;
     }
 
-    if(message == NULL) {
+    if(udpsock->flags & (SHUT_WR << 24)) {
+        errno = EPIPE;
+        goto err;
+    }
+
+    if(msgvec == NULL && vlen) {
         errno = EFAULT;
         goto err;
     }
 
     if(udpsock->local_addr.sin6_port == 0) {
-        uint16 port = 1024, tmp = 0;
-        struct udp_sock *iter;
-
-        /* Grab the first unused port >= 1024. This is, unfortunately, O(n^2) */
-        while(tmp != port) {
-            tmp = port;
+        local_addr = udpsock->local_addr;
 
-            LIST_FOREACH(iter, &net_udp_sockets, sock_list) {
-                if(iter->local_addr.sin6_port == port) {
-                    ++port;
-                    break;
-                }
-            }
+        if(!(local_addr.sin6_port = udp_alloc_port())) {
+            errno = EADDRNOTAVAIL;
+            goto err;
         }
 
-        udpsock->local_addr.sin6_port = htons(port);
+        udp_set_local(udpsock, &local_addr);
     }
 
     local_addr = udpsock->local_addr;
+    remote_addr = udpsock->remote_addr;
+    domain = udpsock->domain;
     sflags = udpsock->flags;
     iflags = udpsock->int_flags;
     hops = udpsock->hop_limit;
@@ -533,9 +863,62 @@ static ssize_t net_udp_sendto(net_socket_t *hnd, const void *message,
     cscov = udpsock->udp_lite.send_cscov;
     mutex_unlock(&udp_mutex);
 
-    return net_udp_send_raw(NULL, &local_addr, &realaddr6,
-                            (const uint8 *)message, length, sflags, hops,
-                            iflags, proto, cscov);
+    for(cnt = 0; cnt < vlen; ++cnt) {
+        msg = &msgvec[cnt].msg_hdr;
+
+        if(!udp_msg_valid(msg)) {
+            errno = EFAULT;
+            break;
+        }
+
+        if(udp_dest_addr(domain, &remote_addr,
+                         (const struct sockaddr *)msg->msg_name,
+                         msg->msg_namelen, &dst))
+            break;
+
+        /* The common case is a datagram in one piece, which can go straight
+           down. Otherwise, it has to be put together first. */
+        tmp = NULL;
+
+        if(msg->msg_iovlen == 1) {
+            data = (const uint8 *)msg->msg_iov[0].iov_base;
+            len = msg->msg_iov[0].iov_len;
+        }
+        else {
+            for(i = 0, len = 0; i < msg->msg_iovlen; ++i) {
+                len += msg->msg_iov[i].iov_len;
+            }
+
+            if(len && !(tmp = (uint8 *)malloc(len))) {
+                errno = ENOBUFS;
+                break;
+            }
+
+            for(i = 0, len = 0; i < msg->msg_iovlen; ++i) {
+                memcpy(tmp + len, msg->msg_iov[i].iov_base,
+                       msg->msg_iov[i].iov_len);
+                len += msg->msg_iov[i].iov_len;
+            }
+
+            data = tmp ? tmp : (const uint8 *)"";
+        }
+
+        rv = net_udp_send_raw(NULL, &local_addr, &dst, data, len, sflags,
+                              hops, iflags, proto, cscov);
+        free(tmp);
+
+        if(rv < 0)
+            break;
+
+        msgvec[cnt].msg_len = (unsigned int)rv;
+    }
+
+    /* Only report an error if nothing at all went out. */
+    if(!cnt && vlen)
+        return -1;
+
+    return (int)cnt;
+
 err:
     mutex_unlock(&udp_mutex);
     return -1;
@@ -601,6 +984,8 @@ static int net_udp_socket(net_socket_t *hnd, int domain, int type, int proto) {
     udpsock->domain = domain;
     udpsock->proto = proto;
     udpsock->hop_limit = UDP_DEFAULT_HOPS;
+    udpsock->sock = hnd->fd;
+    udpsock->rcvbuf = UDP_DEFAULT_RCVBUF;
 
     if(irq_inside_int()) {
         if(mutex_trylock(&udp_mutex) == -1) {
@@ -642,14 +1027,16 @@ static void net_udp_close(net_socket_t *hnd) {
         return;
     }
 
-    TAILQ_FOREACH(pkt, &udpsock->packets, pkt_queue) {
-        free(pkt->data);
+    while((pkt = TAILQ_FIRST(&udpsock->packets))) {
         TAILQ_REMOVE(&udpsock->packets, pkt, pkt_queue);
-        free(pkt);
+        udp_pkt_free(udpsock, pkt);
     }
 
     LIST_REMOVE(udpsock, sock_list);
 
+    if(udpsock->local_addr.sin6_port)
+        LIST_REMOVE(udpsock, port_list);
+
     free(udpsock);
     mutex_unlock(&udp_mutex);
 }
@@ -682,6 +1069,10 @@ static int net_udp_getsockopt(net_socket_t *hnd, int level, int option_name,
                     tmp = 0;
                     goto copy_int;
 
+                case SO_RCVBUF:
+                    tmp = (int)sock->rcvbuf;
+                    goto copy_int;
+
                 case SO_TYPE:
                     tmp = SOCK_DGRAM;
                     goto copy_int;
@@ -803,6 +1194,22 @@ static int net_udp_setsockopt(net_socket_t *hnd, int level, int option_name,
                 case SO_ERROR:
                 case SO_TYPE:
                     goto ret_inval;
+
+                case SO_RCVBUF:
+                    if(option_len != sizeof(int))
+                        goto ret_inval;
+
+                    tmp = *((int *)option_value);
+
+                    if(tmp < UDP_MIN_RCVBUF)
+                        tmp = UDP_MIN_RCVBUF;
+                    else if(tmp > UDP_MAX_RCVBUF)
+                        tmp = UDP_MAX_RCVBUF;
+
+                    /* Anything already queued stays there, even if it's over
+                       the new limit. */
+                    sock->rcvbuf = (size_t)tmp;
+                    goto ret_success;
             }
 
             break;
@@ -1098,12 +1505,13 @@ static short net_udp_poll(net_socket_t *hnd, short events) {
 extern void __poll_event_trigger(int fd, short event);
 
 static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8 *data,
-                          size_t size) {
+                          size_t size, net_pbuf_t *pbuf) {
     udp_hdr_t *hdr = (udp_hdr_t *)data;
     uint16 cs, cscov = 0;
     int partial = 1;
     struct udp_sock *sock;
     struct udp_pkt *pkt;
+    size_t cost;
 
     (void)src;
 
@@ -1161,7 +1569,8 @@ static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8 *data,
            mutex is locked, there isn't much that can be done. */
         return -1;
 
-    LIST_FOREACH(sock, &net_udp_sockets, sock_list) {
+    LIST_FOREACH(sock, &udp_port_hash[udp_port_bucket(hdr->dst_port)],
+                 port_list) {
         /* Don't even bother looking at IPv6-only sockets */
         if(sock->domain == AF_INET6 && (sock->flags & FS_SOCKET_V6ONLY))
             continue;
@@ -1199,6 +1608,18 @@ static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8 *data,
             return 0;
         }
 
+        /* Drop the packet if the queue is full. There's always room for one
+           though, so a datagram bigger than the limit still gets through. */
+        pbuf = udp_pkt_pbuf(sock, data + sizeof(udp_hdr_t),
+                            size - sizeof(udp_hdr_t), pbuf, &cost);
+
+        if(!TAILQ_EMPTY(&sock->packets) &&
+           sock->rcvq_len + cost > sock->rcvbuf) {
+            ++udp_stats.pkt_recv_no_space;
+            mutex_unlock(&udp_mutex);
+            return -1;
+        }
+
         if(!(pkt = (struct udp_pkt *)malloc(sizeof(struct udp_pkt)))) {
             mutex_unlock(&udp_mutex);
             return -1;
@@ -1207,8 +1628,9 @@ static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8 *data,
         memset(pkt, 0, sizeof(struct udp_pkt));
 
         pkt->datasize = size - sizeof(udp_hdr_t);
+        pkt->cost = cost;
 
-        if(!(pkt->data = (uint8 *)malloc(pkt->datasize))) {
+        if(udp_pkt_data(sock, pkt, data + sizeof(udp_hdr_t), pbuf)) {
             free(pkt);
             mutex_unlock(&udp_mutex);
             return -1;
@@ -1219,9 +1641,8 @@ static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8 *data,
         pkt->from.sin6_addr.__s6_addr.__s6_addr32[3] = ip->src;
         pkt->from.sin6_port = hdr->src_port;
 
-        memcpy(pkt->data, data + sizeof(udp_hdr_t), pkt->datasize);
-
         TAILQ_INSERT_TAIL(&sock->packets, pkt, pkt_queue);
+        sock->rcvq_len += pkt->cost;
 
         ++udp_stats.pkt_recv;
         __poll_event_trigger(sock->sock, POLLRDNORM);
@@ -1238,12 +1659,13 @@ static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8 *data,
 }
 
 static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8 *data,
-                          size_t size) {
+                          size_t size, net_pbuf_t *pbuf) {
     udp_hdr_t *hdr = (udp_hdr_t *)data;
     uint16 cs, cscov = 0;
     int partial = 1;
     struct udp_sock *sock;
     struct udp_pkt *pkt;
+    size_t cost;
 
     (void)src;
 
@@ -1299,7 +1721,8 @@ static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8 *data,
            mutex is locked, there isn't much that can be done. */
         return -1;
 
-    LIST_FOREACH(sock, &net_udp_sockets, sock_list) {
+    LIST_FOREACH(sock, &udp_port_hash[udp_port_bucket(hdr->dst_port)],
+                 port_list) {
         /* Don't even bother looking at IPv4 sockets */
         if(sock->domain == AF_INET)
             continue;
@@ -1337,6 +1760,18 @@ static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8 *data,
             return 0;
         }
 
+        /* Drop the packet if the queue is full. There's always room for one
+           though, so a datagram bigger than the limit still gets through. */
+        pbuf = udp_pkt_pbuf(sock, data + sizeof(udp_hdr_t),
+                            size - sizeof(udp_hdr_t), pbuf, &cost);
+
+        if(!TAILQ_EMPTY(&sock->packets) &&
+           sock->rcvq_len + cost > sock->rcvbuf) {
+            ++udp_stats.pkt_recv_no_space;
+            mutex_unlock(&udp_mutex);
+            return -1;
+        }
+
         if(!(pkt = (struct udp_pkt *)malloc(sizeof(struct udp_pkt)))) {
             mutex_unlock(&udp_mutex);
             return -1;
@@ -1345,8 +1780,9 @@ static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8 *data,
         memset(pkt, 0, sizeof(struct udp_pkt));
 
         pkt->datasize = size - sizeof(udp_hdr_t);
+        pkt->cost = cost;
 
-        if(!(pkt->data = (uint8 *)malloc(pkt->datasize))) {
+        if(udp_pkt_data(sock, pkt, data + sizeof(udp_hdr_t), pbuf)) {
             free(pkt);
             mutex_unlock(&udp_mutex);
             return -1;
@@ -1356,9 +1792,8 @@ static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8 *data,
         pkt->from.sin6_addr = ip->src_addr;
         pkt->from.sin6_port = hdr->src_port;
 
-        memcpy(pkt->data, data + sizeof(udp_hdr_t), pkt->datasize);
-
         TAILQ_INSERT_TAIL(&sock->packets, pkt, pkt_queue);
+        sock->rcvq_len += pkt->cost;
 
         ++udp_stats.pkt_recv;
         __poll_event_trigger(sock->sock, POLLRDNORM);
@@ -1375,13 +1810,15 @@ static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8 *data,
 }
 
 static int net_udp_input(netif_t *src, int domain, const void *hdr,
-                         const uint8 *data, size_t size) {
+                         const uint8 *data, size_t size, net_pbuf_t *pbuf) {
     switch(domain) {
         case AF_INET:
-            return net_udp_input4(src, (const ip_hdr_t *)hdr, data, size);
+            return net_udp_input4(src, (const ip_hdr_t *)hdr, data, size,
+                                  pbuf);
 
         case AF_INET6:
-            return net_udp_input6(src, (const ipv6_hdr_t *)hdr, data, size);
+            return net_udp_input6(src, (const ipv6_hdr_t *)hdr, data, size,
+                                  pbuf);
     }
 
     return -1;
@@ -1392,14 +1829,18 @@ static int net_udp_send_raw(netif_t *net, const struct sockaddr_in6 *src,
                             const struct sockaddr_in6 *dst, const uint8 *data,
                             size_t size, uint32_t flags, int hops,
                             uint32_t iflags, int proto, uint16_t cscov) {
-    uint8 buf[size + sizeof(udp_hdr_t)];
-    udp_hdr_t *hdr = (udp_hdr_t *)buf;
+    net_pbuf_t *p, *d;
+    uint8 *buf;
+    udp_hdr_t *hdr;
     uint16 cs;
     int err;
     struct in6_addr srcaddr = src->sin6_addr;
 
     (void)flags;
 
+    if(net_loop_dev && net_loop_addr(&dst->sin6_addr))
+        net = net_loop_dev;
+
     if(!net) {
         net = net_default_dev;
 
@@ -1416,7 +1857,11 @@ static int net_udp_send_raw(netif_t *net, const struct sockaddr_in6 *src,
             srcaddr.__s6_addr.__s6_addr32[3] =
                 htonl(net_ipv4_address(net->ip_addr));
 
-            if(srcaddr.__s6_addr.__s6_addr32[3] == INADDR_ANY) {
+            /* Without an address, the only place we can send to is the
+               limited broadcast address (which is how DHCP gets one, with a
+               source address of 0.0.0.0). */
+            if(srcaddr.__s6_addr.__s6_addr32[3] == INADDR_ANY &&
+               dst->sin6_addr.__s6_addr.__s6_addr32[3] != INADDR_BROADCAST) {
                 errno = ENETDOWN;
                 ++udp_stats.pkt_send_failed;
                 return -1;
@@ -1442,24 +1887,68 @@ static int net_udp_send_raw(netif_t *net, const struct sockaddr_in6 *src,
         }
     }
 
-    memcpy(buf + sizeof(udp_hdr_t), data, size);
-    size += sizeof(udp_hdr_t);
+    /* If the device can take the packet in pieces, the UDP header goes in a
+       buffer of its own and the caller's data gets chained on behind it
+       without being copied at all. That's safe since the device is done with
+       the data by the time the send returns. Otherwise, grab a packet buffer
+       with room for all the headers. The data gets copied into it once below,
+       and that's the only copy made of it on the way down to the driver. */
+    if(net->if_tx_v && proto == IPPROTO_UDP && size) {
+        if((p = net_pbuf_alloc(NET_PBUF_HEADROOM, sizeof(udp_hdr_t)))) {
+            if((d = net_pbuf_ref(data, size))) {
+                net_pbuf_cat(p, d);
+            }
+            else {
+                net_pbuf_free(p);
+                p = NULL;
+            }
+        }
+    }
+    else {
+        p = net_pbuf_alloc(NET_PBUF_HEADROOM, size + sizeof(udp_hdr_t));
+    }
 
+    if(!p) {
+        errno = ENOBUFS;
+        ++udp_stats.pkt_send_failed;
+        return -1;
+    }
+
+    buf = p->data;
+    hdr = (udp_hdr_t *)buf;
     hdr->src_port = src->sin6_port;
     hdr->dst_port = dst->sin6_port;
     hdr->checksum = 0;
 
     /* Is this UDP or UDP-Lite? */
     if(proto == IPPROTO_UDP) {
-        hdr->length = htons(size);
+        hdr->length = htons(size + sizeof(udp_hdr_t));
 
         if(!(iflags & UDPSOCK_NO_CHECKSUM)) {
-            cs = net_ipv6_checksum_pseudo(&srcaddr, &dst->sin6_addr, size,
-                                          proto);
-            hdr->checksum = net_ipv4_checksum(buf, size, cs);
+            cs = net_ipv6_checksum_pseudo(&srcaddr, &dst->sin6_addr,
+                                          size + sizeof(udp_hdr_t), proto);
+
+            if(p->next) {
+                hdr->checksum = net_ipv4_checksum_pbuf(p, cs);
+            }
+            else {
+                /* Checksum the data while we copy it in, then finish up with
+                   the header. */
+                cs = net_ipv4_checksum_copy(buf + sizeof(udp_hdr_t), data,
+                                            size, cs);
+                hdr->checksum = net_ipv4_checksum(buf, sizeof(udp_hdr_t), cs);
+            }
+        }
+        else if(!p->next) {
+            memcpy(buf + sizeof(udp_hdr_t), data, size);
         }
+
+        size += sizeof(udp_hdr_t);
     }
     else {
+        memcpy(buf + sizeof(udp_hdr_t), data, size);
+        size += sizeof(udp_hdr_t);
+
         if(cscov <= size) {
             hdr->length = htons(cscov);
         }
@@ -1473,8 +1962,8 @@ static int net_udp_send_raw(netif_t *net, const struct sockaddr_in6 *src,
     }
 
     /* Pass everything off to the network layer to do the rest. */
-    err = net_ipv6_send(net, buf, size, hops, proto, &srcaddr,
-                        &dst->sin6_addr);
+    err = net_ipv6_send_pbuf(net, p, hops, proto, &srcaddr, &dst->sin6_addr);
+    net_pbuf_free(p);
 
     if(err < 0) {
         ++udp_stats.pkt_send_failed;
@@ -1510,7 +1999,9 @@ static fs_socket_proto_t proto = {
     net_udp_setsockopt,
     net_udp_getsockname,
     net_udp_fcntl,
-    net_udp_poll
+    net_udp_poll,
+    net_udp_recvmmsg,
+    net_udp_sendmmsg
 };
 
 static fs_socket_proto_t proto_lite = {
@@ -1532,7 +2023,9 @@ static fs_socket_proto_t proto_lite = {
     net_udp_setsockopt,
     net_udp_getsockname,
     net_udp_fcntl,
-    net_udp_poll
+    net_udp_poll,
+    net_udp_recvmmsg,
+    net_udp_sendmmsg
 };
 
 int net_udp_init(void) {
@@ -0,0 +1,81 @@
+/* KallistiOS ##version##
+
+   kernel/net/net_wheel.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+#include "net_wheel.h"
+
+/* This file implements a simple hashed timer wheel, used for aging things like
+   the neighbor caches. Each timer goes in the slot for the tick it expires on,
+   so adding and removing one is constant time, and each run only needs to look
+   at the slots for the ticks that have gone by since the last one, instead of
+   at every timer. Any locking is left up to the user of the wheel. */
+
+void net_wheel_init(net_wheel_t *w, uint64 now) {
+    int i;
+
+    for(i = 0; i < NET_WHEEL_SLOTS; ++i) {
+        LIST_INIT(&w->slots[i]);
+    }
+
+    w->cur = now / w->tick;
+}
+
+void net_wheel_add(net_wheel_t *w, net_wheel_ent_t *e, uint64 expire) {
+    uint64 t = (expire + w->tick - 1) / w->tick;
+
+    if(e->pending)
+        LIST_REMOVE(e, entry);
+
+    /* Anything that should have already expired goes off on the next run. */
+    if(t < w->cur)
+        t = w->cur;
+
+    e->expire = expire;
+    e->pending = 1;
+    LIST_INSERT_HEAD(&w->slots[t % NET_WHEEL_SLOTS], e, entry);
+}
+
+void net_wheel_del(net_wheel_t *w, net_wheel_ent_t *e) {
+    (void)w;
+
+    if(e->pending) {
+        LIST_REMOVE(e, entry);
+        e->pending = 0;
+    }
+}
+
+void net_wheel_run(net_wheel_t *w, uint64 now,
+                   void (*cb)(net_wheel_ent_t *e, void *data), void *data) {
+    uint64 last = now / w->tick;
+    net_wheel_ent_t *e, *n;
+    int cnt = 0;
+
+    while(w->cur <= last) {
+        e = LIST_FIRST(&w->slots[w->cur % NET_WHEEL_SLOTS]);
+
+        /* Fire off everything in the slot that is actually due. Anything else
+           in here is waiting for a later trip around the wheel. The callback
+           is free to put the timer back on the wheel. */
+        while(e) {
+            n = LIST_NEXT(e, entry);
+
+            if(e->expire <= now) {
+                LIST_REMOVE(e, entry);
+                e->pending = 0;
+                cb(e, data);
+            }
+
+            e = n;
+        }
+
+        /* If we've fallen more than a whole trip around the wheel behind,
+           there's no need to look at any slot twice. */
+        if(++cnt == NET_WHEEL_SLOTS)
+            w->cur = last;
+
+        ++w->cur;
+    }
+}
@@ -0,0 +1,49 @@
+/* KallistiOS ##version##
+
+   kernel/net/net_wheel.h
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+#ifndef __LOCAL_NET_WHEEL_H
+#define __LOCAL_NET_WHEEL_H
+
+#include <sys/cdefs.h>
+
+__BEGIN_DECLS
+
+#include <sys/queue.h>
+#include <arch/types.h>
+
+/* Number of slots in each timer wheel. Timeouts further out than this many
+   ticks just go around the wheel more than once. */
+#define NET_WHEEL_SLOTS     64
+
+/* One timer on a wheel. This is meant to be embedded in whatever structure
+   needs the timeout. */
+typedef struct net_wheel_ent {
+    LIST_ENTRY(net_wheel_ent) entry;
+    uint64 expire;
+    int pending;
+} net_wheel_ent_t;
+
+LIST_HEAD(net_wheel_slot, net_wheel_ent);
+
+typedef struct net_wheel {
+    struct net_wheel_slot slots[NET_WHEEL_SLOTS];
+    uint32 tick;
+    uint64 cur;
+} net_wheel_t;
+
+/* Set up a wheel with the given tick length (in milliseconds). */
+#define NET_WHEEL_INITIALIZER(t)    { { { NULL } }, (t), 0 }
+
+void net_wheel_init(net_wheel_t *w, uint64 now);
+void net_wheel_add(net_wheel_t *w, net_wheel_ent_t *e, uint64 expire);
+void net_wheel_del(net_wheel_t *w, net_wheel_ent_t *e);
+void net_wheel_run(net_wheel_t *w, uint64 now,
+                   void (*cb)(net_wheel_ent_t *e, void *data), void *data);
+
+__END_DECLS
+
+#endif /* !__LOCAL_NET_WHEEL_H */
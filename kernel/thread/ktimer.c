@@ -0,0 +1,373 @@
+/* KallistiOS ##version##
+
+   ktimer.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* This file implements kernel software timers. Pending timers are kept on a
+   hashed timer wheel with one slot per millisecond, so starting, cancelling,
+   and expiring a timer are all constant time operations (the wheel just wraps
+   around for timers more than a revolution out, and those get skipped over
+   until their time comes around).
+
+   The wheel is checked from the scheduler's timer interrupt, and the scheduler
+   asks us when the next timer is due so that it can program the hardware
+   timer to wake up then, rather than at the next tick. In cooperative mode
+   nothing else programs that timer, so if it isn't set to go off at all when
+   a timer is started, we set it up ourselves. Timers that want to run in
+   thread context are put on a run queue when they expire, and a dedicated
+   thread picks them up from there.
+
+   Everything in here is protected by disabling interrupts, since timers can be
+   started and cancelled from inside interrupts. */
+
+#include <errno.h>
+#include <string.h>
+
+#include <kos/ktimer.h>
+#include <kos/thread.h>
+#include <kos/sem.h>
+#include <arch/irq.h>
+#include <arch/timer.h>
+
+/* Number of slots in the wheel. Each slot is one millisecond wide. This needs
+   to be a power of two. */
+#define WHEEL_SLOTS     256
+
+/* Timer states. These are bits, since a periodic thread timer can be both
+   waiting on the wheel and waiting to be run at the same time. */
+#define KT_ARMED        0x01
+#define KT_QUEUED       0x02
+
+LIST_HEAD(ktimer_list, ktimer);
+TAILQ_HEAD(ktimer_queue, ktimer);
+
+static struct ktimer_list wheel[WHEEL_SLOTS];
+static uint64 wheel_tick;
+static int wheel_count;
+
+/* When the scheduler is next going to wake up (in milliseconds), or 0 if the
+   timer isn't programmed at all. */
+static uint64 next_wake;
+
+/* Thread timers that have expired and are waiting to run. */
+static struct ktimer_queue runq;
+static semaphore_t runq_sem;
+static kthread_t *ktimer_thd;
+static ktimer_t * volatile running;
+static volatile int done;
+
+static void wheel_insert(ktimer_t *t) {
+    uint64 tk = t->tick;
+
+    /* Anything that's already late goes in the next slot to be looked at. */
+    if(tk < wheel_tick)
+        tk = wheel_tick;
+
+    LIST_INSERT_HEAD(&wheel[tk & (WHEEL_SLOTS - 1)], t, entry);
+    t->state |= KT_ARMED;
+    ++wheel_count;
+}
+
+static void wheel_remove(ktimer_t *t) {
+    LIST_REMOVE(t, entry);
+    t->state &= ~KT_ARMED;
+    --wheel_count;
+}
+
+static void *ktimer_thread(void *data) {
+    ktimer_t *t;
+    int old;
+
+    (void)data;
+
+    while(!done) {
+        sem_wait(&runq_sem);
+
+        old = irq_disable();
+
+        if((t = TAILQ_FIRST(&runq))) {
+            TAILQ_REMOVE(&runq, t, runq);
+            t->state &= ~KT_QUEUED;
+            running = t;
+        }
+
+        irq_restore(old);
+
+        /* Note that once the callback returns, the timer may well have been
+           freed, so don't touch it. */
+        if(t) {
+            t->cb(t, t->data);
+            running = NULL;
+        }
+    }
+
+    return NULL;
+}
+
+void ktimer_setup(ktimer_t *t, ktimer_cb_t cb, void *data, int flags) {
+    memset(t, 0, sizeof(ktimer_t));
+    t->cb = cb;
+    t->data = data;
+    t->flags = flags;
+}
+
+int ktimer_start_at(ktimer_t *t, uint64 when, uint64 period) {
+    uint64 ms;
+    int old;
+
+    if(!t->cb) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    old = irq_disable();
+
+    if(t->state & KT_ARMED)
+        wheel_remove(t);
+
+    t->expire = when;
+    t->period = period;
+
+    /* Round up, so that we never fire early. */
+    t->tick = (when + 999) / 1000;
+    wheel_insert(t);
+
+    /* If the scheduler isn't going to wake up in time for this one (or at all),
+       move its wakeup up. */
+    if(!next_wake || t->tick < next_wake) {
+        ms = timer_ms_gettime64();
+        next_wake = t->tick > ms ? t->tick : ms + 1;
+        timer_primary_wakeup((uint32)(next_wake - ms));
+    }
+
+    irq_restore(old);
+
+    return 0;
+}
+
+int ktimer_start(ktimer_t *t, uint64 delay, uint64 period) {
+    return ktimer_start_at(t, timer_us_gettime64() + delay, period);
+}
+
+int ktimer_cancel(ktimer_t *t) {
+    int old, rv = 0, busy;
+
+    for(;;) {
+        old = irq_disable();
+
+        if(t->state & KT_ARMED) {
+            wheel_remove(t);
+            rv = 1;
+        }
+
+        if(t->state & KT_QUEUED) {
+            TAILQ_REMOVE(&runq, t, runq);
+            t->state &= ~KT_QUEUED;
+            rv = 1;
+        }
+
+        busy = running == t && !irq_inside_int() && thd_current != ktimer_thd;
+        irq_restore(old);
+
+        if(!busy)
+            break;
+
+        /* The callback is running in the timer thread right now. Wait for it
+           to finish so that the caller can safely get rid of the timer, then
+           go around again in case the callback started it back up. */
+        while(running == t)
+            thd_pass();
+    }
+
+    return rv;
+}
+
+int ktimer_pending(const ktimer_t *t) {
+    return t->state != 0;
+}
+
+int ktimer_thread_current(void) {
+    return ktimer_thd && thd_current == ktimer_thd;
+}
+
+static void ktimer_expire(ktimer_t *t, uint64 now) {
+    wheel_remove(t);
+
+    /* Periodic timers go right back on the wheel. If we've fallen behind,
+       skip the missed periods rather than firing a burst of them. */
+    if(t->period) {
+        t->expire += t->period;
+
+        if(t->expire <= now)
+            t->expire = now + t->period;
+
+        t->tick = (t->expire + 999) / 1000;
+        wheel_insert(t);
+    }
+
+    if(t->flags & KTIMER_THREAD) {
+        if(!(t->state & KT_QUEUED)) {
+            t->state |= KT_QUEUED;
+            TAILQ_INSERT_TAIL(&runq, t, runq);
+            sem_signal(&runq_sem);
+        }
+    }
+    else {
+        t->cb(t, t->data);
+    }
+}
+
+void ktimer_check(uint64 now) {
+    struct ktimer_list expired;
+    ktimer_t *t, *n;
+    uint64 tick = now / 1000;
+    int slots, i, old;
+
+    old = irq_disable();
+
+    if(!wheel_count || tick < wheel_tick) {
+        if(tick >= wheel_tick)
+            wheel_tick = tick + 1;
+
+        irq_restore(old);
+        return;
+    }
+
+    /* Don't bother going around more than once if we've been away for a while,
+       one trip around covers everything. */
+    if(tick - wheel_tick >= WHEEL_SLOTS)
+        slots = WHEEL_SLOTS;
+    else
+        slots = (int)(tick - wheel_tick) + 1;
+
+    LIST_INIT(&expired);
+
+    /* Pull everything that's due off of the wheel first, then fire them. The
+       callbacks are allowed to start and cancel timers, so we need to be done
+       walking the wheel before they run. */
+    for(i = 0; i < slots; ++i) {
+        t = LIST_FIRST(&wheel[(wheel_tick + i) & (WHEEL_SLOTS - 1)]);
+
+        while(t) {
+            n = LIST_NEXT(t, entry);
+
+            if(t->tick <= tick) {
+                LIST_REMOVE(t, entry);
+                LIST_INSERT_HEAD(&expired, t, entry);
+            }
+
+            t = n;
+        }
+    }
+
+    wheel_tick = tick + 1;
+
+    /* The timers are still counted as armed, so a cancel from one of the
+       callbacks just unlinks them from the expired list. */
+    while((t = LIST_FIRST(&expired))) {
+        ktimer_expire(t, now);
+    }
+
+    irq_restore(old);
+}
+
+uint32 ktimer_next_wakeup(uint64 now, uint32 max) {
+    ktimer_t *t;
+    uint64 tick;
+    uint32 i, rv = max;
+    int old;
+
+    old = irq_disable();
+
+    /* If the scheduler doesn't need to wake up for itself, then don't wake up
+       at all if there's nothing to do, otherwise look at most one trip around
+       the wheel ahead. */
+    if(!max) {
+        if(!wheel_count) {
+            next_wake = 0;
+            irq_restore(old);
+            return 0;
+        }
+
+        rv = max = WHEEL_SLOTS;
+    }
+
+    if(wheel_count) {
+        /* Look through the slots between now and when the scheduler wants to
+           wake up anyway for anything due in that window. */
+        for(i = 1; i < max; ++i) {
+            tick = now + i;
+
+            LIST_FOREACH(t, &wheel[tick & (WHEEL_SLOTS - 1)], entry) {
+                if(t->tick <= tick)
+                    break;
+            }
+
+            if(t) {
+                rv = i;
+                break;
+            }
+        }
+    }
+
+    next_wake = now + rv;
+    irq_restore(old);
+
+    return rv;
+}
+
+int ktimer_init(void) {
+    int i;
+
+    for(i = 0; i < WHEEL_SLOTS; ++i) {
+        LIST_INIT(&wheel[i]);
+    }
+
+    TAILQ_INIT(&runq);
+    wheel_tick = timer_ms_gettime64();
+    wheel_count = 0;
+    next_wake = 0;
+    running = NULL;
+    done = 0;
+
+    sem_init(&runq_sem, 0);
+
+    if(!(ktimer_thd = thd_create(0, ktimer_thread, NULL)))
+        return -1;
+
+    strcpy(ktimer_thd->label, "[ktimer]");
+    thd_set_prio(ktimer_thd, PRIO_DEFAULT / 2);
+
+    return 0;
+}
+
+void ktimer_shutdown(void) {
+    int i, old;
+
+    old = irq_disable();
+
+    /* Forget about anything still pending. The timers themselves belong to
+       whoever set them up. */
+    for(i = 0; i < WHEEL_SLOTS; ++i) {
+        LIST_INIT(&wheel[i]);
+    }
+
+    TAILQ_INIT(&runq);
+    wheel_count = 0;
+    next_wake = 0;
+    done = 1;
+
+    irq_restore(old);
+
+    /* Wake the thread up so that it sees that it's done, and wait for it to
+       go away before getting rid of the semaphore it waits on. */
+    if(ktimer_thd) {
+        sem_signal(&runq_sem);
+        thd_join(ktimer_thd, NULL);
+        ktimer_thd = NULL;
+    }
+
+    sem_destroy(&runq_sem);
+}
@@ -18,6 +18,7 @@
 #include <kos/rwsem.h>
 #include <kos/cond.h>
 #include <kos/genwait.h>
+#include <kos/ktimer.h>
 #include <arch/irq.h>
 #include <arch/timer.h>
 #include <arch/arch.h>
@@ -62,6 +63,10 @@ static semaphore_t thd_reap_sem;
 /* Number of threads active in the system. */
 static uint32 thd_count = 0;
 
+/* When the next pre-emptive context switch is due (in milliseconds). The timer
+   may be woken up before this to service kernel timers. */
+static uint64 thd_next_switch = 0;
+
 /* The idle task */
 static kthread_t *thd_idle_thd = NULL;
 
@@ -525,9 +530,9 @@ void thd_schedule(int front_of_line, uint64 now) {
        thread blocked itself somewhere) or if it's a zombie (below) */
     dontenq = !thd_current;
 
-    /* If there's only two thread left, it's the idle task and the reaper task:
-       exit the OS */
-    if(thd_count == 2) {
+    /* If there's only three threads left, it's the idle task, the reaper task,
+       and the timer task: exit the OS */
+    if(thd_count == 3) {
         dbgio_printf("\nthd_schedule: idle tasks are the only things left; exiting\n");
         arch_exit();
     }
@@ -640,13 +645,38 @@ irq_context_t * thd_choose_new() {
 static void thd_timer_hnd(irq_context_t *context) {
     /* Get the system time */
     uint64 now = timer_ms_gettime64();
+    uint32 next;
 
     (void)context;
 
     //printf("timer woke at %d\n", (uint32)now);
 
-    thd_schedule(0, now);
-    timer_primary_wakeup(1000 / HZ);
+    /* Fire off any kernel timers that are due. */
+    ktimer_check(timer_us_gettime64());
+
+    /* In cooperative mode we're only ever woken up for kernel timers, and
+       threads only switch when they block or yield, so just sleep until the
+       next timer is due (if there is one). */
+    if(thd_mode != THD_MODE_PREEMPT) {
+        if((next = ktimer_next_wakeup(now, 0)))
+            timer_primary_wakeup(next);
+
+        return;
+    }
+
+    /* If this is a pre-empt, then do a full context switch. If we were only
+       woken up for a kernel timer, just make sure the priorities are still
+       straight (the timer thread may have been woken up). */
+    if(now >= thd_next_switch) {
+        thd_schedule(0, now);
+        thd_next_switch = now + 1000 / HZ;
+    }
+    else {
+        thd_schedule(1, now);
+    }
+
+    timer_primary_wakeup(ktimer_next_wakeup(now,
+                                            (uint32)(thd_next_switch - now)));
 }
 
 /*****************************************************************************/
@@ -813,14 +843,18 @@ struct _reent * thd_get_reent(kthread_t *thd) {
 /* Change threading modes */
 int thd_set_mode(int mode) {
     int old = thd_mode;
+    uint64 now;
 
     /* Nothing to change? */
     if(thd_mode == mode)
         return thd_mode;
 
     if(thd_mode == THD_MODE_COOP) {
-        /* Schedule our first pre-emption wakeup */
-        timer_primary_wakeup(1000 / HZ);
+        /* Schedule our first pre-emption wakeup, unless a kernel timer wants
+           us up before then. */
+        now = timer_ms_gettime64();
+        thd_next_switch = now + 1000 / HZ;
+        timer_primary_wakeup(ktimer_next_wakeup(now, 1000 / HZ));
     }
 
     thd_mode = mode;
@@ -933,12 +967,16 @@ int thd_init(int mode) {
     /* Initialize thread sync primitives */
     genwait_init();
 
+    /* Set up kernel timers */
+    ktimer_init();
+
     /* Setup our pre-emption handler */
     timer_primary_set_callback(thd_timer_hnd);
 
     /* If we're in pre-emptive mode, then schedule the first context switch */
     if(thd_mode == THD_MODE_PREEMPT) {
         /* Schedule our first wakeup */
+        thd_next_switch = timer_ms_gettime64() + 1000 / HZ;
         timer_primary_wakeup(1000 / HZ);
 
         printf("thd: pre-emption enabled, HZ=%d\n", HZ);
@@ -953,10 +991,11 @@ int thd_init(int mode) {
 void thd_shutdown() {
     kthread_t *n1, *n2;
 
-    /* Disable pre-emption, if neccessary */
-    if(thd_mode == THD_MODE_PREEMPT) {
-        timer_primary_set_callback(NULL);
-    }
+    /* Disable pre-emption and kernel timers */
+    timer_primary_set_callback(NULL);
+
+    /* Shutdown kernel timers, while the timer thread can still be joined */
+    ktimer_shutdown();
 
     /* Kill remaining live threads */
     n1 = LIST_FIRST(&thd_list);
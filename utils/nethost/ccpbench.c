@@ -0,0 +1,319 @@
+/* KallistiOS ##version##
+
+   utils/nethost/ccpbench.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* Benchmarks the LZS compression that libppp's CCP uses. A few kinds of
+   payload (or whatever files are given on the command line) are cut up into
+   packets, compressed and decompressed the same way they would be on the
+   link, and checked to make sure they come out right. For each one, this
+   reports how well it compressed, how much CPU time it took per KB, and what
+   that works out to on a modem.
+
+   Keep in mind that the CPU times are for the host. The Dreamcast is a good
+   deal slower, so the share of the CPU that compression takes up at modem
+   speeds is going to be quite a bit higher there. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "host_os.h"
+#include "lzs.h"
+
+/* One byte of the compressed packet goes to the sequence number. */
+#define SEQ_LEN     1
+
+static lzs_comp_t comp;
+static lzs_decomp_t decomp;
+static uint8_t out[LZS_MAX_OUT(LZS_MAX_PKT)];
+
+static uint32_t seed = 0x4b4f5321;
+
+static uint32_t rnd(uint32_t n) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) % n;
+}
+
+static const char *words[] = {
+    "the", "of", "and", "to", "in", "is", "you", "that", "it", "he", "was",
+    "for", "on", "are", "as", "with", "his", "they", "at", "be", "this",
+    "have", "from", "or", "one", "had", "by", "word", "but", "not", "what",
+    "all", "were", "we", "when", "your", "can", "said", "there", "use", "an",
+    "each", "which", "she", "do", "how", "their", "if", "will", "up", "other",
+    "about", "out", "many", "then", "them", "these", "so", "some", "her",
+    "would", "make", "like", "him", "into", "time", "has", "look", "two",
+    "more", "write", "go", "see", "number", "no", "way", "could", "people",
+    "my", "than", "first", "water", "been", "call", "who", "oil", "its",
+    "now", "find", "long", "down", "day", "did", "get", "come", "made", "may",
+    "part", "dreamcast", "network", "modem", "packet", "server", "player"
+};
+
+#define NWORDS  (sizeof(words) / sizeof(words[0]))
+
+static size_t gen_text(uint8_t *buf, size_t len) {
+    size_t pos = 0, wl;
+    const char *w;
+
+    while(pos < len) {
+        w = words[rnd(NWORDS)];
+        wl = strlen(w);
+
+        if(pos + wl + 2 > len)
+            break;
+
+        memcpy(buf + pos, w, wl);
+        pos += wl;
+        buf[pos++] = rnd(12) ? ' ' : '\n';
+    }
+
+    return pos;
+}
+
+static size_t gen_json(uint8_t *buf, size_t len) {
+    static const char *names[] = {
+        "Sonic", "Tails", "Knuckles", "Amy", "Big", "Gamma", "Chao", "Eggman"
+    };
+    size_t pos = 0;
+    int n;
+
+    pos += snprintf((char *)buf, len, "{\"scores\":[");
+
+    for(;;) {
+        n = snprintf((char *)buf + pos, len - pos,
+                     "{\"id\":%u,\"name\":\"%s\",\"score\":%u,\"level\":%u,"
+                     "\"online\":%s,\"updated\":\"2026-%02u-%02uT%02u:%02u:"
+                     "%02uZ\"},\n", 100000 + rnd(900000), names[rnd(8)],
+                     rnd(10000000), rnd(60) + 1, rnd(2) ? "true" : "false",
+                     rnd(12) + 1, rnd(28) + 1, rnd(24), rnd(60), rnd(60));
+
+        if(n < 0 || pos + n + 4 > len)
+            break;
+
+        pos += n;
+    }
+
+    memcpy(buf + pos - 2, "]}\n", 3);
+
+    return pos + 1;
+}
+
+/* Something like a VMU save: fixed size records with lots of small numbers
+   and zero padding, a name table, and a block of "graphics" in the middle. */
+static size_t gen_save(uint8_t *buf, size_t len) {
+    size_t pos = 0;
+    int i;
+
+    memset(buf, 0, len);
+
+    while(pos + 64 <= len) {
+        if(rnd(10) < 7) {
+            buf[pos] = 0xa5;
+            buf[pos + 1] = (uint8_t)rnd(8);
+
+            for(i = 0; i < 16; ++i)
+                buf[pos + 4 + i] = (uint8_t)rnd(rnd(2) ? 4 : 100);
+
+            memcpy(buf + pos + 32, words[rnd(NWORDS)], 4);
+        }
+        else {
+            /* A little 4bpp image, mostly runs of the same pixels. */
+            for(i = 0; i < 64; ++i)
+                buf[pos + i] = (uint8_t)(rnd(6) ? 0x11 * (i / 16) : rnd(256));
+        }
+
+        pos += 64;
+    }
+
+    return pos;
+}
+
+static size_t gen_random(uint8_t *buf, size_t len) {
+    size_t i;
+
+    for(i = 0; i < len; ++i)
+        buf[i] = (uint8_t)rnd(256);
+
+    return len;
+}
+
+static uint8_t *load_file(const char *path, size_t *len) {
+    FILE *fp;
+    uint8_t *rv;
+    long sz;
+
+    if(!(fp = fopen(path, "rb")))
+        return NULL;
+
+    if(fseek(fp, 0, SEEK_END) || (sz = ftell(fp)) <= 0 ||
+       fseek(fp, 0, SEEK_SET) || !(rv = malloc(sz))) {
+        fclose(fp);
+        return NULL;
+    }
+
+    if(fread(rv, 1, sz, fp) != (size_t)sz) {
+        free(rv);
+        fclose(fp);
+        return NULL;
+    }
+
+    fclose(fp);
+    *len = (size_t)sz;
+
+    return rv;
+}
+
+/* Runs the data through, a packet at a time, reps times over. Returns the
+   number of packets that didn't come back out right. */
+static int bench(const char *name, const uint8_t *data, size_t len,
+                 size_t pktlen, int reps, int hist) {
+    uint64_t start, comp_us = 0, decomp_us = 0, in_bytes = 0, wire_bytes = 0;
+    uint32_t pkts = 0, plain = 0, bad = 0;
+    size_t pos, n;
+    ssize_t clen, dlen;
+    const uint8_t *dout;
+    double kb, ratio, speed;
+    int r;
+
+    for(r = 0; r < reps; ++r) {
+        _ppp_lzs_comp_reset(&comp);
+        _ppp_lzs_decomp_reset(&decomp);
+
+        for(pos = 0; pos < len; pos += n) {
+            n = len - pos < pktlen ? len - pos : pktlen;
+            ++pkts;
+            in_bytes += n;
+
+            start = host_time_us();
+            clen = _ppp_lzs_compress(&comp, data + pos, n, NULL, 0, NULL, 0,
+                                     out, n - SEQ_LEN, hist);
+            comp_us += host_time_us() - start;
+
+            /* Didn't get any smaller, so it goes out as it is. */
+            if(clen < 0) {
+                ++plain;
+                wire_bytes += n;
+                continue;
+            }
+
+            wire_bytes += clen + SEQ_LEN;
+
+            start = host_time_us();
+            dlen = _ppp_lzs_decompress(&decomp, out, (size_t)clen, &dout,
+                                       hist);
+            decomp_us += host_time_us() - start;
+
+            if(dlen != (ssize_t)n || memcmp(dout, data + pos, n))
+                ++bad;
+        }
+    }
+
+    kb = in_bytes / 1024.0;
+    ratio = (double)in_bytes / wire_bytes;
+
+    printf("%-12s %5.1f%% %6.2f:1 %8.2f %8.2f %6u", name,
+           100.0 * wire_bytes / in_bytes, ratio, comp_us / kb,
+           decomp_us / kb, plain);
+
+    /* Modems send 10 bits per byte (start, 8 data, stop) without any V.42bis
+       compression of their own. */
+    for(r = 0; r < 2; ++r) {
+        speed = (r ? 56000 : 33600) / 10.0 / 1024.0 * ratio;
+        printf(" %6.2f KB/s %5.2f%%", speed,
+               100.0 * speed * (comp_us + decomp_us) / kb / 1000000.0);
+    }
+
+    printf("%s\n", bad ? " BAD" : "");
+
+    return (int)bad;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options] [file...]\n"
+            "  -l len    Packet size (default: 1400)\n"
+            "  -n size   Size of each generated payload (default: 65536)\n"
+            "  -r reps   Times to go over each payload (default: 20)\n"
+            "  -s        Compress each packet on its own (no history)\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    static const struct {
+        const char *name;
+        size_t (*gen)(uint8_t *, size_t);
+    } gens[] = {
+        { "json", gen_json },
+        { "text", gen_text },
+        { "save", gen_save },
+        { "random", gen_random }
+    };
+    int opt, reps = 20, hist = 1, bad = 0, i;
+    size_t pktlen = 1400, size = 65536, len;
+    uint8_t *buf;
+
+    while((opt = getopt(argc, argv, "l:n:r:sh")) != -1) {
+        switch(opt) {
+            case 'l':
+                pktlen = (size_t)atoi(optarg);
+                break;
+
+            case 'n':
+                size = (size_t)atoi(optarg);
+                break;
+
+            case 'r':
+                reps = atoi(optarg);
+                break;
+
+            case 's':
+                hist = 0;
+                break;
+
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if(pktlen < 16 || pktlen > LZS_MAX_PKT - 2 || size < 1024 || reps < 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%d byte packets, %s history\n\n", (int)pktlen,
+           hist ? "with" : "without");
+    printf("%-12s %6s %8s %8s %8s %6s %-19s %s\n", "payload", "size",
+           "ratio", "comp", "decomp", "plain", "33.6k (cpu)",
+           "56k (cpu)");
+    printf("%-12s %6s %8s %8s %8s %6s\n", "", "", "", "us/KB", "us/KB", "pkts");
+
+    if(optind < argc) {
+        for(; optind < argc; ++optind) {
+            if(!(buf = load_file(argv[optind], &len))) {
+                perror(argv[optind]);
+                return EXIT_FAILURE;
+            }
+
+            bad += bench(argv[optind], buf, len, pktlen, reps, hist);
+            free(buf);
+        }
+    }
+    else {
+        if(!(buf = malloc(size))) {
+            perror("malloc");
+            return EXIT_FAILURE;
+        }
+
+        for(i = 0; i < (int)(sizeof(gens) / sizeof(gens[0])); ++i) {
+            len = gens[i].gen(buf, size);
+            bad += bench(gens[i].name, buf, len, pktlen, reps, hist);
+        }
+
+        free(buf);
+    }
+
+    return bad ? EXIT_FAILURE : 0;
+}
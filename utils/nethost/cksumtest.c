@@ -0,0 +1,334 @@
+/* KallistiOS ##version##
+
+   utils/nethost/cksumtest.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* Checks the Internet checksum routines against a plain byte-at-a-time
+   version. net_ipv4_checksum() is run over every length up to a bit over the
+   biggest packet at every alignment, net_ipv4_checksum_copy() over every
+   length with the source and destination at every pair of alignments, and
+   net_ipv4_checksum_update() over a batch of random headers with one word
+   changed in each. Then it times them against the reference, at a few
+   packet sizes. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <kos/net.h>
+#include <arch/timer.h>
+
+#include "net_ipv4.h"
+
+#define MAX_LEN         2100
+#define ALIGNS          8
+#define GUARD           16
+
+static uint8 src_buf[MAX_LEN + ALIGNS + GUARD];
+static uint8 dst_buf[MAX_LEN + ALIGNS + GUARD];
+static uint32 seed = 0x434B534D;
+static int failures = 0;
+
+static uint32 rnd(uint32 n) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) % n;
+}
+
+static void check(int ok, const char *what) {
+    printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+
+    if(!ok)
+        ++failures;
+}
+
+/* The reference: add up the data as 16-bit words in the host's byte order,
+   one byte at a time. first is 1 if the first byte is the second half of a
+   word. */
+static uint32 ref_sum(const uint8 *data, size_t len, int first) {
+    uint32 sum = 0;
+    uint16 w;
+    size_t i;
+
+    for(i = 0; i < len; ++i) {
+        w = 0;
+        ((uint8 *)&w)[(i + first) & 1] = data[i];
+        sum += w;
+    }
+
+    return sum;
+}
+
+static uint16 ref_fold(uint32 sum) {
+    while(sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return (uint16)sum;
+}
+
+static uint16 ref_checksum(const uint8 *data, size_t len, uint16 start) {
+    return ref_fold(ref_sum(data, len, 0) + start) ^ 0xFFFF;
+}
+
+static void fill(uint8 *buf, size_t len) {
+    size_t i;
+
+    for(i = 0; i < len; ++i)
+        buf[i] = (uint8)rnd(256);
+}
+
+static void test_checksum(void) {
+    size_t len;
+    int align, bad = 0, worst = 0;
+    uint16 start;
+    uint8 *p;
+
+    for(align = 0; align < ALIGNS; ++align) {
+        p = src_buf + align;
+
+        for(len = 0; len <= MAX_LEN; ++len) {
+            fill(p, len);
+            start = (uint16)rnd(0x10000);
+
+            if(net_ipv4_checksum(p, len, 0) != ref_checksum(p, len, 0) ||
+               net_ipv4_checksum(p, len, start) !=
+               ref_checksum(p, len, start)) {
+                if(!bad++)
+                    printf("  checksum wrong: %d bytes at +%d\n", (int)len,
+                           align);
+            }
+        }
+
+        /* All ones is where the carries pile up the most. */
+        memset(p, 0xFF, MAX_LEN);
+
+        if(net_ipv4_checksum(p, MAX_LEN, 0xFFFF) !=
+           ref_checksum(p, MAX_LEN, 0xFFFF))
+            ++worst;
+    }
+
+    check(!bad, "net_ipv4_checksum(), every length and alignment");
+    check(!worst, "net_ipv4_checksum(), all ones");
+}
+
+static void test_copy(void) {
+    size_t len;
+    int sa, da, bad = 0, copy = 0, guard = 0, i;
+    uint16 start, sum;
+    uint8 *s, *d;
+
+    for(sa = 0; sa < ALIGNS; ++sa) {
+        for(da = 0; da < ALIGNS; ++da) {
+            s = src_buf + sa;
+            d = dst_buf + da;
+
+            for(len = 0; len <= MAX_LEN; ++len) {
+                fill(s, len);
+                memset(dst_buf, 0xA5, sizeof(dst_buf));
+                start = (uint16)rnd(0x10000);
+
+                sum = net_ipv4_checksum_copy(d, s, len, start);
+
+                /* The sum goes by where the bytes land, not where they came
+                   from. */
+                if(ref_fold(sum) !=
+                   ref_fold(ref_sum(s, len, da & 1) + start)) {
+                    if(!bad++)
+                        printf("  copy sum wrong: %d bytes, +%d to +%d\n",
+                               (int)len, sa, da);
+                }
+
+                if(memcmp(d, s, len))
+                    ++copy;
+
+                for(i = 0; i < da; ++i)
+                    guard += dst_buf[i] != 0xA5;
+
+                for(i = 0; i < GUARD; ++i)
+                    guard += d[len + i] != 0xA5;
+            }
+        }
+    }
+
+    check(!bad, "net_ipv4_checksum_copy() sum, every length and alignment");
+    check(!copy, "net_ipv4_checksum_copy() copies the data");
+    check(!guard, "net_ipv4_checksum_copy() stays inside the buffer");
+}
+
+/* Change one word of a header, and see if updating the checksum gets the same
+   answer as starting over (RFC 1624). */
+static int update_one(uint8 *hdr, int len, int off, uint16 to) {
+    uint16 from, cksum;
+
+    memset(hdr + 10, 0, 2);
+    cksum = net_ipv4_checksum(hdr, len, 0);
+    memcpy(hdr + 10, &cksum, 2);
+
+    memcpy(&from, hdr + off, 2);
+    memcpy(hdr + off, &to, 2);
+    cksum = net_ipv4_checksum_update(cksum, from, to);
+
+    /* The header has to check out with the new checksum in it, and it has to
+       be exactly what we'd get from scratch. */
+    memcpy(hdr + 10, &cksum, 2);
+
+    if(net_ipv4_checksum(hdr, len, 0))
+        return 0;
+
+    memset(hdr + 10, 0, 2);
+    return cksum == net_ipv4_checksum(hdr, len, 0);
+}
+
+static void test_update(void) {
+    static const uint16 edges[] = { 0x0000, 0xFFFF, 0x0001, 0xFFFE, 0x8000 };
+    uint8 hdr[60];
+    int i, j, len, off, bad = 0;
+
+    for(i = 0; i < 100000; ++i) {
+        len = 20 + 4 * rnd(11);
+        fill(hdr, len);
+
+        do {
+            off = 2 * rnd(len / 2);
+        } while(off == 10);
+
+        if(!update_one(hdr, len, off, (uint16)rnd(0x10000)))
+            ++bad;
+    }
+
+    check(!bad, "net_ipv4_checksum_update(), random changes");
+
+    /* The cases where one's complement zero comes into it: words going to or
+       from all zeros or all ones, in headers that are nearly all zeros or all
+       ones. A real header always has its version in it, so it can't be all
+       zeros. */
+    bad = 0;
+
+    for(i = 0; i < 5; ++i) {
+        for(j = 0; j < 5; ++j) {
+            memset(hdr, 0, 20);
+            hdr[0] = 0x45;
+            memcpy(hdr + 4, &edges[i], 2);
+
+            if(!update_one(hdr, 20, 4, edges[j]))
+                ++bad;
+
+            memset(hdr, 0xFF, 20);
+            memcpy(hdr + 4, &edges[i], 2);
+
+            if(!update_one(hdr, 20, 4, edges[j]))
+                ++bad;
+        }
+    }
+
+    check(!bad, "net_ipv4_checksum_update(), zero and all ones");
+}
+
+/* Keep the compiler from throwing away the benchmark loops. */
+static volatile uint32 sink;
+
+static double bench_mbs(uint64 us, size_t bytes) {
+    return us ? (double)bytes / (double)us : 0.0;
+}
+
+static void bench(int reps) {
+    static const int sizes[] = { 20, 64, 576, 1460, 2048 };
+    uint64 start, t_ref, t_ck, t_odd, t_mc, t_cp;
+    size_t i, len, total;
+    int r;
+
+    fill(src_buf, MAX_LEN + ALIGNS);
+
+    printf("\n%6s %10s %10s %10s %10s %10s\n", "bytes", "bytewise",
+           "checksum", "odd addr", "memcpy+ck", "copy");
+    printf("%6s %10s %10s %10s %10s %10s\n", "", "MB/s", "MB/s", "MB/s", "MB/s",
+           "MB/s");
+
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        len = sizes[i];
+        total = len * reps;
+
+        start = timer_us_gettime64();
+
+        for(r = 0; r < reps; ++r)
+            sink += ref_checksum(src_buf, len, 0);
+
+        t_ref = timer_us_gettime64() - start;
+        start = timer_us_gettime64();
+
+        for(r = 0; r < reps; ++r)
+            sink += net_ipv4_checksum(src_buf, len, 0);
+
+        t_ck = timer_us_gettime64() - start;
+        start = timer_us_gettime64();
+
+        for(r = 0; r < reps; ++r)
+            sink += net_ipv4_checksum(src_buf + 1, len, 0);
+
+        t_odd = timer_us_gettime64() - start;
+        start = timer_us_gettime64();
+
+        for(r = 0; r < reps; ++r) {
+            memcpy(dst_buf, src_buf, len);
+            sink += net_ipv4_checksum(dst_buf, len, 0);
+        }
+
+        t_mc = timer_us_gettime64() - start;
+        start = timer_us_gettime64();
+
+        for(r = 0; r < reps; ++r)
+            sink += net_ipv4_checksum_copy(dst_buf, src_buf, len, 0);
+
+        t_cp = timer_us_gettime64() - start;
+
+        printf("%6d %10.1f %10.1f %10.1f %10.1f %10.1f\n", (int)len,
+               bench_mbs(t_ref, total), bench_mbs(t_ck, total),
+               bench_mbs(t_odd, total), bench_mbs(t_mc, total),
+               bench_mbs(t_cp, total));
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options]\n"
+            "  -n reps   Times to go over each size when timing "
+            "(default: 50000)\n"
+            "  -t        Only run the tests, not the timing\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    int opt, reps = 50000, timing = 1;
+
+    while((opt = getopt(argc, argv, "n:th")) != -1) {
+        switch(opt) {
+            case 'n':
+                reps = atoi(optarg);
+                break;
+
+            case 't':
+                timing = 0;
+                break;
+
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if(reps < 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    test_checksum();
+    test_copy();
+    test_update();
+
+    printf("%d check%s FAILED\n", failures, failures == 1 ? "" : "s");
+
+    if(timing)
+        bench(reps);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,57 @@
+/* KallistiOS ##version##
+
+   utils/nethost/compat/arch/types.h
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* This replaces the Dreamcast's arch/types.h when building the network stack
+   for the host. The Dreamcast one uses long for its 32-bit types, which is
+   64 bits wide on most hosts, and would make a mess of every packet header. */
+
+#ifndef __ARCH_TYPES_H
+#define __ARCH_TYPES_H
+
+#include <sys/cdefs.h>
+__BEGIN_DECLS
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Generic types */
+typedef uint64_t uint64;
+typedef uint32_t uint32;
+typedef uint16_t uint16;
+typedef uint8_t uint8;
+typedef int64_t int64;
+typedef int32_t int32;
+typedef int16_t int16;
+typedef int8_t int8;
+
+/* Volatile types */
+typedef volatile uint64 vuint64;
+typedef volatile uint32 vuint32;
+typedef volatile uint16 vuint16;
+typedef volatile uint8 vuint8;
+typedef volatile int64 vint64;
+typedef volatile int32 vint32;
+typedef volatile int16 vint16;
+typedef volatile int8 vint8;
+
+/* Pointer arithmetic types */
+typedef uintptr_t ptr_t;
+
+/* The BSD-style types all come from the host's <sys/types.h>. */
+#include <sys/types.h>
+
+typedef int handle_t;
+
+/* Thread and priority types */
+typedef handle_t tid_t;
+typedef handle_t prio_t;
+
+#include <endian.h>
+
+__END_DECLS
+
+#endif  /* __ARCH_TYPES_H */
@@ -0,0 +1,27 @@
+/* KallistiOS ##version##
+
+   utils/nethost/compat/nethost_pre.h
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* This is included ahead of everything when building KOS sources for the host.
+   It fills in the few things that the KOS sources get from newlib or from the
+   rest of the kernel without asking for them. */
+
+#ifndef __NETHOST_PRE_H
+#define __NETHOST_PRE_H
+
+typedef long long _off64_t;
+typedef long _off_t;
+
+#include <arch/types.h>
+
+/* The host's <fcntl.h> has its own idea of O_ASYNC, which kos/fs.h would
+   otherwise complain about redefining. */
+#include <fcntl.h>
+#undef O_ASYNC
+
+#include <kos/dbglog.h>
+
+#endif /* __NETHOST_PRE_H */
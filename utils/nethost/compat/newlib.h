@@ -0,0 +1,18 @@
+/* KallistiOS ##version##
+
+   utils/nethost/compat/newlib.h
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* The KOS headers check the newlib version in a few places. We're building
+   against glibc, so just say we're an older newlib, which makes them pull in
+   the standard headers instead. */
+
+#ifndef __NETHOST_NEWLIB_H
+#define __NETHOST_NEWLIB_H
+
+#define __NEWLIB__          2
+#define __NEWLIB_MINOR__    2
+
+#endif /* __NETHOST_NEWLIB_H */
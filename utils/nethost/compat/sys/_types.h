@@ -0,0 +1,16 @@
+/* KallistiOS ##version##
+
+   utils/nethost/compat/sys/_types.h
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* The KOS version of this header is written against newlib's internals. The
+   glibc headers already provide everything it would, so this is empty. */
+
+#ifndef __NETHOST_SYS__TYPES_H
+#define __NETHOST_SYS__TYPES_H
+
+#include <endian.h>
+
+#endif /* __NETHOST_SYS__TYPES_H */
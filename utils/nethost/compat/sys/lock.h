@@ -0,0 +1,17 @@
+/* KallistiOS ##version##
+
+   utils/nethost/compat/sys/lock.h
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* Newlib's lock types, which the KOS threading headers refer to. Nothing in
+   the network stack actually uses these. */
+
+#ifndef __NETHOST_SYS_LOCK_H
+#define __NETHOST_SYS_LOCK_H
+
+typedef int _LOCK_T;
+typedef int _LOCK_RECURSIVE_T;
+
+#endif /* __NETHOST_SYS_LOCK_H */
@@ -0,0 +1,18 @@
+/* KallistiOS ##version##
+
+   utils/nethost/compat/sys/reent.h
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* Newlib's reentrancy structure, which kthread_t has one of. On the host, the
+   C library takes care of this itself. */
+
+#ifndef __NETHOST_SYS_REENT_H
+#define __NETHOST_SYS_REENT_H
+
+struct _reent {
+    int _errno;
+};
+
+#endif /* __NETHOST_SYS_REENT_H */
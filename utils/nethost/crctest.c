@@ -0,0 +1,283 @@
+/* KallistiOS ##version##
+
+   utils/nethost/crctest.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* Checks the table-driven CRCs in net_crc.c against the bit-at-a-time
+   versions they replaced, which are kept here as the reference. Every length
+   up to a bit over the biggest frame is run at every alignment, whole and
+   split into two pieces with the _update() functions. Then it times both
+   versions at a few frame sizes. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <kos/net.h>
+#include <arch/timer.h>
+
+#define MAX_LEN         2100
+#define ALIGNS          8
+
+static uint8 buf[MAX_LEN + ALIGNS];
+static uint32 seed = 0x43524333;
+static int failures = 0;
+
+static uint32 rnd(uint32 n) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) % n;
+}
+
+static void check(int ok, const char *what) {
+    printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+
+    if(!ok)
+        ++failures;
+}
+
+/* The old versions from net_crc.c, one bit at a time. */
+static uint32 ref_crc32le(const uint8 *data, int size) {
+    int i, j;
+    uint32 rv = 0xFFFFFFFF;
+
+    for(i = 0; i < size; ++i) {
+        rv ^= data[i];
+
+        for(j = 0; j < 8; ++j)
+            rv = (0xEDB88320 & (-(rv & 1))) ^ (rv >> 1);
+    }
+
+    return ~rv;
+}
+
+static uint32 ref_crc32be(const uint8 *data, int size) {
+    int i, j;
+    uint32 rv = 0xFFFFFFFF, b, c;
+
+    for(i = 0; i < size; ++i) {
+        b = data[i];
+
+        for(j = 0; j < 8; ++j) {
+            c = ((rv & 0x80000000) ? 1 : 0) ^ (b & 1);
+            b >>= 1;
+
+            if(c)   rv = ((rv << 1) ^ 0x04C11DB6) | c;
+            else    rv <<= 1;
+        }
+    }
+
+    return rv;
+}
+
+static uint16 ref_crc16ccitt(const uint8 *data, int size, uint16 start) {
+    uint16 rv = start, tmp;
+
+    while(size--) {
+        tmp = (rv >> 8) ^ *data++;
+        tmp ^= tmp >> 4;
+
+        rv = (rv << 8) ^ (tmp << 12) ^ (tmp << 5) ^ tmp;
+    }
+
+    return rv;
+}
+
+static void fill(uint8 *p, int len) {
+    int i;
+
+    for(i = 0; i < len; ++i)
+        p[i] = (uint8)rnd(256);
+}
+
+static void test_whole(void) {
+    int align, len, le = 0, be = 0, ccitt = 0;
+    uint16 start;
+    uint8 *p;
+
+    for(align = 0; align < ALIGNS; ++align) {
+        p = buf + align;
+
+        for(len = 0; len <= MAX_LEN; ++len) {
+            fill(p, len);
+            start = (uint16)rnd(0x10000);
+
+            le += net_crc32le(p, len) != ref_crc32le(p, len);
+            be += net_crc32be(p, len) != ref_crc32be(p, len);
+            ccitt += net_crc16ccitt(p, len, 0xFFFF) !=
+                     ref_crc16ccitt(p, len, 0xFFFF);
+            ccitt += net_crc16ccitt(p, len, 0) != ref_crc16ccitt(p, len, 0);
+            ccitt += net_crc16ccitt(p, len, start) !=
+                     ref_crc16ccitt(p, len, start);
+        }
+    }
+
+    check(!le, "net_crc32le(), every length and alignment");
+    check(!be, "net_crc32be(), every length and alignment");
+    check(!ccitt, "net_crc16ccitt(), every length and alignment");
+}
+
+/* The same, but in two pieces split at every point, so that each piece starts
+   and ends at every alignment. */
+static void test_split(void) {
+    static const int lens[] = {
+        1, 7, 8, 9, 15, 16, 17, 63, 64, 65, 1500, 1519
+    };
+    int align, i, len, k, le = 0, be = 0, ccitt = 0;
+    uint8 *p;
+
+    for(align = 0; align < ALIGNS; ++align) {
+        p = buf + align;
+
+        for(i = 0; i < (int)(sizeof(lens) / sizeof(lens[0])); ++i) {
+            len = lens[i];
+            fill(p, len);
+
+            for(k = 0; k <= len; ++k) {
+                le += net_crc32le_update(net_crc32le_update(0, p, k), p + k,
+                                         len - k) != ref_crc32le(p, len);
+                be += net_crc32be_update(net_crc32be_update(0xFFFFFFFF, p, k),
+                                         p + k, len - k) !=
+                      ref_crc32be(p, len);
+                ccitt += net_crc16ccitt(p + k, len - k,
+                                        net_crc16ccitt(p, k, 0xFFFF)) !=
+                         ref_crc16ccitt(p, len, 0xFFFF);
+            }
+        }
+    }
+
+    check(!le, "net_crc32le_update(), split at every point");
+    check(!be, "net_crc32be_update(), split at every point");
+    check(!ccitt, "net_crc16ccitt(), split at every point");
+}
+
+/* A few known answers, so that the reference can't be quietly wrong along
+   with everything else. CRC-32 of "123456789" is 0xCBF43926, and CRC-CCITT
+   (starting from 0xFFFF) is 0x29B1. The big-endian CRC is the little-endian
+   one with its bits reversed, and without the final inversion. */
+static void test_known(void) {
+    static const uint8 check_str[] = "123456789";
+
+    check(net_crc32le(check_str, 9) == 0xCBF43926 &&
+          ref_crc32le(check_str, 9) == 0xCBF43926,
+          "CRC-32 check value");
+    check(net_crc16ccitt(check_str, 9, 0xFFFF) == 0x29B1 &&
+          ref_crc16ccitt(check_str, 9, 0xFFFF) == 0x29B1,
+          "CRC16-CCITT check value");
+    check(net_crc32be(check_str, 9) == 0x9B63D02C &&
+          ref_crc32be(check_str, 9) == 0x9B63D02C,
+          "Big-endian CRC-32 check value");
+}
+
+/* Keep the compiler from throwing away the benchmark loops. */
+static volatile uint32 sink;
+
+static double bench_mbs(uint64 us, size_t bytes) {
+    return us ? (double)bytes / (double)us : 0.0;
+}
+
+static void bench(int reps) {
+    static const int sizes[] = { 6, 64, 576, 1518 };
+    uint64 start, t[6];
+    size_t i, total;
+    int r, len;
+
+    fill(buf, MAX_LEN);
+
+    printf("\n%6s %21s %21s %21s\n", "bytes", "crc32le MB/s",
+           "crc32be MB/s", "crc16ccitt MB/s");
+    printf("%6s %10s %10s %10s %10s %10s %10s\n", "", "bitwise", "table",
+           "bitwise", "table", "bitwise", "table");
+
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        len = sizes[i];
+        total = (size_t)len * reps;
+
+        start = timer_us_gettime64();
+
+        for(r = 0; r < reps; ++r)
+            sink += ref_crc32le(buf, len);
+
+        t[0] = timer_us_gettime64() - start;
+        start = timer_us_gettime64();
+
+        for(r = 0; r < reps; ++r)
+            sink += net_crc32le(buf, len);
+
+        t[1] = timer_us_gettime64() - start;
+        start = timer_us_gettime64();
+
+        for(r = 0; r < reps; ++r)
+            sink += ref_crc32be(buf, len);
+
+        t[2] = timer_us_gettime64() - start;
+        start = timer_us_gettime64();
+
+        for(r = 0; r < reps; ++r)
+            sink += net_crc32be(buf, len);
+
+        t[3] = timer_us_gettime64() - start;
+        start = timer_us_gettime64();
+
+        for(r = 0; r < reps; ++r)
+            sink += ref_crc16ccitt(buf, len, 0xFFFF);
+
+        t[4] = timer_us_gettime64() - start;
+        start = timer_us_gettime64();
+
+        for(r = 0; r < reps; ++r)
+            sink += net_crc16ccitt(buf, len, 0xFFFF);
+
+        t[5] = timer_us_gettime64() - start;
+
+        printf("%6d %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", len,
+               bench_mbs(t[0], total), bench_mbs(t[1], total),
+               bench_mbs(t[2], total), bench_mbs(t[3], total),
+               bench_mbs(t[4], total), bench_mbs(t[5], total));
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options]\n"
+            "  -n reps   Times to go over each size when timing "
+            "(default: 20000)\n"
+            "  -t        Only run the tests, not the timing\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    int opt, reps = 20000, timing = 1;
+
+    while((opt = getopt(argc, argv, "n:th")) != -1) {
+        switch(opt) {
+            case 'n':
+                reps = atoi(optarg);
+                break;
+
+            case 't':
+                timing = 0;
+                break;
+
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if(reps < 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    test_known();
+    test_whole();
+    test_split();
+
+    printf("%d check%s FAILED\n", failures, failures == 1 ? "" : "s");
+
+    if(timing)
+        bench(reps);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
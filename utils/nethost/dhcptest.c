@@ -0,0 +1,440 @@
+/* KallistiOS ##version##
+
+   utils/nethost/dhcptest.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* Tests the DHCP client against a little DHCP server that runs on the other
+   end of a pipe device. The stack is brought up several times over, like the
+   Dreamcast being turned off and on again, with the lease kept in a file in
+   between:
+
+       - first boot, no saved lease: the whole DISCOVER/OFFER/REQUEST/ACK
+         exchange
+       - second boot: INIT-REBOOT with the saved lease, which gets ACKed
+       - the server has moved us to a new address: INIT-REBOOT gets NAKed, and
+         the client starts over with DISCOVER
+       - the server ignores INIT-REBOOT: the client gives up after the reboot
+         timeout, and starts over
+       - the saved lease has expired: straight to DISCOVER (this one uses a
+         lease store of its own, in memory)
+       - the server loses the first two DISCOVERs: the client backs off and
+         tries again
+
+   For each, this checks what the client sent and what address it ended up
+   with, and reports how long it took. The server takes -d milliseconds to
+   answer a DISCOVER, standing in for the time a real server spends checking
+   that the address it's about to offer is free. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <kos/net.h>
+#include <kos/dbglog.h>
+#include <arch/timer.h>
+
+#include "nethost.h"
+#include "host_os.h"
+
+/* DHCP message types and options that matter here. */
+#define MSG_DISCOVER    1
+#define MSG_OFFER       2
+#define MSG_REQUEST     3
+#define MSG_ACK         5
+#define MSG_NAK         6
+
+#define OPT_SUBNET      1
+#define OPT_ROUTER      3
+#define OPT_DNS         6
+#define OPT_REQ_IP      50
+#define OPT_LEASE_TIME  51
+#define OPT_MSG_TYPE    53
+#define OPT_SERVER_ID   54
+#define OPT_END         255
+
+/* Offsets into a frame from the client. */
+#define ETH_LEN         14
+#define DHCP_OPTS       236
+
+/* What the server does with an INIT-REBOOT request. */
+#define REBOOT_ACK      0
+#define REBOOT_IGNORE   1
+
+static const uint8 srv_mac[6] = { 0x02, 'D', 'H', 'C', 'P', 0x01 };
+static const uint8 srv_ip[4] = { 10, 9, 0, 1 };
+
+/* The server's state. The server runs on a host thread, outside of KOS, so
+   it only shares these. */
+static volatile int peer = -1;
+static volatile int reboot_mode, drop_discovers, offer_delay;
+static volatile uint8 pool_ip[4];
+static volatile uint32 n_discover, n_select, n_reboot, n_renew, n_nak;
+
+static int get_opt(const uint8 *opts, int len, uint8 code, uint8 *out,
+                   int outlen) {
+    int i = 4;
+
+    while(i < len) {
+        if(opts[i] == 0) {
+            ++i;
+            continue;
+        }
+
+        if(opts[i] == OPT_END || i + 1 >= len || i + 2 + opts[i + 1] > len)
+            break;
+
+        if(opts[i] == code) {
+            if(opts[i + 1] < outlen)
+                return -1;
+
+            memcpy(out, opts + i + 2, outlen);
+            return 0;
+        }
+
+        i += 2 + opts[i + 1];
+    }
+
+    return -1;
+}
+
+static uint16 ip_cksum(const uint8 *p, int len) {
+    uint32 sum = 0;
+    int i;
+
+    for(i = 0; i < len; i += 2)
+        sum += (p[i] << 8) | p[i + 1];
+
+    while(sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return (uint16)~sum;
+}
+
+static void reply(const uint8 *req, uint8 type) {
+    uint8 buf[ETH_LEN + 20 + 8 + 300];
+    uint8 *ip = buf + ETH_LEN, *udp = ip + 20, *d = udp + 8;
+    uint8 *o = d + DHCP_OPTS;
+    static const uint8 mask[4] = { 255, 255, 255, 0 };
+    static const uint8 lease[4] = { 0, 0, 0x0e, 0x10 };    /* One hour */
+    int len, dlen;
+    uint16 sum;
+
+    memset(buf, 0, sizeof(buf));
+
+    /* Ethernet, broadcast. */
+    memset(buf, 0xFF, 6);
+    memcpy(buf + 6, srv_mac, 6);
+    buf[12] = 0x08;
+
+    /* The DHCP part. */
+    d[0] = 2;
+    d[1] = 1;
+    d[2] = 6;
+    memcpy(d + 4, req + 4, 4);              /* xid */
+
+    if(type != MSG_NAK)
+        memcpy(d + 16, (const void *)pool_ip, 4);
+
+    memcpy(d + 20, srv_ip, 4);
+    memcpy(d + 28, req + 28, 16);           /* chaddr */
+
+    o[0] = 0x63;
+    o[1] = 0x82;
+    o[2] = 0x53;
+    o[3] = 0x63;
+    len = 4;
+    o[len++] = OPT_MSG_TYPE;
+    o[len++] = 1;
+    o[len++] = type;
+    o[len++] = OPT_SERVER_ID;
+    o[len++] = 4;
+    memcpy(o + len, srv_ip, 4);
+    len += 4;
+
+    if(type != MSG_NAK) {
+        o[len++] = OPT_LEASE_TIME;
+        o[len++] = 4;
+        memcpy(o + len, lease, 4);
+        len += 4;
+        o[len++] = OPT_SUBNET;
+        o[len++] = 4;
+        memcpy(o + len, mask, 4);
+        len += 4;
+        o[len++] = OPT_ROUTER;
+        o[len++] = 4;
+        memcpy(o + len, srv_ip, 4);
+        len += 4;
+        o[len++] = OPT_DNS;
+        o[len++] = 4;
+        memcpy(o + len, srv_ip, 4);
+        len += 4;
+    }
+
+    o[len++] = OPT_END;
+    dlen = DHCP_OPTS + len;
+
+    /* UDP, with no checksum. */
+    udp[1] = 67;
+    udp[3] = 68;
+    udp[4] = (uint8)((dlen + 8) >> 8);
+    udp[5] = (uint8)(dlen + 8);
+
+    /* IPv4. */
+    ip[0] = 0x45;
+    ip[2] = (uint8)((dlen + 28) >> 8);
+    ip[3] = (uint8)(dlen + 28);
+    ip[8] = 64;
+    ip[9] = 17;
+    memcpy(ip + 12, srv_ip, 4);
+    memset(ip + 16, 0xFF, 4);
+    sum = ip_cksum(ip, 20);
+    ip[10] = (uint8)(sum >> 8);
+    ip[11] = (uint8)sum;
+
+    host_write(peer, buf, ETH_LEN + 28 + dlen);
+}
+
+static void handle(const uint8 *frame, int len) {
+    const uint8 *ip = frame + ETH_LEN, *d;
+    uint8 type, sid[4], req_ip[4];
+    int ihl, dlen;
+
+    /* Only IPv4 UDP to port 67. */
+    if(len < ETH_LEN + 20 || frame[12] != 0x08 || frame[13] != 0x00 ||
+       ip[9] != 17)
+        return;
+
+    ihl = (ip[0] & 0x0F) * 4;
+
+    if(len < ETH_LEN + ihl + 8 + DHCP_OPTS + 4 || ip[ihl + 3] != 67)
+        return;
+
+    d = ip + ihl + 8;
+    dlen = len - ETH_LEN - ihl - 8 - DHCP_OPTS;
+
+    if(get_opt(d + DHCP_OPTS, dlen, OPT_MSG_TYPE, &type, 1) < 0)
+        return;
+
+    if(type == MSG_DISCOVER) {
+        ++n_discover;
+
+        if(drop_discovers > 0) {
+            --drop_discovers;
+            return;
+        }
+
+        if(offer_delay)
+            host_sleep_us(offer_delay * 1000ULL);
+
+        reply(d, MSG_OFFER);
+    }
+    else if(type == MSG_REQUEST) {
+        /* Which kind of request this is depends on what's filled in (RFC 2131,
+           section 4.3.2). */
+        if(!get_opt(d + DHCP_OPTS, dlen, OPT_SERVER_ID, sid, 4)) {
+            ++n_select;
+            reply(d, memcmp(sid, srv_ip, 4) ? MSG_NAK : MSG_ACK);
+        }
+        else if(!get_opt(d + DHCP_OPTS, dlen, OPT_REQ_IP, req_ip, 4) &&
+                !memcmp(d + 12, "\0\0\0\0", 4)) {
+            ++n_reboot;
+
+            if(reboot_mode == REBOOT_IGNORE)
+                return;
+
+            if(memcmp(req_ip, (const void *)pool_ip, 4)) {
+                ++n_nak;
+                reply(d, MSG_NAK);
+            }
+            else {
+                reply(d, MSG_ACK);
+            }
+        }
+        else {
+            ++n_renew;
+            reply(d, MSG_ACK);
+        }
+    }
+}
+
+static void *server_thd(void *arg) {
+    uint8 buf[1600];
+    long len;
+    int fd;
+
+    (void)arg;
+
+    for(;;) {
+        if((fd = peer) < 0 || host_wait_readable(fd, 20) <= 0)
+            continue;
+
+        if((len = host_read(fd, buf, sizeof(buf))) > 0)
+            handle(buf, (int)len);
+    }
+
+    return NULL;
+}
+
+/* A lease store that keeps the lease in memory, and can make it look older
+   than it is. */
+static net_dhcp_lease_t mem_lease;
+static int mem_valid;
+static int64 mem_age;
+
+static int mem_load(net_dhcp_store_t *self, net_dhcp_lease_t *lease) {
+    (void)self;
+
+    if(!mem_valid)
+        return -1;
+
+    *lease = mem_lease;
+    lease->obtained -= mem_age;
+    return 0;
+}
+
+static int mem_save(net_dhcp_store_t *self, const net_dhcp_lease_t *lease) {
+    (void)self;
+
+    mem_lease = *lease;
+    mem_valid = 1;
+    return 0;
+}
+
+static net_dhcp_store_t mem_store = { mem_load, mem_save, NULL, NULL };
+
+/* Bring the stack up on a fresh device, as if the Dreamcast were just turned
+   on, and check how it went. */
+static int boot(const char *name, int want_discover, int want_reboot,
+                int want_ip) {
+    netif_t *nif;
+    uint64 start, ms;
+    int fd, ok;
+
+    n_discover = n_select = n_reboot = n_renew = n_nak = 0;
+
+    if(!(nif = nethost_if_pipe(&fd))) {
+        perror("nethost_if_pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Every device gets a MAC address of its own, but this is meant to be the
+       same one each time. */
+    nif->mac_addr[5] = 1;
+    net_set_default(nif);
+    peer = fd;
+
+    start = timer_ms_gettime64();
+    net_init(0);
+    ms = timer_ms_gettime64() - start;
+
+    ok = nif->ip_addr[0] == 10 && nif->ip_addr[3] == want_ip &&
+         (n_discover > 0) == want_discover && (n_reboot > 0) == want_reboot;
+
+    printf("%-28s %6d ms  %d.%d.%d.%d  %u discover, %u select, %u reboot, "
+           "%u nak  %s\n", name, (int)ms, nif->ip_addr[0], nif->ip_addr[1],
+           nif->ip_addr[2], nif->ip_addr[3], n_discover, n_select, n_reboot,
+           n_nak, ok ? "ok" : "FAILED");
+
+    net_shutdown();
+    peer = -1;
+    host_close(fd);
+
+    return ok ? 0 : -1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options]\n"
+            "  -f file   Where to keep the lease (default: dhcptest.lease)\n"
+            "  -d ms     Time the server takes to answer DISCOVER "
+            "(default: 0)\n"
+            "  -r ms     Client's first retransmit delay (default: 250)\n"
+            "  -t ms     Client's INIT-REBOOT timeout (default: 1000)\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *fn = "dhcptest.lease";
+    net_dhcp_params_t params;
+    int opt, bad = 0;
+
+    memset(&params, 0, sizeof(params));
+    params.retrans_min = 250;
+    params.reboot_timeout = 1000;
+    params.timeout = 10000;
+
+    while((opt = getopt(argc, argv, "f:d:r:t:h")) != -1) {
+        switch(opt) {
+            case 'f':
+                fn = optarg;
+                break;
+
+            case 'd':
+                offer_delay = atoi(optarg);
+                break;
+
+            case 'r':
+                params.retrans_min = atoi(optarg);
+                break;
+
+            case 't':
+                params.reboot_timeout = atoi(optarg);
+                break;
+
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    dbglog_set_level(DBG_WARNING);
+
+    if(nethost_init() < 0) {
+        perror("nethost");
+        return EXIT_FAILURE;
+    }
+
+    if(net_dhcp_set_params(&params) < 0) {
+        perror("net_dhcp_set_params");
+        return EXIT_FAILURE;
+    }
+
+    host_unlink(fn);
+    net_dhcp_set_store_file(fn);
+
+    pool_ip[0] = 10;
+    pool_ip[1] = 9;
+    pool_ip[2] = 0;
+    pool_ip[3] = 100;
+
+    host_thread_create(server_thd, NULL);
+
+    bad += boot("first boot", 1, 0, 100);
+    bad += boot("saved lease", 0, 1, 100);
+
+    pool_ip[3] = 101;
+    bad += boot("saved lease, NAKed", 1, 1, 101);
+
+    reboot_mode = REBOOT_IGNORE;
+    bad += boot("saved lease, no answer", 1, 1, 101);
+    reboot_mode = REBOOT_ACK;
+
+    /* Make the lease look two hours old, when it only lasts for one. */
+    net_dhcp_set_store(&mem_store);
+    bad += boot("memory store, first boot", 1, 0, 101);
+    mem_age = 2 * 60 * 60;
+    bad += boot("memory store, expired", 1, 0, 101);
+    mem_age = 0;
+    bad += boot("memory store, saved lease", 0, 1, 101);
+
+    net_dhcp_set_store(NULL);
+    drop_discovers = 2;
+    bad += boot("no store, 2 DISCOVERs lost", 1, 0, 101);
+
+    nethost_shutdown();
+    host_unlink(fn);
+
+    return bad ? EXIT_FAILURE : 0;
+}
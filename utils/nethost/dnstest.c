@@ -0,0 +1,580 @@
+/* KallistiOS ##version##
+
+   utils/nethost/dnstest.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* Tests getaddrinfo() against a fake DNS server on the loopback. The server
+   is a KOS thread listening on port 53, and the default device's DNS server
+   is set to 127.0.0.1. It knows a handful of made up names, counts every
+   question it gets, and can hold answers back until other questions arrive,
+   which shows whether lookups really are happening at the same time. This
+   checks the following:
+
+       - answers come out of the cache until their TTL runs out, whatever
+         case the name is in
+       - names that don't exist are cached for as long as the SOA says, and
+         server failures aren't cached at all
+       - the A and AAAA questions for one lookup go out together
+       - a batch of getaddrinfo_async() lookups are all in flight at once,
+         and each gets its own answer, including one that was abandoned */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <kos/net.h>
+#include <kos/thread.h>
+#include <kos/dbglog.h>
+#include <arch/timer.h>
+
+#include "nethost.h"
+
+#define DNS_PORT        53
+
+#define QTYPE_A         1
+#define QTYPE_SOA       6
+#define QTYPE_AAAA      28
+
+#define RCODE_OK        0
+#define RCODE_SERVFAIL  2
+#define RCODE_NXDOMAIN  3
+
+/* How long the server will hold an answer back waiting for other questions.
+   This is less than the resolver's retry timeout, so a held answer never
+   causes a retry. */
+#define HOLD_MS         300
+
+/* How many of the parallel lookups to start at once. */
+#define PAR_CNT         8
+
+/* What the server knows about a name. Names with no A or AAAA address get an
+   empty answer (NODATA), or NXDOMAIN if nx is set. Either way, the SOA minimum
+   goes in the authority section if soa is set. */
+typedef struct zone {
+    const char *name;
+    uint32 a;
+    const char *aaaa;
+    uint32 ttl;
+    int rcode;
+    int soa;
+    uint32 soa_min;
+
+    /* Hold the answers to this name until questions have come in for every
+       name with the same group, or HOLD_MS has gone by. */
+    int group;
+
+    /* How many questions of each type have come in. */
+    int queries_a, queries_aaaa;
+} zone_t;
+
+#define GROUP_BOTH      1
+#define GROUP_PAR       2
+
+static zone_t zones[] = {
+    { "host.test", 0x0A010001, "2001:db8::1", 300, RCODE_OK, 0, 0, 0 },
+    { "short.test", 0x0A010002, NULL, 1, RCODE_OK, 1, 1, 0 },
+    { "gone.test", 0, NULL, 300, RCODE_NXDOMAIN, 1, 1, 0 },
+    { "nosoa.test", 0, NULL, 300, RCODE_NXDOMAIN, 0, 0, 0 },
+    { "fail.test", 0, NULL, 300, RCODE_SERVFAIL, 0, 0, 0 },
+    { "both.test", 0x0A010003, "2001:db8::3", 300, RCODE_OK, 0, 0,
+      GROUP_BOTH },
+    { "par0.test", 0x0A020000, NULL, 300, RCODE_OK, 1, 300, GROUP_PAR },
+    { "par1.test", 0x0A020001, NULL, 300, RCODE_OK, 1, 300, GROUP_PAR },
+    { "par2.test", 0x0A020002, NULL, 300, RCODE_OK, 1, 300, GROUP_PAR },
+    { "par3.test", 0x0A020003, NULL, 300, RCODE_OK, 1, 300, GROUP_PAR },
+    { "par4.test", 0x0A020004, NULL, 300, RCODE_OK, 1, 300, GROUP_PAR },
+    { "par5.test", 0x0A020005, NULL, 300, RCODE_OK, 1, 300, GROUP_PAR },
+    { "par6.test", 0x0A020006, NULL, 300, RCODE_OK, 1, 300, GROUP_PAR },
+    { "par7.test", 0x0A020007, NULL, 300, RCODE_OK, 1, 300, GROUP_PAR },
+};
+
+#define ZONE_CNT        (int)(sizeof(zones) / sizeof(zones[0]))
+
+/* A question that's being held back. */
+typedef struct held {
+    struct sockaddr_in from;
+    uint8 buf[512];
+    int len;
+    int zone;
+    uint64 due;
+} held_t;
+
+#define HELD_MAX        32
+
+static held_t held[HELD_MAX];
+static int held_cnt = 0;
+static int held_timeouts = 0;
+static volatile int server_quit = 0;
+static int server_sock = -1;
+static int failures = 0;
+
+static void check(int ok, const char *what) {
+    printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+
+    if(!ok)
+        ++failures;
+}
+
+static void put16(uint8 *p, uint16 v) {
+    p[0] = (uint8)(v >> 8);
+    p[1] = (uint8)v;
+}
+
+static void put32(uint8 *p, uint32 v) {
+    p[0] = (uint8)(v >> 24);
+    p[1] = (uint8)(v >> 16);
+    p[2] = (uint8)(v >> 8);
+    p[3] = (uint8)v;
+}
+
+static uint16 get16(const uint8 *p) {
+    return (uint16)((p[0] << 8) | p[1]);
+}
+
+/* Pull the name and type out of a question. Returns the offset of the end of
+   the question, or -1 if it's garbled. */
+static int parse_question(const uint8 *buf, int len, char *name, int *qtype) {
+    int o = 12, n = 0, l;
+
+    while(o < len && buf[o]) {
+        l = buf[o++];
+
+        if(o + l > len || n + l + 1 > 255)
+            return -1;
+
+        if(n)
+            name[n++] = '.';
+
+        memcpy(name + n, buf + o, l);
+        n += l;
+        o += l;
+    }
+
+    name[n] = 0;
+
+    if(o + 5 > len)
+        return -1;
+
+    *qtype = get16(buf + o + 1);
+    return o + 5;
+}
+
+static int find_zone(const char *name) {
+    int i;
+
+    for(i = 0; i < ZONE_CNT; ++i) {
+        if(!strcmp(zones[i].name, name))
+            return i;
+    }
+
+    return -1;
+}
+
+/* Build and send the answer to a question. */
+static void answer(const struct sockaddr_in *to, const uint8 *q, int qlen,
+                   int zone, int qtype) {
+    uint8 buf[512];
+    const zone_t *z = zone >= 0 ? zones + zone : NULL;
+    int o = qlen, an = 0, ns = 0, rcode = z ? z->rcode : RCODE_NXDOMAIN;
+    struct in6_addr a6;
+
+    memcpy(buf, q, qlen);
+
+    if(z && rcode == RCODE_OK && qtype == QTYPE_A && z->a) {
+        put16(buf + o, 0xC00C);
+        put16(buf + o + 2, QTYPE_A);
+        put16(buf + o + 4, 1);
+        put32(buf + o + 6, z->ttl);
+        put16(buf + o + 10, 4);
+        put32(buf + o + 12, z->a);
+        o += 16;
+        ++an;
+    }
+    else if(z && rcode == RCODE_OK && qtype == QTYPE_AAAA && z->aaaa) {
+        inet_pton(AF_INET6, z->aaaa, &a6);
+        put16(buf + o, 0xC00C);
+        put16(buf + o + 2, QTYPE_AAAA);
+        put16(buf + o + 4, 1);
+        put32(buf + o + 6, z->ttl);
+        put16(buf + o + 10, 16);
+        memcpy(buf + o + 12, &a6, 16);
+        o += 28;
+        ++an;
+    }
+    else if(z && z->soa && rcode != RCODE_SERVFAIL) {
+        /* An SOA with an empty server and mailbox name, and the minimum TTL
+           last (RFC 2308, section 5). */
+        put16(buf + o, 0xC00C);
+        put16(buf + o + 2, QTYPE_SOA);
+        put16(buf + o + 4, 1);
+        put32(buf + o + 6, 3600);
+        put16(buf + o + 10, 22);
+        memset(buf + o + 12, 0, 18);
+        put32(buf + o + 30, z->soa_min);
+        o += 34;
+        ++ns;
+    }
+
+    put16(buf + 2, 0x8180 | rcode);
+    put16(buf + 4, 1);
+    put16(buf + 6, an);
+    put16(buf + 8, ns);
+    put16(buf + 10, 0);
+
+    sendto(server_sock, buf, o, 0, (const struct sockaddr *)to,
+           sizeof(struct sockaddr_in));
+}
+
+/* Has a question come in for every name in the group? */
+static int group_done(int group) {
+    int i;
+
+    for(i = 0; i < ZONE_CNT; ++i) {
+        if(zones[i].group == group &&
+           !zones[i].queries_a && !zones[i].queries_aaaa)
+            return 0;
+
+        /* Both halves of a lookup have to be here. */
+        if(zones[i].group == group && group == GROUP_BOTH &&
+           (!zones[i].queries_a || !zones[i].queries_aaaa))
+            return 0;
+    }
+
+    return 1;
+}
+
+static void release_held(void) {
+    uint64 now = timer_ms_gettime64();
+    char name[256];
+    int i, qtype, qlen, timed_out;
+
+    for(i = 0; i < held_cnt;) {
+        timed_out = held[i].due <= now;
+
+        if(!timed_out && !group_done(zones[held[i].zone].group)) {
+            ++i;
+            continue;
+        }
+
+        held_timeouts += timed_out;
+        qlen = parse_question(held[i].buf, held[i].len, name, &qtype);
+        answer(&held[i].from, held[i].buf, qlen, held[i].zone, qtype);
+        held[i] = held[--held_cnt];
+    }
+}
+
+static void *server_thd(void *data) {
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    struct pollfd pfd;
+    uint8 buf[512];
+    char name[256];
+    int len, qlen, qtype, zone;
+
+    (void)data;
+
+    pfd.fd = server_sock;
+    pfd.events = POLLIN;
+
+    while(!server_quit) {
+        pfd.revents = 0;
+
+        if(poll(&pfd, 1, 10) == 1) {
+            fromlen = sizeof(from);
+            len = recvfrom(server_sock, buf, sizeof(buf), 0,
+                           (struct sockaddr *)&from, &fromlen);
+
+            if(len > 12 &&
+               (qlen = parse_question(buf, len, name, &qtype)) > 0) {
+                if((zone = find_zone(name)) >= 0) {
+                    if(qtype == QTYPE_A)
+                        ++zones[zone].queries_a;
+                    else if(qtype == QTYPE_AAAA)
+                        ++zones[zone].queries_aaaa;
+                }
+
+                if(zone >= 0 && zones[zone].group && held_cnt < HELD_MAX) {
+                    held[held_cnt].from = from;
+                    memcpy(held[held_cnt].buf, buf, len);
+                    held[held_cnt].len = len;
+                    held[held_cnt].zone = zone;
+                    held[held_cnt].due = timer_ms_gettime64() + HOLD_MS;
+                    ++held_cnt;
+                }
+                else {
+                    answer(&from, buf, qlen, zone, qtype);
+                }
+            }
+        }
+
+        release_held();
+    }
+
+    return NULL;
+}
+
+static int start_server(void) {
+    struct sockaddr_in addr;
+
+    if((server_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(DNS_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if(bind(server_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        return -1;
+
+    return thd_create(0, server_thd, NULL) ? 0 : -1;
+}
+
+static int queries(const char *name) {
+    int z = find_zone(name);
+
+    return zones[z].queries_a + zones[z].queries_aaaa;
+}
+
+/* Look a name up, and check that it came back with the IPv4 address given
+   (or 0 for none) and at least one IPv6 address if want6 is set. */
+static int lookup(const char *name, int family, uint32 want4, int want6) {
+    struct addrinfo hints, *res, *ai;
+    int rv, got4 = 0, got6 = 0;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    if((rv = getaddrinfo(name, NULL, &hints, &res)))
+        return rv;
+
+    for(ai = res; ai; ai = ai->ai_next) {
+        if(ai->ai_family == AF_INET &&
+           ntohl(((struct sockaddr_in *)ai->ai_addr)->sin_addr.s_addr) ==
+           want4)
+            ++got4;
+        else if(ai->ai_family == AF_INET6)
+            ++got6;
+    }
+
+    freeaddrinfo(res);
+
+    return (!want4 || got4) && (!want6 || got6) ? 0 : -1;
+}
+
+static void test_cache(void) {
+    int n;
+
+    check(!lookup("host.test", AF_UNSPEC, 0x0A010001, 1) &&
+          queries("host.test") == 2, "First lookup asks the server");
+
+    n = queries("host.test");
+    check(!lookup("host.test", AF_UNSPEC, 0x0A010001, 1) &&
+          !lookup("HOST.Test.", AF_INET, 0x0A010001, 0) &&
+          !lookup("host.test", AF_INET6, 0, 1) &&
+          queries("host.test") == n, "Next lookups come from the cache");
+
+    gai_cache_flush();
+    check(!lookup("host.test", AF_INET, 0x0A010001, 0) &&
+          queries("host.test") == n + 1, "gai_cache_flush() empties it");
+
+    /* This one is only good for a second. */
+    n = queries("short.test");
+    check(!lookup("short.test", AF_INET, 0x0A010002, 0) &&
+          !lookup("short.test", AF_INET, 0x0A010002, 0) &&
+          queries("short.test") == n + 1, "Short TTL is cached");
+
+    thd_sleep(1100);
+    check(!lookup("short.test", AF_INET, 0x0A010002, 0) &&
+          queries("short.test") == n + 2, "Short TTL runs out");
+}
+
+static void test_negative(void) {
+    int n;
+
+    /* The SOA says NXDOMAIN answers are good for a second. */
+    n = queries("gone.test");
+    check(lookup("gone.test", AF_INET, 0, 0) == EAI_NONAME &&
+          lookup("gone.test", AF_INET, 0, 0) == EAI_NONAME &&
+          queries("gone.test") == n + 1, "NXDOMAIN is cached");
+
+    thd_sleep(1100);
+    check(lookup("gone.test", AF_INET, 0, 0) == EAI_NONAME &&
+          queries("gone.test") == n + 2,
+          "NXDOMAIN is only cached for the SOA minimum");
+
+    /* No SOA, so it's cached for the default, which is a good long while. */
+    n = queries("nosoa.test");
+    check(lookup("nosoa.test", AF_INET, 0, 0) == EAI_NONAME &&
+          lookup("nosoa.test", AF_INET, 0, 0) == EAI_NONAME &&
+          queries("nosoa.test") == n + 1, "NXDOMAIN without an SOA is cached");
+
+    /* A name with an address, but not of the type asked for (NODATA). */
+    n = queries("short.test");
+    check(lookup("short.test", AF_INET6, 0, 0) == EAI_NONAME &&
+          lookup("short.test", AF_INET6, 0, 0) == EAI_NONAME &&
+          queries("short.test") == n + 1, "NODATA is cached");
+
+    n = queries("fail.test");
+    check(lookup("fail.test", AF_INET, 0, 0) == EAI_AGAIN &&
+          lookup("fail.test", AF_INET, 0, 0) == EAI_AGAIN &&
+          queries("fail.test") == n + 2, "SERVFAIL isn't cached");
+}
+
+static void test_both(void) {
+    uint64 start;
+    int rv, t = held_timeouts;
+
+    /* The server won't answer either question until it has both. */
+    start = timer_ms_gettime64();
+    rv = lookup("both.test", AF_UNSPEC, 0x0A010003, 1);
+
+    check(!rv && held_timeouts == t &&
+          timer_ms_gettime64() - start < HOLD_MS,
+          "A and AAAA questions go out together");
+}
+
+typedef struct par_result {
+    volatile int done;
+    int err;
+    uint32 addr;
+} par_result_t;
+
+static void par_cb(gai_async_t *req, int err, struct addrinfo *res,
+                   void *data) {
+    par_result_t *r = (par_result_t *)data;
+
+    (void)req;
+
+    r->err = err;
+
+    if(!err && res && res->ai_family == AF_INET)
+        r->addr = ntohl(((struct sockaddr_in *)res->ai_addr)->sin_addr.s_addr);
+
+    freeaddrinfo(res);
+    r->done = 1;
+}
+
+static void test_async(void) {
+    static par_result_t results[PAR_CNT];
+    gai_async_t *reqs[PAR_CNT], *waited;
+    struct addrinfo hints, *res;
+    char name[16];
+    uint64 start;
+    int i, t = held_timeouts, started = 0, done, right = 0, rv, pending;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    start = timer_ms_gettime64();
+
+    /* The first one gets waited on rather than called back, and the last one
+       gets abandoned before it's done. The server doesn't answer any of them
+       until it has seen all of them. */
+    for(i = 0; i < PAR_CNT; ++i) {
+        snprintf(name, sizeof(name), "par%d.test", i);
+        memset(&results[i], 0, sizeof(par_result_t));
+        reqs[i] = getaddrinfo_async(name, "80", &hints, i ? par_cb : NULL,
+                                    &results[i]);
+        started += reqs[i] != NULL;
+    }
+
+    waited = reqs[0];
+    pending = gai_async_wait(waited, 0) == EAI_INPROGRESS;
+    gai_async_free(reqs[PAR_CNT - 1]);
+
+    rv = gai_async_wait(waited, 2000);
+
+    if(!rv && !gai_async_result(waited, &res) && res) {
+        right += ntohl(((struct sockaddr_in *)res->ai_addr)->sin_addr.s_addr) ==
+                 0x0A020000 &&
+                 ntohs(((struct sockaddr_in *)res->ai_addr)->sin_port) == 80;
+        freeaddrinfo(res);
+    }
+
+    gai_async_free(waited);
+
+    /* Wait for the callbacks. */
+    do {
+        thd_sleep(10);
+
+        for(i = 1, done = 0; i < PAR_CNT; ++i)
+            done += results[i].done;
+    } while(done < PAR_CNT - 1 && timer_ms_gettime64() - start < 2000);
+
+    for(i = 1; i < PAR_CNT; ++i)
+        right += !results[i].err && results[i].addr == (uint32)(0x0A020000 + i);
+
+    check(started == PAR_CNT && pending, "Start asynchronous lookups");
+    check(held_timeouts == t && timer_ms_gettime64() - start < HOLD_MS,
+          "They're all in flight at once");
+    check(done == PAR_CNT - 1 && right == PAR_CNT,
+          "Each gets its own answer, abandoned or not");
+
+    for(i = 1; i < PAR_CNT - 1; ++i)
+        gai_async_free(reqs[i]);
+
+    /* And they're cached now, too. */
+    rv = queries("par3.test");
+    check(!lookup("par3.test", AF_INET, 0x0A020003, 0) &&
+          queries("par3.test") == rv, "Asynchronous answers are cached");
+}
+
+int main(int argc, char *argv[]) {
+    netif_t *lo;
+
+    (void)argc;
+    (void)argv;
+
+    dbglog_set_level(DBG_WARNING);
+
+    if(nethost_init() < 0) {
+        perror("nethost_init");
+        return EXIT_FAILURE;
+    }
+
+    net_init(0);
+
+    LIST_FOREACH(lo, &net_if_list, if_list) {
+        if(!strcmp(lo->name, "lo"))
+            break;
+    }
+
+    if(!lo) {
+        fprintf(stderr, "No loopback device\n");
+        return EXIT_FAILURE;
+    }
+
+    /* The resolver asks the default device's DNS server, so that has to be
+       the loopback, and the server has to be on it. */
+    net_set_default(lo);
+    net_default_dev->dns[0] = 127;
+    net_default_dev->dns[1] = 0;
+    net_default_dev->dns[2] = 0;
+    net_default_dev->dns[3] = 1;
+
+    if(start_server() < 0) {
+        perror("Can't start the DNS server");
+        return EXIT_FAILURE;
+    }
+
+    test_cache();
+    test_negative();
+    test_both();
+    test_async();
+
+    server_quit = 1;
+
+    printf("%d check%s FAILED\n", failures, failures == 1 ? "" : "s");
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,149 @@
+/* KallistiOS ##version##
+
+   utils/nethost/epolltest.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* Tests that closing a file descriptor takes it out of the epoll instances
+   that are watching it. A UDP socket on the loopback device is added to an
+   instance and closed, and then this checks that the instance forgets about
+   it, and that a new socket that gets the same descriptor number can be added
+   and reports its own events. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <kos/net.h>
+#include <kos/dbglog.h>
+
+#include "nethost.h"
+
+#define PORT            7200
+
+static int failures = 0;
+
+static void check(int ok, const char *what) {
+    printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+
+    if(!ok)
+        ++failures;
+}
+
+static void set_addr(struct sockaddr_in *addr, int port) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+}
+
+static int udp_bound(int port) {
+    struct sockaddr_in addr;
+    int sock;
+
+    if((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+        return -1;
+
+    set_addr(&addr, port);
+
+    if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+static int watch(int ep, int fd, uint64_t cookie) {
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = cookie;
+    return epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static int send_to(int sock, int port) {
+    struct sockaddr_in addr;
+
+    set_addr(&addr, port);
+    return sendto(sock, "ping", 4, 0, (struct sockaddr *)&addr, sizeof(addr));
+}
+
+static void test_close(void) {
+    struct epoll_event ev;
+    int ep, tx, a, b, c;
+
+    ep = epoll_create1(0);
+    tx = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    a = udp_bound(PORT);
+
+    if(ep < 0 || tx < 0 || a < 0) {
+        check(0, "Set up an epoll instance and some sockets");
+        return;
+    }
+
+    check(!watch(ep, a, 1), "Add a UDP socket");
+    check(send_to(tx, PORT) == 4 && epoll_wait(ep, &ev, 1, 1000) == 1 &&
+          ev.data.u64 == 1 && (ev.events & EPOLLIN),
+          "A datagram makes it ready");
+
+    /* It's still readable (and so still on the ready list) when it's closed,
+       and nothing should come of that. */
+    close(a);
+    check(epoll_wait(ep, &ev, 1, 0) == 0,
+          "Closing it drops it from the instance");
+
+    errno = 0;
+    check(epoll_ctl(ep, EPOLL_CTL_DEL, a, NULL) < 0 && errno == EBADF,
+          "EPOLL_CTL_DEL on the closed fd fails with EBADF");
+
+    b = udp_bound(PORT + 1);
+    check(b == a, "A new socket reuses the fd number");
+    check(!watch(ep, b, 2), "Adding the reused fd works");
+    check(send_to(tx, PORT + 1) == 4 && epoll_wait(ep, &ev, 1, 1000) == 1 &&
+          ev.data.u64 == 2, "The reused fd reports its own events");
+    check(!epoll_ctl(ep, EPOLL_CTL_DEL, b, NULL), "EPOLL_CTL_DEL on it works");
+    check(!watch(ep, tx, 3) && epoll_wait(ep, &ev, 1, 0) == 0,
+          "Add an idle socket");
+
+    /* This time the socket isn't ready when it's closed, and nobody waits on
+       the instance before the number gets used again. */
+    close(tx);
+    c = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    check(c == tx && !watch(ep, c, 4),
+          "Adding a reused fd that was closed while idle works");
+    check(epoll_wait(ep, &ev, 1, 0) == 0,
+          "Nothing is reported for the closed socket");
+
+    close(c);
+    close(b);
+    close(ep);
+}
+
+int main(void) {
+    dbglog_set_level(DBG_WARNING);
+
+    if(nethost_init() < 0) {
+        perror("nethost_init");
+        return EXIT_FAILURE;
+    }
+
+    net_init(0);
+
+    test_close();
+
+    printf("\n%d check%s FAILED\n", failures, failures == 1 ? "" : "s");
+
+    net_shutdown();
+    nethost_shutdown();
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
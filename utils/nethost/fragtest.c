@@ -0,0 +1,485 @@
+/* KallistiOS ##version##
+
+   utils/nethost/fragtest.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* Tests IPv4 and IPv6 fragment reassembly. Fragmented UDP datagrams are fed
+   straight to the stack (on a device with no backend), in order, backwards,
+   shuffled with duplicates, and with fragments that don't agree with each
+   other, and this checks that what comes out of the sockets is right. Then it
+   floods the stack with datagrams that never finish, to make sure that the
+   memory used for reassembly stays inside its budget and that a datagram that
+   does finish still gets through, and checks that the leftovers time out.
+
+   Last, it times reassembly with a number of datagrams in flight at once, the
+   fragments of which are all interleaved with each other. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <kos/net.h>
+#include <kos/thread.h>
+#include <kos/dbglog.h>
+
+#include "nethost.h"
+#include "host_os.h"
+
+#define ETH_LEN         14
+#define IP_LEN          20
+#define IP6_LEN         40
+#define FRAG6_LEN       8
+#define UDP_LEN         8
+
+#define PORT4           7000
+#define PORT6           7001
+
+#define MAX_DGRAM       65535
+#define MAX_FRAGS       128
+
+/* How the fragments of a datagram get sent. */
+#define ORDER_FORWARD   0
+#define ORDER_REVERSE   1
+#define ORDER_SHUFFLE   2
+
+static netif_t *nif;
+static int sock4 = -1, sock6 = -1;
+static const uint8 peer_mac[6] = { 0x02, 'F', 'R', 'A', 'G', 0x01 };
+static const uint8 peer_ip[4] = { 10, 0, 2, 1 };
+static const uint8 local_ip[4] = { 10, 0, 2, 2 };
+static struct in6_addr peer_ip6, local_ip6;
+
+static uint8 dgram[MAX_DGRAM + UDP_LEN];
+static uint8 rbuf[MAX_DGRAM + UDP_LEN];
+static uint32 seed = 0x46524147;
+static int failures = 0;
+
+static uint32 rnd(uint32 n) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) % n;
+}
+
+static uint32 cksum_add(uint32 sum, const uint8 *p, int len) {
+    int i;
+
+    for(i = 0; i + 1 < len; i += 2)
+        sum += (p[i] << 8) | p[i + 1];
+
+    if(len & 1)
+        sum += p[len - 1] << 8;
+
+    return sum;
+}
+
+static uint16 cksum_fold(uint32 sum) {
+    while(sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return (uint16)~sum;
+}
+
+/* Build a UDP datagram with the given payload size in dgram, returning its
+   length. The payload is numbered, so anything out of place shows up. */
+static int build_udp(int v6, int plen, uint32 tag) {
+    uint32 sum;
+    uint8 ph[4];
+    uint16 cs;
+    int i, len = plen + UDP_LEN;
+
+    dgram[0] = 0x12;
+    dgram[1] = 0x34;
+    dgram[2] = (v6 ? PORT6 : PORT4) >> 8;
+    dgram[3] = (v6 ? PORT6 : PORT4) & 0xFF;
+    dgram[4] = len >> 8;
+    dgram[5] = len & 0xFF;
+    dgram[6] = dgram[7] = 0;
+
+    for(i = 0; i < plen; ++i)
+        dgram[UDP_LEN + i] = (uint8)((i * 7) ^ (i >> 8) ^ tag);
+
+    /* The pseudo-header, then the datagram itself. */
+    if(v6) {
+        sum = cksum_add(0, peer_ip6.s6_addr, 16);
+        sum = cksum_add(sum, local_ip6.s6_addr, 16);
+    }
+    else {
+        sum = cksum_add(0, peer_ip, 4);
+        sum = cksum_add(sum, local_ip, 4);
+    }
+
+    ph[0] = 0;
+    ph[1] = IPPROTO_UDP;
+    ph[2] = len >> 8;
+    ph[3] = len & 0xFF;
+    sum = cksum_add(sum, ph, 4);
+    cs = cksum_fold(cksum_add(sum, dgram, len));
+
+    if(!cs)
+        cs = 0xFFFF;
+
+    dgram[6] = cs >> 8;
+    dgram[7] = cs & 0xFF;
+
+    return len;
+}
+
+/* Send one fragment of what's in dgram. */
+static void send_frag(int v6, uint32 id, int off, int len, int more) {
+    uint8 buf[ETH_LEN + IP6_LEN + FRAG6_LEN + 1500];
+    uint8 *ip = buf + ETH_LEN;
+    uint16 fo, cs;
+    int hl;
+
+    memcpy(buf, nif->mac_addr, 6);
+    memcpy(buf + 6, peer_mac, 6);
+
+    if(!v6) {
+        buf[12] = 0x08;
+        buf[13] = 0x00;
+        hl = IP_LEN;
+        memset(ip, 0, IP_LEN);
+        ip[0] = 0x45;
+        ip[2] = (IP_LEN + len) >> 8;
+        ip[3] = (IP_LEN + len) & 0xFF;
+        ip[4] = (id >> 8) & 0xFF;
+        ip[5] = id & 0xFF;
+        fo = (off >> 3) | (more ? 0x2000 : 0);
+        ip[6] = fo >> 8;
+        ip[7] = fo & 0xFF;
+        ip[8] = 64;
+        ip[9] = IPPROTO_UDP;
+        memcpy(ip + 12, peer_ip, 4);
+        memcpy(ip + 16, local_ip, 4);
+        cs = cksum_fold(cksum_add(0, ip, IP_LEN));
+        ip[10] = cs >> 8;
+        ip[11] = cs & 0xFF;
+    }
+    else {
+        buf[12] = 0x86;
+        buf[13] = 0xDD;
+        hl = IP6_LEN + FRAG6_LEN;
+        memset(ip, 0, hl);
+        ip[0] = 0x60;
+        ip[4] = (FRAG6_LEN + len) >> 8;
+        ip[5] = (FRAG6_LEN + len) & 0xFF;
+        ip[6] = 44;
+        ip[7] = 64;
+        memcpy(ip + 8, peer_ip6.s6_addr, 16);
+        memcpy(ip + 24, local_ip6.s6_addr, 16);
+        ip[40] = IPPROTO_UDP;
+        fo = off | (more ? 1 : 0);
+        ip[42] = fo >> 8;
+        ip[43] = fo & 0xFF;
+        ip[44] = id >> 24;
+        ip[45] = id >> 16;
+        ip[46] = id >> 8;
+        ip[47] = id;
+    }
+
+    memcpy(ip + hl, dgram + off, len);
+    nethost_if_input(nif, buf, ETH_LEN + hl + len);
+}
+
+/* Send what's in dgram in fragments of fsize bytes, in the given order. If
+   dup is set, a few of them get sent twice. */
+static void send_dgram(int v6, uint32 id, int len, int fsize, int order,
+                       int dup) {
+    int offs[MAX_FRAGS], n = 0, i, j, t, off;
+
+    for(off = 0; off < len; off += fsize)
+        offs[n++] = off;
+
+    if(order == ORDER_REVERSE) {
+        for(i = 0; i < n / 2; ++i) {
+            t = offs[i];
+            offs[i] = offs[n - 1 - i];
+            offs[n - 1 - i] = t;
+        }
+    }
+    else if(order == ORDER_SHUFFLE) {
+        for(i = n - 1; i > 0; --i) {
+            j = rnd(i + 1);
+            t = offs[i];
+            offs[i] = offs[j];
+            offs[j] = t;
+        }
+    }
+
+    for(i = 0; i < n; ++i) {
+        off = offs[i];
+        t = len - off < fsize ? len - off : fsize;
+        send_frag(v6, id, off, t, off + t < len);
+
+        if(dup && !rnd(3))
+            send_frag(v6, id, off, t, off + t < len);
+    }
+}
+
+/* See if the datagram in dgram came out of the socket (want is 1), or if
+   nothing did (want is 0). */
+static int check_recv(int v6, int len, int want) {
+    ssize_t r = recv(v6 ? sock6 : sock4, rbuf, sizeof(rbuf), MSG_DONTWAIT);
+
+    if(!want)
+        return r < 0;
+
+    return r == len - UDP_LEN && !memcmp(rbuf, dgram + UDP_LEN, r);
+}
+
+static void result(const char *name, int ok) {
+    printf("%-40s %s\n", name, ok ? "ok" : "FAILED");
+
+    if(!ok)
+        ++failures;
+}
+
+static void drain(void) {
+    while(recv(sock4, rbuf, sizeof(rbuf), MSG_DONTWAIT) >= 0)
+        ;
+
+    while(recv(sock6, rbuf, sizeof(rbuf), MSG_DONTWAIT) >= 0)
+        ;
+}
+
+static void test_orders(int v6) {
+    static const char *names[] = { "in order", "backwards", "shuffled" };
+    char name[64];
+    int order, len;
+
+    for(order = ORDER_FORWARD; order <= ORDER_SHUFFLE; ++order) {
+        len = build_udp(v6, 6000, order);
+        send_dgram(v6, 100 + order, len, 1480, order, order == ORDER_SHUFFLE);
+        snprintf(name, sizeof(name), "%s, %s%s", v6 ? "IPv6" : "IPv4",
+                 names[order], order == ORDER_SHUFFLE ? " with dups" : "");
+        result(name, check_recv(v6, len, 1));
+    }
+
+    /* A big one, bigger than our first guess at the size. */
+    len = build_udp(v6, 60000, 9);
+    send_dgram(v6, 110, len, 1480, ORDER_FORWARD, 0);
+    snprintf(name, sizeof(name), "%s, 60000 bytes", v6 ? "IPv6" : "IPv4");
+    result(name, check_recv(v6, len, 1));
+}
+
+static void test_bad(void) {
+    net_frag_stats_t before = net_frag_get_stats(), after;
+    int len, ok;
+
+    /* Two fragments that both claim to be the last one. */
+    len = build_udp(0, 3000, 1);
+    send_frag(0, 200, 2480, len - 2480, 0);
+    send_frag(0, 200, 1480, 1000, 0);
+    send_frag(0, 200, 0, 1480, 1);
+    ok = check_recv(0, len, 0);
+    after = net_frag_get_stats();
+    result("IPv4, lengths don't agree", ok &&
+           after.pkt_bad == before.pkt_bad + 1);
+
+    /* A fragment in the middle that isn't a multiple of 8 bytes. */
+    send_frag(0, 201, 0, 1480, 1);
+    send_frag(0, 201, 1480, 1001, 1);
+    send_frag(0, 201, 2480, len - 2480, 0);
+    result("IPv4, odd sized fragment", check_recv(0, len, 0));
+
+    /* An atomic IPv6 fragment. */
+    len = build_udp(1, 500, 2);
+    send_frag(1, 202, 0, len, 0);
+    result("IPv6, atomic fragment", check_recv(1, len, 1));
+}
+
+static void test_flood(void) {
+    net_frag_params_t p;
+    net_frag_stats_t st;
+    uint32 i;
+    int len, ok = 1;
+
+    net_frag_get_params(&p);
+
+    /* Lots of first fragments that never get the rest. */
+    len = build_udp(0, 8000, 3);
+
+    for(i = 0; i < 2000; ++i) {
+        send_frag(i & 1, 1000 + i, 0, 1480, 1);
+        st = net_frag_get_stats();
+
+        if(st.mem_used > p.max_mem)
+            ok = 0;
+    }
+
+    result("flood stays within the budget", ok && st.mem_peak <= p.max_mem &&
+           st.pkt_evicted > 0);
+
+    /* Something that does finish should still make it. */
+    send_dgram(0, 5000, len, 1480, ORDER_SHUFFLE, 0);
+    result("datagram gets through the flood", check_recv(0, len, 1));
+}
+
+static void test_timeout(void) {
+    net_frag_params_t p, old;
+    net_frag_stats_t st;
+
+    net_frag_get_params(&old);
+    p = old;
+
+    /* Shrinking the budget to nothing throws out whatever is left from the
+       flood. */
+    p.max_mem = 1;
+    net_frag_set_params(&p);
+    st = net_frag_get_stats();
+    result("smaller budget evicts", st.mem_used == 0);
+
+    p.max_mem = old.max_mem;
+    p.timeout = 500;
+    net_frag_set_params(&p);
+
+    build_udp(0, 3000, 4);
+    send_frag(0, 300, 0, 1480, 1);
+
+    /* The reaper runs every two seconds. */
+    thd_sleep(2500);
+    st = net_frag_get_stats();
+    result("leftovers time out", st.mem_used == 0 && st.pkt_timeout > 0);
+
+    net_frag_set_params(&old);
+}
+
+static void bench(int count, int size, int inflight) {
+    int len, fsize = 1480, nf, i, j, k, off, t, got = 0;
+    uint64 start, us;
+    net_frag_stats_t before = net_frag_get_stats(), st;
+
+    len = build_udp(0, size, 5);
+    nf = (len + fsize - 1) / fsize;
+    start = host_time_us();
+
+    for(i = 0; i < count; i += inflight) {
+        /* Interleave the fragments of inflight datagrams. */
+        for(j = 0; j < nf; ++j) {
+            for(k = 0; k < inflight && i + k < count; ++k) {
+                off = j * fsize;
+                t = len - off < fsize ? len - off : fsize;
+                send_frag(0, 20000 + i + k, off, t, off + t < len);
+            }
+        }
+
+        while(recv(sock4, rbuf, sizeof(rbuf), MSG_DONTWAIT) >= 0)
+            ++got;
+    }
+
+    us = host_time_us() - start;
+    st = net_frag_get_stats();
+
+    printf("\n%d datagrams of %d bytes, %d at a time: %.2f us each, "
+           "%d received, %u evicted\npeak reassembly memory %u bytes\n",
+           count, size, inflight, (double)us / count, got,
+           (unsigned)(st.pkt_evicted - before.pkt_evicted),
+           (unsigned)st.mem_peak);
+}
+
+static int open_sock(int v6) {
+    struct sockaddr_in sin;
+    struct sockaddr_in6 sin6;
+    int s, rcvbuf = 256 * 1024;
+
+    if((s = socket(v6 ? PF_INET6 : PF_INET, SOCK_DGRAM, 0)) < 0)
+        return -1;
+
+    if(v6) {
+        memset(&sin6, 0, sizeof(sin6));
+        sin6.sin6_family = AF_INET6;
+        sin6.sin6_port = htons(PORT6);
+        sin6.sin6_addr = in6addr_any;
+
+        if(bind(s, (struct sockaddr *)&sin6, sizeof(sin6)) < 0)
+            return -1;
+    }
+    else {
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons(PORT4);
+        sin.sin_addr.s_addr = INADDR_ANY;
+
+        if(bind(s, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+            return -1;
+    }
+
+    setsockopt(s, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    return s;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options]\n"
+            "  -n count  Datagrams to time (default: 20000)\n"
+            "  -s size   Size of each one (default: 8000)\n"
+            "  -i count  How many are in flight at once (default: 16)\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    int opt, count = 20000, size = 8000, inflight = 16;
+
+    while((opt = getopt(argc, argv, "n:s:i:h")) != -1) {
+        switch(opt) {
+            case 'n':
+                count = atoi(optarg);
+                break;
+
+            case 's':
+                size = atoi(optarg);
+                break;
+
+            case 'i':
+                inflight = atoi(optarg);
+                break;
+
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if(count < 1 || size < 1 || size > 60000 || inflight < 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    dbglog_set_level(DBG_WARNING);
+
+    if(nethost_init() < 0 || !(nif = nethost_if_pcap())) {
+        perror("nethost");
+        return EXIT_FAILURE;
+    }
+
+    net_init(net_ipv4_address(local_ip));
+
+    inet_pton(AF_INET6, "fe80::1", &peer_ip6);
+    local_ip6 = nif->ip6_lladdr;
+
+    if((sock4 = open_sock(0)) < 0 || (sock6 = open_sock(1)) < 0) {
+        perror("socket");
+        return EXIT_FAILURE;
+    }
+
+    test_orders(0);
+    test_orders(1);
+    test_bad();
+    drain();
+    test_flood();
+    drain();
+    test_timeout();
+    bench(count, size, inflight);
+
+    close(sock4);
+    close(sock6);
+    net_shutdown();
+    nethost_shutdown();
+
+    return failures ? EXIT_FAILURE : 0;
+}
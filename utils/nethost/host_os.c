@@ -0,0 +1,426 @@
+/* KallistiOS ##version##
+
+   utils/nethost/host_os.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* This file is the only part of the harness that is built against the host's
+   headers, rather than the KOS ones. Everything in here is plain POSIX (plus
+   the Linux TAP interface). */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#ifdef __linux__
+#include <net/if.h>
+#include <linux/if_tun.h>
+#endif
+
+#include "host_os.h"
+
+/* The big lock is a ticket lock, so that a thread that gives it up and asks
+   for it right back goes to the back of the line, the way thd_pass() would
+   on KOS. Everything here, including the waiters, is protected by the one
+   mutex. */
+static pthread_mutex_t gil_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gil_cv = PTHREAD_COND_INITIALIZER;
+static uint64_t gil_next, gil_serving;
+static volatile int gil_want;
+
+struct host_waiter {
+    pthread_cond_t cv;
+    int woken;
+};
+
+static struct timespec start_time;
+static time_t start_wall;
+
+void host_gil_init(void) {
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    start_wall = time(NULL);
+    gil_next = gil_serving = 0;
+    gil_want = 0;
+}
+
+/* These two need gil_mutex held. */
+static void gil_take(void) {
+    uint64_t me = gil_next++;
+
+    while(me != gil_serving)
+        pthread_cond_wait(&gil_cv, &gil_mutex);
+
+    gil_want = 0;
+}
+
+static void gil_give(void) {
+    ++gil_serving;
+    pthread_cond_broadcast(&gil_cv);
+}
+
+void host_gil_lock(void) {
+    pthread_mutex_lock(&gil_mutex);
+    gil_take();
+    pthread_mutex_unlock(&gil_mutex);
+}
+
+void host_gil_unlock(void) {
+    pthread_mutex_lock(&gil_mutex);
+    gil_give();
+    pthread_mutex_unlock(&gil_mutex);
+}
+
+void host_gil_request(void) {
+    gil_want = 1;
+}
+
+int host_gil_requested(void) {
+    return gil_want;
+}
+
+host_waiter_t *host_waiter_create(void) {
+    pthread_condattr_t attr;
+    host_waiter_t *w;
+
+    if(!(w = (host_waiter_t *)calloc(1, sizeof(host_waiter_t))))
+        return NULL;
+
+    /* The deadlines are on the monotonic clock, so the condition variable
+       needs to be as well. */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&w->cv, &attr);
+    pthread_condattr_destroy(&attr);
+
+    return w;
+}
+
+void host_waiter_destroy(host_waiter_t *w) {
+    pthread_cond_destroy(&w->cv);
+    free(w);
+}
+
+int host_waiter_sleep(host_waiter_t *w, uint64_t deadline) {
+    struct timespec ts;
+    uint64_t t;
+    int rv = 0;
+
+    pthread_mutex_lock(&gil_mutex);
+    w->woken = 0;
+    gil_give();
+
+    if(deadline) {
+        t = (uint64_t)start_time.tv_sec * 1000000 + start_time.tv_nsec / 1000 +
+            deadline;
+        ts.tv_sec = t / 1000000;
+        ts.tv_nsec = (t % 1000000) * 1000;
+
+        while(!w->woken && !rv) {
+            if(pthread_cond_timedwait(&w->cv, &gil_mutex, &ts) == ETIMEDOUT)
+                rv = -1;
+        }
+
+        if(w->woken)
+            rv = 0;
+    }
+    else {
+        while(!w->woken)
+            pthread_cond_wait(&w->cv, &gil_mutex);
+    }
+
+    gil_take();
+    pthread_mutex_unlock(&gil_mutex);
+
+    return rv;
+}
+
+void host_waiter_wake(host_waiter_t *w) {
+    pthread_mutex_lock(&gil_mutex);
+    w->woken = 1;
+    pthread_cond_signal(&w->cv);
+    pthread_mutex_unlock(&gil_mutex);
+}
+
+int host_thread_create(void *(*fn)(void *), void *arg) {
+    pthread_t thd;
+    int rv;
+
+    if((rv = pthread_create(&thd, NULL, fn, arg))) {
+        errno = rv;
+        return -1;
+    }
+
+    pthread_detach(thd);
+    return 0;
+}
+
+uint64_t host_time_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)(ts.tv_sec - start_time.tv_sec) * 1000000 +
+        (ts.tv_nsec - start_time.tv_nsec) / 1000;
+}
+
+int64_t host_start_time(void) {
+    return (int64_t)start_wall;
+}
+
+void host_sleep_us(uint64_t us) {
+    struct timespec ts;
+
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000;
+    nanosleep(&ts, NULL);
+}
+
+/* The harness replaces close(), since the network stack calls it on its own
+   sockets, so get at the real one with the system call directly. */
+int host_open_write(const char *path) {
+    return open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+}
+
+int host_open_read(const char *path) {
+    return open(path, O_RDONLY);
+}
+
+int host_unlink(const char *path) {
+    return unlink(path);
+}
+
+int host_close(int fd) {
+    return (int)syscall(SYS_close, fd);
+}
+
+long host_read(int fd, void *buf, size_t len) {
+    return (long)read(fd, buf, len);
+}
+
+long host_write(int fd, const void *buf, size_t len) {
+    return (long)write(fd, buf, len);
+}
+
+long host_seek(int fd, long offset, int whence) {
+    return (long)lseek(fd, offset, whence);
+}
+
+long host_size(int fd) {
+    struct stat st;
+
+    if(fstat(fd, &st) < 0)
+        return -1;
+
+    return (long)st.st_size;
+}
+
+/* fcntl() is replaced too, for setting sockets non-blocking. */
+int host_fcntl(int fd, int cmd, long arg) {
+    return (int)syscall(SYS_fcntl, fd, cmd, arg);
+}
+
+/* The network stack has its own poll(), which takes the place of the host's,
+   so this has to use select() instead. */
+int host_wait_readable(int fd, int timeout) {
+    struct timeval tv;
+    fd_set fds;
+
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+
+    return select(fd + 1, &fds, NULL, NULL, &tv);
+}
+
+/* Datagram sockets keep the frames apart, just like a TAP device does. */
+int host_pipe_open(int fds[2]) {
+    return socketpair(AF_UNIX, SOCK_DGRAM, 0, fds);
+}
+
+int host_tap_open(char *name, size_t len) {
+#ifdef __linux__
+    struct ifreq ifr;
+    int fd;
+
+    if((fd = open("/dev/net/tun", O_RDWR)) < 0)
+        return -1;
+
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+
+    if(ioctl(fd, TUNSETIFF, &ifr) < 0) {
+        host_close(fd);
+        return -1;
+    }
+
+    strncpy(name, ifr.ifr_name, len - 1);
+    name[len - 1] = 0;
+
+    return fd;
+#else
+    (void)name;
+    (void)len;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* pcap file handling. This is simple enough that it isn't worth pulling in
+   libpcap for. */
+#define PCAP_MAGIC          0xA1B2C3D4
+#define PCAP_MAGIC_SWAPPED  0xD4C3B2A1
+#define PCAP_LINKTYPE_ETH   1
+
+typedef struct pcap_file_hdr {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+} pcap_file_hdr_t;
+
+typedef struct pcap_rec_hdr {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+} pcap_rec_hdr_t;
+
+struct host_pcap {
+    FILE *fp;
+    int swapped;
+};
+
+static uint32_t pcap_swap(const host_pcap_t *p, uint32_t v) {
+    if(!p->swapped)
+        return v;
+
+    return (v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000) | (v << 24);
+}
+
+host_pcap_t *host_pcap_open_read(const char *path) {
+    pcap_file_hdr_t hdr;
+    host_pcap_t *p;
+
+    if(!(p = (host_pcap_t *)calloc(1, sizeof(host_pcap_t))))
+        return NULL;
+
+    if(!(p->fp = fopen(path, "rb")))
+        goto out_free;
+
+    if(fread(&hdr, sizeof(hdr), 1, p->fp) != 1)
+        goto out_close;
+
+    if(hdr.magic == PCAP_MAGIC_SWAPPED)
+        p->swapped = 1;
+    else if(hdr.magic != PCAP_MAGIC)
+        goto out_close;
+
+    if(pcap_swap(p, hdr.linktype) != PCAP_LINKTYPE_ETH)
+        goto out_close;
+
+    return p;
+
+out_close:
+    fclose(p->fp);
+    errno = EINVAL;
+out_free:
+    free(p);
+    return NULL;
+}
+
+host_pcap_t *host_pcap_open_write(const char *path) {
+    pcap_file_hdr_t hdr = {
+        PCAP_MAGIC, 2, 4, 0, 0, 65535, PCAP_LINKTYPE_ETH
+    };
+    host_pcap_t *p;
+
+    if(!(p = (host_pcap_t *)calloc(1, sizeof(host_pcap_t))))
+        return NULL;
+
+    if(!(p->fp = fopen(path, "wb"))) {
+        free(p);
+        return NULL;
+    }
+
+    if(fwrite(&hdr, sizeof(hdr), 1, p->fp) != 1) {
+        fclose(p->fp);
+        free(p);
+        return NULL;
+    }
+
+    return p;
+}
+
+int host_pcap_read(host_pcap_t *p, void *buf, size_t len, uint64_t *ts) {
+    pcap_rec_hdr_t rec;
+    uint32_t incl;
+
+    if(fread(&rec, sizeof(rec), 1, p->fp) != 1)
+        return 0;
+
+    incl = pcap_swap(p, rec.incl_len);
+
+    /* Skip over anything that won't fit, so the next read still works. */
+    if(incl > len) {
+        if(fseek(p->fp, incl, SEEK_CUR) < 0)
+            return 0;
+
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    if(fread(buf, 1, incl, p->fp) != incl)
+        return 0;
+
+    if(ts)
+        *ts = (uint64_t)pcap_swap(p, rec.ts_sec) * 1000000 +
+            pcap_swap(p, rec.ts_usec);
+
+    return (int)incl;
+}
+
+int host_pcap_write(host_pcap_t *p, const void *data, size_t len,
+                    uint64_t ts) {
+    pcap_rec_hdr_t rec;
+    struct timespec now;
+
+    /* With no timestamp given, use the current time. */
+    if(!ts) {
+        clock_gettime(CLOCK_REALTIME, &now);
+        ts = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    }
+
+    rec.ts_sec = (uint32_t)(ts / 1000000);
+    rec.ts_usec = (uint32_t)(ts % 1000000);
+    rec.incl_len = rec.orig_len = (uint32_t)len;
+
+    if(fwrite(&rec, sizeof(rec), 1, p->fp) != 1 ||
+       fwrite(data, 1, len, p->fp) != len)
+        return -1;
+
+    fflush(p->fp);
+    return 0;
+}
+
+void host_pcap_close(host_pcap_t *p) {
+    fclose(p->fp);
+    free(p);
+}
@@ -0,0 +1,88 @@
+/* KallistiOS ##version##
+
+   utils/nethost/host_os.h
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* Interface between the parts of the harness built against the KOS headers
+   and the parts built against the host's headers. Since the two sets of
+   headers don't mix (they both have their own idea of what <pthread.h> and
+   <sys/socket.h> are), nothing in here uses any types that aren't the same on
+   both sides. */
+
+#ifndef __NETHOST_HOST_OS_H
+#define __NETHOST_HOST_OS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The "big kernel lock". KOS runs on one CPU, and the network stack is written
+   with that in mind, so only one thread is ever allowed to be running KOS code
+   at a time. Threads take turns in the order they asked. */
+void host_gil_init(void);
+void host_gil_lock(void);
+void host_gil_unlock(void);
+
+/* Ask whoever holds the lock to give it up at the next chance they get. */
+void host_gil_request(void);
+int host_gil_requested(void);
+
+/* Something for one thread to sleep on. The sleeping thread gives up the big
+   lock while it sleeps, and has it again when this returns. Returns 0 if woken
+   up, -1 if the deadline (in microseconds, 0 for none) passed first. Waking
+   must be done with the big lock held. */
+typedef struct host_waiter host_waiter_t;
+
+host_waiter_t *host_waiter_create(void);
+void host_waiter_destroy(host_waiter_t *w);
+int host_waiter_sleep(host_waiter_t *w, uint64_t deadline);
+void host_waiter_wake(host_waiter_t *w);
+
+/* Threads. These don't touch the big lock at all. */
+int host_thread_create(void *(*fn)(void *), void *arg);
+
+/* Time, in microseconds since the harness started. */
+uint64_t host_time_us(void);
+
+/* Wall clock time the harness started at, in seconds since the epoch. */
+int64_t host_start_time(void);
+void host_sleep_us(uint64_t us);
+
+/* Plain file descriptor I/O, which the harness has to get at without going
+   through the KOS versions of these functions. */
+int host_open_write(const char *path);
+int host_open_read(const char *path);
+int host_unlink(const char *path);
+int host_close(int fd);
+long host_read(int fd, void *buf, size_t len);
+long host_write(int fd, const void *buf, size_t len);
+long host_seek(int fd, long offset, int whence);
+long host_size(int fd);
+int host_fcntl(int fd, int cmd, long arg);
+
+/* Wait up to timeout milliseconds for fd to be readable. Returns > 0 if it
+   is, 0 on timeout. */
+int host_wait_readable(int fd, int timeout);
+
+/* Open a TAP device. The name is filled in with the name of the interface (it
+   may be empty going in to let the kernel pick one). */
+int host_tap_open(char *name, size_t len);
+
+/* Open a pair of connected descriptors that pass ethernet frames back and
+   forth, for a device with something in the harness on the other end. */
+int host_pipe_open(int fds[2]);
+
+/* Capture files, in the classic pcap format with ethernet framing. Timestamps
+   are in microseconds since the epoch. Writing with a timestamp of 0 uses the
+   current time. */
+typedef struct host_pcap host_pcap_t;
+
+host_pcap_t *host_pcap_open_read(const char *path);
+host_pcap_t *host_pcap_open_write(const char *path);
+int host_pcap_read(host_pcap_t *p, void *buf, size_t len, uint64_t *ts);
+int host_pcap_write(host_pcap_t *p, const void *data, size_t len,
+                    uint64_t ts);
+void host_pcap_close(host_pcap_t *p);
+
+#endif /* __NETHOST_HOST_OS_H */
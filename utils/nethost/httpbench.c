@@ -0,0 +1,738 @@
+/* KallistiOS ##version##
+
+   utils/nethost/httpbench.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* Runs libhttpd on the stack, and talks to it over the loopback device. First
+   it checks that the server gets the protocol right: keep-alive, HEAD, errors,
+   request bodies, chunked responses (and what HTTP/1.0 clients get instead),
+   files with and without ranges, both mapped (like the romdisk) and read a
+   block at a time (like the CD), bad requests, and idle timeouts.
+
+   Then it times small requests three ways: one at a time on a connection that
+   is kept open, pipelined on one connection, and with a new connection for
+   each one, and it times sending a file both ways. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+
+#include <kos/net.h>
+#include <kos/fs.h>
+#include <kos/thread.h>
+#include <kos/dbglog.h>
+#include <arch/timer.h>
+
+#include <httpd/httpd.h>
+
+#include "nethost.h"
+#include "host_os.h"
+
+#define PORT            80
+#define FILE_SIZE       (256 * 1024)
+#define IDLE_TIMEOUT    1000
+#define PIPELINE        16
+
+static const char hello[] = "Hello, world!\n";
+
+/* One client connection. Whatever has come in past the end of the last
+   response stays in the buffer for the next one. */
+typedef struct client {
+    int sock;
+    uint8 buf[16384];
+    size_t len;
+} client_t;
+
+typedef struct resp {
+    int status;
+    int closed;
+    char hdrs[2048];
+    size_t len;
+} resp_t;
+
+static httpd_t *srv;
+static char dir[64], file_path[96], index_path[96];
+static uint8 file_data[FILE_SIZE];
+static uint8 body[FILE_SIZE + 4096];
+static int failures = 0;
+
+static void result(const char *name, int ok) {
+    printf("%-40s %s\n", name, ok ? "ok" : "FAILED");
+
+    if(!ok)
+        ++failures;
+}
+
+/* Server side. */
+static int hello_handler(httpd_req_t *req, void *data) {
+    (void)data;
+    return httpd_respond(req, 200, "text/plain", hello, sizeof(hello) - 1);
+}
+
+static int echo_handler(httpd_req_t *req, void *data) {
+    (void)data;
+    return httpd_respond(req, 200, "application/octet-stream", req->body,
+                         req->body_len);
+}
+
+static int count_handler(httpd_req_t *req, void *data) {
+    int i;
+
+    (void)data;
+
+    if(httpd_respond_chunked(req, 200, "text/plain") < 0)
+        return -1;
+
+    for(i = 0; i < 100; ++i)
+        httpd_chunk_printf(req, "line %d\n", i);
+
+    return 0;
+}
+
+static int fail_handler(httpd_req_t *req, void *data) {
+    (void)req;
+    (void)data;
+    return -1;
+}
+
+/* Client side. */
+static int client_open(client_t *cl) {
+    struct sockaddr_in addr;
+    int one = 1;
+
+    if((cl->sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if(connect(cl->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(cl->sock);
+        return -1;
+    }
+
+    setsockopt(cl->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    cl->len = 0;
+
+    return 0;
+}
+
+static void client_close(client_t *cl) {
+    close(cl->sock);
+    cl->sock = -1;
+}
+
+static int client_send(client_t *cl, const char *data) {
+    size_t len = strlen(data);
+    ssize_t r;
+
+    while(len) {
+        if((r = send(cl->sock, data, len, 0)) <= 0)
+            return -1;
+
+        data += r;
+        len -= r;
+    }
+
+    return 0;
+}
+
+/* Make sure at least n bytes are in the buffer. */
+static int need(client_t *cl, size_t n) {
+    ssize_t r;
+
+    while(cl->len < n) {
+        if((r = recv(cl->sock, cl->buf + cl->len, sizeof(cl->buf) - cl->len,
+                     0)) <= 0)
+            return -1;
+
+        cl->len += r;
+    }
+
+    return 0;
+}
+
+static void consume(client_t *cl, size_t n) {
+    cl->len -= n;
+    memmove(cl->buf, cl->buf + n, cl->len);
+}
+
+/* Read some of the body into the response, straight out of the buffer. */
+static int take(client_t *cl, resp_t *rs, size_t n) {
+    size_t cnt;
+
+    while(n) {
+        if(!cl->len && need(cl, 1) < 0)
+            return -1;
+
+        cnt = cl->len < n ? cl->len : n;
+
+        if(rs->len + cnt > sizeof(body))
+            return -1;
+
+        memcpy(body + rs->len, cl->buf, cnt);
+        rs->len += cnt;
+        consume(cl, cnt);
+        n -= cnt;
+    }
+
+    return 0;
+}
+
+static size_t find(client_t *cl, const char *str) {
+    size_t i, len = strlen(str);
+
+    for(i = 0; i + len <= cl->len; ++i) {
+        if(!memcmp(cl->buf + i, str, len))
+            return i;
+    }
+
+    return (size_t)-1;
+}
+
+static int read_line(client_t *cl, char *out, size_t max) {
+    size_t pos;
+
+    while((pos = find(cl, "\r\n")) == (size_t)-1) {
+        if(need(cl, cl->len + 1) < 0)
+            return -1;
+    }
+
+    if(pos >= max)
+        return -1;
+
+    memcpy(out, cl->buf, pos);
+    out[pos] = 0;
+    consume(cl, pos + 2);
+
+    return 0;
+}
+
+static const char *header(resp_t *rs, const char *name) {
+    size_t len = strlen(name);
+    const char *p = rs->hdrs;
+
+    while(p && *p) {
+        if(!strncasecmp(p, name, len) && p[len] == ':') {
+            p += len + 1;
+
+            while(*p == ' ')
+                ++p;
+
+            return p;
+        }
+
+        if((p = strstr(p, "\r\n")))
+            p += 2;
+    }
+
+    return NULL;
+}
+
+static int header_is(resp_t *rs, const char *name, const char *val) {
+    const char *p = header(rs, name);
+
+    return p && !strncasecmp(p, val, strlen(val)) &&
+           (p[strlen(val)] == '\r' || !p[strlen(val)]);
+}
+
+static int get_response(client_t *cl, resp_t *rs, int head) {
+    char line[32];
+    const char *p;
+    size_t pos;
+    unsigned long n;
+
+    rs->len = 0;
+    rs->closed = 0;
+
+    while((pos = find(cl, "\r\n\r\n")) == (size_t)-1) {
+        if(need(cl, cl->len + 1) < 0)
+            return -1;
+    }
+
+    if(pos + 3 > sizeof(rs->hdrs) ||
+       sscanf((char *)cl->buf, "HTTP/1.%*d %d", &rs->status) != 1)
+        return -1;
+
+    memcpy(rs->hdrs, cl->buf, pos + 2);
+    rs->hdrs[pos + 2] = 0;
+    consume(cl, pos + 4);
+
+    if(head || rs->status < 200 || rs->status == 204 || rs->status == 304)
+        return 0;
+
+    if((p = header(rs, "Content-Length")))
+        return take(cl, rs, strtoul(p, NULL, 10));
+
+    if(header_is(rs, "Transfer-Encoding", "chunked")) {
+        for(;;) {
+            if(read_line(cl, line, sizeof(line)) < 0)
+                return -1;
+
+            if(!(n = strtoul(line, NULL, 16)))
+                break;
+
+            if(take(cl, rs, n) < 0 || read_line(cl, line, sizeof(line)) < 0 ||
+               line[0])
+                return -1;
+        }
+
+        /* No trailers, just the empty line. */
+        return read_line(cl, line, sizeof(line)) < 0 || line[0] ? -1 : 0;
+    }
+
+    /* Neither, so the body goes until the connection closes. */
+    for(;;) {
+        if(need(cl, 1) < 0)
+            break;
+
+        if(take(cl, rs, cl->len) < 0)
+            return -1;
+    }
+
+    rs->closed = 1;
+    return 0;
+}
+
+/* Send a request, and get the response to it. */
+static int request(client_t *cl, resp_t *rs, const char *req) {
+    if(client_send(cl, req) < 0)
+        return -1;
+
+    return get_response(cl, rs, !strncmp(req, "HEAD ", 5));
+}
+
+static int is_closed(client_t *cl) {
+    return need(cl, cl->len + 1) < 0;
+}
+
+/* One request on a connection of its own. */
+static int request_once(resp_t *rs, const char *req) {
+    client_t cl;
+    int rv;
+
+    if(client_open(&cl) < 0)
+        return -1;
+
+    rv = request(&cl, rs, req);
+    client_close(&cl);
+
+    return rv;
+}
+
+static void test_basics(void) {
+    client_t cl;
+    resp_t rs;
+    int ok;
+
+    ok = !client_open(&cl) &&
+         !request(&cl, &rs, "GET /hello HTTP/1.1\r\nHost: kos\r\n\r\n") &&
+         rs.status == 200 && rs.len == sizeof(hello) - 1 &&
+         !memcmp(body, hello, rs.len) &&
+         header_is(&rs, "Content-Type", "text/plain") &&
+         !header(&rs, "Connection");
+    result("GET", ok);
+
+    ok = !request(&cl, &rs, "HEAD /hello HTTP/1.1\r\n\r\n") &&
+         rs.status == 200 && !rs.len && header_is(&rs, "Content-Length", "14");
+    result("HEAD on the same connection", ok);
+
+    ok = !request(&cl, &rs, "GET /nothing HTTP/1.1\r\n\r\n") &&
+         rs.status == 404 &&
+         !request(&cl, &rs, "DELETE /hello HTTP/1.1\r\n\r\n") &&
+         rs.status == 405 &&
+         !request(&cl, &rs, "GET /fail HTTP/1.1\r\n\r\n") &&
+         rs.status == 500;
+    result("404, 405 and 500", ok);
+
+    ok = !request(&cl, &rs, "POST /echo HTTP/1.1\r\nContent-Length: 11\r\n"
+                  "\r\nhello there") &&
+         rs.status == 200 && rs.len == 11 && !memcmp(body, "hello there", 11);
+    result("POST with a body", ok);
+
+    ok = !client_send(&cl, "POST /echo HTTP/1.1\r\nContent-Length: 5\r\n"
+                      "Expect: 100-continue\r\n\r\n") &&
+         !get_response(&cl, &rs, 0) && rs.status == 100 &&
+         !client_send(&cl, "abcde") &&
+         !get_response(&cl, &rs, 0) && rs.status == 200 && rs.len == 5;
+    result("Expect: 100-continue", ok);
+
+    ok = !request(&cl, &rs, "GET /count HTTP/1.1\r\n\r\n") &&
+         rs.status == 200 && header_is(&rs, "Transfer-Encoding", "chunked") &&
+         rs.len > 10 && !memcmp(body, "line 0\nline 1\n", 14) &&
+         !memcmp(body + rs.len - 8, "line 99\n", 8);
+    result("Chunked response", ok);
+
+    ok = !request(&cl, &rs, "GET /hello HTTP/1.1\r\nConnection: close\r\n\r\n") &&
+         rs.status == 200 && header_is(&rs, "Connection", "close") &&
+         is_closed(&cl);
+    result("Connection: close", ok);
+    client_close(&cl);
+
+    ok = !client_open(&cl) &&
+         !request(&cl, &rs, "GET /count HTTP/1.0\r\nConnection: keep-alive"
+                  "\r\n\r\n") &&
+         rs.status == 200 && rs.closed && !header(&rs, "Transfer-Encoding") &&
+         !memcmp(body + rs.len - 8, "line 99\n", 8);
+    result("HTTP/1.0 streamed response", ok);
+    client_close(&cl);
+
+    ok = !client_open(&cl) &&
+         !request(&cl, &rs, "GET /hello HTTP/1.0\r\nConnection: keep-alive"
+                  "\r\n\r\n") &&
+         rs.status == 200 && header_is(&rs, "Connection", "keep-alive") &&
+         !request(&cl, &rs, "GET /hello HTTP/1.0\r\n\r\n") &&
+         rs.status == 200 && is_closed(&cl);
+    result("HTTP/1.0 keep-alive", ok);
+    client_close(&cl);
+
+    /* Three at once, with the last one split up. */
+    ok = !client_open(&cl) &&
+         !client_send(&cl, "GET /hello HTTP/1.1\r\n\r\nPOST /echo HTTP/1.1\r\n"
+                      "Content-Length: 3\r\n\r\nxyzGET /hel") &&
+         !client_send(&cl, "lo HTTP/1.1\r\n\r\n") &&
+         !get_response(&cl, &rs, 0) && rs.status == 200 &&
+         rs.len == sizeof(hello) - 1 &&
+         !get_response(&cl, &rs, 0) && rs.len == 3 && !memcmp(body, "xyz", 3) &&
+         !get_response(&cl, &rs, 0) && rs.status == 200;
+    result("Pipelining", ok);
+    client_close(&cl);
+}
+
+static void test_bad(void) {
+    static char big[8192 + 64];
+    client_t cl;
+    resp_t rs;
+    uint64 start;
+    int ok;
+
+    ok = !request_once(&rs, "GARBAGE\r\n\r\n") && rs.status == 400;
+    result("Bad request line", ok);
+
+    ok = !request_once(&rs, "GET /hello HTTP/2.0\r\n\r\n") && rs.status == 505;
+    result("Bad version", ok);
+
+    ok = !request_once(&rs, "POST /echo HTTP/1.1\r\nContent-Length: 100000"
+                       "\r\n\r\n") && rs.status == 413;
+    result("Body too large", ok);
+
+    memset(big, 'a', sizeof(big));
+    memcpy(big, "GET /hello HTTP/1.1\r\nX-Big: ", 28);
+    big[sizeof(big) - 1] = 0;
+    ok = !request_once(&rs, big) && rs.status == 431;
+    result("Headers too large", ok);
+
+    /* The connection should be closed for being idle, not before. */
+    start = timer_ms_gettime64();
+    ok = !client_open(&cl) && is_closed(&cl) &&
+         timer_ms_gettime64() - start >= IDLE_TIMEOUT - 10 &&
+         httpd_get_stats(srv).conns_timed_out == 1;
+    result("Idle timeout", ok);
+    client_close(&cl);
+}
+
+static void test_files(int mapped) {
+    client_t cl;
+    resp_t rs;
+    httpd_stats_t before, after;
+    char name[64];
+    int ok;
+
+    nethost_mmap_files = mapped;
+    before = httpd_get_stats(srv);
+
+    snprintf(name, sizeof(name), "Whole file (%s)", mapped ? "mapped" : "read");
+    ok = !client_open(&cl) &&
+         !request(&cl, &rs, "GET /files/data.bin HTTP/1.1\r\n\r\n") &&
+         rs.status == 200 && rs.len == FILE_SIZE &&
+         !memcmp(body, file_data, FILE_SIZE) &&
+         header_is(&rs, "Content-Type", "application/octet-stream");
+    result(name, ok);
+
+    snprintf(name, sizeof(name), "Ranges (%s)", mapped ? "mapped" : "read");
+    ok = !request(&cl, &rs, "GET /files/data.bin HTTP/1.1\r\n"
+                  "Range: bytes=1000-1999\r\n\r\n") &&
+         rs.status == 206 && rs.len == 1000 &&
+         !memcmp(body, file_data + 1000, 1000) &&
+         header_is(&rs, "Content-Range", "bytes 1000-1999/262144") &&
+         !request(&cl, &rs, "GET /files/data.bin HTTP/1.1\r\n"
+                  "Range: bytes=-500\r\n\r\n") &&
+         rs.status == 206 && rs.len == 500 &&
+         !memcmp(body, file_data + FILE_SIZE - 500, 500) &&
+         !request(&cl, &rs, "GET /files/data.bin HTTP/1.1\r\n"
+                  "Range: bytes=200000-\r\n\r\n") &&
+         rs.status == 206 && rs.len == FILE_SIZE - 200000 &&
+         !memcmp(body, file_data + 200000, rs.len) &&
+         !request(&cl, &rs, "GET /files/data.bin HTTP/1.1\r\n"
+                  "Range: bytes=300000-\r\n\r\n") &&
+         rs.status == 416 && header_is(&rs, "Content-Range", "bytes */262144") &&
+         !request(&cl, &rs, "HEAD /files/data.bin HTTP/1.1\r\n\r\n") &&
+         rs.status == 200 && header_is(&rs, "Content-Length", "262144");
+    result(name, ok);
+    client_close(&cl);
+
+    after = httpd_get_stats(srv);
+
+    if(mapped)
+        ok = after.file_bytes_mapped > before.file_bytes_mapped &&
+             after.file_bytes_read == before.file_bytes_read;
+    else
+        ok = after.file_bytes_read > before.file_bytes_read &&
+             after.file_bytes_mapped == before.file_bytes_mapped;
+
+    snprintf(name, sizeof(name), "Went out %s", mapped ? "mapped" : "read");
+    result(name, ok);
+
+    if(mapped)
+        return;
+
+    ok = !request_once(&rs, "GET /files/ HTTP/1.1\r\n\r\n") &&
+         rs.status == 200 && rs.len == 7 && !memcmp(body, "<html/>", 7) &&
+         header_is(&rs, "Content-Type", "text/html") &&
+         !request_once(&rs, "GET /files/none.txt HTTP/1.1\r\n\r\n") &&
+         rs.status == 404 &&
+         !request_once(&rs, "GET /files/%2e%2e/etc/passwd HTTP/1.1\r\n\r\n") &&
+         rs.status == 403;
+    result("Index, missing file, and ..", ok);
+}
+
+static void report(const char *name, int count, uint64 us) {
+    printf("%-28s %7d requests, %6.1f us each, %8.0f requests/s\n", name,
+           count, (double)us / count, count * 1000000.0 / us);
+}
+
+/* Open a new connection if the server is closing this one. */
+static int reopen(client_t *cl, resp_t *rs) {
+    if(!header_is(rs, "Connection", "close"))
+        return 0;
+
+    client_close(cl);
+    client_open(cl);
+
+    return 1;
+}
+
+static void bench(int count) {
+    static const char req[] = "GET /hello HTTP/1.1\r\nHost: kos\r\n\r\n";
+    static char batch[sizeof(req) * PIPELINE];
+    size_t len = sizeof(req) - 1;
+    client_t cl;
+    resp_t rs;
+    uint64 start, us;
+    int i, j, n, good;
+
+    /* Keep-alive, one at a time. The server closes the connection after so
+       many requests, at which point a client would open another. */
+    good = 0;
+    client_open(&cl);
+    start = timer_us_gettime64();
+
+    for(i = 0; i < count; ++i) {
+        if(request(&cl, &rs, req) || rs.status != 200)
+            break;
+
+        ++good;
+        reopen(&cl, &rs);
+    }
+
+    us = timer_us_gettime64() - start;
+    client_close(&cl);
+    report("Keep-alive", count, us);
+    result("Keep-alive responses", good == count);
+
+    /* Pipelined, in batches. Anything sent after the server said it was
+       closing the connection gets sent again on the next one. */
+    for(i = 0; i < PIPELINE; ++i)
+        memcpy(batch + i * len, req, len);
+
+    good = 0;
+    client_open(&cl);
+    start = timer_us_gettime64();
+
+    while(good < count) {
+        n = count - good < PIPELINE ? count - good : PIPELINE;
+        batch[n * len] = 0;
+
+        if(client_send(&cl, batch) < 0)
+            break;
+
+        for(j = 0; j < n; ++j) {
+            if(get_response(&cl, &rs, 0) || rs.status != 200)
+                break;
+
+            ++good;
+
+            if(reopen(&cl, &rs))
+                break;
+        }
+
+        if(j < n && !header_is(&rs, "Connection", "close"))
+            break;
+    }
+
+    us = timer_us_gettime64() - start;
+    client_close(&cl);
+    report("Pipelined", count, us);
+    result("Pipelined responses", good == count);
+
+    /* A connection for each. */
+    good = 0;
+    n = count / 4;
+    start = timer_us_gettime64();
+
+    for(i = 0; i < n; ++i) {
+        if(!request_once(&rs, req) && rs.status == 200)
+            ++good;
+    }
+
+    us = timer_us_gettime64() - start;
+    report("Connection per request", n, us);
+    result("Connection per request responses", good == n);
+
+    /* Files, both ways. */
+    for(j = 1; j >= 0; --j) {
+        nethost_mmap_files = j;
+        n = count / 20 ? count / 20 : 1;
+        good = 0;
+        client_open(&cl);
+        start = timer_us_gettime64();
+
+        for(i = 0; i < n; ++i) {
+            if(!request(&cl, &rs, "GET /files/data.bin HTTP/1.1\r\n\r\n") &&
+               rs.len == FILE_SIZE)
+                ++good;
+        }
+
+        us = timer_us_gettime64() - start;
+        client_close(&cl);
+        printf("%-28s %7d files, %6.1f MB/s\n",
+               j ? "256KB file (mapped)" : "256KB file (read)", n,
+               (double)n * FILE_SIZE / us);
+        result(j ? "Mapped files" : "Read files", good == n);
+    }
+}
+
+static int write_file(const char *path, const void *data, size_t len) {
+    file_t f;
+    int rv;
+
+    if((f = fs_open(path, O_WRONLY)) == FILEHND_INVALID)
+        return -1;
+
+    rv = fs_write(f, data, len) == (ssize_t)len ? 0 : -1;
+    fs_close(f);
+
+    return rv;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options]\n"
+            "  -n count  Requests to time each way (default: 5000)\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    httpd_params_t params;
+    httpd_stats_t st;
+    int opt, count = 5000, i;
+    uint32 seed = 0x48545450;
+
+    while((opt = getopt(argc, argv, "n:h")) != -1) {
+        switch(opt) {
+            case 'n':
+                count = atoi(optarg);
+                break;
+
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if(count < 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    dbglog_set_level(DBG_WARNING);
+
+    /* Something to serve. */
+    strcpy(dir, "/tmp/httpbench.XXXXXX");
+
+    if(!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    for(i = 0; i < FILE_SIZE; ++i) {
+        seed = seed * 1103515245 + 12345;
+        file_data[i] = (uint8)(seed >> 16);
+    }
+
+    snprintf(file_path, sizeof(file_path), "%s/data.bin", dir);
+    snprintf(index_path, sizeof(index_path), "%s/index.html", dir);
+
+    if(nethost_init() < 0) {
+        perror("nethost");
+        return EXIT_FAILURE;
+    }
+
+    if(write_file(file_path, file_data, FILE_SIZE) < 0 ||
+       write_file(index_path, "<html/>", 7) < 0) {
+        perror(dir);
+        return EXIT_FAILURE;
+    }
+
+    net_init(0);
+
+    memset(&params, 0, sizeof(params));
+    params.port = PORT;
+    params.idle_timeout = IDLE_TIMEOUT;
+
+    if(!(srv = httpd_create(&params))) {
+        perror("httpd_create");
+        return EXIT_FAILURE;
+    }
+
+    httpd_route(srv, "GET", "/hello", hello_handler, NULL);
+    httpd_route(srv, "POST", "/echo", echo_handler, NULL);
+    httpd_route(srv, "GET", "/count", count_handler, NULL);
+    httpd_route(srv, NULL, "/fail", fail_handler, NULL);
+    httpd_serve_files(srv, "/files/", dir);
+
+    if(httpd_start(srv) < 0) {
+        perror("httpd_start");
+        return EXIT_FAILURE;
+    }
+
+    test_basics();
+    test_bad();
+    test_files(1);
+    test_files(0);
+    bench(count);
+
+    st = httpd_get_stats(srv);
+    printf("%u connections, %u requests (%u bad), %llu bytes sent\n",
+           (unsigned)st.conns_accepted, (unsigned)st.requests,
+           (unsigned)st.requests_bad, (unsigned long long)st.bytes_sent);
+
+    httpd_destroy(srv);
+    net_shutdown();
+    nethost_shutdown();
+
+    host_unlink(file_path);
+    host_unlink(index_path);
+    rmdir(dir);
+
+    return failures ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,934 @@
+/* KallistiOS ##version##
+
+   utils/nethost/kos_shim.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* This file stands in for the parts of the kernel that the network stack
+   needs, but which don't make sense outside of a Dreamcast: threads, wait
+   queues, interrupts, timers, and the file descriptor table.
+
+   The model here is a uniprocessor KOS on top of pthreads. Every thread that
+   is running KOS code holds the big lock (see host_os.c), so as far as the
+   network stack can tell there is only ever one thread running at a time, just
+   like on the real thing. A thread only gives up the lock when it blocks (in
+   genwait_wait(), which everything else that blocks is built on), when it
+   calls thd_pass(), or when it re-enables "interrupts" and the timer tick
+   wants to run. That last one is the equivalent of being preempted.
+
+   "Interrupts" are a flag that the lock holder owns. Disabling them keeps the
+   timer tick from getting in, so anything that the stack protects by
+   disabling interrupts is just as safe here as it is on the hardware. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+
+#include <kos/thread.h>
+#include <kos/genwait.h>
+#include <kos/ktimer.h>
+#include <kos/fs.h>
+#include <kos/nmmgr.h>
+#include <kos/dbglog.h>
+#include <arch/arch.h>
+#include <arch/irq.h>
+#include <arch/timer.h>
+#include <arch/rtc.h>
+
+#include "host_os.h"
+#include "nethost.h"
+
+/* How often the timer tick runs, in microseconds. */
+#define TICK_US     1000
+
+typedef struct nh_thread {
+    /* This has to be first, since the rest of KOS only knows about this
+       part of the structure. */
+    kthread_t thd;
+
+    host_waiter_t *waiter;
+
+    /* Wait queue stuff. */
+    struct nh_thread *wait_next;
+    int wait_err;
+
+    void *(*routine)(void *);
+    void *param;
+} nh_thread_t;
+
+kthread_t *thd_current = NULL;
+
+static __thread nh_thread_t *nh_self;
+
+static nh_thread_t *wait_list;
+static int irq_off, in_int;
+static tid_t next_tid = 1;
+
+static nh_thread_t nh_tick_thd;
+static volatile int tick_done;
+
+/* When the primary timer goes off (in milliseconds), or 0 if it isn't
+   programmed, and the scheduler state that decides how it's programmed. */
+static volatile uint64 primary_due;
+static int thd_mode = THD_MODE_PREEMPT;
+static uint64 next_switch;
+
+static int dbg_level = DBG_WARNING;
+
+/* Taking and giving up the big lock, from the point of view of a KOS
+   thread. */
+static void nh_lock(void) {
+    host_gil_lock();
+    thd_current = (kthread_t *)nh_self;
+}
+
+static void nh_unlock(void) {
+    host_gil_unlock();
+}
+
+/* Let the timer tick in, if it's waiting. This is only done where the
+   hardware would take an interrupt, which is whenever they're enabled. */
+static void nh_preempt(void) {
+    if(!irq_off && !in_int && host_gil_requested()) {
+        nh_unlock();
+        nh_lock();
+    }
+}
+
+static nh_thread_t *nh_thread_alloc(void) {
+    nh_thread_t *t;
+
+    if(!(t = (nh_thread_t *)calloc(1, sizeof(nh_thread_t))))
+        return NULL;
+
+    if(!(t->waiter = host_waiter_create())) {
+        free(t);
+        return NULL;
+    }
+
+    t->thd.tid = next_tid++;
+    t->thd.prio = PRIO_DEFAULT;
+    t->thd.state = STATE_READY;
+
+    return t;
+}
+
+static void nh_thread_free(nh_thread_t *t) {
+    host_waiter_destroy(t->waiter);
+    free(t);
+}
+
+/* Interrupts. */
+int irq_disable(void) {
+    int old = irq_off;
+
+    irq_off = 1;
+    return old;
+}
+
+void irq_restore(int v) {
+    irq_off = v;
+    nh_preempt();
+}
+
+void irq_enable(void) {
+    irq_restore(0);
+}
+
+int irq_inside_int(void) {
+    return in_int;
+}
+
+/* Timers. The timer tick is a host thread that looks in once a millisecond
+   to see if the primary timer has gone off. If it has, it takes the big lock,
+   marks itself as being inside an interrupt, and does what the scheduler's
+   timer interrupt does with the kernel timers. Like the hardware timer, the
+   primary timer is one-shot, and only goes off if somebody programmed it. */
+uint64 timer_us_gettime64(void) {
+    nh_preempt();
+    return host_time_us();
+}
+
+uint64 timer_ms_gettime64(void) {
+    return timer_us_gettime64() / 1000;
+}
+
+void timer_primary_wakeup(uint32 millis) {
+    primary_due = host_time_us() / 1000 + millis;
+}
+
+/* The threading mode only changes how the primary timer is programmed here.
+   The big lock still lets threads run in whatever order the host likes. */
+int thd_set_mode(int mode) {
+    int old = thd_mode;
+    uint64 now;
+
+    if(thd_mode == mode)
+        return thd_mode;
+
+    if(thd_mode == THD_MODE_COOP) {
+        now = host_time_us() / 1000;
+        next_switch = now + 1000 / HZ;
+        timer_primary_wakeup(ktimer_next_wakeup(now, 1000 / HZ));
+    }
+
+    thd_mode = mode;
+
+    return old;
+}
+
+int thd_get_mode(void) {
+    return thd_mode;
+}
+
+/* This is thd_timer_hnd(), without the context switching. */
+static void nh_timer_hnd(uint64 now) {
+    uint32 next;
+
+    ktimer_check(host_time_us());
+
+    if(thd_mode != THD_MODE_PREEMPT) {
+        if((next = ktimer_next_wakeup(now, 0)))
+            timer_primary_wakeup(next);
+
+        return;
+    }
+
+    if(now >= next_switch)
+        next_switch = now + 1000 / HZ;
+
+    timer_primary_wakeup(ktimer_next_wakeup(now, (uint32)(next_switch - now)));
+}
+
+/* The real time clock. As far as the stack knows, it booted when the harness
+   started. */
+time_t rtc_boot_time(void) {
+    return (time_t)host_start_time();
+}
+
+static void *nh_tick(void *data) {
+    uint64 now;
+
+    (void)data;
+
+    nh_self = &nh_tick_thd;
+
+    while(!tick_done) {
+        host_sleep_us(TICK_US);
+
+        /* This is only ever written with the big lock held, so at worst we
+           see it go off a tick late. */
+        now = host_time_us() / 1000;
+
+        if(!primary_due || now < primary_due)
+            continue;
+
+        host_gil_request();
+        nh_lock();
+        irq_off = 1;
+        in_int = 1;
+
+        /* Check again, it might have been moved while we were waiting. */
+        if(primary_due && now >= primary_due) {
+            primary_due = 0;
+            nh_timer_hnd(now);
+        }
+
+        in_int = 0;
+        irq_off = 0;
+        nh_unlock();
+    }
+
+    return NULL;
+}
+
+/* Wait queues. */
+static void wait_unlink(nh_thread_t *t) {
+    nh_thread_t **p;
+
+    for(p = &wait_list; *p; p = &(*p)->wait_next) {
+        if(*p == t) {
+            *p = t->wait_next;
+            break;
+        }
+    }
+
+    t->wait_next = NULL;
+    t->thd.wait_obj = NULL;
+    t->thd.wait_msg = NULL;
+    t->thd.wait_callback = NULL;
+    t->thd.wait_timeout = 0;
+    t->thd.state = STATE_READY;
+}
+
+int genwait_wait(void *obj, const char *mesg, int timeout,
+                 void (*callback)(void *)) {
+    nh_thread_t *me = nh_self, **p;
+    uint64 deadline = 0;
+    int old;
+
+    if(in_int) {
+        dbglog(DBG_WARNING, "genwait_wait: called inside interrupt\n");
+        return -1;
+    }
+
+    me->thd.state = STATE_WAIT;
+    me->thd.wait_obj = obj;
+    me->thd.wait_msg = mesg;
+    me->thd.wait_callback = callback;
+    me->wait_err = 0;
+
+    if(timeout > 0) {
+        deadline = host_time_us() + (uint64)timeout * 1000;
+        me->thd.wait_timeout = deadline / 1000;
+    }
+
+    /* Waiters are woken in the order they went to sleep. */
+    for(p = &wait_list; *p; p = &(*p)->wait_next)
+        ;
+
+    *p = me;
+    me->wait_next = NULL;
+
+    old = irq_off;
+    irq_off = 0;
+
+    while(me->thd.wait_obj == obj) {
+        if(host_waiter_sleep(me->waiter, deadline) < 0 &&
+           me->thd.wait_obj == obj) {
+            thd_current = (kthread_t *)me;
+            wait_unlink(me);
+
+            if(callback)
+                callback(obj);
+
+            irq_off = old;
+            errno = EAGAIN;
+            return -1;
+        }
+
+        thd_current = (kthread_t *)me;
+    }
+
+    irq_off = old;
+
+    if(me->wait_err) {
+        errno = me->wait_err;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void wait_wake(nh_thread_t *t, int err) {
+    wait_unlink(t);
+    t->wait_err = err;
+    host_waiter_wake(t->waiter);
+}
+
+int genwait_wake_cnt(void *obj, int cntmax, int err) {
+    nh_thread_t *t, *n;
+    int cnt = 0;
+
+    for(t = wait_list; t; t = n) {
+        n = t->wait_next;
+
+        if(t->thd.wait_obj == obj) {
+            wait_wake(t, err);
+
+            if(cntmax > 0 && ++cnt >= cntmax)
+                break;
+        }
+    }
+
+    return cnt;
+}
+
+void genwait_wake_all(void *obj) {
+    genwait_wake_cnt(obj, -1, 0);
+}
+
+void genwait_wake_one(void *obj) {
+    genwait_wake_cnt(obj, 1, 0);
+}
+
+void genwait_wake_all_err(void *obj, int err) {
+    genwait_wake_cnt(obj, -1, err);
+}
+
+void genwait_wake_one_err(void *obj, int err) {
+    genwait_wake_cnt(obj, 1, err);
+}
+
+int genwait_wake_thd(void *obj, kthread_t *thd, int err) {
+    nh_thread_t *t;
+
+    for(t = wait_list; t; t = t->wait_next) {
+        if(t == (nh_thread_t *)thd && t->thd.wait_obj == obj) {
+            wait_wake(t, err);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Threads. */
+static void *nh_thread_start(void *data) {
+    nh_thread_t *t = (nh_thread_t *)data;
+    void *rv;
+
+    nh_self = t;
+    nh_lock();
+    t->thd.state = STATE_RUNNING;
+
+    rv = t->routine(t->param);
+
+    t->thd.rv = rv;
+    t->thd.state = STATE_FINISHED;
+
+    if(t->thd.flags & THD_DETACHED) {
+        nh_unlock();
+        nh_thread_free(t);
+    }
+    else {
+        genwait_wake_all(t);
+        nh_unlock();
+    }
+
+    return NULL;
+}
+
+kthread_t *thd_create(int detach, void *(*routine)(void *param),
+                      void *param) {
+    nh_thread_t *t;
+
+    if(!(t = nh_thread_alloc()))
+        return NULL;
+
+    t->routine = routine;
+    t->param = param;
+    sprintf(t->thd.label, "[un-named kernel thread %d]", (int)t->thd.tid);
+
+    if(detach)
+        t->thd.flags |= THD_DETACHED;
+
+    if(host_thread_create(nh_thread_start, t) < 0) {
+        nh_thread_free(t);
+        return NULL;
+    }
+
+    return (kthread_t *)t;
+}
+
+int thd_join(kthread_t *thd, void **value_ptr) {
+    if(!thd || (thd->flags & THD_DETACHED) || thd == thd_current) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    while(thd->state != STATE_FINISHED)
+        genwait_wait(thd, "thd_join", 0, NULL);
+
+    if(value_ptr)
+        *value_ptr = thd->rv;
+
+    nh_thread_free((nh_thread_t *)thd);
+    return 0;
+}
+
+void thd_pass(void) {
+    int old = irq_off;
+
+    irq_off = 0;
+    nh_unlock();
+    nh_lock();
+    irq_off = old;
+}
+
+void thd_sleep(int ms) {
+    /* Nobody ever wakes this up, so it'll always time out. */
+    if(ms > 0)
+        genwait_wait((void *)0xffffffff, "thd_sleep", ms, NULL);
+    else
+        thd_pass();
+}
+
+void thd_set_label(kthread_t *thd, const char *label) {
+    strncpy(thd->label, label, sizeof(thd->label) - 1);
+    thd->label[sizeof(thd->label) - 1] = 0;
+}
+
+int thd_set_prio(kthread_t *thd, prio_t prio) {
+    /* There's no scheduler to speak of here, so this is just for show. */
+    thd->prio = prio;
+    return 0;
+}
+
+kthread_t *thd_get_current(void) {
+    return thd_current;
+}
+
+/* File descriptors. This is a tiny version of the table that lives in
+   kernel/fs/fs.c. The descriptors start well above where the host's own are
+   likely to be, so that close() can tell the two apart. */
+typedef struct nh_fd {
+    vfs_handler_t *vfs;
+    void *hnd;
+} nh_fd_t;
+
+static nh_fd_t nh_fds[NETHOST_FD_COUNT];
+
+extern void __poll_fd_closed(int fd, void *hnd);
+
+static nh_fd_t *fd_get(file_t fd) {
+    if(fd < NETHOST_FD_BASE || fd >= NETHOST_FD_BASE + NETHOST_FD_COUNT ||
+       !nh_fds[fd - NETHOST_FD_BASE].vfs) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    return &nh_fds[fd - NETHOST_FD_BASE];
+}
+
+file_t fs_open_handle(vfs_handler_t *vfs, void *hnd) {
+    int i;
+
+    for(i = 0; i < NETHOST_FD_COUNT; ++i) {
+        if(!nh_fds[i].vfs) {
+            nh_fds[i].vfs = vfs;
+            nh_fds[i].hnd = hnd;
+            return NETHOST_FD_BASE + i;
+        }
+    }
+
+    errno = EMFILE;
+    return -1;
+}
+
+vfs_handler_t *fs_get_handler(file_t fd) {
+    nh_fd_t *f = fd_get(fd);
+
+    return f ? f->vfs : NULL;
+}
+
+void *fs_get_handle(file_t fd) {
+    nh_fd_t *f = fd_get(fd);
+
+    return f ? f->hnd : NULL;
+}
+
+int fs_close(file_t fd) {
+    nh_fd_t *f = fd_get(fd);
+    vfs_handler_t *vfs;
+    void *hnd;
+
+    if(!f)
+        return -1;
+
+    /* Same order as the real one: out of the table, tell poll()/epoll, then
+       close the file. */
+    vfs = f->vfs;
+    hnd = f->hnd;
+    f->vfs = NULL;
+    f->hnd = NULL;
+    __poll_fd_closed(fd, hnd);
+
+    return vfs->close ? vfs->close(hnd) : 0;
+}
+
+ssize_t fs_read(file_t fd, void *buf, size_t cnt) {
+    nh_fd_t *f = fd_get(fd);
+
+    if(!f)
+        return -1;
+
+    if(!f->vfs->read) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return f->vfs->read(f->hnd, buf, cnt);
+}
+
+ssize_t fs_write(file_t fd, const void *buf, size_t cnt) {
+    nh_fd_t *f = fd_get(fd);
+
+    if(!f)
+        return -1;
+
+    if(!f->vfs->write) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return f->vfs->write(f->hnd, buf, cnt);
+}
+
+int fs_fcntl(file_t fd, int cmd, ...) {
+    nh_fd_t *f = fd_get(fd);
+    va_list ap;
+    int rv;
+
+    if(!f)
+        return -1;
+
+    if(!f->vfs->fcntl) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    va_start(ap, cmd);
+    rv = f->vfs->fcntl(f->hnd, cmd, ap);
+    va_end(ap);
+
+    return rv;
+}
+
+off_t fs_seek(file_t fd, off_t offset, int whence) {
+    nh_fd_t *f = fd_get(fd);
+
+    if(!f)
+        return -1;
+
+    if(!f->vfs->seek) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return f->vfs->seek(f->hnd, offset, whence);
+}
+
+size_t fs_total(file_t fd) {
+    nh_fd_t *f = fd_get(fd);
+
+    if(!f)
+        return (size_t)-1;
+
+    if(!f->vfs->total) {
+        errno = EINVAL;
+        return (size_t)-1;
+    }
+
+    return f->vfs->total(f->hnd);
+}
+
+off_t fs_tell(file_t fd) {
+    nh_fd_t *f = fd_get(fd);
+
+    if(!f)
+        return -1;
+
+    if(!f->vfs->tell) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return f->vfs->tell(f->hnd);
+}
+
+dirent_t *fs_readdir(file_t fd) {
+    nh_fd_t *f = fd_get(fd);
+
+    if(!f)
+        return NULL;
+
+    if(!f->vfs->readdir) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return f->vfs->readdir(f->hnd);
+}
+
+int fs_fstat(file_t fd, struct stat *st) {
+    nh_fd_t *f = fd_get(fd);
+
+    if(!f)
+        return -1;
+
+    if(!f->vfs->fstat) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return f->vfs->fstat(f->hnd, st);
+}
+
+void *fs_mmap(file_t fd) {
+    nh_fd_t *f = fd_get(fd);
+
+    if(!f)
+        return NULL;
+
+    if(!f->vfs->mmap) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return f->vfs->mmap(f->hnd);
+}
+
+/* Files opened by name. The things in the stack that do that are the packet
+   capture and the DHCP lease file, and libhttpd serves files with them, so
+   this has to read and write files on the host and seek around in them.
+
+   Mapping a file works like it does on the romdisk when nethost_mmap_files is
+   set: the whole file is read into memory, which stays put until the file is
+   closed. Otherwise it fails like it does on the CD. */
+int nethost_mmap_files;
+
+typedef struct host_file {
+    int fd;
+    void *map;
+} host_file_t;
+
+static ssize_t host_file_read(void *hnd, void *buf, size_t cnt) {
+    return host_read(((host_file_t *)hnd)->fd, buf, cnt);
+}
+
+static ssize_t host_file_write(void *hnd, const void *buf, size_t cnt) {
+    return host_write(((host_file_t *)hnd)->fd, buf, cnt);
+}
+
+static off_t host_file_seek(void *hnd, off_t offset, int whence) {
+    return (off_t)host_seek(((host_file_t *)hnd)->fd, (long)offset, whence);
+}
+
+static size_t host_file_total(void *hnd) {
+    return (size_t)host_size(((host_file_t *)hnd)->fd);
+}
+
+static void *host_file_mmap(void *hnd) {
+    host_file_t *hf = (host_file_t *)hnd;
+    long size, pos, len = 0, r;
+
+    if(!nethost_mmap_files) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if(hf->map)
+        return hf->map;
+
+    if((size = host_size(hf->fd)) < 0 ||
+       (pos = host_seek(hf->fd, 0, SEEK_CUR)) < 0 ||
+       !(hf->map = malloc(size ? size : 1)))
+        return NULL;
+
+    host_seek(hf->fd, 0, SEEK_SET);
+
+    while(len < size && (r = host_read(hf->fd, (char *)hf->map + len,
+                                       size - len)) > 0)
+        len += r;
+
+    host_seek(hf->fd, pos, SEEK_SET);
+
+    if(len < size) {
+        free(hf->map);
+        hf->map = NULL;
+        errno = EIO;
+    }
+
+    return hf->map;
+}
+
+static int host_file_close(void *hnd) {
+    host_file_t *hf = (host_file_t *)hnd;
+    int rv = host_close(hf->fd);
+
+    free(hf->map);
+    free(hf);
+
+    return rv;
+}
+
+static vfs_handler_t host_file_vfs = {
+    .close = host_file_close,
+    .read = host_file_read,
+    .write = host_file_write,
+    .seek = host_file_seek,
+    .total = host_file_total,
+    .mmap = host_file_mmap
+};
+
+/* Filesystems that the stack registers with the name manager (like /net).
+   Anything opened under one of these goes to it instead of the host. */
+#define NETHOST_VFS_COUNT   8
+
+static vfs_handler_t *nh_vfs[NETHOST_VFS_COUNT];
+
+file_t fs_open(const char *fn, int mode) {
+    host_file_t *hf;
+    vfs_handler_t *vfs;
+    void *hnd;
+    file_t rv;
+    size_t len;
+    int fd, i;
+
+    for(i = 0; i < NETHOST_VFS_COUNT; ++i) {
+        if(!(vfs = nh_vfs[i]))
+            continue;
+
+        len = strlen(vfs->nmmgr.pathname);
+
+        if(strncmp(fn, vfs->nmmgr.pathname, len) ||
+           (fn[len] && fn[len] != '/'))
+            continue;
+
+        if(!vfs->open || !(hnd = vfs->open(vfs, fn + len, mode)))
+            return FILEHND_INVALID;
+
+        if((rv = fs_open_handle(vfs, hnd)) < 0 && vfs->close)
+            vfs->close(hnd);
+
+        return rv;
+    }
+
+    if((mode & O_MODE_MASK) == O_RDONLY)
+        fd = host_open_read(fn);
+    else
+        fd = host_open_write(fn);
+
+    if(fd < 0)
+        return FILEHND_INVALID;
+
+    if(!(hf = (host_file_t *)calloc(1, sizeof(host_file_t)))) {
+        host_close(fd);
+        errno = ENOMEM;
+        return FILEHND_INVALID;
+    }
+
+    hf->fd = fd;
+
+    if((rv = fs_open_handle(&host_file_vfs, hf)) < 0) {
+        host_close(fd);
+        free(hf);
+    }
+
+    return rv;
+}
+
+int fs_unlink(const char *fn) {
+    return host_unlink(fn);
+}
+
+/* The network stack closes its own sockets with close(), so that has to know
+   about both kinds of descriptors. */
+int close(int fd) {
+    if(fd >= NETHOST_FD_BASE && fd < NETHOST_FD_BASE + NETHOST_FD_COUNT)
+        return fs_close(fd);
+
+    return host_close(fd);
+}
+
+/* Same goes for fcntl(), which programs use to make sockets non-blocking. */
+int fcntl(int fd, int cmd, ...) {
+    va_list ap;
+    long arg;
+
+    va_start(ap, cmd);
+    arg = va_arg(ap, long);
+    va_end(ap);
+
+    if(fd >= NETHOST_FD_BASE && fd < NETHOST_FD_BASE + NETHOST_FD_COUNT)
+        return fs_fcntl(fd, cmd, arg);
+
+    return host_fcntl(fd, cmd, arg);
+}
+
+/* Name manager. Filesystems get remembered for fs_open(), and anything else
+   (the socket layer) is just accepted. */
+int nmmgr_handler_add(nmmgr_handler_t *hnd) {
+    int i;
+
+    if(hnd->type != NMMGR_TYPE_VFS)
+        return 0;
+
+    for(i = 0; i < NETHOST_VFS_COUNT; ++i) {
+        if(!nh_vfs[i]) {
+            nh_vfs[i] = (vfs_handler_t *)hnd;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+int nmmgr_handler_remove(nmmgr_handler_t *hnd) {
+    int i;
+
+    for(i = 0; i < NETHOST_VFS_COUNT; ++i) {
+        if(nh_vfs[i] == (vfs_handler_t *)hnd)
+            nh_vfs[i] = NULL;
+    }
+
+    return 0;
+}
+
+/* Debug output. */
+void dbglog_set_level(int level) {
+    dbg_level = level;
+}
+
+void dbglog(int level, const char *fmt, ...) {
+    va_list ap;
+
+    if(level > dbg_level)
+        return;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+/* Harness control. */
+int nethost_init(void) {
+    host_gil_init();
+
+    if(!(nh_self = nh_thread_alloc()))
+        return -1;
+
+    strcpy(nh_self->thd.label, "[kernel]");
+    nh_self->thd.state = STATE_RUNNING;
+    nh_lock();
+
+    strcpy(nh_tick_thd.thd.label, "[timer tick]");
+    tick_done = 0;
+
+    if(host_thread_create(nh_tick, NULL) < 0) {
+        nh_unlock();
+        return -1;
+    }
+
+    if(ktimer_init() < 0)
+        return -1;
+
+    /* Schedule the first pre-emption, just like thd_init(). */
+    if(thd_mode == THD_MODE_PREEMPT) {
+        next_switch = host_time_us() / 1000 + 1000 / HZ;
+        timer_primary_wakeup(1000 / HZ);
+    }
+
+    return 0;
+}
+
+void nethost_shutdown(void) {
+    ktimer_shutdown();
+    tick_done = 1;
+}
+
+void nethost_leave(void) {
+    irq_off = 0;
+    nh_unlock();
+}
+
+void nethost_enter(void) {
+    if(!nh_self && !(nh_self = nh_thread_alloc()))
+        abort();
+
+    nh_lock();
+}
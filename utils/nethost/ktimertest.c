@@ -0,0 +1,169 @@
+/* KallistiOS ##version##
+
+   utils/nethost/ktimertest.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* Tests the kernel timers, first in pre-emptive mode and then in cooperative
+   mode. In cooperative mode nothing but the kernel timers programs the
+   primary timer, so every timer here has to get it going by itself. Each
+   pass checks one-shot timers run from the interrupt and from the timer
+   thread, a periodic timer, one more than a trip around the wheel out, a
+   timer restarted from its own callback, and cancelling. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <kos/thread.h>
+#include <kos/ktimer.h>
+#include <arch/timer.h>
+
+#include "nethost.h"
+
+/* How late a timer can be and still count as on time. The host doesn't
+   schedule us anywhere near as precisely as the hardware would. */
+#define SLACK_US        20000
+
+typedef struct {
+    ktimer_t timer;
+    uint64 start, when;
+    volatile int fired;
+    int in_thread;
+    int restarts;
+} ttimer_t;
+
+static int failures = 0;
+
+static void check(int ok, const char *what) {
+    printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+
+    if(!ok)
+        ++failures;
+}
+
+static void tt_cb(ktimer_t *t, void *data) {
+    ttimer_t *tt = (ttimer_t *)data;
+
+    (void)t;
+
+    tt->when = timer_us_gettime64();
+    tt->in_thread = ktimer_thread_current();
+    ++tt->fired;
+}
+
+static void tt_restart_cb(ktimer_t *t, void *data) {
+    ttimer_t *tt = (ttimer_t *)data;
+
+    tt_cb(t, data);
+
+    if(tt->restarts--)
+        ktimer_start(t, 10000, 0);
+}
+
+static void tt_start(ttimer_t *tt, ktimer_cb_t cb, int flags, uint64 delay,
+                     uint64 period) {
+    memset(tt, 0, sizeof(ttimer_t));
+    ktimer_setup(&tt->timer, cb, tt, flags);
+    tt->start = timer_us_gettime64();
+    ktimer_start(&tt->timer, delay, period);
+}
+
+/* Wait for a timer to have fired at least cnt times, or until it's clearly
+   not going to. */
+static void tt_wait(ttimer_t *tt, int cnt, uint64 timeout) {
+    uint64 end = timer_us_gettime64() + timeout;
+
+    while(tt->fired < cnt && timer_us_gettime64() < end)
+        thd_sleep(1);
+}
+
+static int tt_on_time(ttimer_t *tt, uint64 delay) {
+    return tt->when >= tt->start + delay &&
+           tt->when < tt->start + delay + SLACK_US;
+}
+
+static void test_mode(const char *mode) {
+    ttimer_t a, b, c, d, e;
+    char what[64];
+    uint64 start;
+    int ok;
+
+    /* One-shot, from the interrupt. */
+    tt_start(&a, tt_cb, 0, 30000, 0);
+    tt_wait(&a, 1, 1000000);
+
+    snprintf(what, sizeof(what), "%s: one-shot timer fires on time", mode);
+    check(a.fired == 1 && !a.in_thread && tt_on_time(&a, 30000), what);
+
+    /* One-shot, from the timer thread. */
+    tt_start(&b, tt_cb, KTIMER_THREAD, 30000, 0);
+    tt_wait(&b, 1, 1000000);
+
+    snprintf(what, sizeof(what), "%s: threaded timer fires on time", mode);
+    check(b.fired == 1 && b.in_thread && tt_on_time(&b, 30000), what);
+
+    /* Periodic, like the net_thd callbacks. */
+    tt_start(&c, tt_cb, KTIMER_THREAD, 10000, 10000);
+    start = timer_us_gettime64();
+    thd_sleep(205);
+    ktimer_cancel(&c.timer);
+
+    snprintf(what, sizeof(what), "%s: periodic timer fires every period",
+             mode);
+    check(c.fired >= 15 && c.fired <= 21 &&
+          (int)((timer_us_gettime64() - start) / 10000) >= c.fired, what);
+
+    /* More than one trip around the wheel. */
+    tt_start(&d, tt_cb, 0, 400000, 0);
+    tt_wait(&d, 1, 1000000);
+
+    snprintf(what, sizeof(what), "%s: timer a wheel revolution out waits",
+             mode);
+    check(d.fired == 1 && tt_on_time(&d, 400000), what);
+
+    /* Restarted from its own callback. */
+    tt_start(&e, tt_restart_cb, 0, 10000, 0);
+    e.restarts = 4;
+    tt_wait(&e, 5, 1000000);
+
+    snprintf(what, sizeof(what), "%s: timer restarted from its callback",
+             mode);
+    check(e.fired == 5 && !ktimer_pending(&e.timer), what);
+
+    /* Cancelled before it's due. */
+    tt_start(&a, tt_cb, 0, 20000, 0);
+    tt_start(&b, tt_cb, KTIMER_THREAD, 20000, 0);
+    ok = ktimer_cancel(&a.timer) == 1 && ktimer_cancel(&b.timer) == 1 &&
+         !ktimer_pending(&a.timer) && !ktimer_pending(&b.timer);
+    thd_sleep(50);
+
+    snprintf(what, sizeof(what), "%s: cancelled timers don't fire", mode);
+    check(ok && !a.fired && !b.fired, what);
+}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    if(nethost_init() < 0) {
+        fprintf(stderr, "Can't set up the harness\n");
+        return EXIT_FAILURE;
+    }
+
+    test_mode("pre-emptive");
+
+    /* Let the pre-emption wakeup that's already programmed go off, so that
+       the timer is stopped when the cooperative tests start. */
+    thd_set_mode(THD_MODE_COOP);
+    thd_sleep(50);
+
+    test_mode("cooperative");
+
+    nethost_shutdown();
+
+    printf("%d check%s FAILED\n", failures, failures == 1 ? "" : "s");
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
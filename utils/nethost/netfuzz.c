@@ -0,0 +1,104 @@
+/* KallistiOS ##version##
+
+   utils/nethost/netfuzz.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* A fuzzing target for net_input(). Each input is taken as one ethernet frame
+   arriving on the stack's device. A UDP and a TCP socket are left listening,
+   so that the fuzzer can get all the way up into those too.
+
+   Built with clang and -fsanitize=fuzzer (see "make fuzz"), this is a
+   libFuzzer target. Otherwise, it's a plain program that runs each file given
+   on the command line through the stack once, which is handy for reproducing
+   crashes under a debugger. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <kos/net.h>
+#include <kos/dbglog.h>
+
+#include "nethost.h"
+
+/* 10.0.2.2 */
+#define FUZZ_IP     0x0A000202
+
+static netif_t *fuzz_if;
+
+static int fuzz_listen(int type, int proto) {
+    struct sockaddr_in addr;
+    int sock;
+
+    if((sock = socket(AF_INET, type, proto)) < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(7);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+       (type == SOCK_STREAM && listen(sock, 5) < 0)) {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+static int fuzz_init(void) {
+    dbglog_set_level(DBG_DEAD);
+
+    if(nethost_init() < 0 || !(fuzz_if = nethost_if_pcap()))
+        return -1;
+
+    net_init(FUZZ_IP);
+
+    fuzz_listen(SOCK_DGRAM, IPPROTO_UDP);
+    fuzz_listen(SOCK_STREAM, IPPROTO_TCP);
+
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if(!fuzz_if && fuzz_init() < 0)
+        abort();
+
+    /* Nothing bigger than a frame would ever come in off of a device. */
+    if(size > 1536)
+        return 0;
+
+    nethost_if_input(fuzz_if, data, (int)size);
+
+    return 0;
+}
+
+#ifndef NETFUZZ_LIBFUZZER
+int main(int argc, char *argv[]) {
+    static uint8 buf[2048];
+    FILE *fp;
+    size_t len;
+    int i;
+
+    for(i = 1; i < argc; ++i) {
+        if(!(fp = fopen(argv[i], "rb"))) {
+            perror(argv[i]);
+            continue;
+        }
+
+        len = fread(buf, 1, sizeof(buf), fp);
+        fclose(fp);
+
+        printf("%s: %u bytes\n", argv[i], (unsigned)len);
+        LLVMFuzzerTestOneInput(buf, len);
+    }
+
+    return 0;
+}
+#endif
@@ -0,0 +1,467 @@
+/* KallistiOS ##version##
+
+   utils/nethost/nethost.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* Runs the KOS network stack as a Linux process, attached to a TAP interface,
+   with a few of the classic test services running on top of it:
+
+       - echo (TCP and UDP port 7)
+       - discard (TCP and UDP port 9)
+       - chargen (TCP port 19)
+
+   That's enough to poke at the stack with ping, nc, and friends from the host,
+   and to measure TCP throughput with something like
+       dd if=/dev/zero bs=64k count=1000 | nc -N 10.0.2.2 9
+   while running perf against this process.
+
+   With -s, no TAP interface is used, and a quick self-test of TCP and UDP is
+   run over the loopback device instead. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <kos/net.h>
+#include <kos/thread.h>
+#include <kos/dbglog.h>
+#include <arch/timer.h>
+
+#include "nethost.h"
+
+#define PORT_ECHO       7
+#define PORT_DISCARD    9
+#define PORT_CHARGEN    19
+
+#define SELFTEST_LEN    (256 * 1024)
+
+static volatile sig_atomic_t done;
+
+static void on_signal(int sig) {
+    (void)sig;
+    done = 1;
+}
+
+static int tcp_server(int port) {
+    struct sockaddr_in addr;
+    int sock;
+
+    if((sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+       listen(sock, 5) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+static int udp_server(int port) {
+    struct sockaddr_in addr;
+    int sock;
+
+    if((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+/* TCP services. Each connection gets its own thread. */
+static int send_all(int sock, const void *buf, size_t len) {
+    const uint8 *ptr = (const uint8 *)buf;
+    ssize_t sz;
+
+    /* The stack will happily take only part of what we give it, if the send
+       buffer is nearly full. */
+    while(len) {
+        if((sz = send(sock, ptr, len, 0)) <= 0)
+            return -1;
+
+        ptr += sz;
+        len -= sz;
+    }
+
+    return 0;
+}
+
+static void *tcp_echo(void *data) {
+    int sock = (int)(intptr_t)data;
+    uint8 buf[1460];
+    ssize_t len;
+
+    while((len = recv(sock, buf, sizeof(buf), 0)) > 0) {
+        if(send_all(sock, buf, len) < 0)
+            break;
+    }
+
+    close(sock);
+    return NULL;
+}
+
+static void *tcp_discard(void *data) {
+    int sock = (int)(intptr_t)data;
+    uint8 buf[1460];
+
+    while(recv(sock, buf, sizeof(buf), 0) > 0)
+        ;
+
+    close(sock);
+    return NULL;
+}
+
+static void *tcp_chargen(void *data) {
+    int sock = (int)(intptr_t)data;
+    char line[74];
+    int i, start = 0;
+
+    line[72] = '\r';
+    line[73] = '\n';
+
+    for(;;) {
+        for(i = 0; i < 72; ++i)
+            line[i] = ' ' + 1 + (start + i) % 94;
+
+        if(send_all(sock, line, sizeof(line)) < 0)
+            break;
+
+        start = (start + 1) % 94;
+    }
+
+    close(sock);
+    return NULL;
+}
+
+typedef struct tcp_service {
+    int sock;
+    void *(*handler)(void *);
+} tcp_service_t;
+
+static void *tcp_accept_thd(void *data) {
+    tcp_service_t *svc = (tcp_service_t *)data;
+    int sock;
+
+    while((sock = accept(svc->sock, NULL, NULL)) >= 0) {
+        if(!thd_create(1, svc->handler, (void *)(intptr_t)sock))
+            close(sock);
+    }
+
+    return NULL;
+}
+
+/* UDP echo and discard share a thread, since neither one has much to do. */
+static void *udp_service_thd(void *data) {
+    int sock = (int)(intptr_t)data, echo;
+    struct sockaddr_in from, me;
+    socklen_t flen, mlen = sizeof(me);
+    uint8 buf[1500];
+    ssize_t len;
+
+    getsockname(sock, (struct sockaddr *)&me, &mlen);
+    echo = ntohs(me.sin_port) == PORT_ECHO;
+
+    for(;;) {
+        flen = sizeof(from);
+
+        if((len = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr *)&from,
+                           &flen)) < 0)
+            break;
+
+        if(echo)
+            sendto(sock, buf, len, 0, (struct sockaddr *)&from, flen);
+    }
+
+    return NULL;
+}
+
+static tcp_service_t services[3];
+
+static int start_services(void) {
+    static const int ports[3] = { PORT_ECHO, PORT_DISCARD, PORT_CHARGEN };
+    static void *(*const handlers[3])(void *) = {
+        tcp_echo, tcp_discard, tcp_chargen
+    };
+    int i, sock;
+
+    for(i = 0; i < 3; ++i) {
+        if((services[i].sock = tcp_server(ports[i])) < 0) {
+            perror("tcp_server");
+            return -1;
+        }
+
+        services[i].handler = handlers[i];
+        thd_create(1, tcp_accept_thd, &services[i]);
+    }
+
+    for(i = 0; i < 2; ++i) {
+        if((sock = udp_server(ports[i])) < 0) {
+            perror("udp_server");
+            return -1;
+        }
+
+        thd_create(1, udp_service_thd, (void *)(intptr_t)sock);
+    }
+
+    return 0;
+}
+
+/* Self-test, over the loopback. */
+static void *selftest_sender(void *data) {
+    int sock = (int)(intptr_t)data, i;
+    uint8 buf[1024];
+    ssize_t len = 0;
+
+    /* Each 1KiB block of the stream is filled with its block number, so the
+       other side can tell if anything got mixed up along the way. */
+    for(i = 0; i < SELFTEST_LEN; i += len) {
+        memset(buf, (uint8)(i / sizeof(buf)), sizeof(buf));
+
+        if((len = send(sock, buf, sizeof(buf) - i % sizeof(buf), 0)) <= 0)
+            break;
+    }
+
+    return NULL;
+}
+
+static int selftest_tcp(void) {
+    struct sockaddr_in addr;
+    kthread_t *thd;
+    uint8 buf[1024];
+    uint64 start, end;
+    int sock, total = 0, bad = 0, i;
+    ssize_t len;
+
+    if((sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT_ECHO);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if(connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        close(sock);
+        return -1;
+    }
+
+    start = timer_us_gettime64();
+    thd = thd_create(0, selftest_sender, (void *)(intptr_t)sock);
+
+    while(total < SELFTEST_LEN &&
+          (len = recv(sock, buf, sizeof(buf), 0)) > 0) {
+        for(i = 0; i < len; ++i) {
+            if(buf[i] != (uint8)((total + i) / sizeof(buf)))
+                ++bad;
+        }
+
+        total += len;
+    }
+
+    end = timer_us_gettime64();
+    thd_join(thd, NULL);
+    close(sock);
+
+    printf("TCP echo: %d of %d bytes back, %d bad, %llu ms\n", total,
+           SELFTEST_LEN, bad, (unsigned long long)((end - start) / 1000));
+
+    return (total == SELFTEST_LEN && !bad) ? 0 : -1;
+}
+
+static int selftest_udp(void) {
+    struct sockaddr_in addr;
+    struct pollfd pfd;
+    uint8 buf[512], rbuf[512];
+    int sock, i, good = 0;
+
+    if((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT_ECHO);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    for(i = 0; i < 100; ++i) {
+        memset(buf, i, sizeof(buf));
+
+        if(sendto(sock, buf, sizeof(buf), 0, (struct sockaddr *)&addr,
+                  sizeof(addr)) != sizeof(buf))
+            break;
+
+        pfd.fd = sock;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        if(poll(&pfd, 1, 1000) <= 0)
+            break;
+
+        if(recv(sock, rbuf, sizeof(rbuf), 0) == sizeof(rbuf) &&
+           !memcmp(buf, rbuf, sizeof(buf)))
+            ++good;
+    }
+
+    close(sock);
+
+    printf("UDP echo: %d of 100 datagrams back intact\n", good);
+
+    return good == 100 ? 0 : -1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options]\n"
+            "  -i name   TAP interface to use (default: let the kernel pick)\n"
+            "  -a addr   IPv4 address to use (default: ask DHCP)\n"
+            "  -w file   Capture everything on the interface to a pcap file\n"
+            "  -c file   Capture everything in the stack (loopback too) with\n"
+            "            net_capture_start()\n"
+            "  -t secs   Exit after this long (default: run until ^C)\n"
+            "  -v        More debug output (can be repeated)\n"
+            "  -s        Run the loopback self-test instead\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *ifname = NULL, *capture = NULL, *stack_cap = NULL;
+    struct in_addr ip = { 0 };
+    int opt, secs = 0, selftest = 0, level = DBG_WARNING, rv = 0;
+    uint64 end;
+    netif_t *nif = NULL;
+
+    while((opt = getopt(argc, argv, "i:a:w:c:t:vsh")) != -1) {
+        switch(opt) {
+            case 'i':
+                ifname = optarg;
+                break;
+
+            case 'a':
+                if(!inet_pton(AF_INET, optarg, &ip)) {
+                    fprintf(stderr, "Bad address: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+
+                break;
+
+            case 'w':
+                capture = optarg;
+                break;
+
+            case 'c':
+                stack_cap = optarg;
+                break;
+
+            case 't':
+                secs = atoi(optarg);
+                break;
+
+            case 'v':
+                ++level;
+                break;
+
+            case 's':
+                selftest = 1;
+                break;
+
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    dbglog_set_level(level);
+
+    if(nethost_init() < 0) {
+        perror("nethost_init");
+        return EXIT_FAILURE;
+    }
+
+    if(!selftest) {
+        if(!(nif = nethost_if_tap(ifname))) {
+            perror("Can't open TAP interface");
+            return EXIT_FAILURE;
+        }
+
+        if(capture && nethost_if_capture(nif, capture) < 0) {
+            perror(capture);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if(net_init(ntohl(ip.s_addr)) < 0)
+        fprintf(stderr, "net_init failed, carrying on anyway\n");
+
+    if(stack_cap && net_capture_start(stack_cap, NULL) < 0) {
+        perror(stack_cap);
+        return EXIT_FAILURE;
+    }
+
+    if(start_services() < 0)
+        return EXIT_FAILURE;
+
+    if(selftest) {
+        if(selftest_tcp() < 0 || selftest_udp() < 0)
+            rv = EXIT_FAILURE;
+
+        printf("Self-test %s\n", rv ? "FAILED" : "passed");
+    }
+    else {
+        printf("%s is up at %d.%d.%d.%d, MAC %02x:%02x:%02x:%02x:%02x:%02x\n",
+               nif->name, nif->ip_addr[0], nif->ip_addr[1], nif->ip_addr[2],
+               nif->ip_addr[3], nif->mac_addr[0], nif->mac_addr[1],
+               nif->mac_addr[2], nif->mac_addr[3], nif->mac_addr[4],
+               nif->mac_addr[5]);
+
+        signal(SIGINT, on_signal);
+        signal(SIGTERM, on_signal);
+        end = timer_ms_gettime64() + secs * 1000;
+
+        while(!done && (!secs || timer_ms_gettime64() < end))
+            thd_sleep(100);
+    }
+
+    if(stack_cap) {
+        net_capture_stats_t st;
+
+        net_capture_stop();
+        st = net_capture_get_stats();
+        printf("Captured %lu frames (%lu dropped) to %s\n",
+               (unsigned long)st.pkt_captured, (unsigned long)st.pkt_dropped,
+               stack_cap);
+    }
+
+    /* The service threads are still blocked in their sockets, so don't try
+       to tear the stack down out from under them. */
+    nethost_shutdown();
+    fflush(stdout);
+
+    return rv;
+}
@@ -0,0 +1,55 @@
+/* KallistiOS ##version##
+
+   utils/nethost/nethost.h
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* Interface to the host network harness, for programs that run the KOS
+   network stack as a normal Linux process. See README for how it all fits
+   together. */
+
+#ifndef __NETHOST_H
+#define __NETHOST_H
+
+#include <kos/net.h>
+
+/* Where the harness starts numbering the file descriptors it hands out for
+   sockets, and how many of them there can be. */
+#define NETHOST_FD_BASE     512
+#define NETHOST_FD_COUNT    256
+
+/* Set up the stand-ins for the kernel (threads, timers, and so on). This has
+   to be called before anything else, and it returns with the calling thread
+   running as a KOS thread. */
+int nethost_init(void);
+void nethost_shutdown(void);
+
+/* Step out of KOS for a while (to make a blocking host call, for instance),
+   and come back in. Threads that were not started by thd_create() have to
+   call nethost_enter() before touching anything in KOS. */
+void nethost_leave(void);
+void nethost_enter(void);
+
+/* Network devices. These register an ethernet device with the stack, which
+   has to be done before net_init(). The TAP device talks to the host's network
+   stack through the given interface (which will need to be configured on the
+   host side). The pcap device has no backend of its own, frames are handed to
+   it with nethost_if_input() (usually read from a capture with
+   nethost_if_replay()). The pipe device passes frames to and from a host
+   descriptor (returned in peer), which the program can read and write from a
+   thread of its own with host_read() and host_write(). Any of these can have
+   everything it sends and receives captured with nethost_if_capture(). */
+netif_t *nethost_if_tap(const char *ifname);
+netif_t *nethost_if_pcap(void);
+netif_t *nethost_if_pipe(int *peer);
+int nethost_if_capture(netif_t *nif, const char *path);
+int nethost_if_input(netif_t *nif, const uint8 *data, int len);
+int nethost_if_replay(netif_t *nif, const char *path, int realtime);
+
+/* Files opened with fs_open() are files on the host. If this is set,
+   fs_mmap() works on them like it does on the romdisk, otherwise it fails like
+   it does on the CD. */
+extern int nethost_mmap_files;
+
+#endif /* __NETHOST_H */
@@ -0,0 +1,320 @@
+/* KallistiOS ##version##
+
+   utils/nethost/netif_host.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* Network devices for the host harness. There are two flavors of these, which
+   only differ in where their frames go:
+
+   - TAP devices are hooked up to a Linux TAP interface, so the host's own
+     network stack (and anything running on it) is on the other end of the
+     wire.
+   - pcap devices aren't hooked up to anything. What they send only ends up in
+     the capture file (if there is one), and what they receive is whatever
+     gets handed to nethost_if_input(). These are for replaying captures and
+     for fuzzing, where everything needs to be repeatable.
+   - Pipe devices are connected to a descriptor that the program keeps the
+     other end of, so that something running on the host side of the harness
+     can play the part of the rest of the network.
+
+   Both look like a plain ethernet device to the stack. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <kos/net.h>
+#include <kos/thread.h>
+#include <arch/timer.h>
+
+#include "host_os.h"
+#include "nethost.h"
+
+/* Biggest frame we'll take in. This leaves room for a VLAN tag. */
+#define NH_FRAME_MAX    1536
+
+typedef struct nh_if {
+    /* This has to be first, the stack only knows about this part. */
+    netif_t nif;
+
+    char name[16];
+    char descr[32];
+
+    int fd;
+    host_pcap_t *cap;
+
+    kthread_t *rx_thd;
+    volatile int done;
+} nh_if_t;
+
+static int nh_count;
+
+static void *nh_if_rx_thd(void *data) {
+    nh_if_t *dev = (nh_if_t *)data;
+    uint8 buf[NH_FRAME_MAX];
+    long len;
+
+    while(!dev->done) {
+        /* Let everyone else run while we're waiting on the host. */
+        nethost_leave();
+
+        if(host_wait_readable(dev->fd, 100) > 0)
+            len = host_read(dev->fd, buf, sizeof(buf));
+        else
+            len = 0;
+
+        nethost_enter();
+
+        if(len > 0 && !dev->done)
+            nethost_if_input(&dev->nif, buf, (int)len);
+    }
+
+    return NULL;
+}
+
+static int nh_if_detect(netif_t *self) {
+    self->flags |= NETIF_DETECTED;
+    return 0;
+}
+
+static int nh_if_init(netif_t *self) {
+    self->flags |= NETIF_INITIALIZED;
+    return 0;
+}
+
+static int nh_if_shutdown(netif_t *self) {
+    nh_if_t *dev = (nh_if_t *)self;
+
+    if(dev->cap) {
+        host_pcap_close(dev->cap);
+        dev->cap = NULL;
+    }
+
+    self->flags &= ~(NETIF_DETECTED | NETIF_INITIALIZED);
+    return 0;
+}
+
+static int nh_if_start(netif_t *self) {
+    nh_if_t *dev = (nh_if_t *)self;
+
+    if(self->flags & NETIF_RUNNING)
+        return 0;
+
+    if(dev->fd >= 0) {
+        dev->done = 0;
+
+        if(!(dev->rx_thd = thd_create(0, nh_if_rx_thd, dev)))
+            return -1;
+
+        thd_set_label(dev->rx_thd, "[nethost rx]");
+    }
+
+    self->flags |= NETIF_RUNNING;
+    return 0;
+}
+
+static int nh_if_stop(netif_t *self) {
+    nh_if_t *dev = (nh_if_t *)self;
+
+    if(!(self->flags & NETIF_RUNNING))
+        return 0;
+
+    if(dev->rx_thd) {
+        dev->done = 1;
+        thd_join(dev->rx_thd, NULL);
+        dev->rx_thd = NULL;
+    }
+
+    self->flags &= ~NETIF_RUNNING;
+    return 0;
+}
+
+static int nh_if_tx(netif_t *self, const uint8 *data, int len, int blocking) {
+    nh_if_t *dev = (nh_if_t *)self;
+
+    (void)blocking;
+
+    if(!(self->flags & NETIF_RUNNING))
+        return NETIF_TX_ERROR;
+
+    if(dev->cap)
+        host_pcap_write(dev->cap, data, len, 0);
+
+    if(dev->fd >= 0 && host_write(dev->fd, data, len) != len)
+        return NETIF_TX_ERROR;
+
+    return NETIF_TX_OK;
+}
+
+static int nh_if_dummy(netif_t *self) {
+    (void)self;
+    return 0;
+}
+
+static int nh_if_set_flags(netif_t *self, uint32 flags_and, uint32 flags_or) {
+    self->flags = (self->flags & flags_and) | flags_or;
+    return 0;
+}
+
+static int nh_if_set_mc(netif_t *self, const uint8 *list, int count) {
+    (void)self;
+    (void)list;
+    (void)count;
+
+    /* The host hands us everything anyway, so the stack sorts it out. */
+    return 0;
+}
+
+static netif_t *nh_if_create(int fd, const char *kind) {
+    nh_if_t *dev;
+
+    if(!(dev = (nh_if_t *)calloc(1, sizeof(nh_if_t)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    snprintf(dev->name, sizeof(dev->name), "nh%d", nh_count);
+    snprintf(dev->descr, sizeof(dev->descr), "Host %s device", kind);
+    dev->fd = fd;
+
+    dev->nif.name = dev->name;
+    dev->nif.descr = dev->descr;
+    dev->nif.index = nh_count;
+    dev->nif.flags = NETIF_NO_FLAGS;
+
+    /* A locally administered address, so it won't clash with anything. */
+    dev->nif.mac_addr[0] = 0x02;
+    dev->nif.mac_addr[1] = 'K';
+    dev->nif.mac_addr[2] = 'O';
+    dev->nif.mac_addr[3] = 'S';
+    dev->nif.mac_addr[4] = 0x00;
+    dev->nif.mac_addr[5] = (uint8)(nh_count + 1);
+
+    dev->nif.mtu = 1500;
+    dev->nif.mtu6 = 1500;
+    dev->nif.hop_limit = 255;
+
+    dev->nif.if_detect = nh_if_detect;
+    dev->nif.if_init = nh_if_init;
+    dev->nif.if_shutdown = nh_if_shutdown;
+    dev->nif.if_start = nh_if_start;
+    dev->nif.if_stop = nh_if_stop;
+    dev->nif.if_tx = nh_if_tx;
+    dev->nif.if_tx_commit = nh_if_dummy;
+    dev->nif.if_rx_poll = nh_if_dummy;
+    dev->nif.if_set_flags = nh_if_set_flags;
+    dev->nif.if_set_mc = nh_if_set_mc;
+
+    if(net_reg_device(&dev->nif) < 0) {
+        free(dev);
+        return NULL;
+    }
+
+    ++nh_count;
+    return &dev->nif;
+}
+
+netif_t *nethost_if_tap(const char *ifname) {
+    char name[16];
+    netif_t *rv;
+    int fd;
+
+    strncpy(name, ifname ? ifname : "", sizeof(name) - 1);
+    name[sizeof(name) - 1] = 0;
+
+    if((fd = host_tap_open(name, sizeof(name))) < 0)
+        return NULL;
+
+    if(!(rv = nh_if_create(fd, "TAP")))
+        host_close(fd);
+    else
+        dbglog(DBG_INFO, "nethost: %s attached to TAP interface %s\n",
+               rv->name, name);
+
+    return rv;
+}
+
+netif_t *nethost_if_pcap(void) {
+    return nh_if_create(-1, "pcap");
+}
+
+netif_t *nethost_if_pipe(int *peer) {
+    netif_t *rv;
+    int fds[2];
+
+    if(host_pipe_open(fds) < 0)
+        return NULL;
+
+    if(!(rv = nh_if_create(fds[0], "pipe"))) {
+        host_close(fds[0]);
+        host_close(fds[1]);
+        return NULL;
+    }
+
+    *peer = fds[1];
+    return rv;
+}
+
+int nethost_if_capture(netif_t *nif, const char *path) {
+    nh_if_t *dev = (nh_if_t *)nif;
+
+    if(dev->cap)
+        host_pcap_close(dev->cap);
+
+    if(!(dev->cap = host_pcap_open_write(path)))
+        return -1;
+
+    return 0;
+}
+
+int nethost_if_input(netif_t *nif, const uint8 *data, int len) {
+    nh_if_t *dev = (nh_if_t *)nif;
+
+    if(!(nif->flags & NETIF_RUNNING))
+        return -1;
+
+    if(dev->cap)
+        host_pcap_write(dev->cap, data, len, 0);
+
+    return net_input(nif, data, len);
+}
+
+int nethost_if_replay(netif_t *nif, const char *path, int realtime) {
+    uint8 buf[NH_FRAME_MAX];
+    host_pcap_t *in;
+    uint64 ts, first = 0, start = 0;
+    int len, count = 0;
+
+    if(!(in = host_pcap_open_read(path)))
+        return -1;
+
+    while((len = host_pcap_read(in, buf, sizeof(buf), &ts)) != 0) {
+        /* Skip anything too big to be a frame we'd get, but keep going. */
+        if(len < 0)
+            continue;
+
+        /* Keep the same spacing between the frames as in the capture, so
+           that the timers in the stack see what they did at the time. */
+        if(realtime) {
+            if(!count) {
+                first = ts;
+                start = timer_us_gettime64();
+            }
+            else if(ts > first &&
+                    ts - first > timer_us_gettime64() - start) {
+                thd_sleep((int)((ts - first - (timer_us_gettime64() - start)) /
+                                1000));
+            }
+        }
+
+        nethost_if_input(nif, buf, len);
+        ++count;
+    }
+
+    host_pcap_close(in);
+
+    return count;
+}
@@ -0,0 +1,116 @@
+/* KallistiOS ##version##
+
+   utils/nethost/netreplay.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* Feeds the frames from a pcap file to the KOS network stack, and captures
+   everything it does in response. This makes for an easy regression test: run
+   the same input through an old and a new version of the stack, and compare
+   what comes out.
+
+   The stack's device has the MAC address 02:4b:4f:53:00:01, so the input
+   should be addressed to that (or be broadcast/multicast). */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+
+#include <kos/net.h>
+#include <kos/thread.h>
+#include <kos/dbglog.h>
+
+#include "nethost.h"
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s -r in.pcap [options]\n"
+            "  -w file   Capture what goes in and out to a pcap file\n"
+            "  -a addr   IPv4 address to use (default: 10.0.2.2)\n"
+            "  -f        Don't keep the timing of the input, go flat out\n"
+            "  -d ms     Let the stack run this long after the input\n"
+            "            (default: 1000)\n"
+            "  -v        More debug output (can be repeated)\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *input = NULL, *capture = NULL;
+    struct in_addr ip;
+    int opt, fast = 0, linger = 1000, level = DBG_WARNING, count;
+    netif_t *nif;
+
+    inet_pton(AF_INET, "10.0.2.2", &ip);
+
+    while((opt = getopt(argc, argv, "r:w:a:fd:vh")) != -1) {
+        switch(opt) {
+            case 'r':
+                input = optarg;
+                break;
+
+            case 'w':
+                capture = optarg;
+                break;
+
+            case 'a':
+                if(!inet_pton(AF_INET, optarg, &ip)) {
+                    fprintf(stderr, "Bad address: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+
+                break;
+
+            case 'f':
+                fast = 1;
+                break;
+
+            case 'd':
+                linger = atoi(optarg);
+                break;
+
+            case 'v':
+                ++level;
+                break;
+
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if(!input) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    dbglog_set_level(level);
+
+    if(nethost_init() < 0 || !(nif = nethost_if_pcap())) {
+        perror("nethost");
+        return EXIT_FAILURE;
+    }
+
+    if(capture && nethost_if_capture(nif, capture) < 0) {
+        perror(capture);
+        return EXIT_FAILURE;
+    }
+
+    net_init(ntohl(ip.s_addr));
+
+    if((count = nethost_if_replay(nif, input, !fast)) < 0) {
+        perror(input);
+        return EXIT_FAILURE;
+    }
+
+    if(linger > 0)
+        thd_sleep(linger);
+
+    printf("Replayed %d frames from %s\n", count, input);
+
+    net_shutdown();
+    nethost_shutdown();
+
+    return 0;
+}
@@ -0,0 +1,259 @@
+/* KallistiOS ##version##
+
+   utils/nethost/pppbench.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* Benchmarks the HDLC framing in libppp. This sets up libppp on a device that
+   just keeps everything in memory (in place of the serial port or modem), and
+   times how long it takes to frame packets on the way out and to unframe them
+   on the way back in. The frames that were sent are fed back in as what was
+   received, so this also checks that what comes out the other end is what
+   went in. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <kos/net.h>
+#include <kos/thread.h>
+#include <kos/dbglog.h>
+
+#include <ppp/ppp.h>
+
+#include "nethost.h"
+#include "host_os.h"
+
+/* Not in any header, since nothing outside of libppp should call them. */
+extern int _ppp_enter_phase(int phase);
+extern void *ppp_main(void *arg);
+
+/* An unassigned protocol number, so that LCP and friends stay out of it. */
+#define BENCH_PROTO     0x0201
+
+/* How much the device hands back to libppp per call to rx(). This is the same
+   as what ppp_scif does. */
+#define RX_CHUNK        1024
+
+static uint8_t *txbuf, *rxbuf;
+static size_t txbuf_size, txbuf_len, rxbuf_len, rxbuf_pos;
+static uint32_t tx_calls, rx_frames, rx_bad;
+static const uint8_t *expect;
+static size_t expect_len;
+
+static int mem_detect_init(ppp_device_t *self) {
+    (void)self;
+
+    return 0;
+}
+
+static int mem_shutdown(ppp_device_t *self) {
+    (void)self;
+
+    return 0;
+}
+
+static int mem_tx(ppp_device_t *self, const uint8_t *data, size_t len,
+                  uint32_t flags) {
+    (void)self;
+    (void)flags;
+
+    ++tx_calls;
+
+    /* Once the buffer fills up, start over. The timed runs only care about
+       what's in there when they're recording the frames to receive later. */
+    if(txbuf_len + len > txbuf_size)
+        txbuf_len = 0;
+
+    memcpy(txbuf + txbuf_len, data, len);
+    txbuf_len += len;
+
+    return 0;
+}
+
+static const uint8_t *mem_rx(ppp_device_t *self, ssize_t *out_len) {
+    const uint8_t *rv = rxbuf + rxbuf_pos;
+    size_t len = rxbuf_len - rxbuf_pos;
+
+    (void)self;
+
+    /* When we've run out of data, drop the link so ppp_main() returns. */
+    if(!len) {
+        _ppp_enter_phase(PPP_PHASE_DEAD);
+        *out_len = 0;
+        return NULL;
+    }
+
+    if(len > RX_CHUNK)
+        len = RX_CHUNK;
+
+    rxbuf_pos += len;
+    *out_len = (ssize_t)len;
+    return rv;
+}
+
+static ppp_device_t mem_dev = {
+    "mem",                              /* name */
+    "PPP over a memory buffer",         /* descr */
+    0,                                  /* index */
+    0,                                  /* flags */
+    NULL,                               /* privdata */
+    &mem_detect_init,                   /* detect */
+    &mem_detect_init,                   /* init */
+    &mem_shutdown,                      /* shutdown */
+    &mem_tx,                            /* tx */
+    &mem_rx                             /* rx */
+};
+
+static int bench_input(ppp_protocol_t *self, const uint8_t *buf, size_t len) {
+    (void)self;
+
+    if(len != expect_len || memcmp(buf, expect, len))
+        ++rx_bad;
+
+    ++rx_frames;
+    return 0;
+}
+
+static ppp_protocol_t bench_proto = {
+    PPP_PROTO_ENTRY_INIT,
+    "bench",                            /* name */
+    BENCH_PROTO,                        /* code */
+    NULL,                               /* privdata */
+    NULL,                               /* init */
+    NULL,                               /* shutdown */
+    &bench_input,                       /* input */
+    NULL,                               /* enter_phase */
+    NULL                                /* check_timeouts */
+};
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options]\n"
+            "  -n count  Number of packets (default: 20000)\n"
+            "  -l len    Length of each packet (default: 1400)\n"
+            "  -t        Fill the packets with text instead of random data\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    int opt, count = 20000, text = 0, i;
+    size_t len = 1400;
+    uint8_t *pkt;
+    uint64_t start, tx_us, rx_us;
+    uint32_t seed = 0x4b4f5321;
+    double mb;
+
+    while((opt = getopt(argc, argv, "n:l:th")) != -1) {
+        switch(opt) {
+            case 'n':
+                count = atoi(optarg);
+                break;
+
+            case 'l':
+                len = (size_t)atoi(optarg);
+                break;
+
+            case 't':
+                text = 1;
+                break;
+
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if(count <= 0 || !len || len > 1500) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* Worst case, everything is escaped. Leave plenty of room for the control
+       protocols to have their say too. */
+    txbuf_size = (size_t)count * (2 * len + 16) + 65536;
+
+    if(!(pkt = malloc(len)) || !(txbuf = malloc(txbuf_size))) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    /* Random data has a control character that needs escaping in about one
+       byte out of eight (with the default ACCM). Text has almost none. */
+    for(i = 0; i < (int)len; ++i) {
+        seed = seed * 1103515245 + 12345;
+
+        if(text)
+            pkt[i] = (uint8_t)(' ' + (seed >> 16) % 95);
+        else
+            pkt[i] = (uint8_t)(seed >> 16);
+    }
+
+    expect = pkt;
+    expect_len = len;
+
+    dbglog_set_level(DBG_WARNING);
+
+    if(nethost_init() < 0) {
+        perror("nethost");
+        return EXIT_FAILURE;
+    }
+
+    net_init(0);
+
+    if(ppp_init() < 0 || ppp_set_device(&mem_dev) < 0 ||
+       ppp_add_protocol(&bench_proto) < 0) {
+        fprintf(stderr, "Couldn't set up libppp\n");
+        return EXIT_FAILURE;
+    }
+
+    /* ppp_send() won't do anything on a dead link, so pretend it's up. */
+    _ppp_enter_phase(PPP_PHASE_NETWORK);
+    txbuf_len = 0;
+    tx_calls = 0;
+
+    start = host_time_us();
+
+    for(i = 0; i < count; ++i) {
+        if(ppp_send(pkt, len, BENCH_PROTO) < 0) {
+            perror("ppp_send");
+            return EXIT_FAILURE;
+        }
+    }
+
+    tx_us = host_time_us() - start;
+
+    /* What we just sent is what we'll receive. */
+    _ppp_enter_phase(PPP_PHASE_DEAD);
+    rxbuf = txbuf;
+    rxbuf_len = txbuf_len;
+    rxbuf_pos = 0;
+
+    if(!(txbuf = malloc(65536))) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    txbuf_size = 65536;
+    txbuf_len = 0;
+
+    start = host_time_us();
+    ppp_main(NULL);
+    rx_us = host_time_us() - start;
+
+    mb = (double)count * len / 1048576.0;
+
+    printf("%d packets of %d bytes (%s), %d bytes framed\n", count, (int)len,
+           text ? "text" : "random", (int)rxbuf_len);
+    printf("send:    %8.1f MB/s, %.2f device writes per packet\n",
+           mb * 1000000.0 / (tx_us ? tx_us : 1), (double)tx_calls / count);
+    printf("receive: %8.1f MB/s, %u packets (%u bad)\n",
+           mb * 1000000.0 / (rx_us ? rx_us : 1), rx_frames, rx_bad);
+
+    ppp_shutdown();
+    net_shutdown();
+    nethost_shutdown();
+
+    return rx_frames == (uint32_t)count && !rx_bad ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,579 @@
+/* KallistiOS ##version##
+
+   utils/nethost/stattest.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* Tests the network statistics. A TCP connection is run over the loopback
+   device, and this checks that what the device, the TCP layer, and TCP_INFO
+   on both ends say about it adds up. A second connection loses some of its
+   packets, to check the retransmission counters. Then it checks the files in
+   /net against the same numbers, and that bad frames and refused connections
+   get counted where they should.
+
+   Last, it times how long it takes to read each of the files in /net with a
+   number of connections open. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <kos/fs.h>
+#include <kos/net.h>
+#include <kos/thread.h>
+#include <kos/dbglog.h>
+#include <arch/timer.h>
+
+#include "nethost.h"
+
+#define PORT            7100
+#define PORT_CLOSED     7101
+#define PORT_LOSSY      7102
+#define PORT_BENCH      7103
+#define XFER_LEN        (256 * 1024)
+#define FILE_MAX        (64 * 1024)
+
+static netif_t *lo;
+static int failures = 0;
+static int verbose = 0;
+static char fbuf[FILE_MAX];
+
+static void check(int ok, const char *what) {
+    printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+
+    if(!ok)
+        ++failures;
+}
+
+static int tcp_sock(void) {
+    return socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+}
+
+static void set_addr(struct sockaddr_in *addr, int port) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+}
+
+static int tcp_listener(int port, int backlog) {
+    struct sockaddr_in addr;
+    int sock;
+
+    if((sock = tcp_sock()) < 0)
+        return -1;
+
+    set_addr(&addr, port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+       listen(sock, backlog) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+static int tcp_connect(int port) {
+    struct sockaddr_in addr;
+    int sock;
+
+    if((sock = tcp_sock()) < 0)
+        return -1;
+
+    set_addr(&addr, port);
+
+    if(connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+static void *accept_thd(void *data) {
+    return (void *)(intptr_t)accept((int)(intptr_t)data, NULL, NULL);
+}
+
+/* Open a connection to a listening socket. The stack doesn't answer the SYN
+   until accept() is called, so that has to happen on another thread. */
+static int tcp_pair(int lsock, int port, int *csock, int *ssock) {
+    kthread_t *thd;
+    void *rv;
+
+    thd = thd_create(0, accept_thd, (void *)(intptr_t)lsock);
+    *csock = tcp_connect(port);
+    thd_join(thd, &rv);
+    *ssock = (int)(intptr_t)rv;
+
+    if(*csock < 0 || *ssock < 0) {
+        if(*csock >= 0)
+            close(*csock);
+
+        if(*ssock >= 0)
+            close(*ssock);
+
+        return -1;
+    }
+
+    return 0;
+}
+
+static int get_info(int sock, struct tcp_info *ti) {
+    socklen_t len = sizeof(*ti);
+
+    memset(ti, 0xff, sizeof(*ti));
+
+    if(getsockopt(sock, IPPROTO_TCP, TCP_INFO, ti, &len) < 0 ||
+       len != sizeof(*ti))
+        return -1;
+
+    return 0;
+}
+
+/* Read a whole file from /net. */
+static ssize_t read_file(const char *fn) {
+    file_t fd;
+    ssize_t len = 0, rv;
+
+    if((fd = fs_open(fn, O_RDONLY)) < 0)
+        return -1;
+
+    while(len < FILE_MAX - 1 &&
+          (rv = fs_read(fd, fbuf + len, FILE_MAX - 1 - len)) > 0)
+        len += rv;
+
+    fs_close(fd);
+    fbuf[len] = 0;
+
+    if(verbose)
+        printf("---- %s ----\n%s", fn, fbuf);
+
+    return len;
+}
+
+/* Find the value of one of the counters in /net/snmp (which has to be in
+   fbuf already). */
+static long snmp_value(const char *proto, const char *name) {
+    char prefix[16], *names, *vals, *n, *v, *ne, *ve;
+    size_t plen;
+
+    plen = snprintf(prefix, sizeof(prefix), "%s:", proto);
+
+    for(names = fbuf; names && strncmp(names, prefix, plen);
+        names = strchr(names, '\n'), names = names ? names + 1 : NULL) {
+    }
+
+    if(!names || !(vals = strchr(names, '\n')) || strncmp(++vals, prefix, plen))
+        return -1;
+
+    n = names + plen;
+    v = vals + plen;
+
+    while(*n == ' ' && *v == ' ') {
+        ++n;
+        ++v;
+        ne = n + strcspn(n, " \n");
+        ve = v + strcspn(v, " \n");
+
+        if((size_t)(ne - n) == strlen(name) && !strncmp(n, name, ne - n))
+            return strtol(v, NULL, 10);
+
+        n = ne;
+        v = ve;
+    }
+
+    return -1;
+}
+
+/* Count the lines in fbuf. */
+static int count_lines(void) {
+    char *p;
+    int cnt = 0;
+
+    for(p = fbuf; (p = strchr(p, '\n')); ++p)
+        ++cnt;
+
+    return cnt;
+}
+
+static int send_all(int sock, const void *buf, size_t len) {
+    const uint8 *p = (const uint8 *)buf;
+    ssize_t rv;
+
+    while(len) {
+        if((rv = send(sock, p, len, 0)) <= 0)
+            return -1;
+
+        p += rv;
+        len -= rv;
+    }
+
+    return 0;
+}
+
+static int sink_sock = -1;
+static volatile uint64 sink_bytes;
+
+static void *sink_thd(void *data) {
+    char buf[4096];
+    ssize_t len;
+
+    (void)data;
+
+    while((len = recv(sink_sock, buf, sizeof(buf), 0)) > 0)
+        sink_bytes += len;
+
+    return NULL;
+}
+
+/* Send XFER_LEN bytes to the sink thread and wait for all of it to be
+   acknowledged, then fill in the sender's TCP_INFO. */
+static int send_wait(int sock, struct tcp_info *ti) {
+    static char buf[8192];
+    uint64 start;
+    int i, ok;
+
+    sink_bytes = 0;
+
+    for(i = 0; i < (int)sizeof(buf); ++i)
+        buf[i] = (char)i;
+
+    for(i = 0, ok = 1; i < XFER_LEN && ok; i += sizeof(buf))
+        ok = send_all(sock, buf, sizeof(buf)) == 0;
+
+    start = timer_ms_gettime64();
+
+    do {
+        thd_sleep(10);
+        get_info(sock, ti);
+    } while((ti->tcpi_unacked || ti->tcpi_notsent_bytes ||
+             sink_bytes < XFER_LEN) && timer_ms_gettime64() - start < 10000);
+
+    return ok && sink_bytes == XFER_LEN ? 0 : -1;
+}
+
+static void test_transfer(void) {
+    net_if_stats_t lo0, lo1;
+    net_tcp_stats_t tcp0, tcp1;
+    struct tcp_info ci, si, li;
+    socklen_t len;
+    kthread_t *thd;
+    int lsock, csock;
+    char line[128];
+
+    lo0 = net_if_get_stats(lo);
+    tcp0 = net_tcp_get_stats();
+
+    if((lsock = tcp_listener(PORT, 4)) < 0 ||
+       tcp_pair(lsock, PORT, &csock, &sink_sock) < 0) {
+        check(0, "Set up a connection over the loopback");
+        return;
+    }
+
+    check(!get_info(lsock, &li) && li.tcpi_state == TCP_LISTEN,
+          "TCP_INFO on a listening socket says TCP_LISTEN");
+
+    thd = thd_create(0, sink_thd, NULL);
+
+    check(!send_wait(csock, &ci), "Send 256KB over the loopback");
+    check(ci.tcpi_state == TCP_ESTABLISHED, "TCP_INFO says TCP_ESTABLISHED");
+    check(ci.tcpi_bytes_acked == XFER_LEN,
+          "Sender's tcpi_bytes_acked is what was sent");
+    check(!get_info(sink_sock, &si) && si.tcpi_bytes_received == XFER_LEN,
+          "Receiver's tcpi_bytes_received is what was sent");
+    check(ci.tcpi_snd_mss > 0 && ci.tcpi_snd_cwnd >= ci.tcpi_snd_mss &&
+          ci.tcpi_rto >= 200000 && ci.tcpi_rtt <= ci.tcpi_rto,
+          "Sender's MSS, cwnd, RTO and RTT make sense");
+    check(ci.tcpi_options == (TCPI_OPT_TIMESTAMPS | TCPI_OPT_SACK |
+                              TCPI_OPT_WSCALE),
+          "Timestamps, SACK and window scaling are in tcpi_options");
+    check(ci.tcpi_segs_out >= XFER_LEN / ci.tcpi_snd_mss &&
+          si.tcpi_segs_in >= XFER_LEN / ci.tcpi_snd_mss &&
+          ci.tcpi_retransmits == 0,
+          "Segment counts add up, with no retransmission pending");
+
+    /* A short buffer only gets the start of the struct. */
+    memset(&li, 0, sizeof(li));
+    len = 4;
+    check(!getsockopt(csock, IPPROTO_TCP, TCP_INFO, &li, &len) && len == 4 &&
+          li.tcpi_state == TCP_ESTABLISHED && !li.tcpi_rto,
+          "TCP_INFO fills in only as much as there's room for");
+
+    lo1 = net_if_get_stats(lo);
+    tcp1 = net_tcp_get_stats();
+
+    check(lo1.tx_packets - lo0.tx_packets == lo1.rx_packets - lo0.rx_packets &&
+          lo1.tx_bytes - lo0.tx_bytes == lo1.rx_bytes - lo0.rx_bytes &&
+          lo1.rx_bytes - lo0.rx_bytes > XFER_LEN,
+          "Loopback sent and received the same packets and bytes");
+    check(tcp1.conn_active - tcp0.conn_active == 1 &&
+          tcp1.conn_passive - tcp0.conn_passive == 1,
+          "One active and one passive open counted");
+    check(tcp1.seg_sent - tcp0.seg_sent == tcp1.seg_recv - tcp0.seg_recv &&
+          tcp1.seg_sent - tcp0.seg_sent ==
+          ci.tcpi_segs_out + si.tcpi_segs_out,
+          "TCP segments sent and received match both sockets' counts");
+
+    /* Now look at the same things through /net. */
+    check(read_file("/net/tcp") > 0 && count_lines() >= 4,
+          "/net/tcp has a header and all three sockets");
+    snprintf(line, sizeof(line), "[::]:%d [::]:0 LISTEN ", PORT);
+    check(strstr(fbuf, line) != NULL, "/net/tcp shows the listening socket");
+    snprintf(line, sizeof(line), " %llu 0\n",
+             (unsigned long long)ci.tcpi_bytes_acked);
+    check(strstr(fbuf, line) != NULL,
+          "/net/tcp shows the sender's bytes_acked");
+
+    check(read_file("/net/snmp") > 0 &&
+          snmp_value("Tcp", "conn_active") == (long)tcp1.conn_active &&
+          snmp_value("Tcp", "conn_passive") == (long)tcp1.conn_passive &&
+          snmp_value("Ip", "pkt_sent") >= 0 &&
+          snmp_value("Udp", "pkt_recv_no_space") >= 0 &&
+          snmp_value("Frag", "mem_peak") >= 0,
+          "/net/snmp has the same TCP counters");
+
+    close(csock);
+    thd_join(thd, NULL);
+    close(sink_sock);
+    close(lsock);
+}
+
+/* Run another transfer with some of the packets thrown away, so that the
+   retransmission counters have something to count. */
+static void test_loss(void) {
+    static const net_loop_params_t lossy = { 0, 20, 0, 0 }, clean = { 0 };
+    net_loop_stats_t ls0, ls1;
+    net_if_stats_t lo0, lo1;
+    net_tcp_stats_t tcp0, tcp1;
+    struct tcp_info ci, si;
+    kthread_t *thd;
+    int lsock, csock, rv;
+
+    if((lsock = tcp_listener(PORT_LOSSY, 4)) < 0 ||
+       tcp_pair(lsock, PORT_LOSSY, &csock, &sink_sock) < 0) {
+        check(0, "Set up a connection over the loopback");
+        return;
+    }
+
+    thd = thd_create(0, sink_thd, NULL);
+
+    lo0 = net_if_get_stats(lo);
+    tcp0 = net_tcp_get_stats();
+    ls0 = net_loop_get_stats();
+    net_loop_set_params(&lossy);
+
+    rv = send_wait(csock, &ci);
+
+    net_loop_set_params(&clean);
+    ls1 = net_loop_get_stats();
+    tcp1 = net_tcp_get_stats();
+    lo1 = net_if_get_stats(lo);
+
+    check(!rv && ci.tcpi_bytes_acked == XFER_LEN &&
+          !get_info(sink_sock, &si) && si.tcpi_bytes_received == XFER_LEN,
+          "Send 256KB over the loopback losing 2% of packets");
+    check(ls1.pkt_lost > ls0.pkt_lost && ci.tcpi_total_retrans > 0,
+          "The sender had to retransmit");
+    check(tcp1.seg_retransmitted - tcp0.seg_retransmitted ==
+          ci.tcpi_total_retrans + si.tcpi_total_retrans,
+          "TCP retransmissions match both sockets' counts");
+    check(tcp1.fast_retransmits - tcp0.fast_retransmits +
+          tcp1.timeouts - tcp0.timeouts > 0 &&
+          tcp1.dup_acks > tcp0.dup_acks,
+          "Fast retransmits, timeouts and duplicate ACKs counted");
+    check(lo1.tx_packets - lo0.tx_packets - (lo1.rx_packets - lo0.rx_packets)
+          == ls1.pkt_lost - ls0.pkt_lost,
+          "Loopback received all it sent but the lost packets");
+
+    close(csock);
+    thd_join(thd, NULL);
+    close(sink_sock);
+    close(lsock);
+}
+
+static void test_errors(void) {
+    net_if_stats_t lo0, lo1;
+    net_tcp_stats_t tcp0, tcp1;
+    static const uint8 bad_ver[20] = { 0x50 };
+    int sock;
+
+    lo0 = net_if_get_stats(lo);
+    net_input(lo, bad_ver, 0);
+    net_input(lo, bad_ver, sizeof(bad_ver));
+    lo1 = net_if_get_stats(lo);
+
+    check(lo1.rx_errors - lo0.rx_errors == 1 &&
+          lo1.rx_dropped - lo0.rx_dropped == 1 &&
+          lo1.rx_packets - lo0.rx_packets == 2,
+          "Empty and unknown frames count as errors and drops");
+
+    tcp0 = net_tcp_get_stats();
+    sock = tcp_connect(PORT_CLOSED);
+    tcp1 = net_tcp_get_stats();
+
+    check(sock < 0 && errno == ECONNREFUSED, "Connect to a closed port fails");
+    check(tcp1.seg_recv_no_sock - tcp0.seg_recv_no_sock == 1 &&
+          tcp1.rst_sent - tcp0.rst_sent == 1 &&
+          tcp1.conn_reset - tcp0.conn_reset == 1,
+          "The SYN, the RST and the refusal are all counted");
+}
+
+static void test_fs(void) {
+    file_t fd;
+    dirent_t *d;
+    struct stat st;
+    char first[64];
+    int cnt = 0;
+    ssize_t len;
+    net_if_stats_t s;
+    unsigned long rx;
+
+    if((fd = fs_open("/net", O_RDONLY | O_DIR)) >= 0) {
+        while((d = fs_readdir(fd)))
+            cnt += !strcmp(d->name, "dev") || !strcmp(d->name, "snmp") ||
+                   !strcmp(d->name, "tcp");
+
+        fs_close(fd);
+    }
+
+    check(cnt == 3, "/net lists dev, snmp and tcp");
+
+    fd = fs_open("/net/dev", O_WRONLY);
+    check(fd < 0 && errno == EROFS, "/net/dev can't be opened for writing");
+    fd = fs_open("/net/nope", O_RDONLY);
+    check(fd < 0 && errno == ENOENT, "/net/nope doesn't exist");
+
+    s = net_if_get_stats(lo);
+    check((len = read_file("/net/dev")) > 0 &&
+          sscanf(strstr(fbuf, "\nlo0 ") ? strstr(fbuf, "\nlo0 ") : "",
+                 "\nlo0 %lu", &rx) == 1 && rx == s.rx_packets,
+          "/net/dev has the loopback's rx_packets");
+
+    if((fd = fs_open("/net/dev", O_RDONLY)) >= 0) {
+        fs_read(fd, first, sizeof(first));
+        fs_fstat(fd, &st);
+        check(fs_seek(fd, 0, SEEK_END) == st.st_size &&
+              fs_total(fd) == (size_t)st.st_size &&
+              fs_seek(fd, 10, SEEK_SET) == 10 &&
+              fs_read(fd, fbuf, 5) == 5 && !memcmp(fbuf, first + 10, 5) &&
+              S_ISREG(st.st_mode),
+              "Seeking around /net/dev works, and fstat has its size");
+        fs_close(fd);
+    }
+    else {
+        check(0, "Seeking around /net/dev works, and fstat has its size");
+    }
+}
+
+/* How long it takes to read each file, with a few connections open. */
+static void bench(int nconns) {
+    static const char *const files[] = { "/net/dev", "/net/snmp", "/net/tcp" };
+    int lsock, *socks, i, j, n = 0;
+    uint64 start, end;
+
+    if(!(socks = calloc(nconns * 2, sizeof(int))) ||
+       (lsock = tcp_listener(PORT_BENCH, nconns)) < 0) {
+        check(0, "Set up connections for the benchmark");
+        free(socks);
+        return;
+    }
+
+    for(i = 0; i < nconns; ++i) {
+        if(tcp_pair(lsock, PORT_BENCH, &socks[n], &socks[n + 1]) < 0)
+            break;
+
+        n += 2;
+    }
+
+    printf("\nReading /net with %d sockets open:\n", n + 1);
+
+    for(j = 0; j < 3; ++j) {
+        ssize_t len = 0;
+
+        start = timer_us_gettime64();
+
+        for(i = 0; i < 100; ++i)
+            len = read_file(files[j]);
+
+        end = timer_us_gettime64();
+        printf("  %-10s %6ld bytes  %8.1f us per read\n", files[j], (long)len,
+               (end - start) / 100.0);
+    }
+
+    for(i = 0; i < n; ++i)
+        close(socks[i]);
+
+    close(lsock);
+    free(socks);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options]\n"
+            "  -c n      Connections to have open for the benchmark "
+            "(default 32)\n"
+            "  -v        Print the files in /net as they're read\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    int opt, nconns = 32;
+
+    while((opt = getopt(argc, argv, "c:vh")) != -1) {
+        switch(opt) {
+            case 'c':
+                nconns = atoi(optarg);
+                break;
+
+            case 'v':
+                verbose = 1;
+                break;
+
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    dbglog_set_level(DBG_WARNING);
+
+    if(nethost_init() < 0) {
+        perror("nethost_init");
+        return EXIT_FAILURE;
+    }
+
+    net_init(0);
+
+    LIST_FOREACH(lo, &net_if_list, if_list) {
+        if(!strcmp(lo->name, "lo"))
+            break;
+    }
+
+    if(!lo) {
+        fprintf(stderr, "No loopback device\n");
+        return EXIT_FAILURE;
+    }
+
+    test_transfer();
+    test_loss();
+    test_errors();
+    test_fs();
+
+    verbose = 0;
+    bench(nconns);
+
+    printf("\n%d check%s FAILED\n", failures, failures == 1 ? "" : "s");
+
+    net_shutdown();
+    nethost_shutdown();
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,1131 @@
+/* KallistiOS ##version##
+
+   utils/nethost/tcptest.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* Tests TCP against a scripted peer. The peer sits on the other end of a pipe
+   device and builds every segment the stack gets by hand, so each test decides
+   exactly what arrives and in what order, and sees every segment the stack
+   sends back. The tests are:
+
+       - close() with data still queued: all of the data arrives before the
+         FIN, and everything sent after the close still carries the
+         timestamps that were negotiated
+       - segments that arrive out of order, twice, or only after a gap: the
+         duplicate ACKs carry the right SACK blocks and echo the right
+         timestamp, and recv() gets the data back in order
+       - a small request and response, answered with two writes: how many
+         segments that takes by default, with TCP_NODELAY and with
+         TCP_CORK, and whether the ACK for the request rides along
+       - two segments lost out of one flight: the fast retransmit, and the
+         retransmissions and congestion window on each partial ACK */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <kos/net.h>
+#include <kos/thread.h>
+#include <kos/dbglog.h>
+#include <arch/timer.h>
+
+#include "nethost.h"
+#include "host_os.h"
+
+#define ETH_LEN         14
+#define IP_LEN          20
+#define TCP_LEN         20
+#define FRAME_MAX       1600
+
+/* TCP flags, as they are in the header. */
+#define SEG_FIN         0x01
+#define SEG_SYN         0x02
+#define SEG_RST         0x04
+#define SEG_PSH         0x08
+#define SEG_ACK         0x10
+
+#define PORT_CLOSE      8000
+#define PORT_OOO        8001
+#define PORT_RR         8002
+#define PORT_LOSS       8005
+
+static const uint8 peer_mac[6] = { 0x02, 'P', 'E', 'E', 'R', 0x01 };
+static const uint8 peer_ip[4] = { 10, 9, 0, 1 };
+static const uint8 kos_ip[4] = { 10, 9, 0, 2 };
+
+static netif_t *nif;
+static int peer = -1;
+static int failures = 0;
+static int verbose = 0;
+
+/* One TCP segment, going either way. */
+typedef struct seg {
+    uint16 sport, dport;
+    uint32 seq, ack;
+    uint8 flags;
+    uint16 wnd;
+
+    /* Options. The ones that only go on a <SYN> are -1 or 0 if absent. */
+    int mss, wscale, sack_ok;
+    int has_ts;
+    uint32 tsval, tsecr;
+    int nsack;
+    uint32 sack[4][2];
+
+    int len;
+    uint8 data[FRAME_MAX];
+} seg_t;
+
+/* The peer's side of a connection. */
+typedef struct conn {
+    uint16 port, kport;             /* The peer's port, and the stack's */
+    uint32 snd_nxt;                 /* Next sequence number the peer sends */
+    uint32 rcv_nxt;                 /* Next one it expects from the stack */
+    int wscale;                     /* Window scale the peer asked for */
+    uint32 ts;                      /* The peer's timestamp clock */
+    uint32 ts_recent;               /* Last timestamp from the stack */
+    int ksock;                      /* The stack's end of the connection */
+} conn_t;
+
+static void check(int ok, const char *what) {
+    printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+
+    if(!ok)
+        ++failures;
+}
+
+static uint32 sum_bytes(uint32 sum, const uint8 *p, int len) {
+    int i;
+
+    for(i = 0; i + 1 < len; i += 2)
+        sum += (p[i] << 8) | p[i + 1];
+
+    if(len & 1)
+        sum += p[len - 1] << 8;
+
+    return sum;
+}
+
+static uint16 sum_fold(uint32 sum) {
+    while(sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return (uint16)~sum;
+}
+
+static void put16(uint8 *p, uint16 v) {
+    p[0] = (uint8)(v >> 8);
+    p[1] = (uint8)v;
+}
+
+static void put32(uint8 *p, uint32 v) {
+    p[0] = (uint8)(v >> 24);
+    p[1] = (uint8)(v >> 16);
+    p[2] = (uint8)(v >> 8);
+    p[3] = (uint8)v;
+}
+
+static uint16 get16(const uint8 *p) {
+    return (uint16)((p[0] << 8) | p[1]);
+}
+
+static uint32 get32(const uint8 *p) {
+    return ((uint32)p[0] << 24) | ((uint32)p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void seg_print(const char *dir, const seg_t *s) {
+    int i;
+
+    if(!verbose)
+        return;
+
+    printf("%s %u > %u [%s%s%s%s%s] seq %u ack %u wnd %u len %d",
+           dir, s->sport, s->dport, s->flags & SEG_SYN ? "S" : "",
+           s->flags & SEG_FIN ? "F" : "", s->flags & SEG_RST ? "R" : "",
+           s->flags & SEG_PSH ? "P" : "", s->flags & SEG_ACK ? "." : "",
+           s->seq, s->ack, s->wnd, s->len);
+
+    if(s->has_ts)
+        printf(" ts %u/%u", s->tsval, s->tsecr);
+
+    for(i = 0; i < s->nsack; ++i)
+        printf(" sack %u-%u", s->sack[i][0], s->sack[i][1]);
+
+    printf("\n");
+}
+
+/* Build a frame from the peer to the stack and send it. */
+static void seg_send(const seg_t *s) {
+    uint8 buf[ETH_LEN + IP_LEN + 60 + FRAME_MAX];
+    uint8 *ip = buf + ETH_LEN, *tcp = ip + IP_LEN, *o = tcp + TCP_LEN;
+    uint32 sum;
+    int olen = 0, tlen, i;
+
+    seg_print(">", s);
+    memset(buf, 0, ETH_LEN + IP_LEN + 60);
+
+    memcpy(buf, nif->mac_addr, 6);
+    memcpy(buf + 6, peer_mac, 6);
+    buf[12] = 0x08;
+
+    if(s->flags & SEG_SYN) {
+        o[olen++] = 2;
+        o[olen++] = 4;
+        put16(o + olen, (uint16)s->mss);
+        olen += 2;
+
+        if(s->wscale >= 0) {
+            o[olen++] = 1;
+            o[olen++] = 3;
+            o[olen++] = 3;
+            o[olen++] = (uint8)s->wscale;
+        }
+
+        if(s->sack_ok) {
+            o[olen++] = 1;
+            o[olen++] = 1;
+            o[olen++] = 4;
+            o[olen++] = 2;
+        }
+    }
+
+    if(s->has_ts) {
+        o[olen++] = 1;
+        o[olen++] = 1;
+        o[olen++] = 8;
+        o[olen++] = 10;
+        put32(o + olen, s->tsval);
+        put32(o + olen + 4, s->tsecr);
+        olen += 8;
+    }
+
+    if(s->nsack) {
+        o[olen++] = 1;
+        o[olen++] = 1;
+        o[olen++] = 5;
+        o[olen++] = (uint8)(2 + 8 * s->nsack);
+
+        for(i = 0; i < s->nsack; ++i) {
+            put32(o + olen, s->sack[i][0]);
+            put32(o + olen + 4, s->sack[i][1]);
+            olen += 8;
+        }
+    }
+
+    tlen = TCP_LEN + olen;
+    memcpy(tcp + tlen, s->data, s->len);
+    tlen += s->len;
+
+    put16(tcp, s->sport);
+    put16(tcp + 2, s->dport);
+    put32(tcp + 4, s->seq);
+    put32(tcp + 8, s->ack);
+    tcp[12] = (uint8)(((TCP_LEN + olen) / 4) << 4);
+    tcp[13] = s->flags;
+    put16(tcp + 14, s->wnd);
+
+    sum = sum_bytes(0, peer_ip, 4);
+    sum = sum_bytes(sum, kos_ip, 4);
+    sum += 6 + tlen;
+    put16(tcp + 16, sum_fold(sum_bytes(sum, tcp, tlen)));
+
+    ip[0] = 0x45;
+    put16(ip + 2, (uint16)(IP_LEN + tlen));
+    ip[8] = 64;
+    ip[9] = 6;
+    memcpy(ip + 12, peer_ip, 4);
+    memcpy(ip + 16, kos_ip, 4);
+    put16(ip + 10, sum_fold(sum_bytes(0, ip, IP_LEN)));
+
+    host_write(peer, buf, ETH_LEN + IP_LEN + tlen);
+}
+
+/* Answer an ARP request for the peer, in case the stack asks. */
+static void arp_reply(const uint8 *req) {
+    uint8 buf[42];
+
+    memcpy(buf, req + 6, 6);
+    memcpy(buf + 6, peer_mac, 6);
+    memcpy(buf + 12, req + 12, 8);
+    buf[21] = 2;
+    memcpy(buf + 22, peer_mac, 6);
+    memcpy(buf + 28, peer_ip, 4);
+    memcpy(buf + 32, req + 22, 10);
+
+    host_write(peer, buf, sizeof(buf));
+}
+
+static int seg_parse(const uint8 *buf, int len, seg_t *s) {
+    const uint8 *ip = buf + ETH_LEN, *tcp, *o;
+    int ihl, off, olen, i;
+
+    if(len < ETH_LEN + IP_LEN + TCP_LEN || buf[12] != 0x08 || buf[13] != 0 ||
+       ip[9] != 6 || memcmp(ip + 16, peer_ip, 4))
+        return -1;
+
+    ihl = (ip[0] & 0x0F) * 4;
+    tcp = ip + ihl;
+    off = (tcp[12] >> 4) * 4;
+    len = get16(ip + 2) - ihl;
+
+    memset(s, 0, sizeof(seg_t));
+    s->sport = get16(tcp);
+    s->dport = get16(tcp + 2);
+    s->seq = get32(tcp + 4);
+    s->ack = get32(tcp + 8);
+    s->flags = tcp[13];
+    s->wnd = get16(tcp + 14);
+    s->mss = s->wscale = -1;
+    s->len = len - off;
+    memcpy(s->data, tcp + off, s->len);
+
+    o = tcp + TCP_LEN;
+    olen = off - TCP_LEN;
+
+    for(i = 0; i < olen;) {
+        if(o[i] == 0)
+            break;
+
+        if(o[i] == 1) {
+            ++i;
+            continue;
+        }
+
+        if(i + 1 >= olen || o[i + 1] < 2 || i + o[i + 1] > olen)
+            break;
+
+        switch(o[i]) {
+            case 2:
+                s->mss = get16(o + i + 2);
+                break;
+
+            case 3:
+                s->wscale = o[i + 2];
+                break;
+
+            case 4:
+                s->sack_ok = 1;
+                break;
+
+            case 5:
+                for(s->nsack = 0; s->nsack < (o[i + 1] - 2) / 8; ++s->nsack) {
+                    s->sack[s->nsack][0] = get32(o + i + 2 + 8 * s->nsack);
+                    s->sack[s->nsack][1] = get32(o + i + 6 + 8 * s->nsack);
+                }
+
+                break;
+
+            case 8:
+                s->has_ts = 1;
+                s->tsval = get32(o + i + 2);
+                s->tsecr = get32(o + i + 6);
+                break;
+        }
+
+        i += o[i + 1];
+    }
+
+    return 0;
+}
+
+/* Wait up to timeout milliseconds for the stack to send a TCP segment. This
+   steps out of KOS while it waits, so that the stack can get on with it. */
+static int seg_recv(seg_t *s, int timeout) {
+    uint8 buf[FRAME_MAX];
+    uint64 end = timer_ms_gettime64() + timeout;
+    long len;
+    int left;
+
+    while((left = (int)(end - timer_ms_gettime64())) > 0) {
+        nethost_leave();
+        len = host_wait_readable(peer, left) > 0 ?
+              host_read(peer, buf, sizeof(buf)) : 0;
+        nethost_enter();
+
+        if(len >= 42 && buf[12] == 0x08 && buf[13] == 0x06 && buf[21] == 1 &&
+           !memcmp(buf + 38, peer_ip, 4)) {
+            arp_reply(buf);
+            continue;
+        }
+
+        if(len > 0 && !seg_parse(buf, (int)len, s)) {
+            seg_print("<", s);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/* Fill in a segment from the peer on a connection. The window is given in
+   bytes, and gets scaled here. */
+static void conn_seg(conn_t *c, seg_t *s, uint8 flags, uint32 seq,
+                     const void *data, int len, uint32 wnd) {
+    memset(s, 0, sizeof(seg_t));
+    s->sport = c->port;
+    s->dport = c->kport;
+    s->seq = seq;
+    s->ack = c->rcv_nxt;
+    s->flags = flags;
+    s->wnd = (uint16)(wnd >> c->wscale);
+    s->has_ts = 1;
+    s->tsval = c->ts;
+    s->tsecr = c->ts_recent;
+    s->len = len;
+
+    if(len)
+        memcpy(s->data, data, len);
+}
+
+static void conn_ack(conn_t *c, uint32 wnd) {
+    seg_t s;
+
+    conn_seg(c, &s, SEG_ACK, c->snd_nxt, NULL, 0, wnd);
+    seg_send(&s);
+}
+
+/* Wait for the next segment on a connection. */
+static int conn_recv(conn_t *c, seg_t *s, int timeout) {
+    uint64 end = timer_ms_gettime64() + timeout;
+    int left;
+
+    while((left = (int)(end - timer_ms_gettime64())) > 0) {
+        if(seg_recv(s, left) < 0)
+            break;
+
+        if(s->sport != c->kport || s->dport != c->port)
+            continue;
+
+        if(s->has_ts)
+            c->ts_recent = s->tsval;
+
+        return 0;
+    }
+
+    return -1;
+}
+
+static int tcp_listener(int port) {
+    struct sockaddr_in addr;
+    int sock;
+
+    if((sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+       listen(sock, 4) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+static void *accept_thd(void *data) {
+    return (void *)(intptr_t)accept((int)(intptr_t)data, NULL, NULL);
+}
+
+/* Open a connection from the peer to a listening socket, offering window
+   scaling, SACK and timestamps. The stack doesn't answer the <SYN> until
+   accept() is called, so that happens on another thread. */
+static int conn_open(conn_t *c, int lsock, uint16 port, uint16 kport,
+                     int wscale, uint32 wnd) {
+    kthread_t *thd;
+    seg_t s;
+    void *rv;
+    int ok = 0;
+
+    memset(c, 0, sizeof(conn_t));
+    c->port = port;
+    c->kport = kport;
+    c->snd_nxt = 1000000;
+    c->wscale = wscale;
+    c->ts = 5000;
+    c->ksock = -1;
+
+    thd = thd_create(0, accept_thd, (void *)(intptr_t)lsock);
+
+    conn_seg(c, &s, SEG_SYN, c->snd_nxt++, NULL, 0, 0);
+    s.wnd = (uint16)(wnd > 0xFFFF ? 0xFFFF : wnd);
+    s.mss = 1460;
+    s.wscale = wscale;
+    s.sack_ok = 1;
+    seg_send(&s);
+
+    if(!conn_recv(c, &s, 1000) && s.flags == (SEG_SYN | SEG_ACK) &&
+       s.ack == c->snd_nxt && s.has_ts && s.sack_ok && s.wscale >= 0) {
+        c->rcv_nxt = s.seq + 1;
+        ++c->ts;
+        conn_ack(c, wnd);
+        ok = 1;
+    }
+
+    thd_join(thd, &rv);
+    c->ksock = (int)(intptr_t)rv;
+
+    if(!ok || c->ksock < 0) {
+        if(c->ksock >= 0)
+            close(c->ksock);
+
+        return -1;
+    }
+
+    return 0;
+}
+
+static void fill(uint8 *buf, int len, int seed) {
+    int i;
+
+    for(i = 0; i < len; ++i)
+        buf[i] = (uint8)(i * 7 + seed);
+}
+
+/* Send everything given to the stack's end of a connection, then close it if
+   asked to. */
+typedef struct {
+    int sock;
+    const uint8 *buf;
+    int len;
+    int close;
+} send_job_t;
+
+static void *send_thd(void *data) {
+    send_job_t *job = (send_job_t *)data;
+    const uint8 *p = job->buf;
+    int left = job->len;
+    ssize_t rv;
+
+    while(left > 0 && (rv = send(job->sock, p, left, 0)) > 0) {
+        p += rv;
+        left -= rv;
+    }
+
+    if(job->close)
+        close(job->sock);
+
+    return (void *)(intptr_t)left;
+}
+
+/* The stack can't send anything until the peer opens its window, so the
+   close() here happens with all of the data still queued. Everything sent
+   after that has to keep using the options negotiated for the connection. */
+static void test_close_queued(void) {
+    static uint8 out[6000], in[sizeof(out)];
+    send_job_t job;
+    kthread_t *thd;
+    conn_t c;
+    seg_t s;
+    void *rv;
+    int lsock, got = 0, segs = 0, all_ts = 1, fin = 0;
+
+    if((lsock = tcp_listener(PORT_CLOSE)) < 0 ||
+       conn_open(&c, lsock, 40000, PORT_CLOSE, 2, 0) < 0) {
+        check(0, "Open a connection from the peer");
+        return;
+    }
+
+    fill(out, sizeof(out), 1);
+    job.sock = c.ksock;
+    job.buf = out;
+    job.len = sizeof(out);
+    job.close = 1;
+    thd = thd_create(0, send_thd, &job);
+    thd_join(thd, &rv);
+
+    check(rv == 0, "send() then close() with the window shut");
+
+    /* Now open the window a bit at a time, and take whatever comes. */
+    conn_ack(&c, 1000);
+
+    while(!fin && !conn_recv(&c, &s, 2000)) {
+        ++segs;
+        all_ts = all_ts && s.has_ts;
+
+        if(s.len && s.seq == c.rcv_nxt && got + s.len <= (int)sizeof(in)) {
+            memcpy(in + got, s.data, s.len);
+            got += s.len;
+            c.rcv_nxt += s.len;
+        }
+
+        if((s.flags & SEG_FIN) && s.seq + s.len == c.rcv_nxt) {
+            ++c.rcv_nxt;
+            fin = 1;
+        }
+
+        ++c.ts;
+        conn_ack(&c, 1000);
+    }
+
+    check(fin && got == (int)sizeof(out) && !memcmp(in, out, sizeof(out)),
+          "All of the queued data arrives before the FIN");
+    check(segs > 0 && all_ts, "Everything sent after close() has timestamps");
+
+    /* Close our side, and make sure that gets ACKed properly too. */
+    conn_seg(&c, &s, SEG_FIN | SEG_ACK, c.snd_nxt++, NULL, 0, 1000);
+    seg_send(&s);
+
+    check(!conn_recv(&c, &s, 1000) && s.ack == c.snd_nxt && s.has_ts &&
+          !(s.flags & SEG_FIN), "Our FIN gets ACKed, with a timestamp");
+
+    close(lsock);
+}
+
+/* Send segment i of a stream cut into OOO_SEG byte pieces, with a fresh
+   timestamp. Returns the timestamp it was sent with. */
+#define OOO_SEG         500
+#define OOO_CNT         8
+
+static uint32 ooo_send(conn_t *c, uint32 base, const uint8 *data, int i) {
+    seg_t s;
+
+    ++c->ts;
+    conn_seg(c, &s, SEG_ACK, base + i * OOO_SEG, data + i * OOO_SEG, OOO_SEG,
+             65535);
+    seg_send(&s);
+
+    return c->ts;
+}
+
+/* Wait for the ACK for something the peer just sent. */
+static int ooo_ack(conn_t *c, seg_t *s) {
+    while(!conn_recv(c, s, 500)) {
+        if(!s->len && s->flags == SEG_ACK)
+            return 0;
+    }
+
+    return -1;
+}
+
+/* Check that an ACK covers up to segment ack and SACKs exactly the segment
+   ranges given, in order, and echoes the timestamp tsecr. */
+static int ooo_match(const seg_t *s, uint32 base, int ack, uint32 tsecr,
+                     int nsack, const int (*blk)[2]) {
+    int i;
+
+    if(s->ack != base + ack * OOO_SEG || !s->has_ts || s->tsecr != tsecr ||
+       s->nsack != nsack)
+        return 0;
+
+    for(i = 0; i < nsack; ++i) {
+        if(s->sack[i][0] != base + blk[i][0] * OOO_SEG ||
+           s->sack[i][1] != base + blk[i][1] * OOO_SEG)
+            return 0;
+    }
+
+    return 1;
+}
+
+/* The peer sends a stream with segment 1 lost, segments 2 and 4 ahead of
+   time, segment 2 twice, and the tail end swapped around. The stack should
+   answer each out-of-order segment with a duplicate ACK right away, putting
+   the block that segment landed in first (RFC 2018, section 4) and echoing
+   the timestamp of the last segment that was in order (RFC 7323, section
+   4.3). */
+static void test_ooo(void) {
+    static const int sack_2[][2] = { { 2, 3 } };
+    static const int sack_4[][2] = { { 4, 5 }, { 2, 3 } };
+    static const int sack_2again[][2] = { { 2, 3 }, { 4, 5 } };
+    static const int sack_3[][2] = { { 2, 5 } };
+    static const int sack_6[][2] = { { 6, 7 } };
+    static uint8 out[OOO_SEG * OOO_CNT], in[sizeof(out)];
+    uint32 base, ts0, ts1;
+    conn_t c;
+    seg_t s;
+    int lsock, got = 0, rv;
+
+    if((lsock = tcp_listener(PORT_OOO)) < 0 ||
+       conn_open(&c, lsock, 40001, PORT_OOO, 0, 65535) < 0) {
+        check(0, "Open a connection from the peer");
+        return;
+    }
+
+    fill(out, sizeof(out), 2);
+    base = c.snd_nxt;
+
+    /* Segment 0 is in order, and its ACK can wait. Segment 1 gets lost. */
+    ts0 = ooo_send(&c, base, out, 0);
+
+    ooo_send(&c, base, out, 2);
+    check(!ooo_ack(&c, &s) && ooo_match(&s, base, 1, ts0, 1, sack_2),
+          "Out-of-order segment gets a duplicate ACK with SACK");
+
+    ooo_send(&c, base, out, 4);
+    check(!ooo_ack(&c, &s) && ooo_match(&s, base, 1, ts0, 2, sack_4),
+          "Newest SACK block comes first");
+
+    ooo_send(&c, base, out, 2);
+    check(!ooo_ack(&c, &s) && ooo_match(&s, base, 1, ts0, 2, sack_2again),
+          "Duplicate segment moves its block back to the front");
+
+    ooo_send(&c, base, out, 3);
+    check(!ooo_ack(&c, &s) && ooo_match(&s, base, 1, ts0, 1, sack_3),
+          "Adjacent SACK blocks merge");
+
+    /* The retransmission fills the hole, and gets ACKed right away. */
+    ts1 = ooo_send(&c, base, out, 1);
+    check(!ooo_ack(&c, &s) && ooo_match(&s, base, 5, ts1, 0, NULL),
+          "Filling the hole ACKs everything, echoing its timestamp");
+
+    /* Something old turns up again. */
+    ooo_send(&c, base, out, 0);
+    check(!ooo_ack(&c, &s) && s.ack == base + 5 * OOO_SEG && !s.nsack,
+          "Old duplicate gets a plain ACK");
+
+    /* And the rest shows up swapped around. */
+    ooo_send(&c, base, out, 6);
+    check(!ooo_ack(&c, &s) && ooo_match(&s, base, 5, ts1, 1, sack_6),
+          "Second hole gets SACKed");
+
+    ts1 = ooo_send(&c, base, out, 5);
+    check(!ooo_ack(&c, &s) && ooo_match(&s, base, 7, ts1, 0, NULL),
+          "Second hole fills");
+
+    /* The last segment is in order, so its ACK might be held back for a bit,
+       but it has to turn up. */
+    ooo_send(&c, base, out, 7);
+    c.snd_nxt = base + sizeof(out);
+
+    check(!ooo_ack(&c, &s) && s.ack == c.snd_nxt && !s.nsack,
+          "Delayed ACK for the last segment");
+
+    while(got < (int)sizeof(out) &&
+          (rv = recv(c.ksock, in + got, sizeof(in) - got, MSG_DONTWAIT)) > 0)
+        got += rv;
+
+    check(got == (int)sizeof(out) && !memcmp(in, out, sizeof(out)),
+          "recv() gets all of the data back in order");
+
+    close(c.ksock);
+    close(lsock);
+}
+
+/* The request and response sizes, and how long the peer holds back its ACK
+   when it's waiting for more of the response, like a stack that delays its
+   ACKs would. */
+#define RR_ROUNDS       20
+#define RR_REQ          64
+#define RR_HDR          16
+#define RR_BODY         200
+#define RR_DELACK       40
+
+enum { RR_DEFAULT, RR_NODELAY, RR_CORK };
+
+typedef struct {
+    int sock;
+    int mode;
+} rr_job_t;
+
+/* The stack's end: read each request, and answer it with a header and a body,
+   written separately. */
+static void *rr_server_thd(void *data) {
+    rr_job_t *job = (rr_job_t *)data;
+    uint8 req[RR_REQ], resp[RR_HDR + RR_BODY];
+    int round, got, rv, on = 1, off = 0;
+
+    if(job->mode == RR_NODELAY)
+        setsockopt(job->sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    fill(resp, sizeof(resp), 3);
+
+    for(round = 0; round < RR_ROUNDS; ++round) {
+        for(got = 0; got < RR_REQ; got += rv) {
+            if((rv = recv(job->sock, req + got, RR_REQ - got, 0)) <= 0)
+                return (void *)(intptr_t)-1;
+        }
+
+        if(job->mode == RR_CORK)
+            setsockopt(job->sock, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+
+        if(send(job->sock, resp, RR_HDR, 0) != RR_HDR ||
+           send(job->sock, resp + RR_HDR, RR_BODY, 0) != RR_BODY)
+            return (void *)(intptr_t)-1;
+
+        if(job->mode == RR_CORK)
+            setsockopt(job->sock, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+    }
+
+    return NULL;
+}
+
+/* Run RR_ROUNDS requests and responses, counting the segments the stack
+   sends. Returns the average time per round in microseconds, or 0 if it
+   didn't work. */
+static uint64 rr_run(int mode, int *data_segs, int *pure_acks) {
+    static uint8 req[RR_REQ];
+    rr_job_t job;
+    kthread_t *thd;
+    uint64 start, t;
+    conn_t c;
+    seg_t s;
+    void *rv;
+    int lsock, round, got, ok = 1;
+
+    *data_segs = *pure_acks = 0;
+
+    if((lsock = tcp_listener(PORT_RR + mode)) < 0 ||
+       conn_open(&c, lsock, 40002 + mode, PORT_RR + mode, 0, 65535) < 0)
+        return 0;
+
+    job.sock = c.ksock;
+    job.mode = mode;
+    thd = thd_create(0, rr_server_thd, &job);
+    fill(req, sizeof(req), 4);
+    start = timer_us_gettime64();
+
+    for(round = 0; ok && round < RR_ROUNDS; ++round) {
+        /* The request carries the ACK for the last response. */
+        ++c.ts;
+        conn_seg(&c, &s, SEG_ACK | SEG_PSH, c.snd_nxt, req, RR_REQ, 65535);
+        seg_send(&s);
+        c.snd_nxt += RR_REQ;
+
+        for(got = 0; ok && got < RR_HDR + RR_BODY;) {
+            if(conn_recv(&c, &s, RR_DELACK) < 0) {
+                /* Nothing more for a while, so ACK what's here. */
+                ++c.ts;
+                conn_ack(&c, 65535);
+
+                ok = !conn_recv(&c, &s, 1000);
+
+                if(!ok)
+                    break;
+            }
+
+            if(!s.len) {
+                ++*pure_acks;
+                continue;
+            }
+
+            ++*data_segs;
+
+            if(s.seq == c.rcv_nxt) {
+                got += s.len;
+                c.rcv_nxt += s.len;
+            }
+        }
+    }
+
+    t = timer_us_gettime64() - start;
+
+    ++c.ts;
+    conn_ack(&c, 65535);
+    thd_join(thd, &rv);
+    close(c.ksock);
+    close(lsock);
+
+    return ok && !rv ? t / RR_ROUNDS : 0;
+}
+
+/* Without delayed ACKs the stack sent a bare ACK for every request, and then
+   the response, for three segments a round. Now the ACK should ride along
+   with the response. The Nagle algorithm holds the body back until the peer
+   ACKs the header, which it only does once it gives up waiting for the rest.
+   TCP_NODELAY sends both right away, and TCP_CORK puts them together. */
+static void test_rr(void) {
+    static const char *names[] = { "default", "TCP_NODELAY", "TCP_CORK" };
+    int data[3], acks[3], mode;
+    uint64 us[3];
+
+    for(mode = RR_DEFAULT; mode <= RR_CORK; ++mode) {
+        us[mode] = rr_run(mode, &data[mode], &acks[mode]);
+
+        if(us[mode])
+            printf("%-12s %d rounds: %3d data segments, %2d bare ACKs, "
+                   "%6.2f ms a round\n", names[mode], RR_ROUNDS, data[mode],
+                   acks[mode], us[mode] / 1000.0);
+    }
+
+    check(us[RR_DEFAULT] && us[RR_NODELAY] && us[RR_CORK],
+          "Requests and responses over three connections");
+    check(!acks[RR_DEFAULT] && !acks[RR_NODELAY] && !acks[RR_CORK],
+          "ACKs for the requests ride along with the responses");
+    check(data[RR_DEFAULT] == 2 * RR_ROUNDS &&
+          us[RR_DEFAULT] >= RR_DELACK * 1000,
+          "Nagle holds the body back until the header is ACKed");
+    check(data[RR_NODELAY] == 2 * RR_ROUNDS &&
+          us[RR_NODELAY] < RR_DELACK * 1000,
+          "TCP_NODELAY sends the header and body right away");
+    check(data[RR_CORK] == RR_ROUNDS && us[RR_CORK] < RR_DELACK * 1000,
+          "TCP_CORK sends each response in one segment");
+}
+
+/* What the peer has seen of a stream the stack is sending it. */
+#define LOSS_LEN        (40 * 1024)
+#define LOSS_MAX_SEGS   64
+#define LOSS_MAX_RX     8
+
+typedef struct {
+    uint32 base;                    /* Sequence number of the first byte */
+    uint32 max;                     /* Highest offset seen so far */
+    uint32 acked;                   /* Highest offset ACKed so far */
+    int nsegs;                      /* Segments seen for the first time */
+    uint32 segs[LOSS_MAX_SEGS];     /* Where each of them started */
+    int nrx;                        /* Retransmissions seen */
+    uint32 rx[LOSS_MAX_RX];         /* Where each of them started */
+    uint8 have[LOSS_LEN];
+    uint8 in[LOSS_LEN];
+} loss_t;
+
+/* Take whatever the stack sends until it goes quiet for the given number of
+   milliseconds. Returns how many segments came in. */
+static int loss_take(conn_t *c, loss_t *l, int quiet) {
+    uint32 off;
+    seg_t s;
+    int cnt = 0;
+
+    while(!conn_recv(c, &s, quiet)) {
+        ++cnt;
+        off = s.seq - l->base;
+
+        if(!s.len || off + s.len > LOSS_LEN)
+            continue;
+
+        if(off < l->max) {
+            if(l->nrx < LOSS_MAX_RX)
+                l->rx[l->nrx] = off;
+
+            ++l->nrx;
+        }
+        else {
+            if(l->nsegs < LOSS_MAX_SEGS)
+                l->segs[l->nsegs] = off;
+
+            ++l->nsegs;
+            l->max = off + s.len;
+        }
+
+        memcpy(l->in + off, s.data, s.len);
+        memset(l->have + off, 1, s.len);
+    }
+
+    return cnt;
+}
+
+/* How far the peer has everything. */
+static uint32 loss_cumack(const loss_t *l) {
+    uint32 off = 0;
+
+    while(off < LOSS_LEN && l->have[off])
+        ++off;
+
+    return off;
+}
+
+static void loss_ack(conn_t *c, loss_t *l, uint32 off) {
+    c->rcv_nxt = l->base + off;
+    l->acked = off;
+    ++c->ts;
+    conn_ack(c, 65535);
+}
+
+/* Forget that the segment that starts at off ever arrived. Returns the next
+   segment, which it has to have been followed by. */
+static int loss_drop(loss_t *l, uint32 off) {
+    int i;
+
+    for(i = 0; i + 1 < l->nsegs && i + 1 < LOSS_MAX_SEGS; ++i) {
+        if(l->segs[i] == off) {
+            memset(l->have + off, 0, l->segs[i + 1] - off);
+            return i + 1;
+        }
+    }
+
+    return -1;
+}
+
+static int loss_info(conn_t *c, struct tcp_info *ti) {
+    socklen_t len = sizeof(struct tcp_info);
+
+    return getsockopt(c->ksock, IPPROTO_TCP, TCP_INFO, ti, &len);
+}
+
+/* The peer lets the congestion window open up a bit, then loses the first
+   and third segments of the next flight. Three duplicate ACKs should get the
+   first one sent again and start fast recovery. Then each partial ACK should
+   get the next hole sent again right away, and take what it acks out of the
+   window, adding one segment back only if it acked at least a segment's worth
+   (RFC 6582, section 3.2). No SACK blocks are sent, so this is plain
+   NewReno. */
+static void test_loss(void) {
+    static loss_t l;
+    static uint8 out[LOSS_LEN];
+    struct tcp_info ti;
+    net_tcp_stats_t st0, st1;
+    send_job_t job;
+    kthread_t *thd;
+    conn_t c;
+    void *rv;
+    uint32 seg, hole1, hole2, cwnd, ssthresh;
+    uint64 end;
+    int lsock, i, next, ok;
+
+    if((lsock = tcp_listener(PORT_LOSS)) < 0 ||
+       conn_open(&c, lsock, 40005, PORT_LOSS, 0, 65535) < 0) {
+        check(0, "Open a connection from the peer");
+        return;
+    }
+
+    memset(&l, 0, sizeof(l));
+    l.base = c.rcv_nxt;
+    st0 = net_tcp_get_stats();
+
+    /* Make room for all of the data up front, so that it's only ever the
+       congestion window holding it back. */
+    i = sizeof(out);
+    setsockopt(c.ksock, SOL_SOCKET, SO_SNDBUF, &i, sizeof(i));
+
+    fill(out, sizeof(out), 5);
+    job.sock = c.ksock;
+    job.buf = out;
+    job.len = sizeof(out);
+    job.close = 0;
+    thd = thd_create(0, send_thd, &job);
+
+    /* Slow start: ACK each flight as it comes in. */
+    for(i = 0; i < 4; ++i) {
+        loss_take(&c, &l, 20);
+        loss_ack(&c, &l, loss_cumack(&l));
+    }
+
+    /* Take the flight that's out now, and lose two segments of it. */
+    loss_take(&c, &l, 30);
+    loss_info(&c, &ti);
+    seg = ti.tcpi_snd_mss;
+    ssthresh = ti.tcpi_unacked / 2 > 2 * seg ? ti.tcpi_unacked / 2 : 2 * seg;
+
+    hole1 = l.acked;
+    next = loss_drop(&l, hole1);
+    hole2 = next > 0 ? l.segs[next + 1] : 0;
+
+    check(next > 0 && next + 3 < l.nsegs && hole2 - hole1 >= seg &&
+          loss_drop(&l, hole2) > 0 && !l.nrx,
+          "Slow start opens the window, and two segments get lost");
+
+    /* Three duplicate ACKs. */
+    for(i = 0; i < 3; ++i)
+        loss_ack(&c, &l, hole1);
+
+    loss_take(&c, &l, 20);
+    loss_info(&c, &ti);
+    st1 = net_tcp_get_stats();
+
+    check(l.nrx == 1 && l.rx[0] == hole1 &&
+          st1.fast_retransmits == st0.fast_retransmits + 1,
+          "Third duplicate ACK sends the lost segment again");
+    check(ti.tcpi_snd_ssthresh == ssthresh &&
+          ti.tcpi_snd_cwnd == ssthresh + 3 * seg,
+          "Fast recovery halves the window and inflates it");
+
+    /* A partial ACK up to the second hole, for more than a segment. */
+    cwnd = ti.tcpi_snd_cwnd;
+    loss_ack(&c, &l, hole2);
+    loss_take(&c, &l, 20);
+    loss_info(&c, &ti);
+
+    check(l.nrx == 2 && l.rx[1] == hole2,
+          "Partial ACK sends the next hole again");
+    check(ti.tcpi_snd_cwnd == cwnd - (hole2 - hole1) + seg,
+          "Partial ACK deflates the window, adding back a segment");
+
+    /* One for less than a segment: nothing gets added back. */
+    cwnd = ti.tcpi_snd_cwnd;
+    loss_ack(&c, &l, hole2 + 100);
+    loss_take(&c, &l, 20);
+    loss_info(&c, &ti);
+
+    check(l.nrx == 3 && l.rx[2] == hole2 + 100 &&
+          ti.tcpi_snd_cwnd == cwnd - 100,
+          "Partial ACK of less than a segment deflates by just that");
+
+    /* Everything up to where the recovery started, and then some. */
+    loss_ack(&c, &l, loss_cumack(&l));
+    loss_take(&c, &l, 20);
+    loss_info(&c, &ti);
+
+    check(ti.tcpi_snd_cwnd <= ti.tcpi_snd_ssthresh &&
+          ti.tcpi_snd_ssthresh == ssthresh,
+          "Full ACK ends recovery with the window deflated");
+
+    /* Now take the rest, ACKing as it comes. */
+    end = timer_ms_gettime64() + 5000;
+
+    while(l.acked < LOSS_LEN && timer_ms_gettime64() < end) {
+        if(loss_cumack(&l) != l.acked)
+            loss_ack(&c, &l, loss_cumack(&l));
+
+        loss_take(&c, &l, 5);
+    }
+
+    thd_join(thd, &rv);
+    loss_info(&c, &ti);
+    st1 = net_tcp_get_stats();
+    ok = l.acked == LOSS_LEN && !memcmp(l.in, out, LOSS_LEN);
+
+    check(ok && rv == 0, "All of the data arrives");
+    check(ti.tcpi_total_retrans == 3 && l.nrx == 3 &&
+          st1.timeouts == st0.timeouts,
+          "Nothing else sent twice, and no timeouts");
+
+    close(c.ksock);
+    close(lsock);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options]\n"
+            "  -v        Print every segment\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+
+    while((opt = getopt(argc, argv, "vh")) != -1) {
+        switch(opt) {
+            case 'v':
+                verbose = 1;
+                break;
+
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    dbglog_set_level(DBG_WARNING);
+
+    if(nethost_init() < 0) {
+        perror("nethost_init");
+        return EXIT_FAILURE;
+    }
+
+    if(!(nif = nethost_if_pipe(&peer))) {
+        perror("nethost_if_pipe");
+        return EXIT_FAILURE;
+    }
+
+    net_set_default(nif);
+    net_init((kos_ip[0] << 24) | (kos_ip[1] << 16) | (kos_ip[2] << 8) |
+             kos_ip[3]);
+    nif->netmask[0] = nif->netmask[1] = nif->netmask[2] = 255;
+    net_arp_insert(nif, peer_mac, peer_ip, 0);
+
+    test_close_queued();
+    test_ooo();
+    test_rr();
+    test_loss();
+
+    printf("%d check%s FAILED\n", failures, failures == 1 ? "" : "s");
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
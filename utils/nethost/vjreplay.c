@@ -0,0 +1,196 @@
+/* KallistiOS ##version##
+
+   utils/nethost/vjreplay.c
+   Copyright (C) 2026 The KOS Team and contributors.
+
+*/
+
+/* Runs the TCP flows from pcap files through libppp's Van Jacobson header
+   compression and back out again, checks that what comes out matches what
+   went in, and reports how many bytes the compression saved.
+
+   Everything goes through the one compressor, as if it were all being sent
+   the same way over the link. Each direction of a connection gets a slot of
+   its own anyway. With -l, some of the packets get "lost" on the way, to
+   check that the decompressor recovers. Packets that come out wrong after a
+   loss are fine as long as their TCP checksum is bad too, since TCP will drop
+   them and the retransmission puts things right. The IP ID isn't covered by
+   that checksum, so a loss can leave that wrong, but nothing cares about the
+   ID on a packet that isn't fragmented. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <kos/net.h>
+
+#include "host_os.h"
+#include "ppp_internal.h"
+#include "vjcomp.h"
+#include "net_ipv4.h"
+
+#define FRAME_MAX   65536
+
+static vj_state_t tx, rx;
+static uint8_t frame[FRAME_MAX], wire[FRAME_MAX], out[FRAME_MAX + VJ_MAX_HDR];
+
+/* Totals, across all of the files. */
+static uint32_t ip_pkts, tcp_pkts, lost, matched, dropped, caught, id_only;
+static uint32_t wrong;
+static uint64_t ip_bytes, wire_bytes;
+
+static inline uint32_t get16(const uint8_t *p) {
+    return (p[0] << 8) | p[1];
+}
+
+static int tcp_cksum_ok(const uint8_t *ip, size_t len) {
+    size_t ihl = (ip[0] & 0x0f) << 2;
+    in_addr_t src, dst;
+
+    memcpy(&src, ip + 12, 4);
+    memcpy(&dst, ip + 16, 4);
+
+    return !net_ipv4_checksum(ip + ihl, len - ihl,
+                              net_ipv4_checksum_pseudo(src, dst, IPPROTO_TCP,
+                                                       len - ihl));
+}
+
+static void replay_packet(const uint8_t *ip, size_t len, int loss) {
+    uint16_t proto;
+    size_t hlen, skip, wlen;
+    ssize_t n;
+
+    ++ip_pkts;
+    ip_bytes += len;
+
+    proto = _ppp_vj_compress(&tx, ip, len, wire, &hlen, &skip);
+
+    if(proto == PPP_PROTOCOL_IPv4) {
+        wire_bytes += len;
+        return;
+    }
+
+    ++tcp_pkts;
+    memcpy(wire + hlen, ip + skip, len - skip);
+    wlen = hlen + len - skip;
+    wire_bytes += wlen;
+
+    if(loss && rand() % 100 < loss) {
+        _ppp_vj_input_error(&rx);
+        ++lost;
+        return;
+    }
+
+    if((n = _ppp_vj_uncompress(&rx, proto, wire, wlen, out)) < 0)
+        ++dropped;
+    else if((size_t)n == len && !memcmp(out, ip, len))
+        ++matched;
+    else if(!tcp_cksum_ok(out, (size_t)n))
+        ++caught;
+    else if((size_t)n == len && !memcmp(out, ip, 4) &&
+            !memcmp(out + 6, ip + 6, 4) && !memcmp(out + 12, ip + 12, len - 12))
+        ++id_only;
+    else
+        ++wrong;
+}
+
+static int replay_file(const char *path, int loss) {
+    host_pcap_t *in;
+    size_t iplen;
+    int len;
+
+    if(!(in = host_pcap_open_read(path)))
+        return -1;
+
+    while((len = host_pcap_read(in, frame, sizeof(frame), NULL)) != 0) {
+        /* Only IPv4 over ethernet is of any interest. */
+        if(len < 34 || get16(frame + 12) != 0x0800)
+            continue;
+
+        iplen = get16(frame + 16);
+
+        if(iplen < 20 || iplen > (size_t)len - 14)
+            continue;
+
+        replay_packet(frame + 14, iplen, loss);
+    }
+
+    host_pcap_close(in);
+
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options] file.pcap...\n"
+            "  -s slots  Connection slots to use (default: %d)\n"
+            "  -c        Don't leave out the connection number\n"
+            "  -l pct    Lose this percentage of the compressed packets\n",
+            prog, VJ_MAX_SLOTS);
+}
+
+int main(int argc, char *argv[]) {
+    int opt, slots = VJ_MAX_SLOTS, comp_cid = 1, loss = 0;
+
+    while((opt = getopt(argc, argv, "s:cl:h")) != -1) {
+        switch(opt) {
+            case 's':
+                slots = atoi(optarg);
+                break;
+
+            case 'c':
+                comp_cid = 0;
+                break;
+
+            case 'l':
+                loss = atoi(optarg);
+                break;
+
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if(optind >= argc || slots < 1 || slots > VJ_MAX_SLOTS || loss < 0 ||
+       loss > 100) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    _ppp_vj_init(&tx, slots, 0, comp_cid);
+    _ppp_vj_init(&rx, 0, slots, comp_cid);
+    srand(1144);
+
+    for(; optind < argc; ++optind) {
+        if(replay_file(argv[optind], loss) < 0) {
+            perror(argv[optind]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%u IPv4 packets, %u through the compressor (%u compressed, "
+           "%u uncompressed)\n", ip_pkts, tcp_pkts, tx.stats.out_compressed,
+           tx.stats.out_uncompressed);
+
+    if(tx.stats.out_compressed)
+        printf("Headers: %u bytes down to %u (%.1f bytes each)\n",
+               tx.stats.out_hdr_bytes, tx.stats.out_comp_bytes,
+               (double)tx.stats.out_comp_bytes / tx.stats.out_compressed);
+
+    if(ip_bytes)
+        printf("Total: %llu bytes down to %llu, %.1f%% saved\n",
+               (unsigned long long)ip_bytes, (unsigned long long)wire_bytes,
+               100.0 * (ip_bytes - wire_bytes) / ip_bytes);
+
+    printf("Decompressed: %u matched, %u dropped, %u bad checksum, %u wrong "
+           "IP ID, %u wrong (%u lost)\n", matched, dropped, caught, id_only,
+           wrong, lost);
+
+    /* Nothing should ever come out wrong without TCP noticing, and without
+       any losses, everything should come out right. */
+    if(wrong || (!loss && matched != tcp_pkts))
+        return EXIT_FAILURE;
+
+    return 0;
+}